@@ -0,0 +1,209 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBADCBLOQUES_H
+#define LIBADCBLOQUES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libreserva.h"
+
+#define ADC_BLOQUE_MAX_PALABRAS 1024 // Maximo de muestras (sumando todos los canales) por bloque, limite del DMA del I2S
+#define ADC_MAX_CANALES 8            // El ADC1 tiene 8 canales
+#define ADC_RESERVA_BLOQUES 2        // Bloques de la reserva del DMA: el manejador usa uno a la vez (2 x 2 KB de RAM interna)
+
+/**
+ * Interfaz de una fuente de bloques de muestras del ADC. En el ESP32 la implementa el
+ * I2S en modo ADC con DMA (FuenteADCI2S en libadcesp32.cpp) y en el computador la
+ * implementa FuenteADCSimulada, asi que el codigo que consume los bloques es el mismo.
+ * Los bloques se entregan intercalados por canal en el orden de escaneo:
+ * x0 y0 z0 x1 y1 z1 ...
+ */
+class FuenteADCBloques {
+public:
+  virtual ~FuenteADCBloques() {}
+
+  /**
+   * Funcion que configura y arranca la adquisicion continua
+   * @param samplingFreq Frecuencia de muestreo por canal en Hz
+   * @param canales Lista de canales del ADC1 a escanear
+   * @param numCanales Numero de canales de la lista
+   * @param muestrasPorBloque Muestras por canal en cada bloque
+   * @return true si la fuente quedo funcionando
+   */
+  virtual bool iniciar(uint32_t samplingFreq, const uint8_t *canales, uint8_t numCanales, size_t muestrasPorBloque) = 0;
+
+  /**
+   * Funcion que espera el siguiente bloque completo
+   * @param destino Donde se escriben las muestras intercaladas (muestrasPorBloque * numCanales)
+   * @param timeoutMs Tiempo maximo de espera en milisegundos
+   * @return Numero de muestras por canal entregadas (0 si se vencio el tiempo)
+   */
+  virtual size_t esperarBloque(uint16_t *destino, uint32_t timeoutMs) = 0;
+
+  /**
+   * Funcion que detiene la adquisicion
+   */
+  virtual void detener() = 0;
+
+  uint32_t bloquesPerdidos = 0; // Bloques que se sobreescribieron porque nadie los leyo a tiempo
+};
+
+/**
+ * Funcion que ordena las palabras crudas del ADC por I2S: cada palabra trae el numero de
+ * canal en los 4 bits altos y el dato de 12 bits en los bajos, y el DMA puede entregar
+ * los pares de palabras intercambiados, asi que cada dato se ubica segun su canal y no
+ * segun su posicion.
+ * @param crudo Palabras leidas del DMA
+ * @param n Numero de palabras
+ * @param canales Lista de canales en el orden de escaneo
+ * @param numCanales Numero de canales de la lista
+ * @param destino Donde se escriben las muestras intercaladas por canal
+ * @param maxMuestras Capacidad del destino en muestras por canal
+ * @return Numero de muestras completas por canal
+ */
+inline size_t desempaquetarADCI2S(const uint16_t *crudo, size_t n, const uint8_t *canales, uint8_t numCanales,
+                                  uint16_t *destino, size_t maxMuestras) {
+  int8_t posicion[16];  // Posicion de cada canal dentro de la muestra intercalada
+  size_t cuenta[ADC_MAX_CANALES] = {0};
+  for (uint8_t i = 0; i < 16; i++) posicion[i] = -1;
+  for (uint8_t i = 0; i < numCanales; i++) posicion[canales[i] & 0x0F] = (int8_t)i;
+  for (size_t i = 0; i < n; i++) {
+    int8_t p = posicion[crudo[i] >> 12];
+    if (p < 0 || cuenta[p] >= maxMuestras) continue;  // Canal desconocido o bloque lleno
+    destino[cuenta[p]++ * numCanales + p] = crudo[i] & 0x0FFF;
+  }
+  size_t completas = maxMuestras;
+  for (uint8_t i = 0; i < numCanales; i++)
+    if (cuenta[i] < completas) completas = cuenta[i];
+  return completas;
+}
+
+/**
+ * Fuente de bloques simulada para probar en el computador el codigo que consume los bloques.
+ * Genera las palabras en el mismo formato que el DMA del I2S (incluido el intercambio de
+ * pares) y las ordena con la misma funcion desempaquetarADCI2S().
+ */
+class FuenteADCSimulada : public FuenteADCBloques {
+public:
+  /**
+   * @param senal Funcion que da el valor de 12 bits del canal en la muestra n
+   */
+  explicit FuenteADCSimulada(uint16_t (*senal)(uint8_t canal, uint32_t n)) : generador(senal) {}
+
+  bool iniciar(uint32_t samplingFreq, const uint8_t *canalesEscaneo, uint8_t num, size_t muestrasPorBloque) override {
+    if (num == 0 || num > ADC_MAX_CANALES || muestrasPorBloque * num > ADC_BLOQUE_MAX_PALABRAS) return false;
+    frecuencia = samplingFreq;
+    numCanales = num;
+    porBloque = muestrasPorBloque;
+    for (uint8_t i = 0; i < num; i++) canales[i] = canalesEscaneo[i];
+    muestra = 0;
+    activa = true;
+    return true;
+  }
+
+  size_t esperarBloque(uint16_t *destino, uint32_t timeoutMs) override {
+    (void)timeoutMs;  // En simulacion el bloque siempre esta listo
+    if (!activa) return 0;
+    size_t n = porBloque * numCanales;
+    for (size_t i = 0; i < n; i++) {
+      uint8_t c = canales[i % numCanales];
+      crudo[i ^ 1] = (uint16_t)((c << 12) | (generador(c, muestra + i / numCanales) & 0x0FFF));  // Pares intercambiados como en el DMA real
+    }
+    if (n & 1) crudo[n - 1] = crudo[n];  // Con un numero impar de palabras la ultima no tiene pareja
+    muestra += porBloque;
+    return desempaquetarADCI2S(crudo, n, canales, numCanales, destino, porBloque);
+  }
+
+  void detener() override { activa = false; }
+
+  /**
+   * Instante simulado (en microsegundos) de la siguiente muestra
+   */
+  uint64_t tiempoUs() const { return frecuencia ? (uint64_t)muestra * 1000000ULL / frecuencia : 0; }
+
+private:
+  uint16_t (*generador)(uint8_t canal, uint32_t n);
+  uint16_t crudo[ADC_BLOQUE_MAX_PALABRAS + 1];
+  uint8_t canales[ADC_MAX_CANALES];
+  uint8_t numCanales = 0;
+  size_t porBloque = 0;
+  uint32_t frecuencia = 0;
+  uint32_t muestra = 0;
+  bool activa = false;
+};
+
+/**
+ * Bloque de muestras del ADC en la reserva: lo llena la fuente y lo lee el manejador en el mismo lugar
+ */
+struct BloqueMuestras {
+  uint64_t marcaTiempo;   // Instante de la ultima muestra del bloque
+  uint16_t muestras;      // Muestras por canal
+  uint8_t canales;        // Canales intercalados
+  uint16_t datos[ADC_BLOQUE_MAX_PALABRAS]; // x0 y0 z0 x1 y1 z1 ...
+};
+
+typedef ReservaBloques<BloqueMuestras, ADC_RESERVA_BLOQUES> ReservaBloquesADC;
+
+/**
+ * Recepcion de los bloques de una fuente en la reserva: la fuente escribe directamente en un bloque
+ * de la reserva y el manejador lo procesa ahi mismo. Solo la adquisicion por DMA usa la reserva; el
+ * serial, el LoRa y la flash reciben las muestras ya procesadas por la cadena (libprocesamiento.h),
+ * no los bloques crudos. Si la reserva se agotara el bloque se recibe en uno propio, asi la cadena
+ * nunca pierde muestras
+ */
+class ReceptorBloques {
+public:
+  explicit ReceptorBloques(ReservaBloquesADC &reservaBloques) : reserva(reservaBloques) {}
+
+  /**
+   * Funcion que espera el siguiente bloque de la fuente
+   * @param canales Canales intercalados que entrega la fuente
+   * @return El bloque con una referencia, o NULL si se vencio el tiempo. Se devuelve con soltar()
+   */
+  BloqueMuestras *esperar(FuenteADCBloques &fuente, uint8_t canales, uint32_t timeoutMs) {
+    BloqueMuestras *bloque = reserva.reservar();
+    if (!bloque) bloque = &propio;
+    size_t n = fuente.esperarBloque(bloque->datos, timeoutMs);
+    if (n == 0) {
+      if (bloque != &propio) reserva.liberar(bloque);
+      return NULL;
+    }
+    bloque->muestras = (uint16_t)n;
+    bloque->canales = canales;
+    return bloque;
+  }
+
+  /**
+   * Funcion que suelta la referencia de esperar() cuando el manejador termino con el bloque
+   */
+  void soltar(BloqueMuestras *bloque) {
+    if (bloque != &propio) reserva.liberar(bloque);  // El propio no es de la reserva (agotada, contado en agotados)
+  }
+
+private:
+  ReservaBloquesADC &reserva;
+  BloqueMuestras propio;
+};
+
+#endif
@@ -33,55 +33,129 @@
 #include "esp_err.h"
 #include "assert.h"
 #include "esp_adc_cal.h"
-
-hw_timer_t *timerADC = NULL;
-portMUX_TYPE DRAM_ATTR timerADCMux = portMUX_INITIALIZER_UNLOCKED;
-TaskHandle_t complexHandlerADCTask;
+#include <driver/i2s.h>
+#include <soc/syscon_struct.h>
+#include <string.h>
+#include "libadcbloques.h"
+#include "libhal.h"
+#include "libplanificador.h"
+#include "libinstrumentacion.h"
 
 void initAdc(uint32_t samplingFreq);
 
 int IRAM_ATTR local_adc1_read(int channel);
 void (*task_adc_handler)(void);
+int trabajoADC = -1;  // Trabajo del planificador que ejecuta el manejador del ADC
+#ifdef INSTRUMENTACION
+MedidorTarea *medidorBloques = NULL; // Medidas de la tarea que procesa los bloques del DMA
+#endif
+
+/**
+ * Fuente de bloques del ADC1 con el I2S0 en modo ADC: el controlador digital del SAR escanea
+ * los canales segun su tabla de patrones y el DMA llena los bloques sin intervencion de la CPU
+ */
+class FuenteADCI2S : public FuenteADCBloques {
+public:
+	bool iniciar(uint32_t samplingFreq, const uint8_t *canalesEscaneo, uint8_t num, size_t muestrasPorBloque) override {
+		if (num == 0 || num > ADC_MAX_CANALES || muestrasPorBloque * num > ADC_BLOQUE_MAX_PALABRAS) return false;
+		numCanales = num;
+		palabrasPorBloque = muestrasPorBloque * num;
+		for (uint8_t i = 0; i < num; i++) canales[i] = canalesEscaneo[i];
+
+		i2s_config_t config;
+		memset(&config, 0, sizeof(config));
+		config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN);
+		config.sample_rate = samplingFreq * num;  // El ADC convierte un canal a la vez, asi que la tasa total es la suma
+		config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+		config.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
+		config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+		config.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1 | ESP_INTR_FLAG_IRAM;  // Los bloques siguen llegando durante un borrado de la flash
+		config.dma_buf_count = DMA_BUFFERS;
+		config.dma_buf_len = palabrasPorBloque;  // Un buffer del DMA es exactamente un bloque
+		config.use_apll = false;
+		if (i2s_driver_install(I2S_NUM_0, &config, DMA_BUFFERS, &colaEventos) != ESP_OK) return false;
+
+		adc1_config_width(ADC_WIDTH_BIT_12);
+		for (uint8_t i = 0; i < num; i++) adc1_config_channel_atten((adc1_channel_t)canales[i], ADC_ATTEN_DB_11);
+		i2s_set_adc_mode(ADC_UNIT_1, (adc1_channel_t)canales[0]);
+		i2s_adc_enable(I2S_NUM_0);
+
+		// i2s_adc_enable() deja la tabla de patrones con un solo canal, asi que la escribimos despues.
+		// Cada patron es un byte: canal [7:4], ancho [3:2], atenuacion [1:0], el primero en el byte alto
+		uint32_t tabla[4] = {0, 0, 0, 0};
+		for (uint8_t i = 0; i < num; i++)
+			tabla[i / 4] |= (uint32_t)((canales[i] << 4) | (ADC_WIDTH_BIT_12 << 2) | ADC_ATTEN_DB_11) << (24 - 8 * (i % 4));
+		SYSCON.saradc_ctrl.sar1_patt_len = num - 1;
+		for (uint8_t i = 0; i < 4; i++) SYSCON.saradc_sar1_patt_tab[i] = tabla[i];
+		return true;
+	}
+
+	size_t esperarBloque(uint16_t *destino, uint32_t timeoutMs) override {
+		i2s_event_t evento;
+		if (xQueueReceive(colaEventos, &evento, pdMS_TO_TICKS(timeoutMs)) != pdTRUE) return 0;  // Dormimos hasta que el DMA complete un buffer
+		if (evento.type != I2S_EVENT_RX_DONE) return 0;
+		if (uxQueueMessagesWaiting(colaEventos) >= DMA_BUFFERS - 1) bloquesPerdidos++;  // El DMA ya dio la vuelta sobre buffers sin leer
+		size_t leidos = 0;
+		i2s_read(I2S_NUM_0, crudo, palabrasPorBloque * sizeof(uint16_t), &leidos, pdMS_TO_TICKS(timeoutMs));
+		return desempaquetarADCI2S(crudo, leidos / sizeof(uint16_t), canales, numCanales, destino, palabrasPorBloque / numCanales);
+	}
+
+	void detener() override {
+		i2s_adc_disable(I2S_NUM_0);
+		i2s_driver_uninstall(I2S_NUM_0);
+	}
+
+private:
+	static const int DMA_BUFFERS = 4;
+	QueueHandle_t colaEventos = NULL;
+	uint16_t crudo[ADC_BLOQUE_MAX_PALABRAS];
+	uint8_t canales[ADC_MAX_CANALES];
+	uint8_t numCanales = 0;
+	size_t palabrasPorBloque = 0;
+};
+
+FuenteADCI2S fuenteI2S;
+FuenteADCBloques *fuenteADC = &fuenteI2S;
+TaskHandle_t complexHandlerADCBloqueTask;
+void (*task_adc_block_handler)(const uint16_t *muestras, size_t numMuestras, uint8_t numCanales);
+ReservaBloquesADC reservaBloquesADC;  // Bloques ordenados por canal, estaticos en la RAM interna (nada de heap en la adquisicion)
+ReceptorBloques receptorBloques(reservaBloquesADC);
+uint8_t numCanalesBloque;
 
 
 int IRAM_ATTR local_adc1_read(int channel) {
 	uint16_t adc_value;
-	SENS.sar_meas_start1.sar1_en_pad = (1 << channel); // Solo un canal es seleccionado
-	while (SENS.sar_slave_addr1.meas_status != 0);
-	SENS.sar_meas_start1.meas1_start_sar = 0;
-	SENS.sar_meas_start1.meas1_start_sar = 1;
-	while (SENS.sar_meas_start1.meas1_done_sar == 0);
-	adc_value = SENS.sar_meas_start1.meas1_data_sar;
+	halSensSeleccionarPad(1 << channel); // Solo un canal es seleccionado
+	while (halSensOcupado());
+	halSensIniciarConversion();
+	while (!halSensConversionLista());
+	adc_value = halSensLeerDato();
 	return adc_value;
 }
 
 
-void complexHandlerADC(void *param) {
+void complexHandlerADCBloque(void *param) {
 	while (true) {
-		// Duerme hasta que la ISR nos de algo para hacer, o por 1 segundo
-
-		ulTaskNotifyTake(pdFALSE, pdMS_TO_TICKS(100000));
-		task_adc_handler();
+		// Duerme hasta que el DMA complete un bloque, o por 1 segundo
+		BloqueMuestras *bloque = receptorBloques.esperar(*fuenteADC, numCanalesBloque, 1000);
+		size_t n = bloque ? bloque->muestras : 0;
+#ifdef INSTRUMENTACION
+		// El DMA no pasa por una ISR propia: solo se mide la duracion de cada bloque contra su periodo
+		if (n == 0 && medidorBloques) medidorBloques->esperasAgotadas++;
+		uint32_t inicio = ciclosInstrumentacion();
+#endif
+		if (bloque) {
+			bloque->marcaTiempo = halMicros();
+			task_adc_block_handler(bloque->datos, n, numCanalesBloque);
+			receptorBloques.soltar(bloque);  // El manejador ya lo proceso en el mismo bloque en que lo escribio el DMA
+		}
+#ifdef INSTRUMENTACION
+		if (n > 0 && medidorBloques) medidorBloques->medirFin(inicio);
+#endif
 	}
 }
 
 
-/**
- * Funcion manejadora del timer 3 usada para adquirir un dato del ADC
- */
-void IRAM_ATTR onTimerADC() {  //Colocar el manejador de la interrupcion en la seccion de memoria IRAM
-	portENTER_CRITICAL_ISR(&timerADCMux);  //Un mutex proteje al manejador de reentradas (lo cual no debe suceder, pero por si acaso)
-	
-	BaseType_t xHigherPriorityTaskWoken = pdFALSE;  //Bandera indicadora de que la tarea de mas prioridad no esta en ejecucion.
-	vTaskNotifyGiveFromISR(complexHandlerADCTask, &xHigherPriorityTaskWoken); 
-	if (xHigherPriorityTaskWoken) {
-		portYIELD_FROM_ISR();
-	}
-	portEXIT_CRITICAL_ISR(&timerADCMux);
-}
-
-
-
 /**
  * Funcion que configura las funciones manejadoras de los touch e inicializa el timer 1
  * @param t1_handler Puntero a la funcion que controla la pulsacion del touchpad 1
@@ -93,35 +167,67 @@ void setADCCallbacks(void (*t1_handler)(void), int samplingFreq){
 }
 
 
+/**
+ * Funcion que cambia la frecuencia de muestreo de la adquisicion por timer sin detenerla: el
+ * siguiente periodo ya es el nuevo
+ * @param samplingFreq Nueva frecuencia de muestreo en Hz
+ * @return false si el ADC no se inicio con setADCCallbacks()
+ */
+bool setADCSamplingFreq(int samplingFreq) {
+	return planificadorCambiarDivisor(trabajoADC, planificadorDivisor(samplingFreq));
+}
+
+
+/**
+ * Funcion que configura la adquisicion continua por bloques con el I2S/DMA
+ * @param handler Puntero a la funcion que procesa cada bloque (muestras intercaladas por canal)
+ * @param samplingFreq Frecuencia de muestreo por canal en Hz
+ * @param canales Lista de canales del ADC1 a escanear
+ * @param numCanales Numero de canales de la lista
+ * @param muestrasPorBloque Muestras por canal en cada bloque
+ * @return true si la adquisicion quedo funcionando
+ */
+bool setADCBlockCallback(void (*handler)(const uint16_t *muestras, size_t numMuestras, uint8_t numCanales), int samplingFreq,
+                         const uint8_t *canales, uint8_t numCanales, size_t muestrasPorBloque) {
+	task_adc_block_handler = handler;
+	numCanalesBloque = numCanales;
+	if (!fuenteADC->iniciar(samplingFreq, canales, numCanales, muestrasPorBloque)) {
+		Serial.println("Inicializacion del ADC por DMA fallida!");
+		return false;
+	}
+#ifdef INSTRUMENTACION
+	medidorBloques = registrarMedidor("ADC Block Handler", (uint32_t)(muestrasPorBloque * 1000000ULL / samplingFreq));
+#endif
+	xTaskCreatePinnedToCore(complexHandlerADCBloque, "ADC Block Handler", 8192, NULL, 1, &complexHandlerADCBloqueTask, 0);
+	return true;
+}
+
+
+/**
+ * Funcion que reemplaza la fuente de bloques (por defecto el I2S/DMA)
+ * @param fuente Fuente de bloques a usar
+ */
+void setADCBlockSource(FuenteADCBloques *fuente) {
+	fuenteADC = fuente;
+}
+
+
+
 /**
  * Funcion que inicializa las interrupciones del ADC
  * @param samplingFreq Especifica la frecuencia de muestreo del ADC en Hz
  */
 void initAdc(uint32_t samplingFreq) {
-	uint32_t contador = 1000000 / samplingFreq; //Calculo del numero de cuentas
-	float realFreq=1/(float)contador;
-	xTaskCreatePinnedToCore(complexHandlerADC, "ADC Handler", 8192, NULL,  1, &complexHandlerADCTask, 0);
+	uint32_t divisor = planificadorDivisor(samplingFreq); //Ticks del planificador entre muestras
+	float realFreq = (float)PLAN_FRECUENCIA_BASE / divisor;
     while(!Serial);
-	Serial.println("Inicializacion del ADC " + String(contador/1000)+ " ms de interrupcion de timerADC, frecuencia de muestreo = "+String(realFreq*1000000)+"Hz");
-	// Adquiere un puntero al timer a usar
-	timerADC = timerBegin(3, 80, true);  // Timer 3, divisor del reloj del sistema entre 80, conteo ascendente
-	timerAttachInterrupt(timerADC, &onTimerADC, true); // Timer a adjuntar la interrupcion, Manejador de la interrupcion asignado al timerADC, interrupcion por flanco de subida del timerADC
-	timerAlarmWrite(timerADC, contador, true); // Objeto timerADC a usar, contador de interrupciones, recargar despues de terminar (corre indefinidamente)
-	timerAlarmEnable(timerADC); // Activamos el timerADC
+	Serial.println("Inicializacion del ADC cada " + String(divisor)+ " ticks del planificador, frecuencia de muestreo = "+String(realFreq)+"Hz");
+	// Trabajo del planificador que ejecuta el manejador del ADC (prioridad 1, nucleo 0) en cada periodo de muestreo
+	trabajoADC = planificadorAgregar("ADC Handler", task_adc_handler, divisor, 1, 0);
 	analogRead(35); //Leemos el puerto analogo IO35 (ADC1_CHANNEL_7) para inicializarlo
 
-#define V_REF 1100  // Voltaje de referencia del ADC en milivoltios
-
     // Configura el ADC
     adc1_config_width(ADC_WIDTH_12Bit);
     adc1_config_channel_atten(ADC1_CHANNEL_7, ADC_ATTEN_11db);
-
-    // Calcula las caracteristicas del ADC por ejemplo factores ganancia de y offset
-    esp_adc_cal_characteristics_t characteristics;
-    //esp_adc_cal_get_characteristics(V_REF, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, &characteristics);
-    esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, V_REF, &characteristics);
-    uint32_t voltaje=0;
-    // Lee el ADC y obtiene el resultado en mV
-    uint32_t err = esp_adc_cal_get_voltage(ADC_CHANNEL_0, &characteristics, &voltaje);
-    printf("%d mV\n", voltaje);
+    // La conversion a mV se calibra por canal y atenuacion en tablas (libcalibracion.h), no aqui
 }
\ No newline at end of file
@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 #include "Arduino.h"
+#include "libadcbloques.h"
 
 /**
  * Funcion que adquiere un dato del canal analogo indicado
@@ -35,3 +36,31 @@ int IRAM_ATTR local_adc1_read(int channel);
  * @param samplingFreq Periodo de muestreo de los touchpad
  */
  void setADCCallbacks(void (*t1_handler)(void), int samplingFreq);
+
+/**
+ * Funcion que cambia la frecuencia de muestreo de la adquisicion por timer sin detenerla (el
+ * planificador aplica el nuevo divisor al terminar el periodo en curso)
+ * @param samplingFreq Nueva frecuencia de muestreo en Hz
+ * @return false si el ADC no se inicio con setADCCallbacks()
+ */
+bool setADCSamplingFreq(int samplingFreq);
+
+
+/**
+ * Funcion que configura la adquisicion continua por bloques con el I2S/DMA: el ADC escanea
+ * los canales por hardware y la CPU solo despierta una vez por bloque
+ * @param handler Puntero a la funcion que procesa cada bloque (muestras intercaladas por canal)
+ * @param samplingFreq Frecuencia de muestreo por canal en Hz
+ * @param canales Lista de canales del ADC1 a escanear
+ * @param numCanales Numero de canales de la lista
+ * @param muestrasPorBloque Muestras por canal en cada bloque
+ * @return true si la adquisicion quedo funcionando
+ */
+bool setADCBlockCallback(void (*handler)(const uint16_t *muestras, size_t numMuestras, uint8_t numCanales), int samplingFreq,
+                         const uint8_t *canales, uint8_t numCanales, size_t muestrasPorBloque);
+
+/**
+ * Funcion que reemplaza la fuente de bloques (por defecto el I2S/DMA), se usa antes de setADCBlockCallback()
+ * @param fuente Fuente de bloques a usar
+ */
+void setADCBlockSource(FuenteADCBloques *fuente);
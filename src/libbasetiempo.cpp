@@ -0,0 +1,146 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libbasetiempo.h"
+#include "libhal.h"
+#include "libseqlock.h"
+
+static DisciplinaTiempo disciplina;                  // Solo la modifica la tarea del GPS
+static Seqlock<DisciplinaTiempo> disciplinaPublicada; // Copia que leen las demas tareas
+static Seqlock<uint64_t> flancoPPS;                  // Lo escribe la interrupcion del PPS
+static uint32_t flancosVistos = 0;
+
+
+DisciplinaTiempo::DisciplinaTiempo()
+    : utcReferencia(0), baseReferencia(0), utcAncla(0), baseAncla(0), ultimaHora(0), ultimoPPS(0), derivaEstimada(false),
+      e{false, false, 0, 0, 0, 0, 0} {}
+
+
+void DisciplinaTiempo::pulsoPPS(uint64_t baseUs) {
+  ultimoPPS = baseUs;
+  e.pulsosPPS++;
+}
+
+
+void DisciplinaTiempo::horaGPS(int64_t utcUs, uint64_t finFraseUs) {
+  if (e.sincronizada && utcUs == ultimaHora) return;
+  ultimaHora = utcUs;
+  // El flanco del PPS de este segundo llega antes que sus frases y a menos de un segundo de ellas
+  bool conPPS = ultimoPPS != 0 && utcUs % 1000000 == 0 && ultimoPPS <= finFraseUs && finFraseUs - ultimoPPS < 1000000;
+  if (!conPPS && finFraseUs < BASE_RETARDO_NMEA_US) return;
+  uint64_t base = conPPS ? ultimoPPS : finFraseUs - BASE_RETARDO_NMEA_US;
+  e.conPPS = conPPS;
+
+  int64_t prediccion;
+  int64_t error = 0;
+  if (!aUTC(base, prediccion) || (error = utcUs - prediccion) > BASE_ERROR_MAX_US || error < -BASE_ERROR_MAX_US) {
+    if (e.sincronizada) e.reinicios++;  // Primer fix o salto de la hora: se toma tal cual
+    utcReferencia = utcAncla = utcUs;
+    baseReferencia = baseAncla = base;
+    e.sincronizada = true;
+    e.ultimoErrorUs = 0;
+    return;
+  }
+  e.ultimoErrorUs = (int32_t)error;
+  e.correcciones++;
+  utcReferencia = prediccion + error / BASE_GANANCIA_FASE;  // La fase se corrige poco a poco para filtrar el ruido de cada medida
+  baseReferencia = base;
+
+  // La deriva se mide contra el ancla: el ruido de una medida se reparte en todo el intervalo, por eso
+  // despues de la primera estimacion solo se actualiza con al menos media ventana de referencia
+  int64_t transcurrido = (int64_t)(base - baseAncla);
+  if (transcurrido >= (derivaEstimada ? BASE_VENTANA_DERIVA_S / 2 : BASE_MIN_DERIVA_S) * 1000000LL) {
+    e.derivaPpb = (int32_t)((transcurrido - (utcUs - utcAncla)) * 1000000000LL / transcurrido);
+    derivaEstimada = true;
+  }
+  if (transcurrido >= BASE_VENTANA_DERIVA_S * 1000000LL) {
+    utcAncla = utcReferencia;
+    baseAncla = baseReferencia;
+  }
+}
+
+
+bool DisciplinaTiempo::aUTC(uint64_t baseUs, int64_t &utcUs) const {
+  if (!e.sincronizada) return false;
+  int64_t transcurrido = (int64_t)(baseUs - baseReferencia);
+  utcUs = utcReferencia + transcurrido - transcurrido * e.derivaPpb / 1000000000LL;
+  return true;
+}
+
+
+bool horaUTCGPS(const RegistroGPS &registro, int64_t &utcUs) {
+  if (!registro.fechaValida || !registro.horaValida || registro.mes < 1 || registro.mes > 12) return false;
+  // Dias desde 1970 de la fecha civil (algoritmo de H. Hinnant, con el año empezando en marzo)
+  int32_t anio = registro.anio - (registro.mes <= 2);
+  int32_t era = anio / 400;
+  int32_t anioEra = anio - era * 400;
+  int32_t diaAnio = (153 * (registro.mes + (registro.mes > 2 ? -3 : 9)) + 2) / 5 + registro.dia - 1;
+  int32_t diaEra = anioEra * 365 + anioEra / 4 - anioEra / 100 + diaAnio;
+  int64_t dias = (int64_t)era * 146097 + diaEra - 719468;
+  int64_t segundos = dias * 86400 + registro.hora * 3600 + registro.minuto * 60 + registro.segundo;
+  utcUs = segundos * 1000000 + registro.centesimas * 10000;
+  return true;
+}
+
+
+/**
+ * Interrupcion del PPS: solo guarda el instante del flanco. Esta en IRAM para que el flanco se
+ * marque a tiempo aunque llegue durante un borrado de la flash
+ */
+static void IRAM_ATTR isrPPS() {
+  flancoPPS.escribir(halMicros());
+}
+
+
+void iniciarBaseTiempo(int pinPPS) {
+  disciplinaPublicada.escribir(disciplina);
+  if (pinPPS >= 0) halInterrupcionPin((uint8_t)pinPPS, isrPPS);
+}
+
+
+void disciplinarBaseTiempo(const RegistroGPS &registro) {
+  uint64_t pps;
+  uint32_t flancos = flancoPPS.leer(pps);
+  if (flancos != flancosVistos) {
+    flancosVistos = flancos;
+    disciplina.pulsoPPS(pps);
+  }
+  int64_t utcUs;
+  if (!horaUTCGPS(registro, utcUs)) return;
+  disciplina.horaGPS(utcUs, registro.marcaTiempo);
+  disciplinaPublicada.escribir(disciplina);
+}
+
+
+bool baseTiempoAUTC(uint64_t baseUs, int64_t &utcUs) {
+  DisciplinaTiempo copia;
+  disciplinaPublicada.leer(copia);
+  return copia.aUTC(baseUs, utcUs);
+}
+
+
+EstadoBaseTiempo estadoBaseTiempo() {
+  DisciplinaTiempo copia;
+  disciplinaPublicada.leer(copia);
+  return copia.estado();
+}
@@ -0,0 +1,133 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBBASETIEMPO_H
+#define LIBBASETIEMPO_H
+
+#include <stdint.h>
+#include "libgps.h"
+
+// Base de tiempo comun de todos los sensores. Cada muestra (ADC, giroscopio, GPS, touch) se marca
+// con halMicros(): 64 bits en microsegundos desde el arranque, monotona y sin saltos, asi que nunca
+// se corrige. Lo que el GPS disciplina es la relacion entre esa base y la hora UTC: con el flanco
+// del PPS (o, si no esta conectado, con la llegada de la primera frase de cada segundo) se estima
+// el desfase y la deriva del oscilador local, y con ellos cualquier marca de tiempo se pasa a UTC.
+
+#define BASE_RETARDO_NMEA_US 80000    // Sin PPS: retardo tipico entre el inicio del segundo UTC y el fin de su primera frase a 9600 baudios
+#define BASE_ERROR_MAX_US 500000      // Un error mayor reinicia la disciplina (primer fix o salto de la hora del GPS)
+#define BASE_GANANCIA_FASE 4          // Cada segundo se corrige 1/4 del error de fase
+#define BASE_MIN_DERIVA_S 30          // Segundos de referencia para la primera estimacion de la deriva
+#define BASE_VENTANA_DERIVA_S 1200    // La referencia de la deriva se renueva cada 20 minutos (el oscilador cambia con la temperatura)
+
+/**
+ * Estado de la disciplina de la base de tiempo
+ */
+struct EstadoBaseTiempo {
+  bool sincronizada;     // Ya hay una relacion con UTC
+  bool conPPS;           // La ultima correccion uso el flanco del PPS
+  int32_t derivaPpb;     // Deriva del reloj local respecto a UTC en partes por mil millones (positiva si el local adelanta)
+  int32_t ultimoErrorUs; // Error de fase medido en la ultima correccion
+  uint32_t correcciones; // Segundos del GPS usados para corregir
+  uint32_t reinicios;    // Veces que el error fue tan grande que se volvio a empezar
+  uint32_t pulsosPPS;    // Flancos del PPS recibidos
+};
+
+/**
+ * Disciplina de la relacion entre la base de tiempo local y UTC. No usa la HAL, asi que se puede
+ * probar con marcas de tiempo sinteticas
+ */
+class DisciplinaTiempo {
+public:
+  DisciplinaTiempo();
+
+  /**
+   * Funcion que registra un flanco del PPS (el inicio exacto de un segundo UTC)
+   * @param baseUs Instante del flanco en la base de tiempo local
+   */
+  void pulsoPPS(uint64_t baseUs);
+
+  /**
+   * Funcion que corrige la relacion con UTC con la hora informada por el GPS. Las horas repetidas
+   * (RMC y GGA del mismo fix) se ignoran
+   * @param utcUs Hora UTC del fix en microsegundos desde 1970
+   * @param finFraseUs Instante local en que termino de llegar la frase
+   */
+  void horaGPS(int64_t utcUs, uint64_t finFraseUs);
+
+  /**
+   * Funcion que convierte una marca de tiempo local a UTC
+   * @param baseUs Marca de tiempo en la base local
+   * @param utcUs Donde se escriben los microsegundos desde 1970
+   * @return false si aun no hay relacion con UTC
+   */
+  bool aUTC(uint64_t baseUs, int64_t &utcUs) const;
+
+  /**
+   * Estado y contadores de la disciplina
+   */
+  EstadoBaseTiempo estado() const { return e; }
+
+private:
+  int64_t utcReferencia;   // Hora UTC en el instante baseReferencia
+  uint64_t baseReferencia;
+  int64_t utcAncla;        // Punto desde el que se mide la deriva
+  uint64_t baseAncla;
+  int64_t ultimaHora;      // Ultima hora del GPS usada
+  uint64_t ultimoPPS;
+  bool derivaEstimada;
+  EstadoBaseTiempo e;
+};
+
+/**
+ * Funcion que calcula la hora UTC de un registro del GPS en microsegundos desde 1970
+ * @param registro Registro del GPS
+ * @param utcUs Donde se escribe el resultado
+ * @return false si el registro no trae fecha y hora
+ */
+bool horaUTCGPS(const RegistroGPS &registro, int64_t &utcUs);
+
+/**
+ * Funcion que prepara la base de tiempo, se usa en el setup() antes de iniciarGPS()
+ * @param pinPPS Pin conectado a la salida PPS del GPS, o -1 si no esta conectada
+ */
+void iniciarBaseTiempo(int pinPPS);
+
+/**
+ * Funcion que corrige la relacion con UTC con un registro del GPS, la llama la tarea del GPS
+ */
+void disciplinarBaseTiempo(const RegistroGPS &registro);
+
+/**
+ * Funcion que convierte una marca de tiempo de cualquier sensor a UTC, se puede llamar desde cualquier tarea
+ * @param baseUs Marca de tiempo (halMicros())
+ * @param utcUs Donde se escriben los microsegundos desde 1970
+ * @return false si el GPS aun no ha dado la hora
+ */
+bool baseTiempoAUTC(uint64_t baseUs, int64_t &utcUs);
+
+/**
+ * Funcion que da el estado de la disciplina de la base de tiempo
+ */
+EstadoBaseTiempo estadoBaseTiempo();
+
+#endif
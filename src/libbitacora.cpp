@@ -0,0 +1,502 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libbitacora.h"
+#include <string.h>
+#include <atomic>
+#include "libhal.h"
+#include "libringbuffer.h"
+#include "libtelemetria.h"
+
+#define DIRECCION_INVALIDA 0xFFFFFFFFu
+#define TAM_SECTOR HAL_FLASH_TAM_SECTOR
+
+/**
+ * Paquete en las colas de la bitacora
+ */
+struct PaqueteBitacora {
+  uint8_t len;
+  uint8_t datos[BITACORA_CARGA_MAX];
+};
+
+/**
+ * Registro entregado al transmisor que aun no se marca como enviado en la flash
+ */
+struct RegistroEnVuelo {
+  uint32_t direccion;  // Direccion del encabezado del registro
+  int32_t cierraSector; // Sector que queda todo enviado cuando se marque este registro, o -1
+};
+
+static BufferCircular<PaqueteBitacora, BITACORA_NUM_ENTRADA> colaEntrada;  // Procesamiento -> tarea
+static BufferCircular<PaqueteBitacora, BITACORA_NUM_SALIDA> colaSalida;    // Tarea -> transmisor
+static std::atomic<bool> respaldoEnFlash(false);  // Hay registros en la flash que aun no pasan a colaSalida
+static int tareaBitacora = -1;
+static uint32_t numSectores = 0;
+static uint32_t secuencia = 0;         // Secuencia del sector de escritura
+static uint32_t sectorEscritura = 0;
+static uint32_t finEscritura = 0;      // Desplazamiento dentro del sector donde va el siguiente registro
+static uint32_t sectorPreborrado = DIRECCION_INVALIDA;  // Sector siguiente al de escritura que ya esta borrado
+static uint32_t sectorLectura = 0;     // Siguiente registro a reenviar
+static uint32_t posLectura = 0;
+static RegistroEnVuelo enVuelo[BITACORA_NUM_SALIDA];
+static uint32_t empujados = 0;         // Registros puestos en colaSalida
+static uint32_t marcados = 0;          // Registros ya marcados como enviados en la flash
+static uint8_t lote[BITACORA_TAM_LOTE];
+static EstadisticasBitacora estadisticas;
+
+
+/**
+ * Funcion que da el tamaño de un registro en la flash, con su encabezado y relleno
+ */
+static uint32_t tamRegistro(size_t len) {
+  return BITACORA_TAM_REGISTRO + (((uint32_t)len + 3) & ~3u);
+}
+
+
+/**
+ * Funcion que borra un sector y mide cuanto tarda: en el ESP32 es el tiempo que la cache estuvo apagada
+ */
+static bool borrarSector(uint32_t sector) {
+  uint64_t inicio = halMicros();
+  bool borrado = halFlashBorrar(sector);
+  uint32_t duracion = (uint32_t)(halMicros() - inicio);
+  if (!borrado) {
+    estadisticas.erroresFlash++;
+    return false;
+  }
+  estadisticas.sectoresBorrados++;
+  estadisticas.borradoTotalUs += duracion;
+  if (duracion > estadisticas.borradoMaximoUs) estadisticas.borradoMaximoUs = duracion;
+  return true;
+}
+
+
+/**
+ * Funcion que indica si una zona de la flash sigue borrada (todos sus bytes en 0xFF)
+ */
+static bool zonaBorrada(uint32_t direccion, uint32_t len) {
+  uint8_t leidos[64];
+  for (uint32_t hecho = 0; hecho < len; hecho += sizeof(leidos)) {
+    uint32_t n = (len - hecho > sizeof(leidos)) ? sizeof(leidos) : len - hecho;
+    if (!halFlashLeer(direccion + hecho, leidos, n)) return false;
+    for (uint32_t i = 0; i < n; i++)
+      if (leidos[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+
+/**
+ * Funcion que lee y valida el encabezado de un sector
+ * @param enviado Si no es NULL, indica si el sector ya se envio completo
+ * @return true si el sector tiene un encabezado valido
+ */
+static bool leerEncabezado(uint32_t sector, uint32_t &sec, bool *enviado = NULL) {
+  uint8_t e[BITACORA_TAM_ENCABEZADO];
+  if (!halFlashLeer(sector * TAM_SECTOR, e, sizeof(e))) {
+    estadisticas.erroresFlash++;
+    return false;
+  }
+  uint32_t magico, marca;
+  uint16_t crc;
+  memcpy(&magico, e, 4);
+  memcpy(&sec, e + 4, 4);
+  memcpy(&crc, e + 8, 2);
+  memcpy(&marca, e + 12, 4);
+  if (enviado) *enviado = marca != 0xFFFFFFFFu;
+  return magico == BITACORA_MAGICO && crc == crc16Ccitt(e, 8);
+}
+
+
+/**
+ * Funcion que marca un sector como enviado por completo, para no volver a recorrerlo al arrancar
+ */
+static void cerrarSector(uint32_t sector) {
+  const uint32_t cero = 0;
+  if (!halFlashEscribir(sector * TAM_SECTOR + 12, &cero, 4)) estadisticas.erroresFlash++;
+}
+
+
+/**
+ * Funcion que lee el encabezado de un registro y valida su carga
+ * @param carga Si no es NULL, donde se copia la carga
+ * @return 1 si el registro es valido, 0 si ahi terminan los registros, -1 si esta corrupto
+ */
+static int leerRegistro(uint32_t direccion, uint32_t limite, uint16_t &len, uint8_t &enviado, uint8_t *carga) {
+  uint8_t e[BITACORA_TAM_REGISTRO];
+  if (direccion + BITACORA_TAM_REGISTRO > limite) return 0;
+  if (!halFlashLeer(direccion, e, sizeof(e))) {
+    estadisticas.erroresFlash++;
+    return -1;
+  }
+  uint16_t crc;
+  memcpy(&len, e, 2);
+  memcpy(&crc, e + 2, 2);
+  enviado = e[4];
+  if (len == 0xFFFF) return 0;
+  if (len > BITACORA_CARGA_MAX || direccion + tamRegistro(len) > limite) return -1;
+  uint8_t propia[BITACORA_CARGA_MAX];
+  if (carga == NULL) carga = propia;
+  if (!halFlashLeer(direccion + BITACORA_TAM_REGISTRO, carga, len)) {
+    estadisticas.erroresFlash++;
+    return -1;
+  }
+  return crc16Ccitt(carga, len, crc16Ccitt(e, 2)) == crc ? 1 : -1;
+}
+
+
+/**
+ * Funcion que recorre los registros de un sector desde el inicio para encontrar donde sigue la
+ * escritura. Un registro corrupto (la energia se fue a media escritura) cierra el sector
+ */
+static uint32_t buscarFin(uint32_t sector) {
+  uint32_t base = sector * TAM_SECTOR;
+  uint32_t pos = BITACORA_TAM_ENCABEZADO;
+  uint16_t len;
+  uint8_t enviado;
+  while (true) {
+    int r = leerRegistro(base + pos, base + TAM_SECTOR, len, enviado, NULL);
+    if (r == 0) return (pos + BITACORA_TAM_REGISTRO > TAM_SECTOR) ? TAM_SECTOR : pos;
+    if (r < 0) return TAM_SECTOR;
+    pos += tamRegistro(len);
+  }
+}
+
+
+/**
+ * Funcion que indica si la lectura ya alcanzo a la escritura
+ */
+static bool lecturaAlDia() {
+  return sectorLectura == sectorEscritura && posLectura >= finEscritura;
+}
+
+
+/**
+ * Funcion que deja la lectura al principio del siguiente sector con registros sin enviar. Si el
+ * sector que deja tiene registros entregados al transmisor sin marcar, se cierra al marcar el ultimo
+ */
+static void avanzarSectorLectura() {
+  uint32_t ultimo = (empujados - 1) % BITACORA_NUM_SALIDA;
+  if (marcados != empujados && enVuelo[ultimo].direccion != DIRECCION_INVALIDA &&
+      enVuelo[ultimo].direccion / TAM_SECTOR == sectorLectura)
+    enVuelo[ultimo].cierraSector = (int32_t)sectorLectura;
+  else
+    cerrarSector(sectorLectura);
+  do {
+    sectorLectura = (sectorLectura + 1) % numSectores;
+    posLectura = BITACORA_TAM_ENCABEZADO;
+    uint32_t sec;
+    bool enviado;
+    if (sectorLectura == sectorEscritura || (leerEncabezado(sectorLectura, sec, &enviado) && !enviado)) return;
+  } while (true);  // Se saltan los sectores borrados o ya enviados; el de escritura siempre detiene la busqueda
+}
+
+
+/**
+ * Funcion que suelta los registros entregados al transmisor que estan en un sector que se va a
+ * borrar: se envian igual, pero ya no hay donde marcarlos
+ */
+static void soltarEnVuelo(uint32_t sector) {
+  for (uint32_t i = 0; i < BITACORA_NUM_SALIDA; i++) {
+    if (enVuelo[i].direccion / TAM_SECTOR == sector) enVuelo[i].direccion = DIRECCION_INVALIDA;
+    if (enVuelo[i].cierraSector == (int32_t)sector) enVuelo[i].cierraSector = -1;
+  }
+}
+
+
+/**
+ * Funcion que abre el siguiente sector del anillo para escribir. Si la lectura aun no termina con
+ * ese sector (la flash esta llena de registros sin enviar), sus registros pendientes se pierden
+ */
+static bool abrirSiguienteSector() {
+  uint32_t s = (sectorEscritura + 1) % numSectores;
+  if (!lecturaAlDia() && sectorLectura == s) {
+    uint32_t base = s * TAM_SECTOR;
+    uint16_t len;
+    uint8_t enviado;
+    for (uint32_t pos = posLectura; leerRegistro(base + pos, base + TAM_SECTOR, len, enviado, NULL) > 0; pos += tamRegistro(len))
+      if (enviado == 0xFF) estadisticas.perdidosLlena++;
+    soltarEnVuelo(s);
+    sectorLectura = (s + 1) % numSectores;
+    posLectura = BITACORA_TAM_ENCABEZADO;
+  }
+  if (sectorPreborrado != s) {
+    soltarEnVuelo(s);
+    if (!borrarSector(s)) return false;
+  }
+  sectorPreborrado = DIRECCION_INVALIDA;
+  uint8_t e[BITACORA_TAM_ENCABEZADO];
+  memset(e, 0xFF, sizeof(e));
+  uint32_t magico = BITACORA_MAGICO;
+  uint32_t sec = secuencia + 1;
+  memcpy(e, &magico, 4);
+  memcpy(e + 4, &sec, 4);
+  uint16_t crc = crc16Ccitt(e, 8);
+  memcpy(e + 8, &crc, 2);
+  if (!halFlashEscribir(s * TAM_SECTOR, e, sizeof(e))) {
+    estadisticas.erroresFlash++;
+    return false;
+  }
+  bool alDia = lecturaAlDia();
+  bool primero = secuencia == 0;  // Antes no habia ningun sector de la bitacora que cerrar
+  secuencia = sec;
+  sectorEscritura = s;
+  finEscritura = BITACORA_TAM_ENCABEZADO;
+  if (alDia) {  // La lectura sigue a la escritura al sector nuevo
+    if (primero) {
+      sectorLectura = s;
+      posLectura = BITACORA_TAM_ENCABEZADO;
+    } else {
+      avanzarSectorLectura();
+    }
+  }
+  return true;
+}
+
+
+/**
+ * Funcion que marca en la flash los registros que el transmisor ya envio
+ */
+static void marcarEnviados() {
+  uint32_t consumidos = empujados - (uint32_t)colaSalida.disponibles();
+  while (marcados != consumidos) {
+    RegistroEnVuelo &r = enVuelo[marcados % BITACORA_NUM_SALIDA];
+    const uint8_t cero = 0;
+    if (r.direccion != DIRECCION_INVALIDA && !halFlashEscribir(r.direccion + 4, &cero, 1)) estadisticas.erroresFlash++;
+    if (r.cierraSector >= 0) cerrarSector((uint32_t)r.cierraSector);
+    marcados++;
+    estadisticas.reproducidos++;
+  }
+}
+
+
+/**
+ * Funcion que borra por adelantado el sector que sigue al de escritura, si ya no tiene registros
+ * sin enviar, para que el lote que lo abra no tenga que esperar el borrado
+ */
+static void preborrarSiguiente() {
+  uint32_t s = (sectorEscritura + 1) % numSectores;
+  if (sectorPreborrado == s || (!lecturaAlDia() && sectorLectura == s)) return;  // Ya borrado, o con registros sin enviar
+  soltarEnVuelo(s);
+  if (!borrarSector(s)) return;
+  sectorPreborrado = s;
+  estadisticas.sectoresPreborrados++;
+}
+
+
+/**
+ * Funcion que escribe en la flash los paquetes de la cola de entrada, en lotes que nunca cruzan
+ * el final de un sector. Los paquetes solo salen de la cola cuando su lote quedo escrito
+ * @return true si escribio algun lote
+ */
+static bool escribirPendientes() {
+  if (colaEntrada.disponibles() == 0) return false;
+  respaldoEnFlash.store(true, std::memory_order_release);  // Antes de sacarlos de la cola, para no dejar un hueco visible
+  bool escrito = false;
+  while (colaEntrada.disponibles() > 0) {
+    Ventana<PaqueteBitacora> pendientes = colaEntrada.primeras(colaEntrada.disponibles());
+    uint32_t len = 0;
+    uint32_t registros = 0;
+    while (registros < pendientes.size()) {
+      const PaqueteBitacora &p = pendientes[registros];
+      uint32_t tam = tamRegistro(p.len);
+      if (finEscritura + len + tam > TAM_SECTOR) {
+        if (len > 0) break;  // Primero se escribe lo que ya esta en el lote
+        if (!abrirSiguienteSector()) return escrito;  // Los paquetes siguen en la cola hasta el siguiente intento
+        continue;
+      }
+      if (len + tam > sizeof(lote)) break;
+      uint8_t *r = lote + len;
+      memset(r, 0xFF, tam);
+      uint16_t largo = p.len;
+      memcpy(r, &largo, 2);
+      memcpy(r + BITACORA_TAM_REGISTRO, p.datos, p.len);
+      uint16_t crc = crc16Ccitt(p.datos, p.len, crc16Ccitt(r, 2));
+      memcpy(r + 2, &crc, 2);
+      len += tam;
+      registros++;
+    }
+    uint32_t direccion = sectorEscritura * TAM_SECTOR + finEscritura;
+    if (!halFlashEscribir(direccion, lote, len)) {
+      estadisticas.erroresFlash++;
+      // Si no se programo nada se reintenta ahi mismo en el siguiente despertar. Si quedo a medias esa
+      // zona ya no se puede escribir sin borrar: los registros que quedaron completos se dan por
+      // guardados (para no repetirlos), el sector se cierra y el resto del lote va al siguiente
+      if (zonaBorrada(direccion, len)) return escrito;
+      uint32_t completos = 0;
+      uint16_t largo;
+      uint8_t enviado;
+      for (uint32_t pos = direccion; completos < registros && leerRegistro(pos, direccion + len, largo, enviado, NULL) > 0;
+           pos += tamRegistro(largo))
+        completos++;
+      colaEntrada.descartar(completos);
+      estadisticas.guardados += completos;
+      finEscritura = TAM_SECTOR;
+      continue;
+    }
+    colaEntrada.descartar(registros);
+    estadisticas.guardados += registros;
+    estadisticas.bytesGuardados += len;
+    estadisticas.lotes++;
+    finEscritura += len;
+    escrito = true;
+  }
+  return escrito;
+}
+
+
+/**
+ * Funcion que lee por adelantado los siguientes registros sin enviar hacia la cola del transmisor
+ */
+static void llenarSalida() {
+  // Se cuenta contra los no marcados: el transmisor puede liberar la cola antes de que se marquen
+  while (!lecturaAlDia() && empujados - marcados < BITACORA_NUM_SALIDA) {
+    static PaqueteBitacora p;
+    uint32_t direccion = sectorLectura * TAM_SECTOR + posLectura;
+    uint32_t limite = (sectorLectura == sectorEscritura) ? sectorEscritura * TAM_SECTOR + finEscritura
+                                                         : (sectorLectura + 1) * TAM_SECTOR;
+    uint16_t len;
+    uint8_t enviado;
+    int r = leerRegistro(direccion, limite, len, enviado, p.datos);
+    if (r <= 0) {
+      if (r < 0) estadisticas.erroresCrc++;
+      if (sectorLectura == sectorEscritura) posLectura = finEscritura;  // Lo que sigue no se puede leer
+      else avanzarSectorLectura();
+      continue;
+    }
+    posLectura += tamRegistro(len);
+    if (enviado != 0xFF) continue;  // Ya se habia enviado antes de reiniciar
+    p.len = (uint8_t)len;
+    enVuelo[empujados % BITACORA_NUM_SALIDA].direccion = direccion;
+    enVuelo[empujados % BITACORA_NUM_SALIDA].cierraSector = -1;
+    colaSalida.push(p);
+    empujados++;
+  }
+  if (lecturaAlDia()) respaldoEnFlash.store(false, std::memory_order_release);  // Despues de publicar el ultimo
+}
+
+
+/**
+ * Manejador de la tarea de la bitacora: se ejecuta al llenarse media cola de entrada, cuando el
+ * transmisor toma un registro o cada BITACORA_ESPERA_US
+ */
+static void atenderBitacora() {
+  marcarEnviados();
+  bool escrito = escribirPendientes();
+  llenarSalida();
+  if (escrito) preborrarSiguiente();  // Despues de darle al transmisor lo que necesita
+}
+
+
+bool iniciarBitacora(uint8_t prioridad, uint8_t nucleo) {
+  memset(&estadisticas, 0, sizeof(estadisticas));
+  numSectores = (uint32_t)(halFlashAbrir() / TAM_SECTOR);
+  estadisticas.numSectores = numSectores;
+  if (numSectores < 2) return false;
+  // Solo se leen los encabezados: el sector de mayor secuencia es donde sigue la escritura
+  bool hay = false;
+  for (uint32_t s = 0; s < numSectores; s++) {
+    uint32_t sec;
+    if (leerEncabezado(s, sec) && (!hay || sec > secuencia)) {
+      hay = true;
+      secuencia = sec;
+      sectorEscritura = s;
+    }
+  }
+  if (!hay) {  // Particion nueva o ajena: se empieza en el sector 0
+    secuencia = 0;
+    sectorEscritura = numSectores - 1;
+    finEscritura = TAM_SECTOR;
+    sectorLectura = sectorEscritura;
+    posLectura = finEscritura;
+    if (!abrirSiguienteSector()) return false;
+  } else {
+    finEscritura = buscarFin(sectorEscritura);
+    // El sector pendiente mas antiguo es el primero sin enviar despues del de escritura en el anillo
+    sectorLectura = sectorEscritura;
+    posLectura = BITACORA_TAM_ENCABEZADO;
+    for (uint32_t i = 1; i < numSectores; i++) {
+      uint32_t s = (sectorEscritura + i) % numSectores;
+      uint32_t sec;
+      bool enviado;
+      if (leerEncabezado(s, sec, &enviado) && !enviado) {
+        sectorLectura = s;
+        estadisticas.sectoresPendientesArranque = numSectores - i + 1;
+        break;
+      }
+    }
+    if (sectorLectura == sectorEscritura && finEscritura > BITACORA_TAM_ENCABEZADO) {
+      uint32_t sec;
+      bool enviado;
+      if (leerEncabezado(sectorEscritura, sec, &enviado) && enviado) posLectura = finEscritura;
+      else estadisticas.sectoresPendientesArranque = 1;
+    }
+  }
+  respaldoEnFlash.store(!lecturaAlDia());
+  tareaBitacora = halTareaEventos(atenderBitacora, BITACORA_ESPERA_US, "Bitacora", prioridad, nucleo);
+  return tareaBitacora >= 0;
+}
+
+
+bool guardarEnBitacora(const uint8_t *datos, size_t len) {
+  static PaqueteBitacora paquete;
+  if (tareaBitacora < 0 || len > BITACORA_CARGA_MAX) return false;
+  if (colaEntrada.disponibles() >= colaEntrada.capacidad()) {
+    estadisticas.descartadosCola++;
+    return false;
+  }
+  paquete.len = (uint8_t)len;
+  memcpy(paquete.datos, datos, len);
+  colaEntrada.push(paquete);
+  if (colaEntrada.disponibles() >= colaEntrada.capacidad() / 2) halNotificar(tareaBitacora);
+  return true;
+}
+
+
+bool bitacoraPendiente() {
+  // Los registros solo avanzan entrada -> flash -> salida, por eso se revisan en ese orden
+  return tareaBitacora >= 0 && (colaEntrada.disponibles() > 0 || respaldoEnFlash.load(std::memory_order_acquire) ||
+                                colaSalida.disponibles() > 0);
+}
+
+
+bool siguienteRegistroBitacora(const uint8_t *&datos, size_t &len) {
+  if (colaSalida.disponibles() == 0) return false;
+  Ventana<PaqueteBitacora> v = colaSalida.primeras(1);
+  datos = v[0].datos;
+  len = v[0].len;
+  return true;
+}
+
+
+void registroBitacoraEnviado() {
+  colaSalida.descartar(1);
+  halNotificar(tareaBitacora);  // Para que marque el registro y lea el siguiente
+}
+
+
+EstadisticasBitacora estadisticasBitacora() {
+  EstadisticasBitacora e = estadisticas;
+  e.pendiente = bitacoraPendiente();
+  return e;
+}
@@ -0,0 +1,134 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBBITACORA_H
+#define LIBBITACORA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bitacora de respaldo (store and forward): cuando el radio no puede enviar, los paquetes de
+// muestras ya comprimidos se guardan en una particion de la flash y se reenvian en orden cuando
+// el enlace vuelve. La particion se escribe como un anillo de sectores de 4 KB que solo crece
+// hacia adelante, asi que todos los sectores se borran el mismo numero de veces (nivelacion de
+// desgaste) y cuando se llena se recicla el sector mas antiguo.
+//
+// Formato de cada sector (little endian):
+//  [0..3]   Magico (BITACORA_MAGICO)
+//  [4..7]   Secuencia del sector (crece en cada sector abierto: el mayor es el mas reciente)
+//  [8..9]   CRC-16/CCITT de los bytes 0..7
+//  [10..11] Reservado (0xFFFF)
+//  [12..15] 0xFFFFFFFF mientras tenga registros sin enviar, 0 cuando ya se envio todo
+//  [16..]   Registros, que nunca cruzan el final del sector:
+//             [0..1] Longitud de la carga (0xFFFF = fin de los registros del sector)
+//             [2..3] CRC-16/CCITT de la longitud y la carga
+//             [4]    0xFF sin enviar, 0x00 enviado (se baja sin borrar el sector)
+//             [5..7] Reservado (0xFF)
+//             [8..]  Carga, rellena hasta un multiplo de 4 bytes
+// Al arrancar solo se leen los encabezados de los sectores y los registros del sector mas
+// reciente, para encontrar el final sin recorrer toda la particion.
+//
+// El camino de procesamiento nunca toca la flash: solo copia el paquete a una cola en RAM. La
+// tarea de la bitacora junta los paquetes de la cola en un lote y lo escribe de una vez, y lee
+// por adelantado los registros pendientes para que el transmisor los tome cuando su propia
+// cola esta vacia. Un lote que no se pudo escribir se queda en la cola y se reintenta en el
+// mismo lugar (o en el sector siguiente, si la escritura alcanzo a programar algo).
+//
+// Borrar un sector apaga la cache de los dos nucleos mientras dura (decenas de ms en una flash
+// tipica, EstadisticasBitacora::borradoMaximoUs lo mide en el equipo). Solo corren las ISR en
+// IRAM: el planificador, el PPS y el DMA del ADC siguen marcando el tiempo y llenando sus buffers,
+// y las tareas se ponen al dia al volver la cache. Para que ese borrado no caiga en medio de un
+// respaldo, la tarea borra por adelantado el sector siguiente justo despues de escribir un lote,
+// cuando ya no tiene registros sin enviar.
+
+#define BITACORA_MAGICO 0x41544942        // "BITA"
+#define BITACORA_TAM_ENCABEZADO 16        // Bytes del encabezado de cada sector
+#define BITACORA_TAM_REGISTRO 8           // Bytes del encabezado de cada registro
+#define BITACORA_CARGA_MAX 255            // Carga maxima de un registro (un paquete LoRa)
+#define BITACORA_TAM_LOTE 1024            // Bytes maximos que se escriben en una sola operacion
+#define BITACORA_NUM_ENTRADA 8            // Paquetes en la cola hacia la tarea (potencia de 2)
+#define BITACORA_NUM_SALIDA 2             // Registros leidos por adelantado para el transmisor (potencia de 2)
+#define BITACORA_ESPERA_US 4000000        // La tarea escribe al menos con este periodo, o al llenarse media cola
+
+/**
+ * Contadores de la bitacora
+ */
+struct EstadisticasBitacora {
+  uint32_t guardados;           // Registros escritos en la flash
+  uint64_t bytesGuardados;      // Bytes escritos en la flash, con encabezados y relleno
+  uint32_t lotes;               // Operaciones de escritura de registros
+  uint32_t reproducidos;        // Registros que el transmisor ya envio
+  uint32_t perdidosLlena;       // Registros sin enviar que se perdieron al reciclar un sector
+  uint32_t descartadosCola;     // Paquetes que no cupieron en la cola hacia la tarea
+  uint32_t erroresCrc;          // Registros corruptos que se saltaron al reproducir
+  uint32_t erroresFlash;        // Operaciones de la flash que fallaron (los lotes se reintentan)
+  uint32_t sectoresBorrados;
+  uint32_t sectoresPreborrados; // Borrados por adelantado, despues de escribir un lote
+  uint32_t borradoMaximoUs;     // Borrado de sector mas largo (la cache estuvo apagada todo ese tiempo)
+  uint64_t borradoTotalUs;
+  uint32_t numSectores;         // Sectores de la particion
+  uint32_t sectoresPendientesArranque;  // Sectores con registros sin enviar encontrados al arrancar
+  bool pendiente;               // Hay registros esperando a ser reenviados
+};
+
+/**
+ * Funcion que abre la particion, recupera el final del anillo y crea la tarea de la bitacora
+ * @param prioridad Prioridad de la tarea (menor que la de adquisicion)
+ * @param nucleo Nucleo al que se fija la tarea
+ * @return true si la particion existe
+ */
+bool iniciarBitacora(uint8_t prioridad, uint8_t nucleo);
+
+/**
+ * Funcion que copia un paquete a la cola de la bitacora sin bloquear (un solo productor)
+ * @param datos Paquete
+ * @param len Numero de bytes (maximo BITACORA_CARGA_MAX)
+ * @return false si la bitacora no esta iniciada o su cola estaba llena
+ */
+bool guardarEnBitacora(const uint8_t *datos, size_t len);
+
+/**
+ * Funcion que indica si quedan paquetes de la bitacora por reenviar. Mientras sea asi los
+ * paquetes nuevos tambien deben ir a la bitacora para que el receptor los reciba en orden
+ */
+bool bitacoraPendiente();
+
+/**
+ * Funcion del transmisor que da el siguiente registro a reenviar, sin sacarlo
+ * @param datos Apunta a la carga del registro (valida hasta registroBitacoraEnviado())
+ * @param len Bytes de la carga
+ * @return false si no hay ningun registro listo
+ */
+bool siguienteRegistroBitacora(const uint8_t *&datos, size_t &len);
+
+/**
+ * Funcion del transmisor que avisa que el radio ya tomo el registro de siguienteRegistroBitacora()
+ */
+void registroBitacoraEnviado();
+
+/**
+ * Funcion que da los contadores de la bitacora
+ */
+EstadisticasBitacora estadisticasBitacora();
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBCADENA_H
+#define LIBCADENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+// Cadena de procesamiento compuesta en tiempo de compilacion: Cadena<E1, E2, ..., En> conecta las
+// etapas en orden y cada una le entrega sus resultados directamente a la siguiente, sin punteros
+// a funcion ni metodos virtuales, asi que el compilador puede juntar toda la cadena en un solo
+// lazo sobre el bloque de muestras. Al compilar se verifica que el tipo y la frecuencia de salida
+// de cada etapa sean los de entrada de la siguiente, de modo que cada placa o producto arma su
+// propia cadena (fuente, decimador, filtro, extractor, codificador, sumidero) sin costo extra.
+//
+// Una etapa es una clase que hereda de Etapa<Entrada, Salida, frecuencia de entrada, de salida>
+// y tiene el metodo
+//   template <typename Siguiente> void procesar(const Entrada &x, Siguiente &siguiente);
+// que llama siguiente.procesar(y) cero o mas veces (un decimador entrega menos de lo que recibe).
+// La ultima etapa es el sumidero: recibe un FinCadena que descarta lo que se le entregue.
+
+#define FRECUENCIA_EVENTOS 0  // Frecuencia de las salidas que no son periodicas (paquetes, eventos)
+
+/**
+ * Tipos y frecuencias de una etapa
+ * @param ENTRADA Tipo de las muestras que recibe
+ * @param SALIDA Tipo de las muestras que entrega
+ * @param FS_ENTRADA Frecuencia en Hz a la que recibe muestras
+ * @param FS_SALIDA Frecuencia en Hz a la que entrega muestras
+ */
+template <typename ENTRADA, typename SALIDA, uint32_t FS_ENTRADA, uint32_t FS_SALIDA = FS_ENTRADA>
+struct Etapa {
+  typedef ENTRADA Entrada;
+  typedef SALIDA Salida;
+  static constexpr uint32_t FRECUENCIA_ENTRADA = FS_ENTRADA;
+  static constexpr uint32_t FRECUENCIA_SALIDA = FS_SALIDA;
+};
+
+/**
+ * Lo que recibe la ultima etapa como siguiente: no hace nada con lo que se le entrega
+ */
+struct FinCadena {
+  template <typename T>
+  inline void procesar(const T &) {}
+};
+
+/**
+ * Sumidero que entrega cada muestra a una funcion fija al compilar (se puede expandir en linea)
+ */
+template <typename T, uint32_t FS, void (*FUNCION)(const T &)>
+struct EtapaSumidero : Etapa<T, T, FS> {
+  template <typename Siguiente>
+  inline void procesar(const T &x, Siguiente &) { FUNCION(x); }
+};
+
+/**
+ * Derivacion: entrega cada muestra a una funcion y la deja seguir por la cadena sin cambios
+ */
+template <typename T, uint32_t FS, void (*FUNCION)(const T &)>
+struct EtapaDerivacion : Etapa<T, T, FS> {
+  template <typename Siguiente>
+  inline void procesar(const T &x, Siguiente &siguiente) {
+    FUNCION(x);
+    siguiente.procesar(x);
+  }
+};
+
+template <typename... ETAPAS>
+class Cadena;
+
+/**
+ * Cadena de una sola etapa (el sumidero, o el final de una cadena mas larga)
+ */
+template <typename ULTIMA>
+class Cadena<ULTIMA> {
+public:
+  typedef typename ULTIMA::Entrada Entrada;
+  typedef typename ULTIMA::Salida Salida;
+  static constexpr uint32_t FRECUENCIA_ENTRADA = ULTIMA::FRECUENCIA_ENTRADA;
+  static constexpr uint32_t FRECUENCIA_SALIDA = ULTIMA::FRECUENCIA_SALIDA;
+  static constexpr size_t NUM_ETAPAS = 1;
+
+  inline void procesar(const Entrada &x) { ultima.procesar(x, fin); }
+
+  void procesarBloque(const Entrada *x, size_t n) {
+    for (size_t i = 0; i < n; i++) ultima.procesar(x[i], fin);
+  }
+
+  /**
+   * Funcion que da la etapa I de la cadena (0 es la primera)
+   */
+  template <size_t I>
+  ULTIMA &etapa() {
+    static_assert(I == 0, "La cadena no tiene tantas etapas");
+    return ultima;
+  }
+
+private:
+  ULTIMA ultima;
+  FinCadena fin;
+};
+
+/**
+ * Cadena de varias etapas: la primera y la cadena con el resto
+ */
+template <typename PRIMERA, typename SEGUNDA, typename... RESTO>
+class Cadena<PRIMERA, SEGUNDA, RESTO...> {
+  typedef Cadena<SEGUNDA, RESTO...> Resto;
+  static_assert(std::is_same<typename PRIMERA::Salida, typename Resto::Entrada>::value,
+                "El tipo de salida de una etapa no es el de entrada de la siguiente");
+  static_assert(PRIMERA::FRECUENCIA_SALIDA == Resto::FRECUENCIA_ENTRADA,
+                "La frecuencia de salida de una etapa no es la de entrada de la siguiente");
+
+public:
+  typedef typename PRIMERA::Entrada Entrada;
+  typedef typename Resto::Salida Salida;
+  static constexpr uint32_t FRECUENCIA_ENTRADA = PRIMERA::FRECUENCIA_ENTRADA;
+  static constexpr uint32_t FRECUENCIA_SALIDA = Resto::FRECUENCIA_SALIDA;
+  static constexpr size_t NUM_ETAPAS = 1 + Resto::NUM_ETAPAS;
+
+  /**
+   * Funcion que pasa una muestra por toda la cadena
+   */
+  inline void procesar(const Entrada &x) { primera.procesar(x, resto); }
+
+  /**
+   * Funcion que pasa un bloque de muestras por toda la cadena (el lazo que el compilador aplana)
+   */
+  void procesarBloque(const Entrada *x, size_t n) {
+    for (size_t i = 0; i < n; i++) primera.procesar(x[i], resto);
+  }
+
+  /**
+   * Funcion que da la etapa I de la cadena (0 es la primera), para configurarla o leer sus contadores
+   */
+  template <size_t I>
+  auto &etapa() {
+    if constexpr (I == 0) return primera;
+    else return resto.template etapa<I - 1>();
+  }
+
+private:
+  PRIMERA primera;
+  Resto resto;
+};
+
+/**
+ * Interfaz virtual equivalente, para comparar la cadena compuesta al compilar con una armada en
+ * tiempo de ejecucion (cada muestra pasa por una llamada virtual en cada etapa)
+ */
+template <typename T>
+class EtapaVirtual {
+public:
+  virtual ~EtapaVirtual() {}
+  virtual void procesar(const T &x) = 0;
+};
+
+/**
+ * Adaptador que pone una etapa detras de la interfaz virtual: la misma etapa, pero la siguiente
+ * se conecta en tiempo de ejecucion
+ */
+template <typename E>
+class AdaptadorVirtual : public EtapaVirtual<typename E::Entrada> {
+public:
+  /**
+   * @param siguiente Etapa que recibe las salidas, o NULL si esta es el sumidero
+   */
+  explicit AdaptadorVirtual(EtapaVirtual<typename E::Salida> *siguiente) { reenvio.destino = siguiente; }
+
+  void procesar(const typename E::Entrada &x) override {
+    if (reenvio.destino) etapa.procesar(x, reenvio);
+    else etapa.procesar(x, fin);
+  }
+
+  E etapa;
+
+private:
+  struct Reenvio {
+    EtapaVirtual<typename E::Salida> *destino;
+    void procesar(const typename E::Salida &y) { destino->procesar(y); }
+  } reenvio;
+  FinCadena fin;
+};
+
+#endif
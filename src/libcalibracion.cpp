@@ -0,0 +1,107 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libcalibracion.h"
+#include "libhalsens.h"
+
+// Constantes de esp_adc_cal_esp32.c para el ADC1 (12 bits)
+#define ESCALA_COEF_A 65536
+static const uint32_t ESCALA_VREF_ADC1[4] = {57431, 76236, 105481, 196602};
+static const uint32_t DESPLAZAMIENTO_VREF_ADC1[4] = {75, 78, 88, 142};
+#define LUT_VREF_BAJO 1000
+#define LUT_VREF_ALTO 1200
+#define LUT_PASO 64
+#define LUT_PUNTOS 20
+#define LUT_UMBRAL_BAJO 2880
+#define LUT_UMBRAL_ALTO (LUT_UMBRAL_BAJO + LUT_PASO)
+// Curvas de la zona no lineal de 11 dB para un chip con Vref de 1000 mV y de 1200 mV
+static const uint32_t LUT_ADC1_BAJA[LUT_PUNTOS] = {2240, 2297, 2352, 2405, 2457, 2512, 2564, 2616, 2664, 2709,
+                                                   2754, 2795, 2832, 2868, 2903, 2937, 2969, 3000, 3030, 3060};
+static const uint32_t LUT_ADC1_ALTA[LUT_PUNTOS] = {2667, 2706, 2745, 2780, 2813, 2844, 2873, 2901, 2928, 2956,
+                                                   2982, 3006, 3032, 3059, 3084, 3110, 3135, 3160, 3184, 3209};
+
+
+void caracterizarADC1(uint8_t atenuacion, uint32_t vref, CaracterizacionADC &c) {
+  atenuacion &= 3;
+  c.coefA = (vref * ESCALA_VREF_ADC1[atenuacion]) / CAL_TAM_TABLA;
+  c.coefB = DESPLAZAMIENTO_VREF_ADC1[atenuacion];
+  c.vref = vref;
+  c.atenuacion = atenuacion;
+}
+
+
+/**
+ * Funcion que evalua la recta de la caracterizacion
+ */
+static uint32_t voltajeLineal(uint32_t crudo, const CaracterizacionADC &c) {
+  return ((c.coefA * crudo) + ESCALA_COEF_A / 2) / ESCALA_COEF_A + c.coefB;
+}
+
+
+/**
+ * Funcion que interpola en las curvas de la zona no lineal: linealmente en el dato entre dos puntos
+ * y linealmente en el Vref entre la curva baja y la alta (interpolacion bilineal)
+ */
+static uint32_t voltajeTabla(uint32_t crudo, uint32_t vref) {
+  uint32_t i = (crudo - LUT_UMBRAL_BAJO) / LUT_PASO;
+  int32_t x2 = LUT_VREF_ALTO - (int32_t)vref;
+  int32_t x1 = (int32_t)vref - LUT_VREF_BAJO;
+  int32_t y2 = (int32_t)((i + 1) * LUT_PASO + LUT_UMBRAL_BAJO) - (int32_t)crudo;
+  int32_t y1 = (int32_t)crudo - (int32_t)(i * LUT_PASO + LUT_UMBRAL_BAJO);
+  int32_t v = (int32_t)LUT_ADC1_BAJA[i] * x2 * y2 + (int32_t)LUT_ADC1_ALTA[i] * x1 * y2 +
+              (int32_t)LUT_ADC1_BAJA[i + 1] * x2 * y1 + (int32_t)LUT_ADC1_ALTA[i + 1] * x1 * y1;
+  v += ((LUT_VREF_ALTO - LUT_VREF_BAJO) * LUT_PASO) / 2;
+  v /= (LUT_VREF_ALTO - LUT_VREF_BAJO) * LUT_PASO;
+  return (uint32_t)v;
+}
+
+
+uint32_t crudoAMilivoltios(uint32_t crudo, const CaracterizacionADC &c) {
+  if (crudo > CAL_TAM_TABLA - 1) crudo = CAL_TAM_TABLA - 1;
+  if (c.atenuacion != CAL_ATENUACION_11DB || crudo < LUT_UMBRAL_BAJO) return voltajeLineal(crudo, c);
+  uint32_t tabla = voltajeTabla(crudo, c.vref);
+  if (crudo > LUT_UMBRAL_ALTO) return tabla;
+  // En la transicion se pasa de la recta a la curva linealmente, para que no haya un escalon
+  uint32_t lineal = voltajeLineal(crudo, c);
+  uint32_t x = crudo - LUT_UMBRAL_BAJO;
+  return (lineal * LUT_PASO + tabla * x - lineal * x + LUT_PASO / 2) / LUT_PASO;
+}
+
+
+bool construirTablaCalibracion(TablaCalibracion &tabla, uint8_t atenuacion) {
+  int fuente = halAdcCaracterizar(atenuacion, CAL_VREF_DEFECTO);
+  if (fuente < 0) return false;
+  tabla.atenuacion = atenuacion;
+  tabla.fuente = (uint8_t)fuente;
+  uint32_t anterior = 0;
+  for (uint32_t crudo = 0; crudo < CAL_TAM_TABLA; crudo++) {
+    uint32_t mv = halAdcMilivoltios((uint16_t)crudo, atenuacion);
+    // En la transicion de 11 dB la recta y la curva se redondean por separado antes de mezclarse y
+    // con algunos Vref la conversion baja 1 mV de un dato al siguiente; la curva real siempre sube,
+    // asi que repetir el valor anterior la deja monotona sin pasar de 1 mV de error
+    if (mv < anterior) mv = anterior;
+    anterior = mv;
+    tabla.milivoltios[crudo] = (uint16_t)(mv > 0xFFFF ? 0xFFFF : mv);
+  }
+  return true;
+}
@@ -0,0 +1,109 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBCALIBRACION_H
+#define LIBCALIBRACION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Calibracion del ADC1 por tablas: en la inicializacion se caracteriza el ADC (con el Vref o
+// los dos puntos que Espressif graba en el eFuse) para la atenuacion de cada canal y se evalua
+// la conversion a milivoltios de esp_adc_cal para los 4096 valores posibles. En el camino de
+// las muestras convertir queda en una sola lectura de la tabla, sin el ajuste de curva
+// (multiplicaciones, division y la interpolacion bilineal de la zona no lineal de 11 dB).
+
+#define CAL_TAM_TABLA 4096       // Un valor por cada dato de 12 bits
+#define CAL_VREF_DEFECTO 1100    // Vref en mV que se supone si el eFuse no trae calibracion
+#define CAL_ATENUACION_0DB 0     // Mismos valores que adc_atten_t
+#define CAL_ATENUACION_2_5DB 1
+#define CAL_ATENUACION_6DB 2
+#define CAL_ATENUACION_11DB 3
+#define CAL_FUENTE_DEFECTO 0     // Origen de la caracterizacion, como esp_adc_cal_value_t
+#define CAL_FUENTE_EFUSE_VREF 1
+#define CAL_FUENTE_EFUSE_DOS_PUNTOS 2
+
+/**
+ * Recta de conversion del ADC1 para una atenuacion: mV = (coefA * dato + 2^15) / 2^16 + coefB,
+ * con una correccion por tabla en la zona no lineal de 11 dB (igual que esp_adc_cal del ESP32)
+ */
+struct CaracterizacionADC {
+  uint32_t coefA;
+  uint32_t coefB;
+  uint32_t vref;
+  uint8_t atenuacion;
+};
+
+/**
+ * Funcion que caracteriza el ADC1 a partir de un Vref, como characterize_using_vref() de esp_adc_cal
+ * @param atenuacion Atenuacion del canal (CAL_ATENUACION_*)
+ * @param vref Vref del chip en mV (del eFuse o CAL_VREF_DEFECTO)
+ * @param c Donde se escribe la caracterizacion
+ */
+void caracterizarADC1(uint8_t atenuacion, uint32_t vref, CaracterizacionADC &c);
+
+/**
+ * Funcion que convierte un dato de 12 bits a milivoltios con las mismas operaciones enteras que
+ * esp_adc_cal_raw_to_voltage() del ESP32. Es lenta: solo se usa para llenar las tablas
+ */
+uint32_t crudoAMilivoltios(uint32_t crudo, const CaracterizacionADC &c);
+
+/**
+ * Tabla de conversion de un canal: dato de 12 bits -> milivoltios
+ */
+struct TablaCalibracion {
+  uint16_t milivoltios[CAL_TAM_TABLA];
+  uint8_t atenuacion;
+  uint8_t fuente;  // CAL_FUENTE_*
+
+  /**
+   * Funcion que convierte un dato crudo (solo se usan sus 12 bits bajos)
+   */
+  inline uint16_t convertir(uint16_t crudo) const { return milivoltios[crudo & (CAL_TAM_TABLA - 1)]; }
+
+  /**
+   * Funcion que convierte un valor de mas de 12 bits (sobremuestreo) interpolando entre dos entradas
+   * @param valor Valor con bits de resolucion
+   * @param bits Resolucion del valor (12 a 16)
+   * @return Milivoltios con bits - 12 bits de fraccion
+   */
+  inline uint16_t convertir(uint16_t valor, uint8_t bits) const {
+    uint8_t fraccion = bits - 12;
+    uint16_t i = valor >> fraccion;
+    uint32_t a = milivoltios[i & (CAL_TAM_TABLA - 1)];
+    uint32_t b = milivoltios[i < CAL_TAM_TABLA - 1 ? i + 1 : i];
+    uint32_t mv = (a << fraccion) + (b - a) * (valor & ((1u << fraccion) - 1));
+    return (uint16_t)(mv > 0xFFFF ? 0xFFFF : mv);
+  }
+};
+
+/**
+ * Funcion que llena la tabla de un canal con la caracterizacion del chip (halAdcCaracterizar()) y
+ * la conversion de referencia (halAdcMilivoltios()) para su atenuacion, sin escalones hacia abajo
+ * @param tabla Tabla a llenar
+ * @param atenuacion Atenuacion configurada en el canal (CAL_ATENUACION_*)
+ * @return false si la caracterizacion fallo
+ */
+bool construirTablaCalibracion(TablaCalibracion &tabla, uint8_t atenuacion);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libcaptura.h"
+#include <string.h>
+#include "libhal.h"
+#include "libringbuffer.h"
+#include "libpaquete.h"
+#include "libtelemetria.h"
+
+// Un buffer por tarea productora: la del ADC (que tambien recoge el giroscopio), la del touch y la del GPS
+BufferCircular<RegistroCaptura, 128> capturaSensores;
+BufferCircular<RegistroCaptura, 16> capturaTouch;
+BufferCircular<RegistroCaptura, 32> capturaGPS;
+static bool activa = false;
+static int tareaCaptura = -1;
+static uint8_t bloque[CAPTURA_TAM_BLOQUE];
+static size_t largoBloque = 0;
+static uint16_t secuenciaBloque = 0;
+static EstadisticasCaptura estadisticas = {};
+
+
+/**
+ * Funcion que arma un registro con la marca de tiempo y la carga
+ */
+static inline RegistroCaptura registro(uint8_t tipo, uint64_t marcaTiempo, const void *datos, size_t len) {
+  RegistroCaptura r;
+  r.marcaTiempo = marcaTiempo;
+  r.tipo = tipo;
+  r.len = (uint8_t)len;
+  memcpy(r.datos, datos, len);
+  return r;
+}
+
+
+void capturarAdc(const MuestraADC &muestra) {
+  if (!activa) return;
+  uint8_t carga[7] = {(uint8_t)muestra.x, (uint8_t)(muestra.x >> 8), (uint8_t)muestra.y, (uint8_t)(muestra.y >> 8),
+                      (uint8_t)muestra.z, (uint8_t)(muestra.z >> 8), muestra.bits};
+  capturaSensores.push(registro(CAPTURA_ADC, muestra.marcaTiempo, carga, sizeof(carga)));
+}
+
+
+void capturarGiroscopio(const MuestraGiroscopio &muestra) {
+  if (!activa) return;
+  uint8_t carga[6] = {(uint8_t)muestra.x, (uint8_t)((uint16_t)muestra.x >> 8), (uint8_t)muestra.y, (uint8_t)((uint16_t)muestra.y >> 8),
+                      (uint8_t)muestra.z, (uint8_t)((uint16_t)muestra.z >> 8)};
+  capturaSensores.push(registro(CAPTURA_GIROSCOPIO, muestra.marcaTiempo, carga, sizeof(carga)));
+}
+
+
+void capturarTouch(uint64_t marcaTiempo, const uint16_t *valores, uint8_t n) {
+  if (!activa) return;
+  uint8_t carga[CAPTURA_MAX_CARGA];
+  if (n > CAPTURA_MAX_CARGA / 2) n = CAPTURA_MAX_CARGA / 2;
+  for (uint8_t i = 0; i < n; i++) {
+    carga[2 * i] = (uint8_t)valores[i];
+    carga[2 * i + 1] = (uint8_t)(valores[i] >> 8);
+  }
+  capturaTouch.push(registro(CAPTURA_TOUCH, marcaTiempo, carga, 2 * n));
+}
+
+
+void capturarNMEA(uint64_t marcaTiempo, const uint8_t *datos, size_t n) {
+  if (!activa) return;
+  for (size_t i = 0; i < n; i += CAPTURA_MAX_CARGA)  // En trozos, todos con el instante de la lectura
+    capturaGPS.push(registro(CAPTURA_NMEA, marcaTiempo, datos + i, (n - i < CAPTURA_MAX_CARGA) ? n - i : CAPTURA_MAX_CARGA));
+}
+
+
+/**
+ * Funcion que cierra el bloque en construccion: le pone el CRC, lo codifica con COBS y lo envia
+ */
+static void cerrarBloque() {
+  if (largoBloque <= 3) return;  // Solo el encabezado
+  largoBloque = agregarCrcPaquete(bloque, largoBloque);
+  static uint8_t codificado[CAPTURA_TAM_MAX];
+  size_t n = cobsCodificar(bloque, largoBloque, codificado);
+  codificado[n++] = 0x00;
+  halSalida(codificado, n);
+  estadisticas.bloques++;
+  estadisticas.bytes += n;
+  largoBloque = 0;
+}
+
+
+/**
+ * Funcion que agrega un registro al bloque, cerrandolo antes si no cabe
+ */
+static void agregarRegistro(const RegistroCaptura &r) {
+  if (largoBloque + CAPTURA_TAM_ENCABEZADO + r.len + 2 > CAPTURA_TAM_BLOQUE) cerrarBloque();
+  if (largoBloque == 0) {
+    bloque[0] = CAPTURA_SYNC;
+    bloque[1] = (uint8_t)secuenciaBloque;
+    bloque[2] = (uint8_t)(secuenciaBloque >> 8);
+    secuenciaBloque++;
+    largoBloque = 3;
+  }
+  uint32_t t = (uint32_t)r.marcaTiempo;
+  uint8_t *p = &bloque[largoBloque];
+  p[0] = r.tipo;
+  p[1] = r.len;
+  p[2] = (uint8_t)t;
+  p[3] = (uint8_t)(t >> 8);
+  p[4] = (uint8_t)(t >> 16);
+  p[5] = (uint8_t)(t >> 24);
+  memcpy(p + CAPTURA_TAM_ENCABEZADO, r.datos, r.len);
+  largoBloque += CAPTURA_TAM_ENCABEZADO + r.len;
+  estadisticas.registros[r.tipo]++;
+}
+
+
+/**
+ * Manejador de la tarea de la captura: vacia los buffers en bloques. El orden solo se garantiza
+ * dentro de cada tipo (cada uno tiene un solo productor)
+ */
+static void vaciarCaptura() {
+  RegistroCaptura r;
+  while (capturaSensores.pop(r)) agregarRegistro(r);
+  while (capturaTouch.pop(r)) agregarRegistro(r);
+  while (capturaGPS.pop(r)) agregarRegistro(r);
+  cerrarBloque();  // Un bloque por periodo aunque no este lleno, para no atrasar la captura
+}
+
+
+bool iniciarCaptura(uint8_t prioridad, uint8_t nucleo) {
+  tareaCaptura = halTareaEventos(vaciarCaptura, CAPTURA_PERIODO_US, "Captura", prioridad, nucleo);
+  if (tareaCaptura < 0) return false;
+  activa = true;
+  return true;
+}
+
+
+bool capturaActiva() {
+  return activa;
+}
+
+
+EstadisticasCaptura estadisticasCaptura() {
+  EstadisticasCaptura e = estadisticas;
+  e.perdidos = capturaSensores.perdidas() + capturaTouch.perdidas() + capturaGPS.perdidas();
+  return e;
+}
+
+
+DecodificadorCaptura::DecodificadorCaptura(void (*alRegistro)(const RegistroCaptura &registro))
+    : bloques(0), errores(0), bloquesPerdidos(0), consumidor(alRegistro), indice(0), desbordado(false), haySecuencia(false),
+      ultimaSecuencia(0) {
+  for (uint8_t i = 0; i < CAPTURA_NUM_TIPOS; i++) ultimaMarca[i] = 0;
+}
+
+
+void DecodificadorCaptura::procesar(uint8_t byte) {
+  if (byte != 0x00) {  // Byte de datos: se acumula hasta el delimitador
+    if (indice < sizeof(recibido)) recibido[indice++] = byte; else desbordado = true;
+    return;
+  }
+  size_t len = indice;
+  bool desborde = desbordado;
+  indice = 0;
+  desbordado = false;
+  if (len == 0) return;
+  uint8_t carga[CAPTURA_TAM_MAX];
+  size_t n = desborde ? 0 : cobsDecodificar(recibido, len, carga);
+  if (n < 5 || carga[0] != CAPTURA_SYNC || !crcPaqueteValido(carga, n)) {
+    errores++;  // Tambien las tramas de telemetria que hubiera antes de iniciar la captura
+    return;
+  }
+  decodificar(carga, n - PAQUETE_TAM_CRC);
+}
+
+
+void DecodificadorCaptura::decodificar(const uint8_t *carga, size_t len) {
+  uint16_t secuencia = (uint16_t)(carga[1] | (carga[2] << 8));
+  if (haySecuencia) bloquesPerdidos += (uint16_t)(secuencia - ultimaSecuencia - 1);
+  haySecuencia = true;
+  ultimaSecuencia = secuencia;
+  bloques++;
+  size_t i = 3;
+  while (i + CAPTURA_TAM_ENCABEZADO <= len) {
+    RegistroCaptura r;
+    r.tipo = carga[i];
+    r.len = carga[i + 1];
+    if (r.tipo == 0 || r.tipo >= CAPTURA_NUM_TIPOS || r.len > CAPTURA_MAX_CARGA || i + CAPTURA_TAM_ENCABEZADO + r.len > len) {
+      errores++;  // El CRC estaba bien, asi que es un formato de otra version
+      return;
+    }
+    uint32_t t = (uint32_t)carga[i + 2] | ((uint32_t)carga[i + 3] << 8) | ((uint32_t)carga[i + 4] << 16) | ((uint32_t)carga[i + 5] << 24);
+    uint64_t &ultima = ultimaMarca[r.tipo];
+    ultima = (ultima == 0) ? t : ultima + (uint32_t)(t - (uint32_t)ultima);  // Avanza lo que avanzaron los 32 bits bajos
+    r.marcaTiempo = ultima;
+    memcpy(r.datos, carga + i + CAPTURA_TAM_ENCABEZADO, r.len);
+    i += CAPTURA_TAM_ENCABEZADO + r.len;
+    consumidor(r);
+  }
+}
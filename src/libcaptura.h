@@ -0,0 +1,136 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBCAPTURA_H
+#define LIBCAPTURA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libprocesamiento.h"
+#include "libgiroscopio.h"
+
+// Captura de las entradas crudas de los sensores para reproducirlas despues en el simulador: las
+// muestras del ADC antes de calibrar, las lecturas de los touchpads, las muestras del giroscopio y
+// los bytes NMEA del GPS, cada una con su marca de tiempo. Cada tarea que produce registros tiene su
+// propio BufferCircular (un productor y un consumidor), y una tarea de baja prioridad los junta en
+// bloques que salen por halSalida() en lugar de la telemetria.
+//
+// Formato de un bloque de la captura (antes de COBS; se termina con 0x00 como la telemetria): el tipo
+// CAPTURA_SYNC (0xC7), la secuencia y el CRC de libpaquete.h, sin la marca de tiempo comun, y
+//  [3..n-3] Registros: tipo (1), bytes de la carga (1), marca de tiempo en us (4, los 32 bits bajos), carga
+// Cargas: ADC x, y, z (uint16) y bits (1); touch un uint16 por pad; giroscopio x, y, z (int16); NMEA los bytes
+
+#define CAPTURA_SYNC 0xC7
+#define CAPTURA_ADC 1
+#define CAPTURA_TOUCH 2
+#define CAPTURA_GIROSCOPIO 3
+#define CAPTURA_NMEA 4
+#define CAPTURA_NUM_TIPOS 5
+#define CAPTURA_MAX_CARGA 16          // Bytes maximos de la carga de un registro (el NMEA se parte en trozos)
+#define CAPTURA_TAM_ENCABEZADO 6      // Tipo, bytes y marca de tiempo de un registro
+#define CAPTURA_TAM_BLOQUE 240        // Bytes maximos de un bloque sin codificar (COBS sin bytes extra)
+#define CAPTURA_TAM_MAX (CAPTURA_TAM_BLOQUE + 2)  // Bloque codificado con COBS y el delimitador
+#define CAPTURA_PERIODO_US 20000      // Cada cuanto la tarea de la captura vacia los buffers
+
+/**
+ * Registro de la captura
+ */
+struct RegistroCaptura {
+  uint64_t marcaTiempo;                // En la captura van los 32 bits bajos; el decodificador los desenvuelve
+  uint8_t tipo;                        // CAPTURA_*
+  uint8_t len;                         // Bytes de la carga
+  uint8_t datos[CAPTURA_MAX_CARGA];
+};
+
+/**
+ * Contadores de la captura
+ */
+struct EstadisticasCaptura {
+  uint32_t registros[CAPTURA_NUM_TIPOS];  // Registros enviados por tipo
+  uint32_t perdidos;                      // Registros descartados porque su buffer estaba lleno
+  uint32_t bloques;
+  uint64_t bytes;                         // Bytes enviados por halSalida()
+};
+
+/**
+ * Funcion que arranca la captura: crea la tarea que vacia los buffers y desde entonces la
+ * telemetria no sale por halSalida() (el flujo es solo de la captura)
+ * @param prioridad Prioridad de la tarea (baja: solo copia bytes a la salida)
+ * @param nucleo Nucleo al que se fija la tarea
+ * @return false si no se pudo crear la tarea
+ */
+bool iniciarCaptura(uint8_t prioridad, uint8_t nucleo);
+
+/**
+ * Funcion que dice si la captura esta andando
+ */
+bool capturaActiva();
+
+/**
+ * Funciones que agregan un registro a la captura, cada una desde la tarea de su sensor. Si la
+ * captura no esta andando no hacen nada
+ */
+void capturarAdc(const MuestraADC &muestra);
+void capturarGiroscopio(const MuestraGiroscopio &muestra);
+void capturarTouch(uint64_t marcaTiempo, const uint16_t *valores, uint8_t n);
+void capturarNMEA(uint64_t marcaTiempo, const uint8_t *datos, size_t n);
+
+/**
+ * Contadores de la captura
+ */
+EstadisticasCaptura estadisticasCaptura();
+
+/**
+ * Decodificador de flujo de la captura (lado del computador): recibe los bytes uno a uno, separa
+ * los bloques por el delimitador 0x00, los valida y entrega sus registros con la marca de tiempo
+ * desenvuelta a 64 bits (por tipo, asi que una captura puede durar mas de 71 minutos)
+ */
+class DecodificadorCaptura {
+public:
+  /**
+   * @param alRegistro Funcion que recibe cada registro valido
+   */
+  explicit DecodificadorCaptura(void (*alRegistro)(const RegistroCaptura &registro));
+
+  /**
+   * Funcion que procesa un byte recibido
+   */
+  void procesar(uint8_t byte);
+
+  uint32_t bloques;          // Bloques validos
+  uint32_t errores;          // Bloques descartados por COBS, CRC o formato
+  uint32_t bloquesPerdidos;  // Segun los saltos del numero de secuencia
+
+private:
+  void decodificar(const uint8_t *bloque, size_t len);
+
+  void (*consumidor)(const RegistroCaptura &registro);
+  uint8_t recibido[CAPTURA_TAM_MAX];
+  size_t indice;
+  bool desbordado;
+  bool haySecuencia;
+  uint16_t ultimaSecuencia;
+  uint64_t ultimaMarca[CAPTURA_NUM_TIPOS];
+};
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libcolumnar.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Los encabezados y los valores se escriben tal como estan en memoria: el formato es little endian
+// como los computadores (x86 y ARM) donde corre la pasarela
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "El archivo columnar se escribe en little endian");
+
+/**
+ * Funcion que redondea hacia arriba a un multiplo de 8
+ */
+static inline size_t alinear8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+
+size_t tamTipoColumnar(uint8_t tipo) {
+  switch (tipo) {
+  case COLUMNAR_TIPO_U8: return 1;
+  case COLUMNAR_TIPO_U16: return 2;
+  case COLUMNAR_TIPO_I16: return 2;
+  case COLUMNAR_TIPO_U64: return 8;
+  default: return 0;
+  }
+}
+
+
+/**
+ * Funcion que escribe todos los bytes (write() puede escribir menos de los pedidos)
+ */
+static bool escribirTodo(int archivo, const uint8_t *datos, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(archivo, datos, len);
+    if (n <= 0) return false;
+    datos += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+
+EscritorColumnar::EscritorColumnar() : bloques(0), bytes(0), archivo(-1), buffer(NULL), capacidad(0) {}
+
+
+EscritorColumnar::~EscritorColumnar() {
+  cerrar();
+  free(buffer);
+}
+
+
+bool EscritorColumnar::abrir(const char *ruta) {
+  archivo = open(ruta, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (archivo < 0) return false;
+  struct stat st;
+  uint8_t encabezado[COLUMNAR_TAM_ENCABEZADO] = {0};
+  if (fstat(archivo, &st) == 0 && st.st_size == 0) {  // Archivo nuevo
+    uint32_t version = COLUMNAR_VERSION, tamBloque = COLUMNAR_TAM_BLOQUE;
+    memcpy(encabezado, COLUMNAR_MAGIA, 8);
+    memcpy(&encabezado[8], &version, 4);
+    memcpy(&encabezado[12], &tamBloque, 4);
+    if (escribirTodo(archivo, encabezado, sizeof(encabezado))) return true;
+  } else if (pread(archivo, encabezado, sizeof(encabezado), 0) == (ssize_t)sizeof(encabezado) &&
+             memcmp(encabezado, COLUMNAR_MAGIA, 8) == 0) {
+    // Se sigue agregando al final (O_APPEND), sin el bloque incompleto que dejo una pasarela cortada:
+    // despues de el el lector no veria los bloques nuevos
+    LectorColumnar lector;
+    const BloqueColumnar *b;
+    const void *valores;
+    bool recortado = true;
+    if (lector.abrir(ruta)) {
+      while (lector.siguiente(b, valores)) {}
+      if (lector.incompleto) recortado = ftruncate(archivo, (off_t)lector.completos()) == 0;
+    }
+    if (recortado) return true;
+  }
+  close(archivo);
+  archivo = -1;
+  return false;
+}
+
+
+bool EscritorColumnar::agregarGrupo(uint32_t dispositivo, uint8_t fuente, const ColumnaColumnar *columnas, size_t numColumnas,
+                                    uint32_t cantidad, uint64_t primeraMarca, uint64_t ultimaMarca) {
+  if (archivo < 0 || cantidad == 0) return false;
+  size_t total = 0;
+  for (size_t c = 0; c < numColumnas; c++) total += COLUMNAR_TAM_BLOQUE + alinear8(cantidad * tamTipoColumnar(columnas[c].tipo));
+  std::lock_guard<std::mutex> guarda(mutex);
+  if (total > capacidad) {
+    uint8_t *nuevo = (uint8_t *)realloc(buffer, total);
+    if (nuevo == NULL) return false;
+    buffer = nuevo;
+    capacidad = total;
+  }
+  uint8_t *p = buffer;
+  for (size_t c = 0; c < numColumnas; c++) {
+    BloqueColumnar b = {COLUMNAR_MAGIA_BLOQUE, dispositivo, fuente, columnas[c].canal, columnas[c].tipo, 0, cantidad, primeraMarca, ultimaMarca};
+    memcpy(p, &b, COLUMNAR_TAM_BLOQUE);
+    size_t n = cantidad * tamTipoColumnar(columnas[c].tipo);
+    memcpy(p + COLUMNAR_TAM_BLOQUE, columnas[c].valores, n);
+    memset(p + COLUMNAR_TAM_BLOQUE + n, 0, alinear8(n) - n);
+    p += COLUMNAR_TAM_BLOQUE + alinear8(n);
+  }
+  if (!escribirTodo(archivo, buffer, total)) return false;
+  bloques += numColumnas;
+  bytes += total;
+  return true;
+}
+
+
+void EscritorColumnar::cerrar() {
+  if (archivo >= 0) close(archivo);
+  archivo = -1;
+}
+
+
+LectorColumnar::LectorColumnar() : incompleto(false), mapa(NULL), largo(0), posicion(0) {}
+
+
+LectorColumnar::~LectorColumnar() {
+  cerrar();
+}
+
+
+bool LectorColumnar::abrir(const char *ruta) {
+  int archivo = open(ruta, O_RDONLY);
+  if (archivo < 0) return false;
+  struct stat st;
+  if (fstat(archivo, &st) == 0 && st.st_size >= COLUMNAR_TAM_ENCABEZADO) {
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, archivo, 0);
+    if (m != MAP_FAILED) {
+      mapa = (const uint8_t *)m;
+      largo = (size_t)st.st_size;
+    }
+  }
+  close(archivo);  // El mapa sigue valido sin el descriptor
+  if (mapa == NULL) return false;
+  if (memcmp(mapa, COLUMNAR_MAGIA, 8) != 0) {
+    cerrar();
+    return false;
+  }
+  posicion = COLUMNAR_TAM_ENCABEZADO;
+  incompleto = false;
+  return true;
+}
+
+
+bool LectorColumnar::siguiente(const BloqueColumnar *&bloque, const void *&valores) {
+  if (mapa == NULL || posicion >= largo) return false;
+  const BloqueColumnar *b = (const BloqueColumnar *)(mapa + posicion);  // Alineado: todo en el archivo va en multiplos de 8
+  size_t tam = (largo - posicion < COLUMNAR_TAM_BLOQUE) ? 0 : tamTipoColumnar(b->tipo);
+  if (tam == 0 || b->magia != COLUMNAR_MAGIA_BLOQUE || largo - posicion - COLUMNAR_TAM_BLOQUE < alinear8((size_t)b->cantidad * tam)) {
+    incompleto = true;
+    return false;
+  }
+  bloque = b;
+  valores = mapa + posicion + COLUMNAR_TAM_BLOQUE;
+  posicion += COLUMNAR_TAM_BLOQUE + alinear8((size_t)b->cantidad * tam);
+  return true;
+}
+
+
+void LectorColumnar::cerrar() {
+  if (mapa != NULL) munmap((void *)mapa, largo);
+  mapa = NULL;
+  largo = 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBCOLUMNAR_H
+#define LIBCOLUMNAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+
+// Archivo columnar de la pasarela (lado del computador): solo se le agregan bloques al final y cada
+// bloque tiene los valores de un solo canal de un dispositivo, contiguos y alineados a 8 bytes, de
+// modo que un analisis puede mapear el archivo en memoria (mmap) y leer una columna sin copiarla.
+// Todos los campos en little endian.
+//
+//  Encabezado del archivo (32 bytes): "DKCOLUM1", version (4), tamaño del encabezado de bloque (4),
+//  reservado (16)
+//  Bloque: encabezado (32 bytes) seguido de cantidad * tamaño del tipo bytes, rellenados hasta un multiplo de 8
+//   [0..3]   COLUMNAR_MAGIA_BLOQUE
+//   [4..7]   Dispositivo
+//   [8]      Fuente (COLUMNAR_FUENTE_*)
+//   [9]      Canal (COLUMNAR_CANAL_* para la telemetria; 0 el tiempo y 1.. los canales para LoRa)
+//   [10]     Tipo de los valores (COLUMNAR_TIPO_*)
+//   [11]     Reservado
+//   [12..15] Cantidad de valores
+//   [16..23] Marca de tiempo de la primera muestra en us (desenvuelta a 64 bits)
+//   [24..31] Marca de tiempo de la ultima muestra en us
+// Los canales de un mismo grupo (dispositivo y fuente) se escriben juntos y con la misma cantidad, asi
+// que el valor i de cada canal corresponde a la marca de tiempo i del canal de tiempo del grupo. Si la
+// pasarela se corta a mitad de un bloque, el ultimo queda incompleto y el lector lo ignora.
+
+#define COLUMNAR_MAGIA "DKCOLUM1"
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_TAM_ENCABEZADO 32
+#define COLUMNAR_MAGIA_BLOQUE 0x51424B44  // "DKBQ"
+#define COLUMNAR_TAM_BLOQUE 32
+#define COLUMNAR_MUESTRAS_BLOQUE 4096     // Muestras por bloque: las columnas se escriben cuando se llena el grupo
+
+#define COLUMNAR_FUENTE_TELEMETRIA 1      // Tramas del puerto serial (libtelemetria.h)
+#define COLUMNAR_FUENTE_LORA 2            // Paquetes de muestras de LoRa (libempaquetador.h)
+#define COLUMNAR_FUENTE_LORA_SIN_FILTRAR 3 // Historia previa de LoRa sin el filtro del EKG (PAQUETE_TIPO_*_SIN_FILTRAR)
+
+#define COLUMNAR_CANAL_TIEMPO 0           // Canales de la telemetria
+#define COLUMNAR_CANAL_ADC_X 1
+#define COLUMNAR_CANAL_ADC_Y 2
+#define COLUMNAR_CANAL_ADC_Z 3
+#define COLUMNAR_CANAL_GIRO_X 4
+#define COLUMNAR_CANAL_GIRO_Y 5
+#define COLUMNAR_CANAL_GIRO_Z 6
+#define COLUMNAR_CANAL_BANDERAS 7         // Bit 0: milivoltios, bit 1: tasa de reposo
+#define COLUMNAR_CANALES_TELEMETRIA 8
+
+#define COLUMNAR_TIPO_U8 1
+#define COLUMNAR_TIPO_U16 2
+#define COLUMNAR_TIPO_I16 3
+#define COLUMNAR_TIPO_U64 4
+
+/**
+ * Funcion que da los bytes de un valor de un tipo COLUMNAR_TIPO_* (0 si el tipo no existe)
+ */
+size_t tamTipoColumnar(uint8_t tipo);
+
+/**
+ * Encabezado de un bloque, tal como queda en el archivo
+ */
+struct BloqueColumnar {
+  uint32_t magia;
+  uint32_t dispositivo;
+  uint8_t fuente;
+  uint8_t canal;
+  uint8_t tipo;
+  uint8_t reservado;
+  uint32_t cantidad;
+  uint64_t primeraMarca;
+  uint64_t ultimaMarca;
+};
+static_assert(sizeof(BloqueColumnar) == COLUMNAR_TAM_BLOQUE, "El encabezado de bloque debe ocupar 32 bytes sin relleno");
+
+/**
+ * Columna que se va a escribir: los valores ya en el tipo del archivo
+ */
+struct ColumnaColumnar {
+  uint8_t canal;
+  uint8_t tipo;
+  const void *valores;
+};
+
+/**
+ * Escritor del archivo columnar. Lo pueden usar varios hilos: cada grupo se agrega con una sola
+ * escritura bajo un mutex, asi que los bloques de un grupo nunca quedan intercalados con otros
+ */
+class EscritorColumnar {
+public:
+  EscritorColumnar();
+  ~EscritorColumnar();
+
+  /**
+   * Funcion que abre el archivo para agregarle bloques; si no existe o esta vacio le escribe el encabezado,
+   * y si termina en un bloque incompleto lo recorta
+   * @return false si no se pudo abrir o si no es un archivo columnar
+   */
+  bool abrir(const char *ruta);
+
+  /**
+   * Funcion que agrega las columnas de un grupo, todas con la misma cantidad de valores
+   * @return false si fallo la escritura
+   */
+  bool agregarGrupo(uint32_t dispositivo, uint8_t fuente, const ColumnaColumnar *columnas, size_t numColumnas, uint32_t cantidad,
+                    uint64_t primeraMarca, uint64_t ultimaMarca);
+
+  void cerrar();
+
+  uint64_t bloques;  // Bloques escritos
+  uint64_t bytes;    // Bytes escritos, con los encabezados
+
+private:
+  int archivo;
+  std::mutex mutex;
+  uint8_t *buffer;   // Grupo armado antes de escribirlo de una vez
+  size_t capacidad;
+};
+
+/**
+ * Lector del archivo columnar: lo mapea en memoria y recorre sus bloques sin copiar los valores
+ */
+class LectorColumnar {
+public:
+  LectorColumnar();
+  ~LectorColumnar();
+
+  /**
+   * Funcion que mapea el archivo
+   * @return false si no se pudo abrir o si no es un archivo columnar
+   */
+  bool abrir(const char *ruta);
+
+  /**
+   * Funcion que da el siguiente bloque completo
+   * @param bloque Donde se escribe un puntero al encabezado del bloque (dentro del mapa)
+   * @param valores Donde se escribe un puntero a sus valores (dentro del mapa, alineados a 8 bytes)
+   * @return false al llegar al final o a un bloque incompleto o dañado
+   */
+  bool siguiente(const BloqueColumnar *&bloque, const void *&valores);
+
+  void cerrar();
+
+  /**
+   * Bytes del archivo hasta el final del ultimo bloque completo leido
+   */
+  size_t completos() const { return posicion; }
+
+  bool incompleto;  // true si al final quedo un bloque cortado o dañado
+
+private:
+  const uint8_t *mapa;
+  size_t largo;
+  size_t posicion;
+};
+
+#endif
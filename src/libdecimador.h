@@ -0,0 +1,232 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBDECIMADOR_H
+#define LIBDECIMADOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include "libfiltros.h"
+
+// Decimador CIC (integrador-peine en cascada) para sobremuestrear el ADC: se muestrea a FACTOR
+// veces la frecuencia de salida y el CIC promedia y filtra el aliasing sin multiplicaciones (solo
+// ETAPAS sumas por muestra de entrada y ETAPAS restas por muestra de salida). Un FIR de 3
+// coeficientes a la frecuencia de salida compensa la caida del CIC en la banda de paso. Con ruido
+// blanco cada factor de 4 en el sobremuestreo da un bit efectivo mas, asi que la salida se entrega
+// con 16 bits (12 del ADC y 4 de fraccion).
+//  - Los integradores son uint32_t y pueden desbordarse: la aritmetica modular da el resultado
+//    exacto mientras 12 + ETAPAS * log2(FACTOR) <= 32 (se verifica al compilar)
+//  - FACTOR debe ser potencia de 2 para quitar la ganancia FACTOR^ETAPAS con un desplazamiento
+
+#define DECIMADOR_BITS_ENTRADA 12
+#define DECIMADOR_BITS_SALIDA 16
+
+/**
+ * Funcion constexpr que calcula el logaritmo en base 2 de una potencia de 2
+ */
+constexpr uint8_t log2Const(uint32_t n) { return (n <= 1) ? 0 : 1 + log2Const(n >> 1); }
+
+/**
+ * Funcion constexpr que eleva a una potencia entera
+ */
+constexpr double potenciaConst(double base, uint8_t exponente) {
+  return (exponente == 0) ? 1 : base * potenciaConst(base, exponente - 1);
+}
+
+/**
+ * Funcion constexpr que da la respuesta en magnitud (normalizada, 1 en DC) de un CIC
+ * @param etapas Numero de etapas
+ * @param factor Factor de decimacion
+ * @param fs Frecuencia de salida en Hz
+ * @param f Frecuencia a evaluar en Hz (menor que fs / 2)
+ */
+constexpr double respuestaCIC(uint8_t etapas, uint32_t factor, double fs, double f) {
+  return (f <= 0) ? 1
+                  : potenciaConst(senoConst(PI_FILTROS * f / fs) / (factor * senoConst(PI_FILTROS * f / (fs * factor))), etapas);
+}
+
+/**
+ * Diseño del compensador de la caida del CIC: FIR simetrico {a, 1 - 2a, a} con ganancia 1 en DC y
+ * con la ganancia inversa del CIC en fc, asi la banda de paso queda plana hasta fc
+ * @param etapas Etapas del CIC
+ * @param factor Factor de decimacion del CIC
+ * @param fs Frecuencia de salida en Hz
+ * @param fc Frecuencia hasta la que se compensa en Hz (el borde de la banda de interes)
+ */
+constexpr std::array<double, 3> disenarCompensadorCIC(uint8_t etapas, uint32_t factor, double fs, double fc) {
+  double a = (1 - 1 / respuestaCIC(etapas, factor, fs, fc)) / (2 - 2 * cosenoConst(2 * PI_FILTROS * fc / fs));
+  return std::array<double, 3>{a, 1 - 2 * a, a};
+}
+
+/**
+ * Decimador CIC de un canal
+ * @param ETAPAS Numero de integradores y de peines (orden del filtro)
+ * @param FACTOR Muestras de entrada por muestra de salida (potencia de 2)
+ */
+template <uint8_t ETAPAS, uint16_t FACTOR>
+class DecimadorCIC {
+  static_assert(FACTOR >= 2 && (FACTOR & (FACTOR - 1)) == 0, "El factor de decimacion debe ser potencia de 2");
+  static_assert(ETAPAS >= 1 && DECIMADOR_BITS_ENTRADA + ETAPAS * log2Const(FACTOR) <= 32,
+                "El crecimiento de bits del CIC no cabe en 32 bits");
+  static_assert(ETAPAS * log2Const(FACTOR) >= DECIMADOR_BITS_SALIDA - DECIMADOR_BITS_ENTRADA,
+                "Muy poca ganancia para entregar 16 bits");
+
+public:
+  static const uint8_t DESPLAZAMIENTO = ETAPAS * log2Const(FACTOR) - (DECIMADOR_BITS_SALIDA - DECIMADOR_BITS_ENTRADA);
+
+  DecimadorCIC() { reiniciar(); }
+
+  /**
+   * Funcion que borra el estado del filtro
+   */
+  void reiniciar() {
+    for (uint8_t i = 0; i < ETAPAS; i++) integrador[i] = peine[i] = 0;
+    cuenta = 0;
+  }
+
+  /**
+   * Funcion que agrega una muestra de 12 bits
+   * @param x Muestra del ADC a la frecuencia alta
+   * @param salida Donde se escribe la muestra decimada de 16 bits cuando la hay
+   * @return true si se completo una muestra de salida
+   */
+  inline bool agregar(uint16_t x, uint16_t &salida) {
+    uint32_t v = x;
+    for (uint8_t i = 0; i < ETAPAS; i++) v = (integrador[i] += v);
+    if (++cuenta < FACTOR) return false;
+    cuenta = 0;
+    for (uint8_t i = 0; i < ETAPAS; i++) {  // Peines a la frecuencia de salida
+      uint32_t anterior = peine[i];
+      peine[i] = v;
+      v -= anterior;
+    }
+    v = (v + (DESPLAZAMIENTO ? (1u << (DESPLAZAMIENTO - 1)) : 0)) >> DESPLAZAMIENTO;
+    salida = (uint16_t)(v > 0xFFFF ? 0xFFFF : v);
+    return true;
+  }
+
+private:
+  uint32_t integrador[ETAPAS];
+  uint32_t peine[ETAPAS];
+  uint16_t cuenta;
+};
+
+/**
+ * Compensador de la caida del CIC de un canal: FIR simetrico de 3 coeficientes sobre las muestras
+ * decimadas de 16 bits
+ */
+class CompensadorCIC {
+public:
+  CompensadorCIC() : coef{0, 1 << 30, 0} { reiniciar(); }
+
+  /**
+   * Funcion que fija los coeficientes (cuantizarFIR<int32_t>(disenarCompensadorCIC(...)))
+   */
+  void configurar(const std::array<int32_t, 3> &coeficientes) { coef = coeficientes; }
+
+  /**
+   * Funcion que borra la historia
+   */
+  void reiniciar() { historia[0] = historia[1] = 0; }
+
+  /**
+   * Funcion que compensa una muestra decimada de 16 bits
+   */
+  inline uint16_t procesar(uint16_t decimada) {
+    int32_t x = ((int32_t)decimada - 32768) * 32768;  // 16 bits a Q31 con un bit de margen para la ganancia del compensador
+    int64_t acumulador = (int64_t)coef[0] * ((int64_t)x + historia[1]) + (int64_t)coef[1] * historia[0];  // Simetrico: una multiplicacion menos
+    int32_t y = (saturarAcumulador<int32_t>(acumulador) >> 15) + 32768;
+    historia[1] = historia[0];
+    historia[0] = x;
+    return (uint16_t)(y < 0 ? 0 : (y > 0xFFFF ? 0xFFFF : y));
+  }
+
+private:
+  std::array<int32_t, 3> coef;
+  int32_t historia[2];  // Las dos muestras decimadas anteriores (Q31)
+};
+
+/**
+ * Retardo de grupo del CIC mas el del compensador, en muestras de salida (para fechar las muestras)
+ */
+constexpr double retardoSobremuestreo(uint8_t etapas, uint16_t factor) { return etapas * (factor - 1) / (2.0 * factor) + 1; }
+
+/**
+ * Frente de adquisicion con sobremuestreo de varios canales: recibe los bloques intercalados del
+ * ADC a FACTOR veces la frecuencia de salida y entrega las muestras decimadas y compensadas de
+ * 16 bits, intercaladas en el mismo orden
+ * @param CANALES Numero de canales intercalados
+ * @param ETAPAS Etapas del CIC
+ * @param FACTOR Factor de sobremuestreo
+ */
+template <uint8_t CANALES, uint8_t ETAPAS, uint16_t FACTOR>
+class SobremuestreoADC {
+public:
+  static constexpr double RETARDO_SALIDA = retardoSobremuestreo(ETAPAS, FACTOR);
+
+  /**
+   * @param compensador Coeficientes del compensador (cuantizarFIR<int32_t>(disenarCompensadorCIC(...)))
+   */
+  explicit SobremuestreoADC(const std::array<int32_t, 3> &compensador) {
+    for (uint8_t c = 0; c < CANALES; c++) compensadores[c].configurar(compensador);
+  }
+
+  /**
+   * Funcion que borra el estado de todos los canales
+   */
+  void reiniciar() {
+    for (uint8_t c = 0; c < CANALES; c++) {
+      cic[c].reiniciar();
+      compensadores[c].reiniciar();
+    }
+  }
+
+  /**
+   * Funcion que decima un bloque
+   * @param muestras Muestras de 12 bits intercaladas por canal a la frecuencia alta
+   * @param numMuestras Muestras por canal del bloque
+   * @param salida Donde se escriben las muestras de 16 bits intercaladas (numMuestras / FACTOR por canal)
+   * @return Muestras de salida por canal
+   */
+  size_t procesarBloque(const uint16_t *muestras, size_t numMuestras, uint16_t *salida) {
+    size_t n = 0;
+    for (size_t i = 0; i < numMuestras; i++) {
+      bool lista = false;
+      for (uint8_t c = 0; c < CANALES; c++) {
+        uint16_t decimada;
+        if (!cic[c].agregar(muestras[i * CANALES + c], decimada)) continue;
+        lista = true;
+        salida[n * CANALES + c] = compensadores[c].procesar(decimada);
+      }
+      if (lista) n++;  // Todos los canales completan su muestra en la misma posicion
+    }
+    return n;
+  }
+
+private:
+  DecimadorCIC<ETAPAS, FACTOR> cic[CANALES];
+  CompensadorCIC compensadores[CANALES];
+};
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libempaquetador.h"
+#include <string.h>
+
+#define PAQUETE_MAX_BYTES_VALOR 3  // Un varint de una diferencia de 12 bits en zigzag ocupa hasta 3 bytes
+
+
+uint32_t tiempoAireLoRaUs(size_t len, uint8_t sf, uint32_t anchoBandaHz, uint8_t cr, uint16_t preambulo) {
+  uint32_t simboloUs = (uint32_t)(((uint64_t)1000000 << sf) / anchoBandaHz);
+  int32_t de = (simboloUs > 16000) ? 1 : 0;  // Optimizacion para tasas bajas, obligatoria con simbolos de mas de 16ms
+  int32_t numerador = 8 * (int32_t)len - 4 * sf + 28 + 16;
+  int32_t denominador = 4 * (sf - 2 * de);
+  int32_t bloques = (numerador > 0) ? (numerador + denominador - 1) / denominador : 0;
+  uint32_t simbolosCarga = 8 + (uint32_t)bloques * (cr + 4);
+  uint32_t preambuloUs = (uint32_t)(((uint64_t)(4 * preambulo + 17) * simboloUs) / 4);  // (preambulo + 4.25) simbolos
+  return preambuloUs + simbolosCarga * simboloUs;
+}
+
+
+EmpaquetadorMuestras::EmpaquetadorMuestras() {
+  iniciar(1, 0);
+}
+
+
+void EmpaquetadorMuestras::iniciar(uint8_t numCanales, uint16_t periodoUs, size_t cargaMax, bool milivoltios) {
+  canales = (numCanales > PAQUETE_MAX_CANALES) ? PAQUETE_MAX_CANALES : numCanales;
+  periodo = periodoUs;
+  tipo = milivoltios ? PAQUETE_TIPO_MILIVOLTIOS : PAQUETE_TIPO_MUESTRAS;
+  carga = (cargaMax > PAQUETE_CARGA_MAX) ? PAQUETE_CARGA_MAX : cargaMax;
+  armador.reiniciar();
+  muestrasPaquete = 0;
+  paquetes = muestras = 0;
+  bytesCrudos = bytesPaquetes = 0;
+}
+
+
+void EmpaquetadorMuestras::empezarPaquete(uint32_t marcaTiempo) {
+  uint8_t *p = armador.empezar(tipo, marcaTiempo, PAQUETE_TAM_ENCABEZADO);
+  p[7] = (uint8_t)periodo;
+  p[8] = (uint8_t)(periodo >> 8);
+  p[9] = canales;
+  p[10] = 0;
+  muestrasPaquete = 0;
+}
+
+
+size_t EmpaquetadorMuestras::codificarMuestra(const uint16_t *valores, uint8_t *destino) const {
+  size_t n = 0;
+  for (uint8_t c = 0; c < canales; c++) {
+    uint32_t v = (muestrasPaquete == 0) ? valores[c] : zigzag((int32_t)valores[c] - (int32_t)anterior[c]);
+    n += escribirVarint(&destino[n], v);
+  }
+  return n;
+}
+
+
+bool EmpaquetadorMuestras::agregar(const uint16_t *valores, uint32_t marcaTiempo) {
+  bool cerrado = false;
+  if (muestrasPaquete == 0) empezarPaquete(marcaTiempo);
+  uint8_t codificada[PAQUETE_MAX_CANALES * PAQUETE_MAX_BYTES_VALOR];
+  size_t n = codificarMuestra(valores, codificada);
+  if (armador.indice + n + PAQUETE_TAM_CRC > carga || muestrasPaquete == 255) {  // No cabe: cerramos y la muestra abre el siguiente paquete
+    cerrado = cerrar();
+    empezarPaquete(marcaTiempo);
+    n = codificarMuestra(valores, codificada);
+  }
+  memcpy(&armador.actual()[armador.indice], codificada, n);
+  armador.indice += n;
+  muestrasPaquete++;
+  for (uint8_t c = 0; c < canales; c++) anterior[c] = valores[c];
+  return cerrado;
+}
+
+
+bool EmpaquetadorMuestras::cerrar() {
+  if (muestrasPaquete == 0) return false;
+  armador.actual()[10] = muestrasPaquete;
+  paquetes++;
+  muestras += muestrasPaquete;
+  bytesCrudos += (uint32_t)muestrasPaquete * canales * 2;
+  bytesPaquetes += armador.cerrar();
+  muestrasPaquete = 0;
+  return true;
+}
+
+
+bool EmpaquetadorMuestras::cambiarPeriodo(uint16_t periodoUs) {
+  bool cerrado = cerrar();
+  periodo = periodoUs;
+  return cerrado;
+}
+
+
+bool EmpaquetadorMuestras::marcarSinFiltrar(bool sinFiltrar) {
+  bool cerrado = cerrar();
+  bool milivoltios = tipo == PAQUETE_TIPO_MILIVOLTIOS || tipo == PAQUETE_TIPO_MILIVOLTIOS_SIN_FILTRAR;
+  if (sinFiltrar) tipo = milivoltios ? PAQUETE_TIPO_MILIVOLTIOS_SIN_FILTRAR : PAQUETE_TIPO_MUESTRAS_SIN_FILTRAR;
+  else tipo = milivoltios ? PAQUETE_TIPO_MILIVOLTIOS : PAQUETE_TIPO_MUESTRAS;
+  return cerrado;
+}
+
+
+size_t desempaquetarMuestras(const uint8_t *paquete, size_t len, EncabezadoPaquete &encabezado, uint16_t *destino,
+                             size_t maxValores) {
+  if (len < PAQUETE_TAM_ENCABEZADO + PAQUETE_TAM_CRC) return 0;
+  if (!esPaqueteMuestras(paquete[0])) return 0;
+  if (!crcPaqueteValido(paquete, len)) return 0;
+  leerEncabezadoPaquete(paquete, encabezado.secuencia, encabezado.marcaTiempo);
+  encabezado.periodoUs = (uint16_t)(paquete[7] | (paquete[8] << 8));
+  encabezado.numCanales = paquete[9];
+  encabezado.numMuestras = paquete[10];
+  encabezado.milivoltios = paquete[0] == PAQUETE_TIPO_MILIVOLTIOS || paquete[0] == PAQUETE_TIPO_MILIVOLTIOS_SIN_FILTRAR;
+  encabezado.sinFiltrar = paquete[0] == PAQUETE_TIPO_MUESTRAS_SIN_FILTRAR || paquete[0] == PAQUETE_TIPO_MILIVOLTIOS_SIN_FILTRAR;
+  size_t canales = encabezado.numCanales;
+  if (canales == 0 || canales > PAQUETE_MAX_CANALES || (size_t)encabezado.numMuestras * canales > maxValores) return 0;
+  size_t i = PAQUETE_TAM_ENCABEZADO;
+  size_t fin = len - PAQUETE_TAM_CRC;
+  for (size_t k = 0; k < (size_t)encabezado.numMuestras * canales; k++) {
+    uint32_t v = 0;
+    uint8_t desplazamiento = 0;
+    do {  // Leemos un varint
+      if (i >= fin || desplazamiento > 28) return 0;
+      v |= (uint32_t)(paquete[i] & 0x7F) << desplazamiento;
+      desplazamiento += 7;
+    } while (paquete[i++] & 0x80);
+    destino[k] = (k < canales) ? (uint16_t)v : (uint16_t)(destino[k - canales] + deszigzag(v));
+  }
+  return (i == fin) ? encabezado.numMuestras : 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBEMPAQUETADOR_H
+#define LIBEMPAQUETADOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libpaquete.h"
+
+// Empaquetador de muestras para LoRa con compresion delta + zigzag + varint.
+// Formato del paquete: el encabezado comun y el CRC de libpaquete.h (tipo 0xB1 cuentas del ADC,
+// 0xB2 milivoltios calibrados, 0xB6 y 0xB7 lo mismo sin filtrar; marca de tiempo de la primera muestra) y
+//  [7..8]   Periodo de muestreo en microsegundos
+//  [9]      Numero de canales
+//  [10]     Numero de muestras (por canal)
+//  [11..]   Primera muestra: un varint por canal con el valor absoluto. Las siguientes: un varint
+//           por canal con la diferencia zigzag respecto a la muestra anterior del mismo canal
+// Como las señales fisiologicas cambian poco entre muestras, la mayoria de diferencias ocupa un
+// solo byte en vez de los 2 bytes de una muestra cruda de 12 bits.
+
+#define PAQUETE_TIPO_MUESTRAS 0xB1
+#define PAQUETE_TIPO_MILIVOLTIOS 0xB2  // Mismo formato, pero los valores estan en milivoltios (libcalibracion.h)
+// Mismo formato, pero el canal x no paso por el filtro del EKG: la historia previa que se envia al
+// volver de la tasa de reposo (libtasa.h), que no se puede filtrar a esa tasa
+#define PAQUETE_TIPO_MUESTRAS_SIN_FILTRAR 0xB6
+#define PAQUETE_TIPO_MILIVOLTIOS_SIN_FILTRAR 0xB7
+#define PAQUETE_TAM_ENCABEZADO 11
+#define PAQUETE_CARGA_MAX 255   // Carga util maxima del SX1278 (RA-02)
+#define PAQUETE_MAX_CANALES 8
+
+/**
+ * Encabezado de un paquete de muestras
+ */
+struct EncabezadoPaquete {
+  uint16_t secuencia;
+  uint32_t marcaTiempo;  // Instante de la primera muestra en microsegundos
+  uint16_t periodoUs;    // Periodo de muestreo en microsegundos
+  uint8_t numCanales;
+  uint8_t numMuestras;
+  bool milivoltios;      // true si los valores estan en milivoltios en vez de cuentas del ADC
+  bool sinFiltrar;       // true si el canal x no paso por el filtro del EKG
+};
+
+/**
+ * Funcion que codifica un entero con signo en zigzag (0, -1, 1, -2, 2... -> 0, 1, 2, 3, 4...)
+ */
+static inline uint32_t zigzag(int32_t n) { return ((uint32_t)n << 1) ^ (uint32_t)(n >> 31); }
+
+/**
+ * Funcion que decodifica un entero zigzag
+ */
+static inline int32_t deszigzag(uint32_t n) { return (int32_t)(n >> 1) ^ -(int32_t)(n & 1); }
+
+/**
+ * Funcion que escribe un varint (7 bits por byte, el bit 7 indica que sigue otro byte)
+ * @return Numero de bytes escritos
+ */
+static inline size_t escribirVarint(uint8_t *p, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (uint8_t)v;
+  return n;
+}
+
+/**
+ * Funcion que estima el tiempo en el aire de un paquete LoRa (formula del datasheet del SX1276/78,
+ * encabezado explicito y CRC activo)
+ * @param len Bytes de carga util
+ * @param sf Factor de dispersion (6 a 12)
+ * @param anchoBandaHz Ancho de banda en Hz (por ejemplo 125000)
+ * @param cr Denominador de la tasa de codigo menos 4 (1 para 4/5 ... 4 para 4/8)
+ * @param preambulo Simbolos de preambulo
+ * @return Tiempo en el aire en microsegundos
+ */
+uint32_t tiempoAireLoRaUs(size_t len, uint8_t sf, uint32_t anchoBandaHz, uint8_t cr, uint16_t preambulo = 8);
+
+/**
+ * Empaquetador incremental: las muestras se agregan una por una y se comprimen al vuelo en el
+ * paquete en construccion. Cuando la siguiente muestra ya no cabe, el paquete se cierra y
+ * queda listo para enviarse mientras se arma el siguiente (doble buffer).
+ */
+class EmpaquetadorMuestras {
+public:
+  EmpaquetadorMuestras();
+
+  /**
+   * Funcion que configura el empaquetador
+   * @param numCanales Canales de cada muestra (maximo PAQUETE_MAX_CANALES)
+   * @param periodoUs Periodo de muestreo en microsegundos
+   * @param cargaMax Tamaño maximo del paquete (maximo PAQUETE_CARGA_MAX)
+   * @param milivoltios true si los valores que se agregan son milivoltios calibrados
+   */
+  void iniciar(uint8_t numCanales, uint16_t periodoUs, size_t cargaMax = PAQUETE_CARGA_MAX, bool milivoltios = false);
+
+  /**
+   * Funcion que agrega una muestra al paquete en construccion
+   * @param valores Un valor por canal
+   * @param marcaTiempo Instante de la muestra en microsegundos
+   * @return true si para agregarla se cerro el paquete anterior, que queda en paquete()/tamano()
+   */
+  bool agregar(const uint16_t *valores, uint32_t marcaTiempo);
+
+  /**
+   * Funcion que cierra el paquete en construccion aunque no este lleno
+   * @return true si habia muestras y el paquete quedo listo en paquete()/tamano()
+   */
+  bool cerrar();
+
+  /**
+   * Funcion que cambia el periodo de muestreo de los paquetes siguientes (la tasa adaptativa); el
+   * paquete en construccion se cierra porque su encabezado tiene el periodo anterior
+   * @return true si se cerro un paquete, que queda en paquete()/tamano()
+   */
+  bool cambiarPeriodo(uint16_t periodoUs);
+
+  /**
+   * Funcion que marca si los paquetes siguientes llevan muestras sin filtrar (PAQUETE_TIPO_*_SIN_FILTRAR);
+   * el paquete en construccion se cierra porque su tipo es el anterior
+   * @return true si se cerro un paquete, que queda en paquete()/tamano()
+   */
+  bool marcarSinFiltrar(bool sinFiltrar);
+
+  const uint8_t *paquete() const { return armador.paquete(); }  // Ultimo paquete cerrado
+  size_t tamano() const { return armador.tamano(); }              // Bytes del ultimo paquete cerrado
+
+  /**
+   * Relacion entre los bytes de las muestras crudas (2 por valor) y los bytes de los paquetes
+   */
+  float razonCompresion() const { return bytesPaquetes ? (float)bytesCrudos / bytesPaquetes : 0; }
+
+  uint32_t paquetes;       // Paquetes cerrados
+  uint32_t muestras;       // Muestras empaquetadas en los paquetes cerrados
+  uint64_t bytesCrudos;    // Bytes que ocuparian esas muestras sin comprimir
+  uint64_t bytesPaquetes;  // Bytes de los paquetes cerrados
+
+private:
+  void empezarPaquete(uint32_t marcaTiempo);
+  size_t codificarMuestra(const uint16_t *valores, uint8_t *destino) const;
+
+  ArmadorPaquetes<PAQUETE_CARGA_MAX> armador;
+  size_t carga;
+  uint8_t canales;
+  uint16_t periodo;
+  uint8_t tipo;           // PAQUETE_TIPO_MUESTRAS, PAQUETE_TIPO_MILIVOLTIOS o sus variantes sin filtrar
+  uint8_t muestrasPaquete;
+  uint16_t anterior[PAQUETE_MAX_CANALES];
+};
+
+/**
+ * Funcion que dice si un tipo de paquete es de muestras (filtradas o no, en cuentas o milivoltios)
+ */
+static inline bool esPaqueteMuestras(uint8_t tipo) {
+  return tipo == PAQUETE_TIPO_MUESTRAS || tipo == PAQUETE_TIPO_MILIVOLTIOS || tipo == PAQUETE_TIPO_MUESTRAS_SIN_FILTRAR ||
+         tipo == PAQUETE_TIPO_MILIVOLTIOS_SIN_FILTRAR;
+}
+
+/**
+ * Funcion que desempaqueta y verifica un paquete de muestras (lado del receptor)
+ * @param paquete Bytes recibidos
+ * @param len Numero de bytes
+ * @param encabezado Donde se escribe el encabezado del paquete
+ * @param destino Donde se escriben las muestras intercaladas por canal
+ * @param maxValores Capacidad del destino en valores (muestras * canales)
+ * @return Numero de muestras por canal, o 0 si el paquete es invalido
+ */
+size_t desempaquetarMuestras(const uint8_t *paquete, size_t len, EncabezadoPaquete &encabezado, uint16_t *destino,
+                             size_t maxValores);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBESCANEOADC_H
+#define LIBESCANEOADC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libhalsens.h"
+
+/**
+ * Escaneo de varios canales del ADC1 por registros (sin pasar por analogRead). La lista de
+ * canales se fija al compilar, la configuracion de los pads se hace una sola vez con
+ * configurar() y cada escaneo solo hace las conversiones, una tras otra.
+ * Ejemplo: EscaneoADC1<7, 5, 4> escaneo; lee IO35, IO33 e IO32.
+ * @param CANALES Canales del ADC1 (0 a 7) en el orden en que se convierten
+ */
+template <uint8_t... CANALES>
+class EscaneoADC1 {
+public:
+  static constexpr size_t NUM_CANALES = sizeof...(CANALES);
+  static_assert(NUM_CANALES > 0, "El escaneo necesita al menos un canal");
+
+  /**
+   * Resultado de un escaneo: un dato de 12 bits por canal, en el orden de CANALES
+   */
+  struct Muestra {
+    uint16_t valor[NUM_CANALES];
+  };
+
+  EscaneoADC1() : ciclosUltimo(0), ciclosMaximo(0), ciclosTotales(0), escaneos(0) {}
+
+  /**
+   * Funcion que configura los pads de todos los canales, se llama una vez en el setup()
+   */
+  void configurar() {
+    for (size_t i = 0; i < NUM_CANALES; i++) halSensConfigurarCanal(canales[i]);
+  }
+
+  /**
+   * Funcion que convierte todos los canales seguidos y mide cuanto tardo el escaneo
+   * @param muestra Donde se escriben los datos de cada canal
+   */
+  inline void leer(Muestra &muestra) {
+    uint32_t inicio = halCiclos();
+    for (size_t i = 0; i < NUM_CANALES; i++) muestra.valor[i] = convertir(canales[i]);
+    uint32_t ciclos = halCiclos() - inicio;
+    ciclosUltimo = ciclos;
+    if (ciclos > ciclosMaximo) ciclosMaximo = ciclos;
+    ciclosTotales += ciclos;
+    escaneos++;
+  }
+
+  /**
+   * Funcion que convierte un solo canal por registros
+   * @param canal Canal del ADC1 (ya configurado)
+   * @return Dato de 12 bits
+   */
+  static inline uint16_t convertir(uint8_t canal) {
+    halSensSeleccionarPad(1u << canal);  // Solo un canal es seleccionado
+    while (halSensOcupado());
+    halSensIniciarConversion();
+    while (!halSensConversionLista());
+    return halSensLeerDato();
+  }
+
+  uint32_t ciclosUltimoEscaneo() const { return ciclosUltimo; }
+  uint32_t ciclosMaximoEscaneo() const { return ciclosMaximo; }
+  uint32_t ciclosPromedioEscaneo() const { return escaneos ? (uint32_t)(ciclosTotales / escaneos) : 0; }
+  uint32_t totalEscaneos() const { return escaneos; }
+
+  /**
+   * Funcion que borra las estadisticas de tiempo
+   */
+  void reiniciarEstadisticas() {
+    ciclosUltimo = ciclosMaximo = 0;
+    ciclosTotales = 0;
+    escaneos = 0;
+  }
+
+private:
+  static constexpr uint8_t canales[NUM_CANALES] = {CANALES...};
+  static constexpr bool canalesValidos() {
+    for (size_t i = 0; i < NUM_CANALES; i++)
+      if (canales[i] > 7) return false;
+    return true;
+  }
+  static_assert(canalesValidos(), "El ADC1 solo tiene los canales 0 a 7");
+
+  uint32_t ciclosUltimo;
+  uint32_t ciclosMaximo;
+  uint64_t ciclosTotales;
+  uint32_t escaneos;
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libespectro.h"
+
+#define DECIBELES_POR_OCTAVA_Q16 1972830  // 100 log10(2) = 30.103 decimas de dB por cada factor 2 de potencia, en Q16
+#define CORRECCION_LOG2_Q16 22715        // 0.3466 en Q16: log2(1 + f) ~ f + 0.3466 f (1 - f)
+
+
+int16_t decimasDeDecibel(uint64_t s, int32_t desplazamientoQ16) {
+  if (s == 0) return ESPECTRO_SIN_POTENCIA;
+  int32_t e = 63 - __builtin_clzll(s);
+  uint32_t f = (uint32_t)(((s << (63 - e)) >> 47) & 0xFFFF);  // Los 16 bits despues del primer uno
+  int64_t log2 = ((int64_t)e << 16) + f + (((uint64_t)CORRECCION_LOG2_Q16 * f * (65536 - f)) >> 32) + desplazamientoQ16;
+  int64_t d = log2 * DECIBELES_POR_OCTAVA_Q16;
+  d = (d >= 0) ? (d + ((int64_t)1 << 31)) >> 32 : -((-d + ((int64_t)1 << 31)) >> 32);
+  if (d > 32767) d = 32767;
+  if (d < -32767) d = -32767;
+  return (int16_t)d;
+}
+
+
+EmpaquetadorEspectro::EmpaquetadorEspectro() {
+  iniciar(1000);
+}
+
+
+void EmpaquetadorEspectro::iniciar(uint16_t periodoMs) {
+  periodo = periodoMs;
+  armador.reiniciar();
+  registrosPaquete = 0;
+  paquetes = registros = 0;
+  bytesPaquetes = 0;
+}
+
+
+bool EmpaquetadorEspectro::agregar(const RegistroEspectro &registro) {
+  uint8_t *p = armador.actual();
+  if (registrosPaquete == 0) {
+    p = armador.empezar(PAQUETE_TIPO_ESPECTRO, (uint32_t)registro.marcaTiempo, ESPECTRO_TAM_ENCABEZADO);
+    p[7] = (uint8_t)periodo;
+    p[8] = (uint8_t)(periodo >> 8);
+    p[9] = ESPECTRO_NUM_VALORES;
+  }
+  for (uint8_t v = 0; v < ESPECTRO_NUM_VALORES; v++) {
+    p[armador.indice++] = (uint8_t)registro.valores[v];
+    p[armador.indice++] = (uint8_t)((uint16_t)registro.valores[v] >> 8);
+  }
+  p[10] = ++registrosPaquete;
+  if (registrosPaquete >= ESPECTRO_REGISTROS_POR_PAQUETE) return cerrar();
+  return false;
+}
+
+
+bool EmpaquetadorEspectro::cerrar() {
+  if (registrosPaquete == 0) return false;
+  paquetes++;
+  registros += registrosPaquete;
+  bytesPaquetes += armador.cerrar();
+  registrosPaquete = 0;
+  return true;
+}
+
+
+size_t desempaquetarEspectro(const uint8_t *paquete, size_t len, EncabezadoEspectro &encabezado, RegistroEspectro *destino, size_t max) {
+  if (len < ESPECTRO_TAM_ENCABEZADO + PAQUETE_TAM_CRC || paquete[0] != PAQUETE_TIPO_ESPECTRO) return 0;
+  if (!crcPaqueteValido(paquete, len)) return 0;
+  leerEncabezadoPaquete(paquete, encabezado.secuencia, encabezado.marcaTiempo);
+  encabezado.periodoMs = (uint16_t)(paquete[7] | (paquete[8] << 8));
+  encabezado.numValores = paquete[9];
+  encabezado.numRegistros = paquete[10];
+  if (encabezado.numRegistros == 0 || encabezado.numRegistros > max || encabezado.numValores != ESPECTRO_NUM_VALORES) return 0;
+  if (len != ESPECTRO_TAM_ENCABEZADO + (size_t)encabezado.numRegistros * ESPECTRO_NUM_VALORES * 2 + PAQUETE_TAM_CRC) return 0;
+  size_t i = ESPECTRO_TAM_ENCABEZADO;
+  for (size_t k = 0; k < encabezado.numRegistros; k++) {
+    destino[k].marcaTiempo = encabezado.marcaTiempo + (uint32_t)k * encabezado.periodoMs * 1000;
+    for (uint8_t v = 0; v < ESPECTRO_NUM_VALORES; v++, i += 2)
+      destino[k].valores[v] = (int16_t)(paquete[i] | (paquete[i + 1] << 8));
+  }
+  return encabezado.numRegistros;
+}
@@ -0,0 +1,340 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBESPECTRO_H
+#define LIBESPECTRO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include "libfiltros.h"
+#include "libpaquete.h"
+
+// Analisis espectral en punto fijo sobre una ventana de N muestras:
+//  - FFT real de N puntos (una FFT compleja radix 2 de N/2 puntos mas la separacion de la parte
+//    real) con ventana de Hann, que se calcula cada N/2 muestras (50% de traslape) para sacar la
+//    potencia de las bandas del EEG
+//  - Goertzel deslizante para unos pocos bins (la red electrica): cada muestra actualiza la DFT
+//    de esos bins sumando la que entra y restando la que sale de la ventana, sin recalcularla.
+//    Los acumuladores son enteros de 64 bits y la fase se toma de la tabla por el indice absoluto
+//    de la muestra, asi que no se acumula error por mas que corra (a diferencia de la recurrencia
+//    con un giro en cada muestra)
+// Las tablas (giros y ventana) se calculan al compilar con las funciones constexpr de libfiltros.h.
+// Las potencias salen en decimas de dB de la unidad de la muestra al cuadrado (cuentas o mV):
+// un seno de amplitud A da 10 log10(A^2 / 2) en el bin o la banda que lo contiene.
+//
+// Formato del paquete de registros espectrales para LoRa: el encabezado comun y el CRC de libpaquete.h
+// (tipo 0xB4, marca de tiempo del primer registro, que es la de la ultima muestra de su ventana) y
+//  [7..8]   Tiempo entre registros en milisegundos
+//  [9]      Valores por registro (bandas y luego bins del Goertzel)
+//  [10]     Numero de registros
+//  [11..]   Los valores de cada registro, int16 en decimas de dB
+
+#define ESPECTRO_NUM_BANDAS 5       // Delta, theta, alfa, beta y gamma
+#define ESPECTRO_NUM_BINS 2         // Bins del Goertzel deslizante (la red y su segundo armonico)
+#define ESPECTRO_NUM_VALORES (ESPECTRO_NUM_BANDAS + ESPECTRO_NUM_BINS)
+#define ESPECTRO_SIN_POTENCIA -32768  // Valor de una banda sin energia
+#define PAQUETE_TIPO_ESPECTRO 0xB4
+#define ESPECTRO_TAM_ENCABEZADO 11
+#define ESPECTRO_REGISTROS_POR_PAQUETE 16  // Un paquete cada 8 s con ventanas de 1 s
+#define ESPECTRO_TAM_MAX (ESPECTRO_TAM_ENCABEZADO + ESPECTRO_REGISTROS_POR_PAQUETE * ESPECTRO_NUM_VALORES * 2 + PAQUETE_TAM_CRC)
+
+// Bandas del EEG en Hz, [inferior, superior)
+constexpr double BANDAS_ESPECTRO[ESPECTRO_NUM_BANDAS][2] = {{0.5, 4}, {4, 8}, {8, 13}, {13, 30}, {30, 45}};
+
+/**
+ * Registro de potencias de una ventana
+ */
+struct RegistroEspectro {
+  uint64_t marcaTiempo;                   // Instante de la ultima muestra de la ventana
+  int16_t valores[ESPECTRO_NUM_VALORES];  // Bandas y bins del Goertzel en decimas de dB
+};
+
+/**
+ * Funcion constexpr que da el bin de una FFT de N puntos a fs que contiene a una frecuencia
+ * (redondeado hacia arriba: el primer bin de una banda)
+ */
+constexpr size_t binEspectro(double f, size_t n, double fs) {
+  double b = f * n / fs;
+  return (size_t)b + (((double)(size_t)b < b) ? 1 : 0);
+}
+
+/**
+ * Funcion constexpr que tabula cos(2 pi i / N) en Q2.30
+ */
+template <size_t N>
+constexpr std::array<int32_t, N> tablaCoseno() {
+  std::array<int32_t, N> t{};
+  for (size_t i = 0; i < N; i++) t[i] = cuantizarCoef<int32_t>(cosenoConst(2 * PI_FILTROS * i / N));
+  return t;
+}
+
+/**
+ * Funcion constexpr que tabula la ventana de Hann periodica de N puntos en Q2.30 (la suma de dos
+ * ventanas traslapadas a la mitad es constante)
+ */
+template <size_t N>
+constexpr std::array<int32_t, N> tablaHann() {
+  std::array<int32_t, N> t{};
+  for (size_t i = 0; i < N; i++) t[i] = cuantizarCoef<int32_t>(0.5 - 0.5 * cosenoConst(2 * PI_FILTROS * i / N));
+  return t;
+}
+
+/**
+ * Funcion constexpr que tabula la permutacion de bits invertidos de M indices
+ */
+template <size_t M>
+constexpr std::array<uint16_t, M> tablaBitsInvertidos() {
+  std::array<uint16_t, M> t{};
+  for (size_t i = 0; i < M; i++) {
+    size_t r = 0;
+    for (size_t b = 1, s = M >> 1; b < M; b <<= 1, s >>= 1)
+      if (i & b) r |= s;
+    t[i] = (uint16_t)r;
+  }
+  return t;
+}
+
+/**
+ * Funcion que convierte una suma de cuadrados en decimas de dB: 100 log10(s * 2^(desplazamiento / 65536))
+ * con un logaritmo entero (CLZ mas una correccion cuadratica de la mantisa, error < 0.05 dB)
+ * @param s Suma de cuadrados en la escala interna
+ * @param desplazamientoQ16 log2 del factor de escala a la unidad de salida, en Q16
+ * @return Decimas de dB, o ESPECTRO_SIN_POTENCIA si s es 0
+ */
+int16_t decimasDeDecibel(uint64_t s, int32_t desplazamientoQ16);
+
+/**
+ * Funcion constexpr que pasa un log2 real a Q16 (para las constantes de escala)
+ */
+constexpr int32_t log2Q16(double log2) { return (int32_t)(log2 * 65536 + (log2 >= 0 ? 0.5 : -0.5)); }
+
+#define LOG2_3 1.5849625007211562
+
+/**
+ * FFT real de N puntos en punto fijo con ventana de Hann. Cada etapa divide por 2, asi que no se
+ * desborda con entradas de 12 bits y la salida es X / N (con la entrada escalada por 2^16)
+ * @param N Puntos de la FFT (potencia de 2, de 8 a 4096)
+ */
+template <size_t N>
+class FFTReal {
+  static_assert(N >= 8 && N <= 4096 && (N & (N - 1)) == 0, "N debe ser potencia de 2 entre 8 y 4096");
+
+public:
+  static constexpr size_t M = N / 2;  // Puntos de la FFT compleja
+
+  /**
+   * Funcion que transforma una ventana
+   * @param x Buffer circular de N muestras de 12 bits centradas en cero (sin ventana)
+   * @param inicio Posicion de la muestra mas vieja en x
+   * @param media Valor medio de la ventana con 8 bits de fraccion, que se resta antes de la ventana
+   *              de Hann para que el nivel DC no se riegue al primer bin
+   * @param potencia Donde se escriben |X[k]|^2 de k = 0 a N/2 (N/2 + 1 valores, en la escala interna)
+   */
+  void transformar(const int16_t *x, size_t inicio, int32_t media, uint64_t *potencia) {
+    for (size_t i = 0; i < M; i++) {  // Pares a la parte real y nones a la imaginaria, ya en orden de bits invertidos
+      size_t j = BITS_INVERTIDOS[i];
+      int64_t par = ((int32_t)x[(inicio + 2 * i) % N] << 8) - media, non = ((int32_t)x[(inicio + 2 * i + 1) % N] << 8) - media;
+      re[j] = (int32_t)((par * HANN[2 * i]) >> 22);  // 12 bits y 8 de fraccion por Q30 a 16 bits de fraccion
+      im[j] = (int32_t)((non * HANN[2 * i + 1]) >> 22);
+    }
+    for (size_t tam = 2; tam <= M; tam <<= 1) {  // Mariposas radix 2 con division por 2 en cada etapa
+      size_t mitad = tam >> 1;
+      size_t paso = N / tam;
+      for (size_t inicio = 0; inicio < M; inicio += tam) {
+        for (size_t j = 0; j < mitad; j++) {
+          int32_t c = COSENO[j * paso];
+          int32_t s = -COSENO[(j * paso + 3 * N / 4) % N];  // e^(-i 2 pi j / tam): cos y -sen
+          size_t a = inicio + j, b = a + mitad;
+          int32_t tr = (int32_t)(((int64_t)re[b] * c - (int64_t)im[b] * s) >> 30);
+          int32_t ti = (int32_t)(((int64_t)re[b] * s + (int64_t)im[b] * c) >> 30);
+          re[b] = (re[a] - tr) >> 1;
+          im[b] = (im[a] - ti) >> 1;
+          re[a] = (re[a] + tr) >> 1;
+          im[a] = (im[a] + ti) >> 1;
+        }
+      }
+    }
+    for (size_t k = 0; k <= M; k++) {  // Separacion: X[k] = (Z[k] + Z*[M-k]) / 2 + W^k (Z[k] - Z*[M-k]) / 2i
+      size_t a = k % M, b = (M - k) % M;
+      int64_t er = ((int64_t)re[a] + re[b]) >> 1, ei = ((int64_t)im[a] - im[b]) >> 1;
+      int64_t or_ = ((int64_t)im[a] + im[b]) >> 1, oi = ((int64_t)re[b] - re[a]) >> 1;
+      int64_t c = COSENO[k], s = -COSENO[(k + 3 * N / 4) % N];
+      int64_t xr = (er + ((or_ * c - oi * s) >> 30)) >> 1;
+      int64_t xi = (ei + ((or_ * s + oi * c) >> 30)) >> 1;
+      potencia[k] = (uint64_t)(xr * xr) + (uint64_t)(xi * xi);
+    }
+  }
+
+  /**
+   * log2 (en Q16) del factor que lleva una suma de |X[k]|^2 a la potencia media de la señal en esos
+   * bins: 2 |X|^2 / (N suma(w^2)), con suma(w^2) = 3N/8 y la escala 2^16 / N de la salida
+   */
+  static constexpr int32_t ESCALA_POTENCIA = log2Q16(4 - LOG2_3 - 32);
+
+private:
+  static constexpr std::array<int32_t, N> COSENO = tablaCoseno<N>();
+  static constexpr std::array<int32_t, N> HANN = tablaHann<N>();
+  static constexpr std::array<uint16_t, M> BITS_INVERTIDOS = tablaBitsInvertidos<M>();
+  int32_t re[M];
+  int32_t im[M];
+};
+
+/**
+ * Goertzel deslizante para BINS bins de una DFT de N puntos, con ventana de Hann aplicada en la
+ * frecuencia (0.5 X[k] - 0.25 X[k-1] - 0.25 X[k+1]), asi que da lo mismo que la FFT en esos bins
+ * @param N Largo de la ventana (potencia de 2)
+ * @param BINS Numero de bins
+ */
+template <size_t N, size_t BINS>
+class GoertzelDeslizante {
+  static_assert(N >= 8 && (N & (N - 1)) == 0, "N debe ser potencia de 2");
+
+public:
+  GoertzelDeslizante() {
+    for (size_t b = 0; b < BINS; b++) bins[b] = 1;
+    reiniciar();
+  }
+
+  /**
+   * Funcion que escoge los bins (de 1 a N/2 - 1) y borra los acumuladores
+   */
+  void configurar(const size_t *k) {
+    for (size_t b = 0; b < BINS; b++) bins[b] = (k[b] < 1) ? 1 : (k[b] > N / 2 - 1 ? N / 2 - 1 : k[b]);
+    reiniciar();
+  }
+
+  void reiniciar() {
+    for (size_t b = 0; b < BINS; b++)
+      for (uint8_t v = 0; v < 3; v++) sumaRe[b][v] = sumaIm[b][v] = 0;
+    indice = 0;
+  }
+
+  /**
+   * Funcion que actualiza los bins con una muestra
+   * @param entra Muestra nueva (12 bits centrada en cero)
+   * @param sale Muestra que sale de la ventana (la de hace N muestras, 0 al principio)
+   */
+  inline void procesar(int32_t entra, int32_t sale) {
+    int64_t d = entra - sale;  // Las dos tienen la misma fase porque la tabla es periodica en N
+    for (size_t b = 0; b < BINS; b++) {
+      for (uint8_t v = 0; v < 3; v++) {  // Bins k-1, k, k+1 para la ventana de Hann
+        size_t fase = ((bins[b] + v - 1) * indice) % N;
+        sumaRe[b][v] += d * COSENO[fase];
+        sumaIm[b][v] -= d * COSENO[(fase + 3 * N / 4) % N];
+      }
+    }
+    indice = (indice + 1) % N;
+  }
+
+  /**
+   * Funcion que da la suma de cuadrados de un bin con ventana de Hann, en la escala de ESCALA_POTENCIA
+   */
+  uint64_t potencia(size_t b) const {
+    int64_t xr[3], xi[3];
+    for (uint8_t v = 0; v < 3; v++) {
+      // Se pasa la fase absoluta a la del inicio de la ventana (indice es la muestra mas vieja)
+      size_t fase = ((bins[b] + v - 1) * indice) % N;
+      int64_t c = COSENO[fase], s = COSENO[(fase + 3 * N / 4) % N];
+      int64_t r = sumaRe[b][v] >> 24, i = sumaIm[b][v] >> 24;  // Quedan menos de 2^27 para girar en 64 bits
+      xr[v] = (r * c - i * s) >> 30;
+      xi[v] = (r * s + i * c) >> 30;
+    }
+    int64_t yr = (2 * xr[1] - xr[0] - xr[2]) >> 2, yi = (2 * xi[1] - xi[0] - xi[2]) >> 2;
+    return (uint64_t)(yr * yr) + (uint64_t)(yi * yi);
+  }
+
+  /**
+   * log2 (en Q16) del factor que lleva potencia() a la potencia de un seno en el bin: 2 |Y|^2 / suma(w)^2
+   * con suma(w) = N/2 (normalizar por suma(w^2), como en las bandas, lo daria 1.76 dB por debajo),
+   * la tabla Q30 y el desplazamiento de 24 bits
+   */
+  static constexpr int32_t ESCALA_POTENCIA = log2Q16(3 - 2 * (double)(31 - __builtin_clz((unsigned)N)) - 12);
+
+private:
+  static constexpr std::array<int32_t, N> COSENO = tablaCoseno<N>();
+  size_t bins[BINS];
+  int64_t sumaRe[BINS][3];
+  int64_t sumaIm[BINS][3];
+  size_t indice;  // Fase de la siguiente muestra (modulo N)
+};
+
+/**
+ * Empaquetador de registros espectrales: junta ESPECTRO_REGISTROS_POR_PAQUETE registros en un
+ * paquete (doble buffer, como EmpaquetadorMuestras)
+ */
+class EmpaquetadorEspectro {
+public:
+  EmpaquetadorEspectro();
+
+  /**
+   * Funcion que configura el empaquetador
+   * @param periodoMs Tiempo entre registros en milisegundos
+   */
+  void iniciar(uint16_t periodoMs);
+
+  /**
+   * Funcion que agrega un registro
+   * @return true si con este registro se cerro el paquete, que queda en paquete()/tamano()
+   */
+  bool agregar(const RegistroEspectro &registro);
+
+  /**
+   * Funcion que cierra el paquete en construccion aunque no este lleno
+   * @return true si habia registros y el paquete quedo listo en paquete()/tamano()
+   */
+  bool cerrar();
+
+  const uint8_t *paquete() const { return armador.paquete(); }  // Ultimo paquete cerrado
+  size_t tamano() const { return armador.tamano(); }              // Bytes del ultimo paquete cerrado
+
+  uint32_t paquetes;       // Paquetes cerrados
+  uint32_t registros;      // Registros en los paquetes cerrados
+  uint64_t bytesPaquetes;  // Bytes de los paquetes cerrados
+
+private:
+  ArmadorPaquetes<ESPECTRO_TAM_MAX> armador;
+  uint16_t periodo;
+  uint8_t registrosPaquete;
+};
+
+/**
+ * Encabezado de un paquete de registros espectrales
+ */
+struct EncabezadoEspectro {
+  uint16_t secuencia;
+  uint32_t marcaTiempo;   // Primer registro
+  uint16_t periodoMs;
+  uint8_t numValores;
+  uint8_t numRegistros;
+};
+
+/**
+ * Funcion que desempaqueta y verifica un paquete de registros espectrales (lado del receptor)
+ * @param destino Donde se escriben los registros (marca de tiempo de 32 bits)
+ * @param max Capacidad del destino
+ * @return Numero de registros, o 0 si el paquete es invalido
+ */
+size_t desempaquetarEspectro(const uint8_t *paquete, size_t len, EncabezadoEspectro &encabezado, RegistroEspectro *destino, size_t max);
+
+#endif
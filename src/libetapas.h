@@ -0,0 +1,361 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBETAPAS_H
+#define LIBETAPAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libcadena.h"
+#include "libprocesamiento.h"
+#include "libcalibracion.h"
+#include "libdecimador.h"
+#include "libfiltros.h"
+#include "libempaquetador.h"
+#include "libqrs.h"
+#include "libespectro.h"
+
+// Etapas del camino del EKG para componer con Cadena<...> (libcadena.h). Cada etapa lleva su
+// frecuencia como parametro de la plantilla: los filtros se diseñan al compilar para esa
+// frecuencia y la cadena verifica que las etapas vecinas coincidan.
+
+/**
+ * Paquete cerrado por el codificador (apunta al buffer del empaquetador, que sigue siendo valido
+ * hasta que se cierre el siguiente)
+ */
+struct PaqueteCodificado {
+  const uint8_t *datos;
+  size_t len;
+};
+
+/**
+ * Calibracion: convierte los tres canales a milivoltios con las tablas de libcalibracion.h. Sin
+ * tablas deja pasar las cuentas del ADC
+ */
+template <uint32_t FS>
+class EtapaCalibracionADC : public Etapa<MuestraADC, MuestraADC, FS> {
+public:
+  template <typename Siguiente>
+  inline void procesar(const MuestraADC &cruda, Siguiente &siguiente) {
+    if (!tablas) {
+      siguiente.procesar(cruda);
+      return;
+    }
+    MuestraADC muestra = cruda;
+    if (cruda.bits > 12) {  // Sobremuestreo: se interpola entre dos entradas para no perder los bits extra
+      muestra.x = tablas[0].convertir(cruda.x, cruda.bits);
+      muestra.y = tablas[1].convertir(cruda.y, cruda.bits);
+      muestra.z = tablas[2].convertir(cruda.z, cruda.bits);
+    } else {  // Una lectura de tabla por canal, sin el ajuste de curva de esp_adc_cal
+      muestra.x = tablas[0].convertir(cruda.x);
+      muestra.y = tablas[1].convertir(cruda.y);
+      muestra.z = tablas[2].convertir(cruda.z);
+    }
+    siguiente.procesar(muestra);
+  }
+
+  const TablaCalibracion *tablas = NULL;  // Una tabla por canal (x, y, z), o NULL para cuentas crudas
+};
+
+/**
+ * Decimador del sobremuestreo: CIC y compensador por canal. Recibe muestras de 12 bits a FS y
+ * entrega muestras de 16 bits a FS / FACTOR, fechadas con el retardo del filtro descontado
+ * @param FS Frecuencia de entrada en Hz
+ * @param FACTOR Factor de decimacion (potencia de 2)
+ * @param ETAPAS Etapas del CIC
+ * @param CORTE Frecuencia en Hz hasta la que el compensador deja plana la banda de paso
+ */
+template <uint32_t FS, uint16_t FACTOR, uint8_t ETAPAS, uint32_t CORTE>
+class EtapaDecimadorADC : public Etapa<MuestraADC, MuestraADC, FS, FS / FACTOR> {
+  static_assert(FS % FACTOR == 0, "La frecuencia de entrada debe ser multiplo del factor de decimacion");
+  static_assert(2 * CORTE < FS / FACTOR, "El corte del compensador debe quedar por debajo de la mitad de la frecuencia de salida");
+
+public:
+  EtapaDecimadorADC() {
+    constexpr std::array<int32_t, 3> COEFICIENTES =
+        cuantizarFIR<int32_t>(disenarCompensadorCIC(ETAPAS, FACTOR, (double)FS / FACTOR, CORTE));
+    for (uint8_t c = 0; c < 3; c++) compensador[c].configurar(COEFICIENTES);
+  }
+
+  template <typename Siguiente>
+  inline void procesar(const MuestraADC &cruda, Siguiente &siguiente) {
+    uint16_t x = 0, y = 0, z = 0;  // Los tres CIC avanzan juntos, solo se usan al completar la muestra
+    cic[0].agregar(cruda.x, x);
+    cic[1].agregar(cruda.y, y);
+    if (!cic[2].agregar(cruda.z, z)) return;  // Los tres canales completan su muestra a la vez
+    MuestraADC muestra;
+    muestra.marcaTiempo = cruda.marcaTiempo - RETARDO_US;
+    muestra.x = compensador[0].procesar(x);
+    muestra.y = compensador[1].procesar(y);
+    muestra.z = compensador[2].procesar(z);
+    muestra.bits = DECIMADOR_BITS_SALIDA;
+    siguiente.procesar(muestra);
+  }
+
+private:
+  static constexpr uint64_t RETARDO_US = (uint64_t)(retardoSobremuestreo(ETAPAS, FACTOR) * FACTOR * 1000000.0 / FS);
+  DecimadorCIC<ETAPAS, FACTOR> cic[3];
+  CompensadorCIC compensador[3];
+};
+
+/**
+ * Analisis espectral (libespectro.h) sobre el canal x antes del filtro, para que se vea la red que
+ * el notch quita: cada N/2 muestras entrega a REGISTRO la potencia de las bandas del EEG en una
+ * ventana de N muestras (FFT con Hann y 50% de traslape) y la de la red y su segundo armonico
+ * (Goertzel deslizante, al dia en cada muestra). Deja pasar las muestras sin tocarlas
+ * @param FS Frecuencia de muestreo en Hz
+ * @param N Largo de la ventana (potencia de 2)
+ * @param REGISTRO Funcion que recibe los registros
+ */
+template <uint32_t FS, size_t N, void (*REGISTRO)(const RegistroEspectro &)>
+class EtapaEspectro : public Etapa<MuestraADC, MuestraADC, FS> {
+  static_assert(4 * FRECUENCIA_RED < FS, "Frecuencia de muestreo muy baja para el segundo armonico de la red");
+
+public:
+  EtapaEspectro() {
+    size_t bins[ESPECTRO_NUM_BINS] = {BIN_RED, 2 * BIN_RED};
+    goertzel.configurar(bins);
+  }
+
+  template <typename Siguiente>
+  inline void procesar(const MuestraADC &muestra, Siguiente &siguiente) {
+    int16_t x = (int16_t)aDoceBits(muestra.x, muestra.bits) - 2048;
+    goertzel.procesar(x, ventana[posicion]);  // La que se sobreescribe es la que sale de la ventana
+    suma += x - ventana[posicion];
+    ventana[posicion] = x;
+    posicion = (posicion + 1) % N;
+    if (muestras < N) muestras++;
+    if (++desdeUltima >= N / 2 && muestras >= N) {
+      desdeUltima = 0;
+      registrar(muestra.marcaTiempo);
+    }
+    siguiente.procesar(muestra);
+  }
+
+  /**
+   * Funcion que borra la ventana y los acumuladores (no el contador de ventanas)
+   */
+  void reiniciar() {
+    for (size_t i = 0; i < N; i++) ventana[i] = 0;
+    goertzel.reiniciar();
+    suma = 0;
+    posicion = muestras = desdeUltima = 0;
+  }
+
+  /**
+   * Funcion que da la potencia de la red ahora mismo (sin esperar a la siguiente ventana)
+   * @param armonico 0 para la fundamental, 1 para el segundo armonico
+   * @return Decimas de dB
+   */
+  int16_t potenciaRed(uint8_t armonico) const { return decimasDeDecibel(goertzel.potencia(armonico), Goertzel::ESCALA_POTENCIA); }
+
+  static constexpr uint16_t PERIODO_MS = (uint16_t)(N / 2 * 1000 / FS);  // Tiempo entre registros
+  uint32_t ventanas = 0;  // Ventanas analizadas
+
+private:
+  typedef GoertzelDeslizante<N, ESPECTRO_NUM_BINS> Goertzel;
+
+  void registrar(uint64_t marcaTiempo) {
+    RegistroEspectro registro;
+    registro.marcaTiempo = marcaTiempo;
+    int32_t media = (int32_t)((int64_t)suma * 256 / (int64_t)N);
+    fft.transformar(ventana, posicion, media, potencia);  // La posicion actual es la de la muestra mas vieja
+    for (uint8_t b = 0; b < ESPECTRO_NUM_BANDAS; b++) {
+      uint64_t banda = 0;
+      for (size_t k = BANDAS[b][0]; k < BANDAS[b][1]; k++) banda += potencia[k];
+      registro.valores[b] = decimasDeDecibel(banda, FFTReal<N>::ESCALA_POTENCIA);
+    }
+    for (uint8_t b = 0; b < ESPECTRO_NUM_BINS; b++) registro.valores[ESPECTRO_NUM_BANDAS + b] = potenciaRed(b);
+    ventanas++;
+    REGISTRO(registro);
+  }
+
+  static constexpr size_t acotar(size_t k) { return k > N / 2 + 1 ? N / 2 + 1 : k; }
+  static constexpr size_t BIN_RED = (size_t)((double)FRECUENCIA_RED * N / FS + 0.5);
+  static constexpr size_t BANDAS[ESPECTRO_NUM_BANDAS][2] = {
+      {acotar(binEspectro(BANDAS_ESPECTRO[0][0], N, FS)), acotar(binEspectro(BANDAS_ESPECTRO[0][1], N, FS))},
+      {acotar(binEspectro(BANDAS_ESPECTRO[1][0], N, FS)), acotar(binEspectro(BANDAS_ESPECTRO[1][1], N, FS))},
+      {acotar(binEspectro(BANDAS_ESPECTRO[2][0], N, FS)), acotar(binEspectro(BANDAS_ESPECTRO[2][1], N, FS))},
+      {acotar(binEspectro(BANDAS_ESPECTRO[3][0], N, FS)), acotar(binEspectro(BANDAS_ESPECTRO[3][1], N, FS))},
+      {acotar(binEspectro(BANDAS_ESPECTRO[4][0], N, FS)), acotar(binEspectro(BANDAS_ESPECTRO[4][1], N, FS))}};
+  FFTReal<N> fft;
+  Goertzel goertzel;
+  int16_t ventana[N] = {};
+  uint64_t potencia[N / 2 + 1];
+  int32_t suma = 0;  // De las muestras de la ventana
+  size_t posicion = 0;
+  size_t muestras = 0;
+  size_t desdeUltima = 0;
+};
+
+/**
+ * Filtro del EKG: pasa altos (linea base) + notch (red electrica) + pasa bajos sobre el canal x,
+ * diseñado al compilar para FS. Entrega el canal x filtrado y los otros dos crudos, todos en 12
+ * bits, y deja en salidaDAC el valor de 8 bits para el DAC
+ */
+template <uint32_t FS>
+class EtapaFiltroEKG : public Etapa<MuestraADC, MuestraADC, FS> {
+  static_assert(2 * CORTE_PASA_BAJOS < FS && 2 * FRECUENCIA_RED < FS, "Frecuencia de muestreo muy baja para el filtro del EKG");
+
+public:
+  EtapaFiltroEKG() : filtro(COEFICIENTES) {}
+
+  template <typename Siguiente>
+  inline void procesar(const MuestraADC &cruda, Siguiente &siguiente) {
+    MuestraADC muestra = cruda;
+    uint8_t extra = cruda.bits - 12;            // Bits de fraccion del sobremuestreo
+    int32_t x = ((int32_t)cruda.x - (2048 << extra)) << (19 - extra); // 12 bits (cuentas o mV hasta 3.3V) a Q31 centrado en cero (con un bit de margen para el pasa altos)
+    int32_t y = filtro.procesar(x);             // Solo aritmetica entera en el lazo de filtrado
+    int32_t dac = (y >> 23) + 128;              // El modulo DAC tiene resolucion de 8 bits, se vuelve a centrar en la mitad de la escala
+    salidaDAC = (uint8_t)(dac < 0 ? 0 : (dac > 255 ? 255 : dac)); // Saturamos los sobrepicos del filtro
+    int32_t x12 = (y >> 19) + 2048;             // Para el radio se conservan los 12 bits del ADC
+    muestra.x = (uint16_t)(x12 < 0 ? 0 : (x12 > 4095 ? 4095 : x12));
+    muestra.y = aDoceBits(cruda.y, cruda.bits);
+    muestra.z = aDoceBits(cruda.z, cruda.bits);
+    muestra.bits = 12;
+    siguiente.procesar(muestra);                // El EKG filtrado junto con los otros dos canales crudos
+  }
+
+  /**
+   * Funcion que borra la historia del filtro
+   */
+  void reiniciar() { filtro.reiniciar(); }
+
+  uint8_t salidaDAC = 0;  // Ultima muestra filtrada en 8 bits
+
+private:
+  static constexpr CoefBiquadQ<int32_t> COEFICIENTES[] = {
+      cuantizar<int32_t>(disenarPasaAltos(FS, CORTE_LINEA_BASE, 0.7071)),
+      cuantizar<int32_t>(disenarNotch(FS, FRECUENCIA_RED, 30)),
+      cuantizar<int32_t>(disenarPasaBajos(FS, CORTE_PASA_BAJOS, 0.7071))};
+  CascadaBiquad<int32_t, 3> filtro;
+};
+
+/**
+ * Detector de latidos (libqrs.h) sobre el canal x ya filtrado: entrega a EVENTO cada latido con el
+ * resumen del ritmo y deja pasar las muestras. Con soloAnomalias solo pasan los fragmentos de
+ * señal alrededor de los latidos anomalos (QRS_FRAGMENTO_PREVIO_MS antes de detectarlos y
+ * QRS_FRAGMENTO_POSTERIOR_MS despues), y el resto del tiempo basta con los eventos
+ * @param FS Frecuencia de muestreo en Hz
+ * @param EVENTO Funcion que recibe los latidos
+ */
+template <uint32_t FS, void (*EVENTO)(const EventoLatido &)>
+class EtapaDetectorQRS : public Etapa<MuestraADC, MuestraADC, FS> {
+public:
+  template <typename Siguiente>
+  inline void procesar(const MuestraADC &muestra, Siguiente &siguiente) {
+    DeteccionQRS detecciones[2];
+    size_t n = detector.procesar((int32_t)aDoceBits(muestra.x, muestra.bits) - 2048, muestra.marcaTiempo, detecciones);
+    for (size_t i = 0; i < n; i++) {
+      EventoLatido latido = ritmo.agregar(detecciones[i].marcaTiempo);
+      latido.recuperado = detecciones[i].recuperado;
+      EVENTO(latido);
+      if (latido.clase == LATIDO_NORMAL || !soloAnomalias) continue;
+      if (restantes == 0) fragmentos++;
+      restantes = POSTERIORES;
+      for (uint32_t k = 0; k < numPrevias; k++)  // Primero la señal que llevo a la anomalia, de la mas vieja a la mas nueva
+        siguiente.procesar(previas[(posPrevias + PREVIAS - numPrevias + k) % PREVIAS]);
+      numPrevias = 0;
+    }
+    if (!soloAnomalias) {
+      siguiente.procesar(muestra);
+    } else if (restantes > 0) {
+      restantes--;
+      siguiente.procesar(muestra);
+    } else {  // Se guarda por si el siguiente latido es anomalo
+      previas[posPrevias] = muestra;
+      posPrevias = (posPrevias + 1) % PREVIAS;
+      if (numPrevias < PREVIAS) numPrevias++;
+    }
+  }
+
+  /**
+   * Funcion que borra la historia del detector y del ritmo
+   * @param anomalias true para dejar pasar solo los fragmentos alrededor de los latidos anomalos
+   */
+  void reiniciar(bool anomalias) {
+    reanudar();
+    soloAnomalias = anomalias;
+    fragmentos = 0;
+  }
+
+  /**
+   * Funcion que vuelve a empezar la deteccion despues de un hueco en la señal (la tasa de reposo de
+   * libtasa.h), sin cambiar la configuracion ni los contadores
+   */
+  void reanudar() {
+    detector.reiniciar();
+    ritmo.reiniciar();
+    posPrevias = numPrevias = restantes = 0;
+  }
+
+  DetectorQRS<FS> detector;
+  AnalizadorRitmo ritmo;
+  bool soloAnomalias = false;
+  uint32_t fragmentos = 0;   // Fragmentos de señal enviados por latidos anomalos
+
+private:
+  static constexpr uint32_t PREVIAS = FS * QRS_FRAGMENTO_PREVIO_MS / 1000;
+  static constexpr uint32_t POSTERIORES = FS * QRS_FRAGMENTO_POSTERIOR_MS / 1000;
+  MuestraADC previas[PREVIAS];
+  uint32_t posPrevias = 0;
+  uint32_t numPrevias = 0;
+  uint32_t restantes = 0;    // Muestras que faltan del fragmento en curso
+};
+
+/**
+ * Codificador: comprime las muestras en paquetes LoRa (libempaquetador.h) y entrega cada paquete
+ * cuando se cierra. Un paquete solo lleva muestras seguidas: si falta alguna (fragmentos, muestras
+ * perdidas) se cierra el paquete y las siguientes empiezan otro con su propia marca de tiempo
+ */
+template <uint32_t FS>
+class EtapaEmpaquetadoLoRa : public Etapa<MuestraADC, PaqueteCodificado, FS, FRECUENCIA_EVENTOS> {
+public:
+  template <typename Siguiente>
+  inline void procesar(const MuestraADC &muestra, Siguiente &siguiente) {
+    if (ultimaMarca && muestra.marcaTiempo - ultimaMarca > PERIODO_US * 3 / 2 && empaquetador.cerrar())
+      siguiente.procesar(PaqueteCodificado{empaquetador.paquete(), empaquetador.tamano()});
+    ultimaMarca = muestra.marcaTiempo;
+    uint16_t valores[3] = {muestra.x, muestra.y, muestra.z}; // El empaquetador toma los primeros canales configurados
+    if (empaquetador.agregar(valores, (uint32_t)muestra.marcaTiempo))
+      siguiente.procesar(PaqueteCodificado{empaquetador.paquete(), empaquetador.tamano()});
+  }
+
+  /**
+   * Funcion que configura el empaquetador para FS
+   * @param canales Canales por muestra (CANALES_LORA)
+   * @param milivoltios true si las muestras estan calibradas en milivoltios
+   */
+  void iniciar(uint8_t canales, bool milivoltios) {
+    empaquetador.iniciar(canales, PERIODO_US, PAQUETE_CARGA_MAX, milivoltios);
+    ultimaMarca = 0;
+  }
+
+  EmpaquetadorMuestras empaquetador;
+
+private:
+  static constexpr uint32_t PERIODO_US = 1000000 / FS;
+  uint64_t ultimaMarca = 0;
+};
+
+#endif
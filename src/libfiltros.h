@@ -0,0 +1,333 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBFILTROS_H
+#define LIBFILTROS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+
+// Motor de filtros digitales en punto fijo (biquads en cascada y FIR) para la señal de EKG.
+// Los coeficientes se calculan en tiempo de compilacion con las funciones constexpr de
+// diseño a partir de la frecuencia de muestreo, asi que en el lazo de filtrado solo hay
+// multiplicaciones y sumas enteras (nada de float).
+//  - Datos Q15 (int16_t): coeficientes Q2.14, acumulador de 64 bits
+//  - Datos Q31 (int32_t): coeficientes Q2.30, acumulador de 64 bits
+// Para frecuencias de corte muy bajas respecto a fs (por ejemplo la remocion de la linea
+// base a 0.5Hz) use Q31: con coeficientes Q2.14 los polos quedan muy mal cuantizados.
+
+#define PI_FILTROS 3.14159265358979323846
+
+/**
+ * Funcion constexpr que calcula el seno por serie de Taylor (para diseñar los filtros al compilar)
+ * @param x Angulo en radianes
+ */
+constexpr double senoConst(double x) {
+  long long vueltas = (long long)((x + PI_FILTROS) / (2 * PI_FILTROS)); // Reducimos el angulo a [-pi, pi)
+  if (x + PI_FILTROS < 0) vueltas--;
+  x -= vueltas * 2 * PI_FILTROS;
+  double termino = x, suma = x;
+  for (int n = 1; n < 16; n++) {
+    termino *= -x * x / ((2 * n) * (2 * n + 1));
+    suma += termino;
+  }
+  return suma;
+}
+
+/**
+ * Funcion constexpr que calcula el coseno
+ * @param x Angulo en radianes
+ */
+constexpr double cosenoConst(double x) { return senoConst(x + PI_FILTROS / 2); }
+
+/**
+ * Coeficientes de un biquad normalizados (a0 = 1):
+ * y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+ */
+struct CoefBiquad {
+  double b0, b1, b2, a1, a2;
+};
+
+/**
+ * Funcion auxiliar que normaliza los coeficientes dividiendo por a0
+ */
+constexpr CoefBiquad normalizarBiquad(double b0, double b1, double b2, double a0, double a1, double a2) {
+  return CoefBiquad{b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0};
+}
+
+/**
+ * Diseño de un filtro rechaza banda (notch), por ejemplo para la interferencia de la red a 50/60Hz
+ * @param fs Frecuencia de muestreo en Hz
+ * @param f0 Frecuencia a eliminar en Hz
+ * @param q Factor de calidad (mas alto = muesca mas angosta)
+ */
+constexpr CoefBiquad disenarNotch(double fs, double f0, double q) {
+  double w0 = 2 * PI_FILTROS * f0 / fs;
+  double alfa = senoConst(w0) / (2 * q);
+  double c = cosenoConst(w0);
+  return normalizarBiquad(1, -2 * c, 1, 1 + alfa, -2 * c, 1 - alfa);
+}
+
+/**
+ * Diseño de un filtro pasa altos de segundo orden (q = 0.7071 para Butterworth), por ejemplo
+ * para remover la deriva de la linea base
+ * @param fs Frecuencia de muestreo en Hz
+ * @param fc Frecuencia de corte en Hz
+ * @param q Factor de calidad
+ */
+constexpr CoefBiquad disenarPasaAltos(double fs, double fc, double q) {
+  double w0 = 2 * PI_FILTROS * fc / fs;
+  double alfa = senoConst(w0) / (2 * q);
+  double c = cosenoConst(w0);
+  return normalizarBiquad((1 + c) / 2, -(1 + c), (1 + c) / 2, 1 + alfa, -2 * c, 1 - alfa);
+}
+
+/**
+ * Diseño de un filtro pasa bajos de segundo orden (q = 0.7071 para Butterworth)
+ * @param fs Frecuencia de muestreo en Hz
+ * @param fc Frecuencia de corte en Hz
+ * @param q Factor de calidad
+ */
+constexpr CoefBiquad disenarPasaBajos(double fs, double fc, double q) {
+  double w0 = 2 * PI_FILTROS * fc / fs;
+  double alfa = senoConst(w0) / (2 * q);
+  double c = cosenoConst(w0);
+  return normalizarBiquad((1 - c) / 2, 1 - c, (1 - c) / 2, 1 + alfa, -2 * c, 1 - alfa);
+}
+
+/**
+ * Diseño de un filtro pasa banda de segundo orden con ganancia unitaria en la frecuencia central
+ * @param fs Frecuencia de muestreo en Hz
+ * @param f0 Frecuencia central en Hz
+ * @param q Factor de calidad (f0 / ancho de banda)
+ */
+constexpr CoefBiquad disenarPasaBanda(double fs, double f0, double q) {
+  double w0 = 2 * PI_FILTROS * f0 / fs;
+  double alfa = senoConst(w0) / (2 * q);
+  double c = cosenoConst(w0);
+  return normalizarBiquad(alfa, 0, -alfa, 1 + alfa, -2 * c, 1 - alfa);
+}
+
+/**
+ * Diseño de un FIR pasa bajos de N coeficientes (sinc con ventana de Hamming, ganancia unitaria en DC)
+ * @param fs Frecuencia de muestreo en Hz
+ * @param fc Frecuencia de corte en Hz
+ */
+template <size_t N>
+constexpr std::array<double, N> disenarFIRPasaBajos(double fs, double fc) {
+  std::array<double, N> h{};
+  double suma = 0;
+  double centro = (N - 1) / 2.0;
+  for (size_t i = 0; i < N; i++) {
+    double m = i - centro;
+    double sinc = (m == 0) ? 2 * fc / fs : senoConst(2 * PI_FILTROS * fc / fs * m) / (PI_FILTROS * m);
+    double hamming = (N > 1) ? 0.54 - 0.46 * cosenoConst(2 * PI_FILTROS * i / (N - 1)) : 1;
+    h[i] = sinc * hamming;
+    suma += h[i];
+  }
+  for (size_t i = 0; i < N; i++) h[i] /= suma;
+  return h;
+}
+
+/**
+ * Parametros del formato de punto fijo segun el tipo de dato
+ */
+template <typename T>
+struct FormatoQ;
+
+template <>
+struct FormatoQ<int16_t> {
+  typedef int16_t Coef;
+  static const int BITS_COEF = 14;  // Coeficientes Q2.14 (rango [-2, 2))
+  static const int32_t MAXIMO = 32767;
+  static const int32_t MINIMO = -32768;
+};
+
+template <>
+struct FormatoQ<int32_t> {
+  typedef int32_t Coef;
+  static const int BITS_COEF = 30;  // Coeficientes Q2.30 (rango [-2, 2))
+  static const int32_t MAXIMO = 2147483647;
+  static const int32_t MINIMO = -2147483647 - 1;
+};
+
+/**
+ * Funcion constexpr que convierte un coeficiente real al formato de punto fijo de T (con redondeo y saturacion)
+ */
+template <typename T>
+constexpr typename FormatoQ<T>::Coef cuantizarCoef(double c) {
+  double escalado = c * (double)(1LL << FormatoQ<T>::BITS_COEF);
+  escalado += (escalado >= 0) ? 0.5 : -0.5;
+  if (escalado > (double)FormatoQ<T>::MAXIMO) return (typename FormatoQ<T>::Coef)FormatoQ<T>::MAXIMO;
+  if (escalado < (double)FormatoQ<T>::MINIMO) return (typename FormatoQ<T>::Coef)FormatoQ<T>::MINIMO;
+  return (typename FormatoQ<T>::Coef)(long long)escalado;
+}
+
+/**
+ * Coeficientes de un biquad en punto fijo
+ */
+template <typename T>
+struct CoefBiquadQ {
+  typename FormatoQ<T>::Coef b0, b1, b2, a1, a2;
+};
+
+/**
+ * Funcion constexpr que cuantiza los coeficientes de un biquad al formato de T
+ */
+template <typename T>
+constexpr CoefBiquadQ<T> cuantizar(const CoefBiquad &c) {
+  return CoefBiquadQ<T>{cuantizarCoef<T>(c.b0), cuantizarCoef<T>(c.b1), cuantizarCoef<T>(c.b2),
+                        cuantizarCoef<T>(c.a1), cuantizarCoef<T>(c.a2)};
+}
+
+/**
+ * Funcion constexpr que cuantiza los coeficientes de un FIR al formato de T
+ */
+template <typename T, size_t N>
+constexpr std::array<typename FormatoQ<T>::Coef, N> cuantizarFIR(const std::array<double, N> &h) {
+  std::array<typename FormatoQ<T>::Coef, N> q{};
+  for (size_t i = 0; i < N; i++) q[i] = cuantizarCoef<T>(h[i]);
+  return q;
+}
+
+/**
+ * Funcion que pasa el acumulador al formato de salida (redondeo y saturacion)
+ */
+template <typename T>
+inline T saturarAcumulador(int64_t acumulador) {
+  acumulador = (acumulador + (1LL << (FormatoQ<T>::BITS_COEF - 1))) >> FormatoQ<T>::BITS_COEF;
+  if (acumulador > FormatoQ<T>::MAXIMO) return (T)FormatoQ<T>::MAXIMO;
+  if (acumulador < FormatoQ<T>::MINIMO) return (T)FormatoQ<T>::MINIMO;
+  return (T)acumulador;
+}
+
+/**
+ * Cascada de ETAPAS biquads en forma directa I con datos en punto fijo Q15 (int16_t) o Q31 (int32_t)
+ * @param T Tipo de las muestras (int16_t o int32_t)
+ * @param ETAPAS Numero de biquads en cascada
+ */
+template <typename T, size_t ETAPAS>
+class CascadaBiquad {
+public:
+  /**
+   * @param coeficientes Coeficientes cuantizados de cada etapa (normalmente un arreglo constexpr)
+   */
+  explicit CascadaBiquad(const CoefBiquadQ<T> (&coeficientes)[ETAPAS]) {
+    for (size_t i = 0; i < ETAPAS; i++) coef[i] = coeficientes[i];
+    reiniciar();
+  }
+
+  /**
+   * Funcion que borra la historia de todas las etapas
+   */
+  void reiniciar() {
+    for (size_t i = 0; i < ETAPAS; i++) estado[i] = Estado{0, 0, 0, 0};
+  }
+
+  /**
+   * Funcion que filtra una muestra
+   * @param x Muestra de entrada
+   * @return Muestra filtrada
+   */
+  T procesar(T x) {
+    for (size_t i = 0; i < ETAPAS; i++) {
+      const CoefBiquadQ<T> &c = coef[i];
+      Estado &e = estado[i];
+      int64_t acumulador = (int64_t)c.b0 * x + (int64_t)c.b1 * e.x1 + (int64_t)c.b2 * e.x2 -
+                           (int64_t)c.a1 * e.y1 - (int64_t)c.a2 * e.y2;
+      T y = saturarAcumulador<T>(acumulador);
+      e.x2 = e.x1;
+      e.x1 = x;
+      e.y2 = e.y1;
+      e.y1 = y;
+      x = y;  // La salida de esta etapa es la entrada de la siguiente
+    }
+    return x;
+  }
+
+  /**
+   * Funcion que filtra un bloque de muestras (entrada y salida pueden ser el mismo arreglo)
+   */
+  void procesar(const T *entrada, T *salida, size_t n) {
+    for (size_t i = 0; i < n; i++) salida[i] = procesar(entrada[i]);
+  }
+
+private:
+  struct Estado {
+    T x1, x2, y1, y2;
+  };
+  CoefBiquadQ<T> coef[ETAPAS];
+  Estado estado[ETAPAS];
+};
+
+/**
+ * Filtro FIR de N coeficientes con datos en punto fijo Q15 (int16_t) o Q31 (int32_t).
+ * La historia se guarda duplicada para que el producto punto recorra memoria contigua
+ * sin calcular el modulo en cada coeficiente.
+ */
+template <typename T, size_t N>
+class FIR {
+public:
+  /**
+   * @param coeficientes Coeficientes cuantizados (normalmente un std::array constexpr)
+   */
+  explicit FIR(const std::array<typename FormatoQ<T>::Coef, N> &coeficientes) : coef(coeficientes) { reiniciar(); }
+
+  /**
+   * Funcion que borra la historia del filtro
+   */
+  void reiniciar() {
+    for (size_t i = 0; i < 2 * N; i++) historia[i] = 0;
+    indice = 0;
+  }
+
+  /**
+   * Funcion que filtra una muestra
+   * @param x Muestra de entrada
+   * @return Muestra filtrada
+   */
+  T procesar(T x) {
+    indice = (indice == 0) ? N - 1 : indice - 1;  // La muestra mas nueva queda en historia[indice]
+    historia[indice] = x;
+    historia[indice + N] = x;
+    const T *h = &historia[indice];
+    int64_t acumulador = 0;
+    for (size_t k = 0; k < N; k++) acumulador += (int64_t)coef[k] * h[k];
+    return saturarAcumulador<T>(acumulador);
+  }
+
+  /**
+   * Funcion que filtra un bloque de muestras (entrada y salida pueden ser el mismo arreglo)
+   */
+  void procesar(const T *entrada, T *salida, size_t n) {
+    for (size_t i = 0; i < n; i++) salida[i] = procesar(entrada[i]);
+  }
+
+private:
+  std::array<typename FormatoQ<T>::Coef, N> coef;
+  T historia[2 * N];
+  size_t indice;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libfusion.h"
+#include <string.h>
+
+
+FusionadorSensores::FusionadorSensores(uint32_t esperaMax)
+    : hayGiroAnterior(false), hayGps(false), esperaMaxUs(esperaMax), e{0, 0, 0, 0, 0} {
+  memset(&giroAnterior, 0, sizeof(giroAnterior));
+  memset(&gpsActual, 0, sizeof(gpsActual));
+}
+
+
+bool FusionadorSensores::agregarAdc(const MuestraADC &muestra) {
+  if (adc.push(muestra)) return true;
+  e.descartadasAdc++;
+  return false;
+}
+
+
+bool FusionadorSensores::agregarGiroscopio(const MuestraGiroscopio &muestra) {
+  if (giroscopio.disponibles() == FUSION_TAM_GIROSCOPIO) {
+    // El ADC no avanza: la muestra mas antigua pasa a ser la anterior, que es lo que se sostendria
+    giroscopio.pop(giroAnterior);
+    hayGiroAnterior = true;
+    e.descartadasGiroscopio++;
+  }
+  return giroscopio.push(muestra);
+}
+
+
+void FusionadorSensores::agregarGPS(const RegistroGPS &registro) {
+  if (gps.disponibles() == FUSION_TAM_GPS) {
+    gps.pop(gpsActual);
+    hayGps = true;
+  }
+  gps.push(registro);
+}
+
+
+bool FusionadorSensores::extraer(uint64_t ahoraUs, RegistroFusionado &registro) {
+  Ventana<MuestraADC> pendiente = adc.primeras(1);
+  if (pendiente.size() == 0) return false;
+  const MuestraADC &muestra = pendiente[0];
+  uint64_t t = muestra.marcaTiempo;
+
+  // El giroscopio avanza hasta su ultima muestra en o antes del instante del ADC
+  Ventana<MuestraGiroscopio> siguiente = giroscopio.primeras(1);
+  while (siguiente.size() > 0 && siguiente[0].marcaTiempo <= t) {
+    giroscopio.pop(giroAnterior);
+    hayGiroAnterior = true;
+    siguiente = giroscopio.primeras(1);
+  }
+  if (siguiente.size() > 0 && hayGiroAnterior) {
+    const MuestraGiroscopio &a = giroAnterior;
+    const MuestraGiroscopio &b = siguiente[0];
+    int64_t fraccion = (int64_t)(t - a.marcaTiempo);
+    int64_t intervalo = (int64_t)(b.marcaTiempo - a.marcaTiempo);
+    registro.giro[0] = (int16_t)(a.x + (b.x - a.x) * fraccion / intervalo);
+    registro.giro[1] = (int16_t)(a.y + (b.y - a.y) * fraccion / intervalo);
+    registro.giro[2] = (int16_t)(a.z + (b.z - a.z) * fraccion / intervalo);
+    registro.banderas = FUSION_GIRO_INTERPOLADO;
+    e.interpolados++;
+  } else if (ahoraUs >= t + esperaMaxUs) {
+    // No llego una muestra posterior a tiempo (giroscopio detenido o atrasado): se sostiene la conocida
+    const MuestraGiroscopio *conocida = hayGiroAnterior ? &giroAnterior : (siguiente.size() > 0 ? &siguiente[0] : NULL);
+    registro.giro[0] = conocida ? conocida->x : 0;
+    registro.giro[1] = conocida ? conocida->y : 0;
+    registro.giro[2] = conocida ? conocida->z : 0;
+    registro.banderas = conocida ? FUSION_GIRO_SOSTENIDO : 0;
+    if (conocida) e.sostenidos++;
+  } else {
+    return false;  // Aun puede llegar la muestra del giroscopio que la rodea
+  }
+
+  // El GPS se sostiene: vale el ultimo fix que llego antes de la muestra
+  Ventana<RegistroGPS> fix = gps.primeras(1);
+  while (fix.size() > 0 && fix[0].marcaTiempo <= t) {
+    gps.pop(gpsActual);
+    hayGps = true;
+    fix = gps.primeras(1);
+  }
+  registro.marcaTiempo = t;
+  registro.adc[0] = muestra.x;
+  registro.adc[1] = muestra.y;
+  registro.adc[2] = muestra.z;
+  registro.latitud = hayGps ? gpsActual.latitud : 0;
+  registro.longitud = hayGps ? gpsActual.longitud : 0;
+  registro.edadGpsMs = hayGps ? (uint32_t)((t - gpsActual.marcaTiempo) / 1000) : UINT32_MAX;
+  if (hayGps && gpsActual.posicionValida) registro.banderas |= FUSION_GPS_VALIDO;
+  adc.descartar(1);
+  e.registros++;
+  return true;
+}
+
+
+EstadisticasFusion FusionadorSensores::estadisticas() const {
+  return e;
+}
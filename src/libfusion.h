@@ -0,0 +1,124 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBFUSION_H
+#define LIBFUSION_H
+
+#include <stdint.h>
+#include "libringbuffer.h"
+#include "libprocesamiento.h"
+#include "libgiroscopio.h"
+#include "libgps.h"
+
+// Fusion de los sensores sobre el reloj de muestreo del ADC. Todas las fuentes vienen marcadas con
+// la base de tiempo comun (halMicros()); por cada muestra del ADC se emite un registro con el
+// giroscopio interpolado linealmente en ese mismo instante y el ultimo fix del GPS anterior a el
+// (sostenido). Como el giroscopio llega por lotes con retraso (se lee de su FIFO cada 80 ms), cada
+// muestra del ADC espera hasta que haya una del giroscopio posterior a ella, o hasta un limite en
+// el que se sostiene el ultimo valor conocido para no frenar a los consumidores.
+
+#define FUSION_ESPERA_MAX_US 200000  // Espera maxima de una muestra del ADC por el giroscopio que la rodea
+#define FUSION_TAM_ADC 128           // Muestras del ADC en espera (potencia de 2, cubre la espera maxima a 256 Hz)
+#define FUSION_TAM_GIROSCOPIO 64     // Muestras del giroscopio por delante del ADC (potencia de 2)
+#define FUSION_TAM_GPS 4
+
+// Banderas de un registro fusionado
+#define FUSION_GIRO_INTERPOLADO 0x01 // El giroscopio se interpolo entre dos muestras que rodean al instante
+#define FUSION_GIRO_SOSTENIDO 0x02   // El giroscopio es la ultima muestra conocida (se agoto la espera)
+#define FUSION_GPS_VALIDO 0x04       // Hay un fix con posicion valida anterior al instante
+
+/**
+ * Registro de todos los sensores alineado a una muestra del ADC
+ */
+struct RegistroFusionado {
+  uint64_t marcaTiempo; // Instante de la muestra del ADC en la base de tiempo comun
+  uint16_t adc[3];      // x, y, z crudos
+  int16_t giro[3];      // Giroscopio x, y, z en ese instante
+  int32_t latitud;      // Microgrados del ultimo fix
+  int32_t longitud;
+  uint32_t edadGpsMs;   // Tiempo desde que llego el fix
+  uint8_t banderas;     // FUSION_*
+};
+
+/**
+ * Contadores del fusionador
+ */
+struct EstadisticasFusion {
+  uint32_t registros;     // Registros emitidos
+  uint32_t interpolados;  // Registros con el giroscopio interpolado
+  uint32_t sostenidos;    // Registros con el giroscopio sostenido
+  uint32_t descartadasAdc; // Muestras del ADC perdidas porque la espera estaba llena
+  uint32_t descartadasGiroscopio; // Muestras del giroscopio perdidas porque iban demasiado adelantadas
+};
+
+/**
+ * Fusionador de las muestras de los sensores. No usa la HAL ni tareas: se le entregan las muestras
+ * de cada fuente en orden y se le piden los registros, asi que se puede probar con flujos sinteticos
+ */
+class FusionadorSensores {
+public:
+  explicit FusionadorSensores(uint32_t esperaMaxUs = FUSION_ESPERA_MAX_US);
+
+  /**
+   * Funcion que agrega una muestra del ADC
+   * @return false si la espera estaba llena y la muestra se descarto
+   */
+  bool agregarAdc(const MuestraADC &muestra);
+
+  /**
+   * Funcion que agrega una muestra del giroscopio
+   * @return false si la muestra se descarto
+   */
+  bool agregarGiroscopio(const MuestraGiroscopio &muestra);
+
+  /**
+   * Funcion que agrega un registro del GPS
+   */
+  void agregarGPS(const RegistroGPS &registro);
+
+  /**
+   * Funcion que emite el registro de la muestra del ADC mas antigua si ya se puede alinear
+   * @param ahoraUs Tiempo actual, para saber si se agoto la espera por el giroscopio
+   * @param registro Donde se escribe el registro
+   * @return true si se emitio un registro
+   */
+  bool extraer(uint64_t ahoraUs, RegistroFusionado &registro);
+
+  /**
+   * Contadores del fusionador
+   */
+  EstadisticasFusion estadisticas() const;
+
+private:
+  BufferCircular<MuestraADC, FUSION_TAM_ADC> adc;
+  BufferCircular<MuestraGiroscopio, FUSION_TAM_GIROSCOPIO> giroscopio;
+  BufferCircular<RegistroGPS, FUSION_TAM_GPS> gps;
+  MuestraGiroscopio giroAnterior; // Ultima muestra del giroscopio en o antes del instante actual
+  RegistroGPS gpsActual;          // Ultimo fix en o antes del instante actual
+  bool hayGiroAnterior;
+  bool hayGps;
+  uint32_t esperaMaxUs;
+  EstadisticasFusion e;
+};
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libgestos.h"
+
+
+ReconocedorGestos::ReconocedorGestos() : pulsados(0), acorde(0), inicioAcorde(0) {
+  for (uint8_t i = 0; i < GESTOS_MAX_PADS; i++) {
+    estado[i] = REPOSO;
+    inicio[i] = plazo[i] = 0;
+  }
+}
+
+
+size_t ReconocedorGestos::procesar(const EventoTouch &e, GestoTouch *gestos, size_t max) {
+  size_t n = revisar(e.marcaTiempo, gestos, max);  // Los plazos que vencieron antes del evento van primero
+  uint8_t p = e.pad;
+  if (p >= GESTOS_MAX_PADS) return n;
+  uint16_t bit = (uint16_t)(1u << p);
+  if (e.pulsado) {
+    pulsados |= bit;
+    // Un pad que se pulsa poco despues de otro que sigue pulsado forma un acorde con el
+    for (uint8_t i = 0; i < GESTOS_MAX_PADS && estado[p] != EN_ACORDE; i++) {
+      if (i == p || !(pulsados & (1u << i))) continue;
+      bool reciente = (estado[i] == PULSADO || estado[i] == SEGUNDO_PULSADO) && e.marcaTiempo - inicio[i] <= GESTO_VENTANA_ACORDE_US;
+      if (estado[i] == EN_ACORDE || reciente) {
+        if (acorde == 0) inicioAcorde = inicio[i];
+        acorde |= bit | (uint16_t)(1u << i);
+        estado[i] = EN_ACORDE;
+        estado[p] = EN_ACORDE;
+      }
+    }
+    if (estado[p] == EN_ACORDE) return n;
+    if (estado[p] == ESPERANDO_SEGUNDO) {
+      estado[p] = SEGUNDO_PULSADO;
+    } else {
+      estado[p] = PULSADO;
+      inicio[p] = e.marcaTiempo;
+    }
+    plazo[p] = e.marcaTiempo + GESTO_PULSACION_LARGA_US;
+    return n;
+  }
+  pulsados &= (uint16_t)~bit;
+  switch (estado[p]) {
+    case PULSADO:
+      estado[p] = ESPERANDO_SEGUNDO;  // Aun puede ser un doble toque
+      plazo[p] = e.marcaTiempo + GESTO_DOBLE_TOQUE_US;
+      break;
+    case SEGUNDO_PULSADO:
+      if (n < max) gestos[n++] = GestoTouch{GESTO_DOBLE_TOQUE, bit, inicio[p]};
+      estado[p] = REPOSO;
+      break;
+    case EN_ACORDE:
+      estado[p] = REPOSO;
+      if ((pulsados & acorde) == 0) {  // Se soltaron todos los pads del acorde
+        if (n < max) gestos[n++] = GestoTouch{GESTO_ACORDE, acorde, inicioAcorde};
+        acorde = 0;
+      }
+      break;
+    default:
+      estado[p] = REPOSO;
+      break;
+  }
+  return n;
+}
+
+
+size_t ReconocedorGestos::revisar(uint64_t ahora, GestoTouch *gestos, size_t max) {
+  size_t n = 0;
+  for (uint8_t p = 0; p < GESTOS_MAX_PADS; p++) {
+    if (ahora < plazo[p]) continue;
+    uint16_t bit = (uint16_t)(1u << p);
+    if (estado[p] == PULSADO || estado[p] == SEGUNDO_PULSADO) {
+      if (n < max) gestos[n++] = GestoTouch{GESTO_PULSACION_LARGA, bit, inicio[p]};
+      estado[p] = LARGA_INFORMADA;
+    } else if (estado[p] == ESPERANDO_SEGUNDO) {
+      if (n < max) gestos[n++] = GestoTouch{GESTO_TOQUE, bit, inicio[p]};
+      estado[p] = REPOSO;
+    }
+  }
+  return n;
+}
+
+
+uint64_t ReconocedorGestos::proximoVencimiento() const {
+  uint64_t proximo = GESTO_SIN_VENCIMIENTO;
+  for (uint8_t p = 0; p < GESTOS_MAX_PADS; p++)
+    if ((estado[p] == PULSADO || estado[p] == SEGUNDO_PULSADO || estado[p] == ESPERANDO_SEGUNDO) && plazo[p] < proximo)
+      proximo = plazo[p];
+  return proximo;
+}
@@ -0,0 +1,106 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBGESTOS_H
+#define LIBGESTOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reconocimiento de gestos sobre los eventos de los touchpads: toque, doble toque, pulsacion
+// larga y acordes (varios pads pulsados a la vez). Solo recibe eventos con marca de tiempo, asi
+// que no depende del hardware y se puede probar con secuencias de eventos grabadas.
+
+#define GESTOS_MAX_PADS 10
+#define GESTO_DOBLE_TOQUE_US 300000     // Tiempo maximo entre soltar y volver a pulsar para un doble toque
+#define GESTO_PULSACION_LARGA_US 800000 // Tiempo pulsado a partir del cual es una pulsacion larga
+#define GESTO_VENTANA_ACORDE_US 150000  // Diferencia maxima entre las pulsaciones de los pads de un acorde
+#define GESTO_SIN_VENCIMIENTO UINT64_MAX
+
+/**
+ * Transicion de un touchpad, tal como la publica la tarea de muestreo de los touch
+ */
+struct EventoTouch {
+  uint64_t marcaTiempo; // Instante de la lectura que confirmo la transicion en microsegundos
+  uint8_t pad;          // Posicion del pad en la tabla
+  bool pulsado;         // true si el pad se pulso, false si se solto
+};
+
+enum TipoGesto {
+  GESTO_TOQUE,            // Pulsacion corta sin otra enseguida
+  GESTO_DOBLE_TOQUE,      // Dos pulsaciones cortas seguidas en el mismo pad
+  GESTO_PULSACION_LARGA,  // El pad lleva pulsado GESTO_PULSACION_LARGA_US (se informa sin esperar a que se suelte)
+  GESTO_ACORDE            // Varios pads pulsados casi al mismo tiempo (se informa cuando se sueltan todos)
+};
+
+/**
+ * Gesto reconocido
+ */
+struct GestoTouch {
+  TipoGesto tipo;
+  uint16_t pads;        // Mascara de bits de los pads del gesto (bit i = pad i de la tabla)
+  uint64_t marcaTiempo; // Instante en que empezo el gesto
+};
+
+/**
+ * Maquina de estados que convierte los eventos de los pads en gestos
+ */
+class ReconocedorGestos {
+public:
+  ReconocedorGestos();
+
+  /**
+   * Funcion que procesa un evento de un pad
+   * @param evento Evento a procesar (en orden de tiempo)
+   * @param gestos Donde se escriben los gestos reconocidos
+   * @param max Capacidad de gestos
+   * @return Numero de gestos reconocidos
+   */
+  size_t procesar(const EventoTouch &evento, GestoTouch *gestos, size_t max);
+
+  /**
+   * Funcion que revisa los plazos vencidos (toque sin segundo toque, pulsacion larga)
+   * @param ahora Instante actual en microsegundos
+   * @param gestos Donde se escriben los gestos reconocidos
+   * @param max Capacidad de gestos
+   * @return Numero de gestos reconocidos
+   */
+  size_t revisar(uint64_t ahora, GestoTouch *gestos, size_t max);
+
+  /**
+   * Instante del siguiente plazo que hay que revisar, o GESTO_SIN_VENCIMIENTO si no hay ninguno
+   */
+  uint64_t proximoVencimiento() const;
+
+private:
+  enum Estado : uint8_t { REPOSO, PULSADO, ESPERANDO_SEGUNDO, SEGUNDO_PULSADO, LARGA_INFORMADA, EN_ACORDE };
+
+  Estado estado[GESTOS_MAX_PADS];
+  uint64_t inicio[GESTOS_MAX_PADS];  // Instante de la primera pulsacion del gesto en curso
+  uint64_t plazo[GESTOS_MAX_PADS];   // Instante en que vence el estado actual
+  uint16_t pulsados;                 // Mascara de los pads pulsados en este momento
+  uint16_t acorde;                   // Mascara de los pads del acorde en curso
+  uint64_t inicioAcorde;
+};
+
+#endif
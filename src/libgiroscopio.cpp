@@ -0,0 +1,164 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libgiroscopio.h"
+#include "libhal.h"
+#include "libplanificador.h"
+#include "libringbuffer.h"
+
+static BufferCircular<MuestraGiroscopio, GIRO_TAM_BUFFER> muestrasGiroscopio; // Tarea del giroscopio -> consumidores
+static int trabajoGiroscopio = -1;
+static uint8_t direccionGiro = 0;  // Direccion I2C encontrada por iniciarGiroscopio()
+static int64_t periodoQ8 = 0;      // Periodo estimado en microsegundos con 8 bits de fraccion
+static int64_t ultimaQ8 = 0;       // Instante de la ultima muestra leida con 8 bits de fraccion
+static bool sincronizado = false;  // La linea de tiempo ya tiene una referencia
+static EstadisticasGiroscopio estadisticas;
+
+
+/**
+ * Funcion que escribe un registro del giroscopio
+ */
+static bool escribirRegistro(uint8_t registro, uint8_t valor) {
+  uint8_t datos[2] = {registro, valor};
+  return halI2cEscribir(direccionGiro, datos, 2);
+}
+
+
+/**
+ * Funcion que busca el giroscopio de un tipo como gyro.init(): primero con SA0 en alto y luego en bajo
+ * @return Direccion en la que respondio con el WHO_AM_I del tipo, 0 si no se encontro
+ */
+static uint8_t buscarGiroscopio(uint8_t tipo) {
+  static const uint8_t ids[GIRO_NUM_TIPOS] = {L3G4200D_ID, L3GD20_ID, L3GD20H_ID};
+  uint8_t direcciones[2] = {DIRECCION_L3GD20_SA0_ALTO, DIRECCION_L3GD20_SA0_BAJO};
+  if (tipo == GIRO_L3G4200D) {
+    direcciones[0] = DIRECCION_L3G4200D_SA0_ALTO;
+    direcciones[1] = DIRECCION_L3G4200D_SA0_BAJO;
+  }
+  for (uint8_t d : direcciones) {
+    uint8_t id;
+    if (halI2cLeer(d, L3G_WHO_AM_I, &id, 1) && id == ids[tipo]) return d;
+  }
+  return 0;
+}
+
+
+/**
+ * Funcion que asigna los instantes de un lote de muestras recien leido y corrige la linea de tiempo.
+ * La ultima muestra del lote se genero en algun momento del ultimo periodo antes de la lectura, asi
+ * que se compara con la mitad de ese periodo: el error corrige el instante (proporcional) y el
+ * periodo estimado (integral), como un PLL, para seguir la diferencia entre el reloj del giroscopio
+ * y el del ESP32
+ */
+static void asignarTiempos(MuestraGiroscopio *lote, size_t n, uint64_t lecturaUs) {
+  int64_t observadaQ8 = ((int64_t)lecturaUs << 8) - periodoQ8 / 2;
+  int64_t predichaQ8 = ultimaQ8 + periodoQ8 * (int64_t)n;
+  int64_t errorQ8 = observadaQ8 - predichaQ8;
+  if (!sincronizado || errorQ8 > 4 * periodoQ8 || errorQ8 < -4 * periodoQ8) {
+    if (sincronizado) estadisticas.resincronizaciones++;
+    sincronizado = true;
+    errorQ8 = 0;
+    predichaQ8 = observadaQ8;
+    ultimaQ8 = observadaQ8 - periodoQ8 * (int64_t)n;
+  }
+  for (size_t i = 0; i < n; i++) lote[i].marcaTiempo = (uint64_t)((ultimaQ8 + periodoQ8 * (int64_t)(i + 1)) >> 8);
+  ultimaQ8 = predichaQ8 + errorQ8 / 16;
+  periodoQ8 += errorQ8 / (int64_t)(256 * n);
+}
+
+
+/**
+ * Manejador de la tarea del giroscopio: lee todas las muestras pendientes de la FIFO
+ */
+static void atenderGiroscopio() {
+  uint8_t fuente;
+  if (!halI2cLeer(direccionGiro, L3G_FIFO_SRC, &fuente, 1)) {
+    estadisticas.errores++;
+    return;
+  }
+  if (fuente & L3G_FIFO_SRC_OVRN) {  // Se perdieron muestras: la linea de tiempo ya no es continua
+    estadisticas.desbordes++;
+    sincronizado = false;
+  }
+  size_t pendientes = fuente & L3G_FIFO_SRC_FSS;
+  if (pendientes == 0 && !(fuente & L3G_FIFO_SRC_EMPTY)) pendientes = L3G_TAM_FIFO;  // FSS solo tiene 5 bits: con la FIFO llena vale 0
+  while (pendientes > 0) {
+    size_t n = (pendientes > GIRO_MAX_RAFAGA) ? GIRO_MAX_RAFAGA : pendientes;
+    uint8_t crudo[GIRO_MAX_RAFAGA * 6];
+    if (!halI2cLeer(direccionGiro, L3G_OUT_X_L | L3G_AUTOINCREMENTO, crudo, n * 6)) {
+      estadisticas.errores++;
+      return;
+    }
+    uint64_t lecturaUs = halMicros();
+    MuestraGiroscopio lote[GIRO_MAX_RAFAGA];
+    for (size_t i = 0; i < n; i++) {
+      lote[i].x = (int16_t)(crudo[6 * i] | (crudo[6 * i + 1] << 8));
+      lote[i].y = (int16_t)(crudo[6 * i + 2] | (crudo[6 * i + 3] << 8));
+      lote[i].z = (int16_t)(crudo[6 * i + 4] | (crudo[6 * i + 5] << 8));
+    }
+    // Si aun quedan muestras despues de esta rafaga, la ultima del lote no es la mas reciente
+    asignarTiempos(lote, n, lecturaUs - (uint64_t)((pendientes - n) * (periodoQ8 >> 8)));
+    for (size_t i = 0; i < n; i++) muestrasGiroscopio.push(lote[i]);
+    estadisticas.lecturas++;
+    estadisticas.muestras += n;
+    pendientes -= n;
+  }
+}
+
+
+bool iniciarGiroscopio(uint8_t tipo, uint16_t odrHz, uint8_t prioridad, uint8_t nucleo) {
+  if (tipo >= GIRO_NUM_TIPOS) return false;  // device_auto u otro que no sabemos configurar
+  direccionGiro = buscarGiroscopio(tipo);
+  if (direccionGiro == 0) return false;
+  uint8_t dr = (odrHz >= 800) ? 3 : (odrHz >= 400) ? 2 : (odrHz >= 200) ? 1 : 0;  // Con LOW_ODR = 0: 100, 200, 400 u 800 Hz
+  uint32_t odr = ((tipo == GIRO_L3GD20) ? 95u : 100u) << dr;
+  periodoQ8 = ((int64_t)1000000 << 8) / odr;
+  sincronizado = false;
+  bool ok = (tipo != GIRO_L3GD20H || escribirRegistro(L3G_LOW_ODR, 0x00)) &&
+            escribirRegistro(L3G_CTRL4, 0x00) &&                              // 245 dps, como enableDefault()
+            escribirRegistro(L3G_CTRL1, (uint8_t)((dr << 6) | (2 << 4) | 0x0F)) && // ODR, ancho de banda, encendido y ejes x, y, z
+            escribirRegistro(L3G_CTRL5, L3G_CTRL5_FIFO_EN) &&
+            escribirRegistro(L3G_FIFO_CTRL, L3G_FIFO_MODO_STREAM | GIRO_UMBRAL_FIFO);
+  if (!ok) return false;
+  // El planificador la ejecuta cuando la FIFO deberia ir por la marca de agua, con margen antes de llenarse
+  if (trabajoGiroscopio < 0)
+    trabajoGiroscopio = planificadorAgregar("Giroscopio", atenderGiroscopio,
+                                            PLAN_FRECUENCIA_BASE * GIRO_UMBRAL_FIFO / odr, prioridad, nucleo);
+  return trabajoGiroscopio >= 0;
+}
+
+
+size_t leerMuestrasGiroscopio(MuestraGiroscopio *destino, size_t max) {
+  size_t n = 0;
+  while (n < max && muestrasGiroscopio.pop(destino[n])) n++;
+  return n;
+}
+
+
+EstadisticasGiroscopio estadisticasGiroscopio() {
+  EstadisticasGiroscopio e = estadisticas;
+  e.perdidas = muestrasGiroscopio.perdidas();
+  e.periodoUs = (uint32_t)(periodoQ8 >> 8);
+  e.direccion = direccionGiro;
+  return e;
+}
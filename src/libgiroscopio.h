@@ -0,0 +1,128 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBGIROSCOPIO_H
+#define LIBGIROSCOPIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Adquisicion del giroscopio L3G (L3G4200D, L3GD20 o L3GD20H) desacoplada de la del ADC. El giroscopio muestrea a su propia
+// tasa (ODR) y guarda las muestras en su FIFO de 32 niveles en modo stream; una tarea aparte lee
+// cada cierto tiempo todas las muestras pendientes en una sola transaccion I2C (lectura en rafaga:
+// con la FIFO activa la direccion autoincremental vuelve de OUT_Z_H a OUT_X_L) y las deja en un
+// buffer circular con la marca de tiempo de cada una reconstruida a partir del ODR.
+// El tipo lo detecta gyro.init() de la biblioteca L3G, que no expone la direccion: iniciarGiroscopio()
+// la vuelve a buscar con el mismo criterio (WHO_AM_I con SA0 en alto y luego en bajo).
+
+// Direcciones I2C de 7 bits segun el pin SA0
+#define DIRECCION_L3GD20_SA0_ALTO 0x6B    // L3GD20 y L3GD20H
+#define DIRECCION_L3GD20_SA0_BAJO 0x6A
+#define DIRECCION_L3G4200D_SA0_ALTO 0x69
+#define DIRECCION_L3G4200D_SA0_BAJO 0x68
+
+// Valor de WHO_AM_I de cada tipo
+#define L3G4200D_ID 0xD3
+#define L3GD20_ID 0xD4
+#define L3GD20H_ID 0xD7
+
+// Registros comunes a los tres tipos (LOW_ODR solo existe en el L3GD20H)
+#define L3G_WHO_AM_I 0x0F
+#define L3G_CTRL1 0x20
+#define L3G_CTRL4 0x23
+#define L3G_CTRL5 0x24
+#define L3G_OUT_X_L 0x28
+#define L3G_FIFO_CTRL 0x2E
+#define L3G_FIFO_SRC 0x2F
+#define L3G_LOW_ODR 0x39
+#define L3G_AUTOINCREMENTO 0x80     // Bit 7 de la direccion del registro: autoincremento en lecturas de varios bytes
+#define L3G_CTRL5_FIFO_EN 0x40
+#define L3G_FIFO_MODO_STREAM 0x40   // FM = 010: la FIFO sobreescribe la muestra mas antigua cuando se llena
+#define L3G_FIFO_SRC_OVRN 0x40      // Se sobreescribio al menos una muestra sin leer
+#define L3G_FIFO_SRC_EMPTY 0x20     // La FIFO esta vacia
+#define L3G_FIFO_SRC_FSS 0x1F       // Numero de muestras sin leer
+#define L3G_TAM_FIFO 32
+
+#define GIRO_UMBRAL_FIFO 16         // Muestras en la FIFO a las que se hace cada lectura (marca de agua)
+#define GIRO_MAX_RAFAGA 21          // Muestras por transaccion: 126 bytes, cabe en el buffer de 128 bytes de Wire
+#define GIRO_TAM_BUFFER 256         // Muestras que caben en el buffer hacia los consumidores (potencia de 2)
+
+/**
+ * Tipos de giroscopio, en el orden de L3G::deviceType para poder pasar gyro.getDeviceType()
+ */
+enum TipoGiroscopio : uint8_t {
+  GIRO_L3G4200D,
+  GIRO_L3GD20,   // ODR de 95, 190, 380 o 760 Hz
+  GIRO_L3GD20H,
+  GIRO_NUM_TIPOS
+};
+
+/**
+ * Muestra del giroscopio con su instante reconstruido
+ */
+struct MuestraGiroscopio {
+  uint64_t marcaTiempo; // Instante de la muestra en la base de tiempo comun (halMicros())
+  int16_t x;
+  int16_t y;
+  int16_t z;
+};
+
+/**
+ * Contadores del giroscopio
+ */
+struct EstadisticasGiroscopio {
+  uint32_t lecturas;        // Transacciones de lectura de la FIFO
+  uint32_t muestras;        // Muestras leidas de la FIFO
+  uint32_t desbordes;       // Veces que la FIFO se lleno y perdio muestras
+  uint32_t errores;         // Transacciones I2C fallidas
+  uint32_t perdidas;        // Muestras descartadas porque el buffer hacia los consumidores estaba lleno
+  uint32_t resincronizaciones; // Veces que la linea de tiempo se volvio a tomar del reloj
+  uint32_t periodoUs;       // Periodo de muestreo estimado (el ODR real difiere un poco del nominal)
+  uint8_t direccion;        // Direccion I2C en la que se encontro el giroscopio (0 si no se encontro)
+};
+
+/**
+ * Funcion que busca el giroscopio del tipo detectado, lo configura en modo FIFO stream y registra en
+ * el planificador el trabajo que lo lee. Se debe llamar antes de iniciarPlanificador()
+ * @param tipo Tipo detectado por gyro.init() (gyro.getDeviceType()); otro valor se rechaza
+ * @param odrHz Tasa de muestreo del giroscopio: 100, 200, 400 u 800 Hz (en el L3GD20 la mas cercana de 95 a 760 Hz)
+ * @param prioridad Prioridad de la tarea del giroscopio
+ * @param nucleo Nucleo al que se fija la tarea
+ * @return true si el giroscopio respondio con el WHO_AM_I de su tipo y quedo configurado
+ */
+bool iniciarGiroscopio(uint8_t tipo, uint16_t odrHz, uint8_t prioridad, uint8_t nucleo);
+
+/**
+ * Funcion que extrae muestras del giroscopio en orden (un solo consumidor)
+ * @param destino Donde se copian las muestras
+ * @param max Capacidad del destino
+ * @return Numero de muestras extraidas
+ */
+size_t leerMuestrasGiroscopio(MuestraGiroscopio *destino, size_t max);
+
+/**
+ * Funcion que da los contadores del giroscopio
+ */
+EstadisticasGiroscopio estadisticasGiroscopio();
+
+#endif
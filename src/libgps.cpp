@@ -0,0 +1,252 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libgps.h"
+#include <stdlib.h>
+#include <string.h>
+#include "libhal.h"
+#include "libbasetiempo.h"
+#include "libseqlock.h"
+#include "libcaptura.h"
+
+static InterpreteNMEA interprete;
+static Seqlock<RegistroGPS> registroPublicado;
+static int tareaGPS = -1;
+static uint32_t bytesGPS = 0;
+static uint32_t publicacionesGPS = 0;
+
+
+/**
+ * Funcion que convierte un digito hexadecimal, o da -1 si no lo es
+ */
+static int valorHex(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+
+/**
+ * Funcion que lee un numero de dos digitos
+ */
+static uint8_t dosDigitos(const char *p) {
+  return (uint8_t)((p[0] - '0') * 10 + (p[1] - '0'));
+}
+
+
+/**
+ * Funcion que convierte una coordenada NMEA (gggmm.mmmm) a microgrados sin usar punto flotante
+ * @param campo Coordenada
+ * @param hemisferio N, S, E u O (W)
+ * @param microgrados Donde se escribe el resultado
+ * @return true si la coordenada es valida
+ */
+static bool coordenada(const char *campo, const char *hemisferio, int32_t &microgrados) {
+  const char *punto = strchr(campo, '.');
+  size_t enteros = punto ? (size_t)(punto - campo) : strlen(campo);
+  if (enteros < 3 || enteros > 5) return false;
+  int32_t grados = 0;
+  for (size_t i = 0; i < enteros - 2; i++) grados = grados * 10 + (campo[i] - '0');
+  int64_t minutosE6 = (int64_t)dosDigitos(&campo[enteros - 2]) * 1000000;  // Minutos con 6 decimales
+  if (punto) {
+    int64_t escala = 100000;
+    for (const char *p = punto + 1; *p >= '0' && *p <= '9' && escala > 0; p++, escala /= 10) minutosE6 += (*p - '0') * escala;
+  }
+  microgrados = (int32_t)(grados * 1000000 + (minutosE6 + 30) / 60);
+  if (hemisferio[0] == 'S' || hemisferio[0] == 'W') microgrados = -microgrados;
+  return true;
+}
+
+
+InterpreteNMEA::InterpreteNMEA() : frases(0), erroresChecksum(0), descartadas(0), largo(0), enFrase(false) {
+  memset(&actual, 0, sizeof(actual));
+}
+
+
+bool InterpreteNMEA::procesar(char c, uint64_t ahoraUs) {
+  if (c == '$') {  // Inicio de frase: si la anterior no habia terminado se descarta
+    if (enFrase) descartadas++;
+    enFrase = true;
+    largo = 0;
+    return false;
+  }
+  if (!enFrase) return false;
+  if (c == '\r' || c == '\n') {
+    enFrase = false;
+    frase[largo] = '\0';
+    if (!interpretar()) return false;
+    actual.marcaTiempo = ahoraUs;
+    return true;
+  }
+  if (largo >= NMEA_TAM_MAX_FRASE) {  // Demasiado larga: ruido en la linea
+    enFrase = false;
+    descartadas++;
+    return false;
+  }
+  frase[largo++] = c;
+  return false;
+}
+
+
+bool InterpreteNMEA::interpretar() {
+  // Verificamos el checksum: XOR de los caracteres entre $ y *
+  char *asterisco = strchr(frase, '*');
+  if (asterisco == NULL || asterisco[1] == '\0' || asterisco[2] == '\0') {
+    descartadas++;
+    return false;
+  }
+  uint8_t suma = 0;
+  for (char *p = frase; p < asterisco; p++) suma ^= (uint8_t)*p;
+  int alto = valorHex(asterisco[1]), bajo = valorHex(asterisco[2]);
+  if (alto < 0 || bajo < 0 || suma != (uint8_t)(alto * 16 + bajo)) {
+    erroresChecksum++;
+    return false;
+  }
+  *asterisco = '\0';
+  // Partimos la frase en campos sobre el mismo buffer (las comas se vuelven fines de cadena)
+  char *campos[NMEA_MAX_CAMPOS];
+  uint8_t n = 0;
+  campos[n++] = frase;
+  for (char *p = frase; *p && n < NMEA_MAX_CAMPOS; p++) {
+    if (*p == ',') {
+      *p = '\0';
+      campos[n++] = p + 1;
+    }
+  }
+  // El identificador es el talker (GP, GN, GL...) seguido del tipo de frase
+  bool ok = false;
+  if (strlen(campos[0]) == 5 && strcmp(&campos[0][2], "RMC") == 0) ok = interpretarRMC(campos, n);
+  else if (strlen(campos[0]) == 5 && strcmp(&campos[0][2], "GGA") == 0) ok = interpretarGGA(campos, n);
+  if (ok) frases++;
+  else descartadas++;
+  return ok;
+}
+
+
+bool InterpreteNMEA::interpretarHora(const char *campo) {
+  if (strlen(campo) < 6) return false;
+  actual.hora = dosDigitos(campo);
+  actual.minuto = dosDigitos(&campo[2]);
+  actual.segundo = dosDigitos(&campo[4]);
+  actual.centesimas = (campo[6] == '.' && campo[7]) ? (uint8_t)((campo[7] - '0') * 10 + (campo[8] ? campo[8] - '0' : 0)) : 0;
+  return true;
+}
+
+
+bool InterpreteNMEA::interpretarRMC(char **campos, uint8_t n) {
+  // $xxRMC,hhmmss.ss,A,llll.ll,a,yyyyy.yy,a,velocidad,rumbo,ddmmyy,...
+  if (n < 10) return false;
+  actual.horaValida = interpretarHora(campos[1]);
+  actual.posicionValida = campos[2][0] == 'A' && coordenada(campos[3], campos[4], actual.latitud) &&
+                          coordenada(campos[5], campos[6], actual.longitud);
+  actual.fechaValida = strlen(campos[9]) == 6;
+  if (actual.fechaValida) {
+    actual.dia = dosDigitos(campos[9]);
+    actual.mes = dosDigitos(&campos[9][2]);
+    uint8_t yy = dosDigitos(&campos[9][4]);
+    actual.anio = (yy >= 80 ? 1900 : 2000) + yy;  // RMC solo trae dos digitos del año
+  }
+  return true;
+}
+
+
+bool InterpreteNMEA::interpretarGGA(char **campos, uint8_t n) {
+  // $xxGGA,hhmmss.ss,llll.ll,a,yyyyy.yy,a,calidad,satelites,hdop,altitud,M,...
+  if (n < 10) return false;
+  actual.horaValida = interpretarHora(campos[1]);
+  actual.calidad = (uint8_t)(campos[6][0] ? campos[6][0] - '0' : 0);
+  actual.satelites = (uint8_t)strtoul(campos[7], NULL, 10);
+  if (actual.calidad > 0) {
+    actual.posicionValida = coordenada(campos[2], campos[3], actual.latitud) && coordenada(campos[4], campos[5], actual.longitud);
+    // Altitud en centimetros sin punto flotante
+    const char *p = campos[9];
+    bool negativa = (*p == '-');
+    if (negativa) p++;
+    int32_t cm = 0;
+    for (; *p >= '0' && *p <= '9'; p++) cm = cm * 10 + (*p - '0');
+    cm *= 100;
+    if (*p == '.') {
+      if (p[1] >= '0' && p[1] <= '9') cm += (p[1] - '0') * 10;
+      if (p[1] && p[2] >= '0' && p[2] <= '9') cm += p[2] - '0';
+    }
+    actual.altitudCm = negativa ? -cm : cm;
+  } else {
+    actual.posicionValida = false;
+  }
+  return true;
+}
+
+
+/**
+ * Funcion que atiende el evento de recepcion del UART: solo despierta la tarea del GPS
+ */
+static void alRecibirGPS() {
+  halNotificar(tareaGPS);
+}
+
+
+/**
+ * Manejador de la tarea del GPS: interpreta todo lo que haya llegado y publica los registros nuevos
+ */
+static void atenderGPS() {
+  uint8_t recibidos[64];
+  size_t n;
+  while ((n = halUartLeer(recibidos, sizeof(recibidos))) > 0) {
+    uint64_t ahora = halMicros();
+    bytesGPS += n;
+    capturarNMEA(ahora, recibidos, n);
+    for (size_t i = 0; i < n; i++) {
+      if (interprete.procesar((char)recibidos[i], ahora)) {
+        registroPublicado.escribir(interprete.registro());
+        publicacionesGPS++;
+        disciplinarBaseTiempo(interprete.registro());  // Cada segundo nuevo corrige la relacion de la base de tiempo con UTC
+      }
+    }
+  }
+}
+
+
+bool iniciarGPS(uint8_t prioridad, uint8_t nucleo) {
+  tareaGPS = halTareaEventos(atenderGPS, GPS_ESPERA_MAX_US, "GPS", prioridad, nucleo);
+  if (tareaGPS < 0) return false;
+  halUartAlRecibir(alRecibirGPS);
+  return true;
+}
+
+
+uint32_t leerGPS(RegistroGPS &registro) {
+  return registroPublicado.leer(registro);
+}
+
+
+EstadisticasGPS estadisticasGPS() {
+  EstadisticasGPS e;
+  e.bytes = bytesGPS;
+  e.frases = interprete.frases;
+  e.erroresChecksum = interprete.erroresChecksum;
+  e.descartadas = interprete.descartadas;
+  e.desbordesRx = halUartDesbordes();
+  e.publicaciones = publicacionesGPS;
+  return e;
+}
@@ -0,0 +1,129 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBGPS_H
+#define LIBGPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Recepcion del GPS sin memoria dinamica. Una tarea despierta con los eventos de recepcion del
+// UART, pasa los bytes por un interprete de frases NMEA (RMC y GGA) que trabaja sobre un buffer
+// fijo, y publica cada fix en un registro de tamaño fijo a traves de un seqlock, asi que quien lo
+// lea nunca bloquea a la tarea del GPS ni espera por ella.
+
+#define NMEA_TAM_MAX_FRASE 82       // Longitud maxima de una frase NMEA 0183 incluyendo $ y el fin de linea
+#define NMEA_MAX_CAMPOS 20
+#define GPS_ESPERA_MAX_US 1000000   // La tarea revisa el UART al menos una vez por segundo
+
+/**
+ * Registro de un fix del GPS
+ */
+struct RegistroGPS {
+  uint64_t marcaTiempo;    // Instante (halMicros) en que termino de llegar la frase
+  int32_t latitud;         // Microgrados, positiva al norte
+  int32_t longitud;        // Microgrados, positiva al este
+  int32_t altitudCm;       // Altitud sobre el nivel del mar en centimetros (GGA)
+  uint16_t anio;
+  uint8_t mes;
+  uint8_t dia;
+  uint8_t hora;            // UTC
+  uint8_t minuto;
+  uint8_t segundo;
+  uint8_t centesimas;
+  uint8_t satelites;       // Satelites usados (GGA)
+  uint8_t calidad;         // Calidad del fix de GGA: 0 sin fix, 1 GPS, 2 DGPS...
+  bool posicionValida;
+  bool fechaValida;
+  bool horaValida;
+};
+
+/**
+ * Interprete de frases NMEA que no usa memoria dinamica: recibe los bytes uno por uno
+ */
+class InterpreteNMEA {
+public:
+  InterpreteNMEA();
+
+  /**
+   * Funcion que procesa un byte recibido del GPS
+   * @param c Byte recibido
+   * @param ahoraUs Instante de recepcion
+   * @return true si con este byte se completo una frase que actualizo el registro
+   */
+  bool procesar(char c, uint64_t ahoraUs);
+
+  /**
+   * Ultimo registro armado con las frases recibidas
+   */
+  const RegistroGPS &registro() const { return actual; }
+
+  uint32_t frases;            // Frases RMC o GGA interpretadas
+  uint32_t erroresChecksum;   // Frases con checksum incorrecto
+  uint32_t descartadas;       // Frases de otros tipos, mal formadas o demasiado largas
+
+private:
+  bool interpretar();
+  bool interpretarRMC(char **campos, uint8_t n);
+  bool interpretarGGA(char **campos, uint8_t n);
+  bool interpretarHora(const char *campo);
+
+  char frase[NMEA_TAM_MAX_FRASE + 1];
+  uint8_t largo;
+  bool enFrase;
+  RegistroGPS actual;
+};
+
+/**
+ * Contadores del GPS
+ */
+struct EstadisticasGPS {
+  uint32_t bytes;             // Bytes recibidos del UART
+  uint32_t frases;            // Frases RMC o GGA interpretadas
+  uint32_t erroresChecksum;   // Frases con checksum incorrecto
+  uint32_t descartadas;       // Frases de otros tipos, mal formadas o demasiado largas
+  uint32_t desbordesRx;       // Desbordes del buffer de recepcion del UART
+  uint32_t publicaciones;     // Registros publicados
+};
+
+/**
+ * Funcion que crea la tarea del GPS, se usa en el setup() despues de iniciar el UART
+ * @param prioridad Prioridad de la tarea del GPS
+ * @param nucleo Nucleo al que se fija la tarea
+ * @return true si la tarea quedo funcionando
+ */
+bool iniciarGPS(uint8_t prioridad, uint8_t nucleo);
+
+/**
+ * Funcion que copia el ultimo registro publicado sin bloquear
+ * @param registro Donde se copia el registro
+ * @return Numero de registros publicados hasta ese (0 si aun no llega ninguno)
+ */
+uint32_t leerGPS(RegistroGPS &registro);
+
+/**
+ * Funcion que da los contadores del GPS
+ */
+EstadisticasGPS estadisticasGPS();
+
+#endif
@@ -0,0 +1,337 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBHAL_H
+#define LIBHAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libhalsens.h"
+
+#ifndef ARDUINO
+#define IRAM_ATTR  // En el computador no hay IRAM: las ISR son funciones comunes
+#endif
+
+// Capa de abstraccion del hardware (HAL). El codigo del camino de adquisicion -> filtro ->
+// transmision solo usa estas funciones, que en el ESP32 implementa libhalesp32.cpp (Arduino,
+// FreeRTOS, LoRa, Wire) y en el computador implementa libhalsim.cpp con temporizadores en
+// tiempo virtual y sensores simulados. El ADC se accede por registros con libhalsens.h.
+
+typedef void (*ManejadorPeriodico)(void);
+
+#define HAL_CUENTAS_ALARMA_POR_SEGUNDO 40000000 // Resolucion de la alarma: el reloj APB de 80 MHz dividido entre 2
+
+/**
+ * Funcion que da el tiempo desde el arranque en microsegundos (virtual en el simulador)
+ */
+uint64_t halMicros();
+
+/**
+ * Funcion que ejecuta un manejador periodicamente en una tarea: en el ESP32 un timer de hardware
+ * despierta la tarea desde su ISR en cada periodo; en el simulador el manejador se ejecuta en
+ * orden de tiempo virtual
+ * @param timer Numero del timer de hardware (0 a 3)
+ * @param periodoUs Periodo en microsegundos
+ * @param manejador Funcion a ejecutar en cada periodo
+ * @param nombre Nombre de la tarea
+ * @param prioridad Prioridad de la tarea
+ * @param nucleo Nucleo al que se fija la tarea
+ * @return true si la tarea quedo funcionando
+ */
+bool halTareaPeriodica(uint8_t timer, uint32_t periodoUs, ManejadorPeriodico manejador, const char *nombre,
+                       uint8_t prioridad, uint8_t nucleo);
+
+/**
+ * Funcion que prepara un timer de hardware como alarma de una sola vez. Su contador arranca en
+ * cero y corre libre a HAL_CUENTAS_ALARMA_POR_SEGUNDO; la alarma se programa en valores absolutos
+ * de ese contador, asi que no acumula error aunque el siguiente instante se calcule en la ISR
+ * @param timer Numero del timer de hardware (0 a 3)
+ * @param isr Funcion que se ejecuta en la interrupcion de la alarma
+ * @return true si el timer quedo funcionando
+ */
+bool halAlarmaIniciar(uint8_t timer, ManejadorPeriodico isr);
+
+/**
+ * Funcion que programa la siguiente interrupcion de la alarma, se puede llamar desde su ISR. En el
+ * ESP32 la ISR y estas dos funciones estan en IRAM: la alarma sigue atendiendose mientras la
+ * cache esta apagada por una escritura en la flash
+ * @param cuenta Valor absoluto del contador en el que se dispara
+ */
+void halAlarmaProgramar(uint64_t cuenta);
+
+/**
+ * Funcion que da el valor actual del contador de la alarma, se puede llamar desde su ISR
+ */
+uint64_t halAlarmaCuenta();
+
+/**
+ * Funcion que crea una tarea que se ejecuta cuando se le notifica un evento con halNotificar()
+ * @param manejador Funcion a ejecutar en cada notificacion
+ * @param esperaMaxUs Si no llega ninguna notificacion en este tiempo el manejador se ejecuta de todas formas
+ * @param nombre Nombre de la tarea
+ * @param prioridad Prioridad de la tarea
+ * @param nucleo Nucleo al que se fija la tarea
+ * @return Identificador de la tarea, o -1 si no se pudo crear
+ */
+int halTareaEventos(ManejadorPeriodico manejador, uint32_t esperaMaxUs, const char *nombre, uint8_t prioridad,
+                    uint8_t nucleo);
+
+/**
+ * Funcion que despierta una tarea creada con halTareaEventos(). Se puede llamar desde una interrupcion
+ * @param tarea Identificador devuelto por halTareaEventos()
+ */
+void halNotificar(int tarea);
+
+/**
+ * Funcion que cambia la espera maxima de una tarea creada con halTareaEventos()
+ * @param tarea Identificador devuelto por halTareaEventos()
+ * @param esperaMaxUs Nueva espera maxima en microsegundos
+ */
+void halEsperaTarea(int tarea, uint32_t esperaMaxUs);
+
+/**
+ * Funcion que lee el valor crudo de un touchpad
+ * @param pin Pin del touchpad
+ */
+uint16_t halTouchLeer(uint8_t pin);
+
+/**
+ * Funcion que programa la interrupcion de un touchpad: el hardware mide el pad por su cuenta y
+ * llama a isr cuando la lectura baja del umbral. Se puede llamar otra vez para cambiar el umbral
+ * @param pin Pin del touchpad
+ * @param umbral Lectura por debajo de la cual se genera la interrupcion
+ * @param isr Funcion que se ejecuta en la interrupcion, solo debe notificar a una tarea
+ */
+void halTouchInterrupcion(uint8_t pin, uint16_t umbral, ManejadorPeriodico isr);
+
+/**
+ * Funcion que programa una interrupcion por flanco de subida en un pin digital (por ejemplo el PPS del GPS)
+ * @param pin Pin de entrada
+ * @param isr Funcion que se ejecuta en la interrupcion, debe ser corta
+ */
+void halInterrupcionPin(uint8_t pin, ManejadorPeriodico isr);
+
+/**
+ * Funcion que escribe bytes a un dispositivo I2C
+ * @param direccion Direccion de 7 bits del dispositivo
+ * @param datos Bytes a escribir (normalmente el registro seguido de los valores)
+ * @param len Numero de bytes
+ * @return true si el dispositivo respondio
+ */
+bool halI2cEscribir(uint8_t direccion, const uint8_t *datos, size_t len);
+
+/**
+ * Funcion que lee bytes de un dispositivo I2C a partir de un registro
+ * @param direccion Direccion de 7 bits del dispositivo
+ * @param registro Registro inicial
+ * @param datos Donde se escriben los bytes leidos
+ * @param len Numero de bytes a leer
+ * @return true si se leyeron todos los bytes
+ */
+bool halI2cLeer(uint8_t direccion, uint8_t registro, uint8_t *datos, size_t len);
+
+/**
+ * Funcion que lee los bytes recibidos por el puerto serial del GPS sin bloquear
+ * @param datos Donde se escriben los bytes
+ * @param max Maximo de bytes a leer
+ * @return Numero de bytes leidos
+ */
+size_t halUartLeer(uint8_t *datos, size_t max);
+
+/**
+ * Funcion que fija el manejador del evento de recepcion del puerto serial del GPS
+ * @param alRecibir Funcion que se ejecuta cuando llegan bytes, solo debe notificar a una tarea
+ */
+void halUartAlRecibir(ManejadorPeriodico alRecibir);
+
+/**
+ * Funcion que da el numero de desbordes del buffer de recepcion del puerto serial del GPS
+ */
+uint32_t halUartDesbordes();
+
+/**
+ * Funcion que inicializa el radio LoRa
+ * @param rst Pin de reset del RA-02
+ * @param nss Pin de seleccion de esclavo del RA-02
+ * @param irq Pin de DIO0 del RA-02 (solo se le pasa a la libreria; el fin de transmision se sondea)
+ * @param frecuencia Frecuencia de operacion en Hz
+ * @return true si el radio respondio
+ */
+bool halRadioIniciar(int rst, int nss, int irq, long frecuencia);
+
+/**
+ * Funcion que inicia el envio de un paquete por el radio sin esperar a que termine
+ * @param datos Carga util del paquete
+ * @param len Numero de bytes (maximo 255)
+ * @return true si el paquete se empezo a enviar, false si el radio aun estaba transmitiendo
+ */
+bool halRadioEnviar(const uint8_t *datos, size_t len);
+
+/**
+ * Funcion que sondea si el radio sigue transmitiendo el ultimo paquete (modo TX o TX done sin
+ * atender, que se borra). En el ESP32 lee los registros del SX1278 por SPI, asi que solo se llama
+ * desde una tarea, nunca desde una interrupcion; no necesita DIO0 conectado
+ * @return true si el paquete aun esta en el aire o el radio no responde
+ */
+bool halRadioTransmitiendo();
+
+/**
+ * Funcion que escribe bytes en la salida de telemetria (el puerto serial en el ESP32)
+ */
+void halSalida(const uint8_t *datos, size_t len);
+
+#define HAL_FLASH_TAM_SECTOR 4096  // Unidad de borrado de la flash SPI
+
+/**
+ * Funcion que abre la particion de datos de la bitacora ("bitacora" en particiones.csv). La
+ * flash es NOR: borrar un sector lo deja en 0xFF y escribir solo puede pasar bits de 1 a 0
+ * @return Tamaño de la particion en bytes, 0 si no existe
+ */
+size_t halFlashAbrir();
+
+/**
+ * Funcion que lee bytes de la particion
+ * @param direccion Desplazamiento dentro de la particion
+ */
+bool halFlashLeer(uint32_t direccion, void *destino, size_t len);
+
+/**
+ * Funcion que escribe bytes en la particion (solo sobre bytes borrados o para bajar bits)
+ * @param direccion Desplazamiento dentro de la particion
+ */
+bool halFlashEscribir(uint32_t direccion, const void *datos, size_t len);
+
+/**
+ * Funcion que borra un sector completo de la particion
+ * @param sector Numero de sector (direccion / HAL_FLASH_TAM_SECTOR)
+ */
+bool halFlashBorrar(uint32_t sector);
+
+#ifndef ARDUINO
+// Funciones propias del simulador
+
+/**
+ * Funcion que ejecuta las tareas periodicas hasta que avance el tiempo virtual indicado
+ * @param duracionUs Tiempo virtual a simular en microsegundos
+ */
+void halSimCorrer(uint64_t duracionUs);
+
+/**
+ * Funcion que fija la señal que entrega cada canal del ADC1 en funcion del tiempo virtual
+ */
+void halSimFuenteAdc(uint16_t (*fuente)(uint8_t canal, uint64_t tiempoUs));
+
+/**
+ * Funcion que fija la señal que entrega cada touchpad en funcion del tiempo virtual
+ */
+void halSimFuenteTouch(uint16_t (*fuente)(uint8_t pin, uint64_t tiempoUs));
+
+/**
+ * Funcion que genera un flanco de subida en un pin: ejecuta la interrupcion programada con halInterrupcionPin()
+ */
+void halSimFlancoPin(uint8_t pin);
+
+/**
+ * Funcion que conecta un dispositivo I2C simulado
+ * @param direccion Direccion de 7 bits del dispositivo
+ * @param escribir Funcion que recibe las escrituras al dispositivo
+ * @param leer Funcion que atiende las lecturas a partir de un registro
+ */
+void halSimDispositivoI2c(uint8_t direccion, bool (*escribir)(const uint8_t *datos, size_t len),
+                          bool (*leer)(uint8_t registro, uint8_t *datos, size_t len));
+
+/**
+ * Funcion que pone bytes en el buffer de recepcion del puerto serial del GPS
+ * @return Numero de bytes aceptados (el resto se pierde como en un desborde del UART)
+ */
+size_t halSimUartEscribir(const uint8_t *datos, size_t len);
+
+/**
+ * Funcion que fija el tiempo en el aire de cada paquete del radio: fijoUs + porByteUs * len
+ */
+void halSimTiempoAire(uint32_t fijoUs, uint32_t porByteUs);
+
+/**
+ * Funcion que hace fallar los siguientes intentos de inicializar el radio (radio desconectado)
+ * @param intentos Numero de llamadas a halRadioIniciar() que devolveran false
+ */
+void halSimFallasRadio(uint32_t intentos);
+
+/**
+ * Funcion que fija el receptor de los paquetes enviados por el radio (por ejemplo para decodificarlos)
+ */
+void halSimRadioReceptor(void (*receptor)(const uint8_t *datos, size_t len));
+
+/**
+ * Funcion que fija a donde van los bytes escritos con halSalida()
+ */
+void halSimSalida(void (*salida)(const uint8_t *datos, size_t len));
+
+/**
+ * Estadisticas del radio simulado
+ */
+struct EstadisticasRadioSim {
+  uint32_t paquetes;    // Paquetes enviados
+  uint32_t rechazados;  // Envios rechazados porque el radio estaba ocupado
+  uint64_t bytes;       // Bytes de carga util enviados
+  uint64_t tiempoAireUs; // Tiempo total en el aire
+};
+EstadisticasRadioSim halSimEstadisticasRadio();
+
+/**
+ * Funcion que deja el radio simulado trabado en un intervalo del tiempo virtual: no termina de
+ * enviar ni se deja iniciar, como si el modulo se hubiera caido
+ */
+void halSimCaidaRadio(uint64_t desdeUs, uint64_t hastaUs);
+
+/**
+ * Funcion que respalda la flash simulada con un archivo, de modo que su contenido sobrevive entre
+ * corridas. Si el archivo no existe se crea borrado (0xFF)
+ * @param archivo Ruta del archivo, o NULL para un archivo temporal que se borra al terminar
+ * @param tamano Tamaño de la particion en bytes (multiplo de HAL_FLASH_TAM_SECTOR)
+ * @return true si el archivo se pudo abrir
+ */
+bool halSimFlash(const char *archivo, size_t tamano);
+
+/**
+ * Funcion que hace fallar las siguientes escrituras de la flash simulada
+ * @param escrituras Numero de escrituras que fallan
+ * @param parciales Si es true, cada escritura que falla alcanza a programar la primera mitad de sus bytes
+ */
+void halSimFallasFlash(uint32_t escrituras, bool parciales);
+
+/**
+ * Estadisticas de la flash simulada
+ */
+struct EstadisticasFlashSim {
+  uint32_t escrituras;        // Llamadas a halFlashEscribir()
+  uint64_t bytesEscritos;
+  uint32_t borrados;          // Sectores borrados
+  uint32_t borradosMinimo;    // Menor y mayor numero de borrados de un sector (desgaste)
+  uint32_t borradosMaximo;
+  uint32_t bitsInvalidos;     // Escrituras que intentaron subir un bit de 0 a 1 sin borrar
+};
+EstadisticasFlashSim halSimEstadisticasFlash();
+#endif
+
+#endif
@@ -0,0 +1,386 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <Arduino.h>
+#include <Wire.h>
+#include <SPI.h>
+#include <LoRa.h>
+#include <esp_partition.h>
+#include <driver/timer.h>
+#include <driver/gpio.h>
+#include "libhal.h"
+#include "libinstrumentacion.h"
+
+// Implementacion de la HAL para el ESP32 con Arduino y FreeRTOS
+
+#define HAL_NUM_TIMERS 4
+#define HAL_MAX_TAREAS_EVENTOS 8
+#define SX1278_REG_OP_MODE 0x01    // Registros del radio para sondear el fin de transmision
+#define SX1278_REG_IRQ_FLAGS 0x12
+#define SX1278_MODO_TX 0x03
+#define SX1278_IRQ_TX_DONE 0x08
+
+TaskHandle_t tareasHal[HAL_NUM_TIMERS];
+ManejadorPeriodico manejadoresHal[HAL_NUM_TIMERS];
+#ifdef INSTRUMENTACION
+MedidorTarea *medidoresHal[HAL_NUM_TIMERS];
+#endif
+
+struct TareaEventosHal {
+  ManejadorPeriodico manejador;
+  volatile TickType_t espera;
+  TaskHandle_t tarea;
+#ifdef INSTRUMENTACION
+  MedidorTarea *medidor;
+#endif
+};
+TareaEventosHal tareasEventosHal[HAL_MAX_TAREAS_EVENTOS];
+uint8_t numTareasEventosHal = 0;
+ManejadorPeriodico manejadorAlarmaHal = NULL;
+timer_group_t grupoAlarmaHal;
+timer_idx_t indiceAlarmaHal;
+const esp_partition_t *particionHal = NULL;
+int pinNssRadio = -1;
+
+
+uint64_t IRAM_ATTR halMicros() {  // esp_timer_get_time() esta en IRAM: se puede marcar el tiempo en cualquier ISR
+  return (uint64_t)esp_timer_get_time();
+}
+
+
+/**
+ * Funcion que inicia un timer de hardware con el driver del IDF y su interrupcion en IRAM. Las
+ * funciones de timer de Arduino no estan en IRAM y registran la interrupcion sin ESP_INTR_FLAG_IRAM,
+ * asi que la interrupcion se perderia mientras la cache esta apagada (escrituras en la flash)
+ * @param timer Numero del timer (0 a 3: grupo timer / 2, indice timer % 2)
+ * @param divisor Divisor del reloj APB de 80 MHz
+ * @param periodo Cuentas entre alarmas con recarga, o 0 para una alarma que se programa despues
+ * @param isr Funcion de la interrupcion (en IRAM)
+ * @return true si el timer quedo corriendo
+ */
+static bool iniciarTimerHal(uint8_t timer, uint32_t divisor, uint64_t periodo, timer_isr_t isr) {
+  timer_group_t grupo = (timer_group_t)(timer / 2);
+  timer_idx_t indice = (timer_idx_t)(timer % 2);
+  timer_config_t config = {};
+  config.alarm_en = periodo ? TIMER_ALARM_EN : TIMER_ALARM_DIS;
+  config.counter_en = TIMER_PAUSE;
+  config.intr_type = TIMER_INTR_LEVEL;
+  config.counter_dir = TIMER_COUNT_UP;
+  config.auto_reload = periodo ? TIMER_AUTORELOAD_EN : TIMER_AUTORELOAD_DIS;  // Sin recarga el contador corre libre
+  config.divider = divisor;
+  if (timer_init(grupo, indice, &config) != ESP_OK) return false;
+  timer_set_counter_value(grupo, indice, 0);
+  if (periodo) timer_set_alarm_value(grupo, indice, periodo);
+  return timer_isr_callback_add(grupo, indice, isr, NULL, ESP_INTR_FLAG_IRAM) == ESP_OK && timer_start(grupo, indice) == ESP_OK;
+}
+
+
+/**
+ * Funcion manejadora de la interrupcion de cada timer: solo despierta la tarea que le corresponde
+ * @return true si desperto una tarea de mas prioridad (el driver cede el procesador al salir)
+ */
+template <uint8_t TIMER>
+static bool IRAM_ATTR isrTimerHal(void *) {
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;  //Bandera indicadora de que la tarea de mas prioridad no esta en ejecucion.
+#ifdef INSTRUMENTACION
+  if (medidoresHal[TIMER]) medidoresHal[TIMER]->cicloNotificacion = ciclosInstrumentacion();
+#endif
+  vTaskNotifyGiveFromISR(tareasHal[TIMER], &xHigherPriorityTaskWoken);
+  return xHigherPriorityTaskWoken == pdTRUE;
+}
+
+static const timer_isr_t isrsHal[HAL_NUM_TIMERS] = {isrTimerHal<0>, isrTimerHal<1>, isrTimerHal<2>, isrTimerHal<3>};
+
+
+/**
+ * Funcion de la tarea que atiende un timer: ejecuta el manejador una vez por cada interrupcion
+ */
+void tareaPeriodicaHal(void *param) {
+  uint8_t timer = (uint8_t)(uintptr_t)param;
+  while (true) {
+    // Duerme hasta que la ISR nos de algo para hacer, o por 1 segundo. Si devuelve mas de 1 la tarea va atrasada
+    uint32_t pendientes = ulTaskNotifyTake(pdFALSE, pdMS_TO_TICKS(1000));
+#ifdef INSTRUMENTACION
+    MedidorTarea *m = medidoresHal[timer];
+    uint32_t inicio = m ? m->medirInicio(pendientes, true) : 0;
+#else
+    (void)pendientes;
+#endif
+    manejadoresHal[timer]();
+#ifdef INSTRUMENTACION
+    if (m) m->medirFin(inicio);
+#endif
+  }
+}
+
+
+bool halTareaPeriodica(uint8_t timer, uint32_t periodoUs, ManejadorPeriodico manejador, const char *nombre,
+                       uint8_t prioridad, uint8_t nucleo) {
+  if (timer >= HAL_NUM_TIMERS || manejadoresHal[timer] != NULL) return false;
+  manejadoresHal[timer] = manejador;
+#ifdef INSTRUMENTACION
+  medidoresHal[timer] = registrarMedidor(nombre, periodoUs);
+#endif
+  if (xTaskCreatePinnedToCore(tareaPeriodicaHal, nombre, 8192, (void *)(uintptr_t)timer, prioridad, &tareasHal[timer], nucleo) != pdPASS)
+    return false;
+  return iniciarTimerHal(timer, 80, periodoUs, isrsHal[timer]);  // Divisor entre 80: 1 cuenta = 1us, recarga en cada alarma
+}
+
+
+/**
+ * Funcion manejadora de la interrupcion de la alarma, registrada con ESP_INTR_FLAG_IRAM: el driver
+ * ya limpio la interrupcion y la alarma quedo deshabilitada hasta que se vuelva a programar
+ */
+static bool IRAM_ATTR isrAlarmaHal(void *) {
+  manejadorAlarmaHal();
+  return false;  // halNotificar() ya pide el cambio de tarea si desperto una de mas prioridad
+}
+
+
+bool halAlarmaIniciar(uint8_t timer, ManejadorPeriodico isr) {
+  if (timer >= HAL_NUM_TIMERS || manejadoresHal[timer] != NULL || manejadorAlarmaHal != NULL) return false;
+  // Las funciones *_in_isr del driver del IDF estan en IRAM y las de timer de Arduino no
+  grupoAlarmaHal = (timer_group_t)(timer / 2);
+  indiceAlarmaHal = (timer_idx_t)(timer % 2);
+  manejadorAlarmaHal = isr;
+  // Sin recarga: el contador sigue corriendo a 40 MHz y la alarma es absoluta
+  if (!iniciarTimerHal(timer, 80000000 / HAL_CUENTAS_ALARMA_POR_SEGUNDO, 0, isrAlarmaHal)) {
+    manejadorAlarmaHal = NULL;
+    return false;
+  }
+  return true;
+}
+
+
+void IRAM_ATTR halAlarmaProgramar(uint64_t cuenta) {
+  timer_group_set_alarm_value_in_isr(grupoAlarmaHal, indiceAlarmaHal, cuenta);
+  timer_group_enable_alarm_in_isr(grupoAlarmaHal, indiceAlarmaHal);
+}
+
+
+uint64_t IRAM_ATTR halAlarmaCuenta() {
+  return timer_group_get_counter_value_in_isr(grupoAlarmaHal, indiceAlarmaHal);
+}
+
+
+/**
+ * Funcion de la tarea que atiende eventos: ejecuta el manejador en cada notificacion o al agotarse la espera
+ */
+void tareaEventosHal(void *param) {
+  TareaEventosHal *t = (TareaEventosHal *)param;
+  while (true) {
+    uint32_t notificaciones = ulTaskNotifyTake(pdTRUE, t->espera);  // Varias notificaciones seguidas se atienden con una sola ejecucion
+#ifdef INSTRUMENTACION
+    uint32_t inicio = t->medidor ? t->medidor->medirInicio(notificaciones, false) : 0;
+#else
+    (void)notificaciones;
+#endif
+    t->manejador();
+#ifdef INSTRUMENTACION
+    if (t->medidor) t->medidor->medirFin(inicio);
+#endif
+  }
+}
+
+
+int halTareaEventos(ManejadorPeriodico manejador, uint32_t esperaMaxUs, const char *nombre, uint8_t prioridad,
+                    uint8_t nucleo) {
+  if (numTareasEventosHal >= HAL_MAX_TAREAS_EVENTOS) return -1;
+  TareaEventosHal *t = &tareasEventosHal[numTareasEventosHal];
+  t->manejador = manejador;
+  t->espera = pdMS_TO_TICKS((esperaMaxUs + 999) / 1000);
+  if (t->espera == 0) t->espera = 1;
+#ifdef INSTRUMENTACION
+  t->medidor = registrarMedidor(nombre, 0);
+#endif
+  if (xTaskCreatePinnedToCore(tareaEventosHal, nombre, 8192, t, prioridad, &t->tarea, nucleo) != pdPASS) return -1;
+  return numTareasEventosHal++;
+}
+
+
+void IRAM_ATTR halNotificar(int tarea) {
+  if (tarea < 0 || tarea >= numTareasEventosHal) return;
+#ifdef INSTRUMENTACION
+  if (tareasEventosHal[tarea].medidor) tareasEventosHal[tarea].medidor->cicloNotificacion = ciclosInstrumentacion();
+#endif
+  if (xPortInIsrContext()) {
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(tareasEventosHal[tarea].tarea, &xHigherPriorityTaskWoken);
+    if (xHigherPriorityTaskWoken) {
+      portYIELD_FROM_ISR();
+    }
+  } else {
+    xTaskNotifyGive(tareasEventosHal[tarea].tarea);
+  }
+}
+
+
+void halEsperaTarea(int tarea, uint32_t esperaMaxUs) {
+  if (tarea < 0 || tarea >= numTareasEventosHal) return;
+  TickType_t espera = pdMS_TO_TICKS((esperaMaxUs + 999) / 1000);
+  tareasEventosHal[tarea].espera = (espera == 0) ? 1 : espera;  // Se usa desde la siguiente espera de la tarea
+}
+
+
+uint16_t halTouchLeer(uint8_t pin) {
+  return touchRead(pin);
+}
+
+
+void halTouchInterrupcion(uint8_t pin, uint16_t umbral, ManejadorPeriodico isr) {
+  // Volver a llamarla solo actualiza el umbral del pad. La interrupcion RTC del touch no es de IRAM:
+  // durante un borrado de la flash se atiende al volver la cache (el gesto se marca en la tarea)
+  touchAttachInterrupt(pin, isr, umbral);
+}
+
+
+/**
+ * Funcion que atiende la interrupcion de un pin desde el servicio de GPIO del IDF
+ */
+static void IRAM_ATTR isrPinHal(void *arg) {
+  ((ManejadorPeriodico)arg)();
+}
+
+
+void halInterrupcionPin(uint8_t pin, ManejadorPeriodico isr) {
+  pinMode(pin, INPUT);
+  // Servicio de GPIO del IDF en IRAM en vez de attachInterrupt(): el flanco se marca a tiempo aun
+  // durante un borrado de la flash (ESP_ERR_INVALID_STATE: ya estaba instalado)
+  esp_err_t instalado = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+  if (instalado != ESP_OK && instalado != ESP_ERR_INVALID_STATE) return;
+  gpio_set_intr_type((gpio_num_t)pin, GPIO_INTR_POSEDGE);
+  gpio_isr_handler_add((gpio_num_t)pin, isrPinHal, (void *)isr);
+}
+
+
+bool halI2cEscribir(uint8_t direccion, const uint8_t *datos, size_t len) {
+  Wire.beginTransmission(direccion);
+  Wire.write(datos, len);
+  return Wire.endTransmission() == 0;
+}
+
+
+bool halI2cLeer(uint8_t direccion, uint8_t registro, uint8_t *datos, size_t len) {
+  Wire.beginTransmission(direccion);
+  Wire.write(registro);
+  if (Wire.endTransmission(false) != 0) return false;  // Inicio repetido para no soltar el bus
+  if (Wire.requestFrom(direccion, (uint8_t)len) != len) return false;
+  for (size_t i = 0; i < len; i++) datos[i] = Wire.read();
+  return true;
+}
+
+
+size_t halUartLeer(uint8_t *datos, size_t max) {
+  size_t n = 0;
+  while (n < max && Serial2.available() > 0) datos[n++] = Serial2.read();
+  return n;
+}
+
+
+static volatile uint32_t uartDesbordesHal = 0;
+
+void halUartAlRecibir(ManejadorPeriodico alRecibir) {
+  Serial2.onReceive(alRecibir, false);  // Evento cada vez que llega un bloque del FIFO del UART o se agota el tiempo entre bytes
+  Serial2.onReceiveError([](hardwareSerial_error_t error) {
+    if (error == UART_BUFFER_FULL_ERROR || error == UART_FIFO_OVF_ERROR) uartDesbordesHal++;
+  });
+}
+
+
+uint32_t halUartDesbordes() {
+  return uartDesbordesHal;
+}
+
+
+bool halRadioIniciar(int rst, int nss, int irq, long frecuencia) {
+  pinMode(rst, OUTPUT);    //Configuramos el pin de reset como salida
+  pinMode(nss, OUTPUT);    //Configuramos el pin de seleccion de esclavo como salida
+  digitalWrite(rst, HIGH); //Ponemos reset=1 para que se ejecute
+  digitalWrite(nss, LOW);  //Ponemos nss=0 para seleccionar el esclavo (el RA-02)
+  pinNssRadio = nss;
+  LoRa.setPins(nss, rst, irq);
+  return LoRa.begin(frecuencia);
+}
+
+
+bool halRadioEnviar(const uint8_t *datos, size_t len) {
+  if (!LoRa.beginPacket()) return false;  // beginPacket() falla si el radio sigue transmitiendo
+  LoRa.write(datos, len);
+  LoRa.endPacket(true);                   // Modo asincrono: no esperamos a que el paquete termine de salir
+  return true;
+}
+
+
+/**
+ * Funcion que transfiere un registro del SX1278 por SPI con la misma configuracion que la libreria LoRa
+ * @param direccion Direccion del registro (con el bit 7 en 1 para escribir)
+ * @param valor Valor a escribir (0 para leer)
+ * @return Valor leido
+ */
+static uint8_t registroRadio(uint8_t direccion, uint8_t valor) {
+  SPI.beginTransaction(SPISettings(LORA_DEFAULT_SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+  digitalWrite(pinNssRadio, LOW);
+  SPI.transfer(direccion);
+  uint8_t leido = SPI.transfer(valor);
+  digitalWrite(pinNssRadio, HIGH);
+  SPI.endTransaction();
+  return leido;
+}
+
+
+bool halRadioTransmitiendo() {
+  // No se usa LoRa.onTxDone(): la libreria haria SPI dentro de la ISR de DIO0, y en el Weareable EEG v1.0 DIO0 no esta conectado
+  if ((registroRadio(SX1278_REG_OP_MODE, 0) & 0x07) == SX1278_MODO_TX) return true;
+  if (registroRadio(SX1278_REG_IRQ_FLAGS, 0) & SX1278_IRQ_TX_DONE) {
+    registroRadio(SX1278_REG_IRQ_FLAGS | 0x80, SX1278_IRQ_TX_DONE);  // Se borra escribiendo un 1
+  }
+  return false;
+}
+
+
+void halSalida(const uint8_t *datos, size_t len) {
+  Serial.write(datos, len);
+}
+
+
+size_t halFlashAbrir() {
+  if (particionHal == NULL)
+    particionHal = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "bitacora");
+  return particionHal ? particionHal->size : 0;
+}
+
+
+bool halFlashLeer(uint32_t direccion, void *destino, size_t len) {
+  return particionHal && esp_partition_read(particionHal, direccion, destino, len) == ESP_OK;
+}
+
+
+bool halFlashEscribir(uint32_t direccion, const void *datos, size_t len) {
+  return particionHal && esp_partition_write(particionHal, direccion, datos, len) == ESP_OK;
+}
+
+
+bool halFlashBorrar(uint32_t sector) {
+  return particionHal &&
+         esp_partition_erase_range(particionHal, sector * HAL_FLASH_TAM_SECTOR, HAL_FLASH_TAM_SECTOR) == ESP_OK;
+}
@@ -0,0 +1,144 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBHALSENS_H
+#define LIBHALSENS_H
+
+#include <stdint.h>
+
+// Capa delgada de acceso a los registros SENS del ADC1 (controlador RTC del SAR). En el ESP32
+// cada funcion es un acceso directo a registro (inline, sin costo extra); en el computador
+// (sin ARDUINO) se usa un bloque SENS simulado para probar la logica de escaneo.
+// La caracterizacion del ADC (halAdcCaracterizar/halAdcMilivoltios) usa esp_adc_cal en el
+// ESP32 y el puerto de sus formulas de libcalibracion en el computador.
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <soc/sens_reg.h>
+#include <soc/sens_struct.h>
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+
+/**
+ * Funcion que configura un canal del ADC1 (12 bits, atenuacion de 11dB). La lectura inicial con
+ * el driver deja el SAR1 en manos del controlador RTC, que es el que usan los registros SENS
+ * @param canal Canal del ADC1 (0 a 7)
+ */
+static inline void halSensConfigurarCanal(uint8_t canal) {
+  adc1_config_width(ADC_WIDTH_BIT_12);
+  adc1_config_channel_atten((adc1_channel_t)canal, ADC_ATTEN_DB_11);
+  adc1_get_raw((adc1_channel_t)canal);
+}
+
+static inline void halSensSeleccionarPad(uint32_t mascara) { SENS.sar_meas_start1.sar1_en_pad = mascara; }
+static inline bool halSensOcupado() { return SENS.sar_slave_addr1.meas_status != 0; }
+static inline void halSensIniciarConversion() {
+  SENS.sar_meas_start1.meas1_start_sar = 0;
+  SENS.sar_meas_start1.meas1_start_sar = 1;
+}
+static inline bool halSensConversionLista() { return SENS.sar_meas_start1.meas1_done_sar != 0; }
+static inline uint16_t halSensLeerDato() { return SENS.sar_meas_start1.meas1_data_sar; }
+static inline uint32_t halCiclos() { return ESP.getCycleCount(); }
+static inline uint32_t halCiclosPorMicrosegundo() { return ESP.getCpuFreqMHz(); }
+
+inline esp_adc_cal_characteristics_t caracteristicasAdc[4]; // Una caracterizacion por atenuacion
+
+/**
+ * Funcion que caracteriza el ADC1 para una atenuacion con la calibracion del eFuse (dos puntos o
+ * Vref) o, si el chip no la trae, con un Vref supuesto
+ * @param atenuacion Atenuacion (0 a 3, como adc_atten_t)
+ * @param vrefDefecto Vref en mV que se usa si el eFuse no tiene calibracion
+ * @return Origen de la caracterizacion (esp_adc_cal_value_t), o -1 si fallo
+ */
+static inline int halAdcCaracterizar(uint8_t atenuacion, uint32_t vrefDefecto) {
+  return (int)esp_adc_cal_characterize(ADC_UNIT_1, (adc_atten_t)(atenuacion & 3), ADC_WIDTH_BIT_12, vrefDefecto,
+                                       &caracteristicasAdc[atenuacion & 3]);
+}
+
+/**
+ * Funcion de conversion de referencia a milivoltios con la ultima caracterizacion de la atenuacion
+ */
+static inline uint32_t halAdcMilivoltios(uint16_t crudo, uint8_t atenuacion) {
+  return esp_adc_cal_raw_to_voltage(crudo, &caracteristicasAdc[atenuacion & 3]);
+}
+
+#else
+
+#include "libcalibracion.h"
+
+/**
+ * Bloque SENS simulado: cada conversion devuelve el valor fijado para el canal seleccionado
+ * y avanza el contador de ciclos, para probar en el computador el escaneo y su medicion de tiempo
+ */
+struct SensSimulado {
+  uint16_t valor[8];             // Valor que entrega cada canal
+  bool configurado[8];           // Canales configurados con halSensConfigurarCanal()
+  uint32_t configuraciones;      // Numero total de llamadas a halSensConfigurarCanal()
+  uint32_t padSeleccionado;      // Ultima mascara escrita en sar1_en_pad
+  uint32_t conversiones;         // Numero de conversiones iniciadas
+  uint16_t dato;                 // Registro meas1_data_sar
+  bool listo;                    // Registro meas1_done_sar
+  uint32_t ciclos;               // Contador de ciclos simulado
+  uint32_t ciclosPorConversion;  // Ciclos que avanza el contador en cada conversion
+  uint16_t (*fuente)(uint8_t canal); // Si no es NULL, da el valor del canal en vez del arreglo valor[]
+  uint32_t vrefEfuse;            // Vref grabado en el eFuse simulado (0 = chip sin calibracion)
+};
+
+inline SensSimulado sensSimulado = {};
+
+static inline void halSensConfigurarCanal(uint8_t canal) {
+  sensSimulado.configurado[canal & 7] = true;
+  sensSimulado.configuraciones++;
+}
+static inline void halSensSeleccionarPad(uint32_t mascara) { sensSimulado.padSeleccionado = mascara; }
+static inline bool halSensOcupado() { return false; }
+static inline void halSensIniciarConversion() {
+  uint8_t canal = 0;
+  while (canal < 7 && !(sensSimulado.padSeleccionado & (1u << canal))) canal++;
+  sensSimulado.dato = (sensSimulado.fuente ? sensSimulado.fuente(canal) : sensSimulado.valor[canal]) & 0x0FFF;
+  sensSimulado.listo = true;
+  sensSimulado.conversiones++;
+  sensSimulado.ciclos += sensSimulado.ciclosPorConversion;
+}
+static inline bool halSensConversionLista() { return sensSimulado.listo; }
+static inline uint16_t halSensLeerDato() {
+  sensSimulado.listo = false;
+  return sensSimulado.dato;
+}
+static inline uint32_t halCiclos() { return sensSimulado.ciclos; }
+static inline uint32_t halCiclosPorMicrosegundo() { return 240; }
+
+inline CaracterizacionADC caracteristicasAdc[4];
+
+static inline int halAdcCaracterizar(uint8_t atenuacion, uint32_t vrefDefecto) {
+  uint32_t vref = sensSimulado.vrefEfuse ? sensSimulado.vrefEfuse : vrefDefecto;
+  caracterizarADC1(atenuacion, vref, caracteristicasAdc[atenuacion & 3]);
+  return sensSimulado.vrefEfuse ? CAL_FUENTE_EFUSE_VREF : CAL_FUENTE_DEFECTO;
+}
+static inline uint32_t halAdcMilivoltios(uint16_t crudo, uint8_t atenuacion) {
+  return crudoAMilivoltios(crudo, caracteristicasAdc[atenuacion & 3]);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,506 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libhal.h"
+#include "libinstrumentacion.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Implementacion simulada de la HAL para correr en el computador. Los temporizadores no usan
+// el reloj real: halSimCorrer() ejecuta los manejadores en el orden en que vencen sus periodos
+// y adelanta el tiempo virtual de un evento al siguiente, asi que la simulacion corre tan
+// rapido como lo permita el procesador.
+
+#define SIM_MAX_TAREAS 16
+#define SIM_MAX_I2C 4
+#define SIM_TAM_UART 256  // Igual que el buffer de recepcion por defecto del UART del ESP32
+#define SIM_MAX_TOUCH 10
+#define SIM_MAX_PINES 4
+#define SIM_PERIODO_TOUCH_US 10000  // Periodo con el que el hardware de touch compara los pads con su umbral
+
+struct TareaSim {
+  ManejadorPeriodico manejador;
+  uint32_t periodoUs;  // Periodo, o espera maxima de las tareas de eventos
+  uint64_t proximaUs;
+  uint8_t prioridad;
+  bool porEventos;     // Tarea de halTareaEventos(): la proxima ejecucion se cuenta desde la anterior
+  uint32_t notificaciones; // Llamadas a halNotificar() desde la ultima ejecucion
+  uint64_t notificadaUs;   // Instante de la primera de ellas
+};
+
+struct InterrupcionTouchSim {
+  uint8_t pin;
+  uint16_t umbral;
+  ManejadorPeriodico isr;
+};
+
+struct InterrupcionPinSim {
+  uint8_t pin;
+  ManejadorPeriodico isr;
+};
+
+struct DispositivoI2cSim {
+  uint8_t direccion;
+  bool (*escribir)(const uint8_t *datos, size_t len);
+  bool (*leer)(uint8_t registro, uint8_t *datos, size_t len);
+};
+
+static uint64_t tiempoVirtualUs = 0;
+static TareaSim tareas[SIM_MAX_TAREAS];
+static uint8_t numTareas = 0;
+#ifdef INSTRUMENTACION
+static MedidorTarea *medidores[SIM_MAX_TAREAS];
+#endif
+static uint16_t (*fuenteAdc)(uint8_t canal, uint64_t tiempoUs) = NULL;
+static uint16_t (*fuenteTouch)(uint8_t pin, uint64_t tiempoUs) = NULL;
+static InterrupcionTouchSim interrupcionesTouch[SIM_MAX_TOUCH];
+static uint8_t numInterrupcionesTouch = 0;
+static InterrupcionPinSim interrupcionesPin[SIM_MAX_PINES];
+static uint8_t numInterrupcionesPin = 0;
+static DispositivoI2cSim dispositivosI2c[SIM_MAX_I2C];
+static uint8_t numDispositivosI2c = 0;
+static uint8_t uart[SIM_TAM_UART];
+static size_t uartCabeza = 0, uartCola = 0;
+static uint32_t uartDesbordes = 0;
+static ManejadorPeriodico uartAlRecibir = NULL;
+static ManejadorPeriodico isrAlarma = NULL;
+static uint64_t alarmaInicioUs = 0;  // Instante virtual en que el contador de la alarma estaba en cero
+static uint64_t alarmaUs = 0;        // Instante virtual de la alarma programada
+static bool alarmaActiva = false;
+static uint32_t tiempoAireFijoUs = 0, tiempoAirePorByteUs = 0;
+static uint64_t radioOcupadoHastaUs = 0;
+static uint32_t fallasRadio = 0;
+static EstadisticasRadioSim estadisticasRadio = {0, 0, 0, 0};
+static void (*salidaSim)(const uint8_t *datos, size_t len) = NULL;
+static void (*receptorRadio)(const uint8_t *datos, size_t len) = NULL;
+static uint64_t caidaRadioDesdeUs = 0, caidaRadioHastaUs = 0;
+static FILE *archivoFlash = NULL;
+static size_t tamanoFlash = 0;
+static uint32_t *borradosSector = NULL;  // Borrados de cada sector de la flash simulada
+static EstadisticasFlashSim estadisticasFlash;
+static uint32_t fallasFlash = 0;         // Escrituras de la flash que aun deben fallar
+static bool fallasFlashParciales = false;
+
+
+uint64_t halMicros() {
+  return tiempoVirtualUs;
+}
+
+
+bool halTareaPeriodica(uint8_t timer, uint32_t periodoUs, ManejadorPeriodico manejador, const char *nombre,
+                       uint8_t prioridad, uint8_t nucleo) {
+  (void)timer;
+  (void)nombre;
+  (void)nucleo;
+  if (numTareas >= SIM_MAX_TAREAS || periodoUs == 0) return false;
+  tareas[numTareas] = TareaSim{manejador, periodoUs, tiempoVirtualUs + periodoUs, prioridad, false, 0, 0};
+#ifdef INSTRUMENTACION
+  medidores[numTareas] = registrarMedidor(nombre, periodoUs);
+#endif
+  numTareas++;
+  return true;
+}
+
+
+int halTareaEventos(ManejadorPeriodico manejador, uint32_t esperaMaxUs, const char *nombre, uint8_t prioridad,
+                    uint8_t nucleo) {
+  (void)nombre;
+  (void)nucleo;
+  if (numTareas >= SIM_MAX_TAREAS || esperaMaxUs == 0) return -1;
+  tareas[numTareas] = TareaSim{manejador, esperaMaxUs, tiempoVirtualUs + esperaMaxUs, prioridad, true, 0, 0};
+#ifdef INSTRUMENTACION
+  medidores[numTareas] = registrarMedidor(nombre, 0);
+#endif
+  return numTareas++;
+}
+
+
+bool halAlarmaIniciar(uint8_t timer, ManejadorPeriodico isr) {
+  (void)timer;
+  if (isrAlarma != NULL || isr == NULL) return false;
+  isrAlarma = isr;
+  alarmaInicioUs = tiempoVirtualUs;
+  return true;
+}
+
+
+void halAlarmaProgramar(uint64_t cuenta) {
+  // El tiempo virtual va en microsegundos: la alarma se dispara en el primero que no queda antes de la cuenta
+  const uint64_t cuentasPorUs = HAL_CUENTAS_ALARMA_POR_SEGUNDO / 1000000;
+  alarmaUs = alarmaInicioUs + (cuenta + cuentasPorUs - 1) / cuentasPorUs;
+  if (alarmaUs < tiempoVirtualUs) alarmaUs = tiempoVirtualUs;
+  alarmaActiva = true;
+}
+
+
+uint64_t halAlarmaCuenta() {
+  return (tiempoVirtualUs - alarmaInicioUs) * (HAL_CUENTAS_ALARMA_POR_SEGUNDO / 1000000);
+}
+
+
+void halNotificar(int tarea) {
+  if (tarea < 0 || tarea >= numTareas) return;
+  if (tareas[tarea].notificaciones++ == 0) tareas[tarea].notificadaUs = tiempoVirtualUs;
+  if (tareas[tarea].proximaUs > tiempoVirtualUs) tareas[tarea].proximaUs = tiempoVirtualUs;  // Se ejecuta en cuanto se pueda
+}
+
+
+void halEsperaTarea(int tarea, uint32_t esperaMaxUs) {
+  if (tarea < 0 || tarea >= numTareas || esperaMaxUs == 0) return;
+  tareas[tarea].periodoUs = esperaMaxUs;
+  if (tareas[tarea].proximaUs > tiempoVirtualUs) tareas[tarea].proximaUs = tiempoVirtualUs + esperaMaxUs;  // Una notificacion pendiente se respeta
+}
+
+
+/**
+ * Funcion que indica si el tiempo virtual esta dentro de la caida programada del radio
+ */
+static bool radioCaido() {
+  return tiempoVirtualUs >= caidaRadioDesdeUs && tiempoVirtualUs < caidaRadioHastaUs;
+}
+
+
+void halSimCorrer(uint64_t duracionUs) {
+  uint64_t fin = tiempoVirtualUs + duracionUs;
+  while (true) {
+    TareaSim *siguiente = NULL;  // La que vence primero; en un empate, la de mayor prioridad
+    for (uint8_t i = 0; i < numTareas; i++) {
+      TareaSim *t = &tareas[i];
+      if (siguiente == NULL || t->proximaUs < siguiente->proximaUs ||
+          (t->proximaUs == siguiente->proximaUs && t->prioridad > siguiente->prioridad))
+        siguiente = t;
+    }
+    uint64_t proximaUs = (siguiente == NULL) ? fin + 1 : siguiente->proximaUs;
+    if (alarmaActiva && alarmaUs <= proximaUs && alarmaUs <= fin) {
+      // La interrupcion de la alarma se atiende antes que cualquier tarea
+      tiempoVirtualUs = alarmaUs;
+      alarmaActiva = false;
+      isrAlarma();
+      continue;
+    }
+    if (siguiente == NULL || siguiente->proximaUs > fin) break;
+    tiempoVirtualUs = siguiente->proximaUs;
+    siguiente->proximaUs = (siguiente->porEventos ? tiempoVirtualUs : siguiente->proximaUs) + siguiente->periodoUs;
+    // Un tick de una tarea periodica cuenta como una notificacion en el instante en que vencio
+    uint32_t notificaciones = siguiente->porEventos ? siguiente->notificaciones : 1;
+    uint64_t notificadaUs = siguiente->porEventos ? siguiente->notificadaUs : tiempoVirtualUs;
+    siguiente->notificaciones = 0;
+#ifdef INSTRUMENTACION
+    MedidorTarea *m = medidores[siguiente - tareas];
+    uint32_t inicio = 0;
+    if (m) {
+      // La latencia es la del tiempo virtual, la duracion la del manejador en el computador
+      m->cicloNotificacion = ciclosInstrumentacion() - (uint32_t)(tiempoVirtualUs - notificadaUs) * halCiclosPorMicrosegundo();
+      inicio = m->medirInicio(notificaciones, !siguiente->porEventos);
+    }
+#else
+    (void)notificaciones;
+    (void)notificadaUs;
+#endif
+    siguiente->manejador();
+#ifdef INSTRUMENTACION
+    if (m) m->medirFin(inicio);
+#endif
+  }
+  tiempoVirtualUs = fin;
+}
+
+
+/**
+ * Funcion que conecta el bloque SENS simulado con la señal del ADC en el tiempo virtual actual
+ */
+static uint16_t leerAdcSimulado(uint8_t canal) {
+  return fuenteAdc ? fuenteAdc(canal, tiempoVirtualUs) : 0;
+}
+
+
+void halSimFuenteAdc(uint16_t (*fuente)(uint8_t canal, uint64_t tiempoUs)) {
+  fuenteAdc = fuente;
+  sensSimulado.fuente = leerAdcSimulado;
+}
+
+
+void halSimFuenteTouch(uint16_t (*fuente)(uint8_t pin, uint64_t tiempoUs)) {
+  fuenteTouch = fuente;
+}
+
+
+uint16_t halTouchLeer(uint8_t pin) {
+  return fuenteTouch ? fuenteTouch(pin, tiempoVirtualUs) : 0;
+}
+
+
+/**
+ * Funcion que simula el hardware de touch: compara cada pad programado con su umbral sin usar la CPU
+ */
+static void compararTouchSimulado() {
+  for (uint8_t i = 0; i < numInterrupcionesTouch; i++)
+    if (halTouchLeer(interrupcionesTouch[i].pin) < interrupcionesTouch[i].umbral) interrupcionesTouch[i].isr();
+}
+
+
+void halTouchInterrupcion(uint8_t pin, uint16_t umbral, ManejadorPeriodico isr) {
+  for (uint8_t i = 0; i < numInterrupcionesTouch; i++) {
+    if (interrupcionesTouch[i].pin == pin) {
+      interrupcionesTouch[i] = InterrupcionTouchSim{pin, umbral, isr};
+      return;
+    }
+  }
+  if (numInterrupcionesTouch >= SIM_MAX_TOUCH) return;
+  if (numInterrupcionesTouch == 0) halTareaPeriodica(0, SIM_PERIODO_TOUCH_US, compararTouchSimulado, "Touch HW", 255, 0);
+  interrupcionesTouch[numInterrupcionesTouch++] = InterrupcionTouchSim{pin, umbral, isr};
+}
+
+
+void halInterrupcionPin(uint8_t pin, ManejadorPeriodico isr) {
+  for (uint8_t i = 0; i < numInterrupcionesPin; i++) {
+    if (interrupcionesPin[i].pin == pin) {
+      interrupcionesPin[i].isr = isr;
+      return;
+    }
+  }
+  if (numInterrupcionesPin < SIM_MAX_PINES) interrupcionesPin[numInterrupcionesPin++] = InterrupcionPinSim{pin, isr};
+}
+
+
+void halSimFlancoPin(uint8_t pin) {
+  for (uint8_t i = 0; i < numInterrupcionesPin; i++)
+    if (interrupcionesPin[i].pin == pin && interrupcionesPin[i].isr) interrupcionesPin[i].isr();
+}
+
+
+void halSimDispositivoI2c(uint8_t direccion, bool (*escribir)(const uint8_t *datos, size_t len),
+                          bool (*leer)(uint8_t registro, uint8_t *datos, size_t len)) {
+  if (numDispositivosI2c < SIM_MAX_I2C) dispositivosI2c[numDispositivosI2c++] = DispositivoI2cSim{direccion, escribir, leer};
+}
+
+
+static DispositivoI2cSim *buscarI2c(uint8_t direccion) {
+  for (uint8_t i = 0; i < numDispositivosI2c; i++)
+    if (dispositivosI2c[i].direccion == direccion) return &dispositivosI2c[i];
+  return NULL;  // Nadie responde el ACK en esa direccion
+}
+
+
+bool halI2cEscribir(uint8_t direccion, const uint8_t *datos, size_t len) {
+  DispositivoI2cSim *d = buscarI2c(direccion);
+  return d != NULL && d->escribir != NULL && d->escribir(datos, len);
+}
+
+
+bool halI2cLeer(uint8_t direccion, uint8_t registro, uint8_t *datos, size_t len) {
+  DispositivoI2cSim *d = buscarI2c(direccion);
+  return d != NULL && d->leer != NULL && d->leer(registro, datos, len);
+}
+
+
+size_t halSimUartEscribir(const uint8_t *datos, size_t len) {
+  size_t n = 0;
+  while (n < len && uartCabeza - uartCola < SIM_TAM_UART) uart[uartCabeza++ % SIM_TAM_UART] = datos[n++];
+  if (n < len) uartDesbordes++;
+  if (n > 0 && uartAlRecibir) uartAlRecibir();
+  return n;
+}
+
+
+size_t halUartLeer(uint8_t *datos, size_t max) {
+  size_t n = 0;
+  while (n < max && uartCola != uartCabeza) datos[n++] = uart[uartCola++ % SIM_TAM_UART];
+  return n;
+}
+
+
+void halUartAlRecibir(ManejadorPeriodico alRecibir) {
+  uartAlRecibir = alRecibir;
+}
+
+
+uint32_t halUartDesbordes() {
+  return uartDesbordes;
+}
+
+
+bool halRadioIniciar(int rst, int nss, int irq, long frecuencia) {
+  (void)rst;
+  (void)nss;
+  (void)irq;
+  (void)frecuencia;
+  if (radioCaido()) return false;
+  if (fallasRadio > 0) {
+    fallasRadio--;
+    return false;
+  }
+  return true;
+}
+
+
+void halSimFallasRadio(uint32_t intentos) {
+  fallasRadio = intentos;
+}
+
+
+void halSimCaidaRadio(uint64_t desdeUs, uint64_t hastaUs) {
+  caidaRadioDesdeUs = desdeUs;
+  caidaRadioHastaUs = hastaUs;
+}
+
+
+void halSimTiempoAire(uint32_t fijoUs, uint32_t porByteUs) {
+  tiempoAireFijoUs = fijoUs;
+  tiempoAirePorByteUs = porByteUs;
+}
+
+
+bool halRadioEnviar(const uint8_t *datos, size_t len) {
+  if (tiempoVirtualUs < radioOcupadoHastaUs || radioCaido()) {  // El paquete anterior sigue en el aire
+    estadisticasRadio.rechazados++;
+    return false;
+  }
+  uint64_t aire = tiempoAireFijoUs + (uint64_t)tiempoAirePorByteUs * len;
+  radioOcupadoHastaUs = tiempoVirtualUs + aire;
+  estadisticasRadio.paquetes++;
+  estadisticasRadio.bytes += len;
+  estadisticasRadio.tiempoAireUs += aire;
+  if (receptorRadio) receptorRadio(datos, len);
+  return true;
+}
+
+
+bool halRadioTransmitiendo() {
+  return tiempoVirtualUs < radioOcupadoHastaUs || radioCaido();  // Un radio caido no responde el sondeo
+}
+
+
+void halSimRadioReceptor(void (*receptor)(const uint8_t *datos, size_t len)) {
+  receptorRadio = receptor;
+}
+
+
+EstadisticasRadioSim halSimEstadisticasRadio() {
+  return estadisticasRadio;
+}
+
+
+void halSimSalida(void (*salida)(const uint8_t *datos, size_t len)) {
+  salidaSim = salida;
+}
+
+
+void halSalida(const uint8_t *datos, size_t len) {
+  if (salidaSim) salidaSim(datos, len);
+}
+
+
+bool halSimFlash(const char *archivo, size_t tamano) {
+  if (archivoFlash) fclose(archivoFlash);
+  tamanoFlash = tamano - tamano % HAL_FLASH_TAM_SECTOR;
+  archivoFlash = archivo ? fopen(archivo, "r+b") : NULL;
+  bool nuevo = archivoFlash == NULL;
+  if (nuevo) archivoFlash = archivo ? fopen(archivo, "w+b") : tmpfile();
+  if (archivoFlash == NULL) return false;
+  fseek(archivoFlash, 0, SEEK_END);
+  long actual = ftell(archivoFlash);
+  if (nuevo || actual < (long)tamanoFlash) {  // La parte que falta queda como flash borrada
+    uint8_t borrado[HAL_FLASH_TAM_SECTOR];
+    memset(borrado, 0xFF, sizeof(borrado));
+    for (size_t d = (size_t)actual - (size_t)actual % HAL_FLASH_TAM_SECTOR; d < tamanoFlash; d += HAL_FLASH_TAM_SECTOR) {
+      fseek(archivoFlash, (long)d, SEEK_SET);
+      fwrite(borrado, 1, HAL_FLASH_TAM_SECTOR, archivoFlash);
+    }
+  }
+  free(borradosSector);
+  borradosSector = (uint32_t *)calloc(tamanoFlash / HAL_FLASH_TAM_SECTOR, sizeof(uint32_t));
+  memset(&estadisticasFlash, 0, sizeof(estadisticasFlash));
+  return true;
+}
+
+
+size_t halFlashAbrir() {
+  return archivoFlash ? tamanoFlash : 0;
+}
+
+
+bool halFlashLeer(uint32_t direccion, void *destino, size_t len) {
+  if (archivoFlash == NULL || direccion + len > tamanoFlash) return false;
+  fseek(archivoFlash, (long)direccion, SEEK_SET);
+  return fread(destino, 1, len, archivoFlash) == len;
+}
+
+
+bool halFlashEscribir(uint32_t direccion, const void *datos, size_t len) {
+  uint8_t actual[256];
+  const uint8_t *nuevos = (const uint8_t *)datos;
+  if (archivoFlash == NULL || direccion + len > tamanoFlash) return false;
+  bool falla = fallasFlash > 0;
+  if (falla) {
+    fallasFlash--;
+    if (!fallasFlashParciales) return false;
+    len /= 2;  // Se programa la primera mitad y la escritura se reporta fallida
+  }
+  estadisticasFlash.escrituras++;
+  estadisticasFlash.bytesEscritos += len;
+  for (size_t hecho = 0; hecho < len;) {  // Como en una NOR, cada bit solo puede bajar de 1 a 0
+    size_t n = (len - hecho > sizeof(actual)) ? sizeof(actual) : len - hecho;
+    fseek(archivoFlash, (long)(direccion + hecho), SEEK_SET);
+    if (fread(actual, 1, n, archivoFlash) != n) return false;
+    for (size_t i = 0; i < n; i++) {
+      if (nuevos[hecho + i] & ~actual[i]) estadisticasFlash.bitsInvalidos++;
+      actual[i] &= nuevos[hecho + i];
+    }
+    fseek(archivoFlash, (long)(direccion + hecho), SEEK_SET);
+    if (fwrite(actual, 1, n, archivoFlash) != n) return false;
+    hecho += n;
+  }
+  return !falla;
+}
+
+
+bool halFlashBorrar(uint32_t sector) {
+  uint8_t borrado[HAL_FLASH_TAM_SECTOR];
+  if (archivoFlash == NULL || (sector + 1) * (size_t)HAL_FLASH_TAM_SECTOR > tamanoFlash) return false;
+  memset(borrado, 0xFF, sizeof(borrado));
+  fseek(archivoFlash, (long)sector * HAL_FLASH_TAM_SECTOR, SEEK_SET);
+  if (fwrite(borrado, 1, sizeof(borrado), archivoFlash) != sizeof(borrado)) return false;
+  borradosSector[sector]++;
+  estadisticasFlash.borrados++;
+  return true;
+}
+
+
+void halSimFallasFlash(uint32_t escrituras, bool parciales) {
+  fallasFlash = escrituras;
+  fallasFlashParciales = parciales;
+}
+
+
+EstadisticasFlashSim halSimEstadisticasFlash() {
+  EstadisticasFlashSim e = estadisticasFlash;
+  size_t sectores = tamanoFlash / HAL_FLASH_TAM_SECTOR;
+  e.borradosMinimo = sectores ? UINT32_MAX : 0;
+  for (size_t s = 0; s < sectores; s++) {
+    if (borradosSector[s] < e.borradosMinimo) e.borradosMinimo = borradosSector[s];
+    if (borradosSector[s] > e.borradosMaximo) e.borradosMaximo = borradosSector[s];
+  }
+  return e;
+}
@@ -0,0 +1,114 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libinstrumentacion.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef INSTRUMENTACION
+
+static MedidorTarea medidores[INSTR_MAX_MEDIDORES];
+static uint8_t numMedidores = 0;
+
+
+uint32_t HistogramaCiclos::percentil(uint32_t porMil) const {
+  uint64_t objetivo = ((uint64_t)muestras * porMil + 999) / 1000;
+  uint64_t acumulado = 0;
+  for (uint8_t k = 0; k < INSTR_CUBETAS; k++) {
+    acumulado += cubetas[k];
+    if (acumulado >= objetivo && acumulado > 0) {
+      uint32_t limite = (k == 0) ? 0 : (k == 32 ? UINT32_MAX : (1u << k) - 1);
+      return limite < maximo ? limite : maximo;  // Ninguna medida supera el maximo registrado
+    }
+  }
+  return maximo;
+}
+
+
+MedidorTarea *registrarMedidor(const char *nombre, uint32_t periodoUs) {
+  if (numMedidores >= INSTR_MAX_MEDIDORES) return NULL;
+  MedidorTarea *m = &medidores[numMedidores++];
+  memset(m, 0, sizeof(*m));
+  m->nombre = nombre;
+  m->periodoCiclos = periodoUs * halCiclosPorMicrosegundo();
+  return m;
+}
+
+
+/**
+ * Funcion que suma a largo los caracteres que escribio snprintf(), sin pasarse del destino
+ */
+static void avanzar(size_t &largo, size_t max, int n) {
+  if (n > 0) largo += n;
+  if (largo >= max) largo = max - 1;  // snprintf() trunco el texto
+}
+
+
+/**
+ * Funcion que escribe la media, la mediana, el percentil 99 y el maximo de un histograma en microsegundos
+ */
+static void escribirHistograma(char *destino, size_t max, size_t &largo, const HistogramaCiclos &h) {
+  float porUs = (float)halCiclosPorMicrosegundo();
+  avanzar(largo, max, snprintf(destino + largo, max - largo, " %8.1f %8.1f %8.1f %9.1f", h.muestras ? h.total / h.muestras / porUs : 0.0f,
+                               h.percentil(500) / porUs, h.percentil(990) / porUs, h.maximo / porUs));
+}
+
+
+size_t reporteInstrumentacion(char *destino, size_t max) {
+  if (max == 0) return 0;
+  size_t largo = 0;
+  avanzar(largo, max, snprintf(destino, max, "%-16s %9s %8s %8s %8s %9s %8s %8s %8s %9s %7s %7s %7s %7s\n", "Tarea (us)", "Ejec", "Lat med",
+                               "Lat p50", "Lat p99", "Lat max", "Dur med", "Dur p50", "Dur p99", "Dur max", "Atras", "Agrup", "Sobre", "Agot"));
+  for (uint8_t i = 0; i < numMedidores; i++) {
+    const MedidorTarea &m = medidores[i];
+    avanzar(largo, max, snprintf(destino + largo, max - largo, "%-16s %9u", m.nombre, m.duracion.muestras));
+    escribirHistograma(destino, max, largo, m.latencia);
+    escribirHistograma(destino, max, largo, m.duracion);
+    avanzar(largo, max, snprintf(destino + largo, max - largo, " %7u %7u %7u %7u\n", m.ticksAtrasados, m.notificacionesAgrupadas,
+                                 m.sobrecargas, m.esperasAgotadas));
+  }
+  return largo;
+}
+
+
+void reiniciarInstrumentacion() {
+  for (uint8_t i = 0; i < numMedidores; i++) {
+    MedidorTarea &m = medidores[i];
+    memset(&m.latencia, 0, sizeof(m.latencia));
+    memset(&m.duracion, 0, sizeof(m.duracion));
+    m.ticksAtrasados = m.notificacionesAgrupadas = m.sobrecargas = m.esperasAgotadas = 0;
+  }
+}
+
+#else
+
+size_t reporteInstrumentacion(char *destino, size_t max) {
+  if (max == 0) return 0;
+  int n = snprintf(destino, max, "Instrumentacion deshabilitada: compile con -DINSTRUMENTACION\n");
+  return (n < 0) ? 0 : ((size_t)n < max ? (size_t)n : max - 1);
+}
+
+
+void reiniciarInstrumentacion() {}
+
+#endif
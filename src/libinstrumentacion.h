@@ -0,0 +1,147 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBINSTRUMENTACION_H
+#define LIBINSTRUMENTACION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libhalsens.h"
+
+// Instrumentacion de las tareas de la HAL con el contador de ciclos: por cada tarea un histograma
+// de la latencia desde la interrupcion que la despierta hasta que empieza su manejador, otro de la
+// duracion del manejador, y contadores de ticks atrasados, notificaciones agrupadas y sobrecargas.
+// Registrar una medida es leer el contador de ciclos, una instruccion NSAU/CLZ para escoger la
+// cubeta y unas pocas sumas. Sin INSTRUMENTACION definido no se compila nada de esto.
+
+//#define INSTRUMENTACION // Se activa con -DINSTRUMENTACION en build_flags (platformio.ini); quitelo para no medir nada
+
+#define INSTR_MAX_MEDIDORES 16
+#define INSTR_CUBETAS 33   // Cubeta 0 para 0 ciclos, cubeta k para [2^(k-1), 2^k) ciclos
+
+#ifdef INSTRUMENTACION
+
+#ifdef ARDUINO
+static inline uint32_t ciclosInstrumentacion() { return halCiclos(); }
+#else
+#include <chrono>
+// En el computador se usa el reloj real expresado en ciclos de un ESP32 a halCiclosPorMicrosegundo() MHz
+static inline uint32_t ciclosInstrumentacion() {
+  return (uint32_t)(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() *
+                    halCiclosPorMicrosegundo() / 1000);
+}
+#endif
+
+/**
+ * Histograma logaritmico de duraciones en ciclos
+ */
+struct HistogramaCiclos {
+  uint32_t cubetas[INSTR_CUBETAS];
+  uint32_t muestras;
+  uint32_t maximo;
+  uint64_t total;
+
+  /**
+   * Funcion que registra una duracion, solo la llama una tarea (o una ISR) por histograma
+   */
+  inline void registrar(uint32_t ciclos) {
+    cubetas[ciclos ? 32 - __builtin_clz(ciclos) : 0]++;
+    muestras++;
+    total += ciclos;
+    if (ciclos > maximo) maximo = ciclos;
+  }
+
+  /**
+   * Funcion que da el limite superior en ciclos de la cubeta que contiene el percentil indicado
+   * @param porMil Percentil en partes por mil (500 para la mediana)
+   */
+  uint32_t percentil(uint32_t porMil) const;
+};
+
+/**
+ * Medidas de una tarea de la HAL
+ */
+struct MedidorTarea {
+  const char *nombre;
+  uint32_t periodoCiclos;            // Periodo de las tareas periodicas (0 en las de eventos)
+  volatile uint32_t cicloNotificacion; // Lo escribe la ISR (o quien notifica) al despertar la tarea
+  HistogramaCiclos latencia;         // De la notificacion al inicio del manejador
+  HistogramaCiclos duracion;         // Del manejador
+  uint32_t ticksAtrasados;           // Ticks que llegaron mientras la tarea aun no atendia uno anterior
+  uint32_t notificacionesAgrupadas;  // Notificaciones atendidas por una sola ejecucion del manejador
+  uint32_t sobrecargas;              // Ejecuciones que duraron mas que el periodo
+  uint32_t esperasAgotadas;          // Ejecuciones sin notificacion, por la espera maxima
+
+  /**
+   * Funcion que la tarea llama al despertar, antes del manejador
+   * @param notificaciones Valor devuelto por ulTaskNotifyTake() (notificaciones pendientes)
+   * @param periodica true si la tarea atiende un timer (cada notificacion es un tick)
+   * @return Ciclo de inicio del manejador, para medirFin()
+   */
+  inline uint32_t medirInicio(uint32_t notificaciones, bool periodica) {
+    uint32_t ahora = ciclosInstrumentacion();
+    if (notificaciones == 0) {
+      esperasAgotadas++;
+    } else {
+      if (notificaciones == 1) latencia.registrar(ahora - cicloNotificacion);  // Con ticks atrasados la marca es de otro tick
+      if (periodica) ticksAtrasados += notificaciones - 1;
+      else notificacionesAgrupadas += notificaciones - 1;
+    }
+    return ahora;
+  }
+
+  /**
+   * Funcion que la tarea llama al terminar el manejador
+   * @param inicio Valor devuelto por medirInicio()
+   */
+  inline void medirFin(uint32_t inicio) {
+    uint32_t ciclos = ciclosInstrumentacion() - inicio;
+    duracion.registrar(ciclos);
+    if (periodoCiclos != 0 && ciclos > periodoCiclos) sobrecargas++;
+  }
+};
+
+/**
+ * Funcion que reserva el medidor de una tarea, la usa la HAL al crear cada tarea
+ * @param nombre Nombre de la tarea
+ * @param periodoUs Periodo de las tareas periodicas, 0 en las de eventos
+ * @return El medidor, o NULL si ya no hay espacio
+ */
+MedidorTarea *registrarMedidor(const char *nombre, uint32_t periodoUs);
+
+#endif
+
+/**
+ * Funcion que escribe la tabla de medidas de todas las tareas como texto
+ * @param destino Donde se escribe el texto
+ * @param max Tamaño del destino
+ * @return Numero de caracteres escritos
+ */
+size_t reporteInstrumentacion(char *destino, size_t max);
+
+/**
+ * Funcion que pone en cero todas las medidas
+ */
+void reiniciarInstrumentacion();
+
+#endif
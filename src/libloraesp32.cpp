@@ -1,5 +1,5 @@
 #include <Arduino.h>
-#include <LoRa.h>
+#include "libtransmisorlora.h"
 
 
 /**
@@ -10,17 +10,12 @@
  * @param freq es la frecuencia deseada de operacion del RA-02
  */
 void setLoRa(int rst_ra, int nss, int irq_na, long freq){
-//Ajuste de los pines usados por el modulo RA-02
-  pinMode(rst_ra, OUTPUT);    //Configuramos IO4 como salida para manejar el pin de reset
-  pinMode(nss, OUTPUT);       //Configuramos IO5 como salida para manejar el pin de seleccion de esclavo
-  digitalWrite(rst_ra, HIGH); //Ponemos reset=1 para que se ejecute
-  digitalWrite(nss, LOW);     //Ponemos nss=0 para seleccionar el esclavo (el RA-02)
-  //Ajustamos los pines del LoRa
-  LoRa.setPins(nss, rst_ra, irq_na);  //Configuramos los pines del modulo LoRa para que la libreria los maneje
-  //Inicializamos el modulo a 433MHz (posible ajustarlo de 410 a 525MHz)
-  if (!LoRa.begin(freq)) {           //Configuramos el modulo RA-02 a 433MHz
-    Serial.println("Inicializacion del modulo LORA RA-02 fallida!");
-    while (1);                        //Si no se pudo inicializar se detiene el programa en este bucle infinito
+  //Ajuste de los pines usados por el modulo RA-02 e inicializacion a 433MHz (posible ajustarlo de 410 a 525MHz)
+  //La tarea del transmisor (prioridad 1 en el nucleo 1) envia los paquetes sin bloquear la adquisicion
+  if (!iniciarTransmisorLoRa(rst_ra, nss, irq_na, freq, 1, 1)) {
+    //En vez de detener el programa, la tarea sigue intentando iniciar el radio con espera exponencial
+    Serial.println("Inicializacion del modulo LORA RA-02 fallida, se reintentara en segundo plano");
+    return;
   }
   delay(200); //Retardo que espera la estabilizacion del modulo RA-02
   Serial.println("Inicializando dispositivo .::Weareable EKG::.");
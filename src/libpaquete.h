@@ -0,0 +1,148 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBPAQUETE_H
+#define LIBPAQUETE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libtelemetria.h"
+
+// Estructura comun de los paquetes binarios de LoRa (muestras, latidos, espectro y cambios de tasa)
+// y de los bloques de la captura, en little endian:
+//  [0]        Tipo del paquete (PAQUETE_TIPO_* o CAPTURA_SYNC)
+//  [1..2]     Numero de secuencia, propio de cada emisor (se desborda solo)
+//  [3..6]     Marca de tiempo en microsegundos, los 32 bits bajos (los paquetes de LoRa; la captura
+//             lleva una marca por registro)
+//  [..]       Campos propios de cada tipo, descritos en su biblioteca
+//  [n-2..n-1] CRC-16/CCITT de todo lo anterior
+// Los empaquetadores arman el paquete en un buffer mientras el anterior espera a que lo envien en el
+// otro (ArmadorPaquetes), asi que quien lo recibe con paquete()/tamano() no necesita copiarlo.
+
+#define PAQUETE_TAM_COMUN 7  // Tipo, secuencia y marca de tiempo
+#define PAQUETE_TAM_CRC 2
+
+/**
+ * Funcion que escribe el tipo, la secuencia y la marca de tiempo al comienzo de un paquete
+ */
+static inline void escribirEncabezadoPaquete(uint8_t *p, uint8_t tipo, uint16_t secuencia, uint32_t marcaTiempo) {
+  p[0] = tipo;
+  p[1] = (uint8_t)secuencia;
+  p[2] = (uint8_t)(secuencia >> 8);
+  for (uint8_t i = 0; i < 4; i++) p[3 + i] = (uint8_t)(marcaTiempo >> (8 * i));
+}
+
+/**
+ * Funcion que lee la secuencia y la marca de tiempo del comienzo de un paquete
+ */
+static inline void leerEncabezadoPaquete(const uint8_t *p, uint16_t &secuencia, uint32_t &marcaTiempo) {
+  secuencia = (uint16_t)(p[1] | (p[2] << 8));
+  marcaTiempo = 0;
+  for (uint8_t i = 0; i < 4; i++) marcaTiempo |= (uint32_t)p[3 + i] << (8 * i);
+}
+
+/**
+ * Funcion que agrega el CRC al final de un paquete
+ * @param p Paquete, con espacio para PAQUETE_TAM_CRC bytes mas
+ * @param len Bytes del paquete sin el CRC
+ * @return Bytes del paquete con el CRC
+ */
+static inline size_t agregarCrcPaquete(uint8_t *p, size_t len) {
+  uint16_t crc = crc16Ccitt(p, len);
+  p[len] = (uint8_t)crc;
+  p[len + 1] = (uint8_t)(crc >> 8);
+  return len + PAQUETE_TAM_CRC;
+}
+
+/**
+ * Funcion que verifica el CRC del final de un paquete recibido
+ * @param p Paquete
+ * @param len Bytes del paquete con el CRC
+ */
+static inline bool crcPaqueteValido(const uint8_t *p, size_t len) {
+  return len > PAQUETE_TAM_CRC && crc16Ccitt(p, len - PAQUETE_TAM_CRC) == (uint16_t)(p[len - 2] | (p[len - 1] << 8));
+}
+
+/**
+ * Doble buffer de un empaquetador: el paquete se arma en un buffer y al cerrarlo queda listo en el
+ * otro hasta que se cierre el siguiente
+ * @param TAM Bytes maximos de un paquete, con el CRC
+ */
+template <size_t TAM>
+class ArmadorPaquetes {
+public:
+  ArmadorPaquetes() { reiniciar(); }
+
+  /**
+   * Funcion que descarta el paquete en construccion y el listo, y vuelve la secuencia a 0
+   */
+  void reiniciar() {
+    armando = 0;
+    listo = 1;
+    tamanoListo = 0;
+    indice = 0;
+    secuencia = 0;
+  }
+
+  /**
+   * Funcion que empieza un paquete con el encabezado comun
+   * @param tipo Tipo del paquete
+   * @param marcaTiempo Marca de tiempo del paquete en microsegundos
+   * @param tamEncabezado Bytes del encabezado completo del tipo; los que siguen al comun los llena quien llama
+   * @return Buffer del paquete en construccion
+   */
+  uint8_t *empezar(uint8_t tipo, uint32_t marcaTiempo, size_t tamEncabezado) {
+    escribirEncabezadoPaquete(buffers[armando], tipo, secuencia, marcaTiempo);
+    indice = tamEncabezado;
+    return buffers[armando];
+  }
+
+  uint8_t *actual() { return buffers[armando]; }  // Buffer del paquete en construccion
+
+  /**
+   * Funcion que le pone el CRC al paquete en construccion y lo deja listo
+   * @return Bytes del paquete cerrado
+   */
+  size_t cerrar() {
+    tamanoListo = agregarCrcPaquete(buffers[armando], indice);
+    secuencia++;
+    listo = armando;  // Intercambiamos los buffers: el cerrado queda listo y se arma en el otro
+    armando ^= 1;
+    indice = 0;
+    return tamanoListo;
+  }
+
+  const uint8_t *paquete() const { return buffers[listo]; }  // Ultimo paquete cerrado
+  size_t tamano() const { return tamanoListo; }              // Bytes del ultimo paquete cerrado
+
+  size_t indice;  // Bytes escritos en el paquete en construccion
+
+private:
+  uint8_t buffers[2][TAM];
+  uint8_t armando;  // Indice del buffer en construccion
+  uint8_t listo;    // Indice del ultimo buffer cerrado
+  size_t tamanoListo;
+  uint16_t secuencia;
+};
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libpasarela.h"
+#include <string.h>
+#include <chrono>
+
+#define ESPERA_COLA_US 50  // Lo que duerme un hilo de la Pasarela cuando su cola esta vacia
+
+
+void EstadisticasIngesta::sumar(const EstadisticasIngesta &e) {
+  bytes += e.bytes;
+  tramas += e.tramas;
+  paquetes += e.paquetes;
+  muestras += e.muestras;
+  erroresTrama += e.erroresTrama;
+  diagnosticos += e.diagnosticos;
+  sinFiltrar += e.sinFiltrar;
+  invalidos += e.invalidos;
+  otros += e.otros;
+  huecos += e.huecos;
+  perdidas += e.perdidas;
+  tardios += e.tardios;
+  reordenados += e.reordenados;
+}
+
+
+IngestorDispositivo::IngestorDispositivo(uint32_t dispositivo, EscritorColumnar *escritor, ConsumidorHuecos alHueco)
+    : id(dispositivo), escritor(escritor), consumidorHuecos(alHueco), contadores(), indice(0), desbordado(false) {}
+
+
+void IngestorDispositivo::procesarFlujo(const uint8_t *datos, size_t len) {
+  contadores.bytes += len;
+  if (!ordenTramas) {
+    ordenTramas.reset(new Reordenador<TramaTelemetria, PASARELA_VENTANA_TRAMAS>());
+    telemetria.reset(new GrupoColumnas());
+    telemetria->fuente = COLUMNAR_FUENTE_TELEMETRIA;
+  }
+  while (len > 0) {
+    const uint8_t *fin = (const uint8_t *)memchr(datos, 0x00, len);  // Se buscan los delimitadores sin recorrer byte a byte
+    size_t n = fin ? (size_t)(fin - datos) : len;
+    if (indice + n <= sizeof(recibido)) memcpy(&recibido[indice], datos, n); else desbordado = true;
+    indice += n;
+    if (fin == NULL) return;  // La trama sigue en el siguiente trozo
+    datos += n + 1;
+    len -= n + 1;
+    TramaTelemetria trama;
+    char texto[TELEMETRIA_TEXTO_MAX + 1];
+    size_t largo;
+    if (indice > 0) {
+      if (!desbordado && decodificarTrama(recibido, indice, trama)) {
+        contadores.tramas++;
+        ordenTramas->agregar(trama.secuencia, trama, [this](const TramaTelemetria &t) { guardarTrama(t); },
+                             [this](uint16_t desde, uint32_t cantidad) {
+                               reportarHueco(COLUMNAR_FUENTE_TELEMETRIA, desde, cantidad, telemetria->ultimaMarca);
+                             });
+      } else if (!desbordado && decodificarTexto(recibido, indice, texto, largo)) {
+        contadores.diagnosticos++;  // Los mensajes del dispositivo no son muestras: solo se cuentan
+      } else {
+        contadores.erroresTrama++;  // Tambien los bloques de la captura (libcaptura.h)
+      }
+    }
+    indice = 0;
+    desbordado = false;
+  }
+}
+
+
+void IngestorDispositivo::procesarPaquete(const uint8_t *paquete, size_t len) {
+  contadores.bytes += len;
+  if (len == 0 || !esPaqueteMuestras(paquete[0])) {
+    contadores.otros++;
+    return;
+  }
+  if (!ordenPaquetes) {
+    ordenPaquetes.reset(new Reordenador<PaqueteDecodificado, PASARELA_VENTANA_PAQUETES>());
+    lora.reset(new GrupoColumnas());
+    lora->fuente = COLUMNAR_FUENTE_LORA;
+    loraSinFiltrar.reset(new GrupoColumnas());
+    loraSinFiltrar->fuente = COLUMNAR_FUENTE_LORA_SIN_FILTRAR;
+    decodificado.reset(new PaqueteDecodificado());
+  }
+  PaqueteDecodificado &p = *decodificado;
+  if (desempaquetarMuestras(paquete, len, p.encabezado, p.valores, PAQUETE_CARGA_MAX) == 0) {
+    contadores.invalidos++;
+    return;
+  }
+  contadores.paquetes++;
+  ordenPaquetes->agregar(p.encabezado.secuencia, p, [this](const PaqueteDecodificado &d) { guardarPaquete(d); },
+                         [this](uint16_t desde, uint32_t cantidad) { reportarHueco(COLUMNAR_FUENTE_LORA, desde, cantidad, lora->ultimaMarca); });
+}
+
+
+void IngestorDispositivo::terminar() {
+  if (ordenTramas) {
+    ordenTramas->vaciar([this](const TramaTelemetria &t) { guardarTrama(t); },
+                        [this](uint16_t desde, uint32_t cantidad) {
+                          reportarHueco(COLUMNAR_FUENTE_TELEMETRIA, desde, cantidad, telemetria->ultimaMarca);
+                        });
+    contadores.tardios += ordenTramas->tardios;
+    contadores.reordenados += ordenTramas->reordenados;
+    escribirGrupo(*telemetria);
+  }
+  if (ordenPaquetes) {
+    ordenPaquetes->vaciar([this](const PaqueteDecodificado &d) { guardarPaquete(d); },
+                          [this](uint16_t desde, uint32_t cantidad) { reportarHueco(COLUMNAR_FUENTE_LORA, desde, cantidad, lora->ultimaMarca); });
+    contadores.tardios += ordenPaquetes->tardios;
+    contadores.reordenados += ordenPaquetes->reordenados;
+    escribirGrupo(*lora);
+    escribirGrupo(*loraSinFiltrar);
+  }
+}
+
+
+/**
+ * Funcion que desenvuelve una marca de tiempo de 32 bits (se desborda cada 71 minutos) a 64 bits con
+ * la anterior del grupo
+ */
+uint64_t IngestorDispositivo::desenvolver(GrupoColumnas &grupo, uint32_t marcaTiempo) {
+  if (!grupo.hayMarca) {
+    grupo.hayMarca = true;
+    grupo.ultimaMarca = marcaTiempo;
+  } else {
+    grupo.ultimaMarca = extenderMarcaTiempo(grupo.ultimaMarca, marcaTiempo);
+  }
+  return grupo.ultimaMarca;
+}
+
+
+void IngestorDispositivo::guardarTrama(const TramaTelemetria &trama) {
+  GrupoColumnas &g = *telemetria;
+  uint32_t i = g.cantidad;
+  g.tiempo[i] = desenvolver(g, trama.marcaTiempo);
+  for (uint8_t c = 0; c < 3; c++) {
+    g.valores[c][i] = trama.adc[c];
+    g.valores[3 + c][i] = (uint16_t)trama.gyro[c];
+  }
+  g.banderas[i] = (uint8_t)((trama.milivoltios ? 1 : 0) | (trama.reposo ? 2 : 0));
+  contadores.muestras++;
+  if (++g.cantidad == COLUMNAR_MUESTRAS_BLOQUE) escribirGrupo(g);
+}
+
+
+void IngestorDispositivo::guardarPaquete(const PaqueteDecodificado &paquete) {
+  const EncabezadoPaquete &e = paquete.encabezado;
+  GrupoColumnas &g = e.sinFiltrar ? *loraSinFiltrar : *lora;  // La secuencia es una sola, pero las muestras van aparte
+  if (e.sinFiltrar) contadores.sinFiltrar++;
+  if (g.cantidad > 0 && e.numCanales != g.canales) escribirGrupo(g);  // Todas las columnas de un grupo tienen los mismos canales
+  g.canales = e.numCanales;
+  uint64_t inicio = desenvolver(g, e.marcaTiempo);
+  for (uint8_t k = 0; k < e.numMuestras; k++) {
+    uint32_t i = g.cantidad;
+    g.tiempo[i] = inicio + (uint64_t)k * e.periodoUs;
+    for (uint8_t c = 0; c < e.numCanales; c++) g.valores[c][i] = paquete.valores[k * e.numCanales + c];
+    g.banderas[i] = e.milivoltios ? 1 : 0;
+    if (++g.cantidad == COLUMNAR_MUESTRAS_BLOQUE) escribirGrupo(g);
+  }
+  contadores.muestras += e.numMuestras;
+  if (e.numMuestras > 0) g.ultimaMarca = inicio + (uint64_t)(e.numMuestras - 1) * e.periodoUs;  // Para el siguiente paquete y los huecos
+}
+
+
+/**
+ * Funcion que escribe las columnas del grupo en el archivo y lo deja vacio
+ */
+void IngestorDispositivo::escribirGrupo(GrupoColumnas &grupo) {
+  if (grupo.cantidad == 0) return;
+  ColumnaColumnar columnas[2 + PAQUETE_MAX_CANALES];
+  size_t n = 0;
+  columnas[n++] = ColumnaColumnar{COLUMNAR_CANAL_TIEMPO, COLUMNAR_TIPO_U64, grupo.tiempo};
+  if (grupo.fuente == COLUMNAR_FUENTE_TELEMETRIA) {
+    for (uint8_t c = 0; c < 6; c++)
+      columnas[n++] = ColumnaColumnar{(uint8_t)(COLUMNAR_CANAL_ADC_X + c), c < 3 ? (uint8_t)COLUMNAR_TIPO_U16 : (uint8_t)COLUMNAR_TIPO_I16,
+                                      grupo.valores[c]};
+    columnas[n++] = ColumnaColumnar{COLUMNAR_CANAL_BANDERAS, COLUMNAR_TIPO_U8, grupo.banderas};
+  } else {
+    for (uint8_t c = 0; c < grupo.canales; c++) columnas[n++] = ColumnaColumnar{(uint8_t)(1 + c), COLUMNAR_TIPO_U16, grupo.valores[c]};
+  }
+  if (escritor) escritor->agregarGrupo(id, grupo.fuente, columnas, n, grupo.cantidad, grupo.tiempo[0], grupo.tiempo[grupo.cantidad - 1]);
+  grupo.cantidad = 0;
+}
+
+
+void IngestorDispositivo::reportarHueco(uint8_t fuente, uint16_t desde, uint32_t cantidad, uint64_t marcaTiempo) {
+  contadores.huecos++;
+  contadores.perdidas += cantidad;
+  if (consumidorHuecos) consumidorHuecos(HuecoSecuencia{id, fuente, desde, cantidad, marcaTiempo});
+}
+
+
+Pasarela::Pasarela(EscritorColumnar *escritor, ConsumidorHuecos alHueco)
+    : descartados(0), escritor(escritor), consumidorHuecos(alHueco), corriendo(false) {}
+
+
+Pasarela::~Pasarela() {
+  terminar();
+}
+
+
+bool Pasarela::iniciar(size_t numHilos) {
+  corriendo = true;
+  for (size_t i = 0; i < numHilos; i++) {
+    hilos.emplace_back(new Hilo());
+    Hilo *h = hilos.back().get();
+    h->hilo = std::thread([this, h]() { atender(*h); });
+  }
+  return !hilos.empty();
+}
+
+
+bool Pasarela::entregar(uint32_t dispositivo, const uint8_t *paquete, size_t len, bool esperar) {
+  if (hilos.empty() || len > PAQUETE_CARGA_MAX) return false;
+  entrante.dispositivo = dispositivo;
+  entrante.len = (uint16_t)len;
+  memcpy(entrante.datos, paquete, len);
+  Hilo &h = *hilos[dispositivo % hilos.size()];  // Un dispositivo siempre va al mismo hilo
+  while (!h.cola.push(entrante)) {
+    if (!esperar) {
+      descartados++;
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+
+/**
+ * Manejador de un hilo de la Pasarela: atiende los paquetes de su cola hasta que se detiene y la vacia
+ */
+void Pasarela::atender(Hilo &h) {
+  Recibido recibido;
+  while (true) {
+    if (!h.cola.pop(recibido)) {
+      if (!corriendo.load(std::memory_order_acquire) && h.cola.disponibles() == 0) break;
+      std::this_thread::sleep_for(std::chrono::microseconds(ESPERA_COLA_US));
+      continue;
+    }
+    std::unique_ptr<IngestorDispositivo> &d = h.dispositivos[recibido.dispositivo];
+    if (!d) d.reset(new IngestorDispositivo(recibido.dispositivo, escritor, consumidorHuecos));
+    d->procesarPaquete(recibido.datos, recibido.len);
+  }
+  for (auto &d : h.dispositivos) d.second->terminar();
+}
+
+
+void Pasarela::terminar() {
+  corriendo.store(false, std::memory_order_release);
+  for (std::unique_ptr<Hilo> &h : hilos)
+    if (h->hilo.joinable()) h->hilo.join();
+}
+
+
+EstadisticasIngesta Pasarela::estadisticas() const {
+  EstadisticasIngesta total = {};
+  paraCadaDispositivo([&total](const IngestorDispositivo &d) { total.sumar(d.estadisticas()); });
+  return total;
+}
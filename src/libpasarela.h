@@ -0,0 +1,300 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBPASARELA_H
+#define LIBPASARELA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "libcolumnar.h"
+#include "libempaquetador.h"
+#include "libringbuffer.h"
+#include "libtelemetria.h"
+
+// Pasarela del lado del computador: recibe la telemetria de muchos dispositivos (tramas COBS del
+// puerto serial, libtelemetria.h, o paquetes de muestras de LoRa, libempaquetador.h), los ordena por
+// numero de secuencia, reporta los huecos y guarda las muestras en el archivo columnar (libcolumnar.h).
+// Cada dispositivo lo atiende un solo hilo, asi que su estado no necesita mutex: los flujos del
+// puerto serial o de un archivo tienen su propio hilo, y los paquetes de un gateway se reparten por
+// dispositivo entre los hilos de una Pasarela.
+
+#define PASARELA_VENTANA_TRAMAS 64     // Tramas de telemetria que se esperan para reordenar antes de dar una por perdida
+#define PASARELA_VENTANA_PAQUETES 16   // Paquetes de LoRa que se esperan para reordenar
+#define PASARELA_COLA_HILO 1024        // Paquetes en espera por hilo de la Pasarela
+
+/**
+ * Reordenador por numero de secuencia de 16 bits: guarda lo que llega adelantado en una ventana de N
+ * posiciones y lo entrega en orden. Una secuencia que falta se da por perdida cuando llega una que ya
+ * no cabe en la ventana (o al vaciarla), y lo que llega detras de lo ya entregado se descarta.
+ * @param T Tipo de lo que se reordena
+ * @param N Tamaño de la ventana (potencia de 2, menor que 32768)
+ */
+template <typename T, size_t N>
+class Reordenador {
+  static_assert(N >= 2 && N < 32768 && (N & (N - 1)) == 0, "La ventana del Reordenador debe ser potencia de 2");
+
+public:
+  Reordenador() : tardios(0), reordenados(0), siguiente(0), iniciado(false), pendientes(0), huecoDesde(0), huecoLargo(0) {
+    for (size_t i = 0; i < N; i++) ocupado[i] = false;
+  }
+
+  /**
+   * Funcion que agrega un elemento y entrega los que ya quedaron en orden
+   * @param salida Recibe cada elemento entregado: salida(const T &)
+   * @param hueco Recibe cada tramo de secuencias perdidas: hueco(uint16_t desde, uint32_t cantidad)
+   */
+  template <typename Salida, typename Hueco>
+  void agregar(uint16_t secuencia, const T &elemento, Salida salida, Hueco hueco) {
+    if (!iniciado) {
+      siguiente = secuencia;
+      iniciado = true;
+    }
+    int32_t distancia = (int16_t)(uint16_t)(secuencia - siguiente);
+    if (distancia < 0 || (distancia < (int32_t)N && ocupado[secuencia & (N - 1)])) {
+      tardios++;  // Repetido, o llego despues de darlo por perdido
+      return;
+    }
+    if (distancia >= (int32_t)N) {  // No cabe: lo que falta antes de el ya no va a llegar
+      while (pendientes > 0) avanzar(salida, hueco);
+      uint16_t inicio = (uint16_t)(secuencia - (N - 1));
+      if ((int16_t)(uint16_t)(inicio - siguiente) > 0) {
+        if (huecoLargo == 0) huecoDesde = siguiente;
+        huecoLargo += (uint16_t)(inicio - siguiente);
+        siguiente = inicio;
+      }
+    }
+    if (secuencia != siguiente) reordenados++;
+    ventana[secuencia & (N - 1)] = elemento;
+    ocupado[secuencia & (N - 1)] = true;
+    pendientes++;
+    while (ocupado[siguiente & (N - 1)]) avanzar(salida, hueco);
+  }
+
+  /**
+   * Funcion que entrega todo lo que quedo en la ventana (al terminar), contando los huecos entre medio
+   */
+  template <typename Salida, typename Hueco>
+  void vaciar(Salida salida, Hueco hueco) {
+    while (pendientes > 0) avanzar(salida, hueco);
+  }
+
+  uint32_t tardios;     // Descartados por repetidos o tardios
+  uint32_t reordenados; // Llegaron adelantados y esperaron en la ventana a los anteriores
+
+private:
+  template <typename Salida, typename Hueco>
+  void avanzar(Salida salida, Hueco hueco) {
+    size_t i = siguiente & (N - 1);
+    if (ocupado[i]) {
+      if (huecoLargo > 0) hueco(huecoDesde, huecoLargo);
+      huecoLargo = 0;
+      ocupado[i] = false;
+      pendientes--;
+      salida(ventana[i]);
+    } else {
+      if (huecoLargo == 0) huecoDesde = siguiente;
+      huecoLargo++;
+    }
+    siguiente++;
+  }
+
+  T ventana[N];
+  bool ocupado[N];
+  uint16_t siguiente;   // Secuencia que se entrega a continuacion
+  bool iniciado;
+  size_t pendientes;    // Elementos en la ventana
+  uint16_t huecoDesde;  // Tramo de secuencias perdidas que se reporta con el siguiente elemento entregado
+  uint32_t huecoLargo;
+};
+
+/**
+ * Tramo de secuencias perdidas de un dispositivo
+ */
+struct HuecoSecuencia {
+  uint32_t dispositivo;
+  uint8_t fuente;        // COLUMNAR_FUENTE_*
+  uint16_t desde;        // Primera secuencia perdida
+  uint32_t cantidad;     // Tramas o paquetes perdidos
+  uint64_t marcaTiempo;  // Ultima marca de tiempo recibida antes del hueco (us, desenvuelta)
+};
+
+typedef void (*ConsumidorHuecos)(const HuecoSecuencia &hueco);
+
+/**
+ * Contadores de un dispositivo (o sumados de varios)
+ */
+struct EstadisticasIngesta {
+  uint64_t bytes;         // Bytes recibidos de flujos y paquetes
+  uint64_t tramas;        // Tramas de telemetria validas
+  uint64_t paquetes;      // Paquetes de muestras de LoRa validos
+  uint64_t muestras;      // Muestras guardadas (una por instante, con todos sus canales)
+  uint32_t sinFiltrar;    // Paquetes de muestras sin filtrar, guardados en COLUMNAR_FUENTE_LORA_SIN_FILTRAR
+  uint32_t erroresTrama;  // Tramas descartadas por COBS, longitud, SYNC o CRC
+  uint32_t diagnosticos;  // Tramas de texto de diagnostico (TELEMETRIA_SYNC_TEXTO)
+  uint32_t invalidos;     // Paquetes de LoRa descartados por formato o CRC
+  uint32_t otros;         // Paquetes de LoRa de otros tipos (latidos, espectro, tasa), que no son columnas
+  uint32_t huecos;        // Tramos de secuencias perdidas
+  uint64_t perdidas;      // Tramas y paquetes perdidos
+  uint32_t tardios;       // Descartados por repetidos o por llegar despues de darlos por perdidos
+  uint32_t reordenados;   // Llegaron fuera de orden y se reordenaron
+
+  void sumar(const EstadisticasIngesta &e);
+};
+
+/**
+ * Muestras de un grupo (dispositivo y fuente) que se juntan en columnas hasta completar un bloque
+ */
+struct GrupoColumnas {
+  uint8_t fuente;
+  uint8_t canales;            // Canales de LoRa ademas del tiempo (la telemetria siempre tiene los de COLUMNAR_CANAL_*)
+  uint32_t cantidad;          // Muestras en las columnas
+  uint64_t tiempo[COLUMNAR_MUESTRAS_BLOQUE];
+  uint16_t valores[COLUMNAR_CANALES_TELEMETRIA > PAQUETE_MAX_CANALES ? COLUMNAR_CANALES_TELEMETRIA : PAQUETE_MAX_CANALES]
+                  [COLUMNAR_MUESTRAS_BLOQUE];
+  uint8_t banderas[COLUMNAR_MUESTRAS_BLOQUE];
+  uint64_t ultimaMarca;       // Para desenvolver las marcas de tiempo de 32 bits
+  bool hayMarca;
+};
+
+/**
+ * Ingesta de un dispositivo: decodifica, reordena y guarda en columnas. La usa un solo hilo a la vez
+ */
+class IngestorDispositivo {
+public:
+  IngestorDispositivo(uint32_t dispositivo, EscritorColumnar *escritor, ConsumidorHuecos alHueco);
+
+  /**
+   * Funcion que procesa un trozo del flujo de telemetria del puerto serial (tramas COBS terminadas en 0x00)
+   */
+  void procesarFlujo(const uint8_t *datos, size_t len);
+
+  /**
+   * Funcion que procesa un paquete de LoRa recibido por el gateway
+   */
+  void procesarPaquete(const uint8_t *paquete, size_t len);
+
+  /**
+   * Funcion que entrega lo que quedo en las ventanas y escribe las columnas incompletas
+   */
+  void terminar();
+
+  uint32_t dispositivo() const { return id; }
+  const EstadisticasIngesta &estadisticas() const { return contadores; }
+
+private:
+  struct PaqueteDecodificado {
+    EncabezadoPaquete encabezado;
+    uint16_t valores[PAQUETE_CARGA_MAX];
+  };
+
+  void guardarTrama(const TramaTelemetria &trama);
+  void guardarPaquete(const PaqueteDecodificado &paquete);
+  uint64_t desenvolver(GrupoColumnas &grupo, uint32_t marcaTiempo);
+  void escribirGrupo(GrupoColumnas &grupo);
+  void reportarHueco(uint8_t fuente, uint16_t desde, uint32_t cantidad, uint64_t marcaTiempo);
+
+  uint32_t id;
+  EscritorColumnar *escritor;
+  ConsumidorHuecos consumidorHuecos;
+  EstadisticasIngesta contadores;
+  uint8_t recibido[TELEMETRIA_TAM_MAX_TEXTO];  // Trama del flujo en construccion (de telemetria o de texto)
+  size_t indice;
+  bool desbordado;
+  std::unique_ptr<Reordenador<TramaTelemetria, PASARELA_VENTANA_TRAMAS>> ordenTramas;  // Se crean con la primera trama o paquete
+  std::unique_ptr<Reordenador<PaqueteDecodificado, PASARELA_VENTANA_PAQUETES>> ordenPaquetes;
+  std::unique_ptr<GrupoColumnas> telemetria;
+  std::unique_ptr<GrupoColumnas> lora;
+  std::unique_ptr<GrupoColumnas> loraSinFiltrar;  // No se mezcla con el EKG filtrado de lora
+  std::unique_ptr<PaqueteDecodificado> decodificado;
+};
+
+/**
+ * Pasarela de paquetes de muchos dispositivos: un productor (el hilo que recibe del gateway) los
+ * entrega y cada uno va a la cola del hilo al que le toca su dispositivo
+ */
+class Pasarela {
+public:
+  Pasarela(EscritorColumnar *escritor, ConsumidorHuecos alHueco);
+  ~Pasarela();
+
+  /**
+   * Funcion que arranca los hilos
+   * @return false si no se pudo crear alguno
+   */
+  bool iniciar(size_t hilos);
+
+  /**
+   * Funcion del productor que entrega un paquete de LoRa de un dispositivo
+   * @param esperar true para esperar si la cola del hilo esta llena (un archivo), false para descartarlo (la red)
+   * @return false si se descarto
+   */
+  bool entregar(uint32_t dispositivo, const uint8_t *paquete, size_t len, bool esperar);
+
+  /**
+   * Funcion que espera a que los hilos vacien sus colas, los detiene y termina a todos los dispositivos
+   */
+  void terminar();
+
+  /**
+   * Funcion que suma los contadores de todos los dispositivos (despues de terminar())
+   */
+  EstadisticasIngesta estadisticas() const;
+
+  /**
+   * Funcion que recorre los dispositivos (despues de terminar())
+   */
+  template <typename F>
+  void paraCadaDispositivo(F f) const {
+    for (const std::unique_ptr<Hilo> &h : hilos)
+      for (const auto &d : h->dispositivos) f(*d.second);
+  }
+
+  uint64_t descartados;  // Paquetes descartados porque la cola de su hilo estaba llena
+
+private:
+  struct Recibido {
+    uint32_t dispositivo;
+    uint16_t len;
+    uint8_t datos[PAQUETE_CARGA_MAX];
+  };
+  struct Hilo {
+    BufferCircular<Recibido, PASARELA_COLA_HILO> cola;
+    std::unordered_map<uint32_t, std::unique_ptr<IngestorDispositivo>> dispositivos;
+    std::thread hilo;
+  };
+
+  void atender(Hilo &hilo);
+
+  EscritorColumnar *escritor;
+  ConsumidorHuecos consumidorHuecos;
+  std::vector<std::unique_ptr<Hilo>> hilos;
+  std::atomic<bool> corriendo;
+  Recibido entrante;  // Del productor (solo hay uno)
+};
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libplanificador.h"
+#include <stdio.h>
+#include <atomic>
+
+/**
+ * Trabajo periodico registrado en el planificador
+ */
+struct Trabajo {
+  const char *nombre;
+  ManejadorPeriodico manejador;
+  uint32_t divisor;                  // Solo lo modifica la ISR (o planificadorAgregar() antes de arrancar)
+  std::atomic<uint32_t> divisorNuevo; // Divisor pedido con planificadorCambiarDivisor(), 0 si no hay cambio
+  uint32_t fase;
+  uint8_t hilo;                      // Hilo que lo ejecuta
+  uint64_t proximoTick;              // Siguiente tick en que vence (solo lo usa la ISR)
+  volatile uint64_t liberadoTick;    // Tick de la ultima liberacion (lo escribe la ISR)
+  std::atomic<bool> enCurso;         // El hilo esta ejecutando el manejador
+  volatile uint32_t sobrecargas;     // Solo lo modifica la ISR
+  uint32_t ejecuciones;              // Solo los modifica el hilo
+  uint32_t retrasoMaximoUs;
+  uint32_t duracionMaximaUs;
+};
+
+/**
+ * Hilo que ejecuta los trabajos de un par (nucleo, prioridad)
+ */
+struct Hilo {
+  uint8_t nucleo;
+  uint8_t prioridad;
+  int tarea;
+  std::atomic<uint32_t> pendientes;  // Un bit por trabajo liberado y aun no ejecutado
+  char nombre[16];
+};
+
+static Trabajo trabajos[PLAN_MAX_TRABAJOS];
+static uint8_t numTrabajos = 0;
+static Hilo hilos[PLAN_MAX_HILOS];
+static uint8_t numHilos = 0;
+static bool iniciado = false;
+static uint64_t inicioUs = 0;  // halMicros() cuando el contador de la alarma estaba en cero
+static const uint64_t CUENTAS_POR_TICK = HAL_CUENTAS_ALARMA_POR_SEGUNDO / PLAN_FRECUENCIA_BASE;
+static_assert(HAL_CUENTAS_ALARMA_POR_SEGUNDO % PLAN_FRECUENCIA_BASE == 0,
+              "La base del planificador debe dividir exactamente al reloj de la alarma");
+static_assert(PLAN_MAX_TRABAJOS <= 32, "Las mascaras de pendientes son de 32 bits");
+
+
+static uint32_t mcd(uint32_t a, uint32_t b) {
+  while (b != 0) {
+    uint32_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+
+/**
+ * Funcion que ejecuta los trabajos liberados de un hilo, en el orden en que se registraron
+ */
+static void atender(Hilo &h) {
+  uint32_t pendientes = h.pendientes.exchange(0, std::memory_order_acquire);
+  while (pendientes != 0) {
+    Trabajo &t = trabajos[__builtin_ctz(pendientes)];
+    pendientes &= pendientes - 1;
+    t.enCurso.store(true, std::memory_order_relaxed);
+    uint64_t comienzoUs = halMicros();
+    uint64_t liberadoUs = inicioUs + t.liberadoTick * 1000000u / PLAN_FRECUENCIA_BASE;
+    uint32_t retraso = (comienzoUs > liberadoUs) ? (uint32_t)(comienzoUs - liberadoUs) : 0;
+    t.manejador();
+    uint32_t duracion = (uint32_t)(halMicros() - comienzoUs);
+    t.enCurso.store(false, std::memory_order_release);
+    t.ejecuciones++;
+    if (retraso > t.retrasoMaximoUs) t.retrasoMaximoUs = retraso;
+    if (duracion > t.duracionMaximaUs) t.duracionMaximaUs = duracion;
+  }
+}
+
+/**
+ * Manejador de cada hilo: halTareaEventos() no recibe parametros, asi que hay uno por indice
+ */
+template <uint8_t H>
+static void atenderHilo() {
+  atender(hilos[H]);
+}
+
+static void (*const manejadoresHilo[PLAN_MAX_HILOS])(void) = {atenderHilo<0>, atenderHilo<1>, atenderHilo<2>,
+                                                              atenderHilo<3>};
+
+
+/**
+ * Funcion manejadora de la alarma: libera los trabajos que vencen y programa el siguiente tick.
+ * Si un trabajo no habia terminado su periodo anterior se cuenta como sobrecarga y la
+ * liberacion se fusiona con la pendiente (no se acumula atraso). Esta en IRAM y solo llama a
+ * funciones en IRAM, porque la alarma no se detiene mientras la cache esta apagada
+ */
+static void IRAM_ATTR isrPlanificador() {
+  while (true) {
+    uint64_t ahora = halAlarmaCuenta();
+    uint32_t despertar = 0;  // Un bit por hilo
+    uint64_t siguiente = UINT64_MAX;
+    for (uint8_t i = 0; i < numTrabajos; i++) {
+      Trabajo &t = trabajos[i];
+      if (t.proximoTick * CUENTAS_POR_TICK <= ahora) {
+        Hilo &h = hilos[t.hilo];
+        if ((h.pendientes.load(std::memory_order_relaxed) & (1u << i)) || t.enCurso.load(std::memory_order_relaxed))
+          t.sobrecargas++;
+        uint64_t liberado = t.proximoTick;
+        uint32_t nuevo = t.divisorNuevo.exchange(0, std::memory_order_relaxed);
+        if (nuevo != 0) t.divisor = nuevo;  // Se cambia en una liberacion: el periodo que empieza ya es el nuevo
+        t.proximoTick += t.divisor;
+        while (t.proximoTick * CUENTAS_POR_TICK <= ahora) {  // Periodos completos que ya pasaron sin atender
+          liberado = t.proximoTick;
+          t.proximoTick += t.divisor;
+          t.sobrecargas++;
+        }
+        t.liberadoTick = liberado;
+        h.pendientes.fetch_or(1u << i, std::memory_order_release);
+        despertar |= 1u << t.hilo;
+      }
+      if (t.proximoTick < siguiente) siguiente = t.proximoTick;
+    }
+    for (uint8_t h = 0; h < numHilos; h++)
+      if (despertar & (1u << h)) halNotificar(hilos[h].tarea);
+    if (siguiente * CUENTAS_POR_TICK > halAlarmaCuenta() + PLAN_MARGEN_CUENTAS) {
+      halAlarmaProgramar(siguiente * CUENTAS_POR_TICK);
+      return;
+    }
+    // El siguiente tick esta tan cerca que la alarma podria quedar en el pasado antes de escribirla
+  }
+}
+
+
+int planificadorAgregar(const char *nombre, ManejadorPeriodico manejador, uint32_t divisor, uint8_t prioridad,
+                        uint8_t nucleo) {
+  if (iniciado || numTrabajos >= PLAN_MAX_TRABAJOS || manejador == NULL || divisor == 0) return -1;
+  uint8_t h = 0;
+  while (h < numHilos && !(hilos[h].nucleo == nucleo && hilos[h].prioridad == prioridad)) h++;
+  if (h == numHilos) {
+    if (numHilos >= PLAN_MAX_HILOS) return -1;
+    hilos[h].nucleo = nucleo;
+    hilos[h].prioridad = prioridad;
+    hilos[h].tarea = -1;
+    hilos[h].pendientes.store(0);
+    numHilos++;
+  }
+  Trabajo &t = trabajos[numTrabajos];
+  t.nombre = nombre;
+  t.manejador = manejador;
+  t.divisor = divisor;
+  t.divisorNuevo.store(0);
+  t.fase = 0;
+  t.hilo = h;
+  t.enCurso.store(false);
+  t.sobrecargas = 0;
+  t.ejecuciones = 0;
+  t.retrasoMaximoUs = 0;
+  t.duracionMaximaUs = 0;
+  return numTrabajos++;
+}
+
+
+bool planificadorCambiarDivisor(int trabajo, uint32_t divisor) {
+  if (trabajo < 0 || trabajo >= numTrabajos || divisor == 0) return false;
+  trabajos[trabajo].divisorNuevo.store(divisor, std::memory_order_relaxed);
+  return true;
+}
+
+
+uint32_t planificadorDivisor(uint32_t frecuenciaHz) {
+  if (frecuenciaHz == 0) return 0;
+  uint32_t divisor = (PLAN_FRECUENCIA_BASE + frecuenciaHz / 2) / frecuenciaHz;
+  return (divisor == 0) ? 1 : divisor;
+}
+
+
+/**
+ * Funcion que asigna las fases. Dos trabajos de divisores d1, d2 y fases f1, f2 coinciden en el
+ * mismo tick solo si f1 y f2 son congruentes modulo mcd(d1, d2), y en ese caso lo hacen una vez
+ * cada mcm(d1, d2) ticks. Empezando por los de mayor tasa, a cada trabajo se le da la fase con
+ * menos coincidencias por segundo contra los ya colocados (en un empate, la menor)
+ */
+static void asignarFases() {
+  bool colocado[PLAN_MAX_TRABAJOS] = {};
+  for (uint8_t n = 0; n < numTrabajos; n++) {
+    uint8_t j = 0;
+    while (colocado[j]) j++;
+    for (uint8_t i = j + 1; i < numTrabajos; i++)
+      if (!colocado[i] && trabajos[i].divisor < trabajos[j].divisor) j = i;
+    Trabajo &t = trabajos[j];
+    double mejorCosto = 0;
+    for (uint32_t f = 0; f < t.divisor; f++) {
+      double costo = 0;
+      for (uint8_t k = 0; k < numTrabajos; k++) {
+        if (!colocado[k]) continue;
+        uint32_t g = mcd(t.divisor, trabajos[k].divisor);
+        if (f % g == trabajos[k].fase % g) costo += 1.0 / ((double)t.divisor / g * trabajos[k].divisor);
+      }
+      if (f == 0 || costo < mejorCosto) {
+        mejorCosto = costo;
+        t.fase = f;
+      }
+      if (costo == 0) break;
+    }
+    colocado[j] = true;
+  }
+}
+
+
+bool iniciarPlanificador(uint8_t timer) {
+  if (iniciado || numTrabajos == 0) return false;
+  asignarFases();
+  for (uint8_t h = 0; h < numHilos; h++) {
+    snprintf(hilos[h].nombre, sizeof(hilos[h].nombre), "Plan n%u p%u", hilos[h].nucleo, hilos[h].prioridad);
+    // La espera maxima es solo un respaldo: los hilos los despierta la ISR
+    hilos[h].tarea = halTareaEventos(manejadoresHilo[h], 1000000, hilos[h].nombre, hilos[h].prioridad, hilos[h].nucleo);
+    if (hilos[h].tarea < 0) return false;
+  }
+  uint64_t primero = UINT64_MAX;
+  for (uint8_t i = 0; i < numTrabajos; i++) {
+    // El tick 0 no se usa para que la primera alarma no quede en el pasado al arrancar el timer
+    trabajos[i].proximoTick = trabajos[i].divisor + trabajos[i].fase;
+    trabajos[i].liberadoTick = 0;
+    if (trabajos[i].proximoTick < primero) primero = trabajos[i].proximoTick;
+  }
+  iniciado = true;
+  if (!halAlarmaIniciar(timer, isrPlanificador)) {
+    iniciado = false;
+    return false;
+  }
+  inicioUs = halMicros();
+  halAlarmaProgramar(primero * CUENTAS_POR_TICK);
+  return true;
+}
+
+
+size_t trabajosPlanificador() {
+  return numTrabajos;
+}
+
+
+bool estadisticasTrabajo(int trabajo, EstadisticasTrabajo &estadisticas) {
+  if (trabajo < 0 || trabajo >= numTrabajos) return false;
+  const Trabajo &t = trabajos[trabajo];
+  estadisticas.nombre = t.nombre;
+  estadisticas.divisor = t.divisor;
+  estadisticas.fase = t.fase;
+  estadisticas.ejecuciones = t.ejecuciones;
+  estadisticas.sobrecargas = t.sobrecargas;
+  estadisticas.retrasoMaximoUs = t.retrasoMaximoUs;
+  estadisticas.duracionMaximaUs = t.duracionMaximaUs;
+  return true;
+}
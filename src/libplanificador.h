@@ -0,0 +1,108 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBPLANIFICADOR_H
+#define LIBPLANIFICADOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libhal.h"
+
+// Planificador de muestreo multitasa: un solo timer de hardware marca una base de tiempo de
+// PLAN_FRECUENCIA_BASE ticks por segundo y cada trabajo periodico corre cada 'divisor' ticks,
+// asi todas las tasas (ADC, giroscopio, ...) quedan amarradas al mismo reloj en vez de que cada
+// subsistema gaste un timer que deriva por su cuenta. El timer no interrumpe en cada tick: la
+// alarma se programa directamente en el siguiente tick en que vence algun trabajo. La ISR solo
+// marca los trabajos que vencen y despierta al hilo que los ejecuta; hay un hilo por cada par
+// (nucleo, prioridad), de modo que la afinidad y la prioridad de cada trabajo las respeta FreeRTOS.
+// A cada trabajo se le asigna una fase fija (en ticks) que minimiza las coincidencias con los
+// demas, y eso hace deterministico el orden de ejecucion entre arranques.
+
+#define PLAN_FRECUENCIA_BASE 6400  // Ticks por segundo: multiplo comun de 256 Hz (ADC), 200 Hz y 100 Hz
+#define PLAN_MAX_TRABAJOS 8        // Trabajos periodicos que se pueden registrar
+#define PLAN_MAX_HILOS 4           // Combinaciones distintas de (nucleo, prioridad)
+#define PLAN_MARGEN_CUENTAS 80     // Si el siguiente tick queda a menos de 2 us la ISR lo espera sin salir
+
+/**
+ * Contadores de un trabajo del planificador
+ */
+struct EstadisticasTrabajo {
+  const char *nombre;         // Nombre con el que se registro
+  uint32_t divisor;           // Ticks entre ejecuciones
+  uint32_t fase;              // Tick (modulo divisor) en que se ejecuta
+  uint32_t ejecuciones;       // Veces que se ejecuto el manejador
+  uint32_t sobrecargas;       // Periodos en que el trabajo vencio sin haber terminado el anterior
+  uint32_t retrasoMaximoUs;   // Mayor tiempo entre el tick que lo libero y el inicio del manejador
+  uint32_t duracionMaximaUs;  // Mayor duracion del manejador
+};
+
+/**
+ * Funcion que registra un trabajo periodico. Se debe llamar antes de iniciarPlanificador()
+ * @param nombre Nombre del trabajo (debe seguir existiendo, se guarda el apuntador)
+ * @param manejador Funcion a ejecutar en cada periodo
+ * @param divisor Ticks de la base entre ejecuciones: la frecuencia es PLAN_FRECUENCIA_BASE / divisor
+ * @param prioridad Prioridad del hilo que lo ejecuta
+ * @param nucleo Nucleo al que se fija el hilo que lo ejecuta
+ * @return Identificador del trabajo, o -1 si no se pudo registrar
+ */
+int planificadorAgregar(const char *nombre, ManejadorPeriodico manejador, uint32_t divisor, uint8_t prioridad,
+                        uint8_t nucleo);
+
+/**
+ * Funcion que cambia el divisor de un trabajo con el planificador andando. El periodo en curso
+ * termina con el divisor anterior y el siguiente empieza con el nuevo, asi que no se pierde ni se
+ * repite ninguna ejecucion (la fase queda donde cayo la ultima liberacion)
+ * @param trabajo Identificador devuelto por planificadorAgregar()
+ * @param divisor Nuevo numero de ticks entre ejecuciones
+ * @return false si el identificador o el divisor no son validos
+ */
+bool planificadorCambiarDivisor(int trabajo, uint32_t divisor);
+
+/**
+ * Funcion que calcula el divisor que corresponde a una frecuencia
+ * @param frecuenciaHz Frecuencia deseada en Hz
+ * @return Divisor (redondeado al mas cercano, minimo 1). La frecuencia es exacta si divide a PLAN_FRECUENCIA_BASE
+ */
+uint32_t planificadorDivisor(uint32_t frecuenciaHz);
+
+/**
+ * Funcion que asigna las fases, crea los hilos y arranca el timer del planificador
+ * @param timer Numero del timer de hardware que usa
+ * @return true si todos los trabajos quedaron funcionando
+ */
+bool iniciarPlanificador(uint8_t timer);
+
+/**
+ * Funcion que da el numero de trabajos registrados
+ */
+size_t trabajosPlanificador();
+
+/**
+ * Funcion que copia los contadores de un trabajo
+ * @param trabajo Identificador devuelto por planificadorAgregar()
+ * @param estadisticas Donde se copian los contadores
+ * @return false si el identificador no es valido
+ */
+bool estadisticasTrabajo(int trabajo, EstadisticasTrabajo &estadisticas);
+
+#endif
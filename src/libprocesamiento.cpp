@@ -0,0 +1,358 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libprocesamiento.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include "libhal.h"
+#include "libtelemetria.h"
+#include "libtransmisorlora.h"
+#include "libfusion.h"
+#include "libbitacora.h"
+#include "libetapas.h"
+#include "libtasa.h"
+#include "libcaptura.h"
+
+uint8_t voltajeSalida = 0;   // Variable que almacena el voltaje que sera sacado por el canal DAC1
+
+static void alimentarFusion(const MuestraADC &muestra);
+static void despacharPaquete(const PaqueteCodificado &paquete);
+static void despacharLatido(const EventoLatido &latido);
+static void despacharEspectro(const RegistroEspectro &registro);
+static void guardarPrevia(const MuestraADC &muestra);
+static void aplicarCambioTasa(const CambioTasa &cambio);
+
+// Camino de la muestra, armado al compilar: calibracion -> copia a la fusion -> analisis espectral ->
+// filtro del EKG -> detector de latidos -> empaquetado LoRa -> transmisor o bitacora. Para otra
+// placa o producto basta con cambiar las etapas
+typedef Cadena<EtapaCalibracionADC<SAMPLING_FREQ>,
+               EtapaDerivacion<MuestraADC, SAMPLING_FREQ, alimentarFusion>,
+               EtapaEspectro<SAMPLING_FREQ, SIZE_BUF, despacharEspectro>,
+               EtapaFiltroEKG<SAMPLING_FREQ>,
+               EtapaDetectorQRS<SAMPLING_FREQ, despacharLatido>,
+               EtapaEmpaquetadoLoRa<SAMPLING_FREQ>,
+               EtapaSumidero<PaqueteCodificado, FRECUENCIA_EVENTOS, despacharPaquete>> CadenaEKG;
+#define ETAPA_ESPECTRO 2     // Indices de las etapas de CadenaEKG que se configuran o consultan
+#define ETAPA_FILTRO 3
+#define ETAPA_QRS 4
+#define ETAPA_EMPAQUETADO 5
+
+// Camino de la muestra en reposo (tasa adaptativa, libtasa.h): solo calibracion y fusion, y las
+// muestras se guardan en la historia previa que se envia al volver la actividad
+#define FRECUENCIA_REPOSO (SAMPLING_FREQ / TASA_DIVISOR_REPOSO)
+typedef Cadena<EtapaCalibracionADC<FRECUENCIA_REPOSO>,
+               EtapaDerivacion<MuestraADC, FRECUENCIA_REPOSO, alimentarFusion>,
+               EtapaSumidero<MuestraADC, FRECUENCIA_REPOSO, guardarPrevia>> CadenaReposo;
+#define PREVIAS_REPOSO (FRECUENCIA_REPOSO * TASA_PREVIO_MS / 1000)
+
+CadenaEKG cadenaEKG;
+CadenaReposo cadenaReposo;
+EmpaquetadorLatidos empaquetadorLatidos; // Los latidos van en sus propios paquetes, mucho mas pequeños
+EmpaquetadorEspectro empaquetadorEspectro; // Y las potencias de las bandas en otros
+bool radioActivo = false;
+bool salidaMilivoltios = false;    // La cadena convierte a milivoltios (para marcar la telemetria)
+FusionadorSensores fusionador;     // Alinea el giroscopio y el GPS a las muestras del ADC
+ConsumidorRegistros consumidorRegistros = NULL;
+uint32_t ultimaPublicacionGPS = 0;
+CambiarFrecuenciaADC cambiarFrecuenciaADC = NULL; // NULL: tasa fija
+ControladorTasa controladorTasa;
+MuestraADC previas[PREVIAS_REPOSO];  // Historia a la tasa de reposo (anillo)
+uint32_t posPrevias = 0;
+uint32_t numPrevias = 0;
+uint16_t secuenciaTasa = 0;
+uint64_t marcaCambioTasa = 0;        // Instante del ultimo cambio de tasa
+
+
+void iniciarProcesamiento(bool transmitirPorRadio, const TablaCalibracion *calibracion, bool soloAnomalias) {
+  radioActivo = transmitirPorRadio;
+  salidaMilivoltios = calibracion != NULL;
+  if (radioActivo) fuenteRespaldoLoRa(siguienteRegistroBitacora, registroBitacoraEnviado); // Lo guardado se reenvia al volver el enlace
+  cadenaEKG.etapa<0>().tablas = calibracion;
+  cadenaReposo.etapa<0>().tablas = calibracion;
+  cadenaEKG.etapa<ETAPA_ESPECTRO>().reiniciar();
+  cadenaEKG.etapa<ETAPA_FILTRO>().reiniciar();
+  cadenaEKG.etapa<ETAPA_QRS>().reiniciar(soloAnomalias);
+  empaquetadorLatidos.iniciar();
+  empaquetadorEspectro.iniciar(cadenaEKG.etapa<ETAPA_ESPECTRO>().PERIODO_MS);
+  cadenaEKG.etapa<ETAPA_EMPAQUETADO>().iniciar(CANALES_LORA, salidaMilivoltios);
+}
+
+
+void iniciarTasaAdaptativa(CambiarFrecuenciaADC cambiar) {
+  cambiarFrecuenciaADC = cambiar;
+  controladorTasa.configurar(SAMPLING_FREQ, FRECUENCIA_REPOSO);
+  posPrevias = numPrevias = 0;
+  marcaCambioTasa = 0;
+}
+
+
+void procesarMuestra(const MuestraADC &muestra) {
+  etapaCadena(muestra);
+
+  /****DAC - Sacando valores analogos por el canal DAC1****/
+  // Sacar un valor de voltaje por el canal DAC1
+  // dac_output_enable(DAC_CHANNEL_1);                  //Habilitamos el DAC canal 1
+  // dac_output_voltage(DAC_CHANNEL_1, voltajeSalida);  //Sacamos el voltaje en el DAC canal 1
+
+  etapaFusion();
+}
+
+
+void alRegistroFusionado(ConsumidorRegistros consumidor) {
+  consumidorRegistros = consumidor;
+}
+
+
+void etapaCadena(const MuestraADC &muestra) {
+  capturarAdc(muestra);  // La muestra cruda, antes de la calibracion
+  if (!cambiarFrecuenciaADC) {
+    cadenaEKG.procesar(muestra);
+    voltajeSalida = cadenaEKG.etapa<ETAPA_FILTRO>().salidaDAC;
+    return;
+  }
+  controladorTasa.agregarAdc(aDoceBits(muestra.x, muestra.bits));
+  if (controladorTasa.enReposo()) {
+    cadenaReposo.procesar(muestra);
+  } else {
+    cadenaEKG.procesar(muestra);
+    voltajeSalida = cadenaEKG.etapa<ETAPA_FILTRO>().salidaDAC;
+  }
+  CambioTasa cambio;
+  if (controladorTasa.revisar(muestra.marcaTiempo, cambio)) aplicarCambioTasa(cambio);
+}
+
+
+/**
+ * Sumidero de la cadena de reposo: la muestra calibrada queda en la historia previa
+ */
+static void guardarPrevia(const MuestraADC &muestra) {
+  previas[posPrevias] = muestra;
+  posPrevias = (posPrevias + 1) % PREVIAS_REPOSO;
+  if (numPrevias < PREVIAS_REPOSO) numPrevias++;
+}
+
+
+/**
+ * Funcion que lleva a cabo un cambio de tasa decidido por el controlador: reprograma la adquisicion,
+ * marca el cambio en el flujo LoRa con un paquete 0xB5 y prepara la cadena que sigue. Al bajar se
+ * cierran los paquetes a medio llenar; al subir se envia la historia previa (a la tasa de reposo,
+ * con su propio periodo en el encabezado, y como PAQUETE_TIPO_*_SIN_FILTRAR porque a esa tasa no
+ * pasa por el filtro del EKG) y las etapas con memoria empiezan de cero, porque el hueco en la
+ * señal las dejaria con un estado que ya no corresponde. Si la adquisicion no acepta la nueva
+ * frecuencia el cambio se cancela y la cadena sigue a la tasa anterior
+ */
+static void aplicarCambioTasa(const CambioTasa &cambio) {
+  if (!cambiarFrecuenciaADC(cambio.frecuenciaHz)) {  // Se aplica al final del periodo en curso
+    controladorTasa.cancelar(cambio);
+    return;
+  }
+  marcaCambioTasa = cambio.marcaTiempo;
+  EmpaquetadorMuestras &empaquetador = cadenaEKG.etapa<ETAPA_EMPAQUETADO>().empaquetador;
+  if (controladorTasa.enReposo()) {
+    if (empaquetador.cerrar()) despacharPaquete(PaqueteCodificado{empaquetador.paquete(), empaquetador.tamano()});
+    if (empaquetadorLatidos.cerrar()) despacharPaquete(PaqueteCodificado{empaquetadorLatidos.paquete(), empaquetadorLatidos.tamano()});
+    if (empaquetadorEspectro.cerrar()) despacharPaquete(PaqueteCodificado{empaquetadorEspectro.paquete(), empaquetadorEspectro.tamano()});
+    posPrevias = numPrevias = 0;
+  }
+  static uint8_t marca[TASA_TAM_PAQUETE];
+  despacharPaquete(PaqueteCodificado{marca, codificarCambioTasa(cambio, secuenciaTasa++, marca)});
+  if (controladorTasa.enReposo()) return;
+
+  const uint32_t periodoReposo = 1000000 / FRECUENCIA_REPOSO;
+  empaquetador.cambiarPeriodo(periodoReposo);
+  empaquetador.marcarSinFiltrar(true);
+  uint64_t anterior = 0;
+  for (uint32_t k = 0; k < numPrevias; k++) {  // De la mas vieja a la mas nueva
+    const MuestraADC &muestra = previas[(posPrevias + PREVIAS_REPOSO - numPrevias + k) % PREVIAS_REPOSO];
+    uint64_t hueco = muestra.marcaTiempo - anterior;  // Una muestra fuera de la rejilla empieza otro paquete
+    if (anterior && (hueco > periodoReposo * 3 / 2 || hueco < periodoReposo / 2) && empaquetador.cerrar())
+      despacharPaquete(PaqueteCodificado{empaquetador.paquete(), empaquetador.tamano()});
+    anterior = muestra.marcaTiempo;
+    // En 12 bits como las de la cadena del EKG (con sobremuestreo la calibracion deja 16)
+    uint16_t valores[3] = {aDoceBits(muestra.x, muestra.bits), aDoceBits(muestra.y, muestra.bits), aDoceBits(muestra.z, muestra.bits)};
+    if (empaquetador.agregar(valores, (uint32_t)muestra.marcaTiempo))
+      despacharPaquete(PaqueteCodificado{empaquetador.paquete(), empaquetador.tamano()});
+  }
+  posPrevias = numPrevias = 0;
+  if (empaquetador.marcarSinFiltrar(false)) despacharPaquete(PaqueteCodificado{empaquetador.paquete(), empaquetador.tamano()});
+  if (empaquetador.cambiarPeriodo(1000000 / SAMPLING_FREQ)) despacharPaquete(PaqueteCodificado{empaquetador.paquete(), empaquetador.tamano()});
+  cadenaEKG.etapa<ETAPA_ESPECTRO>().reiniciar();
+  cadenaEKG.etapa<ETAPA_FILTRO>().reiniciar();
+  cadenaEKG.etapa<ETAPA_QRS>().reanudar();
+}
+
+
+/**
+ * Funcion de la derivacion de la cadena: la muestra calibrada (sin filtrar) entra a la fusion en 12 bits
+ */
+static void alimentarFusion(const MuestraADC &muestra) {
+  MuestraADC adc = muestra;  // Los registros fusionados y la telemetria llevan 12 bits
+  adc.x = aDoceBits(muestra.x, muestra.bits);
+  adc.y = aDoceBits(muestra.y, muestra.bits);
+  adc.z = aDoceBits(muestra.z, muestra.bits);
+  adc.bits = 12;
+  fusionador.agregarAdc(adc);
+}
+
+
+/**
+ * Sumidero de la cadena, decide a donde va un paquete cerrado: al transmisor si el enlace esta arriba
+ * y no hay respaldo pendiente (para no adelantarse a lo guardado), y si no a la bitacora. Sin
+ * bitacora se encola de todas formas y, si la cola esta llena, se descarta y se cuenta. Solo se
+ * copia a una cola, no se espera al radio ni a la flash
+ */
+static void despacharPaquete(const PaqueteCodificado &paquete) {
+  if (radioActivo && radioLoRaListo() && espacioColaLoRa() > 0 && !bitacoraPendiente()) encolarPaqueteLoRa(paquete.datos, paquete.len);
+  else if (!guardarEnBitacora(paquete.datos, paquete.len) && radioActivo) encolarPaqueteLoRa(paquete.datos, paquete.len);
+}
+
+
+/**
+ * Funcion que recibe los latidos del detector: se juntan en un paquete de latidos que sale por el
+ * mismo camino que los de muestras
+ */
+static void despacharLatido(const EventoLatido &latido) {
+  if (empaquetadorLatidos.agregar(latido)) despacharPaquete(PaqueteCodificado{empaquetadorLatidos.paquete(), empaquetadorLatidos.tamano()});
+}
+
+
+/**
+ * Funcion que recibe los registros del analisis espectral: se juntan en un paquete que sale por el
+ * mismo camino que los de muestras
+ */
+static void despacharEspectro(const RegistroEspectro &registro) {
+  if (empaquetadorEspectro.agregar(registro)) despacharPaquete(PaqueteCodificado{empaquetadorEspectro.paquete(), empaquetadorEspectro.tamano()});
+}
+
+
+void etapaFusion() {
+  // Sin I2C: solo se recogen las muestras que la tarea del giroscopio ya leyo de la FIFO
+  MuestraGiroscopio giro[16];
+  size_t n;
+  while ((n = leerMuestrasGiroscopio(giro, 16)) > 0)
+    for (size_t i = 0; i < n; i++) {
+      fusionador.agregarGiroscopio(giro[i]);
+      capturarGiroscopio(giro[i]);
+      if (cambiarFrecuenciaADC) controladorTasa.agregarGiroscopio(giro[i]);
+    }
+  RegistroGPS fix;
+  uint32_t publicacion = leerGPS(fix);  // El seqlock nunca bloquea a la tarea del GPS
+  if (publicacion != ultimaPublicacionGPS) {
+    ultimaPublicacionGPS = publicacion;
+    fusionador.agregarGPS(fix);
+  }
+  RegistroFusionado registro;
+  while (fusionador.extraer(halMicros(), registro)) {
+    etapaTelemetria(registro);
+    if (consumidorRegistros) consumidorRegistros(registro);
+  }
+}
+
+
+void etapaTelemetria(const RegistroFusionado &registro) {
+  if (capturaActiva()) return;  // La salida es de la captura
+#ifdef SALIDA_TEXTO_DEPURACION
+  // Datos del giroscopio y acelerometro para verlos en el SerialPlot (sin String para no fragmentar el heap)
+  static char linea[64];
+  int len = snprintf(linea, sizeof(linea), "%u\t%u\t%u\t%d\t%d\t%d\r\n", registro.adc[0], registro.adc[1], registro.adc[2],
+                     registro.giro[0], registro.giro[1], registro.giro[2]);
+  halSalida((const uint8_t *)linea, len);
+#else
+  // Trama binaria de telemetria (22 bytes en vez de ~30 caracteres), codificada en un buffer preasignado
+  static uint8_t tramaCodificada[TELEMETRIA_TAM_MAX];
+  static uint16_t secuencia = 0;
+  TramaTelemetria trama;
+  trama.secuencia = secuencia++;
+  trama.marcaTiempo = (uint32_t)registro.marcaTiempo;  // Los 32 bits bajos de la base de tiempo
+  trama.milivoltios = salidaMilivoltios;
+  if (cambiarFrecuenciaADC)  // El registro puede ser de antes del ultimo cambio (la fusion espera al giroscopio)
+    trama.reposo = (registro.marcaTiempo > marcaCambioTasa) ? controladorTasa.enReposo() : !controladorTasa.enReposo();
+  for (uint8_t i = 0; i < 3; i++) {
+    trama.adc[i] = registro.adc[i];
+    trama.gyro[i] = registro.giro[i];
+  }
+  halSalida(tramaCodificada, codificarTrama(trama, tramaCodificada));
+#endif
+}
+
+
+void enviarTextoDiagnostico(const char *texto, size_t len) {
+  if (capturaActiva()) return;  // La salida es de la captura
+  uint8_t trama[TELEMETRIA_TAM_MAX_TEXTO];
+  while (len > 0) {
+    size_t linea = 0;  // Una trama por linea (sin el salto), partida si pasa de TELEMETRIA_TEXTO_MAX
+    while (linea < len && linea < TELEMETRIA_TEXTO_MAX && texto[linea] != '\n') linea++;
+    size_t util = linea;
+    while (util > 0 && texto[util - 1] == '\r') util--;
+    if (util > 0) halSalida(trama, codificarTexto(texto, util, trama));  // Una sola escritura: no se intercala con la telemetria
+    if (linea < len && texto[linea] == '\n') linea++;
+    texto += linea;
+    len -= linea;
+  }
+}
+
+
+void enviarDiagnostico(const char *formato, ...) {
+  char texto[2 * TELEMETRIA_TEXTO_MAX];
+  va_list argumentos;
+  va_start(argumentos, formato);
+  int len = vsnprintf(texto, sizeof(texto), formato, argumentos);
+  va_end(argumentos);
+  if (len <= 0) return;
+  enviarTextoDiagnostico(texto, ((size_t)len < sizeof(texto)) ? (size_t)len : sizeof(texto) - 1);
+}
+
+
+const EmpaquetadorMuestras &empaquetadorLoRa() {
+  return cadenaEKG.etapa<ETAPA_EMPAQUETADO>().empaquetador;
+}
+
+
+const EmpaquetadorLatidos &empaquetadorLatidosLoRa() {
+  return empaquetadorLatidos;
+}
+
+
+uint32_t fragmentosAnomalias() {
+  return cadenaEKG.etapa<ETAPA_QRS>().fragmentos;
+}
+
+
+const EmpaquetadorEspectro &empaquetadorEspectroLoRa() {
+  return empaquetadorEspectro;
+}
+
+
+EstadisticasFusion estadisticasFusion() {
+  return fusionador.estadisticas();
+}
+
+
+uint32_t muestrasPerdidasProcesamiento() {
+  return fusionador.estadisticas().descartadasAdc;
+}
+
+
+const ControladorTasa &controladorTasaAdaptativa() {
+  return controladorTasa;
+}
@@ -0,0 +1,190 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBPROCESAMIENTO_H
+#define LIBPROCESAMIENTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libempaquetador.h"
+
+// Camino de procesamiento de las muestras: cadena calibracion -> filtro -> detector de latidos ->
+// transmision por LoRa (libetapas.h), y fusion con el giroscopio y el GPS -> telemetria y consumidores de registros fusionados. Solo depende de la HAL, asi que el mismo codigo corre en el ESP32 (main.cpp) y en el
+// simulador del computador (simulador.cpp).
+
+#define SAMPLING_FREQ 256 // En Hz, escoge la frecuencia de muestreo
+#define SIZE_BUF 256      // Muestras de la ventana del analisis espectral (potencia de 2, 1 s a 256 Hz)
+#define CANALES_LORA 1         // Canales por LoRa: 1 solo el EKG filtrado, 3 tambien y, z crudos (a SF7 y 256Hz no caben en el aire)
+#define LORA_SF 7              // Factor de dispersion del radio (el de la libreria LoRa por defecto)
+#define LORA_ANCHO_BANDA 125E3 // Ancho de banda del radio en Hz
+#define LORA_CR 1              // Tasa de codigo 4/(4 + LORA_CR)
+#define FRECUENCIA_RED 60  // Frecuencia de la red electrica en Hz (50 o 60) que elimina el filtro notch
+#define CORTE_LINEA_BASE 0.5 // Frecuencia de corte en Hz del pasa altos que remueve la deriva de la linea base
+#define CORTE_PASA_BAJOS 40  // Frecuencia de corte en Hz del pasa bajos (con el pasa altos forman el pasa banda del EKG)
+#define FACTOR_SOBREMUESTREO 32 // Muestras del ADC por muestra de salida en la adquisicion con sobremuestreo (potencia de 2, 16 a 64)
+#define ETAPAS_CIC 3            // Orden del decimador CIC del sobremuestreo (libdecimador.h)
+//#define SALIDA_TEXTO_DEPURACION // Quite el comentario para enviar texto separado por tabuladores (SerialPlot) en vez de tramas binarias
+
+/**
+ * Muestra cruda de los tres canales analogos
+ */
+struct MuestraADC {
+  uint64_t marcaTiempo; // Instante de adquisicion en la base de tiempo comun (halMicros())
+  uint16_t x; // ADC1_7 (IO35)
+  uint16_t y; // ADC1_5 (IO33)
+  uint16_t z; // ADC1_4 (IO32)
+  uint8_t bits = 12; // Resolucion de x, y, z: 12 del ADC, 16 si vienen del decimador del sobremuestreo
+};
+
+/**
+ * Funcion que lleva un valor de una muestra a los 12 bits del ADC (con redondeo)
+ */
+static inline uint16_t aDoceBits(uint16_t valor, uint8_t bits) {
+  if (bits <= 12) return valor;
+  uint32_t v = ((uint32_t)valor + (1u << (bits - 13))) >> (bits - 12);
+  return (uint16_t)(v > 4095 ? 4095 : v);
+}
+
+struct RegistroFusionado;   // libfusion.h
+struct EstadisticasFusion;
+struct TablaCalibracion;    // libcalibracion.h
+
+/**
+ * Consumidor de los registros fusionados, se ejecuta en la tarea del ADC y debe ser corto
+ */
+typedef void (*ConsumidorRegistros)(const RegistroFusionado &registro);
+
+/**
+ * Funcion que reprograma la frecuencia de muestreo del ADC (para la tasa adaptativa)
+ * @return false si la adquisicion no permite cambiarla
+ */
+typedef bool (*CambiarFrecuenciaADC)(int frecuenciaHz);
+
+extern uint8_t voltajeSalida; // Ultima muestra filtrada en 8 bits (el valor que se sacaria por el DAC1)
+
+/**
+ * Funcion que prepara el camino de procesamiento, se usa en el setup()
+ * @param transmitirPorRadio true si los paquetes se encolan en el transmisor LoRa (iniciarTransmisorLoRa())
+ * @param calibracion Tablas de los canales x, y, z (en ese orden) para trabajar en milivoltios, o NULL
+ *                    para conservar las cuentas del ADC. Los paquetes y la telemetria marcan la unidad
+ * @param soloAnomalias true para enviar por LoRa solo los latidos y la señal alrededor de los latidos
+ *                      anomalos, false para enviar los latidos y toda la señal
+ */
+void iniciarProcesamiento(bool transmitirPorRadio, const TablaCalibracion *calibracion = NULL, bool soloAnomalias = false);
+
+/**
+ * Funcion que pasa la muestra por la cadena (filtro y transmision por LoRa) y la fusiona con los demas sensores
+ * @param muestra Muestra recien adquirida
+ */
+void procesarMuestra(const MuestraADC &muestra);
+
+/**
+ * Funcion que activa la tasa de muestreo adaptada a la actividad (libtasa.h). Sin actividad la
+ * adquisicion baja a SAMPLING_FREQ / TASA_DIVISOR_REPOSO, solo se calibra y se fusiona, y la señal
+ * se guarda en una historia de TASA_PREVIO_MS que se envia por LoRa al volver a la tasa alta. Cada
+ * cambio se marca con un paquete 0xB5 y en la bandera de reposo de la telemetria
+ * @param cambiar Funcion que reprograma la frecuencia de la adquisicion (setADCSamplingFreq())
+ */
+void iniciarTasaAdaptativa(CambiarFrecuenciaADC cambiar);
+
+/**
+ * Funcion que fija un consumidor adicional de los registros fusionados (ademas de la telemetria)
+ */
+void alRegistroFusionado(ConsumidorRegistros consumidor);
+
+/**
+ * Etapa de la cadena compuesta al compilar (libetapas.h): calibracion, copia de la muestra a la fusion,
+ * filtro del EKG, detector de latidos y empaquetado LoRa hasta el transmisor o la bitacora
+ */
+void etapaCadena(const MuestraADC &muestra);
+
+/**
+ * Etapa de fusion: recoge las muestras del giroscopio y los fix del GPS que ya publicaron sus tareas,
+ * alinea todo a las muestras del ADC que dejo la cadena y entrega los registros listos a la telemetria
+ * y al consumidor
+ */
+void etapaFusion();
+
+/**
+ * Etapa de telemetria: envia la muestra cruda y el giroscopio de un registro fusionado por halSalida()
+ * (nada mientras la captura de libcaptura.h ocupa la salida)
+ */
+void etapaTelemetria(const RegistroFusionado &registro);
+
+/**
+ * Funcion que envia mensajes de diagnostico por halSalida() en tramas de texto de la telemetria
+ * (TELEMETRIA_SYNC_TEXTO), para no mezclar ASCII suelto con el flujo COBS: una trama por linea, partida
+ * si pasa de TELEMETRIA_TEXTO_MAX. No envia nada mientras la captura ocupa la salida
+ * @param texto Mensaje (una o varias lineas, no necesita terminar en '\0')
+ * @param len Numero de caracteres
+ */
+void enviarTextoDiagnostico(const char *texto, size_t len);
+
+/**
+ * Funcion que da formato a un mensaje de diagnostico como printf() y lo envia con enviarTextoDiagnostico()
+ * (hasta 2 * TELEMETRIA_TEXTO_MAX caracteres)
+ */
+void enviarDiagnostico(const char *formato, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * Funcion que da el empaquetador de la transmision por LoRa (para consultar la compresion)
+ */
+const EmpaquetadorMuestras &empaquetadorLoRa();
+
+class EmpaquetadorLatidos;  // libqrs.h
+
+/**
+ * Funcion que da el empaquetador de los latidos (para consultar cuantos latidos y bytes se enviaron)
+ */
+const EmpaquetadorLatidos &empaquetadorLatidosLoRa();
+
+/**
+ * Funcion que da el numero de fragmentos de señal enviados por latidos anomalos (con soloAnomalias)
+ */
+uint32_t fragmentosAnomalias();
+
+class EmpaquetadorEspectro;  // libespectro.h
+
+/**
+ * Funcion que da el empaquetador de los registros espectrales (bandas del EEG y red electrica)
+ */
+const EmpaquetadorEspectro &empaquetadorEspectroLoRa();
+
+class ControladorTasa;  // libtasa.h
+
+/**
+ * Funcion que da el controlador de la tasa adaptativa (tiempo en reposo y cambios)
+ */
+const ControladorTasa &controladorTasaAdaptativa();
+
+/**
+ * Funcion que da los contadores de la etapa de fusion
+ */
+EstadisticasFusion estadisticasFusion();
+
+/**
+ * Funcion que da el numero de muestras perdidas porque el buffer de la fusion se lleno
+ */
+uint32_t muestrasPerdidasProcesamiento();
+
+#endif
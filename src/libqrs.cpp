@@ -0,0 +1,212 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libqrs.h"
+#include "libempaquetador.h"
+
+/**
+ * Funcion que calcula la raiz cuadrada entera (por defecto) de un numero de 64 bits
+ */
+static uint32_t raizEntera(uint64_t n) {
+  uint64_t raiz = 0;
+  uint64_t bit = (uint64_t)1 << 62;
+  while (bit > n) bit >>= 2;
+  while (bit) {
+    if (n >= raiz + bit) {
+      n -= raiz + bit;
+      raiz = (raiz >> 1) + bit;
+    } else {
+      raiz >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)raiz;
+}
+
+
+AnalizadorRitmo::AnalizadorRitmo() {
+  reiniciar();
+}
+
+
+void AnalizadorRitmo::reiniciar() {
+  hayLatido = false;
+  ultimaMarca = 0;
+  numRR = posRR = 0;
+  sumaRR = 0;
+  sumaCuadradosRR = 0;
+  numDiferencias = posDiferencias = 0;
+  sumaDiferencias = 0;
+  anteriorRR = 0;
+  anomalosSeguidos = 0;
+}
+
+
+void AnalizadorRitmo::agregarIntervalo(uint16_t intervalo) {
+  if (numRR == RITMO_NUM_RR) {  // Sale el intervalo mas viejo de la ventana
+    sumaRR -= rr[posRR];
+    sumaCuadradosRR -= (uint32_t)rr[posRR] * rr[posRR];
+  } else {
+    numRR++;
+  }
+  rr[posRR] = intervalo;
+  sumaRR += intervalo;
+  sumaCuadradosRR += (uint32_t)intervalo * intervalo;
+  posRR = (posRR + 1) % RITMO_NUM_RR;
+  if (anteriorRR) {  // Solo se comparan intervalos normales seguidos
+    int32_t d = (int32_t)intervalo - anteriorRR;
+    if (numDiferencias == RITMO_NUM_RR) sumaDiferencias -= diferencias[posDiferencias];
+    else numDiferencias++;
+    diferencias[posDiferencias] = (uint32_t)(d * d);
+    sumaDiferencias += diferencias[posDiferencias];
+    posDiferencias = (posDiferencias + 1) % RITMO_NUM_RR;
+  }
+  anteriorRR = intervalo;
+}
+
+
+EventoLatido AnalizadorRitmo::agregar(uint64_t marcaTiempo) {
+  EventoLatido latido = {};
+  latido.marcaTiempo = marcaTiempo;
+  latido.clase = LATIDO_NORMAL;
+  if (hayLatido) {
+    uint64_t ms = (marcaTiempo - ultimaMarca + 500) / 1000;
+    latido.rrMs = (uint16_t)(ms > 65535 ? 65535 : ms);
+    if (numRR >= RITMO_MIN_RR) {  // Se compara con el promedio de los ultimos intervalos normales
+      uint32_t promedio = sumaRR / numRR;
+      if ((uint32_t)latido.rrMs * 100 < promedio * (100 - RITMO_TOLERANCIA)) latido.clase = LATIDO_PREMATURO;
+      else if ((uint32_t)latido.rrMs * 100 > promedio * (100 + RITMO_TOLERANCIA)) latido.clase = LATIDO_TARDIO;
+    }
+    if (latido.clase == LATIDO_NORMAL && (latido.rrMs < 60000 / RITMO_FC_MAXIMA || latido.rrMs > 60000 / RITMO_FC_MINIMA))
+      latido.clase = LATIDO_FUERA_DE_RANGO;
+    if (latido.clase == LATIDO_NORMAL || latido.clase == LATIDO_FUERA_DE_RANGO) {
+      anomalosSeguidos = 0;
+      agregarIntervalo(latido.rrMs);
+    } else {
+      anteriorRR = 0;  // El siguiente intervalo no se compara con uno anomalo
+      if (++anomalosSeguidos >= RITMO_MIN_RR) {  // Varios seguidos: el ritmo cambio, se vuelve a empezar el promedio
+        numRR = posRR = numDiferencias = posDiferencias = 0;
+        sumaRR = 0;
+        sumaCuadradosRR = sumaDiferencias = 0;
+        anomalosSeguidos = 0;
+      }
+    }
+  }
+  hayLatido = true;
+  ultimaMarca = marcaTiempo;
+  if (numRR > 0) {
+    latido.frecuenciaDeci = (uint16_t)(600000u * numRR / sumaRR);
+    uint64_t n = numRR;
+    latido.sdnnMs = (uint16_t)raizEntera((n * sumaCuadradosRR - (uint64_t)sumaRR * sumaRR) / (n * n));
+  }
+  if (numDiferencias > 0) latido.rmssdMs = (uint16_t)raizEntera(sumaDiferencias / numDiferencias);
+  return latido;
+}
+
+
+EmpaquetadorLatidos::EmpaquetadorLatidos() {
+  iniciar();
+}
+
+
+void EmpaquetadorLatidos::iniciar(uint8_t latidosPorPaquete) {
+  porPaquete = (latidosPorPaquete == 0) ? 1 : (latidosPorPaquete > LATIDOS_MAX_POR_PAQUETE ? LATIDOS_MAX_POR_PAQUETE : latidosPorPaquete);
+  armador.reiniciar();
+  latidosPaquete = 0;
+  paquetes = latidos = anomalos = 0;
+  bytesPaquetes = 0;
+}
+
+
+bool EmpaquetadorLatidos::agregar(const EventoLatido &latido) {
+  uint32_t ms;
+  if (latidosPaquete == 0) {
+    armador.empezar(PAQUETE_TIPO_LATIDOS, (uint32_t)latido.marcaTiempo, LATIDOS_TAM_ENCABEZADO);
+    primeraMarca = latido.marcaTiempo;
+    ultimoMs = 0;
+    ms = latido.rrMs;
+  } else {
+    // Milisegundos redondeados desde el primer latido: el error no se acumula de un latido a otro
+    uint32_t desdePrimero = (uint32_t)((latido.marcaTiempo - primeraMarca + 500) / 1000);
+    ms = desdePrimero - ultimoMs;
+    ultimoMs = desdePrimero;
+  }
+  uint8_t *p = armador.actual();
+  armador.indice += escribirVarint(&p[armador.indice], (ms << 2) | latido.clase);
+  p[7] = (uint8_t)latido.frecuenciaDeci;  // El resumen es siempre el del ultimo latido
+  p[8] = (uint8_t)(latido.frecuenciaDeci >> 8);
+  p[9] = (uint8_t)latido.sdnnMs;
+  p[10] = (uint8_t)(latido.sdnnMs >> 8);
+  p[11] = (uint8_t)latido.rmssdMs;
+  p[12] = (uint8_t)(latido.rmssdMs >> 8);
+  p[13] = ++latidosPaquete;
+  if (latido.clase != LATIDO_NORMAL) anomalos++;
+  // Un latido anomalo sale enseguida, sin esperar a que se llene el paquete
+  if (latidosPaquete >= porPaquete || latido.clase != LATIDO_NORMAL) return cerrar();
+  return false;
+}
+
+
+bool EmpaquetadorLatidos::cerrar() {
+  if (latidosPaquete == 0) return false;
+  paquetes++;
+  latidos += latidosPaquete;
+  bytesPaquetes += armador.cerrar();
+  latidosPaquete = 0;
+  return true;
+}
+
+
+size_t desempaquetarLatidos(const uint8_t *paquete, size_t len, EncabezadoLatidos &encabezado, EventoLatido *destino, size_t max) {
+  if (len < LATIDOS_TAM_ENCABEZADO + PAQUETE_TAM_CRC || paquete[0] != PAQUETE_TIPO_LATIDOS) return 0;
+  if (!crcPaqueteValido(paquete, len)) return 0;
+  leerEncabezadoPaquete(paquete, encabezado.secuencia, encabezado.marcaTiempo);
+  encabezado.frecuenciaDeci = (uint16_t)(paquete[7] | (paquete[8] << 8));
+  encabezado.sdnnMs = (uint16_t)(paquete[9] | (paquete[10] << 8));
+  encabezado.rmssdMs = (uint16_t)(paquete[11] | (paquete[12] << 8));
+  encabezado.numLatidos = paquete[13];
+  if (encabezado.numLatidos == 0 || encabezado.numLatidos > max) return 0;
+  size_t i = LATIDOS_TAM_ENCABEZADO;
+  size_t fin = len - PAQUETE_TAM_CRC;
+  uint32_t desdePrimero = 0;
+  for (size_t k = 0; k < encabezado.numLatidos; k++) {
+    uint32_t v = 0;
+    uint8_t desplazamiento = 0;
+    do {  // Leemos un varint
+      if (i >= fin || desplazamiento > 28) return 0;
+      v |= (uint32_t)(paquete[i] & 0x7F) << desplazamiento;
+      desplazamiento += 7;
+    } while (paquete[i++] & 0x80);
+    EventoLatido &latido = destino[k];
+    uint32_t ms = v >> 2;
+    if (k > 0) desdePrimero += ms;
+    latido.marcaTiempo = encabezado.marcaTiempo + desdePrimero * 1000;
+    latido.rrMs = (uint16_t)(ms > 65535 ? 65535 : ms);
+    latido.clase = (ClaseLatido)(v & 3);
+    latido.recuperado = false;
+    latido.frecuenciaDeci = encabezado.frecuenciaDeci;
+    latido.sdnnMs = encabezado.sdnnMs;
+    latido.rmssdMs = encabezado.rmssdMs;
+  }
+  return (i == fin) ? encabezado.numLatidos : 0;
+}
@@ -0,0 +1,414 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBQRS_H
+#define LIBQRS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libfiltros.h"
+#include "libpaquete.h"
+
+// Deteccion de los complejos QRS del EKG en tiempo real con el algoritmo de Pan y Tompkins en punto
+// fijo: pasa banda de 5 a 15 Hz, derivada, cuadrado e integracion en una ventana de 150 ms, con
+// umbrales que siguen la amplitud de los picos de la señal y del ruido, periodo refractario,
+// descarte de ondas T y busqueda hacia atras de los latidos que quedaron por debajo del umbral.
+// Cada pico R sale como un evento con el intervalo RR y el resumen del ritmo (frecuencia cardiaca,
+// SDNN y RMSSD de los ultimos latidos), que ocupa unos pocos bytes en vez de los cientos de
+// muestras de un latido.
+//
+// Formato del paquete de latidos para LoRa: el encabezado comun y el CRC de libpaquete.h (tipo 0xB3,
+// marca de tiempo del pico R del primer latido) y
+//  [7..8]   Frecuencia cardiaca promedio en decimas de latido por minuto (al ultimo latido)
+//  [9..10]  SDNN en milisegundos
+//  [11..12] RMSSD en milisegundos
+//  [13]     Numero de latidos
+//  [14..]   Un varint por latido con (milisegundos << 2) | clase: para el primero los milisegundos
+//           son su intervalo RR y para los demas el tiempo desde el pico R anterior
+
+#define QRS_CORTE_INFERIOR 5          // Hz, pasa banda del detector (la energia del QRS esta entre 5 y 15 Hz)
+#define QRS_CORTE_SUPERIOR 15
+#define QRS_VENTANA_MS 150            // Ventana de integracion, la duracion de un QRS ancho
+#define QRS_REFRACTARIO_MS 200        // Tiempo minimo entre dos latidos
+#define QRS_ONDA_T_MS 360             // Un pico antes de este tiempo y con poca pendiente es una onda T
+#define QRS_APRENDIZAJE_MS 2000       // Tiempo inicial en el que se estiman los umbrales
+#define QRS_BUSQUEDA_ATRAS 166        // Porcentaje del RR promedio sin latido tras el que se busca uno perdido
+#define QRS_FRAGMENTO_PREVIO_MS 1000  // Señal que se envia antes de detectar un latido anomalo
+#define QRS_FRAGMENTO_POSTERIOR_MS 1000 // Y despues
+
+#define RITMO_NUM_RR 16               // Intervalos RR del resumen de frecuencia y variabilidad
+#define RITMO_MIN_RR 4                // Intervalos que hacen falta para clasificar los latidos
+#define RITMO_TOLERANCIA 20           // Desviacion del RR promedio (en %) a partir de la que un latido es prematuro o tardio
+#define RITMO_FC_MINIMA 40            // Latidos por minuto, fuera de [minima, maxima] el latido esta fuera de rango
+#define RITMO_FC_MAXIMA 150
+
+#define PAQUETE_TIPO_LATIDOS 0xB3
+#define LATIDOS_TAM_ENCABEZADO 14
+#define LATIDOS_POR_PAQUETE 16        // Un paquete cada ~15 s a 60 lpm, o antes si llega un latido anomalo
+#define LATIDOS_MAX_POR_PAQUETE 32
+#define LATIDOS_TAM_MAX (LATIDOS_TAM_ENCABEZADO + LATIDOS_MAX_POR_PAQUETE * 5 + PAQUETE_TAM_CRC) // Un varint de 32 bits ocupa hasta 5 bytes
+
+enum ClaseLatido : uint8_t {
+  LATIDO_NORMAL,
+  LATIDO_PREMATURO,       // RR mas corto que el promedio en mas de RITMO_TOLERANCIA
+  LATIDO_TARDIO,          // RR mas largo (pausa, latido perdido o electrodo suelto)
+  LATIDO_FUERA_DE_RANGO   // Ritmo regular pero con la frecuencia fuera de [RITMO_FC_MINIMA, RITMO_FC_MAXIMA]
+};
+
+/**
+ * Latido detectado, con el resumen del ritmo hasta ese latido
+ */
+struct EventoLatido {
+  uint64_t marcaTiempo;     // Instante del pico R en microsegundos
+  uint16_t rrMs;            // Intervalo desde el latido anterior (0 en el primero)
+  uint16_t frecuenciaDeci;  // Frecuencia cardiaca promedio en decimas de lpm (0 si aun no hay intervalos)
+  uint16_t sdnnMs;          // Desviacion estandar de los RR normales del resumen
+  uint16_t rmssdMs;         // Raiz del promedio de los cuadrados de las diferencias entre RR seguidos
+  ClaseLatido clase;
+  bool recuperado;          // true si se encontro con la busqueda hacia atras
+};
+
+/**
+ * Pico R encontrado por el detector
+ */
+struct DeteccionQRS {
+  uint64_t marcaTiempo;  // Instante de la muestra de mayor amplitud del complejo
+  bool recuperado;       // true si se encontro con la busqueda hacia atras
+};
+
+/**
+ * Detector de QRS de Pan y Tompkins para señales muestreadas a FS. Todo el lazo es aritmetica
+ * entera: el filtro es la cascada de biquads Q31 de libfiltros.h y la integral una suma movil
+ * @param FS Frecuencia de muestreo en Hz
+ */
+template <uint32_t FS>
+class DetectorQRS {
+  static_assert(2 * QRS_CORTE_SUPERIOR < FS, "Frecuencia de muestreo muy baja para el detector de QRS");
+
+public:
+  DetectorQRS() : filtro(COEFICIENTES) { reiniciar(); }
+
+  /**
+   * Funcion que borra la historia y vuelve a la fase de aprendizaje de los umbrales
+   */
+  void reiniciar() {
+    filtro.reiniciar();
+    for (uint8_t i = 0; i < 4; i++) pasaBanda[i] = 0;
+    for (uint32_t i = 0; i < VENTANA; i++) cuadrados[i] = 0;
+    posVentana = posHistoria = 0;
+    integral = 0;
+    indice = 0;
+    maximoAprendizaje = 0;
+    sumaAprendizaje = 0;
+    picoSenal = picoRuido = umbral = 0;
+    subiendo = false;
+    pico = 0;
+    hayQRS = false;
+    rrPromedio = 0;
+    candidato.valor = 0;
+  }
+
+  /**
+   * Funcion que procesa una muestra
+   * @param x Muestra de 12 bits centrada en cero (el EKG ya filtrado, en cuentas o milivoltios)
+   * @param marcaTiempo Instante de la muestra en microsegundos
+   * @param detecciones Donde se escriben los picos R encontrados (capacidad para 2)
+   * @return Numero de picos R encontrados con esta muestra (0 a 2)
+   */
+  size_t procesar(int32_t x, uint64_t marcaTiempo, DeteccionQRS *detecciones) {
+    indice++;
+    posHistoria = (posHistoria + 1 == HISTORIA) ? 0 : posHistoria + 1;
+    historia[posHistoria] = (int16_t)x;  // Para ubicar el pico R cuando se confirme el complejo
+    marcas[posHistoria] = marcaTiempo;
+
+    int32_t pb = filtro.procesar(x << 19) >> 15;  // 12 bits a Q31 y de vuelta con 4 bits de fraccion
+    int32_t derivada = (2 * pb + pasaBanda[0] - pasaBanda[2] - 2 * pasaBanda[3]) >> 3; // Derivada de 5 puntos
+    pasaBanda[3] = pasaBanda[2];
+    pasaBanda[2] = pasaBanda[1];
+    pasaBanda[1] = pasaBanda[0];
+    pasaBanda[0] = pb;
+    uint32_t pendiente = (uint32_t)(derivada < 0 ? -derivada : derivada);
+    if (pendiente > 32767) pendiente = 32767;
+    uint32_t cuadrado = (pendiente * pendiente) >> 8;  // Menos de 2^22, la suma de la ventana cabe en 32 bits
+    integral += cuadrado - cuadrados[posVentana];
+    cuadrados[posVentana] = cuadrado;
+    posVentana = (posVentana + 1 == VENTANA) ? 0 : posVentana + 1;
+
+    if (indice <= APRENDIZAJE) {  // Los umbrales parten del maximo y del promedio de los primeros segundos
+      if (integral > maximoAprendizaje) maximoAprendizaje = integral;
+      sumaAprendizaje += integral;
+      if (indice == APRENDIZAJE) {
+        picoSenal = maximoAprendizaje / 3;
+        picoRuido = (uint32_t)(sumaAprendizaje / APRENDIZAJE / 2);
+        actualizarUmbral();
+      }
+    }
+
+    size_t n = 0;
+    if (hayQRS && rrPromedio && indice - inicioBusqueda > rrPromedio * QRS_BUSQUEDA_ATRAS / 100) {
+      if (candidato.valor > umbral / 2) {
+        // Paso mucho tiempo sin latido: el mayor pico por encima de la mitad del umbral era un QRS
+        picoSenal = candidato.valor / 4 + picoSenal - picoSenal / 4;
+        n += aceptar(candidato, true, &detecciones[n]);
+      } else {
+        // Tampoco hubo un pico asi: la señal bajo de amplitud (otro electrodo, otra posicion) y el
+        // umbral baja a la mitad en cada busqueda hasta que la vuelve a encontrar
+        picoSenal /= 2;
+        if (picoSenal < picoRuido) picoSenal = picoRuido;
+        actualizarUmbral();
+        inicioBusqueda = indice;
+      }
+    }
+
+    // Picos de la integral: sube, y se confirma cuando baja a la mitad (o pasa un cuarto de segundo)
+    if (subiendo) {
+      if (pendiente > pendientePico) pendientePico = pendiente;
+      if (integral >= pico) {
+        pico = integral;
+        indicePico = indice;
+      } else if (integral < pico / 2 || indice - indicePico > ESPERA_PICO) {
+        n += clasificarPico(&detecciones[n]);
+        subiendo = false;
+        pico = integral;
+      }
+    } else if (integral <= pico) {
+      pico = integral;  // Valle
+    } else {
+      subiendo = true;
+      pico = integral;
+      indicePico = indice;
+      pendientePico = pendiente;
+    }
+    return n;
+  }
+
+  uint32_t umbralActual() const { return umbral; }  // Umbral de la integral para aceptar un QRS
+
+private:
+  static constexpr uint32_t VENTANA = FS * QRS_VENTANA_MS / 1000;
+  static constexpr uint32_t REFRACTARIO = FS * QRS_REFRACTARIO_MS / 1000;
+  static constexpr uint32_t ONDA_T = FS * QRS_ONDA_T_MS / 1000;
+  static constexpr uint32_t APRENDIZAJE = FS * QRS_APRENDIZAJE_MS / 1000;
+  static constexpr uint32_t ESPERA_PICO = FS / 4;
+  static constexpr uint32_t RETARDO_FILTRO = FS / 32 + 2;  // Lo que el pasa banda y la derivada atrasan la energia del QRS
+  static constexpr uint32_t HISTORIA = FS / 2;             // Cubre la ventana, el retardo y la espera del pico
+  static_assert(VENTANA >= 4 && VENTANA <= 512, "Ventana de integracion fuera de rango");
+  static_assert(ESPERA_PICO + VENTANA + RETARDO_FILTRO < HISTORIA, "La historia no alcanza para ubicar el pico R");
+
+  static constexpr CoefBiquadQ<int32_t> COEFICIENTES[] = {
+      cuantizar<int32_t>(disenarPasaAltos(FS, QRS_CORTE_INFERIOR, 0.7071)),
+      cuantizar<int32_t>(disenarPasaBajos(FS, QRS_CORTE_SUPERIOR, 0.7071))};
+
+  struct Pico {
+    uint32_t valor;       // Maximo de la integral
+    uint32_t indice;      // Muestra del maximo
+    uint32_t pendiente;   // Mayor pendiente mientras subia la integral
+    uint64_t marcaTiempo; // Instante del pico R
+  };
+
+  void actualizarUmbral() { umbral = picoRuido + (picoSenal - picoRuido) / 4; }
+
+  /**
+   * Funcion que busca el pico R (la muestra de mayor amplitud) en la ventana que termina en el
+   * maximo de la integral
+   */
+  uint64_t ubicarR(uint32_t indiceMaximo) const {
+    uint32_t atras = indice - indiceMaximo;
+    uint32_t hasta = atras + VENTANA + RETARDO_FILTRO;
+    uint32_t mejor = atras;
+    int32_t amplitud = -1;
+    for (uint32_t k = atras; k < hasta; k++) {
+      uint32_t p = (posHistoria + HISTORIA - k) % HISTORIA;
+      int32_t a = historia[p] < 0 ? -historia[p] : historia[p];
+      if (a > amplitud) {
+        amplitud = a;
+        mejor = k;
+      }
+    }
+    return marcas[(posHistoria + HISTORIA - mejor) % HISTORIA];
+  }
+
+  /**
+   * Funcion que decide si el pico recien confirmado de la integral es un QRS, una onda T o ruido
+   */
+  size_t clasificarPico(DeteccionQRS *deteccion) {
+    if (indice <= APRENDIZAJE) return 0;
+    Pico p = {pico, indicePico, pendientePico, 0};
+    if (hayQRS && p.indice - ultimoQRS < REFRACTARIO) return 0;
+    p.marcaTiempo = ubicarR(p.indice);
+    // Onda T: llega pronto y sube con menos de la mitad de la pendiente del QRS anterior
+    bool ondaT = hayQRS && p.indice - ultimoQRS < ONDA_T && p.pendiente < pendienteQRS / 2;
+    if (p.valor > umbral && !ondaT) {
+      picoSenal = p.valor / 8 + picoSenal - picoSenal / 8;
+      return aceptar(p, false, deteccion);
+    }
+    if (!ondaT && p.valor > candidato.valor) candidato = p;  // Por si la busqueda hacia atras lo necesita
+    picoRuido = p.valor / 8 + picoRuido - picoRuido / 8;
+    actualizarUmbral();
+    return 0;
+  }
+
+  size_t aceptar(const Pico &p, bool recuperado, DeteccionQRS *deteccion) {
+    if (hayQRS) {
+      uint32_t rr = p.indice - ultimoQRS;
+      rrPromedio = rrPromedio ? (7 * rrPromedio + rr) / 8 : rr;
+    }
+    hayQRS = true;
+    ultimoQRS = inicioBusqueda = p.indice;
+    pendienteQRS = p.pendiente;
+    candidato.valor = 0;
+    actualizarUmbral();
+    deteccion->marcaTiempo = p.marcaTiempo;
+    deteccion->recuperado = recuperado;
+    return 1;
+  }
+
+  CascadaBiquad<int32_t, 2> filtro;
+  int32_t pasaBanda[4];           // Salidas anteriores del pasa banda para la derivada
+  uint32_t cuadrados[VENTANA];    // Derivadas al cuadrado de la ventana de integracion
+  uint32_t posVentana;
+  uint32_t integral;              // Suma de la ventana
+  int16_t historia[HISTORIA];     // Entrada reciente, para ubicar el pico R
+  uint64_t marcas[HISTORIA];
+  uint32_t posHistoria;
+  uint32_t indice;                // Muestras procesadas
+  uint32_t maximoAprendizaje;
+  uint64_t sumaAprendizaje;
+  uint32_t picoSenal;             // Nivel de los picos de QRS (SPKI)
+  uint32_t picoRuido;             // Nivel de los picos de ruido (NPKI)
+  uint32_t umbral;
+  bool subiendo;                  // La integral va subiendo hacia un pico
+  uint32_t pico;                  // Maximo (subiendo) o minimo (bajando) en curso
+  uint32_t indicePico;
+  uint32_t pendientePico;
+  bool hayQRS;
+  uint32_t ultimoQRS;             // Muestra del maximo de la integral del ultimo QRS
+  uint32_t pendienteQRS;
+  uint32_t rrPromedio;            // En muestras
+  uint32_t inicioBusqueda;        // Desde donde se cuenta el tiempo para la busqueda hacia atras
+  Pico candidato;                 // Mayor pico por debajo del umbral desde el ultimo QRS
+};
+
+/**
+ * Resumen del ritmo: clasifica cada latido por su intervalo RR y calcula la frecuencia cardiaca y
+ * la variabilidad de los ultimos RITMO_NUM_RR intervalos normales
+ */
+class AnalizadorRitmo {
+public:
+  AnalizadorRitmo();
+
+  /**
+   * Funcion que olvida los latidos anteriores
+   */
+  void reiniciar();
+
+  /**
+   * Funcion que agrega un latido
+   * @param marcaTiempo Instante del pico R en microsegundos
+   * @return El latido clasificado, con el resumen del ritmo
+   */
+  EventoLatido agregar(uint64_t marcaTiempo);
+
+private:
+  void agregarIntervalo(uint16_t rr);
+
+  uint64_t ultimaMarca;
+  bool hayLatido;
+  uint16_t rr[RITMO_NUM_RR];      // Ultimos intervalos normales en ms
+  uint8_t numRR, posRR;
+  uint32_t sumaRR;
+  uint64_t sumaCuadradosRR;
+  uint32_t diferencias[RITMO_NUM_RR]; // Cuadrados de las diferencias entre intervalos normales seguidos
+  uint8_t numDiferencias, posDiferencias;
+  uint64_t sumaDiferencias;
+  uint16_t anteriorRR;            // Ultimo intervalo normal, 0 si el anterior no lo fue
+  uint8_t anomalosSeguidos;       // Latidos prematuros o tardios seguidos
+};
+
+/**
+ * Encabezado de un paquete de latidos
+ */
+struct EncabezadoLatidos {
+  uint16_t secuencia;
+  uint32_t marcaTiempo;     // Pico R del primer latido
+  uint16_t frecuenciaDeci;
+  uint16_t sdnnMs;
+  uint16_t rmssdMs;
+  uint8_t numLatidos;
+};
+
+/**
+ * Empaquetador de latidos: junta LATIDOS_POR_PAQUETE eventos en un paquete, o lo cierra antes si
+ * llega un latido anomalo para que salga enseguida (doble buffer con ArmadorPaquetes)
+ */
+class EmpaquetadorLatidos {
+public:
+  EmpaquetadorLatidos();
+
+  /**
+   * Funcion que configura el empaquetador
+   * @param latidosPorPaquete Latidos de cada paquete (maximo LATIDOS_MAX_POR_PAQUETE)
+   */
+  void iniciar(uint8_t latidosPorPaquete = LATIDOS_POR_PAQUETE);
+
+  /**
+   * Funcion que agrega un latido al paquete en construccion
+   * @return true si con este latido se cerro el paquete, que queda en paquete()/tamano()
+   */
+  bool agregar(const EventoLatido &latido);
+
+  /**
+   * Funcion que cierra el paquete en construccion aunque no este lleno
+   * @return true si habia latidos y el paquete quedo listo en paquete()/tamano()
+   */
+  bool cerrar();
+
+  const uint8_t *paquete() const { return armador.paquete(); }  // Ultimo paquete cerrado
+  size_t tamano() const { return armador.tamano(); }              // Bytes del ultimo paquete cerrado
+
+  uint32_t paquetes;       // Paquetes cerrados
+  uint32_t latidos;        // Latidos en los paquetes cerrados
+  uint32_t anomalos;       // Latidos agregados que no fueron normales
+  uint64_t bytesPaquetes;  // Bytes de los paquetes cerrados
+
+private:
+  ArmadorPaquetes<LATIDOS_TAM_MAX> armador;
+  uint8_t porPaquete;
+  uint8_t latidosPaquete;
+  uint64_t primeraMarca;   // Pico R del primer latido del paquete
+  uint32_t ultimoMs;       // Milisegundos del ultimo latido desde el primero
+};
+
+/**
+ * Funcion que desempaqueta y verifica un paquete de latidos (lado del receptor)
+ * @param paquete Bytes recibidos
+ * @param len Numero de bytes
+ * @param encabezado Donde se escribe el encabezado (con el resumen del ritmo)
+ * @param destino Donde se escriben los latidos (marca de tiempo de 32 bits, RR y clase; el resumen
+ *                del encabezado se copia en cada uno)
+ * @param max Capacidad del destino
+ * @return Numero de latidos, o 0 si el paquete es invalido
+ */
+size_t desempaquetarLatidos(const uint8_t *paquete, size_t len, EncabezadoLatidos &encabezado, EventoLatido *destino, size_t max);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBRESERVA_H
+#define LIBRESERVA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Reserva de bloques de tamaño fijo con conteo de referencias, para pasar un mismo bloque a varios
+// consumidores sin copiarlo. Los N bloques son parte del objeto (memoria estatica interna, sin
+// heap): reservar() saca uno de la lista libre con una referencia, cada consumidor que lo guarda
+// para despues llama retener(), y el bloque vuelve a la lista cuando el ultimo llama liberar().
+// La lista libre es una pila sin bloqueos (Treiber) cuya cabeza lleva una etiqueta que cambia en
+// cada operacion, asi un compare-and-swap no confunde una cabeza que salio y volvio (ABA). Todo
+// usa atomicos de 32 bits, que en el ESP32 son instrucciones y no secciones criticas: se puede
+// reservar y liberar desde una ISR o desde cualquier nucleo. En el firmware solo la usa la adquisicion
+// por DMA (ReceptorBloques en libadcbloques.h), donde el manejador procesa el bloque en el mismo lugar.
+
+#define RESERVA_SIN_BLOQUE 0xFFFF  // Indice que marca el fin de la lista libre
+
+/**
+ * Contadores de una reserva de bloques
+ */
+struct EstadisticasReserva {
+  uint32_t capacidad;        // Bloques de la reserva
+  uint32_t ocupados;         // Bloques fuera de la lista libre ahora
+  uint32_t maximoOcupados;   // Mayor ocupacion vista
+  uint32_t reservados;       // Bloques entregados por reservar()
+  uint32_t agotados;         // Veces que reservar() no encontro un bloque libre
+};
+
+/**
+ * Reserva de N bloques de tipo T con conteo de referencias
+ * @param T Tipo del bloque (se usa tal cual, sin constructor por reserva)
+ * @param N Numero de bloques (menos de 65535)
+ */
+template <typename T, size_t N>
+class ReservaBloques {
+  static_assert(N > 0 && N < RESERVA_SIN_BLOQUE, "La reserva debe tener entre 1 y 65534 bloques");
+
+public:
+  ReservaBloques() : cabeza(0), ocupados(0), maximoOcupados(0), reservados(0), agotados(0) {
+    for (size_t i = 0; i < N; i++) {
+      siguiente[i].store((uint32_t)(i + 1 < N ? i + 1 : RESERVA_SIN_BLOQUE), std::memory_order_relaxed);
+      referencias[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Capacidad total de la reserva
+   */
+  static constexpr size_t capacidad() { return N; }
+
+  /**
+   * Funcion que saca un bloque de la lista libre con una referencia (la de quien lo pide)
+   * @return El bloque, o NULL si todos estan ocupados (se cuenta en agotados)
+   */
+  T *reservar() {
+    uint32_t c = cabeza.load(std::memory_order_acquire);
+    while (true) {
+      uint32_t i = c & 0xFFFF;
+      if (i == RESERVA_SIN_BLOQUE) {
+        agotados.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+      }
+      // Si otro saco el bloque entretanto la etiqueta ya cambio y el compare-and-swap falla
+      uint32_t nueva = ((c & 0xFFFF0000) + 0x10000) | siguiente[i].load(std::memory_order_relaxed);
+      if (cabeza.compare_exchange_weak(c, nueva, std::memory_order_acquire, std::memory_order_acquire)) {
+        referencias[i].store(1, std::memory_order_relaxed);
+        reservados.fetch_add(1, std::memory_order_relaxed);
+        uint32_t n = ocupados.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint32_t maximo = maximoOcupados.load(std::memory_order_relaxed);
+        while (n > maximo && !maximoOcupados.compare_exchange_weak(maximo, n, std::memory_order_relaxed)) {
+        }
+        return &bloques[i];
+      }
+    }
+  }
+
+  /**
+   * Funcion que agrega una referencia a un bloque que ya se tiene (para guardarlo despues de que
+   * quien lo entrego lo libere)
+   */
+  void retener(T *bloque) {
+    referencias[indice(bloque)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Funcion que quita una referencia; con la ultima el bloque vuelve a la lista libre
+   * @return true si el bloque volvio a la reserva
+   */
+  bool liberar(T *bloque) {
+    uint32_t i = indice(bloque);
+    if (referencias[i].fetch_sub(1, std::memory_order_acq_rel) != 1) return false;  // Lo usan otros todavia
+    uint32_t c = cabeza.load(std::memory_order_relaxed);
+    do {
+      siguiente[i].store(c & 0xFFFF, std::memory_order_relaxed);
+    } while (!cabeza.compare_exchange_weak(c, ((c & 0xFFFF0000) + 0x10000) | i, std::memory_order_release, std::memory_order_relaxed));
+    ocupados.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * Referencias actuales de un bloque (0 si esta libre)
+   */
+  uint32_t referenciasDe(const T *bloque) const { return referencias[indice(bloque)].load(std::memory_order_relaxed); }
+
+  /**
+   * Contadores de la reserva
+   */
+  EstadisticasReserva estadisticas() const {
+    EstadisticasReserva e;
+    e.capacidad = N;
+    e.ocupados = ocupados.load(std::memory_order_relaxed);
+    e.maximoOcupados = maximoOcupados.load(std::memory_order_relaxed);
+    e.reservados = reservados.load(std::memory_order_relaxed);
+    e.agotados = agotados.load(std::memory_order_relaxed);
+    return e;
+  }
+
+private:
+  uint32_t indice(const T *bloque) const { return (uint32_t)(bloque - bloques); }
+
+  T bloques[N];
+  std::atomic<uint32_t> siguiente[N];    // Enlace de la lista libre de cada bloque
+  std::atomic<uint32_t> referencias[N];
+  std::atomic<uint32_t> cabeza;          // Etiqueta en los 16 bits altos, indice del primer bloque libre en los bajos
+  std::atomic<uint32_t> ocupados;
+  std::atomic<uint32_t> maximoOcupados;
+  std::atomic<uint32_t> reservados;
+  std::atomic<uint32_t> agotados;
+};
+
+#endif
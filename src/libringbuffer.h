@@ -0,0 +1,197 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBRINGBUFFER_H
+#define LIBRINGBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Vista de solo lectura sobre un rango de muestras de un BufferCircular. Como el buffer
+ * es circular, el rango puede quedar partido en dos tramos contiguos (a y b), asi que
+ * la vista no copia nada: solo apunta a la memoria del buffer.
+ */
+template <typename T>
+struct Ventana {
+  const T *a;    // Primer tramo (las muestras mas antiguas del rango)
+  size_t lenA;   // Numero de muestras del primer tramo
+  const T *b;    // Segundo tramo (vacio si el rango no da la vuelta al buffer)
+  size_t lenB;   // Numero de muestras del segundo tramo
+
+  /**
+   * Numero total de muestras de la vista
+   */
+  size_t size() const { return lenA + lenB; }
+
+  /**
+   * Acceso a la muestra i de la vista (0 es la mas antigua)
+   */
+  const T &operator[](size_t i) const { return (i < lenA) ? a[i] : b[i - lenA]; }
+};
+
+/**
+ * Buffer circular sin bloqueos para un productor y un consumidor (SPSC).
+ * El productor (por ejemplo la tarea de adquisicion) solo escribe la cabeza y el
+ * consumidor (filtro o transmision) solo escribe la cola, por eso no se necesitan
+ * mutex ni secciones criticas. La capacidad N debe ser potencia de 2 para que el
+ * indice se calcule con una mascara en vez de un modulo, y los indices corren libres
+ * (se desbordan solos) de modo que lleno/vacio se distinguen sin desperdiciar un espacio.
+ * @param T Tipo de la muestra almacenada
+ * @param N Capacidad del buffer (potencia de 2)
+ */
+template <typename T, size_t N>
+class BufferCircular {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "La capacidad del BufferCircular debe ser potencia de 2");
+
+public:
+  BufferCircular() : cabeza(0), cola(0), descartadas(0) {}
+
+  /**
+   * Capacidad total del buffer
+   */
+  static constexpr size_t capacidad() { return N; }
+
+  /**
+   * Funcion del productor que agrega una muestra. No desplaza datos: solo escribe en la
+   * posicion de la cabeza. Si el buffer esta lleno la muestra se descarta y se cuenta.
+   * @param muestra Es la muestra a almacenar
+   * @return true si la muestra se almaceno, false si el buffer estaba lleno
+   */
+  bool push(const T &muestra) {
+    uint32_t c = cabeza.load(std::memory_order_relaxed);
+    if (c - cola.load(std::memory_order_acquire) >= N) { // Buffer lleno, el consumidor va atrasado
+      descartadas++;
+      return false;
+    }
+    datos[c & MASCARA] = muestra;
+    cabeza.store(c + 1, std::memory_order_release);  // Publicamos la muestra al consumidor
+    return true;
+  }
+
+  /**
+   * Funcion del productor que da la posicion de la cabeza para construir ahi la siguiente muestra,
+   * sin armarla aparte y copiarla con push(). El consumidor no la ve hasta que se llame publicar().
+   * @return Posicion libre, o NULL si el buffer esta lleno (la muestra se cuenta como descartada)
+   */
+  T *reservar() {
+    uint32_t c = cabeza.load(std::memory_order_relaxed);
+    if (c - cola.load(std::memory_order_acquire) >= N) {
+      descartadas++;
+      return NULL;
+    }
+    return &datos[c & MASCARA];
+  }
+
+  /**
+   * Funcion del productor que entrega al consumidor la muestra construida con reservar()
+   */
+  void publicar() {
+    cabeza.store(cabeza.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /**
+   * Funcion del consumidor que extrae la muestra mas antigua
+   * @param muestra Es donde se copia la muestra extraida
+   * @return true si habia una muestra, false si el buffer estaba vacio
+   */
+  bool pop(T &muestra) {
+    uint32_t t = cola.load(std::memory_order_relaxed);
+    if (cabeza.load(std::memory_order_acquire) == t) return false;
+    muestra = datos[t & MASCARA];
+    cola.store(t + 1, std::memory_order_release);  // Liberamos la posicion para el productor
+    return true;
+  }
+
+  /**
+   * Numero de muestras pendientes por consumir (valido desde ambos lados)
+   */
+  size_t disponibles() const {
+    return (size_t)(cabeza.load(std::memory_order_acquire) - cola.load(std::memory_order_acquire));
+  }
+
+  /**
+   * Funcion del consumidor que da una vista sin copia de las n muestras pendientes mas
+   * antiguas. Las muestras siguen siendo validas hasta que se llame descartar().
+   * @param n Numero de muestras deseadas (se recorta a las disponibles)
+   */
+  Ventana<T> primeras(size_t n) const {
+    uint32_t t = cola.load(std::memory_order_relaxed);
+    size_t pendientes = (size_t)(cabeza.load(std::memory_order_acquire) - t);
+    if (n > pendientes) n = pendientes;
+    return vista(t, n);
+  }
+
+  /**
+   * Funcion del consumidor que da una vista sin copia de las ultimas n muestras escritas
+   * (las mas recientes), por ejemplo para un filtro de ventana deslizante. Solo se
+   * entregan muestras aun no consumidas, que el productor no puede sobreescribir.
+   * @param n Numero de muestras deseadas (se recorta a las disponibles)
+   */
+  Ventana<T> ultimas(size_t n) const {
+    uint32_t t = cola.load(std::memory_order_relaxed);
+    uint32_t c = cabeza.load(std::memory_order_acquire);
+    size_t pendientes = (size_t)(c - t);
+    if (n > pendientes) n = pendientes;
+    return vista(c - (uint32_t)n, n);
+  }
+
+  /**
+   * Funcion del consumidor que libera las n muestras mas antiguas despues de usarlas
+   * a traves de una Ventana
+   * @param n Numero de muestras a liberar (se recorta a las disponibles)
+   */
+  void descartar(size_t n) {
+    uint32_t t = cola.load(std::memory_order_relaxed);
+    size_t pendientes = (size_t)(cabeza.load(std::memory_order_acquire) - t);
+    if (n > pendientes) n = pendientes;
+    cola.store(t + (uint32_t)n, std::memory_order_release);
+  }
+
+  /**
+   * Numero de muestras que el productor tuvo que descartar porque el buffer estaba lleno
+   */
+  uint32_t perdidas() const { return descartadas; }
+
+private:
+  static const uint32_t MASCARA = (uint32_t)(N - 1);
+
+  Ventana<T> vista(uint32_t inicio, size_t n) const {
+    size_t i = inicio & MASCARA;
+    size_t hastaFinal = N - i;  // Muestras contiguas antes de dar la vuelta al buffer
+    Ventana<T> v;
+    v.a = &datos[i];
+    v.lenA = (n < hastaFinal) ? n : hastaFinal;
+    v.b = &datos[0];
+    v.lenB = n - v.lenA;
+    return v;
+  }
+
+  T datos[N];
+  std::atomic<uint32_t> cabeza;  // Indice libre de escritura (solo lo modifica el productor)
+  std::atomic<uint32_t> cola;    // Indice libre de lectura (solo lo modifica el consumidor)
+  uint32_t descartadas;          // Contador de muestras perdidas (solo lo modifica el productor)
+};
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBSEQLOCK_H
+#define LIBSEQLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+/**
+ * Seqlock para publicar un registro pequeño de un escritor a varios lectores sin bloquear a
+ * nadie. El escritor deja la secuencia impar mientras escribe y par al terminar; el lector copia
+ * el registro y lo acepta solo si la secuencia era par y no cambio durante la copia, si no vuelve
+ * a intentar. El escritor nunca espera, y un lector solo repite la copia si le toco una escritura.
+ * @param T Tipo del registro (debe poderse copiar con memcpy)
+ */
+template <typename T>
+class Seqlock {
+public:
+  Seqlock() : secuencia(0), dato() {}
+
+  /**
+   * Funcion del escritor que publica un nuevo valor (un solo escritor). Siempre en linea: asi queda
+   * en IRAM cuando la llama una ISR en IRAM
+   */
+  __attribute__((always_inline)) void escribir(const T &valor) {
+    uint32_t s = secuencia.load(std::memory_order_relaxed);
+    secuencia.store(s + 1, std::memory_order_relaxed);  // Impar: escritura en curso
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&dato, &valor, sizeof(T));
+    secuencia.store(s + 2, std::memory_order_release);  // Par: el valor esta completo
+  }
+
+  /**
+   * Funcion de los lectores que copia el ultimo valor publicado
+   * @return Numero de publicaciones hechas hasta ese valor (0 si aun no se ha publicado nada)
+   */
+  uint32_t leer(T &valor) const {
+    uint32_t antes, despues;
+    do {
+      antes = secuencia.load(std::memory_order_acquire);
+      memcpy(&valor, &dato, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      despues = secuencia.load(std::memory_order_relaxed);
+    } while ((antes & 1) || antes != despues);
+    return antes / 2;
+  }
+
+private:
+  std::atomic<uint32_t> secuencia;
+  T dato;
+};
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libtasa.h"
+#include "libpaquete.h"
+
+
+ControladorTasa::ControladorTasa() {
+  configurar(256, 256 / TASA_DIVISOR_REPOSO);
+}
+
+
+void ControladorTasa::configurar(uint16_t alta, uint16_t baja, uint32_t giro, uint32_t varianza, uint32_t tiempoQuietoMs) {
+  frecuenciaAlta = alta;
+  frecuenciaReposo = baja;
+  umbralGiro = giro;
+  umbralVarianza = varianza;
+  tiempoQuietoUs = (uint64_t)tiempoQuietoMs * 1000;
+  reposo = false;
+  inicioVentana = quietoDesde = reposoDesde = 0;
+  sumaAdc = sumaCuadradosAdc = energiaGiro = 0;
+  muestrasAdc = muestrasGiro = 0;
+  cambios = disparosGiroscopio = disparosAdc = fallos = 0;
+  reposoUs = 0;
+  ultimaVarianza = ultimaEnergia = 0;
+}
+
+
+bool ControladorTasa::revisar(uint64_t ahora, CambioTasa &cambio) {
+  if (inicioVentana == 0) inicioVentana = quietoDesde = ahora;
+  if (ahora - inicioVentana < (uint64_t)TASA_VENTANA_MS * 1000) return false;
+  // Con menos de dos muestras no hay varianza (no pasa a 4 Hz o mas), y sin giroscopio no hay energia
+  uint32_t varianza = (muestrasAdc < 2) ? 0 : (uint32_t)((muestrasAdc * sumaCuadradosAdc - sumaAdc * sumaAdc) / ((uint64_t)muestrasAdc * muestrasAdc));
+  uint32_t energia = (muestrasGiro == 0) ? 0 : (uint32_t)(energiaGiro / muestrasGiro);
+  ultimaVarianza = varianza;
+  ultimaEnergia = energia;
+  sumaAdc = sumaCuadradosAdc = energiaGiro = 0;
+  muestrasAdc = muestrasGiro = 0;
+  inicioVentana = ahora;
+  bool giro = energia > umbralGiro;
+  bool adc = varianza > umbralVarianza;
+  if (giro || adc) quietoDesde = ahora;
+  if (reposo && (giro || adc)) {
+    reposo = false;
+    reposoUs += ahora - reposoDesde;
+    if (giro) disparosGiroscopio++;
+    else disparosAdc++;
+    cambio.motivo = giro ? TASA_GIROSCOPIO : TASA_VARIANZA_ADC;
+  } else if (!reposo && ahora - quietoDesde >= tiempoQuietoUs) {
+    reposo = true;
+    reposoDesde = ahora;
+    cambio.motivo = TASA_QUIETO;
+  } else {
+    return false;
+  }
+  cambios++;
+  cambio.marcaTiempo = ahora;
+  cambio.frecuenciaHz = frecuencia();
+  return true;
+}
+
+
+void ControladorTasa::cancelar(const CambioTasa &cambio) {
+  cambios--;
+  fallos++;
+  if (reposo) {  // Iba a bajar: quietoDesde no cambia, asi que la siguiente ventana quieta lo reintenta
+    reposo = false;
+    return;
+  }
+  reposo = true;  // Iba a subir: el tramo en reposo sigue desde reposoDesde
+  reposoUs -= cambio.marcaTiempo - reposoDesde;
+  if (cambio.motivo == TASA_GIROSCOPIO) disparosGiroscopio--;
+  else disparosAdc--;
+}
+
+
+size_t codificarCambioTasa(const CambioTasa &cambio, uint16_t secuencia, uint8_t *destino) {
+  escribirEncabezadoPaquete(destino, PAQUETE_TIPO_TASA, secuencia, (uint32_t)cambio.marcaTiempo);
+  destino[7] = (uint8_t)cambio.frecuenciaHz;
+  destino[8] = (uint8_t)(cambio.frecuenciaHz >> 8);
+  destino[9] = cambio.motivo;
+  return agregarCrcPaquete(destino, TASA_TAM_PAQUETE - PAQUETE_TAM_CRC);
+}
+
+
+bool decodificarCambioTasa(const uint8_t *paquete, size_t len, uint16_t &secuencia, CambioTasa &cambio) {
+  if (len != TASA_TAM_PAQUETE || paquete[0] != PAQUETE_TIPO_TASA) return false;
+  if (!crcPaqueteValido(paquete, len)) return false;
+  uint32_t marcaTiempo;
+  leerEncabezadoPaquete(paquete, secuencia, marcaTiempo);
+  cambio.marcaTiempo = marcaTiempo;
+  cambio.frecuenciaHz = (uint16_t)(paquete[7] | (paquete[8] << 8));
+  cambio.motivo = (MotivoTasa)paquete[9];
+  return cambio.motivo <= TASA_VARIANZA_ADC;
+}
@@ -0,0 +1,167 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBTASA_H
+#define LIBTASA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libgiroscopio.h"
+
+// Tasa de muestreo adaptada a la actividad: mientras el usuario esta quieto (poca energia en el
+// giroscopio y poca varianza en el ADC) la adquisicion baja a una tasa de reposo, y vuelve a la
+// tasa alta en cuanto se mueve. Todo se mide en ventanas de TASA_VENTANA_MS: se baja despues de
+// TASA_TIEMPO_QUIETO_MS seguidos sin actividad y se sube con la primera ventana activa. El cambio
+// de la tasa lo hace quien lo recibe (el planificador cambia el divisor del trabajo del ADC al
+// final del periodo en curso, sin perder ni repetir muestras).
+//
+// Formato del paquete de cambio de tasa para LoRa: el encabezado comun y el CRC de libpaquete.h
+// (tipo 0xB5, marca de tiempo del cambio, que es la de la ultima muestra a la tasa anterior) y
+//  [7..8]   Nueva frecuencia de muestreo en Hz
+//  [9]      Motivo (MotivoTasa)
+
+#define TASA_DIVISOR_REPOSO 8          // La tasa de reposo es la alta entre 8 (32 Hz con 256 Hz)
+#define TASA_VENTANA_MS 250            // Ventana en que se miden la energia del giroscopio y la varianza del ADC
+#define TASA_TIEMPO_QUIETO_MS 5000     // Tiempo sin actividad antes de bajar la tasa
+#define TASA_PREVIO_MS 2000            // Historia previa al disparo que se envia al volver a la tasa alta
+#define UMBRAL_ENERGIA_GIRO 250000     // Cuadrado medio de la velocidad angular en cuentas^2 (~4.4 dps a 250 dps de escala)
+#define UMBRAL_VARIANZA_ADC 150000     // Varianza del canal x en cuentas^2 (un pico R de ~900 cuentas en una ventana a 32 Hz da ~90000)
+#define PAQUETE_TIPO_TASA 0xB5
+#define TASA_TAM_PAQUETE 12
+
+/**
+ * Motivo de un cambio de tasa
+ */
+enum MotivoTasa : uint8_t {
+  TASA_QUIETO = 0,      // Sin actividad durante TASA_TIEMPO_QUIETO_MS: baja a la tasa de reposo
+  TASA_GIROSCOPIO = 1,  // La energia del giroscopio paso el umbral: sube a la tasa alta
+  TASA_VARIANZA_ADC = 2 // La varianza del ADC paso el umbral: sube a la tasa alta
+};
+
+/**
+ * Cambio de tasa decidido por el controlador
+ */
+struct CambioTasa {
+  uint64_t marcaTiempo;   // Instante de la ultima muestra a la tasa anterior
+  uint16_t frecuenciaHz;  // Nueva frecuencia de muestreo
+  MotivoTasa motivo;
+};
+
+/**
+ * Controlador de la tasa de muestreo: recibe las muestras del ADC y del giroscopio y decide
+ * cuando cambiar de tasa. No toca el hardware
+ */
+class ControladorTasa {
+public:
+  ControladorTasa();
+
+  /**
+   * Funcion que configura el controlador y lo deja en la tasa alta
+   * @param alta Frecuencia de muestreo normal en Hz
+   * @param baja Frecuencia de muestreo sin actividad en Hz
+   * @param giro Energia del giroscopio (cuadrado medio, cuentas^2) que cuenta como actividad
+   * @param varianza Varianza del canal x del ADC (cuentas^2) que cuenta como actividad
+   * @param tiempoQuietoMs Tiempo sin actividad antes de bajar a la tasa de reposo
+   */
+  void configurar(uint16_t alta, uint16_t baja, uint32_t giro = UMBRAL_ENERGIA_GIRO, uint32_t varianza = UMBRAL_VARIANZA_ADC,
+                  uint32_t tiempoQuietoMs = TASA_TIEMPO_QUIETO_MS);
+
+  /**
+   * Funcion que agrega una muestra del canal x del ADC (12 bits, antes de calibrar)
+   */
+  inline void agregarAdc(uint16_t x) {
+    sumaAdc += x;
+    sumaCuadradosAdc += (uint64_t)x * x;
+    muestrasAdc++;
+  }
+
+  /**
+   * Funcion que agrega una muestra del giroscopio
+   */
+  inline void agregarGiroscopio(const MuestraGiroscopio &giro) {
+    energiaGiro += (int64_t)giro.x * giro.x + (int64_t)giro.y * giro.y + (int64_t)giro.z * giro.z;
+    muestrasGiro++;
+  }
+
+  /**
+   * Funcion que cierra la ventana si ya paso TASA_VENTANA_MS y decide si hay que cambiar de tasa
+   * @param ahora Marca de tiempo de la ultima muestra del ADC
+   * @param cambio Donde se escribe el cambio, si lo hay
+   * @return true si hay que cambiar la tasa a cambio.frecuenciaHz
+   */
+  bool revisar(uint64_t ahora, CambioTasa &cambio);
+
+  /**
+   * Funcion que deshace el ultimo cambio de revisar() cuando la adquisicion no lo pudo aplicar: el
+   * controlador vuelve a la tasa anterior y lo intenta de nuevo con la siguiente ventana que lo pida
+   * @param cambio El cambio que entrego revisar()
+   */
+  void cancelar(const CambioTasa &cambio);
+
+  bool enReposo() const { return reposo; }
+  uint16_t frecuencia() const { return reposo ? frecuenciaReposo : frecuenciaAlta; }
+
+  /**
+   * Funcion que da el tiempo total en la tasa de reposo, incluido el tramo en curso
+   */
+  uint64_t tiempoReposoUs(uint64_t ahora) const { return reposoUs + (reposo ? ahora - reposoDesde : 0); }
+
+  uint32_t cambios;             // Cambios de tasa
+  uint32_t disparosGiroscopio;  // Subidas por el giroscopio
+  uint32_t disparosAdc;         // Subidas por la varianza del ADC
+  uint32_t fallos;              // Cambios cancelados porque la adquisicion no los pudo aplicar
+  uint32_t ultimaVarianza;      // Medidas de la ultima ventana, para ajustar los umbrales
+  uint32_t ultimaEnergia;
+
+private:
+  uint16_t frecuenciaAlta;
+  uint16_t frecuenciaReposo;
+  uint32_t umbralGiro;
+  uint32_t umbralVarianza;
+  uint64_t tiempoQuietoUs;
+  bool reposo;
+  uint64_t reposoUs;            // Tiempo en la tasa de reposo de los tramos ya terminados
+  uint64_t inicioVentana;
+  uint64_t quietoDesde;         // Inicio del tramo sin actividad en curso
+  uint64_t reposoDesde;
+  uint64_t sumaAdc;
+  uint64_t sumaCuadradosAdc;
+  uint32_t muestrasAdc;
+  uint64_t energiaGiro;
+  uint32_t muestrasGiro;
+};
+
+/**
+ * Funcion que codifica un cambio de tasa en un paquete para LoRa
+ * @param destino Buffer de al menos TASA_TAM_PAQUETE bytes
+ * @return Bytes del paquete
+ */
+size_t codificarCambioTasa(const CambioTasa &cambio, uint16_t secuencia, uint8_t *destino);
+
+/**
+ * Funcion que decodifica y verifica un paquete de cambio de tasa (lado del receptor)
+ * @return false si el paquete es invalido
+ */
+bool decodificarCambioTasa(const uint8_t *paquete, size_t len, uint16_t &secuencia, CambioTasa &cambio);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libtelemetria.h"
+#include <string.h>
+
+/**
+ * Funciones auxiliares para escribir y leer enteros en little endian
+ */
+static inline void escribirU16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void escribirU32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint16_t leerU16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t leerU32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+uint16_t crc16Ccitt(const uint8_t *datos, size_t len, uint16_t crc) {
+  while (len--) {
+    crc ^= (uint16_t)(*datos++) << 8;
+    for (uint8_t i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+
+size_t cobsCodificar(const uint8_t *entrada, size_t len, uint8_t *salida) {
+  size_t lectura = 0;
+  size_t escritura = 1;  // La posicion 0 la ocupa el primer codigo
+  size_t posCodigo = 0;  // Posicion del codigo del grupo actual
+  uint8_t codigo = 1;    // Distancia hasta el proximo cero (o fin del grupo)
+  while (lectura < len) {
+    if (entrada[lectura] == 0) {
+      salida[posCodigo] = codigo;
+      posCodigo = escritura++;
+      codigo = 1;
+    } else {
+      salida[escritura++] = entrada[lectura];
+      if (++codigo == 0xFF) {  // Grupo de 254 bytes sin ceros, se cierra sin cero implicito
+        salida[posCodigo] = codigo;
+        posCodigo = escritura++;
+        codigo = 1;
+      }
+    }
+    lectura++;
+  }
+  salida[posCodigo] = codigo;
+  return escritura;
+}
+
+
+size_t cobsDecodificar(const uint8_t *entrada, size_t len, uint8_t *salida) {
+  size_t lectura = 0;
+  size_t escritura = 0;
+  while (lectura < len) {
+    uint8_t codigo = entrada[lectura];
+    if (codigo == 0 || lectura + codigo > len) return 0;  // Codigo invalido o grupo truncado
+    lectura++;
+    for (uint8_t i = 1; i < codigo; i++) {
+      if (entrada[lectura] == 0) return 0;  // Un bloque COBS no puede contener ceros
+      salida[escritura++] = entrada[lectura++];
+    }
+    if (codigo != 0xFF && lectura < len) salida[escritura++] = 0;  // Cero implicito entre grupos
+  }
+  return escritura;
+}
+
+
+/**
+ * Funcion que dice si un byte es un SYNC valido (con o sin la bandera de reposo)
+ */
+static inline bool syncValido(uint8_t sync) {
+  sync &= ~TELEMETRIA_BANDERA_REPOSO;
+  return sync == TELEMETRIA_SYNC || sync == TELEMETRIA_SYNC_MILIVOLTIOS;
+}
+
+
+size_t codificarTrama(const TramaTelemetria &trama, uint8_t *salida) {
+  uint8_t carga[TELEMETRIA_TAM_CARGA];
+  carga[0] = (trama.milivoltios ? TELEMETRIA_SYNC_MILIVOLTIOS : TELEMETRIA_SYNC) | (trama.reposo ? TELEMETRIA_BANDERA_REPOSO : 0);
+  escribirU16(&carga[1], trama.secuencia);
+  escribirU32(&carga[3], trama.marcaTiempo);
+  uint64_t adc = (uint64_t)(trama.adc[0] & 0x0FFF) | ((uint64_t)(trama.adc[1] & 0x0FFF) << 12) |
+                 ((uint64_t)(trama.adc[2] & 0x0FFF) << 24);  // Tres muestras de 12 bits en 5 bytes
+  for (uint8_t i = 0; i < 5; i++) carga[7 + i] = (uint8_t)(adc >> (8 * i));
+  for (uint8_t i = 0; i < 3; i++) escribirU16(&carga[12 + 2 * i], (uint16_t)trama.gyro[i]);
+  escribirU16(&carga[18], crc16Ccitt(carga, 18));
+  size_t n = cobsCodificar(carga, TELEMETRIA_TAM_CARGA, salida);
+  salida[n++] = 0x00;  // Delimitador de trama
+  return n;
+}
+
+
+bool decodificarTrama(const uint8_t *entrada, size_t len, TramaTelemetria &trama) {
+  uint8_t carga[TELEMETRIA_TAM_MAX];
+  if (len == 0 || len > TELEMETRIA_TAM_MAX) return false;
+  if (cobsDecodificar(entrada, len, carga) != TELEMETRIA_TAM_CARGA) return false;
+  if (!syncValido(carga[0])) return false;
+  if (crc16Ccitt(carga, 18) != leerU16(&carga[18])) return false;
+  trama.secuencia = leerU16(&carga[1]);
+  trama.marcaTiempo = leerU32(&carga[3]);
+  trama.milivoltios = (carga[0] & ~TELEMETRIA_BANDERA_REPOSO) == TELEMETRIA_SYNC_MILIVOLTIOS;
+  trama.reposo = carga[0] & TELEMETRIA_BANDERA_REPOSO;
+  uint64_t adc = 0;
+  for (uint8_t i = 0; i < 5; i++) adc |= (uint64_t)carga[7 + i] << (8 * i);
+  for (uint8_t i = 0; i < 3; i++) {
+    trama.adc[i] = (uint16_t)((adc >> (12 * i)) & 0x0FFF);
+    trama.gyro[i] = (int16_t)leerU16(&carga[12 + 2 * i]);
+  }
+  return true;
+}
+
+
+size_t codificarTexto(const char *texto, size_t len, uint8_t *salida) {
+  uint8_t carga[TELEMETRIA_TEXTO_MAX + 3];
+  if (len > TELEMETRIA_TEXTO_MAX) len = TELEMETRIA_TEXTO_MAX;
+  carga[0] = TELEMETRIA_SYNC_TEXTO;
+  memcpy(&carga[1], texto, len);
+  escribirU16(&carga[1 + len], crc16Ccitt(carga, 1 + len));
+  size_t n = cobsCodificar(carga, len + 3, salida);
+  salida[n++] = 0x00;  // Delimitador de trama
+  return n;
+}
+
+
+bool decodificarTexto(const uint8_t *entrada, size_t len, char *texto, size_t &largo) {
+  uint8_t carga[TELEMETRIA_TAM_MAX_TEXTO];
+  if (len == 0 || len > TELEMETRIA_TAM_MAX_TEXTO) return false;
+  size_t n = cobsDecodificar(entrada, len, carga);
+  if (n < 3 || n > TELEMETRIA_TEXTO_MAX + 3 || carga[0] != TELEMETRIA_SYNC_TEXTO) return false;
+  if (crc16Ccitt(carga, n - 2) != leerU16(&carga[n - 2])) return false;
+  largo = n - 3;
+  memcpy(texto, &carga[1], largo);
+  texto[largo] = '\0';
+  return true;
+}
+
+
+DecodificadorTelemetria::DecodificadorTelemetria()
+    : tramasValidas(0), tramasTexto(0), erroresCrc(0), erroresFormato(0), perdidas(0), marcaExtendida(0), alRecibirTexto(NULL), indice(0),
+      desbordado(false), haySecuencia(false), ultimaSecuencia(0) {}
+
+
+bool DecodificadorTelemetria::procesar(uint8_t byte, TramaTelemetria &trama) {
+  if (byte != 0x00) {  // Byte de datos: se acumula hasta el delimitador
+    if (indice < sizeof(recibido)) recibido[indice++] = byte; else desbordado = true;
+    return false;
+  }
+  size_t len = indice;  // Llego el delimitador: intentamos decodificar lo acumulado
+  bool desborde = desbordado;
+  indice = 0;
+  desbordado = false;
+  if (len == 0) return false;  // Delimitadores seguidos, no es un error
+  uint8_t carga[TELEMETRIA_TAM_MAX_TEXTO];
+  size_t n = desborde ? 0 : cobsDecodificar(recibido, len, carga);
+  if (n >= 3 && carga[0] == TELEMETRIA_SYNC_TEXTO) {  // Mensaje de diagnostico intercalado en el flujo
+    char texto[TELEMETRIA_TEXTO_MAX + 1];
+    size_t largo;
+    if (!decodificarTexto(recibido, len, texto, largo)) {
+      erroresCrc++;
+      return false;
+    }
+    tramasTexto++;
+    if (alRecibirTexto) alRecibirTexto(texto, largo);
+    return false;
+  }
+  if (n != TELEMETRIA_TAM_CARGA || !syncValido(carga[0])) {
+    erroresFormato++;
+    return false;
+  }
+  if (!decodificarTrama(recibido, len, trama)) {  // El formato es correcto, solo pudo fallar el CRC
+    erroresCrc++;
+    return false;
+  }
+  uint16_t salto = (uint16_t)(trama.secuencia - ultimaSecuencia - 1);
+  if (haySecuencia && salto < 0x8000) perdidas += salto;  // Un salto "negativo" es una trama repetida, no una perdida
+  marcaExtendida = haySecuencia ? extenderMarcaTiempo(marcaExtendida, trama.marcaTiempo) : trama.marcaTiempo;
+  haySecuencia = true;
+  ultimaSecuencia = trama.secuencia;
+  tramasValidas++;
+  return true;
+}
@@ -0,0 +1,173 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBTELEMETRIA_H
+#define LIBTELEMETRIA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Formato de la trama de telemetria (antes de aplicar COBS), todos los campos en little endian:
+//  [0]      SYNC (0xA5), identifica el tipo/version de la trama (0xA6 si el ADC va en milivoltios; con
+//           el bit 0x08 si la muestra se tomo a la tasa de reposo, libtasa.h)
+//  [1..2]   Numero de secuencia
+//  [3..6]   Marca de tiempo en microsegundos: los 32 bits bajos de la base de tiempo, que se desbordan cada
+//           71.6 minutos; el receptor la extiende a 64 bits con extenderMarcaTiempo()
+//  [7..11]  ADC x, y, z empaquetados a 12 bits (x | y << 12 | z << 24)
+//  [12..17] Giroscopio x, y, z (int16)
+//  [18..19] CRC-16/CCITT de los bytes 0..17
+// La trama se codifica con COBS y se termina con un byte 0x00, de modo que el receptor
+// se sincroniza buscando el 0x00 sin importar en que punto del flujo empiece a leer.
+//
+// Los mensajes de diagnostico (gestos, GPS, estadisticas) van por el mismo puerto en su propia trama
+// para no romper el flujo binario: SYNC 0xA7, el texto ASCII (sin el 0x00 final, hasta
+// TELEMETRIA_TEXTO_MAX caracteres) y el CRC-16/CCITT de todo lo anterior, tambien con COBS y 0x00.
+#define TELEMETRIA_SYNC 0xA5
+#define TELEMETRIA_SYNC_MILIVOLTIOS 0xA6                     // Misma trama con el ADC calibrado en milivoltios
+#define TELEMETRIA_BANDERA_REPOSO 0x08                       // Bit del SYNC: muestra a la tasa de reposo (0xAD o 0xAE)
+#define TELEMETRIA_TAM_CARGA 20                              // Bytes de la trama sin codificar
+#define TELEMETRIA_TAM_MAX (TELEMETRIA_TAM_CARGA + 2)        // Bytes maximos de la trama codificada (COBS + delimitador)
+#define TELEMETRIA_SYNC_TEXTO 0xA7                           // Trama de diagnostico con texto
+#define TELEMETRIA_TEXTO_MAX 200                             // Caracteres maximos de texto por trama
+#define TELEMETRIA_TAM_MAX_TEXTO (TELEMETRIA_TEXTO_MAX + 5)  // Trama de texto codificada: SYNC, texto, CRC, COBS y delimitador
+
+/**
+ * Contenido de una trama de telemetria
+ */
+struct TramaTelemetria {
+  uint16_t secuencia;    // Numero de secuencia (se desborda solo)
+  uint32_t marcaTiempo;  // Instante de adquisicion en microsegundos (32 bits bajos, ver extenderMarcaTiempo())
+  uint16_t adc[3];       // Muestras de 12 bits de los canales x, y, z (cuentas crudas o milivoltios)
+  bool milivoltios;      // true si adc[] esta en milivoltios calibrados
+  bool reposo = false;   // true si la muestra se tomo a la tasa de reposo (el cambio de este bit marca el de la tasa)
+  int16_t gyro[3];       // Lectura del giroscopio x, y, z
+};
+
+/**
+ * Funcion que extiende una marca de tiempo de 32 bits a 64 bits con la ultima extendida del mismo flujo.
+ * Vale mientras entre las dos marcas haya menos de la mitad del ciclo (35.8 minutos), en cualquier sentido,
+ * asi que tambien sirve para tramas repetidas o reordenadas.
+ * @param anterior Ultima marca extendida
+ * @param marcaTiempo Marca de 32 bits recibida
+ * @return Marca de 64 bits
+ */
+inline uint64_t extenderMarcaTiempo(uint64_t anterior, uint32_t marcaTiempo) {
+  return anterior + (int64_t)(int32_t)(marcaTiempo - (uint32_t)anterior);
+}
+
+/**
+ * Funcion que calcula el CRC-16/CCITT (polinomio 0x1021)
+ * @param datos Bytes sobre los que se calcula el CRC
+ * @param len Numero de bytes
+ * @param crc Valor inicial (0xFFFF, o el CRC parcial para calcularlo por partes)
+ */
+uint16_t crc16Ccitt(const uint8_t *datos, size_t len, uint16_t crc = 0xFFFF);
+
+/**
+ * Funcion que codifica un bloque con COBS (Consistent Overhead Byte Stuffing). La salida
+ * no contiene ningun byte 0x00 y ocupa como maximo len + len / 254 + 1 bytes.
+ * @param entrada Bytes a codificar
+ * @param len Numero de bytes a codificar
+ * @param salida Buffer preasignado donde se escribe el resultado (no puede solaparse con la entrada)
+ * @return Numero de bytes escritos (sin delimitador)
+ */
+size_t cobsCodificar(const uint8_t *entrada, size_t len, uint8_t *salida);
+
+/**
+ * Funcion que decodifica un bloque COBS (sin el delimitador 0x00)
+ * @param entrada Bytes codificados
+ * @param len Numero de bytes codificados
+ * @param salida Buffer donde se escribe el resultado (al menos len bytes)
+ * @return Numero de bytes decodificados, o 0 si el bloque esta mal formado
+ */
+size_t cobsDecodificar(const uint8_t *entrada, size_t len, uint8_t *salida);
+
+/**
+ * Funcion que empaqueta una trama, le calcula el CRC y la codifica con COBS. No usa memoria dinamica.
+ * @param trama Trama a codificar
+ * @param salida Buffer preasignado de al menos TELEMETRIA_TAM_MAX bytes
+ * @return Numero de bytes a transmitir, incluido el delimitador 0x00
+ */
+size_t codificarTrama(const TramaTelemetria &trama, uint8_t *salida);
+
+/**
+ * Funcion que decodifica una trama COBS recibida (sin el delimitador) y verifica su CRC
+ * @param entrada Bytes codificados de la trama
+ * @param len Numero de bytes
+ * @param trama Donde se escribe la trama decodificada
+ * @return true si la trama es valida
+ */
+bool decodificarTrama(const uint8_t *entrada, size_t len, TramaTelemetria &trama);
+
+/**
+ * Funcion que arma una trama de diagnostico con un texto y la codifica con COBS
+ * @param texto Caracteres del mensaje (se recorta a TELEMETRIA_TEXTO_MAX)
+ * @param len Numero de caracteres
+ * @param salida Buffer preasignado de al menos TELEMETRIA_TAM_MAX_TEXTO bytes
+ * @return Numero de bytes a transmitir, incluido el delimitador 0x00
+ */
+size_t codificarTexto(const char *texto, size_t len, uint8_t *salida);
+
+/**
+ * Funcion que decodifica una trama de diagnostico COBS recibida (sin el delimitador) y verifica su CRC
+ * @param entrada Bytes codificados de la trama
+ * @param len Numero de bytes
+ * @param texto Donde se escribe el mensaje terminado en '\0' (al menos TELEMETRIA_TEXTO_MAX + 1 bytes)
+ * @param largo Donde se escribe el numero de caracteres
+ * @return true si la trama es de texto y es valida
+ */
+bool decodificarTexto(const uint8_t *entrada, size_t len, char *texto, size_t &largo);
+
+/**
+ * Decodificador de flujo para el lado del computador (o de un gateway): recibe los bytes
+ * del puerto serial uno a uno, separa las tramas por el delimitador 0x00 y las valida.
+ */
+class DecodificadorTelemetria {
+public:
+  DecodificadorTelemetria();
+
+  /**
+   * Funcion que procesa un byte recibido
+   * @param byte Byte recibido
+   * @param trama Donde se escribe la trama cuando se completa una valida
+   * @return true si con este byte se completo una trama valida
+   */
+  bool procesar(uint8_t byte, TramaTelemetria &trama);
+
+  uint32_t tramasValidas;   // Tramas decodificadas correctamente
+  uint32_t tramasTexto;     // Tramas de diagnostico validas (no cuentan como errores ni como tramas)
+  uint32_t erroresCrc;      // Tramas descartadas por CRC incorrecto
+  uint32_t erroresFormato;  // Tramas descartadas por COBS, longitud o SYNC invalidos
+  uint32_t perdidas;        // Tramas perdidas segun los saltos del numero de secuencia
+  uint64_t marcaExtendida;  // Marca de tiempo de la ultima trama valida extendida a 64 bits (no se desborda)
+  void (*alRecibirTexto)(const char *texto, size_t len);  // Si no es NULL, recibe cada mensaje de diagnostico
+
+private:
+  uint8_t recibido[TELEMETRIA_TAM_MAX_TEXTO];
+  size_t indice;
+  bool desbordado;
+  bool haySecuencia;
+  uint16_t ultimaSecuencia;
+};
+
+#endif
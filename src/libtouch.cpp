@@ -0,0 +1,164 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libtouch.h"
+#include <atomic>
+#include "libringbuffer.h"
+#include "libcaptura.h"
+
+static const Touchpad *tablaTouch = NULL;
+static uint8_t numTouch = 0;
+static DetectorTouch detectores[TOUCH_MAX_PADS];
+static uint16_t umbralesProgramados[TOUCH_MAX_PADS];
+static int tareaTouch = -1;
+static int tareaDespachador = -1;
+static ManejadorGesto manejadorGesto = NULL;
+static BufferCircular<EventoTouch, TOUCH_TAM_COLA> eventosTouch; // Tarea de muestreo -> tarea despachadora
+static ReconocedorGestos reconocedor;  // Solo lo usa la tarea despachadora
+static bool touchActivo = false;          // Hay algun pad pulsado o cambiando de estado
+static uint64_t ultimaBaseUs = 0;
+static std::atomic<uint32_t> interrupcionesTouch(0);
+static EstadisticasTouch estadisticas;
+
+
+/**
+ * Funcion que atiende la interrupcion de los touchpads: solo despierta la tarea del motor
+ */
+static void IRAM_ATTR isrTouch() {
+  interrupcionesTouch.fetch_add(1, std::memory_order_relaxed);
+  halNotificar(tareaTouch);
+}
+
+
+/**
+ * Funcion que programa en la interrupcion el umbral de un pad si cambio su linea base
+ */
+static void programarUmbral(uint8_t i) {
+  uint16_t umbral = detectores[i].umbral();
+  if (umbral == umbralesProgramados[i]) return;
+  umbralesProgramados[i] = umbral;
+  halTouchInterrupcion(tablaTouch[i].pin, umbral, isrTouch);
+}
+
+
+/**
+ * Manejador de la tarea del motor: se ejecuta con la interrupcion, cada TOUCH_PERIODO_ACTIVO_US
+ * mientras hay pads pulsados y cada TOUCH_PERIODO_BASE_US en reposo
+ */
+static void atenderTouch() {
+  uint64_t ahora = halMicros();
+  estadisticas.despertares++;
+  bool activo = false;
+  uint16_t lecturas[TOUCH_MAX_PADS];
+  for (uint8_t i = 0; i < numTouch; i++) lecturas[i] = halTouchLeer(tablaTouch[i].pin);
+  capturarTouch(ahora, lecturas, numTouch);
+  for (uint8_t i = 0; i < numTouch; i++) {
+    int8_t cambio = detectores[i].actualizar(lecturas[i], ahora);
+    if (cambio != 0) {
+      if (cambio > 0) estadisticas.pulsaciones++;
+      eventosTouch.push(EventoTouch{ahora, i, cambio > 0});  // Si la cola esta llena el evento se cuenta como perdido
+      halNotificar(tareaDespachador);
+    }
+    if (detectores[i].estaPulsado() || detectores[i].enTransicion()) activo = true;
+  }
+  if (!activo && (touchActivo || ahora - ultimaBaseUs >= TOUCH_PERIODO_BASE_US)) {
+    ultimaBaseUs = ahora;
+    for (uint8_t i = 0; i < numTouch; i++) programarUmbral(i);  // Los umbrales siguen a las lineas base
+  }
+  if (activo != touchActivo) {
+    touchActivo = activo;
+    halEsperaTarea(tareaTouch, activo ? TOUCH_PERIODO_ACTIVO_US : TOUCH_PERIODO_BASE_US);
+  }
+}
+
+
+/**
+ * Funcion que entrega los gestos al manejador del usuario
+ */
+static void despacharGestos(const GestoTouch *gestos, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    estadisticas.gestos++;
+    if (manejadorGesto) manejadorGesto(gestos[i]);
+  }
+}
+
+
+/**
+ * Manejador de la tarea despachadora: consume los eventos de la cola, reconoce los gestos y
+ * duerme hasta el siguiente evento o el siguiente plazo del reconocedor
+ */
+static void atenderDespachador() {
+  GestoTouch gestos[4];
+  EventoTouch evento;
+  while (eventosTouch.pop(evento)) {
+    uint64_t latencia = halMicros() - evento.marcaTiempo;
+    if (latencia > estadisticas.latenciaMaximaUs) estadisticas.latenciaMaximaUs = (uint32_t)latencia;
+    despacharGestos(gestos, reconocedor.procesar(evento, gestos, 4));
+  }
+  uint64_t ahora = halMicros();
+  despacharGestos(gestos, reconocedor.revisar(ahora, gestos, 4));
+  uint64_t vencimiento = reconocedor.proximoVencimiento();
+  uint64_t espera = (vencimiento == GESTO_SIN_VENCIMIENTO) ? TOUCH_PERIODO_BASE_US : vencimiento - ahora;
+  halEsperaTarea(tareaDespachador, (uint32_t)(espera > TOUCH_PERIODO_BASE_US ? TOUCH_PERIODO_BASE_US : (espera ? espera : 1)));
+}
+
+
+bool iniciarTouch(const Touchpad *pads, uint8_t numPads, ManejadorGesto alGesto, uint8_t prioridad,
+                  uint8_t prioridadDespachador, uint8_t nucleo) {
+  if (numPads > TOUCH_MAX_PADS || numPads > GESTOS_MAX_PADS) return false;
+  manejadorGesto = alGesto;
+  tablaTouch = pads;
+  numTouch = numPads;
+  for (uint8_t i = 0; i < numTouch; i++) {
+    uint32_t suma = 0;
+    for (uint8_t k = 0; k < 8; k++) suma += halTouchLeer(pads[i].pin);  // Linea base inicial con el pad sin tocar
+    detectores[i].iniciar((uint16_t)(suma >> 3), pads[i].sensibilidad);
+    umbralesProgramados[i] = 0;
+  }
+  tareaDespachador = halTareaEventos(atenderDespachador, TOUCH_PERIODO_BASE_US, "Gestos Touch", prioridadDespachador, nucleo);
+  tareaTouch = halTareaEventos(atenderTouch, TOUCH_PERIODO_BASE_US, "Touch", prioridad, nucleo);
+  if (tareaTouch < 0 || tareaDespachador < 0) return false;
+  ultimaBaseUs = halMicros();
+  for (uint8_t i = 0; i < numTouch; i++) programarUmbral(i);
+  return true;
+}
+
+
+bool touchPulsado(uint8_t indice) {
+  return indice < numTouch && detectores[indice].estaPulsado();
+}
+
+
+uint16_t touchLineaBase(uint8_t indice) {
+  return (indice < numTouch) ? detectores[indice].lineaBase() : 0;
+}
+
+
+EstadisticasTouch estadisticasTouch() {
+  EstadisticasTouch e = estadisticas;
+  e.interrupciones = interrupcionesTouch.load(std::memory_order_relaxed);
+  e.eventosPerdidos = eventosTouch.perdidas();
+  e.recalibraciones = 0;
+  for (uint8_t i = 0; i < numTouch; i++) e.recalibraciones += detectores[i].totalRecalibraciones();
+  return e;
+}
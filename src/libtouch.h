@@ -0,0 +1,175 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBTOUCH_H
+#define LIBTOUCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libhal.h"
+#include "libgestos.h"
+
+// Motor de los touchpads capacitivos. El valor que entrega el sensor baja cuando se toca el pad,
+// pero el valor en reposo cambia con la temperatura, la humedad y la piel, asi que cada pad tiene
+// una linea base que se sigue lentamente y el umbral de pulsacion es un porcentaje de ella.
+// La tarea del motor duerme hasta que la interrupcion de los touchpads del ESP32 indica que algun
+// pad bajo de su umbral; solo entonces lee los pads cada TOUCH_PERIODO_ACTIVO_US hasta que se
+// sueltan. En reposo despierta cada TOUCH_PERIODO_BASE_US para actualizar las lineas base y
+// reprogramar los umbrales de la interrupcion.
+// La tarea de muestreo no ejecuta codigo del usuario: solo publica cada transicion con su marca
+// de tiempo en una cola sin bloqueos. Una tarea despachadora de menor prioridad consume la cola,
+// reconoce los gestos (libgestos.h) y llama al manejador del usuario.
+
+#define TOUCH_MAX_PADS 10                 // El ESP32 tiene 10 touchpads
+#define TOUCH_PERIODO_ACTIVO_US 10000     // Periodo de lectura mientras hay algun pad pulsado
+#define TOUCH_PERIODO_BASE_US 1000000     // Periodo de actualizacion de las lineas base en reposo
+#define TOUCH_CONFIRMACIONES 3            // Lecturas seguidas necesarias para aceptar un cambio (antirebote)
+#define TOUCH_ALFA_BASE 3                 // La linea base avanza 1/2^TOUCH_ALFA_BASE hacia cada lectura en reposo
+#define TOUCH_MAX_PULSADO_US 20000000     // Una pulsacion mas larga se toma como deriva y se recalibra la linea base
+#define TOUCH_TAM_COLA 32                 // Eventos que caben en la cola hacia el despachador (potencia de 2)
+
+/**
+ * Configuracion de un touchpad en la tabla que recibe iniciarTouch()
+ */
+struct Touchpad {
+  uint8_t pin;                 // Pin del touchpad
+  uint8_t sensibilidad;        // Caida en porcentaje de la linea base que cuenta como pulsacion
+};
+
+typedef void (*ManejadorGesto)(const GestoTouch &gesto);
+
+/**
+ * Logica de deteccion de un touchpad, independiente del hardware para poder probarla con
+ * trazas grabadas: recibe cada lectura y decide si el pad se pulso o se solto
+ */
+class DetectorTouch {
+public:
+  DetectorTouch() : base16(0), confirmaciones(0), pulsado(false), inicioPulsacionUs(0), sensibilidad(20), recalibraciones(0) {}
+
+  /**
+   * Funcion que reinicia el detector tomando una lectura en reposo como linea base
+   * @param valor Lectura del pad sin tocar
+   * @param porcentaje Caida en porcentaje de la linea base que cuenta como pulsacion
+   */
+  void iniciar(uint16_t valor, uint8_t porcentaje) {
+    base16 = (uint32_t)valor << 4;
+    sensibilidad = porcentaje;
+    confirmaciones = 0;
+    pulsado = false;
+  }
+
+  /**
+   * Funcion que procesa una lectura del pad
+   * @param valor Lectura cruda del pad
+   * @param tiempoUs Instante de la lectura
+   * @return 1 si el pad se acaba de pulsar, -1 si se acaba de soltar, 0 si no hubo cambio
+   */
+  int8_t actualizar(uint16_t valor, uint64_t tiempoUs) {
+    if (pulsado && tiempoUs - inicioPulsacionUs > TOUCH_MAX_PULSADO_US) {
+      // Nadie sostiene un pad tanto tiempo: la linea base se corrio hacia abajo, la volvemos a tomar
+      recalibraciones++;
+      iniciar(valor, sensibilidad);
+      return -1;
+    }
+    bool cambio = pulsado ? (valor > umbralSoltar()) : (valor < umbral());
+    if (!cambio) {
+      confirmaciones = 0;
+      if (!pulsado) base16 += (int32_t)(((int32_t)valor << 4) - (int32_t)base16) >> TOUCH_ALFA_BASE;  // La linea base solo sigue al pad en reposo
+      return 0;
+    }
+    if (++confirmaciones < TOUCH_CONFIRMACIONES) return 0;
+    confirmaciones = 0;
+    pulsado = !pulsado;
+    if (pulsado) inicioPulsacionUs = tiempoUs;
+    return pulsado ? 1 : -1;
+  }
+
+  /**
+   * Umbral por debajo del cual el pad se considera pulsado
+   */
+  uint16_t umbral() const { return (uint16_t)((base16 * (100 - sensibilidad)) / 1600); }
+
+  /**
+   * Umbral por encima del cual un pad pulsado se considera suelto (con histeresis de media sensibilidad)
+   */
+  uint16_t umbralSoltar() const { return (uint16_t)((base16 * (100 - sensibilidad / 2)) / 1600); }
+
+  uint16_t lineaBase() const { return (uint16_t)(base16 >> 4); }
+  bool estaPulsado() const { return pulsado; }
+  bool enTransicion() const { return confirmaciones > 0; }
+  uint32_t totalRecalibraciones() const { return recalibraciones; }
+
+private:
+  uint32_t base16;          // Linea base con 4 bits de fraccion
+  uint8_t confirmaciones;   // Lecturas seguidas que apuntan a un cambio de estado
+  bool pulsado;
+  uint64_t inicioPulsacionUs;
+  uint8_t sensibilidad;
+  uint32_t recalibraciones;
+};
+
+/**
+ * Contadores del motor de touchpads
+ */
+struct EstadisticasTouch {
+  uint32_t despertares;     // Veces que se ejecuto la tarea del motor
+  uint32_t interrupciones;  // Interrupciones de los touchpads recibidas
+  uint32_t pulsaciones;     // Pulsaciones detectadas entre todos los pads
+  uint32_t recalibraciones; // Lineas base recalibradas por pulsaciones demasiado largas
+  uint32_t eventosPerdidos; // Eventos descartados porque la cola del despachador estaba llena
+  uint32_t gestos;          // Gestos entregados al manejador
+  uint32_t latenciaMaximaUs; // Maximo tiempo entre un evento y su despacho
+};
+
+/**
+ * Funcion que inicializa los touchpads de la tabla y la tarea que los atiende, se usa en el setup().
+ * Los pads no se deben tocar durante la inicializacion porque se toma su linea base
+ * @param pads Tabla de touchpads (debe seguir existiendo mientras el motor funcione)
+ * @param numPads Numero de touchpads de la tabla (maximo TOUCH_MAX_PADS)
+ * @param alGesto Funcion que recibe los gestos reconocidos, se ejecuta en la tarea despachadora
+ * @param prioridad Prioridad de la tarea de muestreo de los touch
+ * @param prioridadDespachador Prioridad de la tarea despachadora (menor que la de muestreo)
+ * @param nucleo Nucleo al que se fijan las tareas
+ * @return true si el motor quedo funcionando
+ */
+bool iniciarTouch(const Touchpad *pads, uint8_t numPads, ManejadorGesto alGesto, uint8_t prioridad,
+                  uint8_t prioridadDespachador, uint8_t nucleo);
+
+/**
+ * Funcion que indica si un touchpad de la tabla esta pulsado
+ * @param indice Posicion del pad en la tabla
+ */
+bool touchPulsado(uint8_t indice);
+
+/**
+ * Funcion que da la linea base actual de un touchpad de la tabla
+ * @param indice Posicion del pad en la tabla
+ */
+uint16_t touchLineaBase(uint8_t indice);
+
+/**
+ * Funcion que da los contadores del motor
+ */
+EstadisticasTouch estadisticasTouch();
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "libtransmisorlora.h"
+#include <string.h>
+#include <atomic>
+#include "libhal.h"
+#include "libringbuffer.h"
+
+/**
+ * Buffer preasignado de un paquete en la cola
+ */
+struct PaqueteLoRa {
+  uint8_t len;
+  uint8_t datos[TX_TAM_PAQUETE];
+};
+
+static BufferCircular<PaqueteLoRa, TX_NUM_PAQUETES> colaTx; // Camino de procesamiento -> tarea del transmisor
+static int tareaTx = -1;
+static int pinRst, pinNss, pinIrq;
+static long frecuenciaRadio;
+static std::atomic<bool> radioIniciado(false);  // Lo escribe la tarea del transmisor y lo lee el camino de procesamiento
+static bool radioOcupado = false;            // Se entrego un paquete y el radio aun no termina de enviarlo
+static uint64_t inicioTransmisionUs = 0;
+static uint64_t proximoIntentoUs = 0;
+static uint32_t esperaReintentoUs = TX_ESPERA_MIN_US;
+static EstadisticasTransmisor estadisticas;
+static bool (*siguienteRespaldo)(const uint8_t *&datos, size_t &len) = NULL;
+static void (*enviadoRespaldo)() = NULL;
+
+
+/**
+ * Funcion que intenta iniciar el radio y programa el siguiente intento si falla
+ */
+static void intentarIniciarRadio() {
+  bool iniciado = halRadioIniciar(pinRst, pinNss, pinIrq, frecuenciaRadio);
+  radioIniciado.store(iniciado, std::memory_order_release);
+  if (iniciado) {
+    esperaReintentoUs = TX_ESPERA_MIN_US;
+    radioOcupado = false;
+    return;
+  }
+  estadisticas.fallosInicio++;
+  proximoIntentoUs = halMicros() + esperaReintentoUs;
+  esperaReintentoUs = (esperaReintentoUs * 2 > TX_ESPERA_MAX_US) ? TX_ESPERA_MAX_US : esperaReintentoUs * 2;
+}
+
+
+/**
+ * Manejador de la tarea del transmisor: se ejecuta con cada fin de transmision, cada paquete
+ * nuevo o cada TX_SONDEO_US
+ */
+static void atenderTransmisor() {
+  uint64_t ahora = halMicros();
+  if (!radioIniciado.load(std::memory_order_relaxed)) {
+    if (ahora >= proximoIntentoUs) intentarIniciarRadio();
+    if (!radioIniciado.load(std::memory_order_relaxed)) return;
+  }
+  if (radioOcupado && !halRadioTransmitiendo()) {  // Sondeo de las banderas del radio por SPI, aqui y no en una interrupcion
+    estadisticas.terminados++;
+    radioOcupado = false;
+  }
+  // La cola propia va primero: tiene los paquetes anteriores a los que se guardaron en el respaldo
+  bool deCola = colaTx.disponibles() > 0;
+  const uint8_t *datos;
+  size_t len;
+  if (!deCola && !(siguienteRespaldo && siguienteRespaldo(datos, len))) return;
+  // El radio solo rechaza un paquete mientras transmite: si aun lo hace tanto despues del ultimo, se trabo
+  bool trabado = ahora - inicioTransmisionUs > TX_TRABADO_US;
+  if (radioOcupado && !trabado) return;  // Volvemos a sondear en TX_SONDEO_US
+  if (deCola) {
+    Ventana<PaqueteLoRa> siguiente = colaTx.primeras(1);  // Se envia directo desde el buffer de la cola, sin copiarlo
+    datos = siguiente[0].datos;
+    len = siguiente[0].len;
+  }
+  if (halRadioEnviar(datos, len)) {
+    if (deCola) {
+      colaTx.descartar(1);  // El radio ya copio la carga util a su FIFO, el buffer queda libre
+    } else {
+      enviadoRespaldo();
+      estadisticas.reenviados++;
+    }
+    estadisticas.enviados++;
+    radioOcupado = true;
+    inicioTransmisionUs = ahora;
+  } else if (trabado) {
+    estadisticas.reinicios++;  // Ningun paquete dura tanto en el aire: el radio se trabo
+    radioIniciado.store(false, std::memory_order_release);
+    proximoIntentoUs = ahora;
+  }
+}
+
+
+bool iniciarTransmisorLoRa(int rst, int nss, int irq, long frecuencia, uint8_t prioridad, uint8_t nucleo) {
+  pinRst = rst;
+  pinNss = nss;
+  pinIrq = irq;
+  frecuenciaRadio = frecuencia;
+  memset(&estadisticas, 0, sizeof(estadisticas));
+  intentarIniciarRadio();
+  tareaTx = halTareaEventos(atenderTransmisor, TX_SONDEO_US, "Transmisor LoRa", prioridad, nucleo);
+  return radioIniciado.load(std::memory_order_acquire);
+}
+
+
+bool encolarPaqueteLoRa(const uint8_t *datos, size_t len) {
+  PaqueteLoRa *paquete = (len <= TX_TAM_PAQUETE) ? colaTx.reservar() : NULL;
+  if (paquete == NULL) {
+    estadisticas.descartados++;
+    return false;
+  }
+  paquete->len = (uint8_t)len;  // El paquete se arma directo en su posicion de la cola
+  memcpy(paquete->datos, datos, len);
+  colaTx.publicar();
+  estadisticas.encolados++;
+  uint32_t enCola = colaTx.disponibles();
+  if (enCola > estadisticas.maximoEnCola) estadisticas.maximoEnCola = enCola;
+  halNotificar(tareaTx);
+  return true;
+}
+
+
+size_t espacioColaLoRa() {
+  return colaTx.capacidad() - colaTx.disponibles();
+}
+
+
+void fuenteRespaldoLoRa(bool (*siguiente)(const uint8_t *&datos, size_t &len), void (*enviado)()) {
+  siguienteRespaldo = siguiente;
+  enviadoRespaldo = enviado;
+}
+
+
+bool radioLoRaListo() {
+  return radioIniciado.load(std::memory_order_acquire);
+}
+
+
+EstadisticasTransmisor estadisticasTransmisorLoRa() {
+  EstadisticasTransmisor e = estadisticas;
+  e.enCola = colaTx.disponibles();
+  return e;
+}
@@ -0,0 +1,103 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef LIBTRANSMISORLORA_H
+#define LIBTRANSMISORLORA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Transmisor LoRa asincrono: el camino de procesamiento solo copia cada paquete a una cola
+// acotada de buffers preasignados y sigue adquiriendo; una tarea aparte le pasa los paquetes
+// al radio uno a la vez. Mientras el radio transmite un paquete el empaquetador ya llena el
+// siguiente, y la tarea sondea las banderas del radio por SPI para saber cuando termino (nunca
+// desde una interrupcion: la libreria LoRa haria SPI en la ISR de DIO0). Si el radio no inicia o se queda trabado se reintenta con espera
+// exponencial en vez de detener el programa.
+
+#define TX_NUM_PAQUETES 4            // Paquetes en la cola (potencia de 2)
+#define TX_TAM_PAQUETE 255           // Carga util maxima del SX1278
+#define TX_SONDEO_US 10000           // Periodo de sondeo del fin de transmision del radio
+#define TX_ESPERA_MIN_US 100000      // Primera espera antes de reintentar iniciar el radio
+#define TX_ESPERA_MAX_US 30000000    // Espera maxima entre reintentos
+#define TX_TRABADO_US 2000000        // Tiempo que el radio puede estar ocupado antes de reiniciarlo
+
+/**
+ * Contadores del transmisor
+ */
+struct EstadisticasTransmisor {
+  uint32_t encolados;     // Paquetes aceptados en la cola
+  uint32_t enviados;      // Paquetes entregados al radio
+  uint32_t reenviados;    // De los enviados, los que vinieron de la fuente de respaldo
+  uint32_t descartados;   // Paquetes descartados porque la cola estaba llena
+  uint32_t terminados;    // Fines de transmision detectados al sondear el radio
+  uint32_t fallosInicio;  // Intentos fallidos de iniciar el radio
+  uint32_t reinicios;     // Veces que el radio se reinicio por quedarse trabado
+  uint32_t enCola;        // Paquetes esperando en este momento
+  uint32_t maximoEnCola;  // Maximo de paquetes que llegaron a estar en espera
+};
+
+/**
+ * Funcion que crea la tarea del transmisor e intenta iniciar el radio. Si el radio no responde
+ * la tarea lo sigue intentando con espera exponencial
+ * @param rst Pin de reset del RA-02
+ * @param nss Pin de seleccion de esclavo del RA-02
+ * @param irq Pin de DIO0 del RA-02 (no se usa para el fin de transmision, que se sondea)
+ * @param frecuencia Frecuencia de operacion en Hz
+ * @param prioridad Prioridad de la tarea del transmisor (menor que la de adquisicion)
+ * @param nucleo Nucleo al que se fija la tarea
+ * @return true si el radio inicio en el primer intento
+ */
+bool iniciarTransmisorLoRa(int rst, int nss, int irq, long frecuencia, uint8_t prioridad, uint8_t nucleo);
+
+/**
+ * Funcion que copia un paquete a su posicion en la cola del transmisor sin bloquear (un solo productor)
+ * @param datos Carga util
+ * @param len Numero de bytes (maximo TX_TAM_PAQUETE)
+ * @return true si se encolo, false si la cola estaba llena y el paquete se descarto
+ */
+bool encolarPaqueteLoRa(const uint8_t *datos, size_t len);
+
+/**
+ * Funcion que da cuantos paquetes mas caben en la cola sin descartar ninguno
+ */
+size_t espacioColaLoRa();
+
+/**
+ * Funcion que conecta una segunda fuente de paquetes (por ejemplo la bitacora de respaldo) que el
+ * transmisor atiende cuando su propia cola esta vacia
+ * @param siguiente Da el siguiente paquete sin sacarlo, o false si no hay
+ * @param enviado Se llama cuando el radio ya tomo el paquete que dio siguiente()
+ */
+void fuenteRespaldoLoRa(bool (*siguiente)(const uint8_t *&datos, size_t &len), void (*enviado)());
+
+/**
+ * Funcion que indica si el radio ya esta iniciado
+ */
+bool radioLoRaListo();
+
+/**
+ * Funcion que da los contadores del transmisor
+ */
+EstadisticasTransmisor estadisticasTransmisorLoRa();
+
+#endif
@@ -24,44 +24,78 @@
 
 #include <Arduino.h>
 #include <stdint.h>
-#include "libtouchesp32.h"
+#include "libtouch.h"
 #include "libadcesp32.h"
-#include <driver/dac.h>
 #include "libloraesp32.h"
+#include "libhal.h"
+#include "libprocesamiento.h"
+#include "libescaneoadc.h"
+#include "libgiroscopio.h"
+#include "libgps.h"
+#include "libbasetiempo.h"
+#include "libinstrumentacion.h"
+#include "libplanificador.h"
+#include "libbitacora.h"
+#include "libcalibracion.h"
+#include "libdecimador.h"
+#include "libcaptura.h"
 #include <Wire.h>
 #include <L3G.h>
-#include <TinyGPSPlus.h>
 
 // Pines usados para el modulo LoRa RA-02 (Fijos en el Weareable EEG V1.0)
 #define RST_RA 4  // RESET del RA-02 esta conectado a IO4
 #define NSS 5     // NSS del RA-02 esta conectado a IO4
 #define IRQ_NA 13 // La salida IO0 del RA-02 usada para indicar que llego un dato, (no esta conectada en Weareable EEG v1.0 pero se asigna IO13 que esta libre()
 
-#define SAMPLING_FREQ 256 // En Hz, escoge la frecuencia de muestreo
-#define SIZE_BUF 256      // Tamaño del buffer de datos a transmitir por LoRa
+#define PIN_PPS_GPS -1 // La salida PPS del GPS no esta conectada en el Weareable EEG V1.0; si se conecta ponga aqui su pin
+
+// Pines de los touchpads
+#define TOUCH_1 27
+#define TOUCH_2 14
+#define TOUCH_3 12
+
+//#define ADQUISICION_DMA // Quite el comentario para adquirir por bloques con el I2S/DMA en vez de una interrupcion de timer por muestra
+#define MUESTRAS_POR_BLOQUE_DMA 32 // Muestras por canal que entrega el DMA en cada bloque (la CPU despierta una vez por bloque)
+//#define ADQUISICION_SOBREMUESTREO // Quite el comentario para muestrear por I2S/DMA a FACTOR_SOBREMUESTREO veces SAMPLING_FREQ y decimar con un CIC (mas bits efectivos)
+#define MUESTRAS_POR_BLOQUE_SOBREMUESTREO 8 // Muestras de salida por bloque del DMA (8 x 32 x 3 canales = 768 palabras; 4 con x64)
+//#define SALIDA_MILIVOLTIOS // Quite el comentario para procesar y transmitir milivoltios calibrados en vez de cuentas del ADC
+//#define LORA_SOLO_ANOMALIAS // Quite el comentario para enviar por LoRa solo los latidos y la señal alrededor de los latidos anomalos
+//#define TASA_ADAPTATIVA // Quite el comentario para bajar la tasa de muestreo mientras el usuario esta quieto (solo con la adquisicion por timer)
+//#define GRABAR_CAPTURA // Quite el comentario para sacar por el serial las entradas crudas de los sensores (libcaptura.h, ~7 KB/s) en vez de la telemetria, para reproducirlas en el simulador
+#if defined(TASA_ADAPTATIVA) && (defined(ADQUISICION_DMA) || defined(ADQUISICION_SOBREMUESTREO))
+#error "La tasa adaptativa cambia el periodo del trabajo del ADC en el planificador, no el del I2S/DMA"
+#endif
 
 // Declaracion de las funciones a utilizar en este programa
-void enTouch1Pulsado(); // Funcion que se ejecuta cuando se ha tocado el touchpad 1
-void enTouch2Pulsado(); // Funcion que se ejecuta cuando se ha tocado el touchpad 1
-void enTouch3Pulsado(); // Funcion que se ejecuta cuando se ha tocado el touchpad 1
+void enGestoTouch(const GestoTouch &gesto); // Funcion que se ejecuta cuando se reconoce un gesto en los touchpads
+const Touchpad TOUCHPADS[] = { // Pin, caida de la linea base en % que cuenta como pulsacion
+    {TOUCH_1, 25},
+    {TOUCH_2, 25},
+    {TOUCH_3, 25}};
 void filtrar();         // Funcion que filtra digitalmente la señal analoga en ADC1_7 (IO35) y la transmite por un modulo LoRa
+void filtrarBloque(const uint16_t *muestras, size_t numMuestras, uint8_t numCanales); // Funcion que procesa un bloque de muestras del DMA
+void filtrarSobremuestreo(const uint16_t *muestras, size_t numMuestras, uint8_t numCanales); // Funcion que decima un bloque sobremuestreado
 L3G gyro;               // Objeto que representa el giroscopio
-TinyGPSPlus gps;        // Objeto que representa el GPS
 void displayInfo();     // Funcion que muestra los datos del GPS
+void atenderComandos(); // Funcion que atiende los comandos de texto del puerto serial
 
 
-uint8_t voltajeSalida = 0;   // Variable que almacena el voltaje que sera sacado por el canal DAC1
-uint8_t voltajeSalidaHi = 0; // Variable que almacena el voltaje que sera sacado por el canal DAC1
-uint8_t voltajeSalidaLo = 0; // Variable que almacena el voltaje que sera sacado por el canal DAC1
+const uint8_t CANALES_ADC[] = {7, 5, 4};           // Canales del ADC1 escaneados: IO35, IO33 e IO32
+static_assert(sizeof(CANALES_ADC) >= 1 && sizeof(CANALES_ADC) <= 3, "MuestraADC lleva de uno a tres canales (x, y, z)");
+EscaneoADC1<7, 5, 4> escaneoADC;                   // Escaneo por registros de los mismos canales
+void compararEscaneoADC();                         // Funcion que mide el escaneo por registros contra analogRead
+TablaCalibracion calibracionADC[3];                // Conversion a milivoltios de cada canal escaneado (8KB por canal)
+bool calibrarADC();                                // Funcion que llena las tablas con la calibracion del eFuse
+// Decimador del sobremuestreo: CIC de ETAPAS_CIC etapas y compensador plano hasta el corte del pasa bajos del EKG
+constexpr std::array<int32_t, 3> COMPENSADOR_CIC =
+    cuantizarFIR<int32_t>(disenarCompensadorCIC(ETAPAS_CIC, FACTOR_SOBREMUESTREO, SAMPLING_FREQ, CORTE_PASA_BAJOS));
+static_assert(MUESTRAS_POR_BLOQUE_SOBREMUESTREO * FACTOR_SOBREMUESTREO * sizeof(CANALES_ADC) <= ADC_BLOQUE_MAX_PALABRAS,
+              "El bloque del sobremuestreo no cabe en el DMA: reduzca MUESTRAS_POR_BLOQUE_SOBREMUESTREO");
+typedef SobremuestreoADC<sizeof(CANALES_ADC), ETAPAS_CIC, FACTOR_SOBREMUESTREO> SobremuestreoEKG;
+SobremuestreoEKG sobremuestreo(COMPENSADOR_CIC);
+uint64_t ciclosDecimador = 0;                      // Ciclos gastados en el decimador (costo del sobremuestreo)
+uint64_t muestrasDecimador = 0;                    // Muestras por canal que entraron al decimador
 
-uint8_t buffer[SIZE_BUF * 2]; // Buffer de datos a transmitir por LoRa
-const uint8_t *buf;          // Puntero al buffer de datos a transmitir por LoRa
-float lat = 0.0;  //Variables que almacenan la latitud y longitud del GPS
-float lon = 0.0; 
-int month = 0;  //Variables que almacenan la fecha y hora del GPS
-int day = 0; 
-int year = 0; 
-String tiempo; //Variable que almacena la hora del GPS en formato de cadena de caracteres
 
 
 
@@ -75,58 +109,112 @@ void setup()
   Serial.begin(115200); // Ajustamos el puerto serial a 115200 bits por segundo
   while (!Serial)
     ;                  // Esperamos a que se inicialice el puerto serial en un bucle infinito
+  Serial2.setRxBufferSize(1024); // Buffer de recepcion del GPS con margen para mas de un segundo de frases NMEA
   Serial2.begin(9600); // Ajustamos el puerto serial a 115200 bits por segundo
   while (!Serial2)
     ; // Esperamos a que se inicialice el puerto serial en un bucle infinito
 
   //************************ Inicializacion del modulo LoRa RA-02
-  // setLoRa(RST_RA, NSS, IRQ_NA, 433E6);
+  // setLoRa(RST_RA, NSS, IRQ_NA, 433E6); // Crea la tarea del transmisor, que reintenta si el radio no responde
+  // Bitacora en la particion "bitacora" de la flash: guarda los paquetes que el radio no puede enviar (prioridad 0, nucleo 1)
+  if (!iniciarBitacora(0, 1)) enviarDiagnostico("No se encontro la particion de la bitacora, los paquetes sin radio se pierden");
+#ifdef LORA_SOLO_ANOMALIAS
+  const bool soloAnomalias = true;  // Los latidos siempre salen en sus propios paquetes; la señal solo alrededor de las anomalias
+#else
+  const bool soloAnomalias = false;
+#endif
+#ifdef SALIDA_MILIVOLTIOS
+  iniciarProcesamiento(false, calibrarADC() ? calibracionADC : NULL, soloAnomalias); // Cambie a true si se inicializa el modulo LoRa con setLoRa()
+#else
+  iniciarProcesamiento(false, NULL, soloAnomalias); // Cambie a true si se inicializa el modulo LoRa con setLoRa()
+#endif
+
+#ifdef GRABAR_CAPTURA
+  if (!iniciarCaptura(0, 1)) enviarDiagnostico("No se pudo iniciar la captura"); // Prioridad 0: solo copia los registros al serial
+#endif
+
+  //************************ Tarea del GPS, despierta con los eventos de recepcion del puerto serial 2
+  iniciarBaseTiempo(PIN_PPS_GPS); // El GPS disciplina la relacion de la base de tiempo comun con UTC
+  if (!iniciarGPS(1, 1)) enviarDiagnostico("No se pudo crear la tarea del GPS, no habra fix ni disciplina de la base de tiempo");
 
   //************************ Inicializacion de las interrupciones de los touchpads
-  setTouchCallbacks(&enTouch1Pulsado, &enTouch2Pulsado, &enTouch3Pulsado, 10000);
+  // Muestreo de los touch con prioridad 2 y despacho de los gestos con prioridad 1, ambos en el nucleo 1
+  if (!iniciarTouch(TOUCHPADS, sizeof(TOUCHPADS) / sizeof(TOUCHPADS[0]), enGestoTouch, 2, 1, 1))
+    enviarDiagnostico("No se pudieron iniciar los touchpads, no habra gestos");
 
   //************************ Inicializacion de las interrupciones del ADC
-  setADCCallbacks(&filtrar, SAMPLING_FREQ);
+#if defined(ADQUISICION_SOBREMUESTREO)
+  setADCBlockCallback(&filtrarSobremuestreo, SAMPLING_FREQ * FACTOR_SOBREMUESTREO, CANALES_ADC, sizeof(CANALES_ADC),
+                      MUESTRAS_POR_BLOQUE_SOBREMUESTREO * FACTOR_SOBREMUESTREO);
+#elif defined(ADQUISICION_DMA)
+  setADCBlockCallback(&filtrarBloque, SAMPLING_FREQ, CANALES_ADC, sizeof(CANALES_ADC), MUESTRAS_POR_BLOQUE_DMA);
+#else
+  setADCCallbacks(&filtrar, SAMPLING_FREQ); // Su analogRead()/adc1_config_*() reconfigura el SAR1 y los pads
+  compararEscaneoADC();  // Por eso el escaneo se configura al final, una sola vez (filtrar() no corre antes de iniciarPlanificador())
+#ifdef TASA_ADAPTATIVA
+  iniciarTasaAdaptativa(setADCSamplingFreq);
+#endif
+#endif
   pinMode(23, OUTPUT);  //Configuramos el pin IO23 como salida
   digitalWrite(23, HIGH); //Habilitamos la alimentacion del giroscopio
   Wire.begin();  //Inicializamos el bus I2C para el giroscopio (SCL=IO22, SDA=IO21)
 
   if (!gyro.init()) {  //Inicializamos el giroscopio
-    Serial.println("Fallo al detectar el tipo de giroscopio!"); //Si no se detecta el giroscopio, se imprime un mensaje de error
+    enviarDiagnostico("Fallo al detectar el tipo de giroscopio!"); //Si no se detecta el giroscopio, se imprime un mensaje de error
     while (1); //Se queda en un bucle infinito
   }
 
-  gyro.enableDefault(); //Habilitamos el giroscopio con la configuracion por defecto (500dps) y el filtro pasa-bajos a 100Hz (ver L3G.h)
+  //Configuramos el giroscopio detectado a 200Hz con la FIFO en modo stream y registramos el trabajo que la lee (prioridad 1, nucleo 1)
+  if (!iniciarGiroscopio((uint8_t)gyro.getDeviceType(), 200, 1, 1)) {
+    enviarDiagnostico("Fallo al configurar la FIFO del giroscopio (tipo no soportado o sin respuesta)!");
+  }
+
+  //************************ Planificador de muestreo: un solo timer (el 3) para el ADC y el giroscopio
+  if (!iniciarPlanificador(3)) {
+    enviarDiagnostico("Fallo al iniciar el planificador de muestreo!");
+  }
 }
 
 
 
+/**
+ * Funcion que muestra el ultimo fix del GPS, leido del registro publicado por la tarea del GPS sin bloquearla
+ */
 void displayInfo() {
-  if (gps.location.isValid()) { //Si el GPS tiene una posicion valida
-    lat = gps.location.lat();   //Almacenamos la latitud y longitud en las variables correspondientes
-    lon = gps.location.lng();
-  } else {                      //Si el GPS no tiene una posicion valida
-    lat = 1000;                 //Almacenamos la latitud y longitud en las variables correspondientes
-    lon = 1000;               
+  RegistroGPS fix;
+  if (leerGPS(fix) == 0) return; //Aun no llega ninguna frase valida
+  if (fix.posicionValida) {
+    enviarDiagnostico("GPS %02u:%02u:%02u.%02u %02u/%02u/%04u lat %ld lon %ld (microgrados) %u satelites", fix.hora, fix.minuto,
+                      fix.segundo, fix.centesimas, fix.dia, fix.mes, fix.anio, (long)fix.latitud, (long)fix.longitud, fix.satelites);
+  } else {
+    enviarDiagnostico("GPS sin posicion valida, %u satelites", fix.satelites);
   }
-
-  if (gps.date.isValid()) {    //Si el GPS tiene una fecha valida
-    month= gps.date.month();   //Almacenamos la fecha y hora en las variables correspondientes
-    day = gps.date.day();      
-    year = gps.date.year();
-  } else {                     //Si el GPS no tiene una fecha valida (por ejemplo, si no se ha recibido la hora)
-    month= 13;                 
-    day = 32;
-    year = 0;
+  EstadoBaseTiempo base = estadoBaseTiempo();
+  if (base.sincronizada) {
+    enviarDiagnostico("Base de tiempo disciplinada %s: deriva %ld ppb, ultimo error %ld us", base.conPPS ? "con PPS" : "con NMEA",
+                      (long)base.derivaPpb, (long)base.ultimoErrorUs);
   }
-
-  if (gps.time.isValid()) {
-    int hora = (int) gps.time.hour();
-    int minuto = (int) gps.time.minute();
-    int segundo = gps.time.second();
-    int milisegundo = gps.time.centisecond();
-    tiempo = String(hora) + ":" + String(minuto) + ":" + String(segundo); // Almacenamos la fecha y hora en las variables correspondientes
+  EstadisticasBitacora bitacora = estadisticasBitacora();
+  enviarDiagnostico("Bitacora: %lu registros guardados, %lu reenviados, %lu perdidos, %lu errores de flash, %lu sectores borrados"
+                    " (%lu por adelantado, maximo %lu us con la cache apagada)%s",
+                    (unsigned long)bitacora.guardados, (unsigned long)bitacora.reproducidos, (unsigned long)bitacora.perdidosLlena,
+                    (unsigned long)bitacora.erroresFlash, (unsigned long)bitacora.sectoresBorrados,
+                    (unsigned long)bitacora.sectoresPreborrados, (unsigned long)bitacora.borradoMaximoUs,
+                    bitacora.pendiente ? ", con respaldo pendiente" : "");
+#if defined(ADQUISICION_DMA) || defined(ADQUISICION_SOBREMUESTREO)
+  EstadisticasReserva reserva = getADCBlockPool().estadisticas();
+  enviarDiagnostico("Bloques del DMA: %lu de %lu ocupados (maximo %lu), %lu entregados, %lu sin bloque libre", (unsigned long)reserva.ocupados,
+                    (unsigned long)reserva.capacidad, (unsigned long)reserva.maximoOcupados, (unsigned long)reserva.reservados,
+                    (unsigned long)reserva.agotados);
+#endif
+#ifdef ADQUISICION_SOBREMUESTREO
+  if (muestrasDecimador > 0) {
+    double ciclosPorMuestra = (double)ciclosDecimador / muestrasDecimador;
+    enviarDiagnostico("Sobremuestreo x%u: %.1f ciclos por muestra de entrada (%u canales), %.2f%% del nucleo 0", FACTOR_SOBREMUESTREO,
+                      ciclosPorMuestra, (unsigned)sizeof(CANALES_ADC),
+                      100.0 * ciclosPorMuestra * SAMPLING_FREQ * FACTOR_SOBREMUESTREO / (ESP.getCpuFreqMHz() * 1e6));
   }
+#endif
 }
 
 /**
@@ -137,85 +225,131 @@ void filtrar()
 {
 
   /****ADC - Adquisicion de datos por el ADC1_7****/
-  int adcX = analogRead(35); // = local_adc1_read(7);   //Adquisicion de un dato analogo por el ADC1_7 (IO35) con resolucion de 12 bits
-  int adcY = analogRead(33); // = local_adc1_read(7);   //Adquisicion de un dato analogo por el ADC1_7 (IO35) con resolucion de 12 bits
-  int adcZ = analogRead(32); // = local_adc1_read(7);   //Adquisicion de un dato analogo por el ADC1_7 (IO35) con resolucion de 12 bits
-  static uint16_t index = 0;
-  /****FILTRADO - Implementacion del filtro digital****/
-  //
-  // Escribe tu codigo del filtro digital aqui
-  //
-
-  /****DAC - Sacando valores analogos por el canal DAC1****/
-  // unsigned char voltajeSalida=0;         //Variable que almacena el voltaje que sera sacado por el canal DAC1
-
-  // if(voltajeSalida==0) voltajeSalida=0xFF; else voltajeSalida=0x00; //Generamos una señal de la mitad de la frecuencia de muestreo en el pin IO25
-  // if(index<(SIZE_BUF-1)) {index++;buffer[index]=index;} else {index=0x00; buffer[0]=0;}; //Generamos una señal diente de sierra
-
-  /*  voltajeSalidaHi = (uint8_t)((adc >> 8)&0x03);   //El modulo DAC tiene resolucion de 8 bits, asi que el valor del ADC (de 12 bits) se rota a la derecha 4 bits (divide en 16)
-    voltajeSalidaLo = (uint8_t)(adc & 0xFF);   //El modulo DAC tiene resolucion de 8 bits, asi que el valor del ADC (de 12 bits) se rota a la derecha 4 bits (divide en 16)
-    if(index==(SIZE_BUF-1)) {
-        buffer[index*2+1]=voltajeSalidaHi;
-        buffer[index*2]=voltajeSalidaLo;
-        index=0;
-    } else {
-        buffer[index*2+1]=voltajeSalidaHi;
-        buffer[index*2]=voltajeSalidaLo;
-        index++;
-    } */
-
-  voltajeSalida = (uint8_t)(adcX >> 4); // El modulo DAC tiene resolucion de 8 bits, asi que el valor del ADC (de 12 bits) se rota a la derecha 4 bits (divide en 16)
-  if (index < (SIZE_BUF - 1))
-  {
-    index++; /*buffer[index]=voltajeSalida;*/
+  MuestraADC muestra;
+  muestra.marcaTiempo = halMicros();
+  EscaneoADC1<7, 5, 4>::Muestra escaneo;
+  escaneoADC.leer(escaneo);   // Adquisicion seguida por registros del ADC1_7 (IO35), ADC1_5 (IO33) y ADC1_4 (IO32) con resolucion de 12 bits
+  muestra.x = escaneo.valor[0];
+  muestra.y = escaneo.valor[1];
+  muestra.z = escaneo.valor[2];
+  procesarMuestra(muestra); // La etapa de fusion le agrega el giroscopio y el GPS alineados a este instante
+}
+
+/**
+ * Funcion que caracteriza el ADC1 para la atenuacion de cada canal escaneado y llena sus tablas
+ * de conversion a milivoltios
+ * @return false si alguna caracterizacion fallo (el procesamiento sigue con cuentas crudas)
+ */
+bool calibrarADC()
+{
+  static const char *FUENTES[] = {"Vref supuesto", "Vref del eFuse", "dos puntos del eFuse"};
+  for (uint8_t i = 0; i < sizeof(CANALES_ADC); i++) {
+    // Todos los canales se configuran a 11dB en halSensConfigurarCanal()
+    if (!construirTablaCalibracion(calibracionADC[i], CAL_ATENUACION_11DB)) return false;
+    enviarDiagnostico("ADC1_%u calibrado con %s: 0 -> %u mV, 2048 -> %u mV, 4095 -> %u mV", CANALES_ADC[i],
+                      FUENTES[calibracionADC[i].fuente % 3], calibracionADC[i].convertir(0), calibracionADC[i].convertir(2048),
+                      calibracionADC[i].convertir(4095));
   }
-  else
-  {
-    index = 0x00; /*buffer[0]=voltajeSalida;*/
-  };              // Generamos una señal diente de sierra
+  return true;
+}
 
-  for (int i = 1; i < SIZE_BUF; i++)
-  {
-    buffer[i - 1] = buffer[i];
+/**
+ * Funcion que configura el escaneo por registros y reporta cuanto tarda comparado con tres analogRead()
+ */
+void compararEscaneoADC()
+{
+  const int repeticiones = 100;
+  uint32_t inicio = ESP.getCycleCount();
+  for (int i = 0; i < repeticiones; i++) {
+    analogRead(35);
+    analogRead(33);
+    analogRead(32);
   }
-  buffer[255] = (voltajeSalida + buffer[SIZE_BUF - 1] + buffer[SIZE_BUF - 2] + buffer[SIZE_BUF - 3]) >> 2;
-  // Sacar un valor de voltaje por el canal DAC1
-  // dac_output_enable(DAC_CHANNEL_1);                  //Habilitamos el DAC canal 1
-  // dac_output_voltage(DAC_CHANNEL_1, voltajeSalida);  //Sacamos el voltaje en el DAC canal 1
-  buf = buffer;
-  // Serial.println(buf[0]);
-
-  gyro.read();  //Leemos el giroscopio
-
-  // Quite el comentario de la siguiente linea para imprimir los datos por el puerto serial para verlos en el monitor serial del computador (a 115200 bits por segundo) en formato de tabla separados por tabuladores (\t) y saltos de linea (\n) al final de cada linea (\r) 
-  //Serial.println(String(adcX) + "\t" + String(adcY) + "\t" + String(adcZ) + "\t" + String(gyro.g.x) + "\t" + String(gyro.g.y) + "\t" + String(gyro.g.z) + "\t" + String(lat) + "\t" + String(lon) + "\t" + String(month) + "\t" + String(day) + "\t" + String(year) + "\t"+ String(tiempo) );
-  
-  // Quite el comentario de la siguiente linea para ver los datos del giroscopio y acelerometro para verlo en el SerialPlot
-  Serial.println(String(adcX) + "\t" + String(adcY) + "\t" + String(adcZ) + "\t" + String(gyro.g.x) + "\t" + String(gyro.g.y) + "\t" + String(gyro.g.z));
+  uint32_t ciclosAnalogRead = (ESP.getCycleCount() - inicio) / repeticiones;
+  escaneoADC.configurar(); // Despues de analogRead(), que reconfigura los pads en cada llamada
+  EscaneoADC1<7, 5, 4>::Muestra escaneo;
+  for (int i = 0; i < repeticiones; i++) escaneoADC.leer(escaneo);
+  enviarDiagnostico("Escaneo ADC por registros: %u ciclos, con analogRead: %u ciclos", escaneoADC.ciclosPromedioEscaneo(), ciclosAnalogRead);
+  escaneoADC.reiniciarEstadisticas();
+}
+
+/**
+ * Funcion que pasa una muestra intercalada de los canales de CANALES_ADC a x, y, z en el mismo orden
+ * (los ejes sin canal quedan en 0)
+ * @param muestra Muestra donde se escriben los canales
+ * @param canales Un dato por canal, en el orden de CANALES_ADC
+ * @param numCanales Numero de canales intercalados
+ */
+static inline void asignarCanales(MuestraADC &muestra, const uint16_t *canales, uint8_t numCanales)
+{
+  muestra.x = numCanales > 0 ? canales[0] : 0;
+  muestra.y = numCanales > 1 ? canales[1] : 0;
+  muestra.z = numCanales > 2 ? canales[2] : 0;
 }
 
 /**
- * Funcion que maneja la pulsacion del touchpad 1
+ * Funcion que procesa un bloque de muestras entregado por el DMA del I2S
+ * @param muestras Muestras intercaladas por canal en el orden de CANALES_ADC
+ * @param numMuestras Numero de muestras por canal del bloque
+ * @param numCanales Numero de canales intercalados
  */
-void enTouch1Pulsado()
+void filtrarBloque(const uint16_t *muestras, size_t numMuestras, uint8_t numCanales)
 {
-  Serial.println("1 presionado, valor: " + String(touchRead(TOUCH_1)));
+  uint64_t ahora = halMicros(); // Instante en que se completo el bloque (el de su ultima muestra)
+  for (size_t i = 0; i < numMuestras; i++) {
+    MuestraADC muestra;
+    muestra.marcaTiempo = ahora - (uint64_t)(numMuestras - 1 - i) * (1000000 / SAMPLING_FREQ); // Reconstruimos el instante de cada muestra
+    asignarCanales(muestra, &muestras[i * numCanales], numCanales);
+    procesarMuestra(muestra);
+  }
 }
 
 /**
- * Funcion que maneja la pulsacion del touchpad 2
+ * Funcion que decima un bloque del DMA muestreado a FACTOR_SOBREMUESTREO veces SAMPLING_FREQ y procesa
+ * las muestras de 16 bits resultantes. El bloque termina justo en una muestra de salida
+ * @param muestras Muestras de 12 bits intercaladas por canal en el orden de CANALES_ADC
+ * @param numMuestras Numero de muestras por canal del bloque
+ * @param numCanales Numero de canales intercalados
  */
-void enTouch2Pulsado()
+void filtrarSobremuestreo(const uint16_t *muestras, size_t numMuestras, uint8_t numCanales)
 {
-  Serial.println("2 presionado, valor: " + String(touchRead(TOUCH_2)));
+  static uint16_t decimadas[MUESTRAS_POR_BLOQUE_SOBREMUESTREO * sizeof(CANALES_ADC)];
+  uint64_t ahora = halMicros(); // Instante de la ultima muestra del bloque
+  uint32_t inicio = ESP.getCycleCount();
+  size_t n = sobremuestreo.procesarBloque(muestras, numMuestras, decimadas);
+  ciclosDecimador += ESP.getCycleCount() - inicio;
+  muestrasDecimador += numMuestras;
+  const uint64_t retardoUs = (uint64_t)(SobremuestreoEKG::RETARDO_SALIDA * 1000000 / SAMPLING_FREQ);
+  for (size_t i = 0; i < n; i++) {
+    MuestraADC muestra;
+    muestra.marcaTiempo = ahora - retardoUs - (uint64_t)(n - 1 - i) * (1000000 / SAMPLING_FREQ); // El filtro atrasa la señal
+    asignarCanales(muestra, &decimadas[i * numCanales], numCanales);
+    muestra.bits = DECIMADOR_BITS_SALIDA;
+    procesarMuestra(muestra);
+  }
 }
 
 /**
- * Funcion que maneja la pulsacion del touchpad 3
+ * Funcion que maneja los gestos de los touchpads, se ejecuta en la tarea despachadora (no en la de muestreo)
+ * @param gesto Gesto reconocido, gesto.pads tiene un bit por cada pad de la tabla TOUCHPADS
  */
-void enTouch3Pulsado()
+void enGestoTouch(const GestoTouch &gesto)
 {
-  Serial.println("3 presionado, valor: " + String(touchRead(TOUCH_3)));
+  // El puerto serial lleva la telemetria en COBS: el texto va en tramas de diagnostico (nada durante la captura)
+  switch (gesto.tipo) {
+  case GESTO_TOQUE:
+    enviarDiagnostico("Toque en los pads 0x%x", gesto.pads);
+    break;
+  case GESTO_DOBLE_TOQUE:
+    enviarDiagnostico("Doble toque en los pads 0x%x", gesto.pads);
+    break;
+  case GESTO_PULSACION_LARGA:
+    enviarDiagnostico("Pulsacion larga en los pads 0x%x", gesto.pads);
+    break;
+  case GESTO_ACORDE:
+    enviarDiagnostico("Acorde en los pads 0x%x", gesto.pads);
+    break;
+  }
 }
 
 /**
@@ -223,17 +357,46 @@ void enTouch3Pulsado()
  */
 void loop()
 {
-  //Toma lecturas del GPS por el puerto serial 2
-  while (Serial2.available() > 0)
-    if (gps.encode(Serial2.read()))
-      displayInfo(); //Funcion que muestra los datos del GPS
+  static uint32_t ultimoReporte = 0;
+  atenderComandos();
 
-  if (millis() > 5000 && gps.charsProcessed() < 10)
+  if (millis() - ultimoReporte >= 10000 && !capturaActiva()) // Los diagnosticos se descartan mientras la captura usa el serial
   {
-    Serial.println(F("No se detecto el GPS: revise el cableado."));
-    while (true)
-      ;
+    ultimoReporte = millis();
+    //La tarea del GPS atiende el puerto serial 2, aqui solo se muestra el ultimo fix
+    displayInfo(); //Funcion que muestra los datos del GPS
+
+    if (millis() > 5000 && estadisticasGPS().bytes < 10)
+    {
+      enviarDiagnostico("No se detecto el GPS: revise el cableado.");
+    }
   }
 
-  vTaskDelay(10000);
+  vTaskDelay(100);
+}
+
+/**
+ * Funcion que atiende los comandos que llegan por el puerto serial, uno por linea:
+ * "stats" muestra las medidas de las tareas y "stats reiniciar" las pone en cero
+ */
+void atenderComandos()
+{
+  static char linea[32];
+  static uint8_t largo = 0;
+  while (Serial.available() > 0) {
+    char c = (char)Serial.read();
+    if (c != '\n' && c != '\r') {
+      if (largo < sizeof(linea) - 1) linea[largo++] = c;
+      continue;
+    }
+    linea[largo] = '\0';
+    if (strcmp(linea, "stats") == 0) {
+      static char reporte[2048]; // Estatico para no gastar la pila de loop()
+      enviarTextoDiagnostico(reporte, reporteInstrumentacion(reporte, sizeof(reporte))); // Una trama por renglon de la tabla
+    } else if (strcmp(linea, "stats reiniciar") == 0) {
+      reiniciarInstrumentacion();
+      enviarDiagnostico("Medidas en cero");
+    }
+    largo = 0;
+  }
 }
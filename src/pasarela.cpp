@@ -0,0 +1,532 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include "libpasarela.h"
+
+// Pasarela en el computador: junta la telemetria de muchos dispositivos en un archivo columnar
+// (pio run -e pasarela && .pio/build/pasarela/program -o datos.col serie:/dev/ttyUSB0 udp:1700)
+//
+// Entradas:
+//  serie:/dev/ttyUSB0[:baudios[:dispositivo]]  Tramas de telemetria del puerto serial (115200 por defecto)
+//  archivo:ruta[:dispositivo]                  Tramas de telemetria guardadas del puerto serial
+//  udp:puerto                                  Paquetes de LoRa de un gateway: cada datagrama es el numero
+//                                              del dispositivo (uint32, little endian) y el paquete
+// Cada flujo serial o archivo es un dispositivo (por defecto el numero de la entrada) y tiene su hilo;
+// los paquetes del gateway se reparten por dispositivo entre -h hilos. Los archivos terminan al leerse
+// completos; el puerto serial y el UDP con Ctrl+C.
+//
+// Otros modos:
+//  -l archivo.col                  Resumen del archivo columnar por dispositivo y fuente
+//  -p [dispositivos] [segundos] [hilos]  Prueba de rendimiento con telemetria y paquetes sinteticos
+
+#define PASARELA_BAUDIOS 115200
+#define PASARELA_TROZO 4096           // Bytes que se leen de una vez de un flujo
+#define PASARELA_MAX_HUECOS 20        // Huecos que se imprimen uno por uno; de ahi en adelante solo se cuentan
+#define PRUEBA_FRECUENCIA 256         // Hz de la telemetria sintetica, como SAMPLING_FREQ
+#define PRUEBA_PERDIDA_TRAMA 1000     // Se pierde una trama sintetica de cada tantas
+#define PRUEBA_CRUCE_TRAMA 97         // Una trama de cada tantas llega despues de la siguiente
+#define PRUEBA_PERDIDA_PAQUETE 200    // Se pierde un paquete de LoRa de cada tantos
+#define PRUEBA_CANALES_LORA 3
+
+static std::atomic<bool> detener(false);
+static std::mutex mutexHuecos;
+static uint32_t huecosImpresos = 0;
+
+/**
+ * Manejador de Ctrl+C: termina las entradas y escribe lo que queda
+ */
+static void alInterrumpir(int) {
+  detener = true;
+}
+
+/**
+ * Funcion que da el nombre de una fuente del archivo columnar para los reportes
+ */
+static const char *nombreFuente(uint8_t fuente) {
+  if (fuente == COLUMNAR_FUENTE_LORA) return "LoRa";
+  return fuente == COLUMNAR_FUENTE_LORA_SIN_FILTRAR ? "LoRa previa" : "telemetria";
+}
+
+/**
+ * Consumidor de los huecos de secuencia: imprime los primeros (desde cualquier hilo)
+ */
+static void imprimirHueco(const HuecoSecuencia &h) {
+  std::lock_guard<std::mutex> guarda(mutexHuecos);
+  if (huecosImpresos++ < PASARELA_MAX_HUECOS)
+    fprintf(stderr, "Hueco: dispositivo %u, %s, %u perdidos desde la secuencia %u (despues de t = %.6f s)\n", h.dispositivo,
+            nombreFuente(h.fuente), h.cantidad, h.desde, h.marcaTiempo / 1e6);
+}
+
+/**
+ * Funcion que imprime los contadores de una ingesta
+ */
+static void imprimirEstadisticas(const char *nombre, const EstadisticasIngesta &e) {
+  printf("%s: %llu bytes, %llu tramas y %llu paquetes validos (%u sin filtrar), %llu muestras, %u tramas con error, %u mensajes de diagnostico, %u paquetes invalidos, %u de otros tipos,"
+         " %u huecos (%llu perdidos), %u reordenados, %u repetidos o tardios\n", nombre, (unsigned long long)e.bytes,
+         (unsigned long long)e.tramas, (unsigned long long)e.paquetes, e.sinFiltrar, (unsigned long long)e.muestras, e.erroresTrama, e.diagnosticos, e.invalidos, e.otros,
+         e.huecos, (unsigned long long)e.perdidas, e.reordenados, e.tardios);
+}
+
+/**
+ * Funcion que abre un puerto serial en modo crudo
+ * @return Descriptor del puerto, o -1 si no se pudo abrir
+ */
+static int abrirSerie(const char *ruta, uint32_t baudios) {
+  static const struct { uint32_t baudios; speed_t velocidad; } VELOCIDADES[] = {
+      {9600, B9600}, {57600, B57600}, {115200, B115200}, {230400, B230400}, {460800, B460800}, {921600, B921600}};
+  int puerto = open(ruta, O_RDONLY | O_NOCTTY);
+  if (puerto < 0) return -1;
+  struct termios tty;
+  if (tcgetattr(puerto, &tty) != 0) {
+    close(puerto);
+    return -1;
+  }
+  cfmakeraw(&tty);
+  for (size_t i = 0; i < sizeof(VELOCIDADES) / sizeof(VELOCIDADES[0]); i++)
+    if (VELOCIDADES[i].baudios == baudios) cfsetspeed(&tty, VELOCIDADES[i].velocidad);
+  tty.c_cc[VMIN] = 0;
+  tty.c_cc[VTIME] = 2;  // read() vuelve cada 200 ms aunque no llegue nada, para ver si hay que detenerse
+  tcsetattr(puerto, TCSANOW, &tty);
+  return puerto;
+}
+
+/**
+ * Hilo de un flujo de telemetria (puerto serial o archivo): un dispositivo
+ */
+static void leerFlujo(int entrada, bool esArchivo, IngestorDispositivo *ingestor) {
+  uint8_t trozo[PASARELA_TROZO];
+  while (!detener) {
+    ssize_t n = read(entrada, trozo, sizeof(trozo));
+    if (n > 0) ingestor->procesarFlujo(trozo, (size_t)n);
+    else if (esArchivo || (n < 0 && errno != EINTR && errno != EAGAIN)) break;
+  }
+  close(entrada);
+  ingestor->terminar();
+}
+
+/**
+ * Hilo del gateway UDP: reparte los paquetes por dispositivo entre los hilos de la Pasarela
+ */
+static void recibirUDP(int socket, Pasarela *pasarela, uint64_t *datagramasInvalidos) {
+  uint8_t datagrama[4 + PAQUETE_CARGA_MAX + 1];
+  while (!detener) {
+    ssize_t n = recv(socket, datagrama, sizeof(datagrama), 0);
+    if (n < 0) continue;  // Vencio la espera: se revisa si hay que detenerse
+    if (n < 5 || n > 4 + PAQUETE_CARGA_MAX) {
+      (*datagramasInvalidos)++;
+      continue;
+    }
+    uint32_t dispositivo;
+    memcpy(&dispositivo, datagrama, 4);
+    pasarela->entregar(dispositivo, &datagrama[4], (size_t)n - 4, false);
+  }
+  close(socket);
+}
+
+/**
+ * Funcion que abre el socket UDP del gateway
+ */
+static int abrirUDP(uint16_t puerto) {
+  int s = socket(AF_INET, SOCK_DGRAM, 0);
+  if (s < 0) return -1;
+  int tam = 4 << 20;  // Un buffer grande para no perder rafagas mientras los hilos estan ocupados
+  setsockopt(s, SOL_SOCKET, SO_RCVBUF, &tam, sizeof(tam));
+  struct timeval espera = {0, 200000};
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &espera, sizeof(espera));
+  struct sockaddr_in direccion = {};
+  direccion.sin_family = AF_INET;
+  direccion.sin_addr.s_addr = htonl(INADDR_ANY);
+  direccion.sin_port = htons(puerto);
+  if (bind(s, (struct sockaddr *)&direccion, sizeof(direccion)) != 0) {
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+/**
+ * Resumen de un grupo del archivo columnar
+ */
+struct ResumenGrupo {
+  uint64_t bloques;
+  uint64_t muestras;
+  uint64_t primeraMarca;
+  uint64_t ultimaMarca;
+  uint32_t desordenados;  // Muestras cuya marca de tiempo no avanza
+  uint64_t sumaCanal1;    // Suma del primer canal, para comparar con lo que se envio
+};
+
+/**
+ * Funcion que recorre el archivo columnar mapeado en memoria y resume cada grupo
+ * @return false si no se pudo abrir
+ */
+static bool resumirColumnar(const char *ruta, std::map<std::pair<uint32_t, uint8_t>, ResumenGrupo> &grupos, bool &incompleto) {
+  LectorColumnar lector;
+  if (!lector.abrir(ruta)) return false;
+  const BloqueColumnar *b;
+  const void *valores;
+  while (lector.siguiente(b, valores)) {
+    ResumenGrupo &g = grupos[std::make_pair(b->dispositivo, b->fuente)];
+    g.bloques++;
+    if (b->canal == COLUMNAR_CANAL_TIEMPO && b->tipo == COLUMNAR_TIPO_U64) {
+      const uint64_t *t = (const uint64_t *)valores;  // Directamente del mapa, sin copiar
+      if (g.muestras == 0) g.primeraMarca = t[0];
+      for (uint32_t i = 0; i < b->cantidad; i++) {
+        if ((g.muestras > 0 || i > 0) && t[i] <= g.ultimaMarca) g.desordenados++;
+        g.ultimaMarca = t[i];
+      }
+      g.muestras += b->cantidad;
+    } else if (b->canal == 1 && b->tipo == COLUMNAR_TIPO_U16) {
+      const uint16_t *v = (const uint16_t *)valores;
+      for (uint32_t i = 0; i < b->cantidad; i++) g.sumaCanal1 += v[i];
+    }
+  }
+  incompleto = lector.incompleto;
+  return true;
+}
+
+/**
+ * Modo -l: resumen del archivo columnar
+ */
+static int listarColumnar(const char *ruta) {
+  std::map<std::pair<uint32_t, uint8_t>, ResumenGrupo> grupos;
+  bool incompleto;
+  if (!resumirColumnar(ruta, grupos, incompleto)) {
+    fprintf(stderr, "No se pudo abrir el archivo columnar %s\n", ruta);
+    return 1;
+  }
+  printf("%-12s %-11s %8s %12s %14s %14s %12s\n", "Dispositivo", "Fuente", "Bloques", "Muestras", "Desde (s)", "Hasta (s)", "Desordenadas");
+  for (const auto &g : grupos)
+    printf("%-12u %-11s %8llu %12llu %14.6f %14.6f %12u\n", g.first.first, nombreFuente(g.first.second),
+           (unsigned long long)g.second.bloques, (unsigned long long)g.second.muestras, g.second.primeraMarca / 1e6,
+           g.second.ultimaMarca / 1e6, g.second.desordenados);
+  if (incompleto) printf("El ultimo bloque esta incompleto (la pasarela se corto mientras lo escribia)\n");
+  return 0;
+}
+
+/**
+ * Valor sintetico del canal c de la muestra n de un dispositivo, para poder verificar lo guardado
+ */
+static inline uint16_t valorPrueba(uint32_t dispositivo, uint32_t n, uint8_t c) {
+  return (uint16_t)((2048 + 900 * ((n + 37 * dispositivo) % 213 < 8) + (n * (c + 3) + dispositivo) % 61) & 0x0FFF);
+}
+
+/**
+ * Funcion que genera el flujo serial sintetico de un dispositivo con tramas perdidas y cruzadas
+ * @param suma Recibe la suma del canal x de las tramas que si se envian
+ * @return Tramas enviadas
+ */
+static uint64_t generarFlujoPrueba(uint32_t dispositivo, uint32_t tramas, std::vector<uint8_t> &flujo, uint64_t &suma) {
+  uint8_t codificada[TELEMETRIA_TAM_MAX];
+  uint64_t enviadas = 0;
+  flujo.reserve((size_t)tramas * TELEMETRIA_TAM_MAX);
+  for (uint32_t n = 0; n < tramas; n++) {
+    uint32_t fase = n % PRUEBA_CRUCE_TRAMA;  // Cruza n y n + 1 a mitad del ciclo (la primera trama recibida fija el orden)
+    uint32_t k = (fase == PRUEBA_CRUCE_TRAMA / 2 && n + 1 < tramas) ? n + 1 : (fase == PRUEBA_CRUCE_TRAMA / 2 + 1 ? n - 1 : n);
+    if (k % PRUEBA_PERDIDA_TRAMA == PRUEBA_PERDIDA_TRAMA - 1) continue;
+    TramaTelemetria t;
+    t.secuencia = (uint16_t)k;
+    t.marcaTiempo = (uint32_t)((uint64_t)k * 1000000 / PRUEBA_FRECUENCIA + dispositivo);
+    for (uint8_t c = 0; c < 3; c++) {
+      t.adc[c] = valorPrueba(dispositivo, k, c);
+      t.gyro[c] = (int16_t)(k * (c + 1));
+    }
+    t.milivoltios = false;
+    size_t len = codificarTrama(t, codificada);
+    flujo.insert(flujo.end(), codificada, codificada + len);
+    suma += t.adc[0];
+    enviadas++;
+  }
+  return enviadas;
+}
+
+/**
+ * Paquete sintetico de LoRa de un dispositivo, en el orden en que lo entrega el gateway
+ */
+struct PaquetePrueba {
+  uint32_t dispositivo;
+  uint8_t len;
+  uint8_t datos[PAQUETE_CARGA_MAX];
+};
+
+/**
+ * Funcion que genera los paquetes de LoRa sinteticos de todos los dispositivos, intercalados como
+ * los recibiria el gateway, con paquetes perdidos y cruzados
+ * @param sumas Recibe por dispositivo la suma del canal 1 de los paquetes que si se entregan
+ * @param muestras Recibe las muestras de los paquetes entregados
+ */
+static void generarPaquetesPrueba(uint32_t dispositivos, uint32_t segundos, std::vector<PaquetePrueba> &paquetes, std::vector<uint64_t> &sumas,
+                                  uint64_t &muestras) {
+  std::vector<std::vector<PaquetePrueba>> porDispositivo(dispositivos);
+  std::vector<std::vector<uint64_t>> sumaPaquete(dispositivos);
+  std::vector<std::vector<uint32_t>> muestrasPaquete(dispositivos);
+  for (uint32_t d = 0; d < dispositivos; d++) {
+    EmpaquetadorMuestras e;
+    e.iniciar(PRUEBA_CANALES_LORA, 1000000 / PRUEBA_FRECUENCIA);
+    uint64_t suma = 0;
+    uint32_t enPaquete = 0;
+    for (uint32_t n = 0; n <= segundos * PRUEBA_FRECUENCIA; n++) {
+      bool ultimo = n == segundos * PRUEBA_FRECUENCIA;
+      uint16_t v[PRUEBA_CANALES_LORA];
+      for (uint8_t c = 0; c < PRUEBA_CANALES_LORA; c++) v[c] = valorPrueba(d, n, c);
+      bool cerrado = ultimo ? e.cerrar() : e.agregar(v, (uint32_t)((uint64_t)n * 1000000 / PRUEBA_FRECUENCIA));
+      if (cerrado) {
+        PaquetePrueba p;
+        p.dispositivo = d;
+        p.len = (uint8_t)e.tamano();
+        memcpy(p.datos, e.paquete(), e.tamano());
+        porDispositivo[d].push_back(p);
+        sumaPaquete[d].push_back(suma);
+        muestrasPaquete[d].push_back(enPaquete);
+        suma = 0;
+        enPaquete = 0;
+      }
+      if (!ultimo) {
+        suma += v[0];
+        enPaquete++;
+      }
+    }
+  }
+  sumas.assign(dispositivos, 0);
+  muestras = 0;
+  for (size_t i = 0;; i++) {  // Ronda por ronda: el paquete i de cada dispositivo
+    bool quedan = false;
+    for (uint32_t d = 0; d < dispositivos; d++) {
+      if (i >= porDispositivo[d].size()) continue;
+      quedan = true;
+      size_t k = (i % 7 == 3 && i + 1 < porDispositivo[d].size()) ? i + 1 : (i % 7 == 4 ? i - 1 : i);  // Cruza i e i + 1
+      if ((k + d) % PRUEBA_PERDIDA_PAQUETE == PRUEBA_PERDIDA_PAQUETE - 1 && k + 1 < porDispositivo[d].size()) continue;  // Nunca el ultimo
+      paquetes.push_back(porDispositivo[d][k]);
+      sumas[d] += sumaPaquete[d][k];
+      muestras += muestrasPaquete[d][k];
+    }
+    if (!quedan) break;
+  }
+}
+
+/**
+ * Funcion que verifica el archivo de la prueba: las muestras, el orden y la suma del primer canal de cada grupo
+ * @return Grupos con diferencias
+ */
+static uint32_t verificarPrueba(const char *ruta, uint8_t fuente, const std::vector<uint64_t> &muestras, const std::vector<uint64_t> &sumas) {
+  std::map<std::pair<uint32_t, uint8_t>, ResumenGrupo> grupos;
+  bool incompleto;
+  uint32_t diferencias = 0;
+  if (!resumirColumnar(ruta, grupos, incompleto) || incompleto) return (uint32_t)sumas.size();
+  for (uint32_t d = 0; d < sumas.size(); d++) {
+    const ResumenGrupo &g = grupos[std::make_pair(d, fuente)];
+    if (g.muestras != muestras[d] || g.sumaCanal1 != sumas[d] || g.desordenados != 0) diferencias++;
+  }
+  return diferencias;
+}
+
+/**
+ * Modo -p: prueba de rendimiento. La telemetria sintetica de cada dispositivo se ingiere primero en un
+ * hilo y despues repartida en varios; los paquetes de LoRa pasan por una Pasarela con 1 y con varios hilos
+ */
+static int probarRendimiento(const char *ruta, uint32_t dispositivos, uint32_t segundos, uint32_t maxHilos) {
+  uint32_t tramas = segundos * PRUEBA_FRECUENCIA;
+  std::vector<std::vector<uint8_t>> flujos(dispositivos);
+  std::vector<uint64_t> sumas(dispositivos, 0), enviadas(dispositivos, 0);
+  uint64_t totalEnviadas = 0, bytes = 0;
+  for (uint32_t d = 0; d < dispositivos; d++) {
+    enviadas[d] = generarFlujoPrueba(d, tramas, flujos[d], sumas[d]);
+    totalEnviadas += enviadas[d];
+    bytes += flujos[d].size();
+  }
+  printf("Telemetria sintetica: %u dispositivos, %u s a %u Hz, %llu tramas (%.1f MB)\n", dispositivos, segundos, PRUEBA_FRECUENCIA,
+         (unsigned long long)totalEnviadas, bytes / 1e6);
+  for (uint32_t hilos = 1; hilos <= maxHilos; hilos *= 2) {
+    unlink(ruta);
+    EscritorColumnar escritor;
+    if (!escritor.abrir(ruta)) {
+      fprintf(stderr, "No se pudo crear %s\n", ruta);
+      return 1;
+    }
+    std::vector<std::unique_ptr<IngestorDispositivo>> ingestores;
+    for (uint32_t d = 0; d < dispositivos; d++) ingestores.emplace_back(new IngestorDispositivo(d, &escritor, NULL));
+    std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+    std::vector<std::thread> trabajadores;
+    for (uint32_t h = 0; h < hilos; h++)
+      trabajadores.emplace_back([&, h]() {
+        for (uint32_t d = h; d < dispositivos; d += hilos) {  // Cada dispositivo en un solo hilo
+          for (size_t i = 0; i < flujos[d].size(); i += PASARELA_TROZO)
+            ingestores[d]->procesarFlujo(&flujos[d][i], std::min((size_t)PASARELA_TROZO, flujos[d].size() - i));
+          ingestores[d]->terminar();
+        }
+      });
+    for (std::thread &t : trabajadores) t.join();
+    double segundosReales = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+    escritor.cerrar();
+    EstadisticasIngesta total = {};
+    for (std::unique_ptr<IngestorDispositivo> &i : ingestores) total.sumar(i->estadisticas());
+    std::vector<uint64_t> guardadas(dispositivos);
+    for (uint32_t d = 0; d < dispositivos; d++) guardadas[d] = ingestores[d]->estadisticas().muestras;
+    printf("Telemetria, %u hilo%s: %.2f millones de muestras/s (%.0f MB/s), %llu muestras, %u huecos (%llu perdidas, %u esperados),"
+           " %u reordenadas (%u tardias), %u errores, %llu bytes escritos; verificacion del archivo: %u dispositivos con diferencias\n",
+           hilos, hilos > 1 ? "s" : "", total.muestras / segundosReales / 1e6, bytes / segundosReales / 1e6, (unsigned long long)total.muestras,
+           total.huecos, (unsigned long long)total.perdidas, dispositivos * (tramas / PRUEBA_PERDIDA_TRAMA), total.reordenados, total.tardios, total.erroresTrama,
+           (unsigned long long)escritor.bytes, total.muestras == totalEnviadas ? verificarPrueba(ruta, COLUMNAR_FUENTE_TELEMETRIA, guardadas, sumas)
+                                                                               : dispositivos);
+  }
+  flujos.clear();
+
+  std::vector<PaquetePrueba> paquetes;
+  uint64_t muestrasLoRa;
+  generarPaquetesPrueba(dispositivos, segundos, paquetes, sumas, muestrasLoRa);
+  printf("LoRa sintetico: %zu paquetes de %u canales, %llu muestras\n", paquetes.size(), PRUEBA_CANALES_LORA, (unsigned long long)muestrasLoRa);
+  for (uint32_t hilos = 1; hilos <= maxHilos; hilos *= 2) {
+    unlink(ruta);
+    EscritorColumnar escritor;
+    if (!escritor.abrir(ruta)) return 1;
+    Pasarela pasarela(&escritor, NULL);
+    std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+    pasarela.iniciar(hilos);
+    for (const PaquetePrueba &p : paquetes) pasarela.entregar(p.dispositivo, p.datos, p.len, true);
+    pasarela.terminar();
+    double segundosReales = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+    escritor.cerrar();
+    EstadisticasIngesta total = pasarela.estadisticas();
+    std::vector<uint64_t> guardadas(dispositivos, 0);
+    pasarela.paraCadaDispositivo([&guardadas](const IngestorDispositivo &d) { guardadas[d.dispositivo()] = d.estadisticas().muestras; });
+    printf("LoRa, %u hilo%s: %.2f millones de muestras/s (%.0f mil paquetes/s), %llu muestras, %u huecos (%llu perdidos), %u reordenados,"
+           " %u invalidos; verificacion del archivo: %u dispositivos con diferencias\n", hilos, hilos > 1 ? "s" : "",
+           total.muestras / segundosReales / 1e6, total.paquetes / segundosReales / 1e3, (unsigned long long)total.muestras, total.huecos,
+           (unsigned long long)total.perdidas, total.reordenados, total.invalidos,
+           total.muestras == muestrasLoRa ? verificarPrueba(ruta, COLUMNAR_FUENTE_LORA, guardadas, sumas) : dispositivos);
+  }
+  unlink(ruta);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *salida = "pasarela.col";
+  size_t hilosPasarela = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc) salida = argv[++i];
+    else if (!strcmp(argv[i], "-h") && i + 1 < argc) hilosPasarela = (size_t)atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-l") && i + 1 < argc) return listarColumnar(argv[i + 1]);
+    else if (!strcmp(argv[i], "-p"))
+      return probarRendimiento(salida, (i + 1 < argc) ? atoi(argv[i + 1]) : 32, (i + 2 < argc) ? atoi(argv[i + 2]) : 600,
+                               (i + 3 < argc) ? atoi(argv[i + 3]) : (uint32_t)hilosPasarela);
+    else break;
+  }
+  if (i >= argc) {
+    fprintf(stderr, "Uso: %s [-o archivo.col] [-h hilos] serie:/dev/ttyUSB0[:baudios[:dispositivo]] | archivo:ruta[:dispositivo] | udp:puerto ...\n"
+                    "     %s -l archivo.col\n     %s [-o archivo.col] -p [dispositivos] [segundos] [hilos]\n", argv[0], argv[0], argv[0]);
+    return 1;
+  }
+
+  EscritorColumnar escritor;
+  if (!escritor.abrir(salida)) {
+    fprintf(stderr, "No se pudo abrir el archivo columnar %s\n", salida);
+    return 1;
+  }
+  signal(SIGINT, alInterrumpir);
+  Pasarela pasarela(&escritor, imprimirHueco);
+  std::vector<std::unique_ptr<IngestorDispositivo>> flujos;
+  std::vector<std::thread> hilos;
+  uint64_t datagramasInvalidos = 0;
+  bool conGateway = false;
+  for (uint32_t numero = 1; i < argc; i++, numero++) {
+    std::string entrada = argv[i];
+    std::string tipo = entrada.substr(0, entrada.find(':'));
+    std::string resto = entrada.find(':') == std::string::npos ? "" : entrada.substr(entrada.find(':') + 1);
+    if (tipo == "udp") {
+      int s = conGateway ? -1 : abrirUDP((uint16_t)atoi(resto.c_str()));  // La Pasarela tiene un solo productor
+      if (s < 0) {
+        fprintf(stderr, "No se pudo abrir el puerto UDP %s\n", resto.c_str());
+        return 1;
+      }
+      conGateway = true;
+      pasarela.iniciar(hilosPasarela);
+      hilos.emplace_back(recibirUDP, s, &pasarela, &datagramasInvalidos);
+      continue;
+    }
+    // serie:ruta[:baudios[:dispositivo]] o archivo:ruta[:dispositivo]
+    std::string ruta = resto.substr(0, resto.find(':'));
+    std::string opciones = resto.find(':') == std::string::npos ? "" : resto.substr(resto.find(':') + 1);
+    uint32_t baudios = PASARELA_BAUDIOS, dispositivo = numero;
+    if (tipo == "serie" && !opciones.empty()) {
+      baudios = (uint32_t)atoi(opciones.c_str());
+      opciones = opciones.find(':') == std::string::npos ? "" : opciones.substr(opciones.find(':') + 1);
+    }
+    if (!opciones.empty()) dispositivo = (uint32_t)strtoul(opciones.c_str(), NULL, 0);
+    int descriptor = (tipo == "serie") ? abrirSerie(ruta.c_str(), baudios) : (tipo == "archivo" ? open(ruta.c_str(), O_RDONLY) : -1);
+    if (descriptor < 0) {
+      fprintf(stderr, "No se pudo abrir la entrada %s\n", argv[i]);
+      return 1;
+    }
+    flujos.emplace_back(new IngestorDispositivo(dispositivo, &escritor, imprimirHueco));
+    hilos.emplace_back(leerFlujo, descriptor, tipo == "archivo", flujos.back().get());
+  }
+
+  std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+  if (!conGateway) {  // Solo flujos: se termina cuando se acaban (los archivos) o con Ctrl+C
+    for (std::thread &h : hilos) h.join();
+  } else {
+    while (!detener) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (std::thread &h : hilos) h.join();
+    pasarela.terminar();
+  }
+  double segundos = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+  escritor.cerrar();
+
+  EstadisticasIngesta total = {};
+  for (std::unique_ptr<IngestorDispositivo> &f : flujos) {
+    char nombre[32];
+    snprintf(nombre, sizeof(nombre), "Dispositivo %u", f->dispositivo());
+    imprimirEstadisticas(nombre, f->estadisticas());
+    total.sumar(f->estadisticas());
+  }
+  if (conGateway) {
+    pasarela.paraCadaDispositivo([](const IngestorDispositivo &d) {
+      char nombre[32];
+      snprintf(nombre, sizeof(nombre), "Dispositivo %u (LoRa)", d.dispositivo());
+      imprimirEstadisticas(nombre, d.estadisticas());
+    });
+    total.sumar(pasarela.estadisticas());
+    printf("Gateway: %llu paquetes descartados (colas llenas), %llu datagramas invalidos\n", (unsigned long long)pasarela.descartados,
+           (unsigned long long)datagramasInvalidos);
+  }
+  imprimirEstadisticas("Total", total);
+  printf("Archivo %s: %llu bloques, %llu bytes agregados en %.1f s (%.0f muestras/s)\n", salida, (unsigned long long)escritor.bloques,
+         (unsigned long long)escritor.bytes, segundos, segundos > 0 ? total.muestras / segundos : 0.0);
+  return 0;
+}
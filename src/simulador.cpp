@@ -0,0 +1,1931 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <stdarg.h>
+#include <thread>
+#include <vector>
+#include "libhal.h"
+#include "libprocesamiento.h"
+#include "libescaneoadc.h"
+#include "libtelemetria.h"
+#include "libempaquetador.h"
+#include "libtransmisorlora.h"
+#include "libtouch.h"
+#include "libgiroscopio.h"
+#include "libgps.h"
+#include "libbasetiempo.h"
+#include "libfusion.h"
+#include "libinstrumentacion.h"
+#include "libplanificador.h"
+#include "libbitacora.h"
+#include "libcalibracion.h"
+#include "libdecimador.h"
+#include "libadcbloques.h"
+#include "libetapas.h"
+#include "libqrs.h"
+#include "libespectro.h"
+#include "libtasa.h"
+#include "libreserva.h"
+#include "libcaptura.h"
+
+// Simulador del firmware para el computador (entorno native de PlatformIO): corre el camino
+// adquisicion -> filtro -> transmision -> telemetria sobre la HAL simulada en tiempo virtual,
+// tan rapido como se pueda, y reporta el rendimiento y la latencia de cada etapa.
+// Las opciones se pasan por nombre (simulador --help las lista). Sin archivo de flash se usa uno
+// temporal y al final se mide el rendimiento de escritura de la bitacora; con archivo, lo que quede
+// sin enviar se reenvia en la siguiente corrida. Termina con 1 si alguna verificacion falla (o la
+// salida difiere de la referencia) y con 2 si las opciones o los archivos de entrada no sirven.
+
+#define ODR_GIROSCOPIO 200        // Tasa de muestreo configurada en el giroscopio
+#define RELOJ_L3G 1.004           // El oscilador del giroscopio simulado va 0.4% mas rapido que el nominal
+#define CONVERGENCIA_GIRO_US 10000000 // El error de alineacion del giroscopio se mide despues de los primeros 10 s
+#define RAMPA_Z_L3G 64            // El eje z del giroscopio simulado sube 64 por muestra: el valor interpolado da la posicion entre muestras
+#define CICLO_GESTOS_MS 28000  // La señal de touch simulada repite un guion de gestos cada 28 s
+#define MAX_TRAZA_TOUCH 100000
+#define BYTES_GPS_POR_TICK 10     // A 9600 baudios llegan unos 10 bytes cada 10 ms
+#define PERIODO_UART_GPS_US 10000
+#define FRASE_CORRUPTA_CADA 25    // Una de cada 25 frases sinteticas llega con un byte dañado
+#define LATITUD_INICIAL 4637894   // Microgrados
+#define LONGITUD_INICIAL -74083800
+#define SEGUNDO_UTC_US 1000040    // El reloj local adelanta 40 ppm respecto a UTC: un segundo del GPS dura 1000040 us locales
+#define UTC_INICIO_US 1792238400000000LL // 17/10/2026 12:00:00 UTC, la hora del GPS en el instante local 0
+#define PIN_PPS_SIM 25
+#define CONVERGENCIA_BASE_US 60000000 // El error de la conversion a UTC se mide despues del primer minuto
+#define TAM_FLASH_SIM 0x170000    // Tamaño de la particion de la bitacora en particiones.csv
+#define PAQUETES_MEDICION_BITACORA 20000 // Paquetes que se escriben al medir el rendimiento de la bitacora
+#define VREF_EFUSE_SIM 1114       // Vref grabado en el eFuse del chip simulado (los chips van de 1000 a 1200 mV)
+#define CONVERSIONES_MEDICION 4000000 // Conversiones a milivoltios al comparar la tabla con la formula
+#define SEGUNDOS_SOBREMUESTREO 60 // Duracion de la señal sintetica con la que se mide el SNR del sobremuestreo
+#define FRECUENCIA_PRUEBA 7.3     // Seno de prueba en Hz (dentro de la banda del EKG)
+#define AMPLITUD_PRUEBA 1500.0    // Amplitud del seno de prueba en cuentas del ADC
+#define SEGUNDOS_QRS 300          // Duracion del EKG sintetico con el que se mide el detector de latidos
+#define TOLERANCIA_QRS_US 75000   // Un pico R detectado a menos de esto del verdadero es un acierto (ANSI/AAMI EC57)
+#define PERIODO_LATIDO_SIM (60.0 / 72) // Segundos entre latidos de la señal simulada del ADC
+#define FASE_R_SIM 0.3            // Instante del pico R dentro de cada periodo de la señal simulada
+#define AMPLITUD_RED_SIM 60       // Amplitud en cuentas de la red electrica en la señal simulada del ADC
+#define SEGUNDOS_ESPECTRO 1800    // Duracion de la señal con la que se compara el Goertzel deslizante con la DFT
+#define VENTANAS_ESPECTRO 400     // Ventanas comparadas con la DFT en doble precision
+#define CICLO_ACTIVIDAD_SIM 60    // Con el perfil de actividad el usuario se mueve SEGUNDOS_ACTIVOS_SIM de cada CICLO_ACTIVIDAD_SIM segundos
+#define SEGUNDOS_ACTIVOS_SIM 6
+#define AMPLITUD_MOVIMIENTO_SIM 1000 // Artefacto de movimiento en cuentas sobre el EKG mientras el usuario se mueve
+#define FALLOS_TASA_SIM 2         // Con la tasa adaptativa la adquisicion simulada rechaza los primeros cambios de frecuencia
+#define ADELANTO_ADC_CAPTURA_US 100 // Al reproducir, una muestra del ADC grabada hasta esto despues de la lectura es la de esa lectura
+
+/**
+ * Estadisticas de tiempo (de reloj real) de una etapa del camino de procesamiento
+ */
+struct EstadisticaEtapa {
+  const char *nombre;
+  uint64_t llamadas;
+  double totalNs;
+  double maximoNs;
+};
+
+EstadisticaEtapa etapas[] = {{"adquisicion", 0, 0, 0}, {"cadena", 0, 0, 0}, {"fusion", 0, 0, 0}};
+EscaneoADC1<7, 5, 4> escaneoADC;
+DecodificadorTelemetria decodificador;
+uint64_t bytesTelemetria = 0;
+uint32_t tramasMilivoltios = 0;
+uint32_t mensajesGestos = 0;
+uint32_t tramasReposo = 0;
+TablaCalibracion calibracionADC[3];
+uint32_t gestosDetectados[4] = {0, 0, 0, 0}; // Por TipoGesto
+uint64_t duracionSimulacionUs = 0;
+const Touchpad TOUCHPADS_SIM[] = {{27, 25}, {14, 25}, {12, 25}};
+uint8_t perfilActividad = 0;  // 0: giroscopio siempre en movimiento (con la rampa), 1: perfil de actividad, 2: perfil con tasa adaptativa
+int trabajoAdquisicion = -1;
+
+/**
+ * Tramo del guion de gestos de la señal de touch simulada
+ */
+struct ToqueGuion {
+  uint32_t inicioMs; // Dentro del ciclo de CICLO_GESTOS_MS
+  uint32_t finMs;
+  uint8_t pads;      // Mascara de los pads tocados
+};
+
+// Un gesto de cada tipo por ciclo: toque en el pad 1, doble toque en el 2, pulsacion larga en el 3 y acorde del 1 y el 2
+const ToqueGuion GUION_GESTOS[] = {{6700, 6900, 0x1}, {13500, 13650, 0x2}, {13800, 13950, 0x2}, {19500, 20700, 0x4},
+                                   {26500, 27000, 0x1}, {26550, 27000, 0x2}};
+
+void anotarSalida(const char *formato, ...);
+
+/**
+ * Manejador de los gestos en el simulador: los cuenta por tipo y, como enGestoTouch() en main.cpp, los
+ * reporta en una trama de diagnostico intercalada con la telemetria
+ */
+void alReconocerGesto(const GestoTouch &gesto) {
+  static const char *NOMBRES[] = {"Toque", "Doble toque", "Pulsacion larga", "Acorde"};
+  gestosDetectados[gesto.tipo]++;
+  anotarSalida("G %llu %u %u", (unsigned long long)gesto.marcaTiempo, gesto.tipo, gesto.pads);
+  enviarDiagnostico("%s en los pads 0x%x", NOMBRES[gesto.tipo % 4], gesto.pads);
+}
+
+/**
+ * Traza de touch grabada (tiempo en ms y lectura de los 3 pads) que reemplaza la señal sintetica
+ */
+struct MuestraTouch {
+  uint32_t tiempoMs;
+  uint16_t valor[3];
+};
+MuestraTouch *trazaTouch = NULL;
+size_t largoTrazaTouch = 0;
+
+/**
+ * Estadisticas del receptor LoRa simulado
+ */
+struct ReceptorLoRa {
+  uint32_t paquetes;
+  uint32_t invalidos;    // Paquetes que no pasaron la verificacion
+  uint32_t saltos;       // Paquetes con secuencia o marca de tiempo discontinua
+  uint32_t milivoltios;  // Paquetes marcados con valores en milivoltios
+  uint32_t sinFiltrar;   // Paquetes con la historia previa de la tasa adaptativa, sin el filtro del EKG
+  uint64_t muestras;
+  uint64_t tiempoAireUs; // Tiempo en el aire estimado con la formula del SX1278
+  uint16_t siguienteSecuencia;
+  uint32_t siguienteMarcaTiempo;
+} receptor = {};
+
+/**
+ * Estadisticas de los paquetes de latidos recibidos
+ */
+struct ReceptorLatidos {
+  uint32_t paquetes;
+  uint32_t invalidos;
+  uint32_t saltos;        // Paquetes con la secuencia discontinua
+  uint32_t latidos;
+  uint32_t anomalos;
+  uint64_t bytes;
+  uint64_t tiempoAireUs;
+  double errorTotalUs;    // Diferencia entre el pico R recibido y el de la señal simulada
+  double errorMaximoUs;
+  EncabezadoLatidos ultimo;
+  uint16_t siguienteSecuencia;
+} receptorLatidos = {};
+
+/**
+ * Estadisticas de los paquetes de registros espectrales recibidos
+ */
+struct ReceptorEspectro {
+  uint32_t paquetes;
+  uint32_t invalidos;
+  uint32_t saltos;        // Paquetes con la secuencia discontinua
+  uint32_t registros;
+  uint64_t bytes;
+  uint64_t tiempoAireUs;
+  double suma[ESPECTRO_NUM_VALORES];  // Para el promedio de cada banda en dB
+  uint16_t siguienteSecuencia;
+} receptorEspectro = {};
+
+/**
+ * Estadisticas de los paquetes de cambio de tasa recibidos
+ */
+struct ReceptorTasa {
+  uint32_t cambios;
+  uint32_t invalidos;
+  uint32_t saltos;        // Paquetes con la secuencia discontinua
+  uint32_t incoherentes;  // Cambios a la tasa de reposo fuera de la quietud o a la alta fuera del movimiento
+  uint16_t siguienteSecuencia;
+} receptorTasa = {};
+
+/**
+ * Captura de las entradas de los sensores (libcaptura.h): al grabar, la salida del simulador va a un
+ * archivo; al reproducir, el ADC, los touchpads, el giroscopio y el GPS simulados entregan lo grabado
+ * en el mismo instante virtual en que se grabo, en lugar de las señales sinteticas
+ */
+struct CapturaSim {
+  FILE *grabacion;                                       // Archivo donde se graba la salida, o NULL
+  bool reproduciendo;
+  std::vector<RegistroCaptura> registros[CAPTURA_NUM_TIPOS];
+  size_t posicion[CAPTURA_NUM_TIPOS];                    // Siguiente registro por entregar de cada tipo
+  DecodificadorCaptura *decodificador;
+  uint64_t bytesNMEA;
+  std::string salidas;                                   // Salidas del camino de procesamiento, para comparar con una corrida de referencia
+} capturaSim = {};
+
+/**
+ * Funcion que guarda un registro decodificado de la captura que se va a reproducir
+ */
+void guardarRegistroCapturado(const RegistroCaptura &registro) {
+  capturaSim.registros[registro.tipo].push_back(registro);
+  if (registro.tipo == CAPTURA_NMEA) capturaSim.bytesNMEA += registro.len;
+}
+
+/**
+ * Funcion que carga una captura grabada para reproducirla
+ */
+bool cargarCaptura(const char *archivo) {
+  FILE *f = fopen(archivo, "rb");
+  if (f == NULL) return false;
+  static DecodificadorCaptura decodificador(guardarRegistroCapturado);
+  uint8_t leidos[4096];
+  size_t n;
+  while ((n = fread(leidos, 1, sizeof(leidos), f)) > 0)
+    for (size_t i = 0; i < n; i++) decodificador.procesar(leidos[i]);
+  fclose(f);
+  capturaSim.decodificador = &decodificador;
+  capturaSim.reproduciendo = capturaSim.registros[CAPTURA_ADC].size() > 0;
+  return capturaSim.reproduciendo;
+}
+
+/**
+ * Funcion que da el ultimo registro de un tipo en o antes del instante t (sostenido hasta el siguiente)
+ * @param adelanto Tolerancia hacia adelante: un registro que cae a menos de esto de t ya cuenta
+ */
+const RegistroCaptura *registroCapturado(uint8_t tipo, uint64_t t, uint64_t adelanto = 0) {
+  const std::vector<RegistroCaptura> &v = capturaSim.registros[tipo];
+  size_t &i = capturaSim.posicion[tipo];
+  while (i + 1 < v.size() && v[i + 1].marcaTiempo <= t + adelanto) i++;
+  return v.empty() ? NULL : &v[i];
+}
+
+/**
+ * Funcion que da el valor uint16 numero k de la carga de un registro
+ */
+inline uint16_t valorCapturado(const RegistroCaptura *r, uint8_t k) {
+  return (r && 2 * k + 1 < r->len) ? (uint16_t)(r->datos[2 * k] | (r->datos[2 * k + 1] << 8)) : 0;
+}
+
+/**
+ * Funcion que anota una salida del camino de procesamiento (una linea) para compararla con la corrida de referencia
+ */
+void anotarSalida(const char *formato, ...) {
+  char linea[128];
+  va_list args;
+  va_start(args, formato);
+  vsnprintf(linea, sizeof(linea), formato, args);
+  va_end(args);
+  capturaSim.salidas += linea;
+  capturaSim.salidas += '\n';
+}
+
+/**
+ * Funcion que da el FNV-1a de unos bytes
+ */
+uint32_t fnv1a(const uint8_t *datos, size_t len, uint32_t suma = 2166136261u) {
+  for (size_t i = 0; i < len; i++) suma = (suma ^ datos[i]) * 16777619u;
+  return suma;
+}
+
+/**
+ * Clase auxiliar que mide el tiempo de reloj real de un bloque y lo suma a una etapa
+ */
+class Cronometro {
+public:
+  explicit Cronometro(EstadisticaEtapa &e) : etapa(e), inicio(std::chrono::steady_clock::now()) {}
+  ~Cronometro() {
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - inicio).count();
+    etapa.llamadas++;
+    etapa.totalNs += ns;
+    if (ns > etapa.maximoNs) etapa.maximoNs = ns;
+  }
+
+private:
+  EstadisticaEtapa &etapa;
+  std::chrono::steady_clock::time_point inicio;
+};
+
+/**
+ * Funcion que dice si el usuario simulado se esta moviendo (con el perfil de actividad)
+ */
+bool enMovimientoSimulado(double t) {
+  return perfilActividad == 0 || fmod(t, CICLO_ACTIVIDAD_SIM) < SEGUNDOS_ACTIVOS_SIM;
+}
+
+/**
+ * Señal simulada del ADC: EKG sintetico a 72 latidos por minuto con deriva de la linea base
+ * y ruido de la red electrica en el canal 7, y señales lentas en los otros canales. Con el perfil
+ * de actividad el movimiento agrega un artefacto lento al EKG. Al reproducir una captura da la muestra grabada
+ */
+uint16_t senalAdc(uint8_t canal, uint64_t tiempoUs) {
+  if (capturaSim.reproduciendo) {  // La muestra grabada en ese instante (x, y, z son los canales 7, 5 y 4)
+    const RegistroCaptura *r = registroCapturado(CAPTURA_ADC, tiempoUs, ADELANTO_ADC_CAPTURA_US);
+    return valorCapturado(r, canal == 7 ? 0 : (canal == 5 ? 1 : 2));
+  }
+  double t = tiempoUs / 1e6;
+  double v;
+  if (canal == 7) {
+    double fase = fmod(t, PERIODO_LATIDO_SIM) - FASE_R_SIM;  // Instante relativo al complejo QRS
+    v = 2048 + 900 * exp(-fase * fase / (2 * 0.012 * 0.012)) + 150 * exp(-(fase - 0.25) * (fase - 0.25) / (2 * 0.04 * 0.04)) +
+        200 * sin(2 * M_PI * 0.2 * t) + AMPLITUD_RED_SIM * sin(2 * M_PI * FRECUENCIA_RED * t) + (rand() % 21 - 10);
+    if (perfilActividad && enMovimientoSimulado(t)) v += AMPLITUD_MOVIMIENTO_SIM * sin(2 * M_PI * 1.3 * t);
+  } else {
+    v = 2048 + 500 * sin(2 * M_PI * (canal == 5 ? 1.0 : 0.5) * t);
+  }
+  return (uint16_t)(v < 0 ? 0 : (v > 4095 ? 4095 : v));
+}
+
+/**
+ * Funcion que carga una traza de touch grabada
+ * @return Numero de lecturas cargadas
+ */
+size_t cargarTrazaTouch(const char *archivo) {
+  FILE *f = fopen(archivo, "r");
+  if (f == NULL) return 0;
+  trazaTouch = (MuestraTouch *)malloc(MAX_TRAZA_TOUCH * sizeof(MuestraTouch));
+  unsigned t, a, b, c;
+  while (largoTrazaTouch < MAX_TRAZA_TOUCH && fscanf(f, "%u %u %u %u", &t, &a, &b, &c) == 4)
+    trazaTouch[largoTrazaTouch++] = MuestraTouch{t, {(uint16_t)a, (uint16_t)b, (uint16_t)c}};
+  fclose(f);
+  return largoTrazaTouch;
+}
+
+/**
+ * Señal simulada de los touchpads: linea base que deriva lentamente (temperatura) con ruido, un
+ * escalon de -12% en el pad 3 a la mitad de la simulacion (humedad) y los toques de GUION_GESTOS.
+ * Con una traza grabada se reproduce la traza en su lugar (en bucle), y con una captura las lecturas grabadas
+ */
+uint16_t senalTouch(uint8_t pin, uint64_t tiempoUs) {
+  uint8_t pad = (pin == TOUCHPADS_SIM[0].pin) ? 0 : (pin == TOUCHPADS_SIM[1].pin ? 1 : 2);
+  if (capturaSim.reproduciendo) return valorCapturado(registroCapturado(CAPTURA_TOUCH, tiempoUs), pad);
+  if (largoTrazaTouch > 0) {
+    uint32_t ms = (uint32_t)((tiempoUs / 1000) % (trazaTouch[largoTrazaTouch - 1].tiempoMs + 1));
+    size_t i = 0;
+    while (i + 1 < largoTrazaTouch && trazaTouch[i + 1].tiempoMs <= ms) i++;
+    return trazaTouch[i].valor[pad];
+  }
+  double t = tiempoUs / 1e6;
+  double v = 85 + 8 * sin(2 * M_PI * t / 900 + pad) + (rand() % 5 - 2);
+  if (pad == 2 && tiempoUs > duracionSimulacionUs / 2) v *= 0.88;
+  uint32_t ms = (uint32_t)((tiempoUs / 1000) % CICLO_GESTOS_MS);
+  for (size_t i = 0; i < sizeof(GUION_GESTOS) / sizeof(GUION_GESTOS[0]); i++)
+    if ((GUION_GESTOS[i].pads & (1 << pad)) && ms >= GUION_GESTOS[i].inicioMs && ms < GUION_GESTOS[i].finMs) v *= 0.45;
+  return (uint16_t)v;
+}
+
+/**
+ * Giroscopio L3GD20H simulado en el bus I2C: registros de configuracion, muestreo a su propio ODR
+ * (con el error de su oscilador) y FIFO de 32 niveles en modo stream con lectura en rafaga. El eje z
+ * es una rampa con el numero de la muestra para poder medir el error de alineacion de los registros fusionados
+ */
+struct L3GSimulado {
+  uint8_t registros[0x40];
+  int16_t fifo[L3G_TAM_FIFO][3];
+  uint8_t inicioFifo;
+  uint8_t nivelFifo;
+  bool desborde;
+  uint32_t generadas;   // Muestras generadas desde que se encendio
+  uint64_t encendidoUs; // Instante en que se encendio
+} l3g;
+
+/**
+ * Funcion que da el instante en que el giroscopio simulado genero la muestra n
+ */
+double instanteMuestraL3G(uint32_t n) {
+  return l3g.encendidoUs + (n + 1) * 1e6 / ((100 << (l3g.registros[L3G_CTRL1] >> 6)) * RELOJ_L3G);
+}
+
+/**
+ * Funcion que dice si el giroscopio simulado ya tiene lista la siguiente muestra: la del oscilador
+ * simulado, o al reproducir una captura la siguiente grabada cuyo instante ya paso
+ */
+bool muestraL3GLista() {
+  if (!capturaSim.reproduciendo) return instanteMuestraL3G(l3g.generadas) <= halMicros();
+  const std::vector<RegistroCaptura> &v = capturaSim.registros[CAPTURA_GIROSCOPIO];
+  size_t i = capturaSim.posicion[CAPTURA_GIROSCOPIO];
+  return i < v.size() && v[i].marcaTiempo <= halMicros();
+}
+
+/**
+ * Funcion que pone en la FIFO del giroscopio simulado las muestras generadas hasta el tiempo virtual actual
+ */
+void actualizarL3GSimulado() {
+  if (!(l3g.registros[L3G_CTRL1] & 0x08)) return;  // Apagado
+  while (muestraL3GLista()) {
+    double t = instanteMuestraL3G(l3g.generadas) / 1e6;
+    if (l3g.nivelFifo == L3G_TAM_FIFO) {  // Modo stream: se pierde la mas antigua
+      l3g.inicioFifo = (l3g.inicioFifo + 1) % L3G_TAM_FIFO;
+      l3g.nivelFifo--;
+      l3g.desborde = true;
+    }
+    int16_t *m = l3g.fifo[(l3g.inicioFifo + l3g.nivelFifo++) % L3G_TAM_FIFO];
+    if (capturaSim.reproduciendo) {
+      const RegistroCaptura &r = capturaSim.registros[CAPTURA_GIROSCOPIO][capturaSim.posicion[CAPTURA_GIROSCOPIO]++];
+      for (uint8_t i = 0; i < 3; i++) m[i] = (int16_t)valorCapturado(&r, i);
+    } else if (perfilActividad == 0) {
+      m[0] = (int16_t)(3000 * sin(2 * M_PI * 0.7 * t));
+      m[1] = (int16_t)(2000 * cos(2 * M_PI * 0.3 * t));
+      m[2] = (int16_t)(l3g.generadas * RAMPA_Z_L3G);
+    } else if (enMovimientoSimulado(t)) {  // Sin la rampa: el eje z tambien se mueve
+      m[0] = (int16_t)(3000 * sin(2 * M_PI * 0.7 * t));
+      m[1] = (int16_t)(2000 * cos(2 * M_PI * 0.3 * t));
+      m[2] = (int16_t)(1500 * sin(2 * M_PI * 1.1 * t));
+    } else {  // Quieto: solo el ruido del sensor
+      for (uint8_t i = 0; i < 3; i++) m[i] = (int16_t)(rand() % 41 - 20);
+    }
+    l3g.generadas++;
+  }
+}
+
+bool escribirL3GSimulado(const uint8_t *datos, size_t len) {
+  if (len < 2) return false;
+  actualizarL3GSimulado();
+  uint8_t registro = datos[0] & 0x3F;
+  bool encendido = l3g.registros[L3G_CTRL1] & 0x08;
+  l3g.registros[registro] = datos[1];
+  if (registro == L3G_CTRL1 && !encendido && (datos[1] & 0x08)) {
+    l3g.encendidoUs = halMicros();
+    l3g.generadas = 0;
+  }
+  return true;
+}
+
+bool leerL3GSimulado(uint8_t registro, uint8_t *datos, size_t len) {
+  actualizarL3GSimulado();
+  registro &= 0x3F;  // Sin el bit de autoincremento
+  if (registro == L3G_WHO_AM_I && len == 1) {
+    datos[0] = L3GD20H_ID;
+    return true;
+  }
+  if (registro == L3G_FIFO_SRC && len == 1) {
+    datos[0] = (uint8_t)((l3g.nivelFifo & L3G_FIFO_SRC_FSS) | (l3g.nivelFifo == 0 ? L3G_FIFO_SRC_EMPTY : 0) |
+                         (l3g.desborde ? L3G_FIFO_SRC_OVRN : 0) | (l3g.nivelFifo >= (l3g.registros[L3G_FIFO_CTRL] & 0x1F) ? 0x80 : 0));
+    return true;
+  }
+  if (registro != L3G_OUT_X_L || len % 6 != 0) return false;
+  for (size_t k = 0; k < len / 6; k++) {  // Cada 6 bytes la direccion vuelve a OUT_X_L y sale la siguiente muestra de la FIFO
+    int16_t *m = l3g.fifo[l3g.inicioFifo];
+    for (uint8_t i = 0; i < 6; i++) datos[6 * k + i] = (uint8_t)((i & 1) ? (m[i / 2] >> 8) : m[i / 2]);
+    if (l3g.nivelFifo > 0) {
+      l3g.inicioFifo = (l3g.inicioFifo + 1) % L3G_TAM_FIFO;
+      l3g.nivelFifo--;
+    }
+  }
+  l3g.desborde = false;
+  return true;
+}
+
+/**
+ * Verificacion de los registros fusionados contra los relojes simulados: el giroscopio va 0.4% rapido
+ * y el reloj local 40 ppm rapido respecto a la hora del GPS
+ */
+struct VerificacionFusion {
+  uint64_t registros;
+  uint32_t desordenados;  // Registros cuya marca de tiempo no avanza
+  uint64_t giroMedidos;
+  double errorGiroTotalUs; // Diferencia entre el instante que da el giroscopio interpolado y el de la muestra del ADC
+  double errorGiroMaximoUs;
+  uint32_t gpsIncoherentes; // Registros con un fix que no corresponde a uno anterior a la muestra
+  uint32_t edadGpsMaximaMs;
+  uint64_t utcMedidos;
+  double errorUtcTotalUs;  // Diferencia entre la hora UTC de la base de tiempo disciplinada y la real
+  double errorUtcMaximoUs;
+  uint64_t ultimaMarca;
+} verificacion = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+uint32_t fallasVerificacion = 0;  // Verificaciones que no se cumplieron: el simulador termina con 1
+
+/**
+ * Funcion que anota una verificacion de la corrida y avisa si no se cumple
+ * @param cumple Resultado de la verificacion
+ * @param descripcion Lo que se esperaba, para el aviso
+ */
+void exigir(bool cumple, const char *descripcion) {
+  if (cumple) return;
+  fallasVerificacion++;
+  printf("FALLA: %s\n", descripcion);
+}
+
+/**
+ * GPS simulado en el UART: frases RMC y GGA una vez por segundo de una trayectoria conocida
+ * (o un registro NMEA grabado), entregadas a la velocidad de 9600 baudios
+ */
+struct GPSSimulado {
+  char *registro;        // Registro NMEA grabado, o NULL para generar las frases
+  size_t largoRegistro;
+  size_t posicion;       // Siguiente byte del registro o de las frases pendientes
+  char pendiente[256];   // Frases sinteticas del segundo actual
+  size_t largoPendiente;
+  uint32_t segundo;      // Siguiente segundo a generar
+  uint32_t frasesGeneradas;
+  uint32_t frasesCorruptas;
+  uint32_t verificados;  // Registros publicados que se compararon con la trayectoria
+  uint32_t diferencias;  // Registros publicados que no coinciden con la trayectoria
+  uint32_t ultimaPublicacion;
+} gpsSim = {NULL, 0, 0, {0}, 0, 0, 0, 0, 0, 0, 0};
+
+/**
+ * Funcion que dice si las entradas del GPS son las sinteticas (sin registro NMEA ni captura), las unicas
+ * contra las que se puede verificar la trayectoria y la hora
+ */
+bool gpsSintetico() {
+  return !gpsSim.registro && !capturaSim.reproduciendo;
+}
+
+/**
+ * Funcion que da la posicion de la trayectoria simulada en un segundo
+ */
+void posicionSimulada(uint32_t segundo, int32_t &latitud, int32_t &longitud) {
+  latitud = LATITUD_INICIAL + (int32_t)segundo * 9;
+  longitud = LONGITUD_INICIAL - (int32_t)segundo * 13;
+}
+
+/**
+ * Funcion que escribe una coordenada en formato NMEA con 6 decimales en los minutos (exacta en microgrados)
+ */
+int coordenadaNMEA(char *destino, size_t max, int32_t microgrados, int digitosGrados) {
+  uint32_t v = (uint32_t)(microgrados < 0 ? -microgrados : microgrados);
+  uint64_t minutosE6 = (uint64_t)(v % 1000000) * 60;
+  return snprintf(destino, max, "%0*u%02u.%06u", digitosGrados, v / 1000000, (unsigned)(minutosE6 / 1000000), (unsigned)(minutosE6 % 1000000));
+}
+
+/**
+ * Funcion que agrega una frase con su checksum a las frases pendientes
+ */
+void agregarFraseNMEA(const char *cuerpo) {
+  uint8_t suma = 0;
+  for (const char *p = cuerpo; *p; p++) suma ^= (uint8_t)*p;
+  char *destino = &gpsSim.pendiente[gpsSim.largoPendiente];
+  int n = snprintf(destino, sizeof(gpsSim.pendiente) - gpsSim.largoPendiente, "$%s*%02X\r\n", cuerpo, suma);
+  if (++gpsSim.frasesGeneradas % FRASE_CORRUPTA_CADA == 0) {
+    destino[10] ^= 0x01;  // Un bit dañado en la linea: el checksum ya no coincide
+    gpsSim.frasesCorruptas++;
+  }
+  gpsSim.largoPendiente += n;
+}
+
+/**
+ * Funcion que genera las frases RMC y GGA de un segundo de la trayectoria
+ */
+void generarFrasesGPS(uint32_t segundo) {
+  int32_t latitud, longitud;
+  posicionSimulada(segundo, latitud, longitud);
+  char lat[16], lon[16], cuerpo[128];
+  coordenadaNMEA(lat, sizeof(lat), latitud, 2);
+  coordenadaNMEA(lon, sizeof(lon), longitud, 3);
+  uint32_t hora = 12 * 3600 + segundo;  // Empieza a las 12:00:00 UTC del 17/10/2026
+  gpsSim.largoPendiente = 0;
+  gpsSim.posicion = 0;
+  snprintf(cuerpo, sizeof(cuerpo), "GNRMC,%02u%02u%02u.00,A,%s,%c,%s,%c,0.5,90.0,171026,,,A", hora / 3600 % 24, hora / 60 % 60, hora % 60,
+           lat, latitud < 0 ? 'S' : 'N', lon, longitud < 0 ? 'W' : 'E');
+  agregarFraseNMEA(cuerpo);
+  snprintf(cuerpo, sizeof(cuerpo), "GNGGA,%02u%02u%02u.00,%s,%c,%s,%c,1,08,1.1,2640.5,M,3.1,M,,", hora / 3600 % 24, hora / 60 % 60, hora % 60,
+           lat, latitud < 0 ? 'S' : 'N', lon, longitud < 0 ? 'W' : 'E');
+  agregarFraseNMEA(cuerpo);
+}
+
+/**
+ * Manejador del UART del GPS simulado: entrega los bytes que llegarian en cada periodo
+ */
+void transmitirGPSSimulado() {
+  const char *datos;
+  size_t largo;
+  if (capturaSim.reproduciendo) {  // Los trozos grabados que el lector del GPS ya habia leido en este instante
+    const std::vector<RegistroCaptura> &v = capturaSim.registros[CAPTURA_NMEA];
+    size_t &i = capturaSim.posicion[CAPTURA_NMEA];
+    for (; i < v.size() && v[i].marcaTiempo <= halMicros(); i++) halSimUartEscribir(v[i].datos, v[i].len);
+    return;
+  }
+  if (gpsSim.registro) {
+    datos = gpsSim.registro;
+    largo = gpsSim.largoRegistro;
+    if (gpsSim.posicion >= largo) gpsSim.posicion = 0;  // El registro se repite en bucle
+  } else {
+    if (gpsSim.posicion >= gpsSim.largoPendiente) {
+      if (halMicros() < (uint64_t)gpsSim.segundo * SEGUNDO_UTC_US) return;  // El receptor calcula un fix por segundo UTC
+      generarFrasesGPS(gpsSim.segundo++);
+    }
+    datos = gpsSim.pendiente;
+    largo = gpsSim.largoPendiente;
+  }
+  size_t n = (largo - gpsSim.posicion > BYTES_GPS_POR_TICK) ? BYTES_GPS_POR_TICK : largo - gpsSim.posicion;
+  halSimUartEscribir((const uint8_t *)&datos[gpsSim.posicion], n);
+  gpsSim.posicion += n;
+}
+
+/**
+ * Lector del GPS simulado: lee el registro publicado sin bloquear, como lo haria cualquier otra
+ * tarea, y lo compara con la trayectoria
+ */
+void verificarGPSSimulado() {
+  RegistroGPS r;
+  uint32_t publicacion = leerGPS(r);
+  if (publicacion == gpsSim.ultimaPublicacion || !gpsSintetico() || !r.posicionValida) return;
+  gpsSim.ultimaPublicacion = publicacion;
+  uint32_t segundo = (r.hora * 3600 + r.minuto * 60 + r.segundo) - 12 * 3600;
+  int32_t latitud, longitud;
+  posicionSimulada(segundo, latitud, longitud);
+  gpsSim.verificados++;
+  if (r.latitud != latitud || r.longitud != longitud || r.anio != 2026 || r.mes != 10 || r.dia != 17 || r.altitudCm != 264050)
+    gpsSim.diferencias++;
+}
+
+/**
+ * Flanco del PPS del GPS simulado al inicio de cada segundo UTC
+ */
+void pulsoPPSSimulado() {
+  halSimFlancoPin(PIN_PPS_SIM);
+}
+
+/**
+ * Consumidor de los registros fusionados: verifica que cada fuente quede alineada al instante de la
+ * muestra del ADC, como lo haria la aplicacion que los recibe
+ */
+void verificarRegistro(const RegistroFusionado &r) {
+  uint64_t t = r.marcaTiempo;
+  if (verificacion.registros++ > 0 && t <= verificacion.ultimaMarca) verificacion.desordenados++;
+  verificacion.ultimaMarca = t;
+
+  // Giroscopio: la rampa interpolada dice en que punto entre dos muestras cree estar el registro
+  if ((r.banderas & FUSION_GIRO_INTERPOLADO) && t > l3g.encendidoUs + CONVERGENCIA_GIRO_US && perfilActividad == 0 && !capturaSim.reproduciendo) {
+    double periodo = instanteMuestraL3G(1) - instanteMuestraL3G(0);
+    double posicion = (t - l3g.encendidoUs) / periodo - 1;  // Numero de muestra (fraccionario) en el instante real
+    uint32_t entera = (uint32_t)floor(posicion) % (65536 / RAMPA_Z_L3G);
+    if (entera < 65536 / RAMPA_Z_L3G / 2 - 2 || entera > 65536 / RAMPA_Z_L3G / 2) {  // Sin el salto de la rampa de 16 bits
+      double error = (double)r.giro[2] / RAMPA_Z_L3G - posicion;
+      error -= (65536 / RAMPA_Z_L3G) * floor(error / (65536 / RAMPA_Z_L3G) + 0.5);
+      error = fabs(error) * periodo;
+      verificacion.giroMedidos++;
+      verificacion.errorGiroTotalUs += error;
+      if (error > verificacion.errorGiroMaximoUs) verificacion.errorGiroMaximoUs = error;
+    }
+  }
+
+  // GPS: el fix sostenido debe ser uno de la trayectoria y de un segundo que ya empezo
+  if ((r.banderas & FUSION_GPS_VALIDO) && gpsSintetico()) {
+    int32_t segundo = (r.latitud - LATITUD_INICIAL) / 9;
+    int32_t latitud, longitud;
+    posicionSimulada(segundo, latitud, longitud);
+    if (latitud != r.latitud || longitud != r.longitud || (uint64_t)segundo * SEGUNDO_UTC_US > t || r.edadGpsMs > 1200)
+      verificacion.gpsIncoherentes++;
+    if (r.edadGpsMs > verificacion.edadGpsMaximaMs) verificacion.edadGpsMaximaMs = r.edadGpsMs;
+  }
+
+  // Base de tiempo: la hora UTC de la muestra contra la del reloj del GPS simulado
+  int64_t utcUs;
+  if (gpsSintetico() && t > CONVERGENCIA_BASE_US && baseTiempoAUTC(t, utcUs)) {
+    double error = fabs((double)(utcUs - UTC_INICIO_US) - t * 1e6 / SEGUNDO_UTC_US);
+    verificacion.utcMedidos++;
+    verificacion.errorUtcTotalUs += error;
+    if (error > verificacion.errorUtcMaximoUs) verificacion.errorUtcMaximoUs = error;
+  }
+}
+
+/**
+ * Funcion que carga un registro NMEA grabado
+ */
+bool cargarRegistroNMEA(const char *archivo) {
+  FILE *f = fopen(archivo, "rb");
+  if (f == NULL) return false;
+  fseek(f, 0, SEEK_END);
+  long largo = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  gpsSim.registro = (char *)malloc(largo > 0 ? largo : 1);
+  gpsSim.largoRegistro = fread(gpsSim.registro, 1, largo > 0 ? largo : 0, f);
+  fclose(f);
+  return gpsSim.largoRegistro > 0;
+}
+
+/**
+ * Funcion que anota la telemetria de cada segundo (bytes y FNV-1a) para compararla con la corrida de
+ * referencia. Con datos NULL anota el ultimo segundo
+ */
+void anotarTelemetria(const uint8_t *datos, size_t len) {
+  static uint32_t segundo = 0, bytes = 0, suma = 2166136261u;
+  uint32_t ahora = (uint32_t)(halMicros() / 1000000);
+  if (bytes > 0 && (datos == NULL || ahora != segundo)) {
+    anotarSalida("T %u %u %08x", segundo, bytes, suma);
+    bytes = 0;
+    suma = 2166136261u;
+  }
+  if (datos == NULL) return;
+  segundo = ahora;
+  bytes += len;
+  suma = fnv1a(datos, len, suma);
+}
+
+/**
+ * Receptor de los mensajes de diagnostico del decodificador: cuenta los de los gestos
+ */
+void recibirDiagnostico(const char *texto, size_t len) {
+  if (len > 10 && strstr(texto, " en los pads 0x")) mensajesGestos++;
+}
+
+/**
+ * Salida de telemetria simulada: cuenta los bytes y decodifica las tramas como lo haria el computador
+ */
+void salidaTelemetria(const uint8_t *datos, size_t len) {
+  TramaTelemetria trama;
+  if (capturaSim.grabacion) {  // Con la captura andando la salida es la captura, y se guarda tal cual
+    fwrite(datos, 1, len, capturaSim.grabacion);
+    return;
+  }
+  anotarTelemetria(datos, len);
+  bytesTelemetria += len;
+  for (size_t i = 0; i < len; i++)
+    if (decodificador.procesar(datos[i], trama)) {
+      if (trama.milivoltios) tramasMilivoltios++;
+      if (trama.reposo) tramasReposo++;
+    }
+}
+
+/**
+ * Funcion que recibe un paquete de latidos y compara cada pico R con el de la señal simulada
+ */
+void recibirLatidos(const uint8_t *datos, size_t len) {
+  EventoLatido latidos[LATIDOS_MAX_POR_PAQUETE];
+  EncabezadoLatidos encabezado;
+  ReceptorLatidos &r = receptorLatidos;
+  r.tiempoAireUs += tiempoAireLoRaUs(len, LORA_SF, LORA_ANCHO_BANDA, LORA_CR);
+  size_t n = desempaquetarLatidos(datos, len, encabezado, latidos, LATIDOS_MAX_POR_PAQUETE);
+  if (n == 0) {
+    r.invalidos++;
+    return;
+  }
+  if (r.paquetes > 0 && encabezado.secuencia != r.siguienteSecuencia) r.saltos++;
+  r.siguienteSecuencia = encabezado.secuencia + 1;
+  r.paquetes++;
+  r.bytes += len;
+  r.latidos += n;
+  r.ultimo = encabezado;
+  for (size_t i = 0; i < n; i++) {
+    if (latidos[i].clase != LATIDO_NORMAL) r.anomalos++;
+    double t = (uint32_t)latidos[i].marcaTiempo / 1e6;  // La simulacion no llega a desbordar los 32 bits
+    double error = fabs(t - (FASE_R_SIM + PERIODO_LATIDO_SIM * floor((t - FASE_R_SIM) / PERIODO_LATIDO_SIM + 0.5))) * 1e6;
+    r.errorTotalUs += error;
+    if (error > r.errorMaximoUs) r.errorMaximoUs = error;
+  }
+}
+
+/**
+ * Funcion que recibe un paquete de registros espectrales y acumula las potencias
+ */
+void recibirEspectro(const uint8_t *datos, size_t len) {
+  RegistroEspectro registros[ESPECTRO_REGISTROS_POR_PAQUETE];
+  EncabezadoEspectro encabezado;
+  ReceptorEspectro &r = receptorEspectro;
+  r.tiempoAireUs += tiempoAireLoRaUs(len, LORA_SF, LORA_ANCHO_BANDA, LORA_CR);
+  size_t n = desempaquetarEspectro(datos, len, encabezado, registros, ESPECTRO_REGISTROS_POR_PAQUETE);
+  if (n == 0) {
+    r.invalidos++;
+    return;
+  }
+  if (r.paquetes > 0 && encabezado.secuencia != r.siguienteSecuencia) r.saltos++;
+  r.siguienteSecuencia = encabezado.secuencia + 1;
+  r.paquetes++;
+  r.bytes += len;
+  r.registros += n;
+  for (size_t i = 0; i < n; i++)
+    for (uint8_t v = 0; v < ESPECTRO_NUM_VALORES; v++) r.suma[v] += registros[i].valores[v] / 10.0;
+}
+
+/**
+ * Funcion que recibe un paquete de cambio de tasa y lo compara con el perfil de actividad
+ */
+void recibirCambioTasa(const uint8_t *datos, size_t len) {
+  ReceptorTasa &r = receptorTasa;
+  uint16_t secuencia;
+  CambioTasa cambio;
+  if (!decodificarCambioTasa(datos, len, secuencia, cambio)) {
+    r.invalidos++;
+    return;
+  }
+  if (r.cambios > 0 && secuencia != r.siguienteSecuencia) r.saltos++;
+  r.siguienteSecuencia = secuencia + 1;
+  r.cambios++;
+  bool movimiento = enMovimientoSimulado((uint32_t)cambio.marcaTiempo / 1e6);
+  if ((cambio.motivo == TASA_QUIETO) == movimiento) r.incoherentes++;
+}
+
+/**
+ * Receptor LoRa simulado: desempaqueta cada paquete como lo haria la estacion base y verifica
+ * que la secuencia y las marcas de tiempo sean continuas
+ */
+void recibirLoRa(const uint8_t *datos, size_t len) {
+  static uint16_t valores[PAQUETE_CARGA_MAX * PAQUETE_MAX_CANALES];
+  EncabezadoPaquete encabezado;
+  anotarSalida("L %llu %u %08x", (unsigned long long)halMicros(), (unsigned)len, fnv1a(datos, len));
+  if (len > 0 && datos[0] == PAQUETE_TIPO_LATIDOS) {
+    recibirLatidos(datos, len);
+    return;
+  }
+  if (len > 0 && datos[0] == PAQUETE_TIPO_ESPECTRO) {
+    recibirEspectro(datos, len);
+    return;
+  }
+  if (len > 0 && datos[0] == PAQUETE_TIPO_TASA) {
+    recibirCambioTasa(datos, len);
+    return;
+  }
+  receptor.tiempoAireUs += tiempoAireLoRaUs(len, LORA_SF, LORA_ANCHO_BANDA, LORA_CR);
+  size_t n = desempaquetarMuestras(datos, len, encabezado, valores, sizeof(valores) / sizeof(valores[0]));
+  if (n == 0) {
+    receptor.invalidos++;
+    return;
+  }
+  if (receptor.paquetes > 0) {
+    // La marca de tiempo real tiene la fluctuacion del temporizador, toleramos medio periodo
+    int32_t error = (int32_t)(encabezado.marcaTiempo - receptor.siguienteMarcaTiempo);
+    if (encabezado.secuencia != receptor.siguienteSecuencia || error > encabezado.periodoUs / 2 || -error > encabezado.periodoUs / 2)
+      receptor.saltos++;
+  }
+  receptor.paquetes++;
+  if (encabezado.milivoltios) receptor.milivoltios++;
+  if (encabezado.sinFiltrar) receptor.sinFiltrar++;
+  receptor.muestras += n;
+  receptor.siguienteSecuencia = encabezado.secuencia + 1;
+  receptor.siguienteMarcaTiempo = encabezado.marcaTiempo + n * encabezado.periodoUs;
+}
+
+/**
+ * Funcion que mide el rendimiento sostenido de escritura de la bitacora sobre la flash simulada:
+ * paquetes del tamaño de los de LoRa entran a la cola con el radio caido y la tarea los escribe
+ * por lotes, reciclando el anillo varias veces
+ */
+void medirEscrituraBitacora() {
+  uint8_t paquete[PAQUETE_CARGA_MAX];
+  for (size_t i = 0; i < sizeof(paquete); i++) paquete[i] = (uint8_t)(i * 37);
+  halSimCaidaRadio(halMicros(), UINT64_MAX);  // Nada sale de la bitacora mientras se mide
+  EstadisticasBitacora antes = estadisticasBitacora();
+  EstadisticasFlashSim flashAntes = halSimEstadisticasFlash();
+  std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < PAQUETES_MEDICION_BITACORA; i++) {
+    guardarEnBitacora(paquete, 228);  // El tamaño promedio de un paquete de muestras
+    if (i % (BITACORA_NUM_ENTRADA / 2) == BITACORA_NUM_ENTRADA / 2 - 1) halSimCorrer(0);  // La tarea ya fue notificada
+  }
+  double real = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+  anotarTelemetria(NULL, 0);
+  EstadisticasBitacora despues = estadisticasBitacora();
+  EstadisticasFlashSim flash = halSimEstadisticasFlash();
+  uint64_t bytes = despues.bytesGuardados - antes.bytesGuardados;
+  uint32_t lotes = despues.lotes - antes.lotes;
+  printf("Bitacora (medicion): %u registros, %.1f MB/s sostenidos en el computador, %.0f bytes por lote, %u sectores borrados,"
+         " desgaste por sector min %u max %u, %u descartados por la cola\n",
+         despues.guardados - antes.guardados, bytes / real / 1e6, lotes ? (double)bytes / lotes : 0.0,
+         flash.borrados - flashAntes.borrados, flash.borradosMinimo, flash.borradosMaximo,
+         despues.descartadosCola - antes.descartadosCola);
+}
+
+// Curvas de la zona no lineal de 11 dB publicadas en esp_adc_cal_esp32.c (Vref de 1000 y 1200 mV, cada 64 cuentas desde 2880)
+const double CURVA_11DB_BAJA[20] = {2240, 2297, 2352, 2405, 2457, 2512, 2564, 2616, 2664, 2709,
+                                    2754, 2795, 2832, 2868, 2903, 2937, 2969, 3000, 3030, 3060};
+const double CURVA_11DB_ALTA[20] = {2667, 2706, 2745, 2780, 2813, 2844, 2873, 2901, 2928, 2956,
+                                    2982, 3006, 3032, 3059, 3084, 3110, 3135, 3160, 3184, 3209};
+
+/**
+ * Funcion de referencia de esp_adc_cal (ADC1, 11 dB, caracterizacion por Vref) en punto flotante:
+ * la recta de la hoja de datos, la interpolacion bilineal de las curvas y la transicion entre ambas
+ */
+double milivoltiosReferencia(uint32_t crudo, double vref) {
+  double lineal = vref * 196602.0 / 4096.0 * crudo / 65536.0 + 142.0;
+  if (crudo < 2880) return lineal;
+  uint32_t i = (crudo - 2880) / 64;
+  double fraccionCrudo = (crudo - 2880 - 64.0 * i) / 64.0;
+  double fraccionVref = (vref - 1000.0) / 200.0;
+  double baja = CURVA_11DB_BAJA[i] + (CURVA_11DB_BAJA[i + 1] - CURVA_11DB_BAJA[i]) * fraccionCrudo;
+  double alta = CURVA_11DB_ALTA[i] + (CURVA_11DB_ALTA[i + 1] - CURVA_11DB_ALTA[i]) * fraccionCrudo;
+  double curva = baja + (alta - baja) * fraccionVref;
+  if (crudo > 2944) return curva;
+  return lineal + (curva - lineal) * (crudo - 2880) / 64.0;
+}
+
+/**
+ * Funcion que verifica las tablas de calibracion contra la formula de referencia (error maximo de
+ * 1 mV por el redondeo entero de esp_adc_cal, y sin escalones hacia abajo) y compara el costo de
+ * convertir con la tabla contra el de evaluar la formula entera en cada muestra
+ */
+void verificarCalibracion() {
+  uint32_t diferencias = 0, noMonotonas = 0, interpoladas = 0;
+  double errorMaximo = 0;
+  for (uint8_t c = 0; c < 3; c++)
+    for (uint32_t crudo = 0; crudo < CAL_TAM_TABLA; crudo++) {
+      double error = fabs(calibracionADC[c].convertir(crudo) - milivoltiosReferencia(crudo, VREF_EFUSE_SIM));
+      if (error > errorMaximo) errorMaximo = error;
+      if (error > 1.0) diferencias++;
+      if (crudo > 0 && calibracionADC[c].convertir(crudo) < calibracionADC[c].convertir(crudo - 1)) noMonotonas++;
+      // Con 16 bits (sobremuestreo) los valores exactos de 12 bits deben caer en la misma entrada
+      if (calibracionADC[c].convertir(crudo << 4, 16) != calibracionADC[c].convertir(crudo) << 4) interpoladas++;
+    }
+  CaracterizacionADC caracterizacion;
+  caracterizarADC1(CAL_ATENUACION_11DB, VREF_EFUSE_SIM, caracterizacion);
+  volatile uint32_t suma = 0;
+  uint32_t crudo = 12345;
+  std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < CONVERSIONES_MEDICION; i++, crudo = crudo * 1103515245u + 12345u)
+    suma = suma + calibracionADC[0].convertir((uint16_t)(crudo >> 16));
+  double tabla = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+  inicio = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < CONVERSIONES_MEDICION; i++, crudo = crudo * 1103515245u + 12345u)
+    suma = suma + crudoAMilivoltios((crudo >> 16) & 0x0FFF, caracterizacion);
+  double formula = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+  printf("Calibracion: 3 tablas de %u entradas (Vref del eFuse %u mV, 0 -> %u mV, 4095 -> %u mV), %u diferencias de mas de 1 mV"
+         " con la formula (maximo %.2f mV), %u escalones hacia abajo, %u diferencias al interpolar 16 bits; conversion %.2f ns con tabla, %.2f ns con la formula\n",
+         CAL_TAM_TABLA, VREF_EFUSE_SIM, calibracionADC[0].convertir(0), calibracionADC[0].convertir(4095), diferencias, errorMaximo,
+         noMonotonas, interpoladas, tabla * 1e9 / CONVERSIONES_MEDICION, formula * 1e9 / CONVERSIONES_MEDICION);
+  exigir(diferencias == 0 && noMonotonas == 0 && interpoladas == 0, "las tablas de calibracion siguen a la formula y son monotonas");
+}
+
+/**
+ * Señal sintetica del ADC para medir el sobremuestreo: seno de FRECUENCIA_PRUEBA mas ruido gaussiano
+ * (como el del SAR del ESP32), cuantizado a 12 bits
+ */
+struct SenalPrueba {
+  double frecuenciaMuestreo;
+  double sigma;       // Desviacion del ruido en cuentas
+  uint64_t azar;      // Estado del generador de ruido
+} senalPrueba = {0, 0, 1};
+
+/**
+ * Funcion que da un numero gaussiano de media 0 y desviacion 1 (Box-Muller)
+ */
+double gaussiano() {
+  senalPrueba.azar = senalPrueba.azar * 6364136223846793005ULL + 1442695040888963407ULL;
+  double u1 = ((senalPrueba.azar >> 11) + 1.0) / 9007199254740993.0;
+  senalPrueba.azar = senalPrueba.azar * 6364136223846793005ULL + 1442695040888963407ULL;
+  double u2 = (senalPrueba.azar >> 11) / 9007199254740992.0;
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+uint16_t generarSenalPrueba(uint8_t canal, uint32_t n) {
+  (void)canal;
+  double v = 2048 + AMPLITUD_PRUEBA * sin(2 * M_PI * FRECUENCIA_PRUEBA * n / senalPrueba.frecuenciaMuestreo) +
+             senalPrueba.sigma * gaussiano();
+  long q = lround(v);
+  return (uint16_t)(q < 0 ? 0 : (q > 4095 ? 4095 : q));
+}
+
+/**
+ * Funcion que ajusta por minimos cuadrados un seno de frecuencia conocida (con nivel DC) y da el SNR:
+ * la potencia del seno ajustado sobre la del residuo, que es todo el ruido y la distorsion
+ * @param y Muestras en cuentas de 12 bits (pueden tener fraccion)
+ * @param n Numero de muestras
+ * @param fs Frecuencia de muestreo de las muestras en Hz
+ */
+double snrSeno(const double *y, size_t n, double fs) {
+  double m[3][4] = {};  // Ecuaciones normales de y = a + b sin(wt) + c cos(wt)
+  for (size_t k = 0; k < n; k++) {
+    double base[3] = {1, sin(2 * M_PI * FRECUENCIA_PRUEBA * k / fs), cos(2 * M_PI * FRECUENCIA_PRUEBA * k / fs)};
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) m[i][j] += base[i] * base[j];
+      m[i][3] += base[i] * y[k];
+    }
+  }
+  for (int i = 0; i < 3; i++)  // Eliminacion de Gauss (la matriz es definida positiva)
+    for (int f = 0; f < 3; f++) {
+      if (f == i) continue;
+      double r = m[f][i] / m[i][i];
+      for (int j = 0; j < 4; j++) m[f][j] -= r * m[i][j];
+    }
+  double a = m[0][3] / m[0][0], b = m[1][3] / m[1][1], c = m[2][3] / m[2][2];
+  double ruido = 0;
+  for (size_t k = 0; k < n; k++) {
+    double e = y[k] - (a + b * sin(2 * M_PI * FRECUENCIA_PRUEBA * k / fs) + c * cos(2 * M_PI * FRECUENCIA_PRUEBA * k / fs));
+    ruido += e * e;
+  }
+  return 10 * log10(((b * b + c * c) / 2) / (ruido / n));
+}
+
+/**
+ * Funcion que mide la mejora del sobremuestreo: pasa la señal de prueba por la misma fuente de
+ * bloques que el DMA y compara el SNR de muestrear directamente a SAMPLING_FREQ (una de cada FACTOR
+ * muestras) con el de la salida del CIC y el compensador. Los bits efectivos se refieren a un seno
+ * de escala completa
+ */
+template <uint16_t FACTOR>
+void medirSobremuestreo(double sigma) {
+  constexpr std::array<int32_t, 3> compensador =
+      cuantizarFIR<int32_t>(disenarCompensadorCIC(ETAPAS_CIC, FACTOR, SAMPLING_FREQ, CORTE_PASA_BAJOS));
+  static SobremuestreoADC<3, ETAPAS_CIC, FACTOR> decimador(compensador);
+  const uint8_t canales[3] = {7, 5, 4};
+  // Muestras de salida por bloque: 8 como en main.cpp, o las que quepan en el DMA
+  const size_t porBloque = ADC_BLOQUE_MAX_PALABRAS / (3 * FACTOR) < 8 ? ADC_BLOQUE_MAX_PALABRAS / (3 * FACTOR) : 8;
+  static uint16_t bloque[ADC_BLOQUE_MAX_PALABRAS];
+  static uint16_t decimadas[8 * 3];
+  size_t total = (size_t)SEGUNDOS_SOBREMUESTREO * SAMPLING_FREQ;
+  double *directo = new double[total];
+  double *sobremuestreado = new double[total];
+  senalPrueba = {(double)SAMPLING_FREQ * FACTOR, sigma, 1};
+  FuenteADCSimulada fuente(generarSenalPrueba);
+  if (!fuente.iniciar(SAMPLING_FREQ * FACTOR, canales, 3, porBloque * FACTOR)) return;
+  decimador.reiniciar();
+  size_t n = 0;
+  double segundosDecimador = 0;
+  while (n < total) {
+    size_t m = fuente.esperarBloque(bloque, 0);
+    std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+    size_t salidas = decimador.procesarBloque(bloque, m, decimadas);
+    segundosDecimador += std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+    for (size_t i = 0; i < salidas && n < total; i++, n++) {
+      directo[n] = bloque[((i + 1) * FACTOR - 1) * 3];  // La ultima muestra de cada periodo de salida
+      sobremuestreado[n] = decimadas[i * 3] / 16.0;
+    }
+  }
+  const size_t descarte = 16;  // El CIC y el compensador se asientan en unas pocas muestras
+  double snrDirecto = snrSeno(directo + descarte, total - descarte, SAMPLING_FREQ);
+  double snrSobremuestreo = snrSeno(sobremuestreado + descarte, total - descarte, SAMPLING_FREQ);
+  double escala = 20 * log10(2048 / AMPLITUD_PRUEBA);
+  printf("%8ux %9.1f %10.1f dB %8.2f %10.1f dB %8.2f %12.2f\n", FACTOR, sigma, snrDirecto, (snrDirecto + escala - 1.76) / 6.02,
+         snrSobremuestreo, (snrSobremuestreo + escala - 1.76) / 6.02, segundosDecimador * 1e9 / ((double)total * FACTOR));
+  delete[] directo;
+  delete[] sobremuestreado;
+}
+
+/**
+ * Funcion que reporta la mejora de resolucion del sobremuestreo con varios factores y niveles de ruido,
+ * y la planitud de la banda de paso con el compensador
+ */
+void verificarSobremuestreo() {
+  constexpr std::array<int32_t, 3> compensador =
+      cuantizarFIR<int32_t>(disenarCompensadorCIC(ETAPAS_CIC, FACTOR_SOBREMUESTREO, SAMPLING_FREQ, CORTE_PASA_BAJOS));
+  double w = 2 * M_PI * CORTE_PASA_BAJOS / SAMPLING_FREQ;
+  double compensacion = (compensador[1] + 2.0 * compensador[0] * cos(w)) / (1 << 30);
+  double cic = respuestaCIC(ETAPAS_CIC, FACTOR_SOBREMUESTREO, SAMPLING_FREQ, CORTE_PASA_BAJOS);
+  printf("Sobremuestreo: CIC de %u etapas, a %u Hz el CIC atenua %.2f dB y con el compensador %.3f dB\n", ETAPAS_CIC,
+         CORTE_PASA_BAJOS, 20 * log10(cic), 20 * log10(cic * compensacion));
+  printf("%9s %9s %13s %8s %13s %8s %12s\n", "Factor", "Ruido", "SNR directo", "ENOB", "SNR CIC", "ENOB", "ns/muestra");
+  const double ruidos[] = {0.5, 3};  // Cuentas: casi solo cuantizacion y el ruido tipico del ADC del ESP32
+  for (double sigma : ruidos) {
+    medirSobremuestreo<16>(sigma);
+    medirSobremuestreo<32>(sigma);
+    medirSobremuestreo<64>(sigma);
+  }
+}
+
+#define SEGUNDOS_CADENA 20  // Señal de la comparacion de cadenas (a SAMPLING_FREQ * FACTOR_SOBREMUESTREO)
+
+struct ResultadoCadena {
+  uint32_t paquetes;
+  uint32_t suma;      // FNV-1a de los bytes de todos los paquetes, para comparar las dos cadenas
+} resultadoCadena;
+
+/**
+ * Sumidero de la comparacion: cuenta los paquetes y acumula sus bytes
+ */
+void sumarPaqueteCadena(const PaqueteCodificado &paquete) {
+  resultadoCadena.paquetes++;
+  for (size_t i = 0; i < paquete.len; i++) resultadoCadena.suma = (resultadoCadena.suma ^ paquete.datos[i]) * 16777619u;
+}
+
+typedef EtapaDecimadorADC<SAMPLING_FREQ * FACTOR_SOBREMUESTREO, FACTOR_SOBREMUESTREO, ETAPAS_CIC, CORTE_PASA_BAJOS> DecimadorPrueba;
+typedef EtapaSumidero<PaqueteCodificado, FRECUENCIA_EVENTOS, sumarPaqueteCadena> SumideroPrueba;
+
+/**
+ * Funcion que compara la cadena compuesta al compilar con la misma cadena armada con llamadas
+ * virtuales (decimador -> calibracion -> filtro -> empaquetado -> sumidero, las mismas clases de
+ * libetapas.h): las dos deben dar exactamente los mismos paquetes, y se reporta el tiempo por muestra
+ */
+void medirCadena() {
+  size_t total = (size_t)SEGUNDOS_CADENA * SAMPLING_FREQ * FACTOR_SOBREMUESTREO;
+  MuestraADC *entrada = new MuestraADC[total];
+  senalPrueba = {(double)SAMPLING_FREQ * FACTOR_SOBREMUESTREO, 3, 1};
+  for (size_t n = 0; n < total; n++) {
+    entrada[n].marcaTiempo = 1000000 + (uint64_t)n * 1000000 / (SAMPLING_FREQ * FACTOR_SOBREMUESTREO);
+    entrada[n].x = generarSenalPrueba(0, n);
+    entrada[n].y = generarSenalPrueba(1, n);
+    entrada[n].z = generarSenalPrueba(2, n);
+  }
+  ResultadoCadena resultado[2];
+  double mejor[2] = {1e9, 1e9};
+  for (int repeticion = 0; repeticion < 3; repeticion++) {
+    // Compuesta al compilar
+    Cadena<DecimadorPrueba, EtapaCalibracionADC<SAMPLING_FREQ>, EtapaFiltroEKG<SAMPLING_FREQ>,
+           EtapaEmpaquetadoLoRa<SAMPLING_FREQ>, SumideroPrueba> *compuesta =
+        new Cadena<DecimadorPrueba, EtapaCalibracionADC<SAMPLING_FREQ>, EtapaFiltroEKG<SAMPLING_FREQ>,
+                   EtapaEmpaquetadoLoRa<SAMPLING_FREQ>, SumideroPrueba>();
+    compuesta->etapa<1>().tablas = calibracionADC;
+    compuesta->etapa<3>().iniciar(CANALES_LORA, true);
+    resultadoCadena = {0, 2166136261u};
+    std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+    compuesta->procesarBloque(entrada, total);
+    double segundos = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+    if (segundos < mejor[0]) mejor[0] = segundos;
+    resultado[0] = resultadoCadena;
+    delete compuesta;
+
+    // Armada en tiempo de ejecucion, una llamada virtual por etapa
+    AdaptadorVirtual<SumideroPrueba> *sumidero = new AdaptadorVirtual<SumideroPrueba>(NULL);
+    AdaptadorVirtual<EtapaEmpaquetadoLoRa<SAMPLING_FREQ>> *empaquetado = new AdaptadorVirtual<EtapaEmpaquetadoLoRa<SAMPLING_FREQ>>(sumidero);
+    AdaptadorVirtual<EtapaFiltroEKG<SAMPLING_FREQ>> *filtro = new AdaptadorVirtual<EtapaFiltroEKG<SAMPLING_FREQ>>(empaquetado);
+    AdaptadorVirtual<EtapaCalibracionADC<SAMPLING_FREQ>> *calibracion = new AdaptadorVirtual<EtapaCalibracionADC<SAMPLING_FREQ>>(filtro);
+    AdaptadorVirtual<DecimadorPrueba> *decimador = new AdaptadorVirtual<DecimadorPrueba>(calibracion);
+    calibracion->etapa.tablas = calibracionADC;
+    empaquetado->etapa.iniciar(CANALES_LORA, true);
+    EtapaVirtual<MuestraADC> *primera = decimador;
+    resultadoCadena = {0, 2166136261u};
+    inicio = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < total; n++) primera->procesar(entrada[n]);
+    segundos = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+    if (segundos < mejor[1]) mejor[1] = segundos;
+    resultado[1] = resultadoCadena;
+    delete decimador;
+    delete calibracion;
+    delete filtro;
+    delete empaquetado;
+    delete sumidero;
+  }
+  printf("Cadena (decimador x%u -> calibracion -> filtro -> empaquetado): compuesta %.2f ns/muestra, virtual %.2f ns/muestra, "
+         "%u/%u paquetes, salidas %s\n", FACTOR_SOBREMUESTREO, mejor[0] * 1e9 / total, mejor[1] * 1e9 / total, resultado[0].paquetes,
+         resultado[1].paquetes, resultado[0].paquetes == resultado[1].paquetes && resultado[0].suma == resultado[1].suma ? "identicas" : "DISTINTAS");
+  exigir(resultado[0].paquetes == resultado[1].paquetes && resultado[0].suma == resultado[1].suma,
+         "la cadena compuesta y la virtual dan los mismos paquetes");
+  delete[] entrada;
+}
+
+#define MAX_LATIDOS_PRUEBA 1024
+
+/**
+ * Latidos de la prueba del detector: los verdaderos (de la señal sintetica) y los detectados
+ */
+struct PruebaQRS {
+  double verdaderos[MAX_LATIDOS_PRUEBA];     // Instante de cada pico R en segundos
+  ClaseLatido clases[MAX_LATIDOS_PRUEBA];    // Prematuro o tardio a proposito, o normal
+  size_t numVerdaderos;
+  EventoLatido detectados[MAX_LATIDOS_PRUEBA];
+  size_t numDetectados;
+  EmpaquetadorLatidos empaquetador;
+  uint64_t bytesMuestras;   // Bytes de los paquetes de muestras que saldrian por el radio
+  uint32_t muestrasEnviadas;
+} pruebaQRS;
+
+/**
+ * Sumidero de latidos de la prueba: los guarda y los empaqueta como en el firmware
+ */
+void registrarLatidoPrueba(const EventoLatido &latido) {
+  if (pruebaQRS.numDetectados < MAX_LATIDOS_PRUEBA) pruebaQRS.detectados[pruebaQRS.numDetectados++] = latido;
+  pruebaQRS.empaquetador.agregar(latido);
+}
+
+/**
+ * Sumidero de paquetes de muestras de la prueba
+ */
+void contarPaquetePrueba(const PaqueteCodificado &paquete) {
+  pruebaQRS.bytesMuestras += paquete.len;
+}
+
+/**
+ * Funcion que da un latido sintetico (P, Q, R, S y T como gaussianas) relativo a su pico R
+ * @param t Tiempo desde el pico R en segundos
+ * @param amplitud Amplitud del pico R en cuentas
+ */
+double formaLatido(double t, double amplitud) {
+  static const double onda[5][3] = {  // Centro (s), ancho (s), amplitud relativa al R
+      {-0.20, 0.025, 0.12}, {-0.03, 0.010, -0.12}, {0, 0.011, 1}, {0.03, 0.010, -0.25}, {0.26, 0.050, 0.35}};
+  double v = 0;
+  for (const double *o : onda) v += o[2] * exp(-(t - o[0]) * (t - o[0]) / (2 * o[1] * o[1]));
+  return amplitud * v;
+}
+
+/**
+ * Funcion que mide el detector de latidos con un EKG sintetico de duracion conocida: la frecuencia
+ * sube de 65 a 110 lpm con arritmia respiratoria, hay un latido prematuro cada 20 (con su pausa
+ * compensatoria), un latido que no se produce, un tramo con la amplitud a la tercera parte y, si artefactos,
+ * tramos de ruido muscular y un salto de la linea base. Se pasa por el mismo filtro del EKG y la
+ * misma etapa del detector que el firmware, y cada pico R detectado se empareja con el verdadero
+ * mas cercano dentro de TOLERANCIA_QRS_US
+ */
+void medirQRS(const char *nombre, double sigma, bool artefactos) {
+  PruebaQRS &p = pruebaQRS;
+  p.numVerdaderos = p.numDetectados = 0;
+  p.bytesMuestras = 0;
+  double t = 1.0;
+  uint32_t latido = 0;
+  while (t < SEGUNDOS_QRS - 1 && p.numVerdaderos < MAX_LATIDOS_PRUEBA) {
+    double rr = (60.0 / (65 + 45 * t / SEGUNDOS_QRS)) * (1 + 0.04 * sin(2 * M_PI * 0.25 * t));
+    ClaseLatido clase = LATIDO_NORMAL;
+    if (latido % 20 == 19) {
+      rr *= 0.65;
+      clase = LATIDO_PREMATURO;
+    } else if (latido % 20 == 0 && latido > 0) {  // Pausa compensatoria despues del prematuro
+      rr *= 1.35;
+      clase = LATIDO_TARDIO;
+    } else if (latido == 150) {                   // Un latido que no se produjo
+      rr *= 2;
+      clase = LATIDO_TARDIO;
+    }
+    t += rr;
+    p.verdaderos[p.numVerdaderos] = t;
+    p.clases[p.numVerdaderos++] = clase;
+    latido++;
+  }
+  size_t total = (size_t)SEGUNDOS_QRS * SAMPLING_FREQ;
+  MuestraADC *filtradas = new MuestraADC[total];
+  struct Guardar {  // Sumidero de la etapa del filtro
+    MuestraADC *destino;
+    size_t n;
+    void procesar(const MuestraADC &m) { destino[n++] = m; }
+  } guardar = {filtradas, 0};
+  EtapaFiltroEKG<SAMPLING_FREQ> *filtro = new EtapaFiltroEKG<SAMPLING_FREQ>();
+  senalPrueba.azar = 7;
+  size_t k = 0;
+  for (size_t n = 0; n < total; n++) {
+    double s = (double)n / SAMPLING_FREQ;
+    while (k + 1 < p.numVerdaderos && p.verdaderos[k + 1] < s) k++;
+    double amplitud = (s > 100 && s < 140) ? 300 : 900;  // Otra derivacion o un electrodo con mas impedancia
+    double v = 2048 + 200 * sin(2 * M_PI * 0.2 * s) + 60 * sin(2 * M_PI * FRECUENCIA_RED * s) + sigma * gaussiano();
+    for (size_t j = (k > 0 ? k - 1 : 0); j < k + 2 && j < p.numVerdaderos; j++) v += formaLatido(s - p.verdaderos[j], amplitud);
+    if (artefactos && ((s > 200 && s < 210) || (s > 250 && s < 253))) v += 250 * gaussiano(); // Ruido muscular
+    if (artefactos && s > 230) v -= 400;                                                    // Se movio un electrodo
+    MuestraADC m;
+    m.marcaTiempo = (uint64_t)n * 1000000 / SAMPLING_FREQ;
+    long q = lround(v);
+    m.x = m.y = m.z = (uint16_t)(q < 0 ? 0 : (q > 4095 ? 4095 : q));
+    filtro->procesar(m, guardar);
+  }
+  delete filtro;
+
+  // Costo del detector solo, sobre el EKG ya filtrado
+  DetectorQRS<SAMPLING_FREQ> *detector = new DetectorQRS<SAMPLING_FREQ>();
+  DeteccionQRS detecciones[2];
+  size_t encontrados = 0;
+  std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+  for (size_t n = 0; n < total; n++) encontrados += detector->procesar((int32_t)filtradas[n].x - 2048, filtradas[n].marcaTiempo, detecciones);
+  double segundos = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+  delete detector;
+
+  // Detector y empaquetado como en el firmware, primero con toda la señal y luego solo con los fragmentos
+  typedef Cadena<EtapaDetectorQRS<SAMPLING_FREQ, registrarLatidoPrueba>, EtapaEmpaquetadoLoRa<SAMPLING_FREQ>,
+                 EtapaSumidero<PaqueteCodificado, FRECUENCIA_EVENTOS, contarPaquetePrueba>> CadenaPrueba;
+  CadenaPrueba *cadena = new CadenaPrueba();
+  uint64_t bytesTodas = 0;
+  uint32_t muestrasFragmentos = 0;
+  for (int soloAnomalias = 0; soloAnomalias < 2; soloAnomalias++) {
+    p.numDetectados = 0;
+    p.bytesMuestras = 0;
+    p.empaquetador.iniciar();
+    cadena->etapa<0>().reiniciar(soloAnomalias);
+    cadena->etapa<1>().iniciar(1, false);
+    cadena->procesarBloque(filtradas, total);
+    cadena->etapa<1>().empaquetador.cerrar();
+    p.empaquetador.cerrar();
+    if (soloAnomalias) muestrasFragmentos = cadena->etapa<1>().empaquetador.muestras;
+    else bytesTodas = p.bytesMuestras + cadena->etapa<1>().empaquetador.tamano();
+  }
+  uint32_t fragmentos = cadena->etapa<0>().fragmentos;
+  uint64_t bytesFragmentos = p.bytesMuestras + cadena->etapa<1>().empaquetador.tamano();
+  delete cadena;
+  delete[] filtradas;
+
+  // Emparejamos los picos R detectados con los verdaderos (los dos estan ordenados)
+  size_t vp = 0, fp = 0, anomalosMarcados = 0, anomalos = 0, falsasAlarmas = 0, recuperados = 0;
+  double errorTotal = 0, errorMaximo = 0;
+  size_t j = 0;
+  size_t primero = 0;
+  while (primero < p.numVerdaderos && p.verdaderos[primero] < QRS_APRENDIZAJE_MS / 1000.0 + 0.5) primero++;
+  bool *emparejado = new bool[p.numVerdaderos]();
+  for (size_t i = 0; i < p.numDetectados; i++) {
+    double d = p.detectados[i].marcaTiempo / 1e6;
+    while (j + 1 < p.numVerdaderos && fabs(p.verdaderos[j + 1] - d) < fabs(p.verdaderos[j] - d)) j++;
+    double error = d - p.verdaderos[j];
+    if (fabs(error) * 1e6 <= TOLERANCIA_QRS_US && !emparejado[j]) {
+      emparejado[j] = true;
+      if (j < primero) continue;
+      vp++;
+      errorTotal += error;
+      if (fabs(error) > errorMaximo) errorMaximo = fabs(error);
+      if (p.detectados[i].recuperado) recuperados++;
+      ClaseLatido clase = p.detectados[i].clase;
+      if (p.clases[j] != LATIDO_NORMAL && clase == p.clases[j]) anomalosMarcados++;
+      else if (p.clases[j] == LATIDO_NORMAL && (clase == LATIDO_PREMATURO || clase == LATIDO_TARDIO)) falsasAlarmas++;
+    } else if (d > QRS_APRENDIZAJE_MS / 1000.0) {
+      fp++;
+    }
+  }
+  size_t fn = 0;
+  for (size_t i = primero; i < p.numVerdaderos; i++) {
+    if (!emparejado[i]) fn++;
+    if (p.clases[i] != LATIDO_NORMAL) anomalos++;
+  }
+  delete[] emparejado;
+  double ns = segundos * 1e9 / total;
+  if (encontrados != p.numDetectados) printf("El detector solo encontro %zu latidos y la etapa %zu\n", encontrados, p.numDetectados);
+  printf("%-9s %5zu %5zu %4zu %4zu %7.2f%% %7.2f%% %+7.1f %7.1f %6zu %4zu/%-4zu %6zu %7.1f %8.0f %7.1f%% %6.1f%% %6u\n", nombre,
+         p.numVerdaderos - primero, vp, fn, fp, vp + fn ? 100.0 * vp / (vp + fn) : 0.0, vp + fp ? 100.0 * vp / (vp + fp) : 0.0,
+         vp ? errorTotal / vp * 1e3 : 0.0, errorMaximo * 1e3, recuperados, anomalosMarcados, anomalos, falsasAlarmas, ns,
+         ns * halCiclosPorMicrosegundo() / 1000, 100.0 * (p.empaquetador.bytesPaquetes + bytesFragmentos) / bytesTodas,
+         100.0 * muestrasFragmentos / total, fragmentos);
+}
+
+/**
+ * Funcion que reporta la exactitud y el costo del detector de latidos con señales sinteticas
+ */
+void verificarQRS() {
+  printf("Detector QRS (%u s de EKG sintetico a %u Hz, tolerancia %u ms; ciclos equivalentes a %u MHz medidos en el computador):\n",
+         SEGUNDOS_QRS, SAMPLING_FREQ, TOLERANCIA_QRS_US / 1000, halCiclosPorMicrosegundo());
+  printf("%-9s %5s %5s %4s %4s %8s %8s %7s %7s %6s %9s %6s %7s %8s %8s %7s %6s\n", "Señal", "R", "VP", "FN", "FP", "Sens", "VPP",
+         "Err ms", "Max ms", "Recup", "Anom", "FalsA", "ns/m", "ciclos/m", "Bytes", "Señal", "Fragm");
+  printf("(Bytes y Señal: lo que sale por LoRa solo con los latidos y los fragmentos de las anomalias, frente a enviar toda la señal)\n");
+  medirQRS("limpia", 3, false);
+  medirQRS("ruidosa", 15, true);
+}
+
+/**
+ * Señal de la prueba del analisis espectral: un seno en cada banda del EEG, la red y su segundo
+ * armonico, mas ruido gaussiano, en cuentas de 12 bits
+ */
+uint16_t senalEspectro(uint32_t n) {
+  double t = (double)n / SAMPLING_FREQ;
+  double v = 2048 + 300 * sin(2 * M_PI * 2.0 * t) + 150 * sin(2 * M_PI * 6.1 * t + 1) + 200 * sin(2 * M_PI * 10.3 * t + 2) +
+             80 * sin(2 * M_PI * 21.7 * t + 0.5) + 40 * sin(2 * M_PI * 37.1 * t) + AMPLITUD_RED_SIM * sin(2 * M_PI * FRECUENCIA_RED * t) +
+             20 * sin(2 * M_PI * 2 * FRECUENCIA_RED * t + 1) + 5 * gaussiano();
+  long q = lround(v);
+  return (uint16_t)(q < 0 ? 0 : (q > 4095 ? 4095 : q));
+}
+
+/**
+ * Funcion que calcula en doble precision el bin k de la DFT de la ventana que termina en la muestra
+ * fin, sin el valor medio
+ * @param hann true para aplicar la ventana de Hann periodica
+ */
+void dftReferencia(const uint16_t *x, size_t fin, size_t k, bool hann, double &re, double &im) {
+  const size_t n = SIZE_BUF;
+  double media = 0;
+  for (size_t i = 0; i < n; i++) media += x[fin + 1 - n + i];
+  media /= n;
+  re = im = 0;
+  for (size_t i = 0; i < n; i++) {
+    double v = (x[fin + 1 - n + i] - media) * (hann ? 0.5 - 0.5 * cos(2 * M_PI * i / n) : 1.0);
+    re += v * cos(2 * M_PI * k * i / n);
+    im -= v * sin(2 * M_PI * k * i / n);
+  }
+}
+
+/**
+ * Funcion que pasa |X|^2 de una DFT con ventana de Hann a la potencia media de la señal en dB
+ * @param tono true para la de un seno en un solo bin (ganancia coherente), false para una suma de bins
+ */
+double decibelesHann(double potencia, bool tono) {
+  return 10 * log10(2 * potencia / (tono ? SIZE_BUF * SIZE_BUF / 4.0 : SIZE_BUF * 3.0 * SIZE_BUF / 8));
+}
+
+#define MAX_REGISTROS_PRUEBA (SEGUNDOS_ESPECTRO * SAMPLING_FREQ * 2 / SIZE_BUF + 1)
+
+RegistroEspectro *registrosPrueba = NULL;
+size_t numRegistrosPrueba = 0;
+
+void guardarRegistroPrueba(const RegistroEspectro &registro) {
+  if (numRegistrosPrueba < MAX_REGISTROS_PRUEBA) registrosPrueba[numRegistrosPrueba++] = registro;
+}
+
+void descartarMuestraPrueba(const MuestraADC &muestra) {
+  (void)muestra;
+}
+
+typedef Cadena<EtapaEspectro<SAMPLING_FREQ, SIZE_BUF, guardarRegistroPrueba>,
+               EtapaSumidero<MuestraADC, SAMPLING_FREQ, descartarMuestraPrueba>> CadenaEspectroPrueba;
+
+/**
+ * Funcion que compara el analisis espectral en punto fijo con la DFT en doble precision y mide su costo:
+ *  - las bandas de los registros de la etapa contra las de la DFT de la misma ventana
+ *  - el espectro de FFTReal bin por bin (SNR de las magnitudes)
+ *  - el Goertzel deslizante a lo largo de SEGUNDOS_ESPECTRO: el error del final debe ser el del
+ *    principio (no se acumula), frente a una DFT deslizante recursiva en float que si deriva
+ */
+void verificarEspectro() {
+  const size_t n = SIZE_BUF;
+  size_t total = (size_t)SEGUNDOS_ESPECTRO * SAMPLING_FREQ;
+  uint16_t *x = new uint16_t[total];
+  MuestraADC *entrada = new MuestraADC[total];
+  senalPrueba.azar = 7;
+  for (size_t i = 0; i < total; i++) {
+    x[i] = senalEspectro((uint32_t)i);
+    entrada[i].marcaTiempo = i;  // El registro lleva la marca de la ultima muestra de su ventana: su indice
+    entrada[i].x = entrada[i].y = entrada[i].z = x[i];
+    entrada[i].bits = 12;
+  }
+
+  // Bandas de la etapa contra la DFT en doble precision (en las primeras VENTANAS_ESPECTRO ventanas)
+  registrosPrueba = new RegistroEspectro[MAX_REGISTROS_PRUEBA];
+  numRegistrosPrueba = 0;
+  CadenaEspectroPrueba *cadena = new CadenaEspectroPrueba();
+  cadena->etapa<0>().reiniciar();
+  std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+  cadena->procesarBloque(entrada, total);
+  double etapa = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+  double errorBandas = 0, errorBandasMaximo = 0;
+  size_t bandasComparadas = 0;
+  for (size_t r = 0; r < numRegistrosPrueba && r < VENTANAS_ESPECTRO; r++) {
+    size_t fin = (size_t)registrosPrueba[r].marcaTiempo;
+    for (uint8_t b = 0; b < ESPECTRO_NUM_BANDAS; b++) {
+      double suma = 0, re, im;
+      for (size_t k = binEspectro(BANDAS_ESPECTRO[b][0], n, SAMPLING_FREQ); k < binEspectro(BANDAS_ESPECTRO[b][1], n, SAMPLING_FREQ) && k <= n / 2; k++) {
+        dftReferencia(x, fin, k, true, re, im);
+        suma += re * re + im * im;
+      }
+      double error = fabs(registrosPrueba[r].valores[b] / 10.0 - decibelesHann(suma, false));
+      errorBandas += error;
+      if (error > errorBandasMaximo) errorBandasMaximo = error;
+      bandasComparadas++;
+    }
+  }
+
+  // Espectro de FFTReal bin por bin: las magnitudes en la escala de la DFT (X = |Xf| N / 2^16)
+  FFTReal<SIZE_BUF> *fft = new FFTReal<SIZE_BUF>();
+  int16_t ventana[SIZE_BUF];
+  uint64_t potencia[SIZE_BUF / 2 + 1];
+  double senal = 0, ruido = 0;
+  for (size_t w = 0; w < VENTANAS_ESPECTRO; w++) {
+    size_t fin = n - 1 + w * n / 2;
+    int32_t suma = 0;
+    for (size_t i = 0; i < n; i++) suma += ventana[i] = (int16_t)(x[fin + 1 - n + i] - 2048);
+    fft->transformar(ventana, 0, (int32_t)((int64_t)suma * 256 / (int64_t)n), potencia);
+    for (size_t k = 0; k <= n / 2; k++) {
+      double re, im;
+      dftReferencia(x, fin, k, true, re, im);
+      double referencia = sqrt(re * re + im * im), fija = sqrt((double)potencia[k]) * n / 65536;
+      senal += referencia * referencia;
+      ruido += (fija - referencia) * (fija - referencia);
+    }
+  }
+
+  // Goertzel deslizante en la red contra la DFT, con la DFT deslizante recursiva en float al lado
+  GoertzelDeslizante<SIZE_BUF, ESPECTRO_NUM_BINS> *goertzel = new GoertzelDeslizante<SIZE_BUF, ESPECTRO_NUM_BINS>();
+  size_t bins[ESPECTRO_NUM_BINS] = {(size_t)lround((double)FRECUENCIA_RED * n / SAMPLING_FREQ), (size_t)lround(2.0 * FRECUENCIA_RED * n / SAMPLING_FREQ)};
+  goertzel->configurar(bins);
+  float recursivaRe = 0, recursivaIm = 0;
+  float giroRe = (float)cos(2 * M_PI * bins[0] / n), giroIm = (float)sin(2 * M_PI * bins[0] / n);
+  double errorInicio = 0, errorFinal = 0, errorRecursivaInicio = 0, errorRecursivaFinal = 0;
+  size_t comparaciones = 0;
+  for (size_t i = 0; i < total; i++) {
+    int32_t entra = x[i] - 2048, sale = (i >= n) ? x[i - n] - 2048 : 0;
+    goertzel->procesar(entra, sale);
+    float a = recursivaRe + (float)(entra - sale), b = recursivaIm;  // S(n) = e^(i 2 pi k / N) (S(n-1) + x(n) - x(n-N))
+    recursivaRe = a * giroRe - b * giroIm;
+    recursivaIm = a * giroIm + b * giroRe;
+    if (i < n || (i + 1) % (n / 2)) continue;
+    bool alInicio = i < total / 10, alFinal = i >= total - total / 10;
+    if (!alInicio && !alFinal) continue;
+    double error = 0, errorRecursiva, re, im;
+    for (uint8_t b = 0; b < ESPECTRO_NUM_BINS; b++) {
+      dftReferencia(x, i, bins[b], true, re, im);
+      double e = fabs(decimasDeDecibel(goertzel->potencia(b), GoertzelDeslizante<SIZE_BUF, ESPECTRO_NUM_BINS>::ESCALA_POTENCIA) / 10.0 -
+                      decibelesHann(re * re + im * im, true));
+      if (e > error) error = e;
+    }
+    dftReferencia(x, i, bins[0], false, re, im);  // La recursiva sin ventana (su magnitud no depende de la fase)
+    errorRecursiva = fabs(10 * log10(((double)recursivaRe * recursivaRe + (double)recursivaIm * recursivaIm) / (re * re + im * im)));
+    if (alInicio) {
+      if (error > errorInicio) errorInicio = error;
+      if (errorRecursiva > errorRecursivaInicio) errorRecursivaInicio = errorRecursiva;
+    } else {
+      if (error > errorFinal) errorFinal = error;
+      if (errorRecursiva > errorRecursivaFinal) errorRecursivaFinal = errorRecursiva;
+    }
+    comparaciones++;
+  }
+
+  // Costo de la FFT y del Goertzel por separado
+  const size_t repeticiones = 20000;
+  inicio = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < repeticiones; r++) fft->transformar(ventana, r % n, 0, potencia);
+  double tiempoFFT = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count() / repeticiones;
+  volatile uint64_t sumidero = potencia[1];
+  goertzel->reiniciar();
+  inicio = std::chrono::steady_clock::now();
+  for (size_t i = n; i < total; i++) goertzel->procesar(x[i] - 2048, x[i - n] - 2048);
+  double tiempoGoertzel = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count() / (total - n);
+  sumidero = sumidero + goertzel->potencia(0);
+
+  double ciclos = halCiclosPorMicrosegundo() / 1000.0;  // Ciclos equivalentes por ns
+  printf("Espectro (ventana de %u muestras a %u Hz con Hann y 50%% de traslape, contra la DFT en doble precision; ciclos equivalentes a %u MHz):\n",
+         SIZE_BUF, SAMPLING_FREQ, halCiclosPorMicrosegundo());
+  printf("  FFT en punto fijo: SNR de las magnitudes %.1f dB en %u ventanas; bandas de la etapa: error medio %.3f dB, maximo %.3f dB (%u registros, %u comparados)\n",
+         10 * log10(senal / ruido), VENTANAS_ESPECTRO, bandasComparadas ? errorBandas / bandasComparadas : 0.0, errorBandasMaximo,
+         (unsigned)numRegistrosPrueba, (unsigned)(bandasComparadas / ESPECTRO_NUM_BANDAS));
+  printf("  Goertzel deslizante (%u y %u Hz, %u s = %u muestras): error maximo %.3f dB en el primer 10%% y %.3f dB en el ultimo (%u comparaciones);"
+         " DFT deslizante recursiva en float: %.3f dB -> %.3f dB\n", FRECUENCIA_RED, 2 * FRECUENCIA_RED, SEGUNDOS_ESPECTRO, (unsigned)total,
+         errorInicio, errorFinal, (unsigned)comparaciones, errorRecursivaInicio, errorRecursivaFinal);
+  exigir(errorBandasMaximo < 0.1, "las bandas de la etapa difieren de la DFT en menos de 0.1 dB");
+  exigir(errorFinal < 0.1 && errorFinal <= errorInicio + 0.01, "el Goertzel deslizante no deriva");
+  printf("  Costo: FFT %.2f us (%.0f ciclos, una cada %u muestras), Goertzel %.1f ns/muestra (%.0f ciclos, %u bins), etapa completa %.1f ns/muestra"
+         " (%.0f ciclos, %.3f%% de un nucleo a %u Hz)\n", tiempoFFT * 1e6, tiempoFFT * 1e9 * ciclos, SIZE_BUF / 2, tiempoGoertzel * 1e9,
+         tiempoGoertzel * 1e9 * ciclos, ESPECTRO_NUM_BINS, etapa * 1e9 / total, etapa * 1e9 / total * ciclos,
+         100.0 * etapa / total * SAMPLING_FREQ * ciclos * 1e3 / halCiclosPorMicrosegundo(), SAMPLING_FREQ);
+  delete goertzel;
+  delete fft;
+  delete cadena;
+  delete[] registrosPrueba;
+  delete[] entrada;
+  delete[] x;
+}
+
+/**
+ * Manejador de la tarea del ADC: el mismo trabajo que filtrar() en main.cpp, etapa por etapa
+ */
+#define BLOQUES_RESERVA_SIM 20000   // Bloques del DMA simulados que se reciben en la verificacion de la reserva
+#define AGOTADA_INICIO 9000         // Bloques en los que otro retiene toda la reserva
+#define AGOTADA_FIN 9040
+
+/**
+ * Señal de la verificacion de la reserva: deterministica, para que dos fuentes den los mismos bloques
+ */
+uint16_t senalReserva(uint8_t canal, uint32_t n) {
+  return (uint16_t)((n * 37 + canal * 1000) & 0x0FFF);
+}
+
+/**
+ * Funcion que verifica la recepcion de los bloques del DMA en la reserva: cada bloque que ve el manejador
+ * es igual al que entrega la misma fuente leida en un buffer aparte, la reserva queda libre al soltarlo
+ * y, mientras otro retiene todos los bloques, la recepcion sigue en el bloque propio sin perder muestras
+ */
+void verificarReserva() {
+  const uint8_t canales[3] = {7, 5, 4};
+  FuenteADCSimulada fuente(senalReserva), copia(senalReserva);
+  if (!fuente.iniciar(SAMPLING_FREQ, canales, 3, 32) || !copia.iniciar(SAMPLING_FREQ, canales, 3, 32)) return;  // Los bloques de ADQUISICION_DMA en main.cpp
+  static ReservaBloquesADC reserva;
+  static ReceptorBloques receptor(reserva);
+  static uint16_t esperados[ADC_BLOQUE_MAX_PALABRAS];
+  BloqueMuestras *retenidos[ADC_RESERVA_BLOQUES];
+  uint32_t distintos = 0, sinLiberar = 0;
+  for (uint32_t n = 0; n < BLOQUES_RESERVA_SIM; n++) {
+    if (n == AGOTADA_INICIO)
+      for (BloqueMuestras *&b : retenidos) b = reserva.reservar();
+    if (n == AGOTADA_FIN)
+      for (BloqueMuestras *b : retenidos) reserva.liberar(b);
+    BloqueMuestras *bloque = receptor.esperar(fuente, 3, 0);
+    size_t m = copia.esperarBloque(esperados, 0);
+    if (bloque == NULL || bloque->muestras != m || memcmp(bloque->datos, esperados, m * 3 * sizeof(uint16_t)) != 0) distintos++;
+    if (bloque) receptor.soltar(bloque);
+    if (reserva.estadisticas().ocupados != ((n >= AGOTADA_INICIO && n < AGOTADA_FIN) ? ADC_RESERVA_BLOQUES : 0)) sinLiberar++;
+  }
+  EstadisticasReserva e = reserva.estadisticas();
+  printf("Reserva de bloques: %u bloques de %u x 3 muestras del DMA, %u distintos de la fuente, %u en el bloque propio (reserva"
+         " agotada), %u sin liberar, maximo %u de %u ocupados, %u ocupados al final\n", BLOQUES_RESERVA_SIM, 32, distintos, e.agotados,
+         sinLiberar, e.maximoOcupados, e.capacidad, e.ocupados);
+  exigir(distintos == 0 && sinLiberar == 0 && e.agotados == AGOTADA_FIN - AGOTADA_INICIO && e.ocupados == 0,
+         "la reserva entrega los bloques del DMA completos y los recupera");
+}
+
+/**
+ * Tarea que al reproducir en tiempo real duerme hasta que el reloj real alcanza al virtual, para
+ * ver el comportamiento con el ritmo de la placa (y no a toda velocidad)
+ */
+void ritmoTiempoReal() {
+  static std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+  std::this_thread::sleep_until(inicio + std::chrono::microseconds(halMicros()));
+}
+
+/**
+ * Funcion que compara las salidas de la corrida con las de la corrida de referencia (una por linea).
+ * Si la referencia no existe la crea con las de esta corrida
+ * @param primera Recibe la primera linea distinta de esta corrida
+ * @return Lineas distintas (contando las que sobran o faltan), o -1 si no se pudo leer ni crear la referencia
+ */
+long compararSalidas(const char *archivo, std::string &primera) {
+  FILE *f = fopen(archivo, "rb");
+  if (f == NULL) {
+    f = fopen(archivo, "wb");
+    if (f == NULL) return -1;
+    fwrite(capturaSim.salidas.data(), 1, capturaSim.salidas.size(), f);
+    fclose(f);
+    return 0;
+  }
+  std::string referencia;
+  char leidos[4096];
+  size_t n;
+  while ((n = fread(leidos, 1, sizeof(leidos), f)) > 0) referencia.append(leidos, n);
+  fclose(f);
+  long diferencias = 0;
+  size_t a = 0, b = 0;
+  const std::string &salidas = capturaSim.salidas;
+  while (a < salidas.size() || b < referencia.size()) {
+    size_t finA = salidas.find('\n', a), finB = referencia.find('\n', b);
+    if (finA == std::string::npos) finA = salidas.size();
+    if (finB == std::string::npos) finB = referencia.size();
+    if (salidas.compare(a, finA - a, referencia, b, finB - b) != 0) {
+      if (diferencias++ == 0) primera = a < salidas.size() ? salidas.substr(a, finA - a) : "(falta: " + referencia.substr(b, finB - b) + ")";
+    }
+    a = (finA < salidas.size()) ? finA + 1 : salidas.size();
+    b = (finB < referencia.size()) ? finB + 1 : referencia.size();
+  }
+  return diferencias;
+}
+
+/**
+ * Funcion que cambia la frecuencia de la adquisicion simulada, como setADCSamplingFreq() en la placa
+ */
+bool cambiarFrecuenciaSimulada(int frecuenciaHz) {
+  static uint32_t intentos = 0;
+  if (intentos++ < FALLOS_TASA_SIM) return false;  // El controlador debe seguir a la tasa anterior y reintentar
+  return planificadorCambiarDivisor(trabajoAdquisicion, planificadorDivisor(frecuenciaHz));
+}
+
+void adquirir() {
+  MuestraADC muestra;
+  {
+    Cronometro c(etapas[0]);
+    muestra.marcaTiempo = halMicros();
+    EscaneoADC1<7, 5, 4>::Muestra escaneo;
+    escaneoADC.leer(escaneo);
+    muestra.x = escaneo.valor[0];
+    muestra.y = escaneo.valor[1];
+    muestra.z = escaneo.valor[2];
+  }
+  {
+    Cronometro c(etapas[1]);
+    etapaCadena(muestra);
+  }
+  {
+    Cronometro c(etapas[2]);
+    etapaFusion();
+  }
+}
+
+/**
+ * Funcion que muestra las opciones del simulador
+ * @param f stdout para --help, stderr con una opcion invalida
+ */
+void mostrarUso(FILE *f, const char *programa) {
+  fprintf(f, "Uso: %s [opciones]\n"
+             "  --segundos S          Tiempo virtual a simular (600)\n"
+             "  --fallas-radio N      Intentos de iniciar el radio que fallan (3)\n"
+             "  --aire-por-byte US    Tiempo en el aire por byte en us (1600, aproximadamente SF7)\n"
+             "  --caida-radio S       Segundos que el radio esta caido desde la quinta parte de la simulacion (60)\n"
+             "  --touch ARCHIVO       Traza de touch grabada: lineas \"tiempo_ms pad1 pad2 pad3\"\n"
+             "  --nmea ARCHIVO        Registro NMEA grabado en lugar de la trayectoria sintetica\n"
+             "  --sin-pps             Disciplina la base de tiempo solo con las frases NMEA\n"
+             "  --flash ARCHIVO       Flash de la bitacora que se conserva entre corridas\n"
+             "  --perfil N            Perfil de actividad: 0 ninguno, 1 con tasa fija, 2 con tasa adaptativa (0)\n"
+             "  --grabar ARCHIVO      Graba la captura de las entradas de la corrida\n"
+             "  --reproducir ARCHIVO  Reproduce una captura grabada\n"
+             "  --referencia ARCHIVO  Compara las salidas con las de esta referencia (la crea si no existe)\n"
+             "  --tiempo-real         Reproduce al ritmo de la placa y no a toda velocidad\n"
+             "  --help                Muestra esta ayuda\n"
+             "Termina con 0 si todas las verificaciones se cumplen, 1 si alguna falla y 2 si las opciones o los archivos no sirven\n",
+          programa);
+}
+
+/**
+ * Funcion que lee el valor numerico de la opcion argv[i]
+ * @param i Avanza al valor
+ * @return false si falta el valor, no es un numero o es negativo
+ */
+bool leerValor(int argc, char **argv, int &i, double &valor) {
+  if (i + 1 >= argc) return false;
+  char *fin;
+  valor = strtod(argv[++i], &fin);
+  return fin != argv[i] && *fin == '\0' && isfinite(valor) && valor >= 0;
+}
+
+/**
+ * Funcion que lee el archivo de la opcion argv[i]
+ * @param i Avanza al archivo
+ * @return false si falta
+ */
+bool leerArchivo(int argc, char **argv, int &i, const char *&archivo) {
+  if (i + 1 >= argc) return false;
+  archivo = argv[++i];
+  return true;
+}
+
+/**
+ * Funcion que avisa que no se pudo usar un archivo de entrada
+ * @return El codigo de salida del simulador para las entradas invalidas
+ */
+int entradaInvalida(const char *accion, const char *archivo) {
+  fprintf(stderr, "No se pudo %s %s\n", accion, archivo);
+  return 2;
+}
+
+#ifndef PIO_UNIT_TESTING  // Las pruebas (pio test -e native) enlazan los fuentes con su propio main
+int main(int argc, char **argv) {
+  double segundos = 600;
+  double fallas = 3;  // El radio no responde los primeros intentos
+  double aire = 1600;
+  double caidaRadio = 60;  // El radio se cae a la quinta parte de la simulacion
+  double perfil = 0;
+  const char *archivoTouch = NULL, *archivoNMEA = NULL, *archivoFlash = NULL, *archivoGrabacion = NULL, *archivoCaptura = NULL,
+             *archivoReferencia = NULL;
+  bool conPPS = true, tiempoReal = false;
+  for (int i = 1; i < argc; i++) {
+    const char *opcion = argv[i];
+    bool valida = true;
+    if (!strcmp(opcion, "--help") || !strcmp(opcion, "-h")) {
+      mostrarUso(stdout, argv[0]);
+      return 0;
+    }
+    if (!strcmp(opcion, "--segundos")) valida = leerValor(argc, argv, i, segundos) && segundos > 0;
+    else if (!strcmp(opcion, "--fallas-radio")) valida = leerValor(argc, argv, i, fallas) && fallas == floor(fallas);
+    else if (!strcmp(opcion, "--aire-por-byte")) valida = leerValor(argc, argv, i, aire) && aire == floor(aire);
+    else if (!strcmp(opcion, "--caida-radio")) valida = leerValor(argc, argv, i, caidaRadio);
+    else if (!strcmp(opcion, "--perfil")) valida = leerValor(argc, argv, i, perfil) && (perfil == 0 || perfil == 1 || perfil == 2);
+    else if (!strcmp(opcion, "--touch")) valida = leerArchivo(argc, argv, i, archivoTouch);
+    else if (!strcmp(opcion, "--nmea")) valida = leerArchivo(argc, argv, i, archivoNMEA);
+    else if (!strcmp(opcion, "--flash")) valida = leerArchivo(argc, argv, i, archivoFlash);
+    else if (!strcmp(opcion, "--grabar")) valida = leerArchivo(argc, argv, i, archivoGrabacion);
+    else if (!strcmp(opcion, "--reproducir")) valida = leerArchivo(argc, argv, i, archivoCaptura);
+    else if (!strcmp(opcion, "--referencia")) valida = leerArchivo(argc, argv, i, archivoReferencia);
+    else if (!strcmp(opcion, "--sin-pps")) conPPS = false;
+    else if (!strcmp(opcion, "--tiempo-real")) tiempoReal = true;
+    else {
+      fprintf(stderr, "Opcion desconocida: %s\n", opcion);
+      mostrarUso(stderr, argv[0]);
+      return 2;
+    }
+    if (!valida) {
+      fprintf(stderr, "Valor invalido o ausente para %s\n", opcion);
+      mostrarUso(stderr, argv[0]);
+      return 2;
+    }
+  }
+  uint32_t fallasRadio = (uint32_t)fallas;
+  uint32_t tiempoAirePorByte = (uint32_t)aire;
+  perfilActividad = (uint8_t)perfil;
+  duracionSimulacionUs = (uint64_t)(segundos * 1e6);
+  // Sin las entradas pedidas la corrida no verifica lo que se queria: se termina antes de simular
+  if (archivoTouch && cargarTrazaTouch(archivoTouch) == 0) return entradaInvalida("leer la traza de touch", archivoTouch);
+  if (archivoNMEA && !cargarRegistroNMEA(archivoNMEA)) return entradaInvalida("leer el registro NMEA", archivoNMEA);
+  if (archivoCaptura && !cargarCaptura(archivoCaptura)) return entradaInvalida("leer la captura", archivoCaptura);
+  if (archivoGrabacion && (capturaSim.grabacion = fopen(archivoGrabacion, "wb")) == NULL) return entradaInvalida("crear la captura", archivoGrabacion);
+  if (!halSimFlash(archivoFlash, TAM_FLASH_SIM)) return entradaInvalida("abrir la flash simulada", archivoFlash ? archivoFlash : "(temporal)");
+  halSimCaidaRadio(duracionSimulacionUs / 5, duracionSimulacionUs / 5 + (uint64_t)(caidaRadio * 1e6));
+  halSimFuenteAdc(senalAdc);
+  halSimFuenteTouch(senalTouch);
+  halSimDispositivoI2c(DIRECCION_L3GD20_SA0_ALTO, escribirL3GSimulado, leerL3GSimulado);
+  halSimSalida(salidaTelemetria);
+  decodificador.alRecibirTexto = recibirDiagnostico;
+  halSimTiempoAire(12000, tiempoAirePorByte);  // 1600us por byte es aproximadamente SF7, 125kHz, CR 4/5
+  halSimRadioReceptor(recibirLoRa);
+  halSimFallasRadio(fallasRadio);
+  iniciarTransmisorLoRa(4, 5, 13, 433E6, 0, 1);
+  iniciarBitacora(0, 1);
+  escaneoADC.configurar();
+  sensSimulado.vrefEfuse = VREF_EFUSE_SIM;
+  bool calibrado = true;
+  for (uint8_t c = 0; c < 3; c++) calibrado &= construirTablaCalibracion(calibracionADC[c], CAL_ATENUACION_11DB);
+  iniciarProcesamiento(true, calibrado ? calibracionADC : NULL);
+  alRegistroFusionado(verificarRegistro);
+  trabajoAdquisicion = planificadorAgregar("ADC Handler", adquirir, planificadorDivisor(SAMPLING_FREQ), 1, 0);
+  if (perfilActividad == 2) iniciarTasaAdaptativa(cambiarFrecuenciaSimulada);
+  if (!iniciarGiroscopio(GIRO_L3GD20H, ODR_GIROSCOPIO, 1, 1)) printf("No se pudo iniciar el giroscopio\n");
+  if (!iniciarPlanificador(3)) printf("No se pudo iniciar el planificador\n");
+  iniciarBaseTiempo(conPPS ? PIN_PPS_SIM : -1);
+  if (!iniciarGPS(1, 1)) printf("No se pudo iniciar el GPS\n");
+  if (conPPS && !gpsSim.registro) halTareaPeriodica(1, SEGUNDO_UTC_US, pulsoPPSSimulado, "PPS", 255, 0);
+  halTareaPeriodica(2, PERIODO_UART_GPS_US, transmitirGPSSimulado, "UART GPS", 255, 0);
+  halTareaPeriodica(2, 250000, verificarGPSSimulado, "Lector GPS", 0, 0);
+  if (!iniciarTouch(TOUCHPADS_SIM, 3, alReconocerGesto, 2, 1, 1)) printf("No se pudieron iniciar los touchpads\n");
+  if (capturaSim.grabacion && !iniciarCaptura(0, 0)) printf("No se pudo iniciar la captura\n");
+  if (tiempoReal) halTareaPeriodica(2, 10000, ritmoTiempoReal, "Tiempo real", 0, 0);
+
+  std::chrono::steady_clock::time_point inicio = std::chrono::steady_clock::now();
+  halSimCorrer((uint64_t)(segundos * 1e6));
+  double real = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+
+  uint64_t muestras = etapas[0].llamadas;
+  EstadisticasRadioSim radio = halSimEstadisticasRadio();
+  printf("Tiempo simulado: %.1f s en %.3f s reales (%.0f veces el tiempo real)\n", segundos, real, segundos / real);
+  printf("Muestras procesadas: %llu (%.0f muestras/s)\n", (unsigned long long)muestras, muestras / real);
+  printf("%-12s %12s %12s\n", "Etapa", "Media (ns)", "Maximo (ns)");
+  for (size_t i = 0; i < sizeof(etapas) / sizeof(etapas[0]); i++)
+    printf("%-12s %12.1f %12.1f\n", etapas[i].nombre, etapas[i].llamadas ? etapas[i].totalNs / etapas[i].llamadas : 0.0, etapas[i].maximoNs);
+  printf("Telemetria: %llu bytes (%.0f B/s), %u tramas validas (%u en milivoltios), %u mensajes de diagnostico (%u de gestos), %u errores\n",
+         (unsigned long long)bytesTelemetria, bytesTelemetria / segundos, decodificador.tramasValidas, tramasMilivoltios,
+         decodificador.tramasTexto, mensajesGestos, decodificador.erroresCrc + decodificador.erroresFormato);
+  printf("Radio: %u paquetes, %llu bytes, %.1f%% del tiempo en el aire, %u envios con el radio ocupado\n", radio.paquetes,
+         (unsigned long long)radio.bytes, 100.0 * radio.tiempoAireUs / (segundos * 1e6), radio.rechazados);
+  const EmpaquetadorMuestras &empaquetador = empaquetadorLoRa();
+  printf("LoRa: %u muestras/paquete en promedio, compresion %.2f:1, %.1f ms en el aire por paquete (SF%d), %.0f muestras por segundo de aire\n",
+         empaquetador.paquetes ? empaquetador.muestras / empaquetador.paquetes : 0, empaquetador.razonCompresion(),
+         receptor.paquetes ? receptor.tiempoAireUs / 1e3 / receptor.paquetes : 0.0, LORA_SF,
+         receptor.tiempoAireUs ? receptor.muestras * 1e6 / receptor.tiempoAireUs : 0.0);
+  printf("Receptor LoRa: %u paquetes (%u en milivoltios, %u sin filtrar), %llu muestras, %u invalidos, %u discontinuidades\n", receptor.paquetes,
+         receptor.milivoltios, receptor.sinFiltrar, (unsigned long long)receptor.muestras, receptor.invalidos, receptor.saltos);
+  const ReceptorLatidos &rl = receptorLatidos;
+  printf("Latidos: %u recibidos (%u esperados) en %u paquetes, %u anomalos, %u invalidos, %u discontinuidades, FC %.1f lpm,"
+         " SDNN %u ms, RMSSD %u ms, error del pico R medio %.1f ms maximo %.1f ms, %.1f B/s y %.1f%% del tiempo en el aire\n",
+         rl.latidos, (unsigned)((segundos - FASE_R_SIM) / PERIODO_LATIDO_SIM) + 1, rl.paquetes, rl.anomalos, rl.invalidos, rl.saltos,
+         rl.ultimo.frecuenciaDeci / 10.0, rl.ultimo.sdnnMs, rl.ultimo.rmssdMs, rl.latidos ? rl.errorTotalUs / rl.latidos / 1e3 : 0.0,
+         rl.errorMaximoUs / 1e3, rl.bytes / segundos, 100.0 * rl.tiempoAireUs / (segundos * 1e6));
+  const ReceptorEspectro &re = receptorEspectro;
+  double r = re.registros ? re.registros : 1;
+  // La red en milivoltios si la cadena esta calibrada: media diferencia de la tabla alrededor de la mitad de la escala
+  double red = calibrado ? (calibracionADC[0].convertir(2048 + AMPLITUD_RED_SIM) - calibracionADC[0].convertir(2048 - AMPLITUD_RED_SIM)) / 2.0
+                         : AMPLITUD_RED_SIM;
+  printf("Espectro: %u registros en %u paquetes, %u invalidos, %u discontinuidades, %.1f B/s; media delta %.1f theta %.1f alfa %.1f beta %.1f"
+         " gamma %.1f dB, red %u Hz %.1f dB (esperado %.1f) y %u Hz %.1f dB\n", re.registros, re.paquetes, re.invalidos, re.saltos,
+         re.bytes / segundos, re.suma[0] / r, re.suma[1] / r, re.suma[2] / r, re.suma[3] / r, re.suma[4] / r, FRECUENCIA_RED,
+         re.suma[5] / r, 10 * log10(red * red / 2), 2 * FRECUENCIA_RED, re.suma[6] / r);
+  if (perfilActividad) {
+    // Para comparar la carga con y sin la tasa adaptativa se corre el mismo perfil con 1 y con 2
+    const ControladorTasa &tasa = controladorTasaAdaptativa();
+    double cpuNs = 0;
+    for (size_t i = 0; i < sizeof(etapas) / sizeof(etapas[0]); i++) cpuNs += etapas[i].totalNs;
+    printf("Tasa: perfil %s, %.1f%% del tiempo en reposo, %u cambios (%u por el giroscopio, %u por el ADC, %u rechazados), %u marcas recibidas"
+           " (%u invalidas, %u discontinuidades, %u fuera del perfil), %u tramas de telemetria en reposo; carga: %llu muestras,"
+           " %.1f ms de CPU, %llu bytes de telemetria, %llu bytes por LoRa\n", perfilActividad == 2 ? "con tasa adaptativa" : "con tasa fija",
+           100.0 * tasa.tiempoReposoUs(duracionSimulacionUs) / duracionSimulacionUs, tasa.cambios, tasa.disparosGiroscopio,
+           tasa.disparosAdc, tasa.fallos, receptorTasa.cambios, receptorTasa.invalidos, receptorTasa.saltos, receptorTasa.incoherentes, tramasReposo,
+           (unsigned long long)muestras, cpuNs / 1e6, (unsigned long long)bytesTelemetria, (unsigned long long)radio.bytes);
+  }
+  EstadisticasTransmisor tx = estadisticasTransmisorLoRa();
+  printf("Transmisor LoRa: %u encolados, %u enviados (%u desde la bitacora), %u terminados, %u descartados (cola llena), maximo %u en cola, %u fallos al iniciar, %u reinicios\n",
+         tx.encolados, tx.enviados, tx.reenviados, tx.terminados, tx.descartados, tx.maximoEnCola, tx.fallosInicio, tx.reinicios);
+  EstadisticasBitacora bitacora = estadisticasBitacora();
+  printf("Bitacora: %u registros guardados en %u lotes, %u reenviados, %u perdidos (flash llena), %u descartados (cola), %u errores de CRC,"
+         " %u errores de flash, %u sectores borrados (%u por adelantado), %u sectores pendientes al arrancar%s\n", bitacora.guardados,
+         bitacora.lotes, bitacora.reproducidos, bitacora.perdidosLlena, bitacora.descartadosCola, bitacora.erroresCrc, bitacora.erroresFlash,
+         bitacora.sectoresBorrados, bitacora.sectoresPreborrados, bitacora.sectoresPendientesArranque,
+         bitacora.pendiente ? ", con respaldo pendiente" : "");
+  EstadisticasFlashSim flash = halSimEstadisticasFlash();
+  printf("Flash: %u escrituras, %llu bytes, %u sectores borrados, %u escrituras que intentaron subir bits\n", flash.escrituras,
+         (unsigned long long)flash.bytesEscritos, flash.borrados, flash.bitsInvalidos);
+  EstadisticasTouch touch = estadisticasTouch();
+  printf("Touch: %u pulsaciones, %u despertares de la tarea, %u interrupciones, %u recalibraciones, lineas base %u/%u/%u\n",
+         touch.pulsaciones, touch.despertares, touch.interrupciones, touch.recalibraciones, touchLineaBase(0), touchLineaBase(1), touchLineaBase(2));
+  printf("Gestos: %u toques, %u dobles toques, %u pulsaciones largas, %u acordes (~%llu de cada uno esperados sin traza), %u eventos perdidos, latencia maxima %u us\n",
+         gestosDetectados[GESTO_TOQUE], gestosDetectados[GESTO_DOBLE_TOQUE], gestosDetectados[GESTO_PULSACION_LARGA], gestosDetectados[GESTO_ACORDE],
+         (unsigned long long)(duracionSimulacionUs / (CICLO_GESTOS_MS * 1000ULL)), touch.eventosPerdidos, touch.latenciaMaximaUs);
+  EstadisticasGiroscopio giro = estadisticasGiroscopio();
+  printf("Giroscopio: %u muestras generadas, %u leidas, %u perdidas, %u lecturas I2C, %u desbordes, %u resincronizaciones, periodo estimado %u us\n",
+         l3g.generadas, giro.muestras, giro.perdidas, giro.lecturas, giro.desbordes, giro.resincronizaciones, giro.periodoUs);
+  EstadisticasGPS gps = estadisticasGPS();
+  printf("GPS: %u bytes, %u frases interpretadas, %u errores de checksum (%u frases dañadas), %u descartadas, %u desbordes del UART, %u registros publicados\n",
+         gps.bytes, gps.frases, gps.erroresChecksum, gpsSim.frasesCorruptas, gps.descartadas, gps.desbordesRx, gps.publicaciones);
+  if (gpsSintetico()) printf("GPS: %u registros leidos comparados con la trayectoria, %u diferencias\n", gpsSim.verificados, gpsSim.diferencias);
+  EstadisticasFusion fusion = estadisticasFusion();
+  printf("Fusion: %u registros (%u con el giroscopio interpolado, %u sostenido), %u desordenados, %u muestras del giroscopio descartadas\n",
+         fusion.registros, fusion.interpolados, fusion.sostenidos, verificacion.desordenados, fusion.descartadasGiroscopio);
+  printf("Fusion: error de alineacion del giroscopio: medio %.0f us, maximo %.0f us (%llu registros medidos)\n",
+         verificacion.giroMedidos ? verificacion.errorGiroTotalUs / verificacion.giroMedidos : 0.0, verificacion.errorGiroMaximoUs,
+         (unsigned long long)verificacion.giroMedidos);
+  if (gpsSintetico()) printf("Fusion: %u registros con un fix del GPS incoherente, edad maxima del fix %u ms\n", verificacion.gpsIncoherentes,
+                               verificacion.edadGpsMaximaMs);
+  EstadoBaseTiempo base = estadoBaseTiempo();
+  printf("Base de tiempo: %s, deriva estimada %d ppb (real %d), %u correcciones, %u reinicios, %u flancos PPS\n",
+         base.sincronizada ? (base.conPPS ? "disciplinada con PPS" : "disciplinada con NMEA") : "sin sincronizar", base.derivaPpb,
+         (int)((SEGUNDO_UTC_US - 1000000) * 1000), base.correcciones, base.reinicios, base.pulsosPPS);
+  if (gpsSintetico()) printf("Base de tiempo: error de la hora UTC de las muestras: medio %.0f us, maximo %.0f us\n",
+                               verificacion.utcMedidos ? verificacion.errorUtcTotalUs / verificacion.utcMedidos : 0.0, verificacion.errorUtcMaximoUs);
+  printf("Muestras perdidas en los buffers: %u\n", muestrasPerdidasProcesamiento());
+  if (capturaSim.grabacion) {
+    fclose(capturaSim.grabacion);
+    EstadisticasCaptura captura = estadisticasCaptura();
+    printf("Captura: %u registros del ADC, %u del touch, %u del giroscopio y %u del NMEA en %u bloques, %llu bytes (%.0f B/s), %u perdidos\n",
+           captura.registros[CAPTURA_ADC], captura.registros[CAPTURA_TOUCH], captura.registros[CAPTURA_GIROSCOPIO], captura.registros[CAPTURA_NMEA],
+           captura.bloques, (unsigned long long)captura.bytes, captura.bytes / segundos, captura.perdidos);
+  }
+  if (capturaSim.reproduciendo) {
+    const DecodificadorCaptura &d = *capturaSim.decodificador;
+    printf("Reproduccion: %zu registros del ADC, %zu del touch, %zu del giroscopio y %zu del NMEA (%llu bytes) de %u bloques (%u errores,"
+           " %u perdidos), %zu muestras del giroscopio entregadas, %s, %.0f muestras/s\n", capturaSim.registros[CAPTURA_ADC].size(),
+           capturaSim.registros[CAPTURA_TOUCH].size(), capturaSim.registros[CAPTURA_GIROSCOPIO].size(), capturaSim.registros[CAPTURA_NMEA].size(),
+           (unsigned long long)capturaSim.bytesNMEA, d.bloques, d.errores, d.bloquesPerdidos, capturaSim.posicion[CAPTURA_GIROSCOPIO],
+           tiempoReal ? "a tiempo real" : "a toda velocidad", muestras / real);
+  }
+  if (archivoReferencia) {
+    std::string primera;
+    long diferencias = compararSalidas(archivoReferencia, primera);
+    if (diferencias < 0) printf("Referencia: no se pudo leer ni crear %s\n", archivoReferencia);
+    else printf("Referencia: %zu bytes de salidas (paquetes LoRa, telemetria por segundo y gestos), %ld lineas distintas%s%s\n",
+                capturaSim.salidas.size(), diferencias, diferencias ? ", la primera: " : "", primera.c_str());
+    exigir(diferencias == 0, "las salidas son las de la referencia");
+  }
+  printf("Planificador (%u ticks/s):\n%-12s %8s %6s %10s %8s %10s %12s\n", PLAN_FRECUENCIA_BASE, "Trabajo", "Divisor", "Fase",
+         "Frecuencia", "Sobrec.", "Ejecuc.", "Retraso max");
+  for (size_t i = 0; i < trabajosPlanificador(); i++) {
+    EstadisticasTrabajo trabajo;
+    estadisticasTrabajo((int)i, trabajo);
+    printf("%-12s %8u %6u %8.2fHz %8u %10u %9u us\n", trabajo.nombre, trabajo.divisor, trabajo.fase,
+           trabajo.ejecuciones / segundos, trabajo.sobrecargas, trabajo.ejecuciones, trabajo.retrasoMaximoUs);
+  }
+  static char reporte[4096];
+  reporteInstrumentacion(reporte, sizeof(reporte));
+  printf("Tareas (latencia en tiempo virtual, duracion en tiempo real):\n%s", reporte);
+  verificarCalibracion();
+  verificarSobremuestreo();
+  medirCadena();
+  verificarQRS();
+  verificarEspectro();
+  verificarReserva();
+  if (archivoFlash == NULL) medirEscrituraBitacora();
+
+  // Lo que debe cumplirse en cualquier corrida; sin perdidas en la cola ni en la flash (y sin lo que
+  // quedo de una corrida anterior) los paquetes de muestras tampoco pueden tener discontinuidades
+  exigir(decodificador.erroresCrc + decodificador.erroresFormato == 0, "la telemetria llega sin errores");
+  exigir(receptor.invalidos == 0 && rl.invalidos == 0 && re.invalidos == 0, "los paquetes LoRa pasan la verificacion");
+  if (perfilActividad == 0 && archivoFlash == NULL && tx.descartados == 0 && bitacora.perdidosLlena == 0 && bitacora.descartadosCola == 0)
+    exigir(receptor.saltos == 0, "los paquetes de muestras llegan sin discontinuidades");
+  if (perfilActividad == 2) exigir(receptorTasa.invalidos == 0 && receptorTasa.incoherentes == 0, "los cambios de tasa siguen al perfil");
+  exigir(flash.bitsInvalidos == 0, "la bitacora no escribe sobre la flash sin borrar");
+  exigir(verificacion.desordenados == 0, "los registros fusionados llegan en orden");
+  if (gpsSintetico()) exigir(gpsSim.diferencias == 0 && verificacion.gpsIncoherentes == 0, "el GPS sigue a la trayectoria");
+  printf("Verificacion: %u fallas\n", fallasVerificacion);
+  return fallasVerificacion ? 1 : 0;
+}
+#endif
@@ -0,0 +1,84 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#ifndef EKG_REFERENCIA_H
+#define EKG_REFERENCIA_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+// Segmento de EKG de referencia que usa test_qrs: 60 s a 256 Hz ya filtrado y centrado en cero
+// (la entrada de DetectorQRS), una muestra por linea. Las lineas de un pico R anotado llevan despues
+// del valor su clase: N (normal) o V (extrasistole ventricular). Son 69 latidos, a ~72 lpm con
+// arritmia respiratoria, sintetizados con ondas P, Q, R, S y T gaussianas, ruido gaussiano de 8 cuentas,
+// deriva de la linea base y 60 Hz residuales. Contiene dos extrasistoles ventriculares anchas (a los
+// ~16 y ~48 s, con pausa compensatoria), ondas T de 80% del R entre 20 y 30 s, la amplitud a la
+// mitad entre 36 y 46 s, y ruido muscular de 60 cuentas entre 50 y 53 s.
+
+#define EKG_REFERENCIA_FS 256
+#define EKG_REFERENCIA_MAX (60 * EKG_REFERENCIA_FS)
+#define EKG_REFERENCIA_MAX_PICOS 128
+
+/**
+ * Segmento de referencia con sus anotaciones
+ */
+struct EkgReferencia {
+  int16_t muestras[EKG_REFERENCIA_MAX];
+  size_t numMuestras;
+  uint32_t picos[EKG_REFERENCIA_MAX_PICOS];  // Muestra de cada pico R anotado
+  char clases[EKG_REFERENCIA_MAX_PICOS];     // 'N' o 'V'
+  size_t numPicos;
+};
+
+/**
+ * Funcion que lee ekg_referencia.txt, que esta junto a este archivo
+ * @param ekg Donde se escriben las muestras y las anotaciones
+ * @return Numero de muestras, 0 si no se pudo leer
+ */
+static size_t leerEkgReferencia(EkgReferencia &ekg) {
+  char ruta[512];
+  snprintf(ruta, sizeof(ruta), "%s", __FILE__);
+  char *barra = strrchr(ruta, '/');
+  snprintf(barra ? barra + 1 : ruta, sizeof(ruta) - (barra ? barra + 1 - ruta : 0), "ekg_referencia.txt");
+  ekg.numMuestras = ekg.numPicos = 0;
+  FILE *f = fopen(ruta, "r");
+  if (!f) return 0;
+  char linea[32];
+  while (ekg.numMuestras < EKG_REFERENCIA_MAX && fgets(linea, sizeof(linea), f)) {
+    int valor;
+    char clase;
+    int campos = sscanf(linea, "%d %c", &valor, &clase);
+    if (campos < 1) continue;
+    if (campos == 2 && ekg.numPicos < EKG_REFERENCIA_MAX_PICOS) {
+      ekg.picos[ekg.numPicos] = (uint32_t)ekg.numMuestras;
+      ekg.clases[ekg.numPicos++] = clase;
+    }
+    ekg.muestras[ekg.numMuestras++] = (int16_t)valor;
+  }
+  fclose(f);
+  return ekg.numMuestras;
+}
+
+#endif
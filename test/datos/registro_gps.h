@@ -0,0 +1,60 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#ifndef REGISTRO_GPS_H
+#define REGISTRO_GPS_H
+
+#include <stdio.h>
+#include <string.h>
+
+// Registro NMEA que usa test_gps, en el formato de --nmea del simulador (los bytes tal como salen del
+// UART del GPS). En orden: un RMC y un GGA validos (48°07.038' N, 11°31.000' E, 545.4 m, 8 satelites),
+// un GSV (tipo que no se interpreta), un RMC con el checksum alterado, un GGA truncado por el '$' de
+// la frase siguiente, un GNRMC al sur y al oeste (23:59:59.50 del 01/01/2020), un RMC de 107
+// caracteres, un RMC sin checksum, un GGA sin fix, un GNGGA con altitud negativa y el checksum en
+// minusculas, y un RMC sin fix. Son 6 frases interpretadas, 1 error de checksum y 4 descartadas.
+
+#define REGISTRO_GPS_MAX 2048
+#define REGISTRO_GPS_FRASES 6
+#define REGISTRO_GPS_ERRORES_CHECKSUM 1
+#define REGISTRO_GPS_DESCARTADAS 4
+
+/**
+ * Funcion que lee registro_gps.nmea, que esta junto a este archivo
+ * @param datos Donde se escriben los bytes (REGISTRO_GPS_MAX)
+ * @return Numero de bytes, 0 si no se pudo leer
+ */
+static size_t leerRegistroGPS(char *datos) {
+  char ruta[512];
+  snprintf(ruta, sizeof(ruta), "%s", __FILE__);
+  char *barra = strrchr(ruta, '/');
+  snprintf(barra ? barra + 1 : ruta, sizeof(ruta) - (barra ? barra + 1 - ruta : 0), "registro_gps.nmea");
+  FILE *f = fopen(ruta, "rb");
+  if (!f) return 0;
+  size_t n = fread(datos, 1, REGISTRO_GPS_MAX, f);
+  fclose(f);
+  return n;
+}
+
+#endif
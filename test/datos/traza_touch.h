@@ -0,0 +1,68 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef TRAZA_TOUCH_H
+#define TRAZA_TOUCH_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+// Traza de los touchpads que usan test_touch y test_gestos, en el formato de --touch del simulador:
+// una linea "tiempo_ms pad1 pad2 pad3" cada 10 ms (el periodo activo del motor) durante 12 s.
+// Lineas base de 1500 (baja 0.01 por ms), 1620 (sube 0.004 por ms) y 1380, con ruido de +-4 cuentas.
+// Guion (pads numerados desde 0, como en la tabla de iniciarTouch()): caidas de dos lecturas en el
+// pad 1 (1000 ms) y de una en el 2 (3000 ms), un toque en el pad 0 (2000 ms, con un rebote en la
+// segunda lectura), un doble toque en el pad 1 (4000 y 4300 ms, con un rebote), una pulsacion larga
+// en el pad 2 (6000 a 7500 ms) y un acorde de los pads 0 y 1 (9000 y 9050 ms a 9400 ms). Las
+// pulsaciones bajan la lectura al 60% de la linea base.
+
+#define TRAZA_TOUCH_MAX 2000
+#define TRAZA_TOUCH_PADS 3
+
+struct LecturaTraza {
+  uint32_t tiempoMs;
+  uint16_t valor[TRAZA_TOUCH_PADS];
+};
+
+/**
+ * Funcion que lee traza_touch.txt, que esta junto a este archivo
+ * @param traza Donde se escriben las lecturas (TRAZA_TOUCH_MAX)
+ * @return Numero de lecturas, 0 si no se pudo leer
+ */
+static size_t leerTrazaTouch(LecturaTraza *traza) {
+  char ruta[512];
+  snprintf(ruta, sizeof(ruta), "%s", __FILE__);
+  char *barra = strrchr(ruta, '/');
+  snprintf(barra ? barra + 1 : ruta, sizeof(ruta) - (barra ? barra + 1 - ruta : 0), "traza_touch.txt");
+  FILE *f = fopen(ruta, "r");
+  if (!f) return 0;
+  size_t n = 0;
+  unsigned t, a, b, c;
+  while (n < TRAZA_TOUCH_MAX && fscanf(f, "%u %u %u %u", &t, &a, &b, &c) == 4)
+    traza[n++] = LecturaTraza{t, {(uint16_t)a, (uint16_t)b, (uint16_t)c}};
+  fclose(f);
+  return n;
+}
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <string.h>
+#include "libhal.h"
+#include "libbitacora.h"
+
+// Pruebas de la bitacora de respaldo sobre la flash simulada: orden de los registros, escrituras
+// que fallan sin programar nada o a medias, y borrado por adelantado (pio test -e native -f test_bitacora)
+
+#define SECTORES_PRUEBA 8
+#define LARGO_PAQUETE 200  // Unos 19 registros por sector
+
+static uint32_t siguienteGuardado = 0;  // Numero del siguiente paquete a guardar
+static uint32_t siguienteLeido = 0;     // Numero del siguiente paquete que debe salir
+
+void setUp(void) {
+  static bool iniciada = false;  // La bitacora y su tarea se crean una sola vez para todas las pruebas
+  if (iniciada) return;
+  halSimFlash(NULL, SECTORES_PRUEBA * HAL_FLASH_TAM_SECTOR);
+  iniciada = iniciarBitacora(0, 0);
+}
+
+void tearDown(void) {}
+
+/**
+ * Funcion que guarda paquetes numerados (el numero en los primeros 4 bytes y repetido en el resto)
+ */
+static void guardar(uint32_t cantidad) {
+  uint8_t paquete[LARGO_PAQUETE];
+  for (uint32_t i = 0; i < cantidad; i++, siguienteGuardado++) {
+    for (size_t k = 0; k < sizeof(paquete); k++) paquete[k] = (uint8_t)(siguienteGuardado + k);
+    memcpy(paquete, &siguienteGuardado, 4);
+    TEST_ASSERT_TRUE(guardarEnBitacora(paquete, sizeof(paquete)));
+    if (i % (BITACORA_NUM_ENTRADA / 2) == BITACORA_NUM_ENTRADA / 2 - 1) halSimCorrer(0);  // La tarea ya fue notificada
+  }
+  halSimCorrer(BITACORA_ESPERA_US);  // Lo que quede en la cola se escribe al agotarse la espera de la tarea
+}
+
+/**
+ * Funcion que hace de transmisor: toma los registros de la bitacora y verifica que salgan todos, en orden
+ */
+static void reenviarTodo() {
+  for (int vueltas = 0; bitacoraPendiente() && vueltas < 10000; vueltas++) {
+    const uint8_t *datos;
+    size_t len;
+    if (siguienteRegistroBitacora(datos, len)) {
+      uint32_t numero;
+      TEST_ASSERT_EQUAL_size_t(LARGO_PAQUETE, len);
+      memcpy(&numero, datos, 4);
+      TEST_ASSERT_EQUAL_UINT32(siguienteLeido, numero);
+      TEST_ASSERT_EQUAL_UINT8((uint8_t)(numero + LARGO_PAQUETE - 1), datos[LARGO_PAQUETE - 1]);
+      siguienteLeido++;
+      registroBitacoraEnviado();
+    }
+    halSimCorrer(1000);
+  }
+  TEST_ASSERT_FALSE(bitacoraPendiente());
+  TEST_ASSERT_EQUAL_UINT32(siguienteGuardado, siguienteLeido);
+}
+
+/**
+ * Los paquetes se guardan en lotes a traves de varios sectores y se reenvian en orden
+ */
+void test_guardar_y_reenviar(void) {
+  guardar(60);
+  EstadisticasBitacora e = estadisticasBitacora();
+  TEST_ASSERT_EQUAL_UINT32(60, e.guardados);
+  TEST_ASSERT_TRUE(bitacoraPendiente());
+  reenviarTodo();
+  e = estadisticasBitacora();
+  TEST_ASSERT_EQUAL_UINT32(60, e.reproducidos);
+  TEST_ASSERT_EQUAL_UINT32(0, e.erroresCrc + e.erroresFlash + e.descartadosCola + e.perdidosLlena);
+  TEST_ASSERT_EQUAL_UINT32(0, halSimEstadisticasFlash().bitsInvalidos);
+}
+
+/**
+ * Despues de escribir un lote el sector siguiente ya queda borrado: al abrirlo no se borra otra vez
+ */
+void test_borrado_por_adelantado(void) {
+  EstadisticasBitacora antes = estadisticasBitacora();
+  guardar(3 * HAL_FLASH_TAM_SECTOR / LARGO_PAQUETE);  // Cruza al menos dos sectores
+  EstadisticasBitacora e = estadisticasBitacora();
+  TEST_ASSERT_GREATER_THAN(antes.sectoresPreborrados + 1, e.sectoresPreborrados);
+  // Cada sector abierto se borro por adelantado y el siguiente al de escritura ya esta listo
+  TEST_ASSERT_EQUAL_UINT32(e.sectoresPreborrados - antes.sectoresPreborrados, e.sectoresBorrados - antes.sectoresBorrados);
+  reenviarTodo();
+  TEST_ASSERT_EQUAL_UINT32(0, halSimEstadisticasFlash().bitsInvalidos);
+}
+
+/**
+ * Una escritura que falla sin programar nada deja el lote en la cola y se reintenta en el mismo
+ * lugar: no se pierde nada ni queda un hueco que corte la lectura del sector
+ */
+void test_falla_sin_programar(void) {
+  EstadisticasBitacora antes = estadisticasBitacora();
+  halSimFallasFlash(1, false);
+  guardar(3);
+  EstadisticasBitacora e = estadisticasBitacora();
+  TEST_ASSERT_EQUAL_UINT32(antes.erroresFlash + 1, e.erroresFlash);
+  TEST_ASSERT_EQUAL_UINT32(antes.guardados, e.guardados);  // Sigue en la cola hasta el siguiente despertar
+  TEST_ASSERT_TRUE(bitacoraPendiente());
+  guardar(2);
+  e = estadisticasBitacora();
+  TEST_ASSERT_EQUAL_UINT32(antes.guardados + 5, e.guardados);
+  reenviarTodo();
+  e = estadisticasBitacora();
+  TEST_ASSERT_EQUAL_UINT32(antes.erroresCrc, e.erroresCrc);
+  TEST_ASSERT_EQUAL_UINT32(0, halSimEstadisticasFlash().bitsInvalidos);
+}
+
+/**
+ * Una escritura que falla a medias cierra el sector: el registro que quedo completo no se repite,
+ * el resto del lote va al sector siguiente y la lectura solo salta el registro dañado
+ */
+void test_falla_parcial(void) {
+  EstadisticasBitacora antes = estadisticasBitacora();
+  halSimFallasFlash(1, true);
+  guardar(3);  // Un lote de 3 registros: la mitad programada corta el segundo
+  EstadisticasBitacora e = estadisticasBitacora();
+  TEST_ASSERT_EQUAL_UINT32(antes.erroresFlash + 1, e.erroresFlash);
+  TEST_ASSERT_EQUAL_UINT32(antes.guardados + 3, e.guardados);
+  TEST_ASSERT_EQUAL_UINT32(antes.lotes + 1, e.lotes);  // Solo el de los 2 que faltaban
+  reenviarTodo();
+  e = estadisticasBitacora();
+  TEST_ASSERT_EQUAL_UINT32(antes.erroresCrc + 1, e.erroresCrc);
+  TEST_ASSERT_EQUAL_UINT32(0, e.perdidosLlena + e.descartadosCola);
+  TEST_ASSERT_EQUAL_UINT32(0, halSimEstadisticasFlash().bitsInvalidos);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_guardar_y_reenviar);
+  RUN_TEST(test_borrado_por_adelantado);
+  RUN_TEST(test_falla_sin_programar);
+  RUN_TEST(test_falla_parcial);
+  return UNITY_END();
+}
@@ -0,0 +1,148 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <math.h>
+#include "libcalibracion.h"
+#include "libhalsens.h"
+
+// Pruebas de las tablas de calibracion del ADC1 contra la formula de esp_adc_cal en double, con
+// el eFuse simulado de libhalsens.h (pio test -e native -f test_calibracion)
+
+// Constantes de la hoja de datos (esp_adc_cal_esp32.c): recta por atenuacion y curvas de 11 dB
+const double ESCALA_REFERENCIA[4] = {57431, 76236, 105481, 196602};
+const double DESPLAZAMIENTO_REFERENCIA[4] = {75, 78, 88, 142};
+const double CURVA_11DB_BAJA[20] = {2240, 2297, 2352, 2405, 2457, 2512, 2564, 2616, 2664, 2709,
+                                    2754, 2795, 2832, 2868, 2903, 2937, 2969, 3000, 3030, 3060};
+const double CURVA_11DB_ALTA[20] = {2667, 2706, 2745, 2780, 2813, 2844, 2873, 2901, 2928, 2956,
+                                    2982, 3006, 3032, 3059, 3084, 3110, 3135, 3160, 3184, 3209};
+
+static TablaCalibracion tabla;
+
+void setUp(void) { sensSimulado = {}; }
+void tearDown(void) {}
+
+/**
+ * Funcion de referencia de esp_adc_cal (ADC1, caracterizacion por Vref) en punto flotante: la recta
+ * de la atenuacion y, en 11 dB, la interpolacion bilineal de las curvas y la transicion entre ambas
+ */
+static double milivoltiosReferencia(uint32_t crudo, double vref, uint8_t atenuacion) {
+  double lineal = vref * ESCALA_REFERENCIA[atenuacion] / 4096.0 * crudo / 65536.0 + DESPLAZAMIENTO_REFERENCIA[atenuacion];
+  if (atenuacion != CAL_ATENUACION_11DB || crudo < 2880) return lineal;
+  uint32_t i = (crudo - 2880) / 64;
+  double fraccionCrudo = (crudo - 2880 - 64.0 * i) / 64.0;
+  double fraccionVref = (vref - 1000.0) / 200.0;
+  double baja = CURVA_11DB_BAJA[i] + (CURVA_11DB_BAJA[i + 1] - CURVA_11DB_BAJA[i]) * fraccionCrudo;
+  double alta = CURVA_11DB_ALTA[i] + (CURVA_11DB_ALTA[i + 1] - CURVA_11DB_ALTA[i]) * fraccionCrudo;
+  double curva = baja + (alta - baja) * fraccionVref;
+  if (crudo > 2944) return curva;
+  return lineal + (curva - lineal) * (crudo - 2880) / 64.0;
+}
+
+/**
+ * Funcion que construye la tabla de una atenuacion con un Vref grabado en el eFuse simulado
+ */
+static void construirCon(uint32_t vref, uint8_t atenuacion) {
+  sensSimulado.vrefEfuse = vref;
+  TEST_ASSERT_TRUE(construirTablaCalibracion(tabla, atenuacion));
+  TEST_ASSERT_EQUAL_UINT8(atenuacion, tabla.atenuacion);
+  TEST_ASSERT_EQUAL_UINT8(CAL_FUENTE_EFUSE_VREF, tabla.fuente);
+}
+
+/**
+ * Las tablas nunca bajan de un dato al siguiente, en todas las atenuaciones y en todo el rango de Vref
+ * (con Vref como 1031 o 1037 mV la conversion de esp_adc_cal baja 1 mV en la transicion de 11 dB)
+ */
+void test_monotona(void) {
+  for (uint32_t vref = 1000; vref <= 1200; vref++)  // Todo el rango de Vref de los chips
+    for (uint8_t atenuacion = 0; atenuacion < 4; atenuacion++) {
+      construirCon(vref, atenuacion);
+      for (uint32_t crudo = 1; crudo < CAL_TAM_TABLA; crudo++)
+        if (tabla.convertir(crudo) < tabla.convertir(crudo - 1))
+          TEST_FAIL_MESSAGE("La tabla baja de un dato al siguiente");
+    }
+}
+
+/**
+ * Cada entrada difiere de la formula en double a lo sumo 1 mV (el redondeo entero de esp_adc_cal)
+ */
+void test_error_contra_referencia(void) {
+  for (uint32_t vref = 1000; vref <= 1200; vref++)  // Todo el rango de Vref de los chips
+    for (uint8_t atenuacion = 0; atenuacion < 4; atenuacion++) {
+      construirCon(vref, atenuacion);
+      for (uint32_t crudo = 0; crudo < CAL_TAM_TABLA; crudo++)
+        TEST_ASSERT_DOUBLE_WITHIN(1.0, milivoltiosReferencia(crudo, vref, atenuacion), tabla.convertir(crudo));
+    }
+}
+
+/**
+ * Los extremos de 11 dB con el Vref del chip simulado, y la transicion de la recta a las curvas
+ * (2880 a 2944) sin escalones de mas de 1 mV entre datos vecinos
+ */
+void test_extremos_y_transicion(void) {
+  construirCon(1114, CAL_ATENUACION_11DB);
+  TEST_ASSERT_EQUAL_UINT16(142, tabla.convertir(0));
+  TEST_ASSERT_EQUAL_UINT16(3145, tabla.convertir(4095));
+  TEST_ASSERT_EQUAL_UINT16(3145, tabla.convertir(0xF000 | 4095));  // Solo cuentan los 12 bits bajos
+  for (uint32_t crudo = 2870; crudo < 2960; crudo++)
+    TEST_ASSERT_UINT32_WITHIN(1, 0, tabla.convertir(crudo) - tabla.convertir(crudo - 1));
+}
+
+/**
+ * Sin calibracion en el eFuse la tabla usa CAL_VREF_DEFECTO y lo informa en la fuente
+ */
+void test_sin_efuse(void) {
+  sensSimulado.vrefEfuse = 0;
+  TEST_ASSERT_TRUE(construirTablaCalibracion(tabla, CAL_ATENUACION_11DB));
+  TEST_ASSERT_EQUAL_UINT8(CAL_FUENTE_DEFECTO, tabla.fuente);
+  for (uint32_t crudo = 0; crudo < CAL_TAM_TABLA; crudo++)
+    TEST_ASSERT_DOUBLE_WITHIN(1.0, milivoltiosReferencia(crudo, CAL_VREF_DEFECTO, CAL_ATENUACION_11DB), tabla.convertir(crudo));
+}
+
+/**
+ * Con sobremuestreo los valores exactos de 12 bits caen en su entrada y los intermedios se
+ * interpolan entre las dos vecinas, sin salirse de ellas
+ */
+void test_interpolacion_16_bits(void) {
+  construirCon(1114, CAL_ATENUACION_11DB);
+  for (uint32_t crudo = 0; crudo < CAL_TAM_TABLA; crudo++) {
+    uint32_t a = tabla.convertir(crudo);
+    uint32_t b = tabla.convertir(crudo < CAL_TAM_TABLA - 1 ? crudo + 1 : crudo);
+    TEST_ASSERT_EQUAL_UINT16(a << 4, tabla.convertir(crudo << 4, 16));
+    uint16_t medio = tabla.convertir((crudo << 4) | 8, 16);
+    TEST_ASSERT_EQUAL_UINT16((a << 4) + (b - a) * 8, medio);
+    TEST_ASSERT_TRUE(medio >= a << 4 && medio <= b << 4);
+  }
+  // Con 14 bits la fraccion tiene 2 bits
+  TEST_ASSERT_EQUAL_UINT16(tabla.convertir(100) << 2, tabla.convertir(100 << 2, 14));
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_monotona);
+  RUN_TEST(test_error_contra_referencia);
+  RUN_TEST(test_extremos_y_transicion);
+  RUN_TEST(test_sin_efuse);
+  RUN_TEST(test_interpolacion_16_bits);
+  return UNITY_END();
+}
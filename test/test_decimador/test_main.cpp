@@ -0,0 +1,245 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <math.h>
+#include "libdecimador.h"
+#include "libprocesamiento.h"
+
+// Pruebas del decimador CIC y su compensador contra la respuesta teorica: ganancia en DC, caida
+// y rechazo del aliasing, planitud con el compensador y mejora del SNR con ruido
+// (pio test -e native -f test_decimador)
+
+#define SEGUNDOS_PRUEBA 20  // Señal de cada medicion, a SAMPLING_FREQ * FACTOR
+#define DESCARTE 16         // Muestras de salida mientras el CIC y el compensador se asientan
+#define AMPLITUD 1500.0     // Amplitud de los senos de prueba en cuentas de 12 bits
+
+static const std::array<int32_t, 3> COMPENSADOR_16 =
+    cuantizarFIR<int32_t>(disenarCompensadorCIC(ETAPAS_CIC, 16, SAMPLING_FREQ, CORTE_PASA_BAJOS));
+static const std::array<int32_t, 3> COMPENSADOR_32 =
+    cuantizarFIR<int32_t>(disenarCompensadorCIC(ETAPAS_CIC, 32, SAMPLING_FREQ, CORTE_PASA_BAJOS));
+static const std::array<int32_t, 3> COMPENSADOR_64 =
+    cuantizarFIR<int32_t>(disenarCompensadorCIC(ETAPAS_CIC, 64, SAMPLING_FREQ, CORTE_PASA_BAJOS));
+static const std::array<int32_t, 3> SIN_COMPENSAR = {0, 1 << 30, 0};
+
+static const size_t TOTAL = (size_t)SEGUNDOS_PRUEBA * SAMPLING_FREQ;
+static double directo[TOTAL];   // Una de cada FACTOR muestras de entrada (muestrear sin sobremuestreo)
+static double decimado[TOTAL];  // Salida del decimador en cuentas de 12 bits
+static uint64_t azar;
+
+void setUp(void) { azar = 1; }
+void tearDown(void) {}
+
+/**
+ * Funcion que da un numero gaussiano de media 0 y desviacion 1 (Box-Muller)
+ */
+static double gaussiano() {
+  azar = azar * 6364136223846793005ULL + 1442695040888963407ULL;
+  double u1 = ((azar >> 11) + 1.0) / 9007199254740993.0;
+  azar = azar * 6364136223846793005ULL + 1442695040888963407ULL;
+  double u2 = (azar >> 11) / 9007199254740992.0;
+  return sqrt(-2 * log(u1)) * cos(2 * PI_FILTROS * u2);
+}
+
+/**
+ * Funcion que pasa un seno con ruido cuantizado a 12 bits por el decimador de un canal
+ * @param f Frecuencia del seno en Hz
+ * @param sigma Desviacion del ruido en cuentas
+ * @param compensador Coeficientes del compensador
+ */
+template <uint16_t FACTOR>
+static void decimarSeno(double f, double sigma, const std::array<int32_t, 3> &compensador) {
+  DecimadorCIC<ETAPAS_CIC, FACTOR> cic;
+  CompensadorCIC comp;
+  comp.configurar(compensador);
+  double fsEntrada = (double)SAMPLING_FREQ * FACTOR;
+  size_t n = 0;
+  for (uint64_t k = 0; n < TOTAL; k++) {
+    double v = 2048 + AMPLITUD * sin(2 * PI_FILTROS * f * k / fsEntrada) + sigma * gaussiano();
+    long q = lround(v);
+    uint16_t x = (uint16_t)(q < 0 ? 0 : (q > 4095 ? 4095 : q));
+    uint16_t salida;
+    if (!cic.agregar(x, salida)) continue;
+    directo[n] = x;
+    decimado[n++] = comp.procesar(salida) / 16.0;
+  }
+}
+
+/**
+ * Funcion que ajusta por minimos cuadrados un seno de frecuencia conocida con nivel DC
+ * @param y Muestras
+ * @param n Numero de muestras
+ * @param f Frecuencia del seno en Hz (a SAMPLING_FREQ)
+ * @param snr Si no es NULL, donde se escribe el SNR en dB (seno ajustado sobre residuo)
+ * @return Amplitud del seno
+ */
+static double ajustarSeno(const double *y, size_t n, double f, double *snr = NULL) {
+  double m[3][4] = {};  // Ecuaciones normales de y = a + b sin(wt) + c cos(wt)
+  for (size_t k = 0; k < n; k++) {
+    double base[3] = {1, sin(2 * PI_FILTROS * f * k / SAMPLING_FREQ), cos(2 * PI_FILTROS * f * k / SAMPLING_FREQ)};
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) m[i][j] += base[i] * base[j];
+      m[i][3] += base[i] * y[k];
+    }
+  }
+  for (int i = 0; i < 3; i++)  // Eliminacion de Gauss-Jordan (la matriz es definida positiva)
+    for (int r = 0; r < 3; r++) {
+      if (r == i) continue;
+      double factor = m[r][i] / m[i][i];
+      for (int j = 0; j < 4; j++) m[r][j] -= factor * m[i][j];
+    }
+  double a = m[0][3] / m[0][0], b = m[1][3] / m[1][1], c = m[2][3] / m[2][2];
+  if (snr) {
+    double ruido = 0;
+    for (size_t k = 0; k < n; k++) {
+      double e = y[k] - (a + b * sin(2 * PI_FILTROS * f * k / SAMPLING_FREQ) + c * cos(2 * PI_FILTROS * f * k / SAMPLING_FREQ));
+      ruido += e * e;
+    }
+    *snr = 10 * log10(((b * b + c * c) / 2) / (ruido / n));
+  }
+  return sqrt(b * b + c * c);
+}
+
+/**
+ * Funcion que da la ganancia medida del decimador en dB para un seno sin ruido
+ */
+template <uint16_t FACTOR>
+static double gananciaMedida(double f, const std::array<int32_t, 3> &compensador, double fAlias = -1) {
+  decimarSeno<FACTOR>(f, 0, compensador);
+  return 20 * log10(ajustarSeno(decimado + DESCARTE, TOTAL - DESCARTE, fAlias < 0 ? f : fAlias) / AMPLITUD);
+}
+
+/**
+ * Con entrada constante la salida es exactamente 16 veces la entrada (ganancia 1 con 4 bits de
+ * fraccion), tambien despues de que los integradores se desbordan muchas veces
+ */
+void test_ganancia_dc(void) {
+  const uint16_t niveles[] = {0, 1, 2048, 4095};
+  for (uint16_t x : niveles) {
+    DecimadorCIC<ETAPAS_CIC, 64> cic;
+    uint16_t salida = 0;
+    uint32_t salidas = 0;
+    for (uint32_t k = 0; k < 1000000; k++)  // El tercer integrador pasa de 2^32 en unas 3000 muestras con 4095
+      if (cic.agregar(x, salida) && ++salidas > ETAPAS_CIC) TEST_ASSERT_EQUAL_UINT16(x * 16, salida);
+    TEST_ASSERT_EQUAL_UINT32(1000000 / 64, salidas);
+  }
+  CompensadorCIC comp;
+  comp.configurar(COMPENSADOR_32);
+  uint16_t y = 0;
+  for (int k = 0; k < 4; k++) y = comp.procesar(30000);
+  TEST_ASSERT_UINT32_WITHIN(1, 30000, y);  // El compensador tiene ganancia 1 en DC
+}
+
+/**
+ * La caida del CIC medida con senos sigue a respuestaCIC() en la banda del EKG
+ */
+void test_respuesta_cic(void) {
+  const double frecuencias[] = {1, 10, 25, 40, 60, 100};
+  for (double f : frecuencias) {
+    double teorica = 20 * log10(respuestaCIC(ETAPAS_CIC, 32, SAMPLING_FREQ, f));
+    TEST_ASSERT_DOUBLE_WITHIN(0.005, teorica, gananciaMedida<32>(f, SIN_COMPENSAR));
+  }
+  // A CORTE_PASA_BAJOS el CIC de 3 etapas atenua 1.05 dB
+  TEST_ASSERT_DOUBLE_WITHIN(0.01, -1.05, 20 * log10(respuestaCIC(ETAPAS_CIC, 32, SAMPLING_FREQ, CORTE_PASA_BAJOS)));
+}
+
+/**
+ * Un seno cerca de la frecuencia de salida (que se doblaria a la banda del EKG) se rechaza en
+ * mas de 60 dB, como predice respuestaCIC()
+ */
+void test_rechazo_alias(void) {
+  double teorica = 20 * log10(fabs(respuestaCIC(ETAPAS_CIC, 32, SAMPLING_FREQ, SAMPLING_FREQ - 10)));
+  TEST_ASSERT_TRUE(teorica < -60);
+  TEST_ASSERT_TRUE(gananciaMedida<32>(SAMPLING_FREQ - 10, SIN_COMPENSAR, 10) < -60);
+  TEST_ASSERT_TRUE(gananciaMedida<32>(2 * SAMPLING_FREQ + 7, SIN_COMPENSAR, 7) < -60);
+}
+
+/**
+ * Con el compensador la banda de paso queda plana (0.05 dB) hasta CORTE_PASA_BAJOS, para los tres factores
+ */
+void test_compensador_plano(void) {
+  const double frecuencias[] = {1, 10, 20, 30, 40};
+  for (double f : frecuencias) {
+    TEST_ASSERT_DOUBLE_WITHIN(0.05, 0, gananciaMedida<16>(f, COMPENSADOR_16));
+    TEST_ASSERT_DOUBLE_WITHIN(0.05, 0, gananciaMedida<32>(f, COMPENSADOR_32));
+    TEST_ASSERT_DOUBLE_WITHIN(0.05, 0, gananciaMedida<64>(f, COMPENSADOR_64));
+  }
+}
+
+/**
+ * Funcion que da la mejora del SNR del decimador sobre muestrear directamente, con ruido blanco
+ */
+template <uint16_t FACTOR>
+static double mejoraSNR(const std::array<int32_t, 3> &compensador) {
+  decimarSeno<FACTOR>(7.3, 3, compensador);  // 3 cuentas: el ruido tipico del ADC del ESP32
+  double snrDirecto, snrDecimado;
+  ajustarSeno(directo + DESCARTE, TOTAL - DESCARTE, 7.3, &snrDirecto);
+  ajustarSeno(decimado + DESCARTE, TOTAL - DESCARTE, 7.3, &snrDecimado);
+  return snrDecimado - snrDirecto;
+}
+
+/**
+ * Con ruido blanco el SNR mejora casi 10 log10(FACTOR) dB (un bit efectivo por cada factor de 4);
+ * el CIC deja pasar algo mas de ruido que un pasa bajos ideal, de ahi el margen de 1.5 dB
+ */
+void test_mejora_snr(void) {
+  TEST_ASSERT_DOUBLE_WITHIN(1.5, 10 * log10(16.0), mejoraSNR<16>(COMPENSADOR_16));
+  TEST_ASSERT_DOUBLE_WITHIN(1.5, 10 * log10(32.0), mejoraSNR<32>(COMPENSADOR_32));
+  TEST_ASSERT_DOUBLE_WITHIN(1.5, 10 * log10(64.0), mejoraSNR<64>(COMPENSADOR_64));
+}
+
+/**
+ * El frente de varios canales da en cada canal lo mismo que un decimador y compensador sueltos
+ */
+void test_canales_intercalados(void) {
+  SobremuestreoADC<3, ETAPAS_CIC, 32> frente(COMPENSADOR_32);
+  DecimadorCIC<ETAPAS_CIC, 32> cic[3];
+  CompensadorCIC comp[3];
+  static uint16_t bloque[8 * 32 * 3];
+  uint16_t salida[8 * 3];
+  for (uint8_t c = 0; c < 3; c++) comp[c].configurar(COMPENSADOR_32);
+  for (uint32_t b = 0; b < 50; b++) {
+    for (size_t i = 0; i < 8 * 32; i++)
+      for (uint8_t c = 0; c < 3; c++) bloque[i * 3 + c] = (uint16_t)((b * 8 * 32 + i) * (c + 1) * 37 % 4096);
+    TEST_ASSERT_EQUAL(8, frente.procesarBloque(bloque, 8 * 32, salida));
+    for (uint8_t c = 0; c < 3; c++) {
+      size_t n = 0;
+      for (size_t i = 0; i < 8 * 32; i++) {
+        uint16_t decimada;
+        if (cic[c].agregar(bloque[i * 3 + c], decimada)) TEST_ASSERT_EQUAL_UINT16(comp[c].procesar(decimada), salida[n++ * 3 + c]);
+      }
+      TEST_ASSERT_EQUAL(8, n);
+    }
+  }
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ganancia_dc);
+  RUN_TEST(test_respuesta_cic);
+  RUN_TEST(test_rechazo_alias);
+  RUN_TEST(test_compensador_plano);
+  RUN_TEST(test_mejora_snr);
+  RUN_TEST(test_canales_intercalados);
+  return UNITY_END();
+}
@@ -0,0 +1,250 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <string.h>
+#include "libempaquetador.h"
+
+// Pruebas de la compresion delta + zigzag + varint de los paquetes LoRa (pio test -e native -f test_empaquetador)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * Funcion que lee un varint (el inverso de escribirVarint, como lo hace desempaquetarMuestras)
+ * @param p Bytes del varint
+ * @param leidos Donde se escribe cuantos bytes ocupaba
+ */
+static uint32_t leerVarint(const uint8_t *p, size_t &leidos) {
+  uint32_t v = 0;
+  leidos = 0;
+  do {
+    v |= (uint32_t)(p[leidos] & 0x7F) << (7 * leidos);
+  } while (p[leidos++] & 0x80);
+  return v;
+}
+
+/**
+ * zigzag intercala positivos y negativos (0, -1, 1, -2... -> 0, 1, 2, 3...) y deszigzag lo invierte
+ * en todo el rango de int32_t
+ */
+void test_zigzag_ida_y_vuelta(void) {
+  TEST_ASSERT_EQUAL_UINT32(0, zigzag(0));
+  TEST_ASSERT_EQUAL_UINT32(1, zigzag(-1));
+  TEST_ASSERT_EQUAL_UINT32(2, zigzag(1));
+  TEST_ASSERT_EQUAL_UINT32(3, zigzag(-2));
+  TEST_ASSERT_EQUAL_UINT32(8190, zigzag(4095));   // La mayor diferencia de 12 bits
+  TEST_ASSERT_EQUAL_UINT32(8189, zigzag(-4095));
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFEu, zigzag(2147483647));
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFFu, zigzag(-2147483647 - 1));
+  for (int64_t n = -2147483648LL; n <= 2147483647LL; n += 65521) TEST_ASSERT_EQUAL_INT32((int32_t)n, deszigzag(zigzag((int32_t)n)));
+  for (int32_t n = -70000; n <= 70000; n++) TEST_ASSERT_EQUAL_INT32(n, deszigzag(zigzag(n)));
+}
+
+/**
+ * Cada byte del varint lleva 7 bits: los limites de 1 a 5 bytes y la ida y vuelta
+ */
+void test_varint_tamanos(void) {
+  const uint32_t valores[] = {0, 0x7F, 0x80, 0x3FFF, 0x4000, 0x1FFFFF, 0x200000, 0x0FFFFFFF, 0x10000000, 0xFFFFFFFF};
+  const size_t tamanos[] = {1, 1, 2, 2, 3, 3, 4, 4, 5, 5};
+  for (size_t i = 0; i < sizeof(valores) / sizeof(valores[0]); i++) {
+    uint8_t buffer[8];
+    memset(buffer, 0xAA, sizeof(buffer));
+    size_t n = escribirVarint(buffer, valores[i]);
+    TEST_ASSERT_EQUAL(tamanos[i], n);
+    TEST_ASSERT_EQUAL_HEX8(0xAA, buffer[n]);  // No escribe de mas
+    size_t leidos;
+    TEST_ASSERT_EQUAL_UINT32(valores[i], leerVarint(buffer, leidos));
+    TEST_ASSERT_EQUAL(n, leidos);
+  }
+  uint8_t buffer[4];  // Diferencias de un ADC de 12 bits: hasta +-63 en un byte, cualquiera en dos
+  TEST_ASSERT_EQUAL(1, escribirVarint(buffer, zigzag(-64)));
+  TEST_ASSERT_EQUAL(2, escribirVarint(buffer, zigzag(64)));
+  TEST_ASSERT_EQUAL(2, escribirVarint(buffer, zigzag(-4095)));
+}
+
+/**
+ * Con una señal constante de 3 canales cada muestra despues de la primera ocupa 3 bytes: el paquete
+ * de 255 bytes lleva 1 + (255 - 11 - 2 - 6) / 3 = 79 muestras y mide 253 bytes
+ */
+void test_tamano_de_paquete(void) {
+  EmpaquetadorMuestras e;
+  e.iniciar(3, 3906);
+  const uint16_t valores[3] = {2048, 1000, 4095};  // La primera muestra absoluta ocupa 2 bytes por canal
+  uint32_t t = 1000;
+  int cerrados = 0;
+  size_t primeraMuestra = 0;
+  for (size_t i = 0; i < 200 && cerrados == 0; i++, t += 3906) {
+    if (e.agregar(valores, t)) {
+      cerrados++;
+      primeraMuestra = i;
+    }
+  }
+  TEST_ASSERT_EQUAL(1, cerrados);
+  TEST_ASSERT_EQUAL(79, primeraMuestra);  // La muestra 79 ya no cupo y abrio el segundo paquete
+  TEST_ASSERT_EQUAL(11 + 6 + 78 * 3 + 2, e.tamano());
+  TEST_ASSERT_LESS_OR_EQUAL(PAQUETE_CARGA_MAX, e.tamano());
+  TEST_ASSERT_EQUAL_UINT32(79, e.muestras);
+  TEST_ASSERT_DOUBLE_WITHIN(0.01, 79.0 * 6 / 253, e.razonCompresion());
+
+  EmpaquetadorMuestras corto;  // Una carga mas pequeña para un SF alto tambien se respeta
+  corto.iniciar(1, 3906, 64);
+  uint16_t v = 0;
+  for (int i = 0; i < 100; i++, v += 200) corto.agregar(&v, i);  // Diferencias de 200: 2 bytes cada una
+  TEST_ASSERT_GREATER_THAN(0, corto.paquetes);
+  TEST_ASSERT_LESS_OR_EQUAL(64, corto.tamano());
+}
+
+/**
+ * Lo que se empaqueta se recupera igual, con encabezado, secuencia y marcas de tiempo continuas,
+ * tambien con saltos de toda la escala entre muestras
+ */
+void test_ida_y_vuelta(void) {
+  EmpaquetadorMuestras e;
+  e.iniciar(3, 4000, PAQUETE_CARGA_MAX, true);
+  static uint16_t enviados[3000][3];
+  uint32_t semilla = 7;
+  for (size_t i = 0; i < 3000; i++) {
+    semilla = semilla * 1664525u + 1013904223u;
+    enviados[i][0] = (uint16_t)(2048 + 400 * ((int)(i % 50) - 25) / 25);  // Rampa
+    enviados[i][1] = (uint16_t)((semilla >> 20) & 0x0FFF);                  // Ruido en toda la escala
+    enviados[i][2] = (i % 2) ? 4095 : 0;                                   // Saltos de toda la escala
+  }
+  size_t recibidos = 0;
+  uint16_t secuencia = 0;
+  uint16_t valores[PAQUETE_CARGA_MAX * 3];
+  for (size_t i = 0; i <= 3000; i++) {
+    bool cerrado = (i < 3000) ? e.agregar(enviados[i], 500 + (uint32_t)i * 4000) : e.cerrar();
+    if (!cerrado) continue;
+    EncabezadoPaquete encabezado;
+    size_t n = desempaquetarMuestras(e.paquete(), e.tamano(), encabezado, valores, sizeof(valores) / sizeof(valores[0]));
+    TEST_ASSERT_GREATER_THAN(0, n);
+    TEST_ASSERT_EQUAL_UINT16(secuencia++, encabezado.secuencia);
+    TEST_ASSERT_EQUAL_UINT32(500 + recibidos * 4000, encabezado.marcaTiempo);
+    TEST_ASSERT_EQUAL_UINT16(4000, encabezado.periodoUs);
+    TEST_ASSERT_EQUAL(3, encabezado.numCanales);
+    TEST_ASSERT_TRUE(encabezado.milivoltios);
+    TEST_ASSERT_EQUAL_UINT8(PAQUETE_TIPO_MILIVOLTIOS, e.paquete()[0]);
+    TEST_ASSERT_EQUAL_MEMORY(enviados[recibidos], valores, n * 3 * sizeof(uint16_t));
+    recibidos += n;
+  }
+  TEST_ASSERT_EQUAL(3000, recibidos);
+  TEST_ASSERT_EQUAL_UINT32(secuencia, e.paquetes);
+  TEST_ASSERT_FALSE(e.cerrar());  // No queda nada en construccion
+}
+
+/**
+ * El cambio de periodo cierra el paquete en construccion y el siguiente lleva el nuevo periodo
+ */
+void test_cambio_de_periodo(void) {
+  EmpaquetadorMuestras e;
+  e.iniciar(1, 3906);
+  uint16_t v = 100;
+  for (int i = 0; i < 10; i++) e.agregar(&v, i * 3906);
+  TEST_ASSERT_TRUE(e.cambiarPeriodo(15625));
+  uint16_t valores[16];
+  EncabezadoPaquete encabezado;
+  TEST_ASSERT_EQUAL(10, desempaquetarMuestras(e.paquete(), e.tamano(), encabezado, valores, 16));
+  TEST_ASSERT_EQUAL_UINT16(3906, encabezado.periodoUs);
+  e.agregar(&v, 100000);
+  TEST_ASSERT_TRUE(e.cerrar());
+  TEST_ASSERT_EQUAL(1, desempaquetarMuestras(e.paquete(), e.tamano(), encabezado, valores, 16));
+  TEST_ASSERT_EQUAL_UINT16(15625, encabezado.periodoUs);
+  TEST_ASSERT_EQUAL_UINT16(1, encabezado.secuencia);
+  TEST_ASSERT_FALSE(e.cambiarPeriodo(3906));  // Sin muestras no hay paquete que cerrar
+}
+
+/**
+ * La marca de muestras sin filtrar cierra el paquete en construccion, cambia el tipo (en cuentas y en
+ * milivoltios) y sigue la misma secuencia; al quitarla vuelve el tipo normal
+ */
+void test_sin_filtrar(void) {
+  const bool unidades[] = {false, true};
+  for (bool milivoltios : unidades) {
+    EmpaquetadorMuestras e;
+    e.iniciar(1, 31250, PAQUETE_CARGA_MAX, milivoltios);
+    uint16_t v = 100, valores[16];
+    EncabezadoPaquete encabezado;
+    TEST_ASSERT_FALSE(e.marcarSinFiltrar(true));  // Sin muestras no hay paquete que cerrar
+    for (int i = 0; i < 5; i++) e.agregar(&v, i * 31250);
+    TEST_ASSERT_TRUE(e.marcarSinFiltrar(false));
+    TEST_ASSERT_EQUAL_UINT8(milivoltios ? PAQUETE_TIPO_MILIVOLTIOS_SIN_FILTRAR : PAQUETE_TIPO_MUESTRAS_SIN_FILTRAR, e.paquete()[0]);
+    TEST_ASSERT_EQUAL(5, desempaquetarMuestras(e.paquete(), e.tamano(), encabezado, valores, 16));
+    TEST_ASSERT_TRUE(encabezado.sinFiltrar);
+    TEST_ASSERT_EQUAL(milivoltios, encabezado.milivoltios);
+    e.agregar(&v, 200000);
+    TEST_ASSERT_TRUE(e.cerrar());
+    TEST_ASSERT_EQUAL_UINT8(milivoltios ? PAQUETE_TIPO_MILIVOLTIOS : PAQUETE_TIPO_MUESTRAS, e.paquete()[0]);
+    TEST_ASSERT_EQUAL(1, desempaquetarMuestras(e.paquete(), e.tamano(), encabezado, valores, 16));
+    TEST_ASSERT_FALSE(encabezado.sinFiltrar);
+    TEST_ASSERT_EQUAL(milivoltios, encabezado.milivoltios);
+    TEST_ASSERT_EQUAL_UINT16(1, encabezado.secuencia);
+  }
+}
+
+/**
+ * Un paquete con un bit cambiado, truncado, de otro tipo o que no cabe en el destino se rechaza
+ */
+void test_paquetes_invalidos(void) {
+  EmpaquetadorMuestras e;
+  e.iniciar(2, 3906);
+  uint16_t muestra[2] = {1000, 3000};
+  for (int i = 0; i < 20; i++, muestra[0] += 7) e.agregar(muestra, i * 3906);
+  TEST_ASSERT_TRUE(e.cerrar());
+  uint8_t paquete[PAQUETE_CARGA_MAX];
+  size_t len = e.tamano();
+  memcpy(paquete, e.paquete(), len);
+  uint16_t valores[64];
+  EncabezadoPaquete encabezado;
+  TEST_ASSERT_EQUAL(20, desempaquetarMuestras(paquete, len, encabezado, valores, 64));
+  TEST_ASSERT_EQUAL(0, desempaquetarMuestras(paquete, len, encabezado, valores, 39));  // 20 muestras x 2 canales no caben
+  TEST_ASSERT_EQUAL(0, desempaquetarMuestras(paquete, len - 1, encabezado, valores, 64));
+  TEST_ASSERT_EQUAL(0, desempaquetarMuestras(paquete, PAQUETE_TAM_ENCABEZADO, encabezado, valores, 64));
+  for (size_t i = 0; i < len; i++) {
+    paquete[i] ^= 0x10;
+    TEST_ASSERT_EQUAL(0, desempaquetarMuestras(paquete, len, encabezado, valores, 64));
+    paquete[i] ^= 0x10;
+  }
+}
+
+/**
+ * Tiempo en el aire con la formula del datasheet del SX1276/78 (SF7 y SF12 a 125kHz, CR 4/5)
+ */
+void test_tiempo_en_el_aire(void) {
+  TEST_ASSERT_EQUAL_UINT32(41216, tiempoAireLoRaUs(10, 7, 125000, 1));    // 12.25 + 8 + 4 * 5 simbolos de 1024 us
+  TEST_ASSERT_EQUAL_UINT32(991232, tiempoAireLoRaUs(10, 12, 125000, 1));  // 12.25 + 8 + 2 * 5 de 32768 us (con la optimizacion para tasas bajas)
+  TEST_ASSERT_LESS_THAN(tiempoAireLoRaUs(255, 7, 125000, 1), tiempoAireLoRaUs(253, 7, 125000, 1) - 1);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_zigzag_ida_y_vuelta);
+  RUN_TEST(test_varint_tamanos);
+  RUN_TEST(test_tamano_de_paquete);
+  RUN_TEST(test_ida_y_vuelta);
+  RUN_TEST(test_cambio_de_periodo);
+  RUN_TEST(test_sin_filtrar);
+  RUN_TEST(test_paquetes_invalidos);
+  RUN_TEST(test_tiempo_en_el_aire);
+  return UNITY_END();
+}
@@ -0,0 +1,123 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include "libescaneoadc.h"
+
+// Pruebas del escaneo del ADC1 por registros sobre el bloque SENS simulado de libhalsens.h
+// (pio test -e native -f test_escaneo)
+
+static uint8_t ordenConvertido[32];  // Canales en el orden en que el SAR los convirtio
+static size_t numConvertidos;
+
+/**
+ * Fuente del bloque SENS simulado que anota el canal de cada conversion y devuelve 100 * canal
+ */
+static uint16_t fuenteAnotada(uint8_t canal) {
+  if (numConvertidos < sizeof(ordenConvertido)) ordenConvertido[numConvertidos++] = canal;
+  return 100 * canal;
+}
+
+void setUp(void) {
+  sensSimulado = {};
+  sensSimulado.fuente = fuenteAnotada;
+  sensSimulado.ciclosPorConversion = 250;
+  numConvertidos = 0;
+}
+void tearDown(void) {}
+
+/**
+ * configurar() toca una sola vez el pad de cada canal de la lista y ningun otro; los escaneos
+ * posteriores no vuelven a configurar nada
+ */
+void test_configura_una_sola_vez(void) {
+  EscaneoADC1<7, 5, 4> escaneo;
+  escaneo.configurar();
+  TEST_ASSERT_EQUAL_UINT32(3, sensSimulado.configuraciones);
+  for (uint8_t canal = 0; canal < 8; canal++) TEST_ASSERT_EQUAL(canal == 7 || canal == 5 || canal == 4, sensSimulado.configurado[canal]);
+  EscaneoADC1<7, 5, 4>::Muestra muestra;
+  for (int i = 0; i < 10; i++) escaneo.leer(muestra);
+  TEST_ASSERT_EQUAL_UINT32(3, sensSimulado.configuraciones);
+  TEST_ASSERT_EQUAL_UINT32(30, sensSimulado.conversiones);
+}
+
+/**
+ * Cada escaneo convierte los canales en el orden de la plantilla, con un solo pad seleccionado a
+ * la vez, y deja cada dato en la posicion de su canal
+ */
+void test_orden_de_canales(void) {
+  EscaneoADC1<7, 5, 4> escaneo;
+  escaneo.configurar();
+  EscaneoADC1<7, 5, 4>::Muestra muestra;
+  escaneo.leer(muestra);
+  escaneo.leer(muestra);
+  const uint8_t esperado[] = {7, 5, 4, 7, 5, 4};
+  TEST_ASSERT_EQUAL(sizeof(esperado), numConvertidos);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(esperado, ordenConvertido, sizeof(esperado));
+  TEST_ASSERT_EQUAL_UINT32(1u << 4, sensSimulado.padSeleccionado);  // El ultimo pad seleccionado es solo el del ultimo canal
+  TEST_ASSERT_EQUAL_UINT16(700, muestra.valor[0]);
+  TEST_ASSERT_EQUAL_UINT16(500, muestra.valor[1]);
+  TEST_ASSERT_EQUAL_UINT16(400, muestra.valor[2]);
+
+  numConvertidos = 0;  // Con otra lista el orden y las posiciones siguen a la plantilla
+  EscaneoADC1<0, 3> escaneoInverso;
+  EscaneoADC1<0, 3>::Muestra otra;
+  escaneoInverso.leer(otra);
+  TEST_ASSERT_EQUAL_UINT8(0, ordenConvertido[0]);
+  TEST_ASSERT_EQUAL_UINT8(3, ordenConvertido[1]);
+  TEST_ASSERT_EQUAL_UINT16(0, otra.valor[0]);
+  TEST_ASSERT_EQUAL_UINT16(300, otra.valor[1]);
+}
+
+/**
+ * Los datos se recortan a 12 bits y el tiempo de escaneo se mide con el contador de ciclos
+ */
+void test_doce_bits_y_ciclos(void) {
+  sensSimulado.fuente = NULL;
+  sensSimulado.valor[7] = 0xFFFF;
+  sensSimulado.valor[5] = 0x1234;
+  EscaneoADC1<7, 5, 4> escaneo;
+  escaneo.configurar();
+  EscaneoADC1<7, 5, 4>::Muestra muestra;
+  escaneo.leer(muestra);
+  TEST_ASSERT_EQUAL_UINT16(0x0FFF, muestra.valor[0]);
+  TEST_ASSERT_EQUAL_UINT16(0x0234, muestra.valor[1]);
+  TEST_ASSERT_EQUAL_UINT16(0, muestra.valor[2]);
+  TEST_ASSERT_EQUAL_UINT32(3 * 250, escaneo.ciclosUltimoEscaneo());
+  sensSimulado.ciclosPorConversion = 350;
+  escaneo.leer(muestra);
+  TEST_ASSERT_EQUAL_UINT32(3 * 350, escaneo.ciclosMaximoEscaneo());
+  TEST_ASSERT_EQUAL_UINT32(3 * 300, escaneo.ciclosPromedioEscaneo());
+  TEST_ASSERT_EQUAL_UINT32(2, escaneo.totalEscaneos());
+  escaneo.reiniciarEstadisticas();
+  TEST_ASSERT_EQUAL_UINT32(0, escaneo.totalEscaneos());
+  TEST_ASSERT_EQUAL_UINT32(0, escaneo.ciclosPromedioEscaneo());
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_configura_una_sola_vez);
+  RUN_TEST(test_orden_de_canales);
+  RUN_TEST(test_doce_bits_y_ciclos);
+  return UNITY_END();
+}
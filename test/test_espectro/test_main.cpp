@@ -0,0 +1,242 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <math.h>
+#include "libespectro.h"
+#include "libetapas.h"
+
+// Pruebas del analisis espectral en punto fijo (FFT real, bandas de la etapa y Goertzel
+// deslizante) contra la DFT en doble precision de la misma ventana (pio test -e native -f test_espectro)
+
+#define N_PRUEBA SIZE_BUF
+#define SEGUNDOS_PRUEBA 1800   // El Goertzel deslizante no debe derivar en media hora de muestras
+#define MAX_REGISTROS (SEGUNDOS_PRUEBA * SAMPLING_FREQ * 2 / N_PRUEBA + 1)
+
+static const size_t TOTAL = (size_t)SEGUNDOS_PRUEBA * SAMPLING_FREQ;
+static uint16_t senal[TOTAL];
+static RegistroEspectro registros[MAX_REGISTROS];
+static size_t numRegistros;
+
+/**
+ * Funcion que genera la señal de prueba de 12 bits: un seno en cada banda del EEG, la red y su
+ * segundo armonico, y ruido pseudoaleatorio de unas 5 cuentas
+ */
+static void generarSenal() {
+  uint32_t semilla = 7;
+  for (size_t n = 0; n < TOTAL; n++) {
+    double t = (double)n / SAMPLING_FREQ;
+    semilla = semilla * 1664525u + 1013904223u;
+    double ruido = ((double)(semilla >> 8) / (1 << 24) - 0.5) * 17;
+    double v = 2048 + 300 * sin(2 * PI_FILTROS * 2.0 * t) + 150 * sin(2 * PI_FILTROS * 6.1 * t + 1) +
+               200 * sin(2 * PI_FILTROS * 10.3 * t + 2) + 80 * sin(2 * PI_FILTROS * 21.7 * t + 0.5) + 40 * sin(2 * PI_FILTROS * 37.1 * t) +
+               60 * sin(2 * PI_FILTROS * FRECUENCIA_RED * t) + 20 * sin(2 * PI_FILTROS * 2 * FRECUENCIA_RED * t + 1) + ruido;
+    long q = lround(v);
+    senal[n] = (uint16_t)(q < 0 ? 0 : (q > 4095 ? 4095 : q));
+  }
+}
+
+void setUp(void) {
+  if (!senal[0]) generarSenal();
+  numRegistros = 0;
+}
+void tearDown(void) {}
+
+/**
+ * Funcion que calcula en doble precision el bin k de la DFT con ventana de Hann de la ventana que
+ * termina en la muestra fin, sin el valor medio
+ */
+static void dftReferencia(size_t fin, size_t k, double &re, double &im) {
+  double media = 0;
+  for (size_t i = 0; i < N_PRUEBA; i++) media += senal[fin + 1 - N_PRUEBA + i];
+  media /= N_PRUEBA;
+  re = im = 0;
+  for (size_t i = 0; i < N_PRUEBA; i++) {
+    double v = (senal[fin + 1 - N_PRUEBA + i] - media) * (0.5 - 0.5 * cos(2 * PI_FILTROS * i / N_PRUEBA));
+    re += v * cos(2 * PI_FILTROS * k * i / N_PRUEBA);
+    im -= v * sin(2 * PI_FILTROS * k * i / N_PRUEBA);
+  }
+}
+
+/**
+ * Funcion que pasa |X|^2 de la DFT con ventana de Hann a dB: potencia media de la señal en los bins
+ * sumados (normalizada por suma(w^2) = 3N/8), o la de un seno en un bin (ganancia coherente N/2)
+ */
+static double decibelesHann(double potencia, bool tono) {
+  return 10 * log10(2 * potencia / (tono ? N_PRUEBA * N_PRUEBA / 4.0 : N_PRUEBA * 3.0 * N_PRUEBA / 8));
+}
+
+static void guardarRegistro(const RegistroEspectro &registro) {
+  if (numRegistros < MAX_REGISTROS) registros[numRegistros++] = registro;
+}
+
+static void descartarMuestra(const MuestraADC &muestra) { (void)muestra; }
+
+typedef Cadena<EtapaEspectro<SAMPLING_FREQ, N_PRUEBA, guardarRegistro>,
+               EtapaSumidero<MuestraADC, SAMPLING_FREQ, descartarMuestra>> CadenaEspectro;
+
+/**
+ * El logaritmo entero da 100 log10 de la suma con escala, a menos de una decima de dB (0.05 dB del
+ * logaritmo mas el redondeo), en todo el rango de 64 bits
+ */
+void test_decimas_de_decibel(void) {
+  TEST_ASSERT_EQUAL_INT16(ESPECTRO_SIN_POTENCIA, decimasDeDecibel(0, 0));
+  for (double s = 1; s < 1.8e19; s *= 1.0137) {
+    uint64_t entero = (uint64_t)s;
+    const int32_t escalas[] = {0, log2Q16(-32.4), log2Q16(7.25)};
+    for (int32_t escala : escalas) {
+      double esperado = 100 * log10((double)entero) + 100 * log10(2.0) * escala / 65536.0;
+      TEST_ASSERT_DOUBLE_WITHIN(1.0, esperado, decimasDeDecibel(entero, escala));
+    }
+  }
+  TEST_ASSERT_EQUAL_INT16(32767, decimasDeDecibel(1, log2Q16(1200)));  // Satura en vez de dar la vuelta
+  TEST_ASSERT_EQUAL_INT16(-32767, decimasDeDecibel(1, log2Q16(-1200)));
+}
+
+/**
+ * Las magnitudes de FFTReal bin por bin siguen a la DFT en doble precision con un SNR de mas de
+ * 100 dB (el ruido de redondeo de 16 bits de fraccion)
+ */
+void test_fft_contra_dft(void) {
+  static FFTReal<N_PRUEBA> fft;
+  int16_t ventana[N_PRUEBA];
+  uint64_t potencia[N_PRUEBA / 2 + 1];
+  double energia = 0, ruido = 0;
+  for (size_t w = 0; w < 100; w++) {
+    size_t fin = N_PRUEBA - 1 + w * 17 * N_PRUEBA / 2;  // Repartidas en toda la señal
+    int32_t suma = 0;
+    for (size_t i = 0; i < N_PRUEBA; i++) suma += ventana[i] = (int16_t)(senal[fin + 1 - N_PRUEBA + i] - 2048);
+    // La ventana se entrega rotada, como el buffer circular de la etapa
+    int16_t circular[N_PRUEBA];
+    size_t inicio = w % N_PRUEBA;
+    for (size_t i = 0; i < N_PRUEBA; i++) circular[(inicio + i) % N_PRUEBA] = ventana[i];
+    fft.transformar(circular, inicio, (int32_t)((int64_t)suma * 256 / N_PRUEBA), potencia);
+    for (size_t k = 0; k <= N_PRUEBA / 2; k++) {
+      double re, im;
+      dftReferencia(fin, k, re, im);
+      double referencia = sqrt(re * re + im * im), fija = sqrt((double)potencia[k]) * N_PRUEBA / 65536;
+      energia += referencia * referencia;
+      ruido += (fija - referencia) * (fija - referencia);
+    }
+  }
+  TEST_ASSERT_TRUE(10 * log10(energia / ruido) > 100);
+}
+
+/**
+ * Un seno en el centro de una banda da 10 log10(A^2 / 2) en esa banda, y las demas quedan muy abajo
+ */
+void test_seno_en_banda(void) {
+  CadenaEspectro *cadena = new CadenaEspectro();
+  cadena->etapa<0>().reiniciar();
+  const double amplitud = 500;
+  for (size_t i = 0; i < 4 * N_PRUEBA; i++) {
+    MuestraADC m = {};
+    m.marcaTiempo = i;
+    m.x = (uint16_t)lround(2048 + amplitud * sin(2 * PI_FILTROS * 10.0 * i / SAMPLING_FREQ));
+    m.bits = 12;
+    cadena->procesar(m);
+  }
+  TEST_ASSERT_EQUAL(7, numRegistros);
+  const RegistroEspectro &r = registros[numRegistros - 1];
+  TEST_ASSERT_INT32_WITHIN(1, lround(100 * log10(amplitud * amplitud / 2)), r.valores[2]);  // Alfa: 8 a 13 Hz
+  for (uint8_t b = 0; b < ESPECTRO_NUM_BANDAS; b++)
+    if (b != 2) TEST_ASSERT_TRUE(r.valores[b] < r.valores[2] - 400);
+  delete cadena;
+}
+
+/**
+ * Las bandas de los registros de la etapa difieren de las de la DFT en doble precision de la misma
+ * ventana en menos de 0.1 dB, y en promedio en menos de 0.05 dB
+ */
+void test_bandas_contra_dft(void) {
+  static MuestraADC entrada[400 * N_PRUEBA / 2];
+  const size_t total = sizeof(entrada) / sizeof(entrada[0]);
+  for (size_t i = 0; i < total; i++) {
+    entrada[i] = {};
+    entrada[i].marcaTiempo = i;  // El registro lleva la marca de la ultima muestra de su ventana: su indice
+    entrada[i].x = senal[i];
+    entrada[i].bits = 12;
+  }
+  CadenaEspectro *cadena = new CadenaEspectro();
+  cadena->etapa<0>().reiniciar();
+  cadena->procesarBloque(entrada, total);
+  TEST_ASSERT_EQUAL(total / (N_PRUEBA / 2) - 1, numRegistros);
+  double errorTotal = 0;
+  size_t comparadas = 0;
+  for (size_t r = 0; r < numRegistros; r++) {
+    size_t fin = (size_t)registros[r].marcaTiempo;
+    for (uint8_t b = 0; b < ESPECTRO_NUM_BANDAS; b++) {
+      double suma = 0, re, im;
+      for (size_t k = binEspectro(BANDAS_ESPECTRO[b][0], N_PRUEBA, SAMPLING_FREQ);
+           k < binEspectro(BANDAS_ESPECTRO[b][1], N_PRUEBA, SAMPLING_FREQ) && k <= N_PRUEBA / 2; k++) {
+        dftReferencia(fin, k, re, im);
+        suma += re * re + im * im;
+      }
+      double error = fabs(registros[r].valores[b] / 10.0 - decibelesHann(suma, false));
+      TEST_ASSERT_TRUE(error < 0.1);
+      errorTotal += error;
+      comparadas++;
+    }
+  }
+  TEST_ASSERT_TRUE(errorTotal / comparadas < 0.05);
+  delete cadena;
+}
+
+/**
+ * El Goertzel deslizante en la red y su armonico sigue a la DFT con ventana de Hann a menos de
+ * 0.1 dB, y el error al final de SEGUNDOS_PRUEBA no es mayor que al principio (no se acumula)
+ */
+void test_goertzel_sin_deriva(void) {
+  static GoertzelDeslizante<N_PRUEBA, ESPECTRO_NUM_BINS> goertzel;
+  size_t bins[ESPECTRO_NUM_BINS] = {(size_t)lround((double)FRECUENCIA_RED * N_PRUEBA / SAMPLING_FREQ),
+                                    (size_t)lround(2.0 * FRECUENCIA_RED * N_PRUEBA / SAMPLING_FREQ)};
+  goertzel.configurar(bins);
+  double errorInicio = 0, errorFinal = 0;
+  for (size_t i = 0; i < TOTAL; i++) {
+    goertzel.procesar(senal[i] - 2048, i >= N_PRUEBA ? senal[i - N_PRUEBA] - 2048 : 0);
+    if (i < N_PRUEBA || (i + 1) % (N_PRUEBA / 2)) continue;
+    bool alInicio = i < TOTAL / 10, alFinal = i >= TOTAL - TOTAL / 10;
+    if (!alInicio && !alFinal) continue;
+    for (uint8_t b = 0; b < ESPECTRO_NUM_BINS; b++) {
+      double re, im;
+      dftReferencia(i, bins[b], re, im);
+      double error = fabs(decimasDeDecibel(goertzel.potencia(b), GoertzelDeslizante<N_PRUEBA, ESPECTRO_NUM_BINS>::ESCALA_POTENCIA) / 10.0 -
+                          decibelesHann(re * re + im * im, true));
+      double &maximo = alInicio ? errorInicio : errorFinal;
+      if (error > maximo) maximo = error;
+    }
+  }
+  TEST_ASSERT_TRUE(errorInicio < 0.1);
+  TEST_ASSERT_TRUE(errorFinal < 0.1);
+  TEST_ASSERT_TRUE(errorFinal <= errorInicio + 0.01);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_decimas_de_decibel);
+  RUN_TEST(test_fft_contra_dft);
+  RUN_TEST(test_seno_en_banda);
+  RUN_TEST(test_bandas_contra_dft);
+  RUN_TEST(test_goertzel_sin_deriva);
+  return UNITY_END();
+}
@@ -0,0 +1,205 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include "libfiltros.h"
+#include "libprocesamiento.h"
+
+// Pruebas del motor de filtros en punto fijo contra una referencia en double, y medicion del
+// costo por muestra en el computador (pio test -e native -f test_filtros)
+
+#define MUESTRAS_PRUEBA 20000      // Unos 78 s de señal a SAMPLING_FREQ: pasa todo el transitorio del pasa altos
+#define MUESTRAS_RENDIMIENTO 2000000
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * Biquad en forma directa I con coeficientes y estado en double (referencia)
+ */
+struct BiquadDouble {
+  CoefBiquad c;
+  double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+  double procesar(double x) {
+    double y = c.b0 * x + c.b1 * x1 + c.b2 * x2 - c.a1 * y1 - c.a2 * y2;
+    x2 = x1;
+    x1 = x;
+    y2 = y1;
+    y1 = y;
+    return y;
+  }
+};
+
+/**
+ * Funcion que genera la señal de prueba normalizada a [-1, 1): deriva lenta, componente de EKG,
+ * interferencia de la red y ruido pseudoaleatorio
+ * @param n Indice de la muestra
+ */
+static double senalPrueba(size_t n) {
+  static uint32_t semilla = 12345;
+  semilla = semilla * 1664525u + 1013904223u;
+  double t = (double)n / SAMPLING_FREQ;
+  double ruido = ((double)(semilla >> 8) / (1 << 24) - 0.5) * 0.05;
+  return 0.25 * sin(2 * PI_FILTROS * 0.2 * t) + 0.3 * sin(2 * PI_FILTROS * 7 * t) +
+         0.15 * sin(2 * PI_FILTROS * FRECUENCIA_RED * t) + ruido;
+}
+
+/**
+ * Funcion que compara una cascada en punto fijo con la misma cascada en double
+ * @param diseno Coeficientes reales de cada etapa
+ * @param filtro Cascada en punto fijo construida con los mismos coeficientes cuantizados
+ * @return Maximo error absoluto a escala completa (1.0 = fondo de escala de T)
+ */
+template <typename T, size_t ETAPAS>
+static double errorCascada(const CoefBiquad (&diseno)[ETAPAS], CascadaBiquad<T, ETAPAS> &filtro) {
+  const double escala = (double)FormatoQ<T>::MAXIMO + 1;
+  BiquadDouble referencia[ETAPAS];
+  for (size_t i = 0; i < ETAPAS; i++) referencia[i].c = diseno[i];
+  double maximo = 0;
+  for (size_t n = 0; n < MUESTRAS_PRUEBA; n++) {
+    double x = senalPrueba(n);
+    T q = (T)lround(x * escala);
+    double y = q / escala;  // La referencia parte de la misma muestra cuantizada
+    for (size_t i = 0; i < ETAPAS; i++) y = referencia[i].procesar(y);
+    double error = fabs(filtro.procesar(q) / escala - y);
+    if (error > maximo) maximo = error;
+  }
+  return maximo;
+}
+
+/**
+ * La cadena del EKG en Q31 (pasa altos de linea base, notch de la red y pasa bajos) sigue a la
+ * referencia en double con un error muy por debajo del bit menos significativo del ADC de 12 bits
+ */
+void test_biquad_q31_contra_double(void) {
+  static constexpr CoefBiquad DISENO[] = {disenarPasaAltos(SAMPLING_FREQ, CORTE_LINEA_BASE, 0.7071),
+                                          disenarNotch(SAMPLING_FREQ, FRECUENCIA_RED, 30),
+                                          disenarPasaBajos(SAMPLING_FREQ, CORTE_PASA_BAJOS, 0.7071)};
+  static constexpr CoefBiquadQ<int32_t> COEF[] = {cuantizar<int32_t>(DISENO[0]), cuantizar<int32_t>(DISENO[1]),
+                                                  cuantizar<int32_t>(DISENO[2])};
+  CascadaBiquad<int32_t, 3> filtro(COEF);
+  double error = errorCascada(DISENO, filtro);
+  char texto[80];
+  snprintf(texto, sizeof(texto), "Q31 error maximo %.2e", error);
+  TEST_MESSAGE(texto);
+  TEST_ASSERT_LESS_THAN(1e-6, error);
+}
+
+/**
+ * En Q15 el notch y el pasa bajos (cortes lejos de 0 Hz) siguen a la referencia dentro de unos pocos LSB
+ */
+void test_biquad_q15_contra_double(void) {
+  static constexpr CoefBiquad DISENO[] = {disenarNotch(SAMPLING_FREQ, FRECUENCIA_RED, 30),
+                                          disenarPasaBajos(SAMPLING_FREQ, CORTE_PASA_BAJOS, 0.7071)};
+  static constexpr CoefBiquadQ<int16_t> COEF[] = {cuantizar<int16_t>(DISENO[0]), cuantizar<int16_t>(DISENO[1])};
+  CascadaBiquad<int16_t, 2> filtro(COEF);
+  double error = errorCascada(DISENO, filtro);
+  char texto[80];
+  snprintf(texto, sizeof(texto), "Q15 error maximo %.2e", error);
+  TEST_MESSAGE(texto);
+  TEST_ASSERT_LESS_THAN(1e-3, error);
+}
+
+/**
+ * El FIR pasa bajos Q31 da el mismo producto punto que en double, con ganancia unitaria en DC
+ * y la red muy atenuada
+ */
+void test_fir_q31_contra_double(void) {
+  static constexpr std::array<double, 31> H = disenarFIRPasaBajos<31>(SAMPLING_FREQ, CORTE_PASA_BAJOS);
+  static constexpr std::array<int32_t, 31> HQ = cuantizarFIR<int32_t>(H);
+  FIR<int32_t, 31> filtro(HQ);
+  const double escala = 2147483648.0;
+  double historia[31] = {0};
+  double maximo = 0;
+  for (size_t n = 0; n < MUESTRAS_PRUEBA; n++) {
+    int32_t q = (int32_t)lround(senalPrueba(n) * escala);
+    for (size_t k = 30; k > 0; k--) historia[k] = historia[k - 1];
+    historia[0] = q / escala;
+    double y = 0;
+    for (size_t k = 0; k < 31; k++) y += H[k] * historia[k];
+    double error = fabs(filtro.procesar(q) / escala - y);
+    if (error > maximo) maximo = error;
+  }
+  TEST_ASSERT_LESS_THAN(1e-8, maximo);
+
+  double dc = 0, red = 0, redIm = 0;  // Respuesta en frecuencia de los coeficientes cuantizados
+  for (size_t k = 0; k < 31; k++) {
+    dc += HQ[k] / 1073741824.0;
+    red += HQ[k] / 1073741824.0 * cos(2 * PI_FILTROS * FRECUENCIA_RED / SAMPLING_FREQ * k);
+    redIm += HQ[k] / 1073741824.0 * sin(2 * PI_FILTROS * FRECUENCIA_RED / SAMPLING_FREQ * k);
+  }
+  TEST_ASSERT_DOUBLE_WITHIN(1e-6, 1.0, dc);
+  TEST_ASSERT_LESS_THAN(-20.0, 20 * log10(sqrt(red * red + redIm * redIm)));
+}
+
+/**
+ * Funcion que mide el tiempo por muestra de un filtro (el resultado se acumula para que el
+ * compilador no elimine el lazo)
+ * @param nombre Nombre que aparece en el reporte
+ */
+template <typename F>
+static double medirFiltro(const char *nombre, F &filtro) {
+  int64_t suma = 0;
+  int32_t x = 0;
+  auto inicio = std::chrono::steady_clock::now();
+  for (uint32_t n = 0; n < MUESTRAS_RENDIMIENTO; n++) {
+    x = x * 1103515245 + 12345;
+    suma += filtro.procesar(x >> 2);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - inicio).count() /
+              MUESTRAS_RENDIMIENTO;
+  char texto[96];
+  snprintf(texto, sizeof(texto), "%s: %.1f ns por muestra (suma %lld)", nombre, ns, (long long)suma);
+  TEST_MESSAGE(texto);
+  return ns;
+}
+
+/**
+ * Costo por muestra en el computador de la cadena del EKG (3 biquads Q31) y de un FIR Q31 de 31
+ * coeficientes. En el ESP32 a 240MHz cada ns del computador son del orden de 10 a 20 ciclos; aqui solo
+ * se reporta y se verifica que no haya un retroceso grosero (mas de 1 us por muestra).
+ */
+void test_rendimiento(void) {
+  static constexpr CoefBiquadQ<int32_t> COEF[] = {
+      cuantizar<int32_t>(disenarPasaAltos(SAMPLING_FREQ, CORTE_LINEA_BASE, 0.7071)),
+      cuantizar<int32_t>(disenarNotch(SAMPLING_FREQ, FRECUENCIA_RED, 30)),
+      cuantizar<int32_t>(disenarPasaBajos(SAMPLING_FREQ, CORTE_PASA_BAJOS, 0.7071))};
+  static constexpr std::array<int32_t, 31> HQ =
+      cuantizarFIR<int32_t>(disenarFIRPasaBajos<31>(SAMPLING_FREQ, CORTE_PASA_BAJOS));
+  CascadaBiquad<int32_t, 3> cascada(COEF);
+  FIR<int32_t, 31> fir(HQ);
+  TEST_ASSERT_LESS_THAN(1000.0, medirFiltro("Cascada Q31 de 3 biquads", cascada));
+  TEST_ASSERT_LESS_THAN(1000.0, medirFiltro("FIR Q31 de 31 coeficientes", fir));
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_biquad_q31_contra_double);
+  RUN_TEST(test_biquad_q15_contra_double);
+  RUN_TEST(test_fir_q31_contra_double);
+  RUN_TEST(test_rendimiento);
+  return UNITY_END();
+}
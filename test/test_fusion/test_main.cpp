@@ -0,0 +1,307 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include "libfusion.h"
+#include "libbasetiempo.h"
+
+// Pruebas de la alineacion de los sensores sobre la base de tiempo comun: el fusionador con flujos
+// sinteticos de marcas de tiempo conocidas y la disciplina de la hora UTC con un reloj local que
+// deriva (pio test -e native -f test_fusion)
+
+#define PERIODO_ADC_US (1e6 / 256)
+#define PERIODO_GIRO_US (1e6 / (200 * 1.004))  // Giroscopio a 200 Hz con su oscilador 0.4% rapido
+#define RAMPA_Z 64                             // El eje z sube 64 por muestra: su valor interpolado da el instante
+#define LOTE_GIRO_US 80000                     // El giroscopio se lee de su FIFO cada 80 ms
+#define UTC_INICIO_US 1792238400000000LL       // 12:00:00 UTC del 17/10/2026
+#define SEGUNDO_LOCAL_US 1000040               // El reloj local adelanta 40 ppm respecto a UTC
+#define DESFASE_LOCAL_US 1234                  // Instante local del segundo UTC 0
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * Funcion que da el instante de la muestra n del giroscopio
+ */
+static uint64_t instanteGiro(uint32_t n) {
+  return (uint64_t)llround((n + 1) * PERIODO_GIRO_US);
+}
+
+/**
+ * Funcion que da la muestra n del giroscopio con la rampa en el eje z
+ */
+static MuestraGiroscopio muestraGiro(uint32_t n) {
+  MuestraGiroscopio m;
+  m.marcaTiempo = instanteGiro(n);
+  m.x = (int16_t)n;
+  m.y = (int16_t)-n;
+  m.z = (int16_t)(n * RAMPA_Z);
+  return m;
+}
+
+/**
+ * Funcion que da la muestra n del ADC
+ */
+static MuestraADC muestraAdc(uint32_t n) {
+  MuestraADC m;
+  m.marcaTiempo = (uint64_t)llround(500 + n * PERIODO_ADC_US);
+  m.x = (uint16_t)(n & 0x0FFF);
+  m.y = 0;
+  m.z = 0;
+  return m;
+}
+
+/**
+ * Funcion que da el instante local del inicio de un segundo UTC
+ */
+static uint64_t localSegundo(uint32_t segundo) {
+  return DESFASE_LOCAL_US + (uint64_t)segundo * SEGUNDO_LOCAL_US;
+}
+
+/**
+ * Seudoaleatorio determinista en [-1, 1) para el retardo de las frases
+ */
+static double ruido(uint32_t n) {
+  n = n * 1103515245u + 12345u;
+  n ^= n >> 16;
+  return (n & 0xFFFF) / 32768.0 - 1;
+}
+
+/**
+ * Flujos como los de la aplicacion: el giroscopio llega por lotes, con retraso; cada registro debe
+ * tener el giroscopio interpolado en el instante exacto de su muestra del ADC, en orden y sin huecos
+ */
+void test_giroscopio_interpolado(void) {
+  FusionadorSensores fusion;
+  uint32_t giro = 0, adc = 0, emitidos = 0, antesDelGiro = 0;
+  double errorMaximoUs = 0;
+  uint64_t anterior = 0;
+  for (uint64_t ahora = LOTE_GIRO_US; ahora <= 2000000; ahora += 1000) {  // 2 s: la rampa de 16 bits no da la vuelta
+    if (ahora % LOTE_GIRO_US == 0)
+      while (instanteGiro(giro) <= ahora) TEST_ASSERT_TRUE(fusion.agregarGiroscopio(muestraGiro(giro++)));
+    while (muestraAdc(adc).marcaTiempo <= ahora) TEST_ASSERT_TRUE(fusion.agregarAdc(muestraAdc(adc++)));
+    RegistroFusionado r;
+    while (fusion.extraer(ahora, r)) {
+      TEST_ASSERT_EQUAL_UINT64(muestraAdc(emitidos).marcaTiempo, r.marcaTiempo);
+      TEST_ASSERT_EQUAL_UINT16(emitidos & 0x0FFF, r.adc[0]);
+      TEST_ASSERT_TRUE(emitidos == 0 || r.marcaTiempo > anterior);
+      anterior = r.marcaTiempo;
+      emitidos++;
+      if (r.marcaTiempo <= instanteGiro(0)) {  // Antes de la primera muestra del giroscopio no hay nada que interpolar
+        TEST_ASSERT_EQUAL_UINT8(FUSION_GIRO_SOSTENIDO, r.banderas);
+        antesDelGiro++;
+        continue;
+      }
+      TEST_ASSERT_EQUAL_UINT8(FUSION_GIRO_INTERPOLADO, r.banderas);
+      double error = fabs(((double)r.giro[2] / RAMPA_Z - (r.marcaTiempo / PERIODO_GIRO_US - 1)) * PERIODO_GIRO_US);
+      if (error > errorMaximoUs) errorMaximoUs = error;
+      TEST_ASSERT_EQUAL_INT16(-r.giro[0], r.giro[1]);
+    }
+  }
+  // Solo quedan pendientes las muestras del ADC posteriores al ultimo lote del giroscopio
+  TEST_ASSERT_GREATER_THAN(450, emitidos);
+  TEST_ASSERT_LESS_OR_EQUAL(LOTE_GIRO_US / PERIODO_ADC_US + 1, adc - emitidos);
+  // La interpolacion entera pierde menos de una unidad de la rampa (1/64 de periodo) mas el redondeo de las marcas
+  TEST_ASSERT_LESS_THAN(PERIODO_GIRO_US / RAMPA_Z + 2, errorMaximoUs);
+  EstadisticasFusion e = fusion.estadisticas();
+  TEST_ASSERT_EQUAL_UINT32(emitidos, e.registros);
+  TEST_ASSERT_EQUAL_UINT32(2, antesDelGiro);
+  TEST_ASSERT_EQUAL_UINT32(antesDelGiro, e.sostenidos);
+  TEST_ASSERT_EQUAL_UINT32(0, e.descartadasAdc + e.descartadasGiroscopio);
+}
+
+/**
+ * Si el giroscopio se detiene, las muestras del ADC esperan hasta el limite y salen con la ultima
+ * muestra conocida sostenida, nunca antes
+ */
+void test_giroscopio_sostenido(void) {
+  FusionadorSensores fusion(100000);
+  uint32_t giro = 0, adc = 0, sostenidos = 0;
+  while (instanteGiro(giro) <= 1000000) fusion.agregarGiroscopio(muestraGiro(giro++));
+  MuestraGiroscopio ultima = muestraGiro(giro - 1);
+  for (uint64_t ahora = 0; ahora <= 2000000; ahora += 1000) {
+    while (muestraAdc(adc).marcaTiempo <= ahora) fusion.agregarAdc(muestraAdc(adc++));
+    RegistroFusionado r;
+    while (fusion.extraer(ahora, r)) {
+      if (r.marcaTiempo < ultima.marcaTiempo) continue;
+      TEST_ASSERT_EQUAL_UINT8(FUSION_GIRO_SOSTENIDO, r.banderas);
+      TEST_ASSERT_TRUE(ahora >= r.marcaTiempo + 100000);
+      TEST_ASSERT_TRUE(ahora < r.marcaTiempo + 100000 + 1000);  // Sale en cuanto se agota la espera
+      TEST_ASSERT_EQUAL_INT16(ultima.z, r.giro[2]);
+      sostenidos++;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(sostenidos, fusion.estadisticas().sostenidos);
+  TEST_ASSERT_GREATER_THAN(200, sostenidos);
+}
+
+/**
+ * El fix del GPS se sostiene: cada registro lleva el ultimo que llego antes de su muestra y su edad
+ */
+void test_gps_sostenido(void) {
+  FusionadorSensores fusion;
+  uint32_t giro = 0, adc = 0, conFix = 0;
+  for (uint64_t ahora = 0; ahora <= 3000000; ahora += 1000) {
+    if (ahora % 1000000 == 80000) {  // Un fix por segundo, 80 ms despues del inicio del segundo
+      RegistroGPS fix;
+      memset(&fix, 0, sizeof(fix));
+      fix.marcaTiempo = ahora;
+      fix.latitud = (int32_t)(ahora / 1000000) + 1;
+      fix.longitud = -fix.latitud;
+      fix.posicionValida = true;
+      fusion.agregarGPS(fix);
+    }
+    while (instanteGiro(giro) <= ahora) fusion.agregarGiroscopio(muestraGiro(giro++));
+    while (muestraAdc(adc).marcaTiempo <= ahora) fusion.agregarAdc(muestraAdc(adc++));
+    RegistroFusionado r;
+    while (fusion.extraer(ahora, r)) {
+      if (r.marcaTiempo < 80000) {
+        TEST_ASSERT_FALSE(r.banderas & FUSION_GPS_VALIDO);
+        continue;
+      }
+      uint64_t llegada = (r.marcaTiempo - 80000) / 1000000 * 1000000 + 80000;
+      TEST_ASSERT_TRUE(r.banderas & FUSION_GPS_VALIDO);
+      TEST_ASSERT_EQUAL_INT32((int32_t)(llegada / 1000000) + 1, r.latitud);
+      TEST_ASSERT_EQUAL_INT32(-r.latitud, r.longitud);
+      TEST_ASSERT_EQUAL_UINT32((r.marcaTiempo - llegada) / 1000, r.edadGpsMs);
+      conFix++;
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(700, conFix);
+}
+
+/**
+ * Las esperas llenas descartan y lo cuentan: la del ADC rechaza la nueva, la del giroscopio la mas antigua
+ */
+void test_esperas_llenas(void) {
+  FusionadorSensores fusion;
+  for (uint32_t n = 0; n < FUSION_TAM_ADC + 5; n++) TEST_ASSERT_EQUAL(n < FUSION_TAM_ADC, fusion.agregarAdc(muestraAdc(n)));
+  for (uint32_t n = 0; n < FUSION_TAM_GIROSCOPIO + 3; n++) TEST_ASSERT_TRUE(fusion.agregarGiroscopio(muestraGiro(n)));
+  EstadisticasFusion e = fusion.estadisticas();
+  TEST_ASSERT_EQUAL_UINT32(5, e.descartadasAdc);
+  TEST_ASSERT_EQUAL_UINT32(3, e.descartadasGiroscopio);
+}
+
+/**
+ * Fecha y hora del GPS a microsegundos desde 1970, incluido un 29 de febrero
+ */
+void test_hora_utc(void) {
+  RegistroGPS r;
+  memset(&r, 0, sizeof(r));
+  int64_t utc;
+  TEST_ASSERT_FALSE(horaUTCGPS(r, utc));
+  r.fechaValida = r.horaValida = true;
+  r.anio = 2026;
+  r.mes = 10;
+  r.dia = 17;
+  r.hora = 12;
+  TEST_ASSERT_TRUE(horaUTCGPS(r, utc));
+  TEST_ASSERT_EQUAL_INT64(UTC_INICIO_US, utc);
+  r.anio = 2000;
+  r.mes = 2;
+  r.dia = 29;
+  r.hora = 23;
+  r.minuto = 59;
+  r.segundo = 59;
+  r.centesimas = 50;
+  TEST_ASSERT_TRUE(horaUTCGPS(r, utc));
+  TEST_ASSERT_EQUAL_INT64(951868799500000LL, utc);
+}
+
+/**
+ * Con el PPS, la deriva del reloj local converge a la real y la hora UTC de cualquier marca queda
+ * a pocos microsegundos, aunque las frases lleguen con un retardo variable
+ */
+void test_disciplina_con_pps(void) {
+  DisciplinaTiempo d;
+  for (uint32_t s = 1; s <= 600; s++) {
+    d.pulsoPPS(localSegundo(s));
+    uint64_t fin = localSegundo(s) + 95000 + (uint64_t)(30000 * (ruido(s) + 1));
+    d.horaGPS(UTC_INICIO_US + s * 1000000LL, fin);
+    d.horaGPS(UTC_INICIO_US + s * 1000000LL, fin + 40000);  // La GGA del mismo fix se ignora
+  }
+  EstadoBaseTiempo e = d.estado();
+  TEST_ASSERT_TRUE(e.sincronizada);
+  TEST_ASSERT_TRUE(e.conPPS);
+  TEST_ASSERT_EQUAL_UINT32(599, e.correcciones);
+  TEST_ASSERT_EQUAL_UINT32(0, e.reinicios);
+  TEST_ASSERT_INT32_WITHIN(100, 40000, e.derivaPpb);
+  for (uint32_t k = 0; k < 10; k++) {  // Marcas del ultimo segundo y medio
+    uint64_t local = localSegundo(599) + k * 150000;
+    int64_t utc;
+    TEST_ASSERT_TRUE(d.aUTC(local, utc));
+    double real = UTC_INICIO_US + (double)(local - DESFASE_LOCAL_US) * 1e6 / SEGUNDO_LOCAL_US;
+    TEST_ASSERT_DOUBLE_WITHIN(10, real, (double)utc);
+  }
+}
+
+/**
+ * Sin PPS la referencia es el fin de la primera frase menos su retardo tipico: el error queda en el
+ * orden del jitter de la llegada de las frases
+ */
+void test_disciplina_sin_pps(void) {
+  DisciplinaTiempo d;
+  for (uint32_t s = 1; s <= 1300; s++)
+    d.horaGPS(UTC_INICIO_US + s * 1000000LL, localSegundo(s) + BASE_RETARDO_NMEA_US + (int64_t)(2000 * ruido(s)));
+  EstadoBaseTiempo e = d.estado();
+  TEST_ASSERT_TRUE(e.sincronizada);
+  TEST_ASSERT_FALSE(e.conPPS);
+  TEST_ASSERT_EQUAL_UINT32(0, e.reinicios);
+  TEST_ASSERT_INT32_WITHIN(10000, 40000, e.derivaPpb);
+  int64_t utc;
+  TEST_ASSERT_TRUE(d.aUTC(localSegundo(1300) + 500000, utc));
+  double real = UTC_INICIO_US + 1300e6 + 500000 * 1e6 / SEGUNDO_LOCAL_US;
+  TEST_ASSERT_DOUBLE_WITHIN(3000, real, (double)utc);
+}
+
+/**
+ * Un salto de la hora del GPS mayor que BASE_ERROR_MAX_US reinicia la disciplina en la nueva hora
+ */
+void test_disciplina_salto(void) {
+  DisciplinaTiempo d;
+  int64_t utc;
+  TEST_ASSERT_FALSE(d.aUTC(1000000, utc));
+  for (uint32_t s = 1; s <= 60; s++) {
+    d.pulsoPPS(localSegundo(s));
+    d.horaGPS(UTC_INICIO_US + s * 1000000LL + (s > 40 ? 2000000 : 0), localSegundo(s) + 100000);
+  }
+  EstadoBaseTiempo e = d.estado();
+  TEST_ASSERT_EQUAL_UINT32(1, e.reinicios);
+  TEST_ASSERT_TRUE(d.aUTC(localSegundo(60), utc));
+  TEST_ASSERT_INT64_WITHIN(50, UTC_INICIO_US + 62000000LL, utc);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_giroscopio_interpolado);
+  RUN_TEST(test_giroscopio_sostenido);
+  RUN_TEST(test_gps_sostenido);
+  RUN_TEST(test_esperas_llenas);
+  RUN_TEST(test_hora_utc);
+  RUN_TEST(test_disciplina_con_pps);
+  RUN_TEST(test_disciplina_sin_pps);
+  RUN_TEST(test_disciplina_salto);
+  return UNITY_END();
+}
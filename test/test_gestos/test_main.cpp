@@ -0,0 +1,167 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include "libgestos.h"
+#include "libtouch.h"
+#include "../datos/traza_touch.h"
+
+// Pruebas del reconocedor de gestos: toque, doble toque, pulsacion larga y acorde con secuencias de
+// eventos armadas a mano, los plazos que informa proximoVencimiento() y la traza de test/datos
+// pasada por DetectorTouch como lo hace el motor (pio test -e native -f test_gestos)
+
+#define MS 1000ULL
+
+static ReconocedorGestos *reconocedor;
+static GestoTouch gestos[8];
+
+void setUp(void) { reconocedor = new ReconocedorGestos(); }
+void tearDown(void) { delete reconocedor; }
+
+/**
+ * Funcion que entrega un evento al reconocedor
+ * @return Gestos reconocidos (quedan en gestos[])
+ */
+static size_t evento(uint64_t tiempoUs, uint8_t pad, bool pulsado) {
+  return reconocedor->procesar(EventoTouch{tiempoUs, pad, pulsado}, gestos, 8);
+}
+
+/**
+ * Un toque se informa cuando vence la espera del segundo toque, no antes, con el instante de la pulsacion
+ */
+void test_toque(void) {
+  TEST_ASSERT_EQUAL(0, evento(1000 * MS, 3, true));
+  TEST_ASSERT_EQUAL_UINT64(1000 * MS + GESTO_PULSACION_LARGA_US, reconocedor->proximoVencimiento());
+  TEST_ASSERT_EQUAL(0, evento(1100 * MS, 3, false));
+  TEST_ASSERT_EQUAL_UINT64(1100 * MS + GESTO_DOBLE_TOQUE_US, reconocedor->proximoVencimiento());
+  TEST_ASSERT_EQUAL(0, reconocedor->revisar(1100 * MS + GESTO_DOBLE_TOQUE_US - 1, gestos, 8));
+  TEST_ASSERT_EQUAL(1, reconocedor->revisar(1100 * MS + GESTO_DOBLE_TOQUE_US, gestos, 8));
+  TEST_ASSERT_EQUAL(GESTO_TOQUE, gestos[0].tipo);
+  TEST_ASSERT_EQUAL_UINT16(1 << 3, gestos[0].pads);
+  TEST_ASSERT_EQUAL_UINT64(1000 * MS, gestos[0].marcaTiempo);
+  TEST_ASSERT_EQUAL_UINT64(GESTO_SIN_VENCIMIENTO, reconocedor->proximoVencimiento());
+}
+
+/**
+ * Dos toques dentro de GESTO_DOBLE_TOQUE_US son un doble toque al soltar el segundo; si el segundo
+ * llega tarde son dos toques
+ */
+void test_doble_toque(void) {
+  evento(0, 1, true);
+  evento(100 * MS, 1, false);
+  TEST_ASSERT_EQUAL(0, evento(350 * MS, 1, true));
+  TEST_ASSERT_EQUAL(1, evento(450 * MS, 1, false));
+  TEST_ASSERT_EQUAL(GESTO_DOBLE_TOQUE, gestos[0].tipo);
+  TEST_ASSERT_EQUAL_UINT64(0, gestos[0].marcaTiempo);
+  TEST_ASSERT_EQUAL(0, reconocedor->revisar(2000 * MS, gestos, 8));  // No queda un toque pendiente
+
+  evento(3000 * MS, 1, true);
+  evento(3100 * MS, 1, false);
+  TEST_ASSERT_EQUAL(1, evento(3100 * MS + GESTO_DOBLE_TOQUE_US + 1, 1, true));  // El primero vence al llegar el segundo
+  TEST_ASSERT_EQUAL(GESTO_TOQUE, gestos[0].tipo);
+  evento(3500 * MS, 1, false);
+  TEST_ASSERT_EQUAL(1, reconocedor->revisar(3500 * MS + GESTO_DOBLE_TOQUE_US, gestos, 8));
+  TEST_ASSERT_EQUAL(GESTO_TOQUE, gestos[0].tipo);
+}
+
+/**
+ * La pulsacion larga se informa al cumplir GESTO_PULSACION_LARGA_US sin esperar a que se suelte,
+ * y al soltar no sale ningun otro gesto
+ */
+void test_pulsacion_larga(void) {
+  evento(500 * MS, 0, true);
+  TEST_ASSERT_EQUAL(0, reconocedor->revisar(500 * MS + GESTO_PULSACION_LARGA_US - 1, gestos, 8));
+  TEST_ASSERT_EQUAL(1, reconocedor->revisar(500 * MS + GESTO_PULSACION_LARGA_US, gestos, 8));
+  TEST_ASSERT_EQUAL(GESTO_PULSACION_LARGA, gestos[0].tipo);
+  TEST_ASSERT_EQUAL_UINT64(500 * MS, gestos[0].marcaTiempo);
+  TEST_ASSERT_EQUAL_UINT64(GESTO_SIN_VENCIMIENTO, reconocedor->proximoVencimiento());
+  TEST_ASSERT_EQUAL(0, evento(5000 * MS, 0, false));
+  TEST_ASSERT_EQUAL(0, reconocedor->revisar(10000 * MS, gestos, 8));
+}
+
+/**
+ * Pads pulsados dentro de GESTO_VENTANA_ACORDE_US forman un acorde que sale al soltar el ultimo;
+ * un pad pulsado despues de la ventana es un gesto aparte
+ */
+void test_acorde(void) {
+  evento(0, 0, true);
+  evento(100 * MS, 2, true);
+  TEST_ASSERT_EQUAL(0, evento(400 * MS, 0, false));
+  TEST_ASSERT_EQUAL(1, evento(450 * MS, 2, false));
+  TEST_ASSERT_EQUAL(GESTO_ACORDE, gestos[0].tipo);
+  TEST_ASSERT_EQUAL_UINT16((1 << 0) | (1 << 2), gestos[0].pads);
+  TEST_ASSERT_EQUAL_UINT64(0, gestos[0].marcaTiempo);
+  TEST_ASSERT_EQUAL_UINT64(GESTO_SIN_VENCIMIENTO, reconocedor->proximoVencimiento());
+
+  evento(1000 * MS, 0, true);
+  evento(1000 * MS + GESTO_VENTANA_ACORDE_US + 1, 1, true);  // Tarde para el acorde
+  size_t n = evento(1300 * MS, 1, false);
+  n += evento(1350 * MS, 0, false);
+  n += reconocedor->revisar(2000 * MS, gestos + n, 8 - n);
+  TEST_ASSERT_EQUAL(2, n);
+  TEST_ASSERT_EQUAL(GESTO_TOQUE, gestos[0].tipo);
+  TEST_ASSERT_EQUAL(GESTO_TOQUE, gestos[1].tipo);
+  TEST_ASSERT_EQUAL_UINT16((1 << 0) | (1 << 1), gestos[0].pads | gestos[1].pads);
+}
+
+/**
+ * La traza grabada pasada por un DetectorTouch por pad da exactamente los gestos de su guion,
+ * revisando los plazos cada 10 ms como la tarea despachadora
+ */
+void test_traza(void) {
+  static LecturaTraza traza[TRAZA_TOUCH_MAX];
+  size_t largo = leerTrazaTouch(traza);
+  TEST_ASSERT_TRUE(largo > 0);
+  DetectorTouch detectores[TRAZA_TOUCH_PADS];
+  for (uint8_t p = 0; p < TRAZA_TOUCH_PADS; p++) detectores[p].iniciar(traza[0].valor[p], 25);
+  GestoTouch encontrados[16];
+  size_t n = 0;
+  for (size_t i = 1; i < largo; i++) {
+    uint64_t t = (uint64_t)traza[i].tiempoMs * MS;
+    for (uint8_t p = 0; p < TRAZA_TOUCH_PADS; p++) {
+      int8_t cambio = detectores[p].actualizar(traza[i].valor[p], t);
+      if (cambio != 0) n += reconocedor->procesar(EventoTouch{t, p, cambio > 0}, encontrados + n, 16 - n);
+    }
+    n += reconocedor->revisar(t, encontrados + n, 16 - n);
+  }
+  const GestoTouch esperados[] = {{GESTO_TOQUE, 1 << 0, 2040 * MS},
+                                  {GESTO_DOBLE_TOQUE, 1 << 1, 4020 * MS},
+                                  {GESTO_PULSACION_LARGA, 1 << 2, 6020 * MS},
+                                  {GESTO_ACORDE, (1 << 0) | (1 << 1), 9020 * MS}};
+  TEST_ASSERT_EQUAL(sizeof(esperados) / sizeof(esperados[0]), n);
+  for (size_t i = 0; i < n; i++) {
+    TEST_ASSERT_EQUAL(esperados[i].tipo, encontrados[i].tipo);
+    TEST_ASSERT_EQUAL_UINT16(esperados[i].pads, encontrados[i].pads);
+    TEST_ASSERT_EQUAL_UINT64(esperados[i].marcaTiempo, encontrados[i].marcaTiempo);
+  }
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_toque);
+  RUN_TEST(test_doble_toque);
+  RUN_TEST(test_pulsacion_larga);
+  RUN_TEST(test_acorde);
+  RUN_TEST(test_traza);
+  return UNITY_END();
+}
@@ -0,0 +1,297 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <unity.h>
+#include "libgiroscopio.h"
+#include "libhal.h"
+#include "libplanificador.h"
+
+// Pruebas de la adquisicion del giroscopio contra una FIFO simulada en el bus I2C: deteccion por
+// WHO_AM_I en las direcciones de cada tipo, division de las lecturas en rafagas de GIRO_MAX_RAFAGA,
+// desborde de la FIFO y seguimiento del reloj del giroscopio por el lazo PI de las marcas de tiempo
+// (pio test -e native -f test_giroscopio)
+
+#define RELOJ_GIRO 1.004  // El oscilador del giroscopio simulado va 0.4% mas rapido que el nominal
+#define MAX_RAFAGAS 64
+
+/**
+ * Giroscopio simulado: responde en una sola direccion con un WHO_AM_I configurable. La muestra n
+ * lleva n en x (bits bajos) y en y (bits altos) para saber cuales se perdieron
+ */
+static struct {
+  uint8_t direccion;  // 0: nadie responde
+  uint8_t id;
+  uint8_t registros[64];
+  bool escribioLowOdr;
+  double encendidoUs;
+  uint32_t consumidas;  // Muestras que ya salieron de la FIFO (leidas o sobreescritas)
+  bool desborde;
+  size_t rafagas[MAX_RAFAGAS];  // Muestras de cada lectura de OUT_X_L
+  size_t numRafagas;
+} giro;
+
+static int trabajo = -1;
+
+/**
+ * Funcion que calcula el instante real de una muestra del giroscopio simulado
+ */
+static double instanteMuestra(uint32_t n) {
+  return giro.encendidoUs + (n + 1) * 1e6 / ((100 << (giro.registros[L3G_CTRL1] >> 6)) * RELOJ_GIRO);
+}
+
+/**
+ * Funcion que actualiza la FIFO hasta el instante actual y devuelve el numero de muestras pendientes
+ */
+static uint32_t nivelFifo() {
+  if (!(giro.registros[L3G_CTRL1] & 0x08)) return 0;
+  uint32_t generadas = 0;
+  while (instanteMuestra(generadas) <= halMicros()) generadas++;
+  if (generadas - giro.consumidas > L3G_TAM_FIFO) {  // Modo stream: se sobreescriben las mas antiguas
+    giro.consumidas = generadas - L3G_TAM_FIFO;
+    giro.desborde = true;
+  }
+  return generadas - giro.consumidas;
+}
+
+template <uint8_t DIRECCION>
+static bool escribirGiro(const uint8_t *datos, size_t len) {
+  if (giro.direccion != DIRECCION || len != 2) return false;
+  uint8_t registro = datos[0] & 0x3F;
+  if (registro == L3G_CTRL1 && !(giro.registros[L3G_CTRL1] & 0x08) && (datos[1] & 0x08)) {
+    giro.encendidoUs = (double)halMicros();
+    giro.consumidas = 0;
+  }
+  if (registro == L3G_LOW_ODR) giro.escribioLowOdr = true;
+  giro.registros[registro] = datos[1];
+  return true;
+}
+
+template <uint8_t DIRECCION>
+static bool leerGiro(uint8_t registro, uint8_t *datos, size_t len) {
+  if (giro.direccion != DIRECCION) return false;
+  registro &= 0x3F;
+  if (registro == L3G_WHO_AM_I && len == 1) {
+    datos[0] = giro.id;
+    return true;
+  }
+  uint32_t nivel = nivelFifo();
+  if (registro == L3G_FIFO_SRC && len == 1) {
+    datos[0] = (uint8_t)((nivel & L3G_FIFO_SRC_FSS) | (nivel == 0 ? L3G_FIFO_SRC_EMPTY : 0) | (giro.desborde ? L3G_FIFO_SRC_OVRN : 0));
+    return true;
+  }
+  if (registro != L3G_OUT_X_L || len % 6 != 0 || len / 6 > nivel) return false;
+  for (size_t k = 0; k < len / 6; k++) {
+    uint32_t n = giro.consumidas++;
+    int16_t m[3] = {(int16_t)(n & 0x7FFF), (int16_t)(n >> 15), 0};
+    for (uint8_t i = 0; i < 6; i++) datos[6 * k + i] = (uint8_t)((i & 1) ? (m[i / 2] >> 8) : m[i / 2]);
+  }
+  if (giro.numRafagas < MAX_RAFAGAS) giro.rafagas[giro.numRafagas++] = len / 6;
+  giro.desborde = false;
+  return true;
+}
+
+/**
+ * Funcion que pone el giroscopio simulado en una direccion con un WHO_AM_I, apagado
+ */
+static void conectarGiro(uint8_t direccion, uint8_t id) {
+  memset(&giro, 0, sizeof(giro));
+  giro.direccion = direccion;
+  giro.id = id;
+}
+
+/**
+ * Funcion que descarta las muestras acumuladas y devuelve cuantas eran
+ */
+static size_t vaciar() {
+  MuestraGiroscopio m[GIRO_TAM_BUFFER];
+  return leerMuestrasGiroscopio(m, GIRO_TAM_BUFFER);
+}
+
+/**
+ * Funcion que deja un L3GD20H en 0x6B a 200 Hz leido por el planificador (una sola vez para todas las pruebas)
+ */
+static void arrancar() {
+  static bool arrancado = false;
+  if (arrancado) return;
+  conectarGiro(DIRECCION_L3GD20_SA0_ALTO, L3GD20H_ID);
+  TEST_ASSERT_TRUE(iniciarGiroscopio(GIRO_L3GD20H, 200, 1, 1));
+  trabajo = 0;  // Es el unico trabajo del planificador
+  TEST_ASSERT_TRUE(iniciarPlanificador(3));
+  halSimCorrer(2000000);  // Que el lazo PI converja
+  arrancado = true;
+}
+
+/**
+ * Funcion que devuelve el numero de la muestra simulada que llego en una muestra leida
+ */
+static uint32_t numeroMuestra(const MuestraGiroscopio &m) {
+  return (uint32_t)(uint16_t)m.x | ((uint32_t)(uint16_t)m.y << 15);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_rechaza_tipo_desconocido() {
+  conectarGiro(DIRECCION_L3GD20_SA0_ALTO, L3GD20H_ID);
+  TEST_ASSERT_FALSE(iniciarGiroscopio(GIRO_NUM_TIPOS, 200, 1, 1));  // device_auto de la biblioteca L3G
+  TEST_ASSERT_FALSE(iniciarGiroscopio(0xFF, 200, 1, 1));
+  TEST_ASSERT_EQUAL_HEX8(0, giro.registros[L3G_CTRL1]);  // No se toco el dispositivo
+}
+
+void test_rechaza_sin_dispositivo() {
+  conectarGiro(0, 0);
+  TEST_ASSERT_FALSE(iniciarGiroscopio(GIRO_L3GD20H, 200, 1, 1));
+  TEST_ASSERT_EQUAL_HEX8(0, estadisticasGiroscopio().direccion);
+}
+
+void test_rechaza_who_am_i_de_otro_tipo() {
+  conectarGiro(DIRECCION_L3GD20_SA0_ALTO, L3GD20_ID);  // Un L3GD20 donde se esperaba un L3GD20H
+  TEST_ASSERT_FALSE(iniciarGiroscopio(GIRO_L3GD20H, 200, 1, 1));
+  conectarGiro(DIRECCION_L3GD20_SA0_ALTO, L3G4200D_ID);  // El L3G4200D no se busca en las direcciones del L3GD20
+  TEST_ASSERT_FALSE(iniciarGiroscopio(GIRO_L3G4200D, 200, 1, 1));
+  TEST_ASSERT_EQUAL_HEX8(0, giro.registros[L3G_CTRL1]);
+}
+
+void test_detecta_l3g4200d() {
+  conectarGiro(DIRECCION_L3G4200D_SA0_ALTO, L3G4200D_ID);
+  TEST_ASSERT_TRUE(iniciarGiroscopio(GIRO_L3G4200D, 200, 1, 1));
+  TEST_ASSERT_EQUAL_HEX8(DIRECCION_L3G4200D_SA0_ALTO, estadisticasGiroscopio().direccion);
+  TEST_ASSERT_FALSE(giro.escribioLowOdr);  // El L3G4200D no tiene LOW_ODR
+  TEST_ASSERT_EQUAL_HEX8(L3G_FIFO_MODO_STREAM | GIRO_UMBRAL_FIFO, giro.registros[L3G_FIFO_CTRL]);
+  TEST_ASSERT_EQUAL_UINT32(5000, estadisticasGiroscopio().periodoUs);
+}
+
+void test_detecta_l3gd20_con_sa0_en_bajo() {
+  conectarGiro(DIRECCION_L3GD20_SA0_BAJO, L3GD20_ID);
+  TEST_ASSERT_TRUE(iniciarGiroscopio(GIRO_L3GD20, 200, 1, 1));
+  TEST_ASSERT_EQUAL_HEX8(DIRECCION_L3GD20_SA0_BAJO, estadisticasGiroscopio().direccion);
+  TEST_ASSERT_FALSE(giro.escribioLowOdr);
+  TEST_ASSERT_EQUAL_UINT32(1000000 / 190, estadisticasGiroscopio().periodoUs);  // El L3GD20 va a 190 Hz, no a 200
+}
+
+void test_rafagas_divididas() {
+  arrancar();
+  uint32_t divisor = PLAN_FRECUENCIA_BASE * GIRO_UMBRAL_FIFO / 200;
+  TEST_ASSERT_TRUE(planificadorCambiarDivisor(trabajo, divisor * 3 / 2));  // ~24 muestras por lectura
+  halSimCorrer(200000);
+  vaciar();
+  EstadisticasGiroscopio antes = estadisticasGiroscopio();
+  giro.numRafagas = 0;
+  halSimCorrer(1000000);  // ~200 muestras: caben en el buffer hacia los consumidores
+  MuestraGiroscopio m[GIRO_TAM_BUFFER];
+  size_t n = leerMuestrasGiroscopio(m, GIRO_TAM_BUFFER);
+  EstadisticasGiroscopio despues = estadisticasGiroscopio();
+  TEST_ASSERT_EQUAL_UINT32(antes.desbordes, despues.desbordes);
+  TEST_ASSERT_EQUAL_UINT32(n, despues.muestras - antes.muestras);
+  TEST_ASSERT_GREATER_THAN(190, n);
+  for (size_t i = 1; i < n; i++) TEST_ASSERT_EQUAL_UINT32(numeroMuestra(m[i - 1]) + 1, numeroMuestra(m[i]));  // Ninguna perdida
+  size_t partidas = 0;
+  for (size_t r = 0; r < giro.numRafagas; r++) {
+    TEST_ASSERT_LESS_OR_EQUAL(GIRO_MAX_RAFAGA, giro.rafagas[r]);
+    if (giro.rafagas[r] == GIRO_MAX_RAFAGA && r + 1 < giro.numRafagas && giro.rafagas[r + 1] <= L3G_TAM_FIFO - GIRO_MAX_RAFAGA)
+      partidas++;
+  }
+  TEST_ASSERT_GREATER_THAN(giro.numRafagas / 3, partidas);  // Casi todas las lecturas son 21 + el resto
+  TEST_ASSERT_TRUE(planificadorCambiarDivisor(trabajo, divisor));
+}
+
+void test_desborde() {
+  arrancar();
+  uint32_t divisor = PLAN_FRECUENCIA_BASE * GIRO_UMBRAL_FIFO / 200;
+  vaciar();
+  EstadisticasGiroscopio antes = estadisticasGiroscopio();
+  TEST_ASSERT_TRUE(planificadorCambiarDivisor(trabajo, divisor * 3));  // ~48 muestras entre lecturas: la FIFO se llena
+  halSimCorrer(1000000);
+  EstadisticasGiroscopio durante = estadisticasGiroscopio();
+  TEST_ASSERT_GREATER_THAN(antes.desbordes + 2, durante.desbordes);
+  MuestraGiroscopio m[GIRO_TAM_BUFFER];
+  size_t n = leerMuestrasGiroscopio(m, GIRO_TAM_BUFFER);
+  size_t saltos = 0;
+  for (size_t i = 1; i < n; i++) {
+    TEST_ASSERT_GREATER_THAN(m[i - 1].marcaTiempo, m[i].marcaTiempo);  // La linea de tiempo nunca retrocede
+    if (numeroMuestra(m[i]) != numeroMuestra(m[i - 1]) + 1) {
+      saltos++;
+      // La resincronizacion deja el hueco en la marca de tiempo, no lo reparte entre las muestras
+      uint32_t perdidas = numeroMuestra(m[i]) - numeroMuestra(m[i - 1]) - 1;
+      TEST_ASSERT_GREATER_THAN((uint64_t)perdidas * 4000, m[i].marcaTiempo - m[i - 1].marcaTiempo);
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(0, saltos);
+
+  // Con el divisor normal la FIFO no vuelve a desbordarse
+  TEST_ASSERT_TRUE(planificadorCambiarDivisor(trabajo, divisor));
+  halSimCorrer(500000);  // La lectura ya programada con el divisor largo aun puede encontrar la FIFO desbordada
+  EstadisticasGiroscopio recuperado = estadisticasGiroscopio();
+  halSimCorrer(2000000);
+  TEST_ASSERT_EQUAL_UINT32(recuperado.desbordes, estadisticasGiroscopio().desbordes);
+  vaciar();
+}
+
+void test_lazo_pi_sigue_el_reloj() {
+  arrancar();
+  halSimCorrer(10000000);  // Tiempo para que el periodo estimado converja despues del desborde
+  vaciar();
+  EstadisticasGiroscopio antes = estadisticasGiroscopio();
+  double errorMax = 0, errorMedio = 0;
+  size_t total = 0;
+  for (int s = 0; s < 20; s++) {
+    halSimCorrer(1000000);
+    MuestraGiroscopio m[GIRO_TAM_BUFFER];
+    size_t n = leerMuestrasGiroscopio(m, GIRO_TAM_BUFFER);
+    for (size_t i = 0; i < n; i++) {
+      double error = (double)m[i].marcaTiempo - instanteMuestra(numeroMuestra(m[i]));
+      errorMedio += error;
+      if (fabs(error) > errorMax) errorMax = fabs(error);
+    }
+    total += n;
+  }
+  EstadisticasGiroscopio despues = estadisticasGiroscopio();
+  TEST_ASSERT_EQUAL_UINT32(antes.resincronizaciones, despues.resincronizaciones);
+  TEST_ASSERT_EQUAL_UINT32(antes.desbordes, despues.desbordes);
+  TEST_ASSERT_UINT32_WITHIN(3, 1e6 / (200 * RELOJ_GIRO), despues.periodoUs);  // 4980 us, no los 5000 nominales
+  TEST_ASSERT_UINT32_WITHIN(2, 20 * 200 * RELOJ_GIRO, total);
+  errorMedio /= total;
+  char mensaje[96];
+  snprintf(mensaje, sizeof mensaje, "error medio %.0f us, maximo %.0f us", errorMedio, errorMax);
+  TEST_MESSAGE(mensaje);
+  TEST_ASSERT_DOUBLE_WITHIN(250, 0, errorMedio);  // Sin deriva: el error no crece con el tiempo
+  TEST_ASSERT_LESS_THAN(1000, errorMax);          // Menos de un quinto de periodo en cualquier muestra
+}
+
+int main(int, char **) {
+  halSimDispositivoI2c(DIRECCION_L3GD20_SA0_ALTO, escribirGiro<DIRECCION_L3GD20_SA0_ALTO>, leerGiro<DIRECCION_L3GD20_SA0_ALTO>);
+  halSimDispositivoI2c(DIRECCION_L3GD20_SA0_BAJO, escribirGiro<DIRECCION_L3GD20_SA0_BAJO>, leerGiro<DIRECCION_L3GD20_SA0_BAJO>);
+  halSimDispositivoI2c(DIRECCION_L3G4200D_SA0_ALTO, escribirGiro<DIRECCION_L3G4200D_SA0_ALTO>, leerGiro<DIRECCION_L3G4200D_SA0_ALTO>);
+  halSimDispositivoI2c(DIRECCION_L3G4200D_SA0_BAJO, escribirGiro<DIRECCION_L3G4200D_SA0_BAJO>, leerGiro<DIRECCION_L3G4200D_SA0_BAJO>);
+  UNITY_BEGIN();
+  RUN_TEST(test_rechaza_tipo_desconocido);
+  RUN_TEST(test_rechaza_sin_dispositivo);
+  RUN_TEST(test_rechaza_who_am_i_de_otro_tipo);
+  RUN_TEST(test_detecta_l3g4200d);
+  RUN_TEST(test_detecta_l3gd20_con_sa0_en_bajo);
+  RUN_TEST(test_rafagas_divididas);
+  RUN_TEST(test_desborde);
+  RUN_TEST(test_lazo_pi_sigue_el_reloj);
+  return UNITY_END();
+}
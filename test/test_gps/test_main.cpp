@@ -0,0 +1,247 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "libgps.h"
+#include "libhal.h"
+#include "libseqlock.h"
+#include "../datos/registro_gps.h"
+
+// Pruebas del GPS con el registro NMEA de test/datos: checksum, frases truncadas y demasiado largas,
+// los campos de RMC y GGA, la tarea del GPS sobre el UART simulado y la consistencia de las copias
+// del seqlock con un escritor y dos lectores en hilos (pio test -e native -f test_gps)
+
+static char registro[REGISTRO_GPS_MAX];
+static size_t largoRegistro;
+
+void setUp(void) { largoRegistro = leerRegistroGPS(registro); }
+void tearDown(void) {}
+
+/**
+ * Funcion que pasa el registro por un interprete
+ * @param fixes Donde se copia el registro despues de cada frase interpretada (REGISTRO_GPS_FRASES)
+ * @return Numero de frases interpretadas
+ */
+static size_t interpretarRegistro(InterpreteNMEA &interprete, RegistroGPS *fixes) {
+  size_t n = 0;
+  for (size_t i = 0; i < largoRegistro; i++)
+    if (interprete.procesar(registro[i], i) && n < REGISTRO_GPS_FRASES) fixes[n++] = interprete.registro();
+  return n;
+}
+
+void test_contadores_del_registro() {
+  TEST_ASSERT_GREATER_THAN(0, largoRegistro);
+  InterpreteNMEA interprete;
+  RegistroGPS fixes[REGISTRO_GPS_FRASES];
+  TEST_ASSERT_EQUAL(REGISTRO_GPS_FRASES, interpretarRegistro(interprete, fixes));
+  TEST_ASSERT_EQUAL_UINT32(REGISTRO_GPS_FRASES, interprete.frases);
+  TEST_ASSERT_EQUAL_UINT32(REGISTRO_GPS_ERRORES_CHECKSUM, interprete.erroresChecksum);
+  TEST_ASSERT_EQUAL_UINT32(REGISTRO_GPS_DESCARTADAS, interprete.descartadas);
+}
+
+void test_checksum() {
+  InterpreteNMEA interprete;
+  const char *mala = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*48\r\n";  // Es 47
+  for (const char *p = mala; *p; p++) TEST_ASSERT_FALSE(interprete.procesar(*p, 0));
+  TEST_ASSERT_EQUAL_UINT32(1, interprete.erroresChecksum);
+  const char *noHex = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*4G\r\n";
+  for (const char *p = noHex; *p; p++) TEST_ASSERT_FALSE(interprete.procesar(*p, 0));
+  TEST_ASSERT_EQUAL_UINT32(2, interprete.erroresChecksum);
+  const char *buena = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n";
+  bool completa = false;
+  for (const char *p = buena; *p; p++) completa |= interprete.procesar(*p, 0);
+  TEST_ASSERT_TRUE(completa);
+  TEST_ASSERT_EQUAL_UINT32(0, interprete.descartadas);
+}
+
+void test_frases_truncadas_y_largas() {
+  InterpreteNMEA interprete;
+  // Sin fin de linea: la frase queda abierta hasta que llega el siguiente '$'
+  const char *truncada = "$GPRMC,123519.00,A,4807.0";
+  for (const char *p = truncada; *p; p++) interprete.procesar(*p, 0);
+  TEST_ASSERT_EQUAL_UINT32(0, interprete.descartadas);
+  interprete.procesar('$', 0);
+  TEST_ASSERT_EQUAL_UINT32(1, interprete.descartadas);
+  // Una frase de exactamente NMEA_TAM_MAX_FRASE caracteres despues del '$' cabe, una mas no
+  char larga[NMEA_TAM_MAX_FRASE + 2];
+  memset(larga, '0', sizeof(larga));
+  for (size_t i = 0; i < NMEA_TAM_MAX_FRASE; i++) interprete.procesar(larga[i], 0);
+  TEST_ASSERT_EQUAL_UINT32(1, interprete.descartadas);
+  interprete.procesar(larga[0], 0);  // El caracter NMEA_TAM_MAX_FRASE + 1
+  TEST_ASSERT_EQUAL_UINT32(2, interprete.descartadas);
+  // Lo que queda de la frase larga se ignora hasta el siguiente '$', sin contarse otra vez
+  const char *resto = "000,*00\r\n";
+  for (const char *p = resto; *p; p++) TEST_ASSERT_FALSE(interprete.procesar(*p, 0));
+  TEST_ASSERT_EQUAL_UINT32(2, interprete.descartadas);
+  TEST_ASSERT_EQUAL_UINT32(0, interprete.erroresChecksum);
+  TEST_ASSERT_EQUAL_UINT32(0, interprete.frases);
+}
+
+void test_campos_rmc() {
+  InterpreteNMEA interprete;
+  RegistroGPS fixes[REGISTRO_GPS_FRASES];
+  interpretarRegistro(interprete, fixes);
+  const RegistroGPS &norte = fixes[0];
+  TEST_ASSERT_TRUE(norte.posicionValida && norte.fechaValida && norte.horaValida);
+  TEST_ASSERT_EQUAL_INT32(48117300, norte.latitud);   // 48°07.038'
+  TEST_ASSERT_EQUAL_INT32(11516667, norte.longitud);  // 11°31.000'
+  TEST_ASSERT_EQUAL_UINT16(1994, norte.anio);         // Dos digitos del año: 94 es de 1994
+  TEST_ASSERT_EQUAL_UINT8(3, norte.mes);
+  TEST_ASSERT_EQUAL_UINT8(23, norte.dia);
+  TEST_ASSERT_EQUAL_UINT8(12, norte.hora);
+  TEST_ASSERT_EQUAL_UINT8(35, norte.minuto);
+  TEST_ASSERT_EQUAL_UINT8(19, norte.segundo);
+
+  const RegistroGPS &sur = fixes[2];  // El GNRMC despues del GGA truncado
+  TEST_ASSERT_TRUE(sur.posicionValida);
+  TEST_ASSERT_EQUAL_INT32(-33752057, sur.latitud);
+  TEST_ASSERT_EQUAL_INT32(-70509463, sur.longitud);
+  TEST_ASSERT_EQUAL_UINT16(2020, sur.anio);
+  TEST_ASSERT_EQUAL_UINT8(1, sur.mes);
+  TEST_ASSERT_EQUAL_UINT8(1, sur.dia);
+  TEST_ASSERT_EQUAL_UINT8(23, sur.hora);
+  TEST_ASSERT_EQUAL_UINT8(59, sur.minuto);
+  TEST_ASSERT_EQUAL_UINT8(59, sur.segundo);
+  TEST_ASSERT_EQUAL_UINT8(50, sur.centesimas);
+
+  const RegistroGPS &sinFix = fixes[5];  // Estado V: hora y fecha sin posicion
+  TEST_ASSERT_FALSE(sinFix.posicionValida);
+  TEST_ASSERT_TRUE(sinFix.fechaValida);
+  TEST_ASSERT_EQUAL_UINT16(2026, sinFix.anio);
+  TEST_ASSERT_EQUAL_UINT8(7, sinFix.mes);
+  TEST_ASSERT_EQUAL_UINT8(15, sinFix.dia);
+}
+
+void test_campos_gga() {
+  InterpreteNMEA interprete;
+  RegistroGPS fixes[REGISTRO_GPS_FRASES];
+  interpretarRegistro(interprete, fixes);
+  const RegistroGPS &conFix = fixes[1];
+  TEST_ASSERT_TRUE(conFix.posicionValida);
+  TEST_ASSERT_EQUAL_UINT8(1, conFix.calidad);
+  TEST_ASSERT_EQUAL_UINT8(8, conFix.satelites);
+  TEST_ASSERT_EQUAL_INT32(54540, conFix.altitudCm);
+  TEST_ASSERT_EQUAL_INT32(48117300, conFix.latitud);
+
+  const RegistroGPS &sinFix = fixes[3];
+  TEST_ASSERT_FALSE(sinFix.posicionValida);
+  TEST_ASSERT_EQUAL_UINT8(0, sinFix.calidad);
+  TEST_ASSERT_EQUAL_UINT8(0, sinFix.satelites);
+  TEST_ASSERT_EQUAL_UINT8(1, sinFix.segundo);
+
+  const RegistroGPS &dgps = fixes[4];  // Checksum en minusculas
+  TEST_ASSERT_TRUE(dgps.posicionValida);
+  TEST_ASSERT_EQUAL_UINT8(2, dgps.calidad);
+  TEST_ASSERT_EQUAL_UINT8(11, dgps.satelites);
+  TEST_ASSERT_EQUAL_INT32(-1230, dgps.altitudCm);
+  TEST_ASSERT_EQUAL_INT32(-70509463, dgps.longitud);
+}
+
+void test_tarea_gps_con_uart_simulado() {
+  TEST_ASSERT_TRUE(iniciarGPS(1, 0));
+  RegistroGPS fix;
+  TEST_ASSERT_EQUAL_UINT32(0, leerGPS(fix));
+  // El registro llega por el UART en trozos, como del GPS a 9600 baudios
+  for (size_t i = 0; i < largoRegistro; i += 48) {
+    size_t n = (largoRegistro - i < 48) ? largoRegistro - i : 48;
+    TEST_ASSERT_EQUAL(n, halSimUartEscribir((const uint8_t *)&registro[i], n));
+    halSimCorrer(50000);
+  }
+  EstadisticasGPS e = estadisticasGPS();
+  TEST_ASSERT_EQUAL_UINT32(largoRegistro, e.bytes);
+  TEST_ASSERT_EQUAL_UINT32(REGISTRO_GPS_FRASES, e.frases);
+  TEST_ASSERT_EQUAL_UINT32(REGISTRO_GPS_ERRORES_CHECKSUM, e.erroresChecksum);
+  TEST_ASSERT_EQUAL_UINT32(REGISTRO_GPS_DESCARTADAS, e.descartadas);
+  TEST_ASSERT_EQUAL_UINT32(0, e.desbordesRx);
+  TEST_ASSERT_EQUAL_UINT32(REGISTRO_GPS_FRASES, e.publicaciones);
+  TEST_ASSERT_EQUAL_UINT32(REGISTRO_GPS_FRASES, leerGPS(fix));
+  TEST_ASSERT_FALSE(fix.posicionValida);  // El ultimo es el RMC sin fix
+  TEST_ASSERT_EQUAL_UINT8(15, fix.dia);
+  TEST_ASSERT_EQUAL_INT32(-1230, fix.altitudCm);  // Lo que no trae el RMC queda del GGA anterior
+  TEST_ASSERT_GREATER_THAN(0, fix.marcaTiempo);
+  TEST_ASSERT_LESS_OR_EQUAL(halMicros(), fix.marcaTiempo);
+}
+
+/**
+ * Registro cuyos campos se derivan todos de un contador: una copia mezclada de dos escrituras no cuadra
+ */
+static void registroDePrueba(uint32_t k, RegistroGPS &r) {
+  memset(&r, 0, sizeof(r));
+  r.marcaTiempo = (uint64_t)k * 1000003;
+  r.latitud = (int32_t)k;
+  r.longitud = -(int32_t)k;
+  r.altitudCm = (int32_t)(k * 7);
+  r.anio = (uint16_t)k;
+  r.segundo = (uint8_t)(k >> 8);
+  r.satelites = (uint8_t)k;
+  r.posicionValida = (k & 1) != 0;
+}
+
+void test_seqlock_con_hilos() {
+  static Seqlock<RegistroGPS> publicado;
+  const uint32_t ESCRITURAS = 200000;
+  std::atomic<bool> terminado(false);
+  std::atomic<uint32_t> inconsistentes(0), retrocesos(0), lecturas(0);
+  auto lector = [&]() {
+    uint32_t ultima = 0;
+    RegistroGPS r, esperado;
+    while (!terminado.load(std::memory_order_relaxed)) {
+      uint32_t n = publicado.leer(r);
+      lecturas++;
+      if (n < ultima) retrocesos++;
+      ultima = n;
+      if (n == 0) continue;
+      registroDePrueba((uint32_t)r.latitud, esperado);
+      if (memcmp(&r, &esperado, sizeof(r)) != 0 || (uint32_t)r.latitud != n) inconsistentes++;
+    }
+  };
+  std::thread lector1(lector), lector2(lector);
+  RegistroGPS r;
+  for (uint32_t k = 1; k <= ESCRITURAS; k++) {
+    registroDePrueba(k, r);
+    publicado.escribir(r);
+  }
+  terminado = true;
+  lector1.join();
+  lector2.join();
+  TEST_ASSERT_EQUAL_UINT32(0, inconsistentes.load());
+  TEST_ASSERT_EQUAL_UINT32(0, retrocesos.load());
+  TEST_ASSERT_GREATER_THAN(0, lecturas.load());
+  TEST_ASSERT_EQUAL_UINT32(ESCRITURAS, publicado.leer(r));
+  TEST_ASSERT_EQUAL_INT32(ESCRITURAS, r.latitud);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_contadores_del_registro);
+  RUN_TEST(test_checksum);
+  RUN_TEST(test_frases_truncadas_y_largas);
+  RUN_TEST(test_campos_rmc);
+  RUN_TEST(test_campos_gga);
+  RUN_TEST(test_tarea_gps_con_uart_simulado);
+  RUN_TEST(test_seqlock_con_hilos);
+  return UNITY_END();
+}
@@ -0,0 +1,202 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <unity.h>
+#include "libhal.h"
+#include "libplanificador.h"
+
+// Pruebas del planificador sobre el HAL simulado: fases y orden de ejecucion segun los divisores,
+// cambio de divisor con el planificador andando y ausencia de deriva respecto a la base de
+// PLAN_FRECUENCIA_BASE ticks por segundo (pio test -e native -f test_planificador)
+
+#define MAX_EJECUCIONES 4096
+
+/**
+ * Ejecucion registrada por un manejador: trabajo y tick de la base en que empezo
+ */
+struct Ejecucion {
+  uint8_t trabajo;
+  uint64_t tick;
+};
+
+static Ejecucion ejecuciones[MAX_EJECUCIONES];
+static size_t numEjecuciones;
+static uint64_t inicioUs;  // halMicros() al arrancar el planificador: el tick 0 de la base
+static int trabajo256, trabajo200, trabajo100, trabajoVariable;
+
+/**
+ * Funcion que convierte el instante actual a ticks de la base
+ */
+static uint64_t tickActual() {
+  return (halMicros() - inicioUs) * PLAN_FRECUENCIA_BASE / 1000000;
+}
+
+template <uint8_t T>
+static void registrarEjecucion() {
+  if (numEjecuciones < MAX_EJECUCIONES) ejecuciones[numEjecuciones++] = Ejecucion{T, tickActual()};
+}
+
+/**
+ * Funcion que copia los ticks en que se ejecuto un trabajo desde la ultima limpieza
+ * @return Numero de ejecuciones copiadas
+ */
+static size_t ticksDe(uint8_t trabajo, uint64_t *ticks, size_t max) {
+  size_t n = 0;
+  for (size_t i = 0; i < numEjecuciones && n < max; i++)
+    if (ejecuciones[i].trabajo == trabajo) ticks[n++] = ejecuciones[i].tick;
+  return n;
+}
+
+static uint32_t faseDe(int trabajo) {
+  EstadisticasTrabajo e;
+  estadisticasTrabajo(trabajo, e);
+  return e.fase;
+}
+
+void setUp(void) { numEjecuciones = 0; }
+void tearDown(void) {}
+
+void test_rechaza_trabajos_invalidos() {
+  TEST_ASSERT_FALSE(iniciarPlanificador(3));  // Sin trabajos
+  TEST_ASSERT_EQUAL_INT(-1, planificadorAgregar("Nulo", NULL, 25, 1, 0));
+  TEST_ASSERT_EQUAL_INT(-1, planificadorAgregar("Cero", registrarEjecucion<9>, 0, 1, 0));
+  TEST_ASSERT_FALSE(planificadorCambiarDivisor(0, 10));  // Aun no existe
+  TEST_ASSERT_EQUAL(0, trabajosPlanificador());
+  TEST_ASSERT_EQUAL_UINT32(25, planificadorDivisor(256));
+  TEST_ASSERT_EQUAL_UINT32(32, planificadorDivisor(200));
+  TEST_ASSERT_EQUAL_UINT32(1, planificadorDivisor(100000));
+}
+
+void test_fases_por_divisor() {
+  // Se registran en desorden: el de 100 Hz primero. Los tres primeros comparten hilo (nucleo 0, prioridad 1)
+  trabajo100 = planificadorAgregar("100 Hz", registrarEjecucion<2>, planificadorDivisor(100), 1, 0);
+  trabajo256 = planificadorAgregar("256 Hz", registrarEjecucion<0>, planificadorDivisor(256), 1, 0);
+  trabajo200 = planificadorAgregar("200 Hz", registrarEjecucion<1>, planificadorDivisor(200), 1, 0);
+  trabajoVariable = planificadorAgregar("Variable", registrarEjecucion<3>, 50, 2, 1);
+  TEST_ASSERT_EQUAL(4, trabajosPlanificador());
+  inicioUs = halMicros();
+  TEST_ASSERT_TRUE(iniciarPlanificador(3));
+  TEST_ASSERT_FALSE(iniciarPlanificador(3));  // Solo se arranca una vez
+  TEST_ASSERT_EQUAL_INT(-1, planificadorAgregar("Tarde", registrarEjecucion<9>, 25, 1, 0));
+
+  // El de mayor tasa se coloca primero en la fase 0. Los divisores 25 y 32 son coprimos (coinciden
+  // igual en cualquier fase), 64 comparte 32 con el de 200 Hz y se aparta de su fase
+  TEST_ASSERT_EQUAL_UINT32(0, faseDe(trabajo256));
+  TEST_ASSERT_EQUAL_UINT32(0, faseDe(trabajo200));
+  TEST_ASSERT_NOT_EQUAL(0, faseDe(trabajo100) % 32);
+  TEST_ASSERT_NOT_EQUAL(0, faseDe(trabajoVariable) % 25);  // mcd(50, 25) = 25
+  TEST_ASSERT_NOT_EQUAL(faseDe(trabajo100) % 2, faseDe(trabajoVariable) % 2);  // mcd(64, 50) = 2
+
+  // En un segundo cada trabajo corre PLAN_FRECUENCIA_BASE / divisor veces, en ticks fase + k * divisor
+  halSimCorrer(1000000);
+  const int ids[3] = {trabajo256, trabajo200, trabajo100};
+  const uint32_t divisores[3] = {25, 32, 64};
+  uint64_t ticks[512];
+  for (uint8_t j = 0; j < 3; j++) {
+    size_t n = ticksDe(j, ticks, 512);
+    TEST_ASSERT_UINT32_WITHIN(1, PLAN_FRECUENCIA_BASE / divisores[j], n);
+    for (size_t k = 0; k < n; k++) TEST_ASSERT_EQUAL_UINT64(faseDe(ids[j]) + (k + 1) * divisores[j], ticks[k]);
+  }
+  // Los que vencen en el mismo tick en el mismo hilo corren en el orden en que se registraron
+  size_t coincidencias = 0;
+  for (size_t i = 1; i < numEjecuciones; i++) {
+    const Ejecucion &a = ejecuciones[i - 1], &b = ejecuciones[i];
+    if (a.tick != b.tick || a.trabajo == 3 || b.trabajo == 3) continue;
+    coincidencias++;
+    uint8_t ordenRegistro[3] = {1, 2, 0};  // 256 Hz, 200 Hz y 100 Hz se registraron segundo, tercero y primero
+    TEST_ASSERT_LESS_THAN(ordenRegistro[b.trabajo], ordenRegistro[a.trabajo]);
+  }
+  TEST_ASSERT_GREATER_THAN(0, coincidencias);
+}
+
+void test_cambio_de_divisor_en_la_siguiente_liberacion() {
+  halSimCorrer(1000 + 12 * 1000000 / PLAN_FRECUENCIA_BASE);  // A mitad de un periodo del trabajo variable
+  numEjecuciones = 0;
+  TEST_ASSERT_TRUE(planificadorCambiarDivisor(trabajoVariable, 80));
+  TEST_ASSERT_FALSE(planificadorCambiarDivisor(trabajoVariable, 0));
+  TEST_ASSERT_FALSE(planificadorCambiarDivisor(PLAN_MAX_TRABAJOS, 80));
+  uint64_t pedido = tickActual();
+  halSimCorrer(200000);
+  uint64_t ticks[64];
+  size_t n = ticksDe(3, ticks, 64);
+  TEST_ASSERT_GREATER_THAN(3, n);
+  // El periodo en curso termina con el divisor anterior: la siguiente ejecucion es la que ya estaba programada
+  TEST_ASSERT_EQUAL_UINT64(0, (ticks[0] - faseDe(trabajoVariable)) % 50);
+  TEST_ASSERT_LESS_OR_EQUAL(pedido + 50, ticks[0]);
+  TEST_ASSERT_GREATER_THAN(pedido, ticks[0]);
+  // Y desde esa liberacion el periodo ya es el nuevo, sin ejecuciones perdidas ni repetidas
+  for (size_t k = 1; k < n; k++) TEST_ASSERT_EQUAL_UINT64(ticks[k - 1] + 80, ticks[k]);
+  EstadisticasTrabajo e;
+  TEST_ASSERT_TRUE(estadisticasTrabajo(trabajoVariable, e));
+  TEST_ASSERT_EQUAL_UINT32(80, e.divisor);
+  TEST_ASSERT_EQUAL_UINT32(0, e.sobrecargas);
+
+  // Un cambio pedido en el mismo tick de una liberacion, ya atendida, espera a que termine el periodo que empezo
+  uint64_t ultimo = ticks[n - 1];
+  while (tickActual() < ultimo + 80) halSimCorrer(1);
+  numEjecuciones = 0;
+  TEST_ASSERT_TRUE(planificadorCambiarDivisor(trabajoVariable, 50));
+  halSimCorrer(100000);
+  n = ticksDe(3, ticks, 64);
+  TEST_ASSERT_GREATER_THAN(2, n);
+  TEST_ASSERT_EQUAL_UINT64(ultimo + 160, ticks[0]);
+  for (size_t k = 1; k < n; k++) TEST_ASSERT_EQUAL_UINT64(ticks[k - 1] + 50, ticks[k]);
+}
+
+void test_sin_deriva() {
+  EstadisticasTrabajo antes[3], despues[3];
+  const int ids[3] = {trabajo256, trabajo200, trabajo100};
+  for (uint8_t j = 0; j < 3; j++) estadisticasTrabajo(ids[j], antes[j]);
+  uint64_t tickInicial = tickActual();
+  const uint32_t SEGUNDOS = 60;
+  uint64_t ultimoTick[3] = {0, 0, 0};
+  uint32_t retrasoMaximo = 0;
+  for (uint32_t s = 0; s < SEGUNDOS; s++) {
+    numEjecuciones = 0;
+    halSimCorrer(1000000);
+    for (size_t i = 0; i < numEjecuciones; i++)
+      if (ejecuciones[i].trabajo < 3) ultimoTick[ejecuciones[i].trabajo] = ejecuciones[i].tick;
+  }
+  const uint32_t divisores[3] = {25, 32, 64};
+  for (uint8_t j = 0; j < 3; j++) {
+    estadisticasTrabajo(ids[j], despues[j]);
+    uint64_t esperadas = (uint64_t)SEGUNDOS * PLAN_FRECUENCIA_BASE / divisores[j];
+    TEST_ASSERT_UINT64_WITHIN(1, esperadas, despues[j].ejecuciones - antes[j].ejecuciones);
+    TEST_ASSERT_EQUAL_UINT32(0, despues[j].sobrecargas);
+    // Despues de un minuto la ultima ejecucion sigue cayendo exactamente en su tick: el error no se acumula
+    TEST_ASSERT_EQUAL_UINT64(faseDe(ids[j]) % divisores[j], ultimoTick[j] % divisores[j]);
+    TEST_ASSERT_GREATER_OR_EQUAL(tickInicial + (uint64_t)SEGUNDOS * PLAN_FRECUENCIA_BASE - divisores[j], ultimoTick[j]);
+    if (despues[j].retrasoMaximoUs > retrasoMaximo) retrasoMaximo = despues[j].retrasoMaximoUs;
+  }
+  TEST_ASSERT_LESS_THAN(1000000 / PLAN_FRECUENCIA_BASE, retrasoMaximo);  // Cada uno empieza antes del tick siguiente
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_rechaza_trabajos_invalidos);
+  RUN_TEST(test_fases_por_divisor);
+  RUN_TEST(test_cambio_de_divisor_en_la_siguiente_liberacion);
+  RUN_TEST(test_sin_deriva);
+  return UNITY_END();
+}
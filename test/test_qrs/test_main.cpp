@@ -0,0 +1,268 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <unity.h>
+#include <math.h>
+#include "libqrs.h"
+#include "../datos/ekg_referencia.h"
+
+// Pruebas del detector de QRS: sensibilidad y valor predictivo positivo sobre el segmento de EKG de
+// referencia de test/datos con sus picos R anotados, y con latidos sinteticos el periodo refractario,
+// el descarte de ondas T y la adaptacion del umbral a un cambio de amplitud (pio test -e native -f test_qrs)
+
+#define FS EKG_REFERENCIA_FS
+#define TOLERANCIA_MUESTRAS (FS * 75 / 1000)  // Un pico R a menos de 75 ms del anotado es un acierto (ANSI/AAMI EC57)
+#define MAX_DETECCIONES 256
+
+static EkgReferencia ekg;
+static int16_t senal[EKG_REFERENCIA_MAX];  // Señal sintetica de las pruebas de casos limite
+static DetectorQRS<FS> detector;
+
+/**
+ * Detecciones de una pasada del detector, en muestras
+ */
+struct Resultado {
+  uint32_t muestras[MAX_DETECCIONES];
+  bool recuperados[MAX_DETECCIONES];
+  size_t n;
+};
+
+/**
+ * Funcion que pasa una señal completa por un detector recien reiniciado
+ */
+static void detectar(const int16_t *x, size_t len, Resultado &r) {
+  detector.reiniciar();
+  r.n = 0;
+  DeteccionQRS d[2];
+  for (size_t i = 0; i < len; i++) {
+    size_t n = detector.procesar(x[i], (uint64_t)i * 1000000 / FS, d);
+    for (size_t k = 0; k < n && r.n < MAX_DETECCIONES; k++, r.n++) {
+      r.muestras[r.n] = (uint32_t)((d[k].marcaTiempo * FS + 500000) / 1000000);
+      r.recuperados[r.n] = d[k].recuperado;
+    }
+  }
+}
+
+/**
+ * Funcion que suma un latido sintetico (P, Q, R, S y T gaussianas) con el pico R en una muestra
+ * @param ondaT Amplitud de la onda T relativa al R
+ */
+static void agregarLatido(int16_t *x, size_t len, uint32_t r, double amplitud, double ondaT = 0.35) {
+  static const double onda[5][3] = {  // Centro (s), ancho (s), amplitud relativa al R
+      {-0.20, 0.025, 0.12}, {-0.03, 0.010, -0.12}, {0, 0.011, 1}, {0.03, 0.010, -0.25}, {0.26, 0.050, 0}};
+  for (int32_t n = (int32_t)r - FS / 2; n < (int32_t)r + FS * 7 / 10; n++) {
+    if (n < 0 || n >= (int32_t)len) continue;
+    double t = (double)(n - (int32_t)r) / FS, v = 0;
+    for (uint8_t i = 0; i < 5; i++) {
+      double a = (i == 4) ? ondaT : onda[i][2];
+      v += a * exp(-(t - onda[i][0]) * (t - onda[i][0]) / (2 * onda[i][1] * onda[i][1]));
+    }
+    x[n] = (int16_t)(x[n] + lround(amplitud * v));
+  }
+}
+
+/**
+ * Funcion que arma un ritmo regular de un RR dado entre dos muestras, con ruido de +-4 cuentas
+ * @return Numero de latidos
+ */
+static size_t ritmoRegular(uint32_t *picos, size_t max, uint32_t desde, uint32_t hasta, uint32_t rr, double amplitud) {
+  size_t n = 0;
+  for (uint32_t r = desde; r < hasta && n < max; r += rr) {
+    agregarLatido(senal, EKG_REFERENCIA_MAX, r, amplitud);
+    picos[n++] = r;
+  }
+  return n;
+}
+
+static void ruido(size_t len) {
+  uint32_t azar = 12345;
+  for (size_t i = 0; i < len; i++) {
+    azar = azar * 1103515245 + 12345;
+    senal[i] = (int16_t)((azar >> 16) % 9) - 4;
+  }
+}
+
+/**
+ * Funcion que empareja detecciones y anotaciones (las dos ordenadas) despues del aprendizaje
+ * @param verdaderos Aciertos
+ * @param falsos Detecciones sin anotacion
+ * @param perdidos Anotaciones sin deteccion
+ */
+static void emparejar(const uint32_t *anotados, size_t numAnotados, const Resultado &r, size_t &verdaderos,
+                      size_t &falsos, size_t &perdidos) {
+  const uint32_t inicio = FS * QRS_APRENDIZAJE_MS / 1000 + FS / 2;
+  verdaderos = falsos = perdidos = 0;
+  size_t j = 0;
+  for (size_t a = 0; a < numAnotados; a++) {
+    while (j < r.n && r.muestras[j] + TOLERANCIA_MUESTRAS < anotados[a]) {
+      if (r.muestras[j] >= inicio) falsos++;
+      j++;
+    }
+    bool acierto = j < r.n && r.muestras[j] <= anotados[a] + TOLERANCIA_MUESTRAS;
+    if (acierto) j++;
+    if (anotados[a] < inicio) continue;
+    if (acierto) verdaderos++;
+    else perdidos++;
+  }
+  for (; j < r.n; j++)
+    if (r.muestras[j] >= inicio) falsos++;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_referencia_sensibilidad_y_vpp() {
+  TEST_ASSERT_EQUAL(EKG_REFERENCIA_MAX, leerEkgReferencia(ekg));
+  TEST_ASSERT_EQUAL(69, ekg.numPicos);
+  Resultado r;
+  detectar(ekg.muestras, ekg.numMuestras, r);
+  size_t vp, fp, fn;
+  emparejar(ekg.picos, ekg.numPicos, r, vp, fp, fn);
+  char mensaje[96];
+  snprintf(mensaje, sizeof mensaje, "%u aciertos, %u falsos, %u perdidos", (unsigned)vp, (unsigned)fp, (unsigned)fn);
+  TEST_MESSAGE(mensaje);
+  double sensibilidad = (double)vp / (vp + fn), vpp = (double)vp / (vp + fp);
+  TEST_ASSERT_GREATER_OR_EQUAL(0.98, sensibilidad);  // A lo sumo un latido perdido
+  TEST_ASSERT_GREATER_OR_EQUAL(0.98, vpp);           // Y a lo sumo una deteccion falsa
+}
+
+void test_referencia_precision_del_pico_r() {
+  leerEkgReferencia(ekg);
+  Resultado r;
+  detectar(ekg.muestras, ekg.numMuestras, r);
+  // Los latidos normales se ubican en la muestra de mayor amplitud: a 1 muestra del anotado
+  size_t j = 0, normales = 0;
+  for (size_t a = 0; a < ekg.numPicos; a++) {
+    while (j < r.n && r.muestras[j] + TOLERANCIA_MUESTRAS < ekg.picos[a]) j++;
+    if (j == r.n || r.muestras[j] > ekg.picos[a] + TOLERANCIA_MUESTRAS || ekg.clases[a] != 'N') continue;
+    TEST_ASSERT_INT_WITHIN(1, ekg.picos[a], r.muestras[j]);
+    normales++;
+  }
+  TEST_ASSERT_GREATER_THAN(60, normales);
+}
+
+void test_refractario() {
+  const size_t LARGO = 12 * FS;
+  ruido(LARGO);
+  uint32_t picos[32];
+  size_t n = ritmoRegular(picos, 32, FS / 2, LARGO - FS, FS * 5 / 6, 600);  // 72 lpm
+  // Un complejo menor a 150 ms del latido de los 8 s cae dentro del periodo refractario y no cuenta
+  uint32_t base = 0;
+  for (size_t i = 0; i < n; i++)
+    if (picos[i] >= 8 * FS) {
+      base = picos[i];
+      break;
+    }
+  agregarLatido(senal, LARGO, base + FS * 150 / 1000, 450);
+  Resultado r;
+  detectar(senal, LARGO, r);
+  size_t cerca = 0;
+  for (size_t i = 0; i < r.n; i++)
+    if (r.muestras[i] + FS / 10 >= base && r.muestras[i] < base + FS / 2) cerca++;
+  TEST_ASSERT_EQUAL(1, cerca);
+  size_t vp, fp, fn;
+  emparejar(picos, n, r, vp, fp, fn);
+  TEST_ASSERT_EQUAL(0, fp);
+  TEST_ASSERT_EQUAL(0, fn);
+
+  // Pasado el refractario (250 ms) un complejo con la misma pendiente si es un latido, aunque llegue antes
+  // que la ventana de la onda T
+  ruido(LARGO);
+  n = ritmoRegular(picos, 32, FS / 2, LARGO - FS, FS * 5 / 6, 600);
+  agregarLatido(senal, LARGO, base + FS * 250 / 1000, 600);
+  detectar(senal, LARGO, r);
+  cerca = 0;
+  for (size_t i = 0; i < r.n; i++)
+    if (r.muestras[i] + FS / 10 >= base && r.muestras[i] < base + FS / 2) cerca++;
+  TEST_ASSERT_EQUAL(2, cerca);
+}
+
+void test_onda_t_alta_no_es_latido() {
+  const size_t LARGO = 20 * FS;
+  ruido(LARGO);
+  uint32_t picos[40];
+  size_t n = 0;
+  for (uint32_t p = FS / 2; p < LARGO - FS; p += FS * 5 / 6) {  // Ondas T del 90% del R
+    agregarLatido(senal, LARGO, p, 600, 0.9);
+    picos[n++] = p;
+  }
+  Resultado r;
+  detectar(senal, LARGO, r);
+  size_t vp, fp, fn;
+  emparejar(picos, n, r, vp, fp, fn);
+  TEST_ASSERT_EQUAL(0, fp);
+  TEST_ASSERT_EQUAL(0, fn);
+}
+
+void test_umbral_sigue_la_amplitud() {
+  // 20 s a 900 cuentas, 20 s a la cuarta parte y 20 s al doble de la original
+  const size_t LARGO = 60 * FS;
+  ruido(LARGO);
+  uint32_t picos[96];
+  size_t n = ritmoRegular(picos, 96, FS / 2, 20 * FS, FS * 5 / 6, 900);
+  size_t inicioBajo = n;
+  n += ritmoRegular(&picos[n], 96 - n, picos[n - 1] + FS * 5 / 6, 40 * FS, FS * 5 / 6, 225);
+  size_t inicioAlto = n;
+  n += ritmoRegular(&picos[n], 96 - n, picos[n - 1] + FS * 5 / 6, LARGO - FS, FS * 5 / 6, 1800);
+
+  detector.reiniciar();
+  DeteccionQRS d[2];
+  Resultado r = {};
+  uint32_t umbralAlto = 0, umbralBajo = 0;
+  for (size_t i = 0; i < LARGO; i++) {
+    size_t k = detector.procesar(senal[i], (uint64_t)i * 1000000 / FS, d);
+    for (size_t j = 0; j < k && r.n < MAX_DETECCIONES; j++, r.n++) {
+      r.muestras[r.n] = (uint32_t)((d[j].marcaTiempo * FS + 500000) / 1000000);
+      r.recuperados[r.n] = d[j].recuperado;
+    }
+    if (i == picos[inicioBajo] - FS / 4) umbralAlto = detector.umbralActual();
+    if (i == picos[inicioAlto] - FS / 4) umbralBajo = detector.umbralActual();
+  }
+  TEST_ASSERT_LESS_THAN(umbralAlto / 4, umbralBajo);  // La integral va con el cuadrado de la amplitud
+
+  // Al bajar la amplitud solo se pierden los primeros latidos mientras la busqueda hacia atras baja el
+  // umbral, y los que se recuperan asi salen marcados
+  size_t vp, fp, fn;
+  emparejar(&picos[inicioBajo], inicioAlto - inicioBajo, r, vp, fp, fn);
+  TEST_ASSERT_LESS_OR_EQUAL(3, fn);
+  size_t recuperados = 0;
+  for (size_t i = 0; i < r.n; i++)
+    if (r.recuperados[i] && r.muestras[i] >= picos[inicioBajo] && r.muestras[i] < picos[inicioAlto]) recuperados++;
+  TEST_ASSERT_GREATER_THAN(0, recuperados);
+  // Al subir, el umbral alcanza a la señal sin detecciones falsas
+  emparejar(&picos[inicioAlto], n - inicioAlto, r, vp, fp, fn);
+  TEST_ASSERT_EQUAL(0, fn);
+  emparejar(picos, n, r, vp, fp, fn);
+  TEST_ASSERT_EQUAL(0, fp);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_referencia_sensibilidad_y_vpp);
+  RUN_TEST(test_referencia_precision_del_pico_r);
+  RUN_TEST(test_refractario);
+  RUN_TEST(test_onda_t_alta_no_es_latido);
+  RUN_TEST(test_umbral_sigue_la_amplitud);
+  return UNITY_END();
+}
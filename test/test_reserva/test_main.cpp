@@ -0,0 +1,191 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "libreserva.h"
+#include "libadcbloques.h"
+
+// Pruebas de la reserva de bloques con conteo de referencias: agotamiento, regreso de un bloque con
+// la ultima referencia, contadores, reservas y liberaciones desde varios hilos a la vez, y la
+// recepcion de los bloques del DMA en la reserva (pio test -e native -f test_reserva)
+
+#define HILOS 4
+#define CICLOS_HILO 200000
+
+/**
+ * Bloque de la prueba de concurrencia: el dueño se marca con un atomico, asi dos hilos con el mismo
+ * bloque se detectan sin una carrera de datos
+ */
+struct BloqueConcurrencia {
+  std::atomic<uint32_t> dueno;
+};
+
+static uint16_t senalPrueba(uint8_t canal, uint32_t n) {
+  return (uint16_t)((n * 37 + canal * 1000) & 0x0FFF);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_agotamiento() {
+  static ReservaBloques<uint32_t, 4> reserva;
+  uint32_t *bloques[4];
+  for (uint8_t i = 0; i < 4; i++) {
+    bloques[i] = reserva.reservar();
+    TEST_ASSERT_NOT_NULL(bloques[i]);
+    for (uint8_t j = 0; j < i; j++) TEST_ASSERT_TRUE(bloques[i] != bloques[j]);
+  }
+  TEST_ASSERT_NULL(reserva.reservar());
+  TEST_ASSERT_NULL(reserva.reservar());
+  TEST_ASSERT_EQUAL_UINT32(2, reserva.estadisticas().agotados);
+  // El ultimo que vuelve es el primero que sale (la lista libre es una pila)
+  TEST_ASSERT_TRUE(reserva.liberar(bloques[2]));
+  TEST_ASSERT_TRUE(reserva.reservar() == bloques[2]);
+  TEST_ASSERT_NULL(reserva.reservar());
+  for (uint32_t *b : bloques) TEST_ASSERT_TRUE(reserva.liberar(b));
+  TEST_ASSERT_EQUAL_UINT32(0, reserva.estadisticas().ocupados);
+}
+
+void test_libera_con_la_ultima_referencia() {
+  static ReservaBloques<uint32_t, 2> reserva;
+  uint32_t *bloque = reserva.reservar();
+  TEST_ASSERT_EQUAL_UINT32(1, reserva.referenciasDe(bloque));
+  reserva.retener(bloque);  // Dos consumidores lo guardan para despues
+  reserva.retener(bloque);
+  TEST_ASSERT_EQUAL_UINT32(3, reserva.referenciasDe(bloque));
+  TEST_ASSERT_FALSE(reserva.liberar(bloque));  // Quien lo reservo
+  TEST_ASSERT_FALSE(reserva.liberar(bloque));
+  TEST_ASSERT_EQUAL_UINT32(1, reserva.estadisticas().ocupados);
+  uint32_t *otro = reserva.reservar();  // Mientras alguien lo tenga no se entrega de nuevo
+  TEST_ASSERT_TRUE(otro != bloque);
+  TEST_ASSERT_NULL(reserva.reservar());
+  TEST_ASSERT_TRUE(reserva.liberar(bloque));  // La ultima referencia lo devuelve
+  TEST_ASSERT_EQUAL_UINT32(0, reserva.referenciasDe(bloque));
+  TEST_ASSERT_TRUE(reserva.reservar() == bloque);
+  TEST_ASSERT_TRUE(reserva.liberar(bloque));
+  TEST_ASSERT_TRUE(reserva.liberar(otro));
+}
+
+void test_estadisticas() {
+  static ReservaBloques<uint32_t, 3> reserva;
+  EstadisticasReserva e = reserva.estadisticas();
+  TEST_ASSERT_EQUAL_UINT32(3, e.capacidad);
+  TEST_ASSERT_EQUAL_UINT32(0, e.ocupados);
+  TEST_ASSERT_EQUAL_UINT32(0, e.maximoOcupados);
+  uint32_t *a = reserva.reservar(), *b = reserva.reservar();
+  reserva.liberar(a);
+  uint32_t *c = reserva.reservar();
+  reserva.liberar(b);
+  reserva.liberar(c);
+  for (uint8_t i = 0; i < 3; i++) reserva.liberar(reserva.reservar());
+  e = reserva.estadisticas();
+  TEST_ASSERT_EQUAL_UINT32(6, e.reservados);
+  TEST_ASSERT_EQUAL_UINT32(0, e.ocupados);
+  TEST_ASSERT_EQUAL_UINT32(2, e.maximoOcupados);  // El maximo se queda aunque ya esten libres
+  TEST_ASSERT_EQUAL_UINT32(0, e.agotados);
+}
+
+void test_hilos() {
+  // Cada hilo toma un bloque, lo comparte consigo mismo y lo suelta; con menos bloques que hilos
+  // tambien se agota. Un bloque con dos dueños es un error
+  static ReservaBloques<BloqueConcurrencia, HILOS / 2> reserva;
+  std::atomic<uint32_t> conflictos(0), obtenidos(0);
+  std::vector<std::thread> hilos;
+  for (uint32_t h = 1; h <= HILOS; h++)
+    hilos.emplace_back([h, &conflictos, &obtenidos]() {
+      for (uint32_t i = 0; i < CICLOS_HILO; i++) {
+        BloqueConcurrencia *b = reserva.reservar();
+        if (!b) continue;
+        obtenidos.fetch_add(1, std::memory_order_relaxed);
+        if (b->dueno.exchange(h) != 0) conflictos.fetch_add(1, std::memory_order_relaxed);
+        reserva.retener(b);
+        reserva.liberar(b);
+        if (b->dueno.exchange(0) != h) conflictos.fetch_add(1, std::memory_order_relaxed);
+        reserva.liberar(b);
+      }
+    });
+  for (std::thread &hilo : hilos) hilo.join();
+  EstadisticasReserva e = reserva.estadisticas();
+  TEST_ASSERT_EQUAL_UINT32(0, conflictos.load());
+  TEST_ASSERT_EQUAL_UINT32(0, e.ocupados);
+  TEST_ASSERT_EQUAL_UINT32(obtenidos.load(), e.reservados);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)HILOS * CICLOS_HILO, e.reservados + e.agotados);
+  TEST_ASSERT_LESS_OR_EQUAL(HILOS / 2, e.maximoOcupados);
+  // Despues de todo la lista libre sigue entera
+  BloqueConcurrencia *a = reserva.reservar(), *b = reserva.reservar();
+  TEST_ASSERT_TRUE(a != NULL && b != NULL && a != b);
+  TEST_ASSERT_NULL(reserva.reservar());
+  reserva.liberar(a);
+  reserva.liberar(b);
+}
+
+void test_recepcion_de_bloques_del_dma() {
+  const uint8_t canales[3] = {7, 5, 4};
+  static ReservaBloquesADC reserva;
+  static ReceptorBloques receptor(reserva);
+  static uint16_t esperados[ADC_BLOQUE_MAX_PALABRAS];
+  FuenteADCSimulada fuente(senalPrueba), copia(senalPrueba);
+
+  // Fuente sin iniciar: se vence el tiempo y el bloque vuelve a la reserva
+  TEST_ASSERT_NULL(receptor.esperar(fuente, 3, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, reserva.estadisticas().ocupados);
+
+  TEST_ASSERT_TRUE(fuente.iniciar(256, canales, 3, 32));
+  TEST_ASSERT_TRUE(copia.iniciar(256, canales, 3, 32));
+  for (uint8_t paso = 0; paso < 2; paso++) {
+    // En el segundo paso otro retiene toda la reserva y los bloques llegan en el propio del receptor
+    BloqueMuestras *retenidos[ADC_RESERVA_BLOQUES];
+    if (paso == 1)
+      for (BloqueMuestras *&b : retenidos) b = reserva.reservar();
+    for (uint8_t n = 0; n < 4; n++) {
+      BloqueMuestras *bloque = receptor.esperar(fuente, 3, 0);
+      TEST_ASSERT_NOT_NULL(bloque);
+      TEST_ASSERT_EQUAL_UINT16(32, bloque->muestras);
+      TEST_ASSERT_EQUAL_UINT8(3, bloque->canales);
+      TEST_ASSERT_EQUAL(32, copia.esperarBloque(esperados, 0));
+      TEST_ASSERT_EQUAL_UINT16_ARRAY(esperados, bloque->datos, 32 * 3);
+      TEST_ASSERT_EQUAL_UINT32(paso == 0 ? 1 : ADC_RESERVA_BLOQUES, reserva.estadisticas().ocupados);
+      receptor.soltar(bloque);
+      TEST_ASSERT_EQUAL_UINT32(paso == 0 ? 0 : ADC_RESERVA_BLOQUES, reserva.estadisticas().ocupados);
+    }
+    if (paso == 1)
+      for (BloqueMuestras *b : retenidos) TEST_ASSERT_TRUE(reserva.liberar(b));
+  }
+  EstadisticasReserva e = reserva.estadisticas();
+  TEST_ASSERT_EQUAL_UINT32(4, e.agotados);
+  TEST_ASSERT_EQUAL_UINT32(0, e.ocupados);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_agotamiento);
+  RUN_TEST(test_libera_con_la_ultima_referencia);
+  RUN_TEST(test_estadisticas);
+  RUN_TEST(test_hilos);
+  RUN_TEST(test_recepcion_de_bloques_del_dma);
+  return UNITY_END();
+}
@@ -0,0 +1,192 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <thread>
+#include "libringbuffer.h"
+
+// Pruebas del BufferCircular SPSC y de sus vistas sin copia (pio test -e native -f test_ringbuffer)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * Vacio al crearlo, lleno con N muestras: la siguiente se descarta y se cuenta
+ */
+void test_lleno_y_vacio(void) {
+  BufferCircular<uint16_t, 8> b;
+  uint16_t v;
+  TEST_ASSERT_EQUAL(0, b.disponibles());
+  TEST_ASSERT_FALSE(b.pop(v));
+  for (uint16_t i = 0; i < 8; i++) TEST_ASSERT_TRUE(b.push(i));
+  TEST_ASSERT_EQUAL(8, b.disponibles());
+  TEST_ASSERT_FALSE(b.push(99));
+  TEST_ASSERT_EQUAL(1, b.perdidas());
+  for (uint16_t i = 0; i < 8; i++) {
+    TEST_ASSERT_TRUE(b.pop(v));
+    TEST_ASSERT_EQUAL(i, v);
+  }
+  TEST_ASSERT_FALSE(b.pop(v));
+  TEST_ASSERT_EQUAL(0, b.disponibles());
+}
+
+/**
+ * Muchas vueltas al buffer: el orden se mantiene y el lleno/vacio se distingue en cada posicion
+ */
+void test_vueltas(void) {
+  BufferCircular<uint32_t, 4> b;
+  uint32_t escrito = 0, leido = 0, v;
+  for (int vuelta = 0; vuelta < 1000; vuelta++) {
+    size_t n = 1 + vuelta % 4;  // Lotes de 1 a 4 para pasar por todas las posiciones
+    for (size_t i = 0; i < n; i++) TEST_ASSERT_TRUE(b.push(escrito++));
+    for (size_t i = 0; i < n; i++) {
+      TEST_ASSERT_TRUE(b.pop(v));
+      TEST_ASSERT_EQUAL_UINT32(leido++, v);
+    }
+    TEST_ASSERT_EQUAL(0, b.disponibles());
+  }
+  TEST_ASSERT_EQUAL(0, b.perdidas());
+}
+
+/**
+ * Construir en el lugar: lo reservado no se ve hasta publicar(), y con el buffer lleno no hay lugar
+ */
+void test_reservar_y_publicar(void) {
+  struct Paquete {
+    uint8_t len;
+    uint8_t datos[16];
+  };
+  BufferCircular<Paquete, 4> b;
+  for (int vuelta = 0; vuelta < 3; vuelta++) {
+    for (uint8_t i = 0; i < 4; i++) {
+      Paquete *p = b.reservar();
+      TEST_ASSERT_NOT_NULL(p);
+      p->len = i;
+      p->datos[0] = (uint8_t)(vuelta * 10 + i);
+      TEST_ASSERT_EQUAL(i, b.disponibles());  // Aun no publicado
+      b.publicar();
+    }
+    TEST_ASSERT_NULL(b.reservar());
+    TEST_ASSERT_EQUAL((uint32_t)vuelta + 1, b.perdidas());
+    Ventana<Paquete> w = b.primeras(4);
+    TEST_ASSERT_EQUAL(4, w.size());
+    for (uint8_t i = 0; i < 4; i++) {
+      TEST_ASSERT_EQUAL(i, w[i].len);
+      TEST_ASSERT_EQUAL(vuelta * 10 + i, w[i].datos[0]);
+    }
+    b.descartar(3);
+    Paquete ultimo;
+    TEST_ASSERT_TRUE(b.pop(ultimo));
+    TEST_ASSERT_EQUAL(3, ultimo.len);
+  }
+}
+
+/**
+ * Vistas partidas en dos tramos cuando el rango da la vuelta al final del buffer
+ */
+void test_ventana_partida(void) {
+  BufferCircular<uint16_t, 8> b;
+  uint16_t v;
+  for (uint16_t i = 0; i < 6; i++) b.push(i);
+  for (int i = 0; i < 6; i++) b.pop(v);  // La cola queda en la posicion 6
+  for (uint16_t i = 100; i < 105; i++) b.push(i);
+
+  Ventana<uint16_t> w = b.primeras(5);
+  TEST_ASSERT_EQUAL(5, w.size());
+  TEST_ASSERT_EQUAL(2, w.lenA);  // Posiciones 6 y 7
+  TEST_ASSERT_EQUAL(3, w.lenB);  // Posiciones 0 a 2
+  for (size_t i = 0; i < 5; i++) TEST_ASSERT_EQUAL(100 + i, w[i]);
+
+  Ventana<uint16_t> u = b.ultimas(3);
+  TEST_ASSERT_EQUAL(3, u.size());
+  for (size_t i = 0; i < 3; i++) TEST_ASSERT_EQUAL(102 + i, u[i]);
+
+  TEST_ASSERT_EQUAL(5, b.primeras(50).size());  // Se recorta a las disponibles
+  b.descartar(2);
+  TEST_ASSERT_EQUAL(3, b.disponibles());
+  TEST_ASSERT_TRUE(b.pop(v));
+  TEST_ASSERT_EQUAL(102, v);
+  b.descartar(50);
+  TEST_ASSERT_EQUAL(0, b.disponibles());
+  TEST_ASSERT_EQUAL(0, b.primeras(4).size());
+}
+
+/**
+ * Un productor y un consumidor en hilos distintos: el consumidor ve todas las muestras en orden,
+ * sin repetidas ni perdidas (el productor reintenta cuando el buffer esta lleno)
+ */
+void test_orden_spsc(void) {
+  static BufferCircular<uint32_t, 64> b;
+  const uint32_t TOTAL = 200000;
+  std::thread productor([]() {
+    for (uint32_t i = 0; i < TOTAL;)
+      if (b.push(i)) i++;
+      else std::this_thread::yield();
+  });
+  uint32_t esperado = 0, desordenadas = 0, v;
+  while (esperado < TOTAL) {
+    if (!b.pop(v)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (v != esperado) desordenadas++;
+    esperado = v + 1;
+  }
+  productor.join();
+  TEST_ASSERT_EQUAL_UINT32(0, desordenadas);
+  TEST_ASSERT_EQUAL(0, b.disponibles());
+}
+
+/**
+ * Lo mismo consumiendo por vistas: el consumidor lee sin copiar y libera con descartar()
+ */
+void test_orden_spsc_ventanas(void) {
+  static BufferCircular<uint32_t, 64> b;
+  const uint32_t TOTAL = 200000;
+  std::thread productor([]() {
+    for (uint32_t i = 0; i < TOTAL;)
+      if (b.push(i)) i++;
+      else std::this_thread::yield();
+  });
+  uint32_t esperado = 0, desordenadas = 0;
+  while (esperado < TOTAL) {
+    Ventana<uint32_t> w = b.primeras(16);
+    if (w.size() == 0) std::this_thread::yield();
+    for (size_t i = 0; i < w.size(); i++)
+      if (w[i] != esperado++) desordenadas++;
+    b.descartar(w.size());
+  }
+  productor.join();
+  TEST_ASSERT_EQUAL_UINT32(0, desordenadas);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_lleno_y_vacio);
+  RUN_TEST(test_vueltas);
+  RUN_TEST(test_reservar_y_publicar);
+  RUN_TEST(test_ventana_partida);
+  RUN_TEST(test_orden_spsc);
+  RUN_TEST(test_orden_spsc_ventanas);
+  return UNITY_END();
+}
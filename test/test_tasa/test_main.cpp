@@ -0,0 +1,135 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include "libtasa.h"
+
+// Pruebas del controlador de la tasa adaptativa: cuando baja y sube, y como se deshace un cambio
+// que la adquisicion no pudo aplicar (pio test -e native -f test_tasa)
+
+#define TIEMPO_QUIETO_PRUEBA_MS 1000
+#define VENTANA_US ((uint64_t)TASA_VENTANA_MS * 1000)
+
+static ControladorTasa controlador;
+static uint64_t ahora;
+
+void setUp(void) {
+  controlador.configurar(256, 32, UMBRAL_ENERGIA_GIRO, UMBRAL_VARIANZA_ADC, TIEMPO_QUIETO_PRUEBA_MS);
+  ahora = 1000000;
+}
+void tearDown(void) {}
+
+/**
+ * Funcion que pasa una ventana de TASA_VENTANA_MS por el controlador
+ * @param movimiento true para que el giroscopio pase el umbral de energia
+ * @param cambio Donde se escribe el cambio, si lo hay
+ * @return Lo que devuelve revisar() al final de la ventana
+ */
+static bool pasarVentana(bool movimiento, CambioTasa &cambio) {
+  uint32_t muestras = controlador.frecuencia() * TASA_VENTANA_MS / 1000;
+  for (uint32_t i = 0; i < muestras; i++) controlador.agregarAdc(2048 + (i & 1));
+  MuestraGiroscopio giro = {};
+  giro.x = movimiento ? 2000 : 10;
+  for (uint32_t i = 0; i < 50; i++) controlador.agregarGiroscopio(giro);
+  ahora += VENTANA_US;
+  return controlador.revisar(ahora, cambio);
+}
+
+/**
+ * Funcion que deja al controlador en reposo
+ */
+static void llevarAReposo() {
+  CambioTasa cambio;
+  controlador.revisar(ahora, cambio);  // La primera llamada abre la primera ventana
+  while (!pasarVentana(false, cambio)) TEST_ASSERT_TRUE(ahora < 10000000);
+  TEST_ASSERT_TRUE(controlador.enReposo());
+}
+
+/**
+ * Sin actividad baja a la tasa de reposo despues de TIEMPO_QUIETO_PRUEBA_MS y sube con la primera
+ * ventana con movimiento
+ */
+void test_baja_y_sube(void) {
+  CambioTasa cambio;
+  controlador.revisar(ahora, cambio);
+  uint64_t inicio = ahora;
+  while (!pasarVentana(false, cambio)) {}
+  TEST_ASSERT_EQUAL_UINT64(inicio + TIEMPO_QUIETO_PRUEBA_MS * 1000, ahora);
+  TEST_ASSERT_EQUAL_UINT16(32, cambio.frecuenciaHz);
+  TEST_ASSERT_EQUAL(TASA_QUIETO, cambio.motivo);
+  TEST_ASSERT_FALSE(pasarVentana(false, cambio));
+  TEST_ASSERT_TRUE(pasarVentana(true, cambio));
+  TEST_ASSERT_EQUAL_UINT16(256, cambio.frecuenciaHz);
+  TEST_ASSERT_EQUAL(TASA_GIROSCOPIO, cambio.motivo);
+  TEST_ASSERT_EQUAL_UINT32(2, controlador.cambios);
+  TEST_ASSERT_EQUAL_UINT64(2 * VENTANA_US, controlador.tiempoReposoUs(ahora));
+}
+
+/**
+ * Una bajada cancelada deja al controlador en la tasa alta sin contarla, y la siguiente ventana
+ * quieta la vuelve a pedir
+ */
+void test_cancelar_bajada(void) {
+  CambioTasa cambio;
+  controlador.revisar(ahora, cambio);
+  while (!pasarVentana(false, cambio)) {}
+  controlador.cancelar(cambio);
+  TEST_ASSERT_FALSE(controlador.enReposo());
+  TEST_ASSERT_EQUAL_UINT16(256, controlador.frecuencia());
+  TEST_ASSERT_EQUAL_UINT32(0, controlador.cambios);
+  TEST_ASSERT_EQUAL_UINT32(1, controlador.fallos);
+  TEST_ASSERT_EQUAL_UINT64(0, controlador.tiempoReposoUs(ahora));
+  TEST_ASSERT_TRUE(pasarVentana(false, cambio));
+  TEST_ASSERT_EQUAL_UINT16(32, cambio.frecuenciaHz);
+  TEST_ASSERT_EQUAL_UINT32(1, controlador.cambios);
+}
+
+/**
+ * Una subida cancelada deja al controlador en reposo sin cortar el tramo en reposo ni contar el
+ * disparo, y la siguiente ventana con movimiento la vuelve a pedir
+ */
+void test_cancelar_subida(void) {
+  llevarAReposo();
+  uint64_t desde = ahora;
+  CambioTasa cambio;
+  TEST_ASSERT_TRUE(pasarVentana(true, cambio));
+  controlador.cancelar(cambio);
+  TEST_ASSERT_TRUE(controlador.enReposo());
+  TEST_ASSERT_EQUAL_UINT16(32, controlador.frecuencia());
+  TEST_ASSERT_EQUAL_UINT32(1, controlador.cambios);
+  TEST_ASSERT_EQUAL_UINT32(0, controlador.disparosGiroscopio);
+  TEST_ASSERT_EQUAL_UINT32(1, controlador.fallos);
+  TEST_ASSERT_EQUAL_UINT64(ahora - desde, controlador.tiempoReposoUs(ahora));
+  TEST_ASSERT_TRUE(pasarVentana(true, cambio));
+  TEST_ASSERT_EQUAL_UINT16(256, cambio.frecuenciaHz);
+  TEST_ASSERT_EQUAL_UINT32(1, controlador.disparosGiroscopio);
+  TEST_ASSERT_EQUAL_UINT64(ahora - desde, controlador.tiempoReposoUs(ahora));
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_baja_y_sube);
+  RUN_TEST(test_cancelar_bajada);
+  RUN_TEST(test_cancelar_subida);
+  return UNITY_END();
+}
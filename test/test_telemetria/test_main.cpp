@@ -0,0 +1,322 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "libtelemetria.h"
+
+// Pruebas de la trama de telemetria COBS y de su decodificador de flujo (pio test -e native -f test_telemetria)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * Funcion que arma una trama de prueba
+ * @param secuencia Numero de secuencia
+ */
+static TramaTelemetria tramaPrueba(uint16_t secuencia) {
+  TramaTelemetria t;
+  t.secuencia = secuencia;
+  t.marcaTiempo = 123456789u + secuencia * 2000u;
+  t.adc[0] = 0x0ABC;
+  t.adc[1] = 0x0123;
+  t.adc[2] = 0x0FFF;
+  t.milivoltios = false;
+  t.reposo = false;
+  t.gyro[0] = -1;
+  t.gyro[1] = 32767;
+  t.gyro[2] = -32768;
+  return t;
+}
+
+/**
+ * Funcion que pasa una trama codificada por el decodificador de flujo
+ * @return true si el ultimo byte (el delimitador) completo una trama valida
+ */
+static bool alimentar(DecodificadorTelemetria &dec, const uint8_t *bytes, size_t len, TramaTelemetria &trama) {
+  bool valida = false;
+  for (size_t i = 0; i < len; i++) valida = dec.procesar(bytes[i], trama);
+  return valida;
+}
+
+/**
+ * Codificar y decodificar devuelve exactamente los mismos campos, en cuentas y en milivoltios
+ */
+void test_ida_y_vuelta(void) {
+  for (int variante = 0; variante < 4; variante++) {
+    TramaTelemetria t = tramaPrueba(4242);
+    t.milivoltios = variante & 1;
+    t.reposo = variante & 2;
+    uint8_t cod[TELEMETRIA_TAM_MAX];
+    size_t n = codificarTrama(t, cod);
+    TEST_ASSERT_LESS_OR_EQUAL(TELEMETRIA_TAM_MAX, n);
+    TEST_ASSERT_EQUAL_HEX8(0x00, cod[n - 1]);
+    TramaTelemetria r;
+    TEST_ASSERT_TRUE(decodificarTrama(cod, n - 1, r));
+    TEST_ASSERT_EQUAL_UINT16(t.secuencia, r.secuencia);
+    TEST_ASSERT_EQUAL_UINT32(t.marcaTiempo, r.marcaTiempo);
+    for (int i = 0; i < 3; i++) {
+      TEST_ASSERT_EQUAL_UINT16(t.adc[i], r.adc[i]);
+      TEST_ASSERT_EQUAL_INT16(t.gyro[i], r.gyro[i]);
+    }
+    TEST_ASSERT_EQUAL(t.milivoltios, r.milivoltios);
+    TEST_ASSERT_EQUAL(t.reposo, r.reposo);
+  }
+}
+
+/**
+ * Una trama llena de ceros (secuencia 0x0100, ADC y giroscopio en 0) no deja ningun 0x00 antes del
+ * delimitador y se recupera intacta
+ */
+void test_ceros_embebidos(void) {
+  TramaTelemetria t = tramaPrueba(0x0100);
+  t.marcaTiempo = 0;
+  for (int i = 0; i < 3; i++) {
+    t.adc[i] = 0;
+    t.gyro[i] = 0;
+  }
+  uint8_t cod[TELEMETRIA_TAM_MAX];
+  size_t n = codificarTrama(t, cod);
+  for (size_t i = 0; i + 1 < n; i++) TEST_ASSERT_NOT_EQUAL(0x00, cod[i]);
+  DecodificadorTelemetria dec;
+  TramaTelemetria r;
+  TEST_ASSERT_TRUE(alimentar(dec, cod, n, r));
+  TEST_ASSERT_EQUAL_UINT16(0x0100, r.secuencia);
+  TEST_ASSERT_EQUAL_UINT32(0, r.marcaTiempo);
+  TEST_ASSERT_EQUAL_UINT16(0, r.adc[1]);
+  TEST_ASSERT_EQUAL_INT16(0, r.gyro[2]);
+
+  uint8_t bloque[600], codificado[610], decodificado[610];  // Bloques de mas de 254 bytes sin ceros y todo en ceros
+  for (int relleno = 0; relleno < 2; relleno++) {
+    for (size_t i = 0; i < sizeof(bloque); i++) bloque[i] = relleno ? 0x00 : (uint8_t)(i % 255 + 1);
+    size_t m = cobsCodificar(bloque, sizeof(bloque), codificado);
+    TEST_ASSERT_LESS_OR_EQUAL(sizeof(bloque) + sizeof(bloque) / 254 + 1, m);
+    TEST_ASSERT_NULL(memchr(codificado, 0x00, m));
+    TEST_ASSERT_EQUAL(sizeof(bloque), cobsDecodificar(codificado, m, decodificado));
+    TEST_ASSERT_EQUAL_MEMORY(bloque, decodificado, sizeof(bloque));
+  }
+}
+
+/**
+ * Un bit cambiado en cualquier byte de la trama se descarta: por CRC si el COBS sigue bien formado,
+ * por formato si no. Nunca se entrega una trama corrupta.
+ */
+void test_crc_corrupto(void) {
+  TramaTelemetria t = tramaPrueba(7);
+  uint8_t cod[TELEMETRIA_TAM_MAX];
+  size_t n = codificarTrama(t, cod);
+  DecodificadorTelemetria dec;
+  TramaTelemetria r;
+  uint32_t intentos = 0;
+  for (size_t i = 0; i + 1 < n; i++) {
+    for (int bit = 0; bit < 8; bit++) {
+      uint8_t corrupto[TELEMETRIA_TAM_MAX];
+      memcpy(corrupto, cod, n);
+      corrupto[i] ^= 1 << bit;
+      if (corrupto[i] == 0x00) continue;  // Eso seria un delimitador, no una trama corrupta
+      TEST_ASSERT_FALSE(alimentar(dec, corrupto, n, r));
+      intentos++;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, dec.tramasValidas);
+  TEST_ASSERT_EQUAL_UINT32(intentos, dec.erroresCrc + dec.erroresFormato);
+  TEST_ASSERT_GREATER_THAN(0, dec.erroresCrc);
+
+  uint8_t carga[TELEMETRIA_TAM_CARGA];  // Trama bien formada con el CRC alterado: cuenta como error de CRC
+  TEST_ASSERT_EQUAL(TELEMETRIA_TAM_CARGA, cobsDecodificar(cod, n - 1, carga));
+  carga[18] ^= 0x01;
+  n = cobsCodificar(carga, TELEMETRIA_TAM_CARGA, cod);
+  cod[n++] = 0x00;
+  uint32_t previos = dec.erroresCrc;
+  TEST_ASSERT_FALSE(alimentar(dec, cod, n, r));
+  TEST_ASSERT_EQUAL_UINT32(previos + 1, dec.erroresCrc);
+
+  n = codificarTrama(t, cod);  // Despues del ruido el decodificador se resincroniza en el siguiente delimitador
+  TEST_ASSERT_TRUE(alimentar(dec, cod, n, r));
+  TEST_ASSERT_EQUAL_UINT32(1, dec.tramasValidas);
+}
+
+/**
+ * Los saltos de secuencia se cuentan como perdidas, tambien a traves del desborde de 16 bits;
+ * las repetidas no
+ */
+void test_conteo_de_perdidas(void) {
+  const uint16_t secuencias[] = {65530, 65531, 65534, 1, 2, 2, 1, 10};  // Faltan 2 + 2 (65535, 0) + 8 (3..10 tras volver a 1)
+  DecodificadorTelemetria dec;
+  TramaTelemetria r;
+  for (uint16_t s : secuencias) {
+    uint8_t cod[TELEMETRIA_TAM_MAX];
+    size_t n = codificarTrama(tramaPrueba(s), cod);
+    TEST_ASSERT_TRUE(alimentar(dec, cod, n, r));
+    TEST_ASSERT_EQUAL_UINT16(s, r.secuencia);
+  }
+  TEST_ASSERT_EQUAL_UINT32(sizeof(secuencias) / sizeof(secuencias[0]), dec.tramasValidas);
+  TEST_ASSERT_EQUAL_UINT32(2 + 2 + 8, dec.perdidas);
+  TEST_ASSERT_EQUAL_UINT32(0, dec.erroresCrc + dec.erroresFormato);
+}
+
+/**
+ * La marca de 32 bits se desborda cada 71.6 minutos; el decodificador la sigue a 64 bits a traves
+ * del desborde, tambien con una trama repetida de antes del desborde
+ */
+void test_desborde_de_marca(void) {
+  const uint32_t marcas[] = {0xFFFFF000u, 0xFFFFF800u, 0x00000100u, 0xFFFFF800u, 0x00000900u};
+  const uint64_t esperadas[] = {0xFFFFF000ull, 0xFFFFF800ull, 0x100000100ull, 0xFFFFF800ull, 0x100000900ull};
+  DecodificadorTelemetria dec;
+  TramaTelemetria r;
+  for (size_t i = 0; i < sizeof(marcas) / sizeof(marcas[0]); i++) {
+    TramaTelemetria t = tramaPrueba((uint16_t)i);
+    t.marcaTiempo = marcas[i];
+    uint8_t cod[TELEMETRIA_TAM_MAX];
+    size_t n = codificarTrama(t, cod);
+    TEST_ASSERT_TRUE(alimentar(dec, cod, n, r));
+    TEST_ASSERT_EQUAL_UINT32(marcas[i], r.marcaTiempo);
+    TEST_ASSERT_TRUE(esperadas[i] == dec.marcaExtendida);
+  }
+  uint64_t marca = 0;  // Varias vueltas completas en pasos de 20 minutos
+  for (uint32_t paso = 0; paso < 20; paso++) {
+    uint64_t real = (uint64_t)paso * 1200000000ull;
+    marca = extenderMarcaTiempo(marca, (uint32_t)real);
+    TEST_ASSERT_TRUE(real == marca);
+  }
+}
+
+/**
+ * Basura sin delimitador que desborda el buffer y delimitadores seguidos: solo la basura es error
+ */
+void test_desborde_y_delimitadores(void) {
+  DecodificadorTelemetria dec;
+  TramaTelemetria r;
+  for (int i = 0; i < 2 * TELEMETRIA_TAM_MAX_TEXTO; i++) TEST_ASSERT_FALSE(dec.procesar(0x55, r));
+  TEST_ASSERT_FALSE(dec.procesar(0x00, r));
+  TEST_ASSERT_FALSE(dec.procesar(0x00, r));
+  TEST_ASSERT_EQUAL_UINT32(1, dec.erroresFormato);
+  uint8_t cod[TELEMETRIA_TAM_MAX];
+  size_t n = codificarTrama(tramaPrueba(1), cod);
+  TEST_ASSERT_TRUE(alimentar(dec, cod, n, r));
+}
+
+static uint32_t textosRecibidos;
+static char ultimoTexto[TELEMETRIA_TEXTO_MAX + 1];
+
+/**
+ * Receptor de los mensajes de diagnostico del decodificador de flujo en las pruebas
+ */
+static void recibirTexto(const char *texto, size_t len) {
+  textosRecibidos++;
+  memcpy(ultimoTexto, texto, len + 1);
+}
+
+/**
+ * Un mensaje de diagnostico (con un 0x00 en medio) sale igual de la trama de texto
+ */
+void test_texto_ida_y_vuelta(void) {
+  const char mensaje[] = "Toque en los pads 0x\0" "3";
+  uint8_t cod[TELEMETRIA_TAM_MAX_TEXTO];
+  size_t n = codificarTexto(mensaje, sizeof(mensaje) - 1, cod);
+  TEST_ASSERT_EQUAL_UINT8(0x00, cod[n - 1]);
+  for (size_t i = 0; i < n - 1; i++) TEST_ASSERT_NOT_EQUAL(0x00, cod[i]);
+  char texto[TELEMETRIA_TEXTO_MAX + 1];
+  size_t largo = 0;
+  TEST_ASSERT_TRUE(decodificarTexto(cod, n - 1, texto, largo));
+  TEST_ASSERT_EQUAL_UINT32(sizeof(mensaje) - 1, largo);
+  TEST_ASSERT_EQUAL_MEMORY(mensaje, texto, largo);
+  TramaTelemetria r;
+  TEST_ASSERT_FALSE(decodificarTrama(cod, n - 1, r));  // Una trama de texto nunca pasa por una de telemetria
+}
+
+/**
+ * Un texto mas largo que TELEMETRIA_TEXTO_MAX se recorta y cabe en TELEMETRIA_TAM_MAX_TEXTO
+ */
+void test_texto_largo(void) {
+  char largoTexto[3 * TELEMETRIA_TEXTO_MAX];
+  memset(largoTexto, 'x', sizeof(largoTexto));
+  uint8_t cod[TELEMETRIA_TAM_MAX_TEXTO];
+  size_t n = codificarTexto(largoTexto, sizeof(largoTexto), cod);
+  TEST_ASSERT_TRUE(n <= TELEMETRIA_TAM_MAX_TEXTO);
+  char texto[TELEMETRIA_TEXTO_MAX + 1];
+  size_t largo = 0;
+  TEST_ASSERT_TRUE(decodificarTexto(cod, n - 1, texto, largo));
+  TEST_ASSERT_EQUAL_UINT32(TELEMETRIA_TEXTO_MAX, largo);
+  TEST_ASSERT_EQUAL_INT(0, texto[largo]);
+}
+
+/**
+ * Los mensajes intercalados con la telemetria se entregan aparte: no son errores ni cortan la secuencia
+ */
+void test_texto_intercalado(void) {
+  DecodificadorTelemetria dec;
+  dec.alRecibirTexto = recibirTexto;
+  textosRecibidos = 0;
+  uint8_t cod[TELEMETRIA_TAM_MAX_TEXTO];
+  TramaTelemetria r;
+  uint32_t validas = 0;
+  for (uint16_t s = 1; s <= 20; s++) {
+    size_t n = codificarTrama(tramaPrueba(s), cod);
+    if (alimentar(dec, cod, n, r)) validas++;
+    if (s % 5 == 0) {
+      char mensaje[32];
+      int len = snprintf(mensaje, sizeof(mensaje), "Mensaje %u", s);
+      n = codificarTexto(mensaje, len, cod);
+      TEST_ASSERT_FALSE(alimentar(dec, cod, n, r));
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(20, validas);
+  TEST_ASSERT_EQUAL_UINT32(4, dec.tramasTexto);
+  TEST_ASSERT_EQUAL_UINT32(4, textosRecibidos);
+  TEST_ASSERT_EQUAL_STRING("Mensaje 20", ultimoTexto);
+  TEST_ASSERT_EQUAL_UINT32(0, dec.erroresCrc + dec.erroresFormato + dec.perdidas);
+}
+
+/**
+ * Una trama de texto con un bit cambiado cuenta como error de CRC y no llega al receptor
+ */
+void test_texto_corrupto(void) {
+  DecodificadorTelemetria dec;
+  dec.alRecibirTexto = recibirTexto;
+  textosRecibidos = 0;
+  uint8_t cod[TELEMETRIA_TAM_MAX_TEXTO];
+  size_t n = codificarTexto("Medidas en cero", 15, cod);
+  cod[5] ^= 0x04;
+  TramaTelemetria r;
+  TEST_ASSERT_FALSE(alimentar(dec, cod, n, r));
+  TEST_ASSERT_EQUAL_UINT32(0, dec.tramasTexto);
+  TEST_ASSERT_EQUAL_UINT32(0, textosRecibidos);
+  TEST_ASSERT_EQUAL_UINT32(1, dec.erroresCrc);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ida_y_vuelta);
+  RUN_TEST(test_ceros_embebidos);
+  RUN_TEST(test_crc_corrupto);
+  RUN_TEST(test_conteo_de_perdidas);
+  RUN_TEST(test_desborde_de_marca);
+  RUN_TEST(test_desborde_y_delimitadores);
+  RUN_TEST(test_texto_ida_y_vuelta);
+  RUN_TEST(test_texto_largo);
+  RUN_TEST(test_texto_intercalado);
+  RUN_TEST(test_texto_corrupto);
+  return UNITY_END();
+}
@@ -0,0 +1,151 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2020 Alvaro Salazar <alvaro@denkitronik.com>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <unity.h>
+#include "libtouch.h"
+#include "../datos/traza_touch.h"
+
+// Pruebas del detector de un touchpad con la traza de test/datos: la linea base sigue la deriva,
+// las caidas cortas y los rebotes no cambian el estado, la histeresis y la recalibracion de una
+// pulsacion demasiado larga (pio test -e native -f test_touch)
+
+#define SENSIBILIDAD 25  // La de los pads del simulador
+
+static LecturaTraza traza[TRAZA_TOUCH_MAX];
+static size_t largoTraza;
+
+/**
+ * Transicion esperada de un pad en la traza
+ */
+struct Transicion {
+  uint32_t tiempoMs;
+  uint8_t pad;
+  bool pulsado;
+};
+
+void setUp(void) { largoTraza = leerTrazaTouch(traza); }
+void tearDown(void) {}
+
+/**
+ * Funcion que pasa la traza por un detector por pad
+ * @param detectores Un detector por pad, se inician con la primera lectura
+ * @param transiciones Donde se escriben las transiciones encontradas
+ * @param max Capacidad de transiciones
+ * @return Numero de transiciones
+ */
+static size_t recorrerTraza(DetectorTouch *detectores, Transicion *transiciones, size_t max) {
+  size_t n = 0;
+  for (uint8_t p = 0; p < TRAZA_TOUCH_PADS; p++) detectores[p].iniciar(traza[0].valor[p], SENSIBILIDAD);
+  for (size_t i = 1; i < largoTraza; i++)
+    for (uint8_t p = 0; p < TRAZA_TOUCH_PADS; p++) {
+      int8_t cambio = detectores[p].actualizar(traza[i].valor[p], (uint64_t)traza[i].tiempoMs * 1000);
+      if (cambio != 0 && n < max) transiciones[n++] = Transicion{traza[i].tiempoMs, p, cambio > 0};
+    }
+  return n;
+}
+
+/**
+ * La traza tiene exactamente las pulsaciones del guion, cada una confirmada en la tercera lectura
+ * seguida: las caidas de una y dos lecturas no cuentan y un rebote reinicia la cuenta
+ */
+void test_transiciones_de_la_traza(void) {
+  TEST_ASSERT_EQUAL(1201, largoTraza);
+  const Transicion esperadas[] = {
+      {2040, 0, true},  {2170, 0, false},  // El rebote de 2010 ms atrasa la confirmacion a 2040 ms
+      {4020, 1, true},  {4140, 1, false},  {4340, 1, true}, {4440, 1, false},
+      {6020, 2, true},  {7520, 2, false},
+      {9020, 0, true},  {9070, 1, true},   {9420, 0, false}, {9420, 1, false}};
+  DetectorTouch detectores[TRAZA_TOUCH_PADS];
+  Transicion encontradas[32];
+  size_t n = recorrerTraza(detectores, encontradas, 32);
+  TEST_ASSERT_EQUAL(sizeof(esperadas) / sizeof(esperadas[0]), n);
+  for (size_t i = 0; i < n; i++) {
+    TEST_ASSERT_EQUAL_UINT32(esperadas[i].tiempoMs, encontradas[i].tiempoMs);
+    TEST_ASSERT_EQUAL_UINT8(esperadas[i].pad, encontradas[i].pad);
+    TEST_ASSERT_EQUAL(esperadas[i].pulsado, encontradas[i].pulsado);
+  }
+  for (uint8_t p = 0; p < TRAZA_TOUCH_PADS; p++) TEST_ASSERT_FALSE(detectores[p].estaPulsado());
+}
+
+/**
+ * La linea base sigue la deriva lenta de los pads 0 y 1 (120 y 48 cuentas en 12 s) y el umbral
+ * de pulsacion queda en el porcentaje configurado de ella
+ */
+void test_linea_base_sigue_la_deriva(void) {
+  DetectorTouch detectores[TRAZA_TOUCH_PADS];
+  Transicion encontradas[32];
+  recorrerTraza(detectores, encontradas, 32);
+  const uint16_t finales[TRAZA_TOUCH_PADS] = {1380, 1668, 1380};  // Lineas base de la traza a los 12 s
+  for (uint8_t p = 0; p < TRAZA_TOUCH_PADS; p++) {
+    TEST_ASSERT_UINT16_WITHIN(8, finales[p], detectores[p].lineaBase());
+    TEST_ASSERT_UINT16_WITHIN(2, detectores[p].lineaBase() * (100 - SENSIBILIDAD) / 100, detectores[p].umbral());
+  }
+}
+
+/**
+ * Mientras el pad esta pulsado la linea base no se mueve, y entre el umbral de pulsacion y el de
+ * soltar (histeresis de media sensibilidad) el pad sigue pulsado
+ */
+void test_histeresis_y_base_congelada(void) {
+  DetectorTouch d;
+  d.iniciar(2000, 20);  // Pulsa por debajo de 1600, suelta por encima de 1800
+  TEST_ASSERT_EQUAL_UINT16(1600, d.umbral());
+  TEST_ASSERT_EQUAL_UINT16(1800, d.umbralSoltar());
+  uint64_t t = 0;
+  for (int i = 0; i < TOUCH_CONFIRMACIONES - 1; i++) TEST_ASSERT_EQUAL_INT8(0, d.actualizar(1000, t += 10000));
+  TEST_ASSERT_EQUAL_INT8(1, d.actualizar(1000, t += 10000));
+  for (int i = 0; i < 50; i++) TEST_ASSERT_EQUAL_INT8(0, d.actualizar(1700, t += 10000));  // Entre los dos umbrales
+  TEST_ASSERT_TRUE(d.estaPulsado());
+  TEST_ASSERT_EQUAL_UINT16(2000, d.lineaBase());
+  for (int i = 0; i < TOUCH_CONFIRMACIONES - 1; i++) TEST_ASSERT_EQUAL_INT8(0, d.actualizar(1900, t += 10000));
+  TEST_ASSERT_EQUAL_INT8(-1, d.actualizar(1900, t += 10000));
+  TEST_ASSERT_FALSE(d.enTransicion());
+}
+
+/**
+ * Una pulsacion de mas de TOUCH_MAX_PULSADO_US se toma como deriva: el pad se suelta, la lectura
+ * pasa a ser la linea base y sigue sin pulsar aunque la lectura no cambie
+ */
+void test_recalibracion_de_pulsacion_larga(void) {
+  DetectorTouch d;
+  d.iniciar(1500, SENSIBILIDAD);
+  uint64_t t = 0;
+  for (int i = 0; i < TOUCH_CONFIRMACIONES; i++) d.actualizar(900, t += 10000);
+  TEST_ASSERT_TRUE(d.estaPulsado());
+  uint64_t inicio = t;
+  for (t += 100000; t - inicio <= TOUCH_MAX_PULSADO_US; t += 100000) TEST_ASSERT_EQUAL_INT8(0, d.actualizar(900, t));
+  TEST_ASSERT_EQUAL_INT8(-1, d.actualizar(900, t));
+  TEST_ASSERT_EQUAL_UINT32(1, d.totalRecalibraciones());
+  TEST_ASSERT_EQUAL_UINT16(900, d.lineaBase());
+  for (int i = 0; i < 20; i++) TEST_ASSERT_EQUAL_INT8(0, d.actualizar(900, t += 10000));
+  TEST_ASSERT_FALSE(d.estaPulsado());
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_transiciones_de_la_traza);
+  RUN_TEST(test_linea_base_sigue_la_deriva);
+  RUN_TEST(test_histeresis_y_base_congelada);
+  RUN_TEST(test_recalibracion_de_pulsacion_larga);
+  return UNITY_END();
+}